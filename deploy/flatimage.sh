@@ -31,7 +31,6 @@ BINARIES=(
   dwarfs_aio
   overlayfs
   unionfs
-  magick
 )
 FIM_FILE_TOOLS="/flatimage/build/tools.json"
 FIM_FILE_META="/flatimage/build/meta.json"
@@ -63,7 +62,6 @@ function _fetch_binaries()
     dwarfs_aio="$(< ./meta/dwarfs_aio.json)" \
     overlayfs="$(< ./meta/overlayfs.json)" \
     unionfs="$(< ./meta/unionfs.json)" \
-    magick="$(< ./meta/magick.json)" \
     | tr -d '\n' > "$FIM_DIR_BUILD/meta.json"
 
   # Tools to include in the source with #embed
@@ -15,6 +15,7 @@
 #include "../lib/linux.hpp"
 #include "../lib/env.hpp"
 #include "../lib/log.hpp"
+#include "../lib/span.hpp"
 #include "../parser/executor.hpp"
 #include "../config.hpp"
 #include "relocate.hpp"
@@ -41,11 +42,18 @@ extern char** environ;
 {
   using ns_db::ns_portal::ns_dispatcher::deserialize;
   // Create configuration object
-  std::shared_ptr<ns_config::FlatImage> fim = Pop(ns_config::config());
+  std::shared_ptr<ns_config::FlatImage> fim;
+  {
+    ns_span::Span span("config");
+    fim = Pop(ns_config::config());
+  }
   return_if(fim == nullptr, Error("E::Failed to initialize configuration"));
   // Set log file, permissive
   ns_log::set_sink_file(fim->logs.path_file_boot);
+  // Extract optional tools when they are first needed
+  ns_relocate::enable_lazy(fim->path.bin.self, fim->path.dir.app, fim->path.dir.app_bin);
   // Execute flatimage command if exists
+  ns_span::Span span("execute");
   return Pop(ns_parser::execute_command(*fim, argc, argv));
 }
 
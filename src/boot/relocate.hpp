@@ -6,15 +6,31 @@
  * @copyright Copyright (c) 2025 Ruan Formigoni
  */
 
+#include <algorithm>
+#include <atomic>
 #include <expected>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <system_error>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <print>
+#include <ranges>
 
 #include "../macro.hpp"
 #include "../lib/env.hpp"
 #include "../lib/elf.hpp"
+#include "../lib/span.hpp"
 #include "../db/db.hpp"
 #include "../std/expected.hpp"
 #include "../config.hpp"
@@ -70,6 +86,143 @@ constexpr std::array<const char*,403> const arr_busybox_applet
   "wc","wget","which","who","whoami","whois","xargs","xxd","xz","xzcat","yes","zcat","zcip",
 };
 
+// Tools extracted on the first run, the others are extracted when they are searched for
+constexpr std::array<const char*,7> const arr_tool_eager
+{
+  "bash", "busybox", "bwrap", "dwarfs_aio", "fim_janitor", "fim_portal", "fim_portal_daemon"
+};
+
+/**
+ * @brief Creates the identity of an extracted binary, as recorded in the tools manifest
+ *
+ * @param path_file Path to the extracted binary
+ * @return std::optional<std::string> The identity '<size>:<inode>:<mtime>', or nothing if the
+ * file does not exist
+ */
+[[nodiscard]] inline std::optional<std::string> identity(fs::path const& path_file)
+{
+  struct statx stx{};
+  return_if(::statx(AT_FDCWD, path_file.c_str(), AT_SYMLINK_NOFOLLOW, STATX_SIZE | STATX_INO | STATX_MTIME, &stx) != 0
+    , std::nullopt
+  );
+  return std::format("{}:{}:{}.{}", stx.stx_size, stx.stx_ino, stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec);
+}
+
+/**
+ * @brief Replaces the tools manifest atomically
+ *
+ * @param path_file_manifest Path to the manifest
+ * @param db_manifest The contents to write
+ */
+inline void write_manifest(fs::path const& path_file_manifest, ns_db::Db& db_manifest)
+{
+  fs::path path_file_manifest_temp = std::format("{}.tmp.{}", path_file_manifest.string(), getpid());
+  ns_db::write_file(path_file_manifest_temp, db_manifest).discard("E::Could not write tools manifest");
+  Catch(fs::rename(path_file_manifest_temp, path_file_manifest)).discard("E::Could not rename tools manifest");
+}
+
+/**
+ * @brief Layout of the binaries in the flatimage file
+ *
+ * The main ELF is followed by the boot ELF and the tools of FIM_FILE_TOOLS, each prefixed by its
+ * size, and then by the reserved space. The layout is parsed once from the headers, with a pread
+ * for each of them on the same file descriptor.
+ */
+struct Image
+{
+  /**
+   * @brief A binary of the image and its [begin,end) range in the file
+   */
+  struct Section
+  {
+    std::string name;
+    uint64_t offset_beg;
+    uint64_t offset_end;
+  };
+  uint64_t size;                 ///< Size of the file
+  uint64_t offset_elf_end;       ///< First byte after the main ELF
+  Section boot;                  ///< The boot binary
+  std::vector<Section> tools;    ///< The tools, in the order of FIM_FILE_TOOLS
+  uint64_t offset_reserved;      ///< First byte after the binaries, where the reserved space starts
+
+  [[nodiscard]] static Value<Image> parse(int fd);
+};
+
+/**
+ * @brief Parses the layout of the image
+ *
+ * @param fd File descriptor of the flatimage file
+ * @return Value<Image> The layout, or the respective error
+ */
+inline Value<Image> Image::parse(int fd)
+{
+  struct stat st{};
+  return_if(::fstat(fd, &st) < 0, Error("E::Could not stat flatimage binary: {}", strerror(errno)));
+  Image image{};
+  image.size = static_cast<uint64_t>(st.st_size);
+  image.offset_elf_end = Pop(ns_elf::skip_elf_header(fd));
+  // The boot binary is an ELF right after the main one, its size is read from its header
+  image.boot = Section{"fim_boot"
+    , image.offset_elf_end
+    , Pop(ns_elf::skip_elf_header(fd, image.offset_elf_end)) + image.offset_elf_end
+  };
+  // The tools are prefixed by their size, only the headers are read to locate them
+  constexpr static char const str_raw_json[] =
+  {
+    #embed FIM_FILE_TOOLS
+  };
+  uint64_t offset_end = image.boot.offset_end;
+  // TODO: Make this compile-time with C++26 reflection features
+  for(auto&& tool : Pop(Pop(ns_db::from_string(str_raw_json)).template value<std::vector<std::string>>()))
+  {
+    uint64_t size;
+    return_if(::pread(fd, &size, sizeof(size), static_cast<off_t>(offset_end)) != sizeof(size)
+      , Error("E::Could not read binary size")
+    );
+    uint64_t offset_beg = offset_end + sizeof(size);
+    offset_end = offset_beg + size;
+    return_if(offset_end > image.size, Error("E::Binary '{}' ends past the image", tool));
+    image.tools.push_back(Section{tool, offset_beg, offset_end});
+  }
+  image.offset_reserved = offset_end;
+  return image;
+}
+
+/**
+ * @brief Runs the boot binary from an anonymous memory file
+ *
+ * The boot binary is copied into a sealed memfd and executed with fexecve, so no disk write is
+ * needed before startup. The image file descriptor is close-on-exec, which leaves the file free
+ * to be mounted. Only returns on failure, e.g., when memfd execution is disabled by vm.memfd_noexec.
+ *
+ * @param fd_self Close-on-exec file descriptor of the flatimage binary
+ * @param section The [begin,end] range of the boot binary in the image
+ * @param argv Argument vector passed to the main program
+ * @return Value<void> The respective error
+ */
+[[nodiscard]] inline Value<void> exec_memfd(int fd_self
+  , std::pair<uint64_t,uint64_t> section
+  , char** argv)
+{
+  int fd_boot = ::memfd_create("fim_boot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  return_if(fd_boot < 0, Error("E::Could not create memfd: {}", strerror(errno)));
+  auto copied = ns_elf::copy_range(fd_self, fd_boot, section);
+  if(not copied)
+  {
+    ::close(fd_boot);
+    return Error("E::Could not copy boot binary to memfd: {}", copied.error());
+  }
+  // The executable cannot change while it runs
+  log_if(::fcntl(fd_boot, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0
+    , "D::Could not seal boot memfd: {}", strerror(errno)
+  );
+  ns_log::flush();
+  ::fexecve(fd_boot, argv, environ);
+  int err = errno;
+  ::close(fd_boot);
+  return Error("E::Could not perform 'fexecve': {}", strerror(err));
+}
+
 /**
  * @brief Relocate the binary (by copying it) from the image.
  *
@@ -80,11 +233,15 @@ constexpr std::array<const char*,403> const arr_busybox_applet
  * @param argv Argument vector passed to the main program
  * @param offset Offset to the reserved space, past the elf and appended binaries
  * @param path_file_self Path to the current executable binary
+ * @param fd_self Close-on-exec file descriptor of the current executable binary
+ * @param image Layout of the current executable binary
  * @return Nothing on success, or the respective error
  */
 [[nodiscard]] inline Value<void> relocate_impl(char** argv
   , uint32_t offset
-  , fs::path const& path_file_self)
+  , fs::path const& path_file_self
+  , int fd_self
+  , Image const& image)
 {
   // Save the original path before relocation
   ns_env::set("FIM_BIN_SELF", path_file_self, ns_env::Replace::Y);
@@ -101,116 +258,131 @@ constexpr std::array<const char*,403> const arr_busybox_applet
   Try(fs::create_directories(dir.app_bin));
   Try(fs::create_directories(dir.app_sbin));
   Try(fs::create_directories(dir.instance));
-  // Starting offsets
-  uint64_t offset_beg = 0;
-  uint64_t offset_end = Pop(ns_elf::skip_elf_header(bin.self.c_str()));
   /**
-   * @brief Lambda function to write a binary by reading its ELF header offset
-   *
-   * Extracts a binary from the flatimage by reading its ELF header to determine size,
-   * and writes it to the specified path. Skips if the file already exists.
-   *
-   * @param path_file Destination path for the extracted binary
-   * @param offset_end Current end offset in the source file
-   * @return Value<std::pair<uint64_t,uint64_t>> Pair of (begin_offset, end_offset) for the next binary, or error
+   * @brief A binary to extract from the flatimage
    */
-  auto f_write_from_header = [&](fs::path path_file, uint64_t offset_end)
-    -> Value<std::pair<uint64_t,uint64_t>>
+  struct Extract
   {
-    // Update offsets
-    offset_beg = offset_end;
-    offset_end = Pop(ns_elf::skip_elf_header(bin.self.c_str(),offset_beg)) + offset_beg;
-    // Write binary only if it doesnt already exist
-    if ( ! Try(fs::exists(path_file)) )
-    {
-      Pop(ns_elf::copy_binary(bin.self.string()
-        , path_file
-        , {offset_beg
-        , offset_end})
-      );
-    }
-    // Set permissions (with error_code - doesn't throw)
-    Try(fs::permissions(path_file.c_str(), fs::perms::owner_all | fs::perms::group_all));
-    // Return new values for offsets
-    return std::make_pair(offset_beg, offset_end);
+    fs::path path_file;
+    uint64_t offset_beg;
+    uint64_t offset_end;
   };
-
-  /**
-   * @brief Lambda function to write a binary by reading size metadata at a specific offset
-   *
-   * Reads a uint64_t size value at the specified offset, then extracts that many bytes
-   * to write the binary to the specified path. Skips if the file already exists.
-   *
-   * @param file_binary Input stream positioned in the source flatimage file
-   * @param path_file Destination path for the extracted binary
-   * @param offset_end Current end offset in the source file
-   * @return Value<std::pair<uint64_t,uint64_t>> Pair of (begin_offset, end_offset) for the next binary, or error
-   */
-  auto f_write_from_offset = [&](std::ifstream& file_binary, fs::path path_file, uint64_t offset_end)
-    -> Value<std::pair<uint64_t,uint64_t>>
+  std::vector<Extract> vec_extract;
+  Extract const extract_boot{dir.app_bin / image.boot.name, image.boot.offset_beg, image.boot.offset_end};
+  // Run the boot binary from memory, it is only written to disk if that fails
+  bool const is_boot_memfd = not ns_env::exists("FIM_BOOT_MEMFD", "0");
+  if(not is_boot_memfd)
   {
-    std::error_code ec;
-    uint64_t offset_beg = offset_end;
-    logger("D::Writting binary file '{}'", path_file);
-    // Set file position
-    file_binary.seekg(offset_beg);
-    // Read size bytes (FATAL if fails)
-    uint64_t size;
-    return_if(not file_binary.read(reinterpret_cast<char*>(&size), sizeof(size)), Error("E::Could not read binary size"));
-    // Open output file and write
-    if (fs::exists(path_file, ec))
+    vec_extract.push_back(extract_boot);
+  }
+  for(auto&& tool : image.tools)
+  {
+    vec_extract.push_back(Extract{dir.app_bin / tool.name, tool.offset_beg, tool.offset_end});
+  }
+  uint64_t const offset_end = image.offset_reserved;
+  // The manifest holds the identity of each extracted binary, one statx per binary tells if it
+  // is missing, was modified or does not have the size recorded in the image
+  auto start = std::chrono::high_resolution_clock::now();
+  fs::path path_file_manifest = dir.app / "tools.json";
+  ns_db::Db db_manifest = ns_db::read_file(path_file_manifest).value_or(ns_db::Db{});
+  bool is_manifest_changed = false;
+  // Optional tools are only located here, the search_path hook extracts them on demand
+  std::erase_if(vec_extract, [&](auto&& e)
+  {
+    std::string name = e.path_file.filename().string();
+    return_if(name == "fim_boot" or std::ranges::find(arr_tool_eager, name) != arr_tool_eager.end(), false);
+    std::string range = std::format("{}:{}", e.offset_beg, e.offset_end);
+    if(db_manifest("lazy")(name).template value<std::string>().value_or("") != range)
     {
-      file_binary.seekg(offset_beg + size + sizeof(size));
-    } // if
-    else
+      db_manifest("lazy")(name) = range;
+      is_manifest_changed = true;
+    }
+    return true;
+  });
+  std::erase_if(vec_extract, [&](auto&& e)
+  {
+    auto found = identity(e.path_file);
+    auto recorded = db_manifest("files")(e.path_file.filename().string()).template value<std::string>();
+    return found
+      and recorded
+      and *found == *recorded
+      and found->starts_with(std::format("{}:", e.offset_end - e.offset_beg));
+  });
+  // Write the binaries that are missing or differ, in parallel
+  std::vector<std::optional<std::string>> vec_error(vec_extract.size());
+  std::atomic<size_t> index{0};
+  auto f_worker = [&]
+  {
+    for(size_t i = index++; i < vec_extract.size(); i = index++)
     {
-      // Read binary
-      std::vector<char> buffer(size);
-      return_if(not file_binary.read(buffer.data(), size), Error("E::Could not read binary"));
-      // Open output binary file
-      std::ofstream of{path_file, std::ios::out | std::ios::binary};
-      return_if(not of.is_open(), Error("E::Could not open output file '{}'", path_file));
-      // Write binary
-      return_if(not of.write(buffer.data(), size), Error("E::Could not write binary file '{}'", path_file));
-      // Set permissions (with error_code - doesn't throw)
-      fs::permissions(path_file, fs::perms::owner_all | fs::perms::group_all, ec);
-      log_if(ec, "E::Error on setting permissions of file '{}': {}", path_file.string(), ec.message());
-    } // if
-    // Return new values for offsets
-    return std::make_pair(offset_beg, file_binary.tellg());
+      auto const& [path_file, offset_beg, offset_end] = vec_extract[i];
+      logger("D::Writting binary file '{}'", path_file);
+      // Each binary is written to a temporary file and renamed, a partial write is never visible
+      if(auto ret = ns_elf::copy_binary(fd_self, path_file, {offset_beg, offset_end}); not ret)
+      {
+        vec_error[i] = ret.error();
+      }
+    }
   };
-
-  // Write binaries
-  auto start = std::chrono::high_resolution_clock::now();
-  std::ifstream file_binary{bin.self, std::ios::in | std::ios::binary};
-  return_if(not file_binary.is_open(), Error("E::Could not open flatimage binary file"));
-  constexpr static char const str_raw_json[] =
   {
-    #embed FIM_FILE_TOOLS
-  };
-  std::tie(offset_beg, offset_end) = Pop(f_write_from_header(dir.app_bin / "fim_boot" , 0));
-  // TODO: Make this compile-time with C++26 reflection features
-  for(auto&& tool : Pop(Pop(ns_db::from_string(str_raw_json)).template value<std::vector<std::string>>()))
+    ns_span::Span span("extract_tools");
+    size_t count_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    std::vector<std::jthread> threads;
+    for(size_t i = 0; i < std::min(count_threads, vec_extract.size()); ++i)
+    {
+      threads.emplace_back(f_worker);
+    }
+  }
+  for(auto&& error : vec_error)
   {
-    std::tie(offset_beg, offset_end) = Pop(f_write_from_offset(file_binary, dir.app_bin / tool, offset_end));
+    return_if(error, Error("E::Could not extract binary: {}", *error));
+  }
+  // Record the extracted binaries
+  for(auto&& extract : vec_extract)
+  {
+    auto found = identity(extract.path_file);
+    continue_if(not found, "E::Could not stat extracted binary '{}'", extract.path_file);
+    db_manifest("files")(extract.path_file.filename().string()) = *found;
+    is_manifest_changed = true;
+  }
+  if(is_manifest_changed)
+  {
+    write_manifest(path_file_manifest, db_manifest);
+    logger("D::Extracted {} binaries", vec_extract.size());
   }
-  file_binary.close();
   auto f_symlink = [](auto&& points_to, auto&& saved_at)
   {
     if(fs::exists(saved_at)) { fs::remove(saved_at); }
     fs::create_symlink(points_to, saved_at);
   };
-  // Create symlinks (with error_code - doesn't throw)
-  fs::path path_file_dwarfs_aio = dir.app_bin / "dwarfs_aio";
-  Try(f_symlink(path_file_dwarfs_aio, dir.app_bin / "dwarfs"));
-  Try(f_symlink(path_file_dwarfs_aio, dir.app_bin / "mkdwarfs"));
-  auto end = std::chrono::high_resolution_clock::now();
-
-  // Create busybox symlinks, allow (symlinks exists) errors
-  for(auto const& busybox_applet : arr_busybox_applet)
+  // The symlinks only change with the build, which is part of the app directory name, so a
+  // stamp written after the last one marks them as complete
+  fs::path path_file_stamp = dir.app / "symlinks.stamp";
+  std::string const str_stamp = std::format("{}_{}:{}", FIM_COMMIT, FIM_TIMESTAMP, arr_busybox_applet.size());
+  std::string str_stamp_found;
+  if(std::ifstream file_stamp(path_file_stamp); file_stamp.is_open())
   {
-    Try(f_symlink(dir.app_bin / "busybox", dir.app_sbin / busybox_applet));
-  } // for
+    std::getline(file_stamp, str_stamp_found);
+  }
+  if(str_stamp_found != str_stamp)
+  {
+    ns_span::Span span("symlinks");
+    // Create symlinks (with error_code - doesn't throw)
+    fs::path path_file_dwarfs_aio = dir.app_bin / "dwarfs_aio";
+    Try(f_symlink(path_file_dwarfs_aio, dir.app_bin / "dwarfs"));
+    Try(f_symlink(path_file_dwarfs_aio, dir.app_bin / "mkdwarfs"));
+    // Create busybox symlinks, allow (symlinks exists) errors
+    for(auto const& busybox_applet : arr_busybox_applet)
+    {
+      Try(f_symlink(dir.app_bin / "busybox", dir.app_sbin / busybox_applet));
+    } // for
+    // Publish the stamp atomically, concurrent first runs write the same content
+    fs::path path_file_stamp_temp = std::format("{}.tmp.{}", path_file_stamp.string(), getpid());
+    std::ofstream(path_file_stamp_temp, std::ios::trunc) << str_stamp << '\n';
+    Try(fs::rename(path_file_stamp_temp, path_file_stamp));
+    logger("D::Created {} symlinks", arr_busybox_applet.size() + 2);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
 
   // Filesystem starts here
   ns_env::set("FIM_OFFSET", std::to_string(offset_end).c_str(), ns_env::Replace::Y);
@@ -228,12 +400,83 @@ constexpr std::array<const char*,403> const arr_busybox_applet
   } // if
 
   // Launch Runner
-  int code = execve(std::format("{}/fim_boot", dir.app_bin.string()).c_str(), argv, environ);
+  if(is_boot_memfd)
+  {
+    exec_memfd(fd_self, {extract_boot.offset_beg, extract_boot.offset_end}, argv)
+      .discard("W::Could not run boot binary from memory, writing it to '{}'", extract_boot.path_file);
+    Pop(ns_elf::copy_binary(fd_self, extract_boot.path_file, {extract_boot.offset_beg, extract_boot.offset_end}));
+  }
+  ns_log::flush();
+  int code = execve(extract_boot.path_file.c_str(), argv, environ);
   return Error("E::Could not perform 'evecve({})': {}", code, strerror(errno));
 }
 
 } // namespace
 
+/**
+ * @brief Extracts the optional tools when they are searched for in PATH
+ *
+ * The tools that were not extracted on the first run are located by the tools manifest. The
+ * hook of ns_env::search_path extracts each one from the image the first time it is searched
+ * for in this process, if it is missing or differs from the manifest. All the tools are also
+ * registered as shipped, so search_path resolves them without a stat.
+ *
+ * @param path_file_self Path to the flatimage binary
+ * @param path_dir_app Path to the application directory, which holds the manifest
+ * @param path_dir_app_bin Path to the directory to extract the tools to
+ */
+inline void enable_lazy(fs::path const& path_file_self
+  , fs::path const& path_dir_app
+  , fs::path const& path_dir_app_bin)
+{
+  fs::path path_file_manifest = path_dir_app / "tools.json";
+  ns_db::Db db_manifest = ns_db::read_file(path_file_manifest).value_or(ns_db::Db{});
+  // Name of each optional tool to its [begin,end) range in the image
+  auto ranges = std::make_shared<std::map<std::string,std::pair<uint64_t,uint64_t>>>();
+  for(auto&& name : db_manifest("lazy").keys())
+  {
+    auto range = db_manifest("lazy")(name).value<std::string>();
+    continue_if(not range);
+    auto pos = range->find(':');
+    continue_if(pos == std::string::npos);
+    auto offset_beg = Catch(std::stoull(range->substr(0, pos)));
+    auto offset_end = Catch(std::stoull(range->substr(pos+1)));
+    continue_if(not offset_beg or not offset_end, "E::Invalid range for tool '{}'", name);
+    (*ranges)[name] = {*offset_beg, *offset_end};
+  }
+  // Every tool of the manifest is in the binary directory, or extracted on its first lookup
+  auto& shipped = ns_env::search_path_shipped();
+  shipped.path_dir = path_dir_app_bin;
+  std::ranges::copy(db_manifest("files").keys(), std::inserter(shipped.names, shipped.names.end()));
+  std::ranges::copy(std::views::keys(*ranges), std::inserter(shipped.names, shipped.names.end()));
+  return_if(ranges->empty(),);
+  auto mutex = std::make_shared<std::mutex>();
+  ns_env::search_path_hook() = [=](std::string const& query)
+  {
+    std::lock_guard lock(*mutex);
+    auto it = ranges->find(query);
+    return_if(it == ranges->end(),);
+    auto [offset_beg, offset_end] = it->second;
+    // Check only once per process
+    ranges->erase(it);
+    fs::path path_file = path_dir_app_bin / query;
+    ns_db::Db db = ns_db::read_file(path_file_manifest).value_or(ns_db::Db{});
+    auto found = identity(path_file);
+    auto recorded = db("files")(query).value<std::string>();
+    return_if(found and recorded and *found == *recorded,);
+    logger("D::Extracting '{}' on demand", query);
+    if(auto ret = ns_elf::copy_binary(path_file_self, path_file, {offset_beg, offset_end}); not ret)
+    {
+      logger("E::Could not extract '{}': {}", query, ret.error());
+      return;
+    }
+    found = identity(path_file);
+    return_if(not found,, "E::Could not stat extracted binary '{}'", path_file);
+    db("files")(query) = *found;
+    write_manifest(path_file_manifest, db);
+  };
+}
+
 /**
  * @brief Calls the implementation of relocate
  *
@@ -245,12 +488,30 @@ constexpr std::array<const char*,403> const arr_busybox_applet
 {
   // Get path to self
   fs::path path_file_self = Try(fs::read_symlink("/proc/self/exe"));
-  // If it is outside /tmp, move the binary
-  if (Try(fs::file_size(path_file_self)) != Pop(ns_elf::skip_elf_header(path_file_self)))
+  // If it is outside /tmp, move the binary, the checks go through '/proc/self/exe' which also
+  // resolves when the boot binary runs from a memfd. The descriptor is shared by every read of
+  // the image and closed by the exec.
+  int fd_self = ::open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+  return_if(fd_self < 0, Error("E::Could not open '/proc/self/exe': {}", strerror(errno)));
+  struct stat st{};
+  auto offset_elf_end = ns_elf::skip_elf_header(fd_self);
+  if(::fstat(fd_self, &st) < 0 or not offset_elf_end)
   {
-    Pop(relocate_impl(argv, offset, path_file_self), "E::Could not relocate binary");
+    ::close(fd_self);
+    return Error("E::Could not read '/proc/self/exe'");
+  }
+  Value<void> ret{};
+  if (static_cast<uint64_t>(st.st_size) != *offset_elf_end)
+  {
+    ret = [&] -> Value<void>
+    {
+      Image image = Pop(Image::parse(fd_self), "E::Could not parse the image layout");
+      Pop(relocate_impl(argv, offset, path_file_self, fd_self, image), "E::Could not relocate binary");
+      return {};
+    }();
   }
-  return {};
+  ::close(fd_self);
+  return ret;
 }
 
 } // namespace ns_relocate
\ No newline at end of file
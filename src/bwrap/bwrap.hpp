@@ -10,19 +10,26 @@
 
 #include <fcntl.h>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <ranges>
 #include <sys/types.h>
 #include <pwd.h>
 #include <regex>
+#include <set>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 #include "../db/bind.hpp"
-#include "../db/portal/daemon.hpp"
-#include "../db/portal/dispatcher.hpp"
+#include "../db/limit.hpp"
 #include "../reserved/permissions.hpp"
 #include "../reserved/unshare.hpp"
+#include "grant.hpp"
 #include "../std/expected.hpp"
 #include "../std/vector.hpp"
+#include "../lib/cgroup.hpp"
 #include "../lib/log.hpp"
+#include "../lib/span.hpp"
 #include "../lib/subprocess.hpp"
 #include "../lib/env.hpp"
 #include "../macro.hpp"
@@ -83,7 +90,10 @@ struct Overlay
 struct Logs
 {
   fs::path const path_file_apparmor;
-  Logs(fs::path const& path_dir_log) : path_file_apparmor(path_dir_log / "apparmor.log")
+  fs::path const path_file_cgroup;
+  Logs(fs::path const& path_dir_log)
+    : path_file_apparmor(path_dir_log / "apparmor.log")
+    , path_file_cgroup(path_dir_log / "cgroup.log")
   {
     fs::create_directories(path_file_apparmor.parent_path());
   }
@@ -243,13 +253,20 @@ class Bwrap
     std::vector<std::string> m_args;
     // Run bwrap with uid and gid equal to 0
     bool m_is_root;
+    // Cache file of the bwrap probe
+    std::optional<fs::path> m_path_file_probe;
+    // Resource limits of the sandbox
+    ns_db::ns_limit::Limit m_limit;
+    // Arguments granted by the permissions, built by run() if not set
+    std::optional<ns_grant::Args> m_args_grant;
     // Bwrap native --overlay options
     void overlay(ns_proxy::Overlay const& overlay);
     // Set XDG_RUNTIME_DIR
     void set_xdg_runtime_dir();
     // Setup
     Value<fs::path> test_and_setup(fs::path const& path_file_bwrap);
-    Bwrap& symlink_nvidia(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host);
+    // Host information of the permission bindings
+    ns_grant::Context grant_context() const;
 
   public:
     Bwrap(ns_proxy::Logs logs
@@ -264,30 +281,19 @@ class Bwrap
     Bwrap& operator=(Bwrap const&) = delete;
     Bwrap& operator=(Bwrap&&) = delete;
     [[maybe_unused]] [[nodiscard]] Bwrap& with_binds(ns_db::ns_bind::Binds const& binds);
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_home();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_media();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_audio();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_wayland();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_xorg();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_dbus_user();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_dbus_system();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_udev();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_input();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_usb();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_network();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_shm();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_optical();
-    [[maybe_unused]] [[nodiscard]] Bwrap& bind_dev();
-    [[maybe_unused]] [[nodiscard]] Bwrap& with_bind_gpu(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host);
+    [[maybe_unused]] [[nodiscard]] Bwrap& with_bind_gpu(fs::path const& path_dir_root_guest
+      , fs::path const& path_dir_root_host
+      , fs::path const& path_file_cache);
     [[maybe_unused]] [[nodiscard]] Bwrap& with_bind(fs::path const& src, fs::path const& dst);
     [[maybe_unused]] [[nodiscard]] Bwrap& with_bind_ro(fs::path const& src, fs::path const& dst);
     [[maybe_unused]] void set_overlay(ns_proxy::Overlay const& overlay);
+    [[maybe_unused]] void set_probe_cache(fs::path const& path_file_probe);
+    [[maybe_unused]] void set_limit(ns_db::ns_limit::Limit const& limit);
+    [[maybe_unused]] void set_grant(ns_grant::Args args);
     [[maybe_unused]] [[nodiscard]] Value<bwrap_run_ret_t> run(Permissions const& permissions
       , Unshares const& unshares
       , fs::path const& path_file_daemon
-      , ns_db::ns_portal::ns_dispatcher::Dispatcher const& arg1_dispatcher
-      , ns_db::ns_portal::ns_daemon::Daemon const& arg1_daemon
-      , ns_db::ns_portal::ns_daemon::ns_log::Logs const& arg2_daemon
+      , fs::path const& path_file_snapshot
     );
 };
 
@@ -316,6 +322,9 @@ inline Bwrap::Bwrap(ns_proxy::Logs logs
   , m_path_dir_xdg_runtime()
   , m_args()
   , m_is_root(user.data.id.uid == 0)
+  , m_path_file_probe(std::nullopt)
+  , m_limit()
+  , m_args_grant(std::nullopt)
 {
   // Push passed environment
   std::ranges::for_each(program_env, [&](auto&& e){ logger("I::ENV: {}", e); m_program_env.push_back(e); });
@@ -384,7 +393,7 @@ inline void Bwrap::overlay(ns_proxy::Overlay const& overlay)
  */
 inline void Bwrap::set_xdg_runtime_dir()
 {
-  m_path_dir_xdg_runtime = ns_env::get_expected<"W">("XDG_RUNTIME_DIR").value_or(std::format("/run/user/{}", getuid()));
+  m_path_dir_xdg_runtime = ns_grant::xdg_runtime_dir();
   logger("I::XDG_RUNTIME_DIR: {}", m_path_dir_xdg_runtime);
   m_program_env.push_back(std::format("XDG_RUNTIME_DIR={}", m_path_dir_xdg_runtime.string()));
   ns_vector::push_back(m_args, "--setenv", "XDG_RUNTIME_DIR", m_path_dir_xdg_runtime);
@@ -398,20 +407,72 @@ inline void Bwrap::set_xdg_runtime_dir()
  */
 inline Value<fs::path> Bwrap::test_and_setup(fs::path const& path_file_bwrap_src)
 {
+  fs::path path_file_bwrap_opt = "/opt/flatimage/bwrap";
+  // The outcome of the probe only changes with the user, the kernel, the apparmor policy or the
+  // binaries
+  auto f_identity = [](fs::path const& path)
+  {
+    struct stat st{};
+    return (::stat(path.c_str(), &st) == 0)?
+        std::format("{}:{}:{}:{}:{}.{}", st.st_dev, st.st_ino, st.st_size, st.st_uid, st.st_mtim.tv_sec, st.st_mtim.tv_nsec)
+      : std::string{"none"};
+  };
+  auto f_read = [](fs::path const& path)
+  {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+  };
+  struct utsname uts{};
+  ::uname(&uts);
+  std::string key = std::format("{}|{}|{}|{}|{}|{}|{}|{}"
+    , ::getuid()
+    , uts.release
+    , f_read("/proc/sys/kernel/apparmor_restrict_unprivileged_userns")
+    , f_read("/proc/sys/kernel/unprivileged_userns_clone")
+    , f_identity("/etc/apparmor.d")
+    , f_identity("/etc/apparmor.d/flatimage")
+    , f_identity(path_file_bwrap_src)
+    , f_identity(path_file_bwrap_opt)
+  );
+  // Reuse the result of a previous probe
+  if(m_path_file_probe)
+  {
+    ns_db::Db db = ns_db::read_file(*m_path_file_probe).value_or(ns_db::Db{});
+    if(db(path_file_bwrap_src.string())("key").value<std::string>().value_or("") == key)
+    {
+      fs::path path_file_bwrap = db(path_file_bwrap_src.string())("bwrap").value<std::string>().value_or("");
+      return_if(not path_file_bwrap.empty(), path_file_bwrap, "D::Using cached bwrap probe '{}'", path_file_bwrap);
+    }
+  }
+  // Save a successful probe, keyed by the bwrap binary it was made for
+  auto f_cache = [&](fs::path const& path_file_bwrap) -> fs::path
+  {
+    return_if(not m_path_file_probe, path_file_bwrap);
+    ns_db::Db db = ns_db::read_file(*m_path_file_probe).value_or(ns_db::Db{});
+    db(path_file_bwrap_src.string())("key") = key;
+    db(path_file_bwrap_src.string())("bwrap") = path_file_bwrap.string();
+    fs::path path_file_probe_temp = std::format("{}.tmp.{}", m_path_file_probe->string(), getpid());
+    if(ns_db::write_file(path_file_probe_temp, db))
+    {
+      Catch(fs::rename(path_file_probe_temp, *m_path_file_probe)).discard("E::Could not rename bwrap probe cache");
+    }
+    return path_file_bwrap;
+  };
   // Test current bwrap binary
   using enum ns_subprocess::Stream;
   auto ret = ns_subprocess::Subprocess(path_file_bwrap_src)
     .with_args("--bind", "/", "/", "bash", "-c", "echo")
     .with_stdio(Pipe)
     .spawn()->wait();
-  return_if(ret and *ret == 0, path_file_bwrap_src);
+  return_if(ret and *ret == 0, f_cache(path_file_bwrap_src));
   // Try to use bwrap installed by flatimage
-  fs::path path_file_bwrap_opt = "/opt/flatimage/bwrap";
   ret = ns_subprocess::Subprocess(path_file_bwrap_opt)
     .with_args("--bind", "/", "/", "bash", "-c", "echo")
     .with_stdio(Pipe)
     .spawn()->wait();
-  return_if(ret and *ret == 0, path_file_bwrap_opt);
+  return_if(ret and *ret == 0, f_cache(path_file_bwrap_opt));
   // Error might be EACCES, try to integrate with apparmor
   fs::path path_file_pkexec = Pop(ns_env::search_path("pkexec"));
   fs::path path_file_bwrap_apparmor = Pop(ns_env::search_path("fim_bwrap_apparmor"));
@@ -421,73 +482,6 @@ inline Value<fs::path> Bwrap::test_and_setup(fs::path const& path_file_bwrap_src
   return path_file_bwrap_opt;
 }
 
-/**
- * @brief Setup symlinks to nvidia drivers
- *
- * @param path_dir_root_guest Path to the root directory of the sandbox
- * @param path_dir_root_host Path to the root directory of the host system (from the guest)
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::symlink_nvidia(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host)
-{
-  std::regex regex_exclude("gst|icudata|egl-wayland", std::regex_constants::extended);
-
-  auto f_find_and_bind = [&]<typename... Args>(fs::path const& path_dir_search, Args&&... args) -> void
-  {
-    std::vector<std::string_view> keywords{std::forward<Args>(args)...};
-    return_if(not fs::exists(path_dir_search),, "E::Search path does not exist: '{}'", path_dir_search);
-    auto f_process_entry = [&](fs::path const& path_file_entry) -> void
-    {
-      // Skip ignored matches
-      return_if(std::regex_search(path_file_entry.c_str(), regex_exclude),);
-      // Skip directories
-      return_if(fs::is_directory(path_file_entry),);
-      // Skip files that do not match keywords
-      return_if(not std::ranges::any_of(keywords, [&](auto&& f){ return path_file_entry.filename().string().contains(f); }),);
-      // Symlink target is the file and the end of the symlink chain
-      // fs::canonical throws if path_file_entry does not exist
-      auto path_file_entry_realpath = fs::canonical(path_file_entry);
-      // Create target and symlink names
-      fs::path path_link_target = path_dir_root_host / path_file_entry_realpath.relative_path();
-      fs::path path_link_name = path_dir_root_guest / path_file_entry.relative_path();
-      // File already exists in the container as a regular file or directory, skip
-      return_if(fs::exists(path_link_name) and not fs::is_symlink(path_link_name),);
-      // Create parent directories
-      fs::create_directories(path_link_name.parent_path());
-      // Remove existing link
-      fs::remove(path_link_name);
-      // Symlink
-      fs::create_symlink(path_link_target.c_str(), path_link_name.c_str());
-      // Log symlink successful
-      logger("D::PERM(NVIDIA): {} -> {}", path_link_name, path_link_target);
-    };
-    // Process entries
-    for(auto&& path_file_entry : fs::directory_iterator(path_dir_search) | std::views::transform([](auto&& e){ return e.path(); }))
-    {
-      Catch(f_process_entry(path_file_entry)).template discard();
-    } // for
-  };
-
-  // Bind files
-  f_find_and_bind("/usr/lib", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/lib/x86_64-linux-gnu", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/lib/i386-linux-gnu", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/bin", "nvidia");
-  f_find_and_bind("/usr/share", "nvidia");
-  f_find_and_bind("/usr/share/vulkan/icd.d", "nvidia");
-  f_find_and_bind("/usr/lib32", "nvidia", "cuda");
-
-  // Bind devices
-  for(auto&& entry : fs::directory_iterator("/dev")
-    | std::views::transform([](auto&& e){ return e.path(); })
-    | std::views::filter([](auto&& e){ return e.filename().string().contains("nvidia"); }))
-  {
-    ns_vector::push_back(m_args, "--dev-bind-try", entry, entry);
-  } // for
-
-  return *this;
-}
-
 /**
  * @brief Allows to specify custom bindings from a json file
  *
@@ -498,16 +492,21 @@ inline Bwrap& Bwrap::with_binds(ns_db::ns_bind::Binds const& binds)
 {
   using TypeBind = ns_db::ns_bind::Type;
   // Load bindings from the filesystem if any
+  // Literal paths are used as stored, only the ones with variables are expanded
+  auto f_expand = [](fs::path const& path)
+  {
+    std::string str = path.string();
+    return ns_env::is_literal(str)? str : ns_env::expand(str).value_or(str);
+  };
+  m_args.reserve(m_args.size() + binds.get().size() * 3);
   for(auto&& bind : binds.get())
   {
-    std::string src = bind.path_src;
-    std::string dst = bind.path_dst;
     std::string type = (bind.type == TypeBind::DEV)? "--dev-bind-try"
       : (bind.type == TypeBind::RO)? "--ro-bind-try"
       : "--bind-try";
     m_args.push_back(type);
-    m_args.push_back(ns_env::expand(src).value_or(src));
-    m_args.push_back(ns_env::expand(dst).value_or(dst));
+    m_args.push_back(f_expand(bind.path_src));
+    m_args.push_back(f_expand(bind.path_dst));
   } // for
   return *this;
 }
@@ -549,319 +548,67 @@ inline void Bwrap::set_overlay(ns_proxy::Overlay const& overlay)
 }
 
 /**
- * @brief Includes a binding from the host $HOME to the guest
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_home()
-{
-  if ( m_is_root ) { return *this; }
-  logger("D::PERM(HOME)");
-  std::string str_dir_home = ({
-    auto ret = ns_env::get_expected("HOME");
-    return_if(not ret, *this, "E::HOME environment variable is unset");
-    ret.value();
-  });
-  ns_vector::push_back(m_args, "--bind-try", str_dir_home, str_dir_home);
-  return *this;
-}
-
-/**
- * @brief Binds the host's media directories to the guest
- *
- * The bindings are `/media`, `/run/media`, and `/mnt`
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_media()
-{
-  logger("D::PERM(MEDIA)");
-  ns_vector::push_back(m_args, "--bind-try", "/media", "/media");
-  ns_vector::push_back(m_args, "--bind-try", "/run/media", "/run/media");
-  ns_vector::push_back(m_args, "--bind-try", "/mnt", "/mnt");
-  return *this;
-}
-
-/**
- * @brief Binds the host's audio sockets and devices to the guest
- *
- * The bindings are $XDG_RUNTIME_DIR/{/pulse/native,pipewire-0}
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_audio()
-{
-  logger("D::PERM(AUDIO)");
-
-  // Try to bind pulse socket
-  fs::path path_socket_pulse = m_path_dir_xdg_runtime / "pulse/native";
-  ns_vector::push_back(m_args, "--bind-try", path_socket_pulse, path_socket_pulse);
-  ns_vector::push_back(m_args, "--setenv", "PULSE_SERVER", "unix:" + path_socket_pulse.string());
-
-  // Try to bind pipewire socket
-  fs::path path_socket_pipewire = m_path_dir_xdg_runtime / "pipewire-0";
-  ns_vector::push_back(m_args, "--bind-try", path_socket_pipewire, path_socket_pipewire);
-
-  // Other paths required to sound
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/dsp", "/dev/dsp");
-  ns_vector::push_back(m_args, "--bind-try", "/dev/snd", "/dev/snd");
-  ns_vector::push_back(m_args, "--bind-try", "/proc/asound", "/proc/asound");
-
-  return *this;
-}
-
-/**
- * @brief Binds the wayland socket from the host to the guest
- *
- * Requires the WAYLAND_DISPLAY variable set
- * The binding is $XDG_RUNTIME_DIR/$WAYLAND_DISPLAY
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_wayland()
-{
-  logger("D::PERM(WAYLAND)");
-  // Get WAYLAND_DISPLAY
-  std::string env_wayland_display = ({
-    auto ret = ns_env::get_expected("WAYLAND_DISPLAY");
-    return_if(not ret, *this, "E::WAYLAND_DISPLAY is undefined");
-    ret.value();
-  });
-
-  // Get wayland socket
-  fs::path path_socket_wayland = m_path_dir_xdg_runtime / env_wayland_display;
-
-  // Bind
-  ns_vector::push_back(m_args, "--bind-try", path_socket_wayland, path_socket_wayland);
-  ns_vector::push_back(m_args, "--setenv", "WAYLAND_DISPLAY", env_wayland_display);
-
-  return *this;
-}
-
-/**
- * @brief Binds the xorg socket from the host to the guest
- *
- * Requires the DISPLAY environment variable set
- * Requires the XAUTHORITY environment variable set
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_xorg()
-{
-  logger("D::PERM(XORG)");
-  // Get DISPLAY
-  std::string env_display = ({
-    auto ret = ns_env::get_expected("DISPLAY");
-    return_if(not ret, *this, "E::DISPLAY is undefined");
-    ret.value();
-  });
-  // Get XAUTHORITY
-  std::string env_xauthority = ({
-    auto ret = ns_env::get_expected("XAUTHORITY");
-    return_if(not ret, *this, "E::XAUTHORITY is undefined");
-    ret.value();
-  });
-  // Bind
-  ns_vector::push_back(m_args, "--ro-bind-try", env_xauthority, env_xauthority);
-  ns_vector::push_back(m_args, "--setenv", "XAUTHORITY", env_xauthority);
-  ns_vector::push_back(m_args, "--setenv", "DISPLAY", env_display);
-  return *this;
-}
-
-/**
- * @brief Binds the user session bus from the host to the guest
+ * @brief Enables the cache of the bwrap probe
  *
- * Requires the DBUS_SESSION_BUS_ADDRESS environment variable set
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_dbus_user()
-{
-  logger("D::PERM(DBUS_USER)");
-  // Get DBUS_SESSION_BUS_ADDRESS
-  std::string env_dbus_session_bus_address = ({
-    auto ret = ns_env::get_expected("DBUS_SESSION_BUS_ADDRESS");
-    return_if(not ret, *this, "E::DBUS_SESSION_BUS_ADDRESS is undefined");
-    ret.value();
-  });
-
-  // Path to current session bus
-  std::string str_dbus_session_bus_path = env_dbus_session_bus_address;
-
-  // Variable has expected contents similar to: 'unix:path=/run/user/1000/bus,guid=bb1adf978ae9c14....'
-  // Erase until the first '=' (inclusive)
-  if ( auto pos = str_dbus_session_bus_path.find('/'); pos != std::string::npos )
-  {
-    str_dbus_session_bus_path.erase(0, pos);
-  } // if
-
-  // Erase from the first ',' (inclusive)
-  if ( auto pos = str_dbus_session_bus_path.find(','); pos != std::string::npos )
-  {
-    str_dbus_session_bus_path.erase(pos);
-  } // if
-
-  // Bind
-  ns_vector::push_back(m_args, "--setenv", "DBUS_SESSION_BUS_ADDRESS", env_dbus_session_bus_address);
-  ns_vector::push_back(m_args, "--bind-try", str_dbus_session_bus_path, str_dbus_session_bus_path);
-
-  return *this;
-}
-
-/**
- * @brief Binds the syst from the host to the guest
- *
- * the binding is `/run/dbus/system_bus_socket`
- *
- * @return bwrap& a reference to *this
- */
-inline Bwrap& Bwrap::bind_dbus_system()
-{
-  logger("D::PERM(DBUS_SYSTEM)");
-  ns_vector::push_back(m_args, "--bind-try", "/run/dbus/system_bus_socket", "/run/dbus/system_bus_socket");
-  return *this;
-}
-
-/**
- * @brief binds the udev folder from the host to the guest
- *
- * The binding is `/run/udev`
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_udev()
-{
-  logger("D::PERM(UDEV)");
-  ns_vector::push_back(m_args, "--bind-try", "/run/udev", "/run/udev");
-  return *this;
-}
-
-/**
- * @brief Binds the input devices from the host to the guest
- *
- * The bindings are `/dev/{input,uinput}`
- *
- * @return Bwrap& A reference to *this
+ * @param path_file_probe Path to the cache file, in a directory private to the user
  */
-inline Bwrap& Bwrap::bind_input()
+inline void Bwrap::set_probe_cache(fs::path const& path_file_probe)
 {
-  logger("D::PERM(INPUT)");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/input", "/dev/input");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/uinput", "/dev/uinput");
-  return *this;
+  m_path_file_probe = path_file_probe;
 }
 
 /**
- * @brief Binds the usb devices from the host to the guest
- *
- * The bindings are `/dev/bus/usb` and `/dev/usb`
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_usb()
-{
-  logger("D::PERM(USB)");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/bus/usb", "/dev/bus/usb");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/usb", "/dev/usb");
-  return *this;
-}
-
-/**
- * @brief Binds the network configuration from the host to the guest
- *
- * The bindings are:
- * - `/etc/host.conf`
- * - `/etc/hosts`
- * - `/etc/nsswitch.conf`
- * - `/etc/resolv.conf`
+ * @brief Sets the resource limits of the sandbox
  *
- * @return Bwrap& A reference to *this
+ * @param limit The cgroup limits, applied if it has limits or accounting enabled
  */
-inline Bwrap& Bwrap::bind_network()
+inline void Bwrap::set_limit(ns_db::ns_limit::Limit const& limit)
 {
-  logger("D::PERM(NETWORK)");
-  ns_vector::push_back(m_args, "--ro-bind-try", "/etc/host.conf", "/etc/host.conf");
-  ns_vector::push_back(m_args, "--ro-bind-try", "/etc/hosts", "/etc/hosts");
-  ns_vector::push_back(m_args, "--ro-bind-try", "/etc/nsswitch.conf", "/etc/nsswitch.conf");
-  ns_vector::push_back(m_args, "--ro-bind-try", "/etc/resolv.conf", "/etc/resolv.conf");
-  return *this;
+  m_limit = limit;
 }
 
 /**
- * @brief Binds the /dev/shm directory to the containter
+ * @brief Sets the arguments granted by the permissions
  *
- * A tmpfs mount used for POSIX shared memory
+ * Allows to prepare them concurrently with other work, see ns_grant::args
  *
- * @return Bwrap& A reference to *this
+ * @param args The arguments built with ns_grant::args
  */
-inline Bwrap& Bwrap::bind_shm()
+inline void Bwrap::set_grant(ns_grant::Args args)
 {
-  logger("D::PERM(SHM)");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/shm", "/dev/shm");
-  return *this;
+  m_args_grant = std::move(args);
 }
 
 /**
- * @brief Binds optical devices to the container
- *
- * Grants access to optical devices such as CD and DVD drives.
- * The maximum number of scsi devices is defined in the linux kernel
- * as [#define SR_DISKS	256](https://github.com/torvalds/linux/blob/master/drivers/scsi/sr.c).
+ * @brief Gets the host information the permission bindings of this sandbox depend on
  *
- * @return Bwrap& A reference to *this
+ * @return ns_grant::Context The context for ns_grant::args
  */
-inline Bwrap& Bwrap::bind_optical()
+inline ns_grant::Context Bwrap::grant_context() const
 {
-  logger("D::PERM(OPTICAL)");
-  auto f_bind = [this](fs::path const& path_device) -> bool
+  return ns_grant::Context
   {
-    auto __expected_fn = [](auto&&){ return false; };
-    if(not Try(fs::exists(path_device), "E::Error to check if file exists: {}", path_device))
-    {
-      return false;
-    }
-    ns_vector::push_back(m_args, "--dev-bind-try", path_device, path_device);
-    return true;
+    .is_root = m_is_root,
+    .path_dir_xdg_runtime = m_path_dir_xdg_runtime,
+    .path_file_probe = std::nullopt,
+    .shm = std::nullopt,
   };
-  // Bind /dev/sr[0-255] and /dev/sg[0-255]
-  // Devices are sequential, so stop when both sr and sg don't exist
-  for(int i : std::views::iota(0,256))
-  {
-    bool sr_exists = f_bind(std::format("/dev/sr{}", i));
-    bool sg_exists = f_bind(std::format("/dev/sg{}", i));
-    // Stop if neither device exists
-    if (!sr_exists && !sg_exists) break;
-  }
-  return *this;
 }
 
-/**
- * @brief Binds the /dev directory to the containter
- *
- * Superseeds all previous /dev related bindings
- *
- * @return Bwrap& A reference to *this
- */
-inline Bwrap& Bwrap::bind_dev()
-{
-  logger("D::PERM(DEV)");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev", "/dev");
-  return *this;
-}
-
-
 /**
  * @brief Binds the gpu device from the host to the guest
  *
  * @param path_dir_root_guest Path to the root directory of the sandbox
  * @param path_dir_root_host Path to the root directory of the host system (from the guest)
+ * @param path_file_cache Path to the cache file of the driver symlinks
  * @return Bwrap&
  */
-inline Bwrap& Bwrap::with_bind_gpu(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host)
+inline Bwrap& Bwrap::with_bind_gpu(fs::path const& path_dir_root_guest
+  , fs::path const& path_dir_root_host
+  , fs::path const& path_file_cache)
 {
-  logger("D::PERM(GPU)");
-  ns_vector::push_back(m_args, "--dev-bind-try", "/dev/dri", "/dev/dri");
-  return symlink_nvidia(path_dir_root_guest, path_dir_root_host);
+  ns_grant::bind_gpu(m_args, path_dir_root_guest, path_dir_root_host, path_file_cache);
+  return *this;
 }
 
 /**
@@ -870,33 +617,23 @@ inline Bwrap& Bwrap::with_bind_gpu(fs::path const& path_dir_root_guest, fs::path
  * @param permissions Permissions for the program (HOME, MEDIA, AUDIO, etc.), configured in bubblewrap
  * @param unshares Unshare namespace options (USER, IPC, PID, NET, UTS, CGROUP)
  * @param path_file_daemon Path to the portal daemon executable
- * @param arg1_dispatcher Dispatcher configuration for the portal communication (controls FIFO communication between host and container)
- * @param arg1_daemon Daemon host configuration for the portal (controls daemon communication settings)
- * @param arg2_daemon Log configuration for the portal daemon (specifies log file paths and settings)
+ * @param path_file_snapshot Snapshot with the configuration of the guest daemon and of the dispatcher to the host daemon
  * @return Value<bwrap_run_ret_t> Return value containing exit code, syscall number, and errno on error
  */
 inline Value<bwrap_run_ret_t> Bwrap::run(Permissions const& permissions
   , Unshares const& unshares
   , fs::path const& path_file_daemon
-  , ns_db::ns_portal::ns_dispatcher::Dispatcher const& arg1_dispatcher
-  , ns_db::ns_portal::ns_daemon::Daemon const& arg1_daemon
-  , ns_db::ns_portal::ns_daemon::ns_log::Logs const& arg2_daemon)
+  , fs::path const& path_file_snapshot)
 {
+  // Time the setup apart from the sandboxed program
+  std::optional<ns_span::Span> span_setup(std::in_place, "bwrap_setup");
   // Configure bindings
-  if(permissions.contains(Permission::HOME)){ std::ignore = bind_home(); };
-  if(permissions.contains(Permission::MEDIA)){ std::ignore = bind_media(); };
-  if(permissions.contains(Permission::AUDIO)){ std::ignore = bind_audio(); };
-  if(permissions.contains(Permission::WAYLAND)){ std::ignore = bind_wayland(); };
-  if(permissions.contains(Permission::XORG)){ std::ignore = bind_xorg(); };
-  if(permissions.contains(Permission::DBUS_USER)){ std::ignore = bind_dbus_user(); };
-  if(permissions.contains(Permission::DBUS_SYSTEM)){ std::ignore = bind_dbus_system(); };
-  if(permissions.contains(Permission::UDEV)){ std::ignore = bind_udev(); };
-  if(permissions.contains(Permission::INPUT)){ std::ignore = bind_input(); };
-  if(permissions.contains(Permission::USB)){ std::ignore = bind_usb(); };
-  if(permissions.contains(Permission::NETWORK)){ std::ignore = bind_network(); };
-  if(permissions.contains(Permission::SHM)){ std::ignore = bind_shm(); };
-  if(permissions.contains(Permission::OPTICAL)){ std::ignore = bind_optical(); };
-  if(permissions.contains(Permission::DEV)){ std::ignore = bind_dev(); };
+  if(not m_args_grant)
+  {
+    m_args_grant = ns_grant::args(permissions, grant_context());
+  }
+  std::ranges::move(*m_args_grant, std::back_inserter(m_args));
+  m_args_grant.reset();
 
   // Configure unshare namespace options
   // Note: USER and CGROUP use '-try' variants for permissiveness
@@ -931,9 +668,6 @@ inline Value<bwrap_run_ret_t> Bwrap::run(Permissions const& permissions
     ns_vector::push_back(m_args, "--unshare-cgroup-try");
   }
 
-  // Search for bash
-  fs::path path_file_bash = Pop(ns_env::search_path("bash"));
-
   // Use builtin bwrap or native if exists
   fs::path path_file_bwrap = Pop(ns_env::search_path("bwrap"));
 
@@ -951,16 +685,9 @@ inline Value<bwrap_run_ret_t> Bwrap::run(Permissions const& permissions
     return Error("E::Could not configure bwrap pipe to be non-blocking");
   }
 
-  // Get path to daemon
-  std::string str_arg1_dispatcher = Pop(ns_db::ns_portal::ns_dispatcher::serialize(arg1_dispatcher));
-  std::string str_arg1_daemon = Pop(ns_db::ns_portal::ns_daemon::serialize(arg1_daemon));
-  std::string str_arg2_daemon = Pop(ns_db::ns_portal::ns_daemon::ns_log::serialize(arg2_daemon));
-
-  // Pass daemon configuration via environment variables to avoid shell escaping issues
-  // The daemon will read FIM_DAEMON_CFG and FIM_DAEMON_LOG from environment
-  ns_vector::push_back(m_args, "--setenv", "FIM_DISPATCHER_CFG", str_arg1_dispatcher);
-  ns_vector::push_back(m_args, "--setenv", "FIM_DAEMON_CFG", str_arg1_daemon);
-  ns_vector::push_back(m_args, "--setenv", "FIM_DAEMON_LOG", str_arg2_daemon);
+  // The guest daemon and the dispatchers of the sandbox read their configuration from the snapshot
+  ns_vector::push_back(m_args, "--setenv", "FIM_SNAPSHOT", path_file_snapshot.string());
+  ns_vector::push_back(m_args, "--setenv", "FIM_DAEMON_MODE", "guest");
 
   return_if(not Try(fs::exists(path_file_daemon)), Error("E::Missing portal daemon to run binary file path"));
 
@@ -974,16 +701,68 @@ inline Value<bwrap_run_ret_t> Bwrap::run(Permissions const& permissions
     ns_vector::push_front(m_args, "--bind", m_path_dir_root, "/");
   }
 
-  // Run Bwrap
-  auto code = ns_subprocess::Subprocess(path_file_bash)
-    .with_args("-c", std::format(R"("{}" "$@")", path_file_bwrap.string()), "--")
+  // Create the cgroup of the sandbox, permissive
+  std::unique_ptr<ns_cgroup::Cgroup> cgroup;
+  int fd_cgroup_procs = -1;
+  if(not m_limit.files.empty() or m_limit.is_accounting)
+  {
+    std::set<std::string> controllers;
+    for(auto const& [file,_] : m_limit.files)
+    {
+      controllers.insert(file.substr(0, file.find('.')));
+    }
+    // Accounting reads the statistics of every controller
+    if(m_limit.is_accounting)
+    {
+      controllers.insert({"cpu", "memory", "io", "pids"});
+    }
+    if(auto ret = ns_cgroup::Cgroup::create(std::format("fim-{}", getpid()), controllers))
+    {
+      cgroup = std::move(*ret);
+      for(auto const& [file,value] : m_limit.files)
+      {
+        cgroup->set(file, value).discard("W::Could not apply limit '{}'", file);
+      }
+      fd_cgroup_procs = cgroup->open_procs().value_or(-1);
+    }
+    else
+    {
+      logger("W::Could not create cgroup for resource limits: {}", ret.error());
+    }
+  }
+
+  // Run Bwrap, the daemon starts itself in the background and then runs the program
+  span_setup.reset();
+  ns_span::Span span_run("bwrap_run");
+  auto code = ns_subprocess::Subprocess(path_file_bwrap)
     .with_args("--error-fd", std::to_string(pipe_error[1]))
     .with_args(m_args)
-    .with_args(path_file_bash, "-c", std::format(R"(&>/dev/null nohup "{}" & disown; "{}" "$@")", path_file_daemon.string(), m_path_file_program.string()), "--")
+    .with_args(path_file_daemon, m_path_file_program)
     .with_args(m_program_args)
     .with_env(m_program_env)
+    .with_affinity(m_limit.placement(false))
+    .with_callback_child([fd_cgroup_procs](ns_subprocess::ArgsCallbackChild)
+    {
+      // Join the cgroup before bwrap executes, so every process of the sandbox is in it
+      if(fd_cgroup_procs >= 0)
+      {
+        std::ignore = ::write(fd_cgroup_procs, "0", 1);
+      }
+    })
     .spawn()->wait().value_or(125);
 
+  // Log the resources used by the sandbox
+  if(fd_cgroup_procs >= 0)
+  {
+    ::close(fd_cgroup_procs);
+  }
+  if(cgroup and m_limit.is_accounting)
+  {
+    std::string accounting = cgroup->accounting();
+    logger("I::Sandbox usage: {}", accounting);
+    std::ofstream(m_logs.path_file_cgroup, std::ios::app) << accounting << '\n';
+  }
+
   // Failed syscall and errno
   int syscall_nr = -1;
   int errno_nr = -1;
@@ -0,0 +1,681 @@
+/**
+ * @file grant.hpp
+ * @author Ruan Formigoni
+ * @brief Bubblewrap arguments granted by the permissions of the image
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <ranges>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../db/db.hpp"
+#include "../db/perf.hpp"
+#include "../reserved/permissions.hpp"
+#include "../std/expected.hpp"
+#include "../std/filesystem.hpp"
+#include "../std/vector.hpp"
+#include "../lib/env.hpp"
+#include "../lib/log.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_bwrap::ns_grant
+ * @brief Bindings derived from the permissions
+ *
+ * The arguments depend only on the permissions and the host, not on the filesystems of the
+ * image, so they can be prepared while the filesystems are mounted. Probes of host devices are
+ * cached for the boot session, keyed by the boot id and the modification time of /dev which
+ * changes when devices are added or removed.
+ */
+namespace ns_bwrap::ns_grant
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+} // namespace
+
+using Args = std::vector<std::string>;
+using Permissions = ns_reserved::ns_permissions::Permissions;
+using Permission = ns_reserved::ns_permissions::Permission;
+
+/**
+ * @brief Host information and image settings the bindings depend on
+ */
+struct Context
+{
+  bool is_root;                            ///< The sandbox user is root
+  fs::path path_dir_xdg_runtime;           ///< XDG_RUNTIME_DIR of the host
+  std::optional<fs::path> path_file_probe; ///< Cache of the device probes, none to always probe
+  std::optional<ns_db::ns_perf::Shm> shm;  ///< Mount of /dev/shm, none to bind the one of the host
+};
+
+/**
+ * @brief Gets the XDG_RUNTIME_DIR of the host, or its default location
+ *
+ * @return fs::path The runtime directory of the user
+ */
+[[nodiscard]] inline fs::path xdg_runtime_dir()
+{
+  return ns_env::get_expected<"W">("XDG_RUNTIME_DIR").value_or(std::format("/run/user/{}", getuid()));
+}
+
+/**
+ * @brief Identifies the current boot session and the set of devices in it
+ *
+ * @return std::string The key of the session, empty if it could not be determined
+ */
+[[nodiscard]] inline std::string probe_key()
+{
+  std::string boot_id;
+  std::ifstream("/proc/sys/kernel/random/boot_id") >> boot_id;
+  struct stat st{};
+  return_if(boot_id.empty() or ::stat("/dev", &st) < 0, std::string{});
+  return std::format("{}:{}.{}", boot_id, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+}
+
+/**
+ * @brief Lists the optical devices of the host
+ *
+ * The maximum number of scsi devices is defined in the linux kernel
+ * as [#define SR_DISKS	256](https://github.com/torvalds/linux/blob/master/drivers/scsi/sr.c).
+ * Devices are sequential, so the probe stops when both sr and sg don't exist.
+ *
+ * @param path_file_probe Cache of the probe, none to always probe
+ * @return std::vector<std::string> The paths of the existing devices
+ */
+[[nodiscard]] inline std::vector<std::string> probe_optical(std::optional<fs::path> const& path_file_probe)
+{
+  std::string key = path_file_probe? probe_key() : std::string{};
+  // Reuse the result of a previous probe in this boot session
+  if(not key.empty())
+  {
+    ns_db::Db db = ns_db::read_file(*path_file_probe).value_or(ns_db::Db{});
+    if(db("optical")("key").value<std::string>().value_or("") == key)
+    {
+      if(auto devices = db("optical")("devices").value<std::vector<std::string>>())
+      {
+        logger("D::Using cached optical probe");
+        return *devices;
+      }
+    }
+  }
+  auto __expected_fn = [](auto&&){ return false; };
+  auto f_exists = [&](fs::path const& path_device) -> bool
+  {
+    return Try(fs::exists(path_device), "E::Error to check if file exists: {}", path_device);
+  };
+  std::vector<std::string> devices;
+  for(int i : std::views::iota(0,256))
+  {
+    bool sr_exists = f_exists(std::format("/dev/sr{}", i));
+    bool sg_exists = f_exists(std::format("/dev/sg{}", i));
+    if(sr_exists) { devices.push_back(std::format("/dev/sr{}", i)); }
+    if(sg_exists) { devices.push_back(std::format("/dev/sg{}", i)); }
+    // Stop if neither device exists
+    break_if(not sr_exists and not sg_exists);
+  }
+  // Save the probe, other sections of the cache are kept
+  if(not key.empty())
+  {
+    ns_db::Db db = ns_db::read_file(*path_file_probe).value_or(ns_db::Db{});
+    db("optical")("key") = key;
+    db("optical")("devices") = devices;
+    fs::path path_file_probe_temp = std::format("{}.tmp.{}", path_file_probe->string(), getpid());
+    std::error_code ec;
+    fs::create_directories(path_file_probe->parent_path(), ec);
+    if(ns_db::write_file(path_file_probe_temp, db))
+    {
+      Catch(fs::rename(path_file_probe_temp, *path_file_probe)).discard("E::Could not rename device probe cache");
+    }
+  }
+  return devices;
+}
+
+/**
+ * @brief Includes a binding from the host $HOME to the guest
+ *
+ * @param args Arguments to append to
+ * @param context Host information
+ */
+inline void bind_home(Args& args, Context const& context)
+{
+  if ( context.is_root ) { return; }
+  logger("D::PERM(HOME)");
+  auto ret = ns_env::get_expected("HOME");
+  return_if(not ret,, "E::HOME environment variable is unset");
+  ns_vector::push_back(args, "--bind-try", *ret, *ret);
+}
+
+/**
+ * @brief Binds the host's media directories to the guest
+ *
+ * The bindings are `/media`, `/run/media`, and `/mnt`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_media(Args& args)
+{
+  logger("D::PERM(MEDIA)");
+  ns_vector::push_back(args, "--bind-try", "/media", "/media");
+  ns_vector::push_back(args, "--bind-try", "/run/media", "/run/media");
+  ns_vector::push_back(args, "--bind-try", "/mnt", "/mnt");
+}
+
+/**
+ * @brief Binds the host's audio sockets and devices to the guest
+ *
+ * The bindings are $XDG_RUNTIME_DIR/{/pulse/native,pipewire-0}
+ *
+ * @param args Arguments to append to
+ * @param context Host information
+ */
+inline void bind_audio(Args& args, Context const& context)
+{
+  logger("D::PERM(AUDIO)");
+
+  // Try to bind pulse socket
+  fs::path path_socket_pulse = context.path_dir_xdg_runtime / "pulse/native";
+  ns_vector::push_back(args, "--bind-try", path_socket_pulse, path_socket_pulse);
+  ns_vector::push_back(args, "--setenv", "PULSE_SERVER", "unix:" + path_socket_pulse.string());
+
+  // Try to bind pipewire socket
+  fs::path path_socket_pipewire = context.path_dir_xdg_runtime / "pipewire-0";
+  ns_vector::push_back(args, "--bind-try", path_socket_pipewire, path_socket_pipewire);
+
+  // Other paths required to sound
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/dsp", "/dev/dsp");
+  ns_vector::push_back(args, "--bind-try", "/dev/snd", "/dev/snd");
+  ns_vector::push_back(args, "--bind-try", "/proc/asound", "/proc/asound");
+}
+
+/**
+ * @brief Binds the wayland socket from the host to the guest
+ *
+ * Requires the WAYLAND_DISPLAY variable set
+ * The binding is $XDG_RUNTIME_DIR/$WAYLAND_DISPLAY
+ *
+ * @param args Arguments to append to
+ * @param context Host information
+ */
+inline void bind_wayland(Args& args, Context const& context)
+{
+  logger("D::PERM(WAYLAND)");
+  // Get WAYLAND_DISPLAY
+  auto env_wayland_display = ns_env::get_expected("WAYLAND_DISPLAY");
+  return_if(not env_wayland_display,, "E::WAYLAND_DISPLAY is undefined");
+
+  // Get wayland socket
+  fs::path path_socket_wayland = context.path_dir_xdg_runtime / *env_wayland_display;
+
+  // Bind
+  ns_vector::push_back(args, "--bind-try", path_socket_wayland, path_socket_wayland);
+  ns_vector::push_back(args, "--setenv", "WAYLAND_DISPLAY", *env_wayland_display);
+}
+
+/**
+ * @brief Binds the xorg socket from the host to the guest
+ *
+ * Requires the DISPLAY environment variable set
+ * Requires the XAUTHORITY environment variable set
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_xorg(Args& args)
+{
+  logger("D::PERM(XORG)");
+  // Get DISPLAY
+  auto env_display = ns_env::get_expected("DISPLAY");
+  return_if(not env_display,, "E::DISPLAY is undefined");
+  // Get XAUTHORITY
+  auto env_xauthority = ns_env::get_expected("XAUTHORITY");
+  return_if(not env_xauthority,, "E::XAUTHORITY is undefined");
+  // Bind
+  ns_vector::push_back(args, "--ro-bind-try", *env_xauthority, *env_xauthority);
+  ns_vector::push_back(args, "--setenv", "XAUTHORITY", *env_xauthority);
+  ns_vector::push_back(args, "--setenv", "DISPLAY", *env_display);
+}
+
+/**
+ * @brief Binds the user session bus from the host to the guest
+ *
+ * Requires the DBUS_SESSION_BUS_ADDRESS environment variable set
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_dbus_user(Args& args)
+{
+  logger("D::PERM(DBUS_USER)");
+  // Get DBUS_SESSION_BUS_ADDRESS
+  auto env_dbus_session_bus_address = ns_env::get_expected("DBUS_SESSION_BUS_ADDRESS");
+  return_if(not env_dbus_session_bus_address,, "E::DBUS_SESSION_BUS_ADDRESS is undefined");
+
+  // Path to current session bus
+  std::string str_dbus_session_bus_path = *env_dbus_session_bus_address;
+
+  // Variable has expected contents similar to: 'unix:path=/run/user/1000/bus,guid=bb1adf978ae9c14....'
+  // Erase until the first '=' (inclusive)
+  if ( auto pos = str_dbus_session_bus_path.find('/'); pos != std::string::npos )
+  {
+    str_dbus_session_bus_path.erase(0, pos);
+  } // if
+
+  // Erase from the first ',' (inclusive)
+  if ( auto pos = str_dbus_session_bus_path.find(','); pos != std::string::npos )
+  {
+    str_dbus_session_bus_path.erase(pos);
+  } // if
+
+  // Bind
+  ns_vector::push_back(args, "--setenv", "DBUS_SESSION_BUS_ADDRESS", *env_dbus_session_bus_address);
+  ns_vector::push_back(args, "--bind-try", str_dbus_session_bus_path, str_dbus_session_bus_path);
+}
+
+/**
+ * @brief Binds the system bus from the host to the guest
+ *
+ * The binding is `/run/dbus/system_bus_socket`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_dbus_system(Args& args)
+{
+  logger("D::PERM(DBUS_SYSTEM)");
+  ns_vector::push_back(args, "--bind-try", "/run/dbus/system_bus_socket", "/run/dbus/system_bus_socket");
+}
+
+/**
+ * @brief Binds the udev folder from the host to the guest
+ *
+ * The binding is `/run/udev`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_udev(Args& args)
+{
+  logger("D::PERM(UDEV)");
+  ns_vector::push_back(args, "--bind-try", "/run/udev", "/run/udev");
+}
+
+/**
+ * @brief Binds the input devices from the host to the guest
+ *
+ * The bindings are `/dev/{input,uinput}`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_input(Args& args)
+{
+  logger("D::PERM(INPUT)");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/input", "/dev/input");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/uinput", "/dev/uinput");
+}
+
+/**
+ * @brief Binds the usb devices from the host to the guest
+ *
+ * The bindings are `/dev/bus/usb` and `/dev/usb`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_usb(Args& args)
+{
+  logger("D::PERM(USB)");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/bus/usb", "/dev/bus/usb");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/usb", "/dev/usb");
+}
+
+/**
+ * @brief Binds the network configuration from the host to the guest
+ *
+ * The bindings are:
+ * - `/etc/host.conf`
+ * - `/etc/hosts`
+ * - `/etc/nsswitch.conf`
+ * - `/etc/resolv.conf`
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_network(Args& args)
+{
+  logger("D::PERM(NETWORK)");
+  ns_vector::push_back(args, "--ro-bind-try", "/etc/host.conf", "/etc/host.conf");
+  ns_vector::push_back(args, "--ro-bind-try", "/etc/hosts", "/etc/hosts");
+  ns_vector::push_back(args, "--ro-bind-try", "/etc/nsswitch.conf", "/etc/nsswitch.conf");
+  ns_vector::push_back(args, "--ro-bind-try", "/etc/resolv.conf", "/etc/resolv.conf");
+}
+
+/**
+ * @brief Finds a hugetlbfs mount of the host, e.g., /dev/hugepages
+ *
+ * @return std::optional<fs::path> The mount point, or std::nullopt if there is none
+ */
+[[nodiscard]] inline std::optional<fs::path> find_hugetlbfs()
+{
+  std::ifstream file_mounts("/proc/self/mounts");
+  for(std::string line; std::getline(file_mounts, line);)
+  {
+    std::istringstream ss_line(line);
+    std::string device, path_dir_mount, type;
+    continue_if(not (ss_line >> device >> path_dir_mount >> type));
+    return_if(type == "hugetlbfs", fs::path(path_dir_mount));
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Gets the directory of an instance in a hugetlbfs mount of the host
+ *
+ * @param path_dir_hugetlbfs The hugetlbfs mount point
+ * @param pid Process ID of the instance
+ * @return fs::path The directory 'fim-<uid>-<pid>' in the mount
+ */
+[[nodiscard]] inline fs::path hugetlbfs_instance(fs::path const& path_dir_hugetlbfs, pid_t pid)
+{
+  return path_dir_hugetlbfs / std::format("fim-{}-{}", getuid(), pid);
+}
+
+/**
+ * @brief Removes the hugetlbfs directories of the instances of the user that exited
+ *
+ * Huge pages are only returned to the pool when the files that hold them are removed, the
+ * directory of an instance that crashed is removed by the next one.
+ *
+ * @param path_dir_hugetlbfs The hugetlbfs mount point
+ */
+inline void hugetlbfs_clean(fs::path const& path_dir_hugetlbfs)
+{
+  std::string const prefix = std::format("fim-{}-", getuid());
+  std::error_code ec;
+  for(auto const& entry : fs::directory_iterator(path_dir_hugetlbfs, ec))
+  {
+    std::string const name = entry.path().filename().string();
+    continue_if(not name.starts_with(prefix));
+    pid_t pid{};
+    char const* end = name.data() + name.size();
+    auto [ptr, errc] = std::from_chars(name.data() + prefix.size(), end, pid);
+    continue_if(errc != std::errc{} or ptr != end);
+    continue_if(::kill(pid, 0) == 0 or errno != ESRCH);
+    logger("D::Removing hugetlbfs directory '{}' of an exited instance", entry.path());
+    fs::remove_all(entry.path(), ec);
+    log_if(ec, "W::Could not remove '{}': {}", entry.path(), ec.message());
+  }
+}
+
+/**
+ * @brief Mounts the /dev/shm directory in the containter
+ *
+ * A tmpfs mount used for POSIX shared memory. Binds the one of the host by default, or mounts a
+ * private tmpfs of the configured size, or binds a directory of the hugetlbfs mount of the host
+ * so shared memory segments are backed by huge pages. The pages of a private tmpfs follow the
+ * memory policy of the process that touches them first, which 'fim-limit set affinity
+ * node:<list>' binds to NUMA nodes.
+ *
+ * hugetlbfs cannot be mounted in a user namespace, so the instance gets a private directory
+ * 'fim-<uid>-<pid>' in the mount of the host instead of the whole pool, which keeps the segments
+ * of other instances and users out of reach. Files of hugetlbfs are only written through mmap,
+ * applications that write(2) to their segments fail with EINVAL.
+ *
+ * @param args Arguments to append to
+ * @param context Host information and image settings
+ */
+inline void bind_shm(Args& args, Context const& context)
+{
+  logger("D::PERM(SHM)");
+  if(context.shm and context.shm->is_hugetlbfs)
+  {
+    if(auto path_dir_hugetlbfs = find_hugetlbfs())
+    {
+      hugetlbfs_clean(*path_dir_hugetlbfs);
+      if(auto ret = ns_fs::create_private_directory(hugetlbfs_instance(*path_dir_hugetlbfs, getpid())))
+      {
+        logger("D::Binding hugetlbfs directory '{}' to /dev/shm", *ret);
+        ns_vector::push_back(args, "--bind", ret->string(), "/dev/shm");
+        return;
+      }
+      else
+      {
+        logger("W::Could not create a directory in hugetlbfs, binding /dev/shm: {}", ret.error());
+      }
+    }
+    else
+    {
+      logger("W::The host has no hugetlbfs mount, binding /dev/shm");
+    }
+  }
+  else if(context.shm)
+  {
+    logger("D::Mounting a private tmpfs of {} bytes to /dev/shm", context.shm->size);
+    // Sticky and writable by all users, as /dev/shm
+    ns_vector::push_back(args, "--perms", "1777", "--size", std::to_string(context.shm->size), "--tmpfs", "/dev/shm");
+    return;
+  }
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/shm", "/dev/shm");
+}
+
+/**
+ * @brief Binds optical devices to the container
+ *
+ * Grants access to optical devices such as CD and DVD drives.
+ *
+ * @param args Arguments to append to
+ * @param context Host information
+ */
+inline void bind_optical(Args& args, Context const& context)
+{
+  logger("D::PERM(OPTICAL)");
+  for(auto const& path_device : probe_optical(context.path_file_probe))
+  {
+    ns_vector::push_back(args, "--dev-bind-try", path_device, path_device);
+  }
+}
+
+/**
+ * @brief Binds the /dev directory to the containter
+ *
+ * Superseeds all previous /dev related bindings
+ *
+ * @param args Arguments to append to
+ */
+inline void bind_dev(Args& args)
+{
+  logger("D::PERM(DEV)");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev", "/dev");
+}
+
+/**
+ * @brief Setup symlinks to nvidia drivers
+ *
+ * Searching the host library directories is slow, so the symlinks are recorded to a cache file
+ * along with the driver version and the modification times of the searched directories. While
+ * those stay the same, the recorded symlinks are reused and only the missing ones are created.
+ *
+ * @param path_dir_root_guest Path to the root directory of the sandbox
+ * @param path_dir_root_host Path to the root directory of the host system (from the guest)
+ * @param path_file_cache Path to the cache file of the driver symlinks
+ * @param args Arguments to append to
+ */
+inline void symlink_nvidia(fs::path const& path_dir_root_guest
+  , fs::path const& path_dir_root_host
+  , fs::path const& path_file_cache
+  , Args& args)
+{
+  std::regex regex_exclude("gst|icudata|egl-wayland", std::regex_constants::extended);
+
+  // Directories to search and the keywords of the files to link
+  std::vector<std::pair<fs::path, std::vector<std::string_view>>> const searches
+  {
+    {"/usr/lib", {"nvidia", "cuda", "nvcuvid", "nvoptix"}},
+    {"/usr/lib/x86_64-linux-gnu", {"nvidia", "cuda", "nvcuvid", "nvoptix"}},
+    {"/usr/lib/i386-linux-gnu", {"nvidia", "cuda", "nvcuvid", "nvoptix"}},
+    {"/usr/bin", {"nvidia"}},
+    {"/usr/share", {"nvidia"}},
+    {"/usr/share/vulkan/icd.d", {"nvidia"}},
+    {"/usr/lib32", {"nvidia", "cuda"}},
+  };
+
+  // The links change with the driver, or with the contents of the searched directories
+  std::string key = path_dir_root_host.string();
+  if(std::ifstream file_version("/proc/driver/nvidia/version"); file_version.is_open())
+  {
+    for(std::string line; std::getline(file_version, line);) { key += "|" + line; }
+  }
+  for(auto&& [path_dir_search, keywords] : searches)
+  {
+    struct stat st{};
+    key += (::stat(path_dir_search.c_str(), &st) == 0)?
+        std::format("|{}:{}.{}", path_dir_search.string(), st.st_mtim.tv_sec, st.st_mtim.tv_nsec)
+      : std::format("|{}:none", path_dir_search.string());
+  }
+
+  auto f_symlink = [&](fs::path const& path_link_name, fs::path const& path_link_target) -> void
+  {
+    // File already exists in the container as a regular file or directory, skip
+    return_if(fs::exists(path_link_name) and not fs::is_symlink(path_link_name),);
+    // Create parent directories
+    fs::create_directories(path_link_name.parent_path());
+    // Remove existing link
+    fs::remove(path_link_name);
+    // Symlink
+    fs::create_symlink(path_link_target.c_str(), path_link_name.c_str());
+    // Log symlink successful
+    logger("D::PERM(NVIDIA): {} -> {}", path_link_name, path_link_target);
+  };
+
+  ns_db::Db db_cache = ns_db::read_file(path_file_cache).value_or(ns_db::Db{});
+  if(db_cache("key").value<std::string>().value_or("") == key)
+  {
+    // Reuse the links of the previous search, only re-create the missing ones
+    for(auto&& [name, target] : db_cache("links").items())
+    {
+      fs::path path_link_name = path_dir_root_guest / name;
+      std::error_code ec;
+      continue_if(fs::is_symlink(path_link_name, ec));
+      auto path_link_target = target.value<std::string>();
+      continue_if(not path_link_target);
+      Catch(f_symlink(path_link_name, *path_link_target)).discard("E::Could not re-create link '{}'", path_link_name);
+    }
+    logger("D::PERM(NVIDIA): Reused cached driver links");
+  }
+  else
+  {
+    ns_db::Db db_cache_new;
+    db_cache_new("key") = key;
+    db_cache_new("links") = ns_db::object_t{};
+    auto f_find_and_bind = [&](fs::path const& path_dir_search, std::vector<std::string_view> const& keywords) -> void
+    {
+      return_if(not fs::exists(path_dir_search),, "E::Search path does not exist: '{}'", path_dir_search);
+      auto f_process_entry = [&](fs::path const& path_file_entry) -> void
+      {
+        // Skip ignored matches
+        return_if(std::regex_search(path_file_entry.c_str(), regex_exclude),);
+        // Skip directories
+        return_if(fs::is_directory(path_file_entry),);
+        // Skip files that do not match keywords
+        return_if(not std::ranges::any_of(keywords, [&](auto&& f){ return path_file_entry.filename().string().contains(f); }),);
+        // Symlink target is the file and the end of the symlink chain
+        // fs::canonical throws if path_file_entry does not exist
+        auto path_file_entry_realpath = fs::canonical(path_file_entry);
+        // Create target and symlink names
+        fs::path path_link_target = path_dir_root_host / path_file_entry_realpath.relative_path();
+        f_symlink(path_dir_root_guest / path_file_entry.relative_path(), path_link_target);
+        db_cache_new("links")(path_file_entry.relative_path().string()) = path_link_target.string();
+      };
+      // Process entries
+      for(auto&& path_file_entry : fs::directory_iterator(path_dir_search) | std::views::transform([](auto&& e){ return e.path(); }))
+      {
+        Catch(f_process_entry(path_file_entry)).template discard();
+      } // for
+    };
+    // Bind files
+    for(auto&& [path_dir_search, keywords] : searches)
+    {
+      f_find_and_bind(path_dir_search, keywords);
+    }
+    // Replace the cache atomically, other instances could be reading it
+    fs::path path_file_cache_temp = std::format("{}.tmp.{}", path_file_cache.string(), getpid());
+    if(ns_db::write_file(path_file_cache_temp, db_cache_new))
+    {
+      Catch(fs::rename(path_file_cache_temp, path_file_cache)).discard("E::Could not rename driver cache");
+    }
+  }
+
+  // Bind devices, these can appear at any time (e.g., nvidia-uvm) so they are never cached
+  for(auto&& entry : fs::directory_iterator("/dev")
+    | std::views::transform([](auto&& e){ return e.path(); })
+    | std::views::filter([](auto&& e){ return e.filename().string().contains("nvidia"); }))
+  {
+    ns_vector::push_back(args, "--dev-bind-try", entry, entry);
+  } // for
+}
+
+/**
+ * @brief Binds the gpu device from the host to the guest
+ *
+ * Creates the driver symlinks in the upper directory of the sandbox, which must exist, it does
+ * not need the filesystems of the image to be mounted.
+ *
+ * @param args Arguments to append to
+ * @param path_dir_root_guest Path to the root directory of the sandbox
+ * @param path_dir_root_host Path to the root directory of the host system (from the guest)
+ * @param path_file_cache Path to the cache file of the driver symlinks
+ */
+inline void bind_gpu(Args& args
+  , fs::path const& path_dir_root_guest
+  , fs::path const& path_dir_root_host
+  , fs::path const& path_file_cache)
+{
+  logger("D::PERM(GPU)");
+  ns_vector::push_back(args, "--dev-bind-try", "/dev/dri", "/dev/dri");
+  symlink_nvidia(path_dir_root_guest, path_dir_root_host, path_file_cache, args);
+}
+
+/**
+ * @brief Builds the arguments granted by the permissions
+ *
+ * GPU is not handled here, its bindings depend on the upper directory of the sandbox, see bind_gpu.
+ *
+ * @param permissions Permissions of the image
+ * @param context Host information
+ * @return Args The bubblewrap arguments
+ */
+[[nodiscard]] inline Args args(Permissions const& permissions, Context const& context)
+{
+  Args args;
+  if(permissions.contains(Permission::HOME)){ bind_home(args, context); };
+  if(permissions.contains(Permission::MEDIA)){ bind_media(args); };
+  if(permissions.contains(Permission::AUDIO)){ bind_audio(args, context); };
+  if(permissions.contains(Permission::WAYLAND)){ bind_wayland(args, context); };
+  if(permissions.contains(Permission::XORG)){ bind_xorg(args); };
+  if(permissions.contains(Permission::DBUS_USER)){ bind_dbus_user(args); };
+  if(permissions.contains(Permission::DBUS_SYSTEM)){ bind_dbus_system(args); };
+  if(permissions.contains(Permission::UDEV)){ bind_udev(args); };
+  if(permissions.contains(Permission::INPUT)){ bind_input(args); };
+  if(permissions.contains(Permission::USB)){ bind_usb(args); };
+  if(permissions.contains(Permission::NETWORK)){ bind_network(args); };
+  if(permissions.contains(Permission::SHM)){ bind_shm(args, context); };
+  if(permissions.contains(Permission::OPTICAL)){ bind_optical(args, context); };
+  if(permissions.contains(Permission::DEV)){ bind_dev(args); };
+  return args;
+}
+
+} // namespace ns_bwrap::ns_grant
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
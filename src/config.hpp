@@ -18,11 +18,14 @@
 #include <pwd.h>
 #include <filesystem>
 #include <format>
+#include <random>
 #include <unordered_map>
 
 #include "bwrap/bwrap.hpp"
 #include "filesystems/controller.hpp"
 #include "filesystems/layers.hpp"
+#include "db/perf.hpp"
+#include "db/limit.hpp"
 #include "db/portal/daemon.hpp"
 #include "db/portal/dispatcher.hpp"
 #include "lib/env.hpp"
@@ -34,6 +37,7 @@
 #include "reserved/casefold.hpp"
 #include "reserved/notify.hpp"
 #include "reserved/overlay.hpp"
+#include "reserved/volatile.hpp"
 #include "std/filesystem.hpp"
 
 // Version
@@ -121,7 +125,8 @@ namespace fs = std::filesystem;
  * │               ├── passwd
  * │               ├── portal/                 (portal)
  * │               │   ├── daemon/
- * │               │   └── dispatcher/
+ * │               │   ├── dispatcher/
+ * │               │   └── snapshot.json       (configuration of the portal helpers)
  * │               ├── logs/
  * │               ├── mount/                  (merged root)
  * │               └── layers/                 (layer mounts)
@@ -137,6 +142,11 @@ namespace fs = std::filesystem;
  *     ├── root/
  *     ├── casefold/
  *     └── recipes/
+ *
+ * $XDG_CACHE_HOME/flatimage/                   (cache, mode 0700)
+ * ├── bwrap.json                              (bwrap probe)
+ * ├── probe.json                              (host device probes)
+ * └── remote/                                 (layers downloaded from URLs, mode 0700)
  * @endcode
  */
 class Path
@@ -160,6 +170,7 @@ class Path
     fs::path const host_data;       ///< Data directory next to binary
     fs::path const host_data_tmp;   ///< Temporary files in data directory
     fs::path const host_data_layers; ///< Layers directory in data directory
+    fs::path const cache;           ///< Per-user cache directory ($XDG_CACHE_HOME/flatimage)
 
     static Value<Dir> create()
     {
@@ -180,6 +191,8 @@ class Path
         self / std::format(".{}.data", path_bin_self.filename().string());
       fs::path host_data_tmp = host_data / "tmp";
       fs::path host_data_layers = host_data / "layers";
+      // Caches of host probes are private to the user, created by the code that writes them
+      fs::path cache = ns_env::xdg_cache_home<fs::path>().value_or(host_data / "cache") / "flatimage";
       // Side effect: create directories
       Pop(ns_fs::create_directories(host_data_tmp));
       Pop(ns_fs::create_directories(host_data_layers));
@@ -198,7 +211,8 @@ class Path
         .host_home = std::move(host_home),
         .host_data = std::move(host_data),
         .host_data_tmp = std::move(host_data_tmp),
-        .host_data_layers = std::move(host_data_layers)
+        .host_data_layers = std::move(host_data_layers),
+        .cache = std::move(cache)
       };
     }
   } dir;
@@ -208,14 +222,16 @@ class Path
    */
   struct File
   {
-    fs::path const bashrc;  ///< Path to instance-specific bashrc file
-    fs::path const passwd;  ///< Path to instance-specific passwd file
+    fs::path const bashrc;    ///< Path to instance-specific bashrc file
+    fs::path const passwd;    ///< Path to instance-specific passwd file
+    fs::path const snapshot;  ///< Path to the configuration of the portal helpers
 
     static File create(fs::path const& path_dir_instance)
     {
       return File{
         .bashrc = path_dir_instance / "bashrc",
-        .passwd = path_dir_instance / "passwd"
+        .passwd = path_dir_instance / "passwd",
+        .snapshot = path_dir_instance / "portal" / "snapshot.json"
       };
     }
   } file;
@@ -300,6 +316,7 @@ class Path
  * │   ├── overlayfs.log             - OverlayFS logs
  * │   ├── unionfs.log               - UnionFS logs
  * │   ├── janitor.log               - Filesystem janitor logs
+ * │   ├── perfmon.log               - DwarFS performance monitor summaries on un-mount
  * │   └── guest/                    - Guest filesystem logs
  * └── boot.log                      - Boot/initialization logs
  * @endcode
@@ -326,6 +343,7 @@ struct Logs
         .path_file_overlayfs = path_dir_log / "fuse" / "overlayfs.log",
         .path_file_unionfs = path_dir_log / "fuse" / "unionfs.log",
         .path_file_janitor = path_dir_log / "fuse" / "janitor.log",
+        .path_file_perfmon = path_dir_log / "fuse" / "perfmon.log",
       })
     , path_file_boot(path_dir_log / "boot.log")
   {
@@ -370,6 +388,8 @@ struct Config
    * - Daemon: host and guest portal configurations
    *
    * @param is_casefold Enable case-insensitive filesystem layer
+   * @param is_volatile Discard the changes of the run, kept in memory until then
+   * @param path_dir_app Application directory path, shared by all instances
    * @param path_dir_instance Instance-specific directory path
    * @param path_dir_host_data Host configuration directory path
    * @param path_bin_janitor Path to janitor cleanup binary
@@ -381,6 +401,8 @@ struct Config
   static Value<Config> create(
     ns_filesystems::ns_layers::Layers const& layers,
     bool const is_casefold,
+    bool const is_volatile,
+    fs::path const& path_dir_app,
     fs::path const& path_dir_instance,
     fs::path const& path_dir_host_data,
     fs::path const& path_bin_janitor,
@@ -391,16 +413,47 @@ struct Config
   {
     // Compute paths first
     auto path_dir_mount = path_dir_instance / "mount";
-    auto path_dir_work = path_dir_host_data / "work" / std::to_string(getpid());
+    fs::path path_dir_work = path_dir_host_data / "work" / std::to_string(getpid());
     auto path_dir_upper = path_dir_host_data / "root";
     auto path_dir_layers = path_dir_instance / "layers";
+    auto path_dir_share = path_dir_app / "share";
     auto path_dir_ciopfs = path_dir_host_data / "casefold";
+    auto path_dir_trace = path_dir_host_data / "trace";
+    // Concurrent instances write to an upper directory of their own, FIM_CONCURRENT=merge keeps
+    // their changes on exit
+    bool const is_merge = not is_volatile and ns_env::exists("FIM_CONCURRENT", "merge");
+    fs::path path_dir_upper_instance;
+    fs::path path_dir_volatile;
+    if(is_volatile)
+    {
+      // Unprivileged processes cannot mount a tmpfs on the host, use the shared memory one. The
+      // name can not be guessed by other users, the directory is created exclusively on mount
+      std::random_device random;
+      path_dir_volatile = ns_filesystems::ns_utils::is_tmpfs("/dev/shm")?
+          fs::path{"/dev/shm"} / std::format("fim-{}-{:08x}{:08x}", getpid(), random(), random())
+        : path_dir_instance / "volatile";
+      log_if(not path_dir_volatile.string().starts_with("/dev/shm")
+        , "W::'/dev/shm' is not a tmpfs, volatile changes are written to '{}'", path_dir_volatile
+      );
+      path_dir_upper_instance = path_dir_volatile / "upper";
+      path_dir_work = path_dir_volatile / "work";
+    }
+    else if(is_merge or ns_env::exists("FIM_CONCURRENT", "1"))
+    {
+      path_dir_upper_instance = path_dir_host_data / "instances" / std::to_string(getpid());
+    }
+    // The casefold mount point is per instance as well
+    if(not path_dir_upper_instance.empty())
+    {
+      path_dir_ciopfs = path_dir_instance / "casefold";
+    }
 
-    // Side effects: create directories
+    // Side effects: create directories, the volatile ones are created on mount
     fs::create_directories(path_dir_mount);
-    fs::create_directories(path_dir_work);
+    if(path_dir_volatile.empty()) { fs::create_directories(path_dir_work); }
     fs::create_directories(path_dir_upper);
     fs::create_directories(path_dir_layers);
+    fs::create_directories(path_dir_share);
     fs::create_directories(path_dir_ciopfs);
 
     // Configure overlay type
@@ -417,6 +470,14 @@ struct Config
       overlay_type = ns_reserved::ns_overlay::OverlayType::UNIONFS;
     }
 
+    // Access recording only sees reads done through a fuse overlay
+    bool const is_trace = ns_env::exists("FIM_TRACE_ACCESS", "1");
+    if(is_trace and overlay_type == ns_reserved::ns_overlay::OverlayType::BWRAP)
+    {
+      logger("W::access recording cannot be used with bwrap overlayfs, falling back to unionfs");
+      overlay_type = ns_reserved::ns_overlay::OverlayType::UNIONFS;
+    }
+
     // Compression level configuration (clamps from 0 to 9, default is 7)
     uint32_t const compression_level = ({
       std::string str_compression_level = ns_env::get_expected<"D">("FIM_COMPRESSION_LEVEL").value_or("7");
@@ -428,16 +489,28 @@ struct Config
     auto fuse = ns_filesystems::ns_controller::Config
     {
       .is_casefold = is_casefold,
+      // Layers are shared between instances unless disabled with FIM_SHARE_LAYERS=0
+      .is_share = not ns_env::exists("FIM_SHARE_LAYERS", "0"),
+      .is_trace = is_trace,
       .compression_level = compression_level,
       .overlay_type = overlay_type,
       .path_dir_mount = std::move(path_dir_mount),
       .path_dir_work = std::move(path_dir_work),
       .path_dir_upper = std::move(path_dir_upper),
       .path_dir_layers = std::move(path_dir_layers),
+      .path_dir_upper_instance = std::move(path_dir_upper_instance),
+      .is_merge = is_merge,
+      .path_dir_volatile = std::move(path_dir_volatile),
+      .path_dir_share = std::move(path_dir_share),
+      .path_dir_trace = std::move(path_dir_trace),
       .path_dir_ciopfs = std::move(path_dir_ciopfs),
       .path_bin_janitor = path_bin_janitor,
+      // The host portal daemon cleans the mounts of a crashed instance instead of a janitor
+      .path_file_supervisor = ns_env::exists("FIM_SUPERVISOR", "1")? path_dir_instance / "supervisor" : fs::path{},
       .path_bin_self = path_bin_self,
       .layers = layers,
+      .perf = ns_db::ns_perf::get(path_bin_self).value_or(ns_db::ns_perf::Perf{}),
+      .affinity = ns_db::ns_limit::get(path_bin_self).value_or(ns_db::ns_limit::Limit{}).placement(true),
     };
 
     auto daemon = Daemon
@@ -466,8 +539,8 @@ struct Config
  * Controls FlatImage behavior through environment variables and reserved space:
  *
  * Flag resolution priority (highest to lowest):
- * 1. Environment variables (FIM_ROOT, FIM_DEBUG, FIM_CASEFOLD)
- * 2. Reserved space configuration (casefold, notify)
+ * 1. Environment variables (FIM_ROOT, FIM_DEBUG, FIM_CASEFOLD, FIM_VOLATILE)
+ * 2. Reserved space configuration (casefold, notify, volatile)
  * 3. Binary environment database (UID check for root)
  *
  * @note All flags are immutable after creation
@@ -482,6 +555,7 @@ struct Flags
   bool is_debug;      ///< Enable debug logging? Set via FIM_DEBUG=1
   bool is_casefold;   ///< Enable case-insensitive filesystem? Via FIM_CASEFOLD or reserved space
   bool is_notify;     ///< Show desktop notifications? Stored in reserved space
+  bool is_volatile;   ///< Discard the changes of each run? Via FIM_VOLATILE or reserved space
 
   /**
    * @brief Factory method to create Flags
@@ -491,6 +565,7 @@ struct Flags
    * - is_debug: FIM_DEBUG env
    * - is_casefold: FIM_CASEFOLD env → reserved space
    * - is_notify: reserved space only
+   * - is_volatile: FIM_VOLATILE env → reserved space
    *
    * @param path_bin_self Path to FlatImage binary
    * @return Value<Flags> Initialized flags or error
@@ -504,6 +579,8 @@ struct Flags
     flags.is_casefold = ns_env::exists("FIM_CASEFOLD", "1")
       or Pop(ns_reserved::ns_casefold::read(path_bin_self));
     flags.is_notify = Pop(ns_reserved::ns_notify::read(path_bin_self));
+    flags.is_volatile = ns_env::exists("FIM_VOLATILE", "1")
+      or Pop(ns_reserved::ns_volatile::read(path_bin_self));
     flags.is_debug = ns_env::exists("FIM_DEBUG", "1");
     return flags;
   }
@@ -579,6 +656,21 @@ struct FlatImage
     }
     return overlay_type;
   }
+
+  /**
+   * @brief Gets the fuse overlay used when the kernel overlay of bwrap is unavailable
+   *
+   * FIM_OVERLAY_FALLBACK overrides the one set with 'fim-overlay fallback'.
+   *
+   * @return ns_reserved::ns_overlay::OverlayType OVERLAYFS or UNIONFS
+   */
+  ns_reserved::ns_overlay::OverlayType overlay_fallback()
+  {
+    using ns_reserved::ns_overlay::OverlayType;
+    return ns_env::exists("FIM_OVERLAY_FALLBACK", "unionfs")? ns_reserved::ns_overlay::OverlayType::UNIONFS
+      : ns_env::exists("FIM_OVERLAY_FALLBACK", "overlayfs")? ns_reserved::ns_overlay::OverlayType::OVERLAYFS
+      : ns_reserved::ns_overlay::read_fallback(path.bin.self).value_or(OverlayType::UNIONFS).get();
+  }
 }; // struct FlatImage
 
 /**
@@ -602,14 +694,22 @@ struct FlatImage
 
   // Gather layers
   ns_filesystems::ns_layers::Layers layers;
-  layers.push_binary(path.bin.self, FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE);
-  layers.push_from_var("FIM_LAYERS").discard("W::Failed to setup FIM_LAYERS");
-  layers.push(path.dir.host_data_layers).discard("W::Failed to setup host_data_layers");
+  // Layers given by URL are downloaded once to a cache shared by all images
+  layers.set_remote(path.dir.app_sbin / "wget", path.dir.cache / "remote");
+  // Embedded layers are indexed in the data directory to skip re-scanning the binary on each boot,
+  // external layer files are validated once per change
+  layers.push_binary(path.bin.self, FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE, path.dir.host_data / "layers.json");
+  layers.push_from_var("FIM_LAYERS", path.dir.host_data / "layers.json").discard("W::Failed to setup FIM_LAYERS");
+  layers.push(path.dir.host_data_layers, path.dir.host_data / "layers.json").discard("W::Failed to setup host_data_layers");
+  // Layers whose fingerprints collide are hashed to tell the copies apart
+  layers.resolve_copies(path.bin.self, path.dir.host_data / "layers.json");
 
   // Module configuration
   Config config = Pop(Config::create(
     layers,
     flags.is_casefold,
+    flags.is_volatile,
+    path.dir.app,
     path.dir.instance,
     path.dir.host_data,
     path.bin.janitor,
@@ -9,9 +9,11 @@
 #pragma once
 
 
+#include <algorithm>
 #include <string>
 
 #include "db.hpp"
+#include "compact.hpp"
 #include "../std/expected.hpp"
 
 #include "../std/enum.hpp"
@@ -94,15 +96,32 @@ struct Binds
      * public methods to maintain invariants such as index consistency.
      */
     std::vector<Bind> m_binds;
+    void reindex();
   public:
     Binds() = default;
     std::vector<Bind> const& get() const;
-    void push_back(Bind const& bind);
+    size_t push_back(Bind bind);
     void erase(size_t index);
     bool empty() const noexcept;
     friend Value<Binds> deserialize(std::string_view raw_json);
 };
 
+/**
+ * @brief Makes the index of each bind mount its position in the collection
+ *
+ * Entries are kept in the order of their indices, so an index addresses its entry directly and
+ * the next index is the size of the collection. Sections written by older versions may have
+ * gaps or be out of order, the relative order of their entries is preserved.
+ */
+inline void Binds::reindex()
+{
+  if(not std::ranges::is_sorted(m_binds, {}, &Bind::index))
+  {
+    std::ranges::stable_sort(m_binds, {}, &Bind::index);
+  }
+  for(size_t i{}; auto& bind : m_binds) { bind.index = i++; }
+}
+
 /**
  * @brief Retrieves the current list of bind mounts
  *
@@ -121,38 +140,40 @@ struct Binds
  * @brief Appends a new bind mount to the collection
  *
  * Adds the provided bind mount configuration to the internal vector. The bind
- * mount will be appended to the end of the list, maintaining insertion order.
- * No validation is performed; the caller is responsible for ensuring the bind
- * configuration is valid.
+ * mount will be appended to the end of the list, maintaining insertion order,
+ * and receives the next index. No validation is performed; the caller is
+ * responsible for ensuring the bind configuration is valid.
  * 
  * @param bind The bind mount configuration to add to the collection
+ * @return size_t The index assigned to the bind mount
  */
-inline void Binds::push_back(Bind const& bind)
+inline size_t Binds::push_back(Bind bind)
 {
-  m_binds.push_back(bind);
+  bind.index = m_binds.size();
+  m_binds.push_back(std::move(bind));
+  return m_binds.back().index;
 }
 
 /**
  * @brief Removes a bind mount by its index
  *
- * Searches for and removes the bind mount with the specified index from the internal
- * vector. After removal, reindexes all remaining bind mounts sequentially starting
- * from 0 to maintain consistent indexing. Logs whether the element was found and
- * removed or if no element with the given index existed.
+ * Removes the bind mount at the specified index from the internal vector. After
+ * removal, the following bind mounts are shifted down by one to keep the indices
+ * sequential. Logs whether the element was found and removed or if no element with
+ * the given index existed.
  * 
  * @param index The zero-based index of the bind mount to remove
  */
 inline void Binds::erase(size_t index)
 {
-  if (std::erase_if(m_binds, [&](auto&& bind){ return bind.index == index; }) > 0)
-  {
-    logger("I::Erase element with index '{}'", index);
-  }
-  else
+  if (index >= m_binds.size())
   {
     logger("I::No element with index '{}' found", index);
+    return;
   }
-  for(long i{}; auto& bind : m_binds) { bind.index = i++; }
+  m_binds.erase(m_binds.begin() + index);
+  logger("I::Erase element with index '{}'", index);
+  for(auto it = m_binds.begin() + index; it != m_binds.end(); ++it) { it->index -= 1; }
 }
 
 /**
@@ -168,6 +189,52 @@ inline bool Binds::empty() const noexcept
   return m_binds.empty();
 }
 
+/**
+ * @brief Decodes the bindings in the compact encoding
+ *
+ * Layout: count, then index, source, destination and type of each binding.
+ *
+ * @param data The encoded section
+ * @return Value<std::vector<Bind>> The bindings, or the respective error
+ */
+[[nodiscard]] inline Value<std::vector<Bind>> decode(std::string_view data)
+{
+  auto reader = Pop(ns_compact::Reader::open(data, ns_compact::Kind::BINDINGS));
+  uint64_t count = Pop(reader.integer());
+  return_if(count > data.size(), Error("E::Invalid bind count '{}'", count));
+  std::vector<Bind> binds(count);
+  for(auto& bind : binds)
+  {
+    bind.index = Pop(reader.integer());
+    bind.path_src = Pop(reader.string());
+    bind.path_dst = Pop(reader.string());
+    uint64_t type = Pop(reader.integer());
+    return_if(type >= Type().size, Error("E::Invalid bind type '{}'", type));
+    bind.type = Type(static_cast<Type::enum_t>(type));
+  }
+  return binds;
+}
+
+/**
+ * @brief Encodes the bindings in the compact encoding
+ *
+ * @param binds The bindings to encode
+ * @return Value<std::string> The encoded section, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> encode(Binds const& binds)
+{
+  ns_compact::Writer writer(ns_compact::Kind::BINDINGS);
+  writer.integer(binds.get().size());
+  for(auto&& bind : binds.get())
+  {
+    writer.integer(bind.index)
+      .string(bind.path_src.string())
+      .string(bind.path_dst.string())
+      .integer(static_cast<uint64_t>(bind.type.get()));
+  }
+  return writer.finish();
+}
+
 /**
  * @brief Deserializes JSON string into a Binds object
  *
@@ -185,6 +252,14 @@ inline bool Binds::empty() const noexcept
 {
   Binds binds;
 
+  // Sections written by this version are in the compact encoding
+  if(ns_compact::is_compact(raw_json))
+  {
+    binds.m_binds = Pop(decode(raw_json));
+    binds.reindex();
+    return binds;
+  }
+
   auto db = Pop(ns_db::from_string(raw_json));
 
   for(auto [key,value] : db.items())
@@ -209,6 +284,7 @@ inline bool Binds::empty() const noexcept
       continue;
     }
   }
+  binds.reindex();
   return binds;
 }
 
@@ -13,6 +13,7 @@
 
 #include "../std/expected.hpp"
 #include "db.hpp"
+#include "compact.hpp"
 
 /**
  * @namespace ns_db::ns_boot
@@ -58,6 +59,19 @@ inline Boot::Boot()
 {
   Boot boot;
   return_if(str_raw_json.empty(), Error("D::Empty json data"));
+  // Sections written by this version are in the compact encoding: program, count, args
+  if(ns_compact::is_compact(str_raw_json))
+  {
+    auto reader = Pop(ns_compact::Reader::open(str_raw_json, ns_compact::Kind::BOOT));
+    boot.m_program = Pop(reader.string());
+    uint64_t count = Pop(reader.integer());
+    return_if(count > str_raw_json.size(), Error("E::Invalid argument count '{}'", count));
+    for(uint64_t i = 0; i < count; ++i)
+    {
+      boot.m_args.emplace_back(Pop(reader.string()));
+    }
+    return boot;
+  }
   // Open DB
   auto db = Pop(ns_db::from_string(str_raw_json));
   // Parse program (optional, defaults to empty string)
@@ -81,6 +95,23 @@ inline Boot::Boot()
   return db.dump();
 }
 
+/**
+ * @brief Encodes a `Boot` class in the compact encoding of the reserved space
+ *
+ * @param boot The `Boot` object to encode
+ * @return The encoded data, or the respective error
+ */
+[[maybe_unused]] [[nodiscard]] inline Value<std::string> encode(Boot const& boot) noexcept
+{
+  ns_compact::Writer writer(ns_compact::Kind::BOOT);
+  writer.string(boot.get_program()).integer(boot.get_args().size());
+  for(auto&& arg : boot.get_args())
+  {
+    writer.string(arg);
+  }
+  return writer.finish();
+}
+
 } // namespace ns_db::ns_boot
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
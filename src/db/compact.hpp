@@ -0,0 +1,234 @@
+/**
+ * @file compact.hpp
+ * @author Ruan Formigoni
+ * @brief Compact binary encoding of the configuration sections in the reserved space
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_db::ns_compact
+ * @brief Compact encoding of the reserved space configuration sections
+ *
+ * A section starts with a header: the magic bytes, the format version and the kind of the
+ * section. It is followed by a sequence of integers and length prefixed strings, whose layout
+ * is defined by the reader and writer of each section. Integers are stored as the LEB128 form
+ * of the value plus one, which never contains a null byte. Strings cannot contain null bytes
+ * either, so an encoded section is a null terminated string like the json sections it replaces
+ * and goes through the same reserved space readers and writers.
+ *
+ * Json data never starts with the magic bytes, so sections written by older versions are told
+ * apart and still parsed as json.
+ */
+namespace ns_db::ns_compact
+{
+
+// Header of an encoded section
+constexpr std::string_view const magic = "\x7f" "FIM";
+constexpr uint64_t const version = 1;
+
+/**
+ * @brief Kind of an encoded section, decoding a section as another kind fails
+ */
+enum class Kind : uint64_t
+{
+  ENVIRONMENT = 1,
+  BINDINGS,
+  BOOT,
+  DESKTOP,
+  REMOTE,
+};
+
+/**
+ * @brief Checks if the data of a section is in the compact encoding
+ *
+ * @param data The data of the section
+ * @return bool True if the data starts with the compact header, false otherwise
+ */
+[[nodiscard]] inline bool is_compact(std::string_view data) noexcept
+{
+  return data.starts_with(magic);
+}
+
+/**
+ * @class Writer
+ * @brief Encodes a section
+ */
+class Writer
+{
+  private:
+    std::string m_data;
+    std::string m_error;
+
+  public:
+    explicit Writer(Kind kind);
+    Writer& integer(uint64_t value);
+    Writer& string(std::string_view value);
+    [[nodiscard]] Value<std::string> finish();
+};
+
+/**
+ * @brief Construct a new Writer object and write the header
+ *
+ * @param kind Kind of the section
+ */
+inline Writer::Writer(Kind kind)
+  : m_data(magic)
+  , m_error()
+{
+  integer(version);
+  integer(static_cast<uint64_t>(kind));
+}
+
+/**
+ * @brief Appends an integer
+ *
+ * @param value The integer to append, below UINT64_MAX
+ * @return Writer& A reference to this writer
+ */
+inline Writer& Writer::integer(uint64_t value)
+{
+  if(value == UINT64_MAX)
+  {
+    m_error = "Integers must be below UINT64_MAX";
+    return *this;
+  }
+  // Offset by one, the last byte of the encoding of a non-zero value is never zero
+  value += 1;
+  do
+  {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    m_data.push_back(static_cast<char>(value? (byte | 0x80) : byte));
+  }
+  while(value);
+  return *this;
+}
+
+/**
+ * @brief Appends a length prefixed string
+ *
+ * @param value The string to append, it cannot contain null bytes
+ * @return Writer& A reference to this writer
+ */
+inline Writer& Writer::string(std::string_view value)
+{
+  if(value.contains('\0'))
+  {
+    m_error = "Strings cannot contain null bytes";
+    return *this;
+  }
+  integer(value.size());
+  m_data.append(value);
+  return *this;
+}
+
+/**
+ * @brief Gets the encoded section
+ *
+ * @return Value<std::string> The encoded section, or the first error found while writing it
+ */
+[[nodiscard]] inline Value<std::string> Writer::finish()
+{
+  return_if(not m_error.empty(), Error("E::Could not encode section: {}", m_error));
+  return std::move(m_data);
+}
+
+/**
+ * @class Reader
+ * @brief Decodes a section, the strings it returns are views into the encoded data
+ */
+class Reader
+{
+  private:
+    std::string_view m_data;
+
+    explicit Reader(std::string_view data);
+
+  public:
+    [[nodiscard]] static Value<Reader> open(std::string_view data, Kind kind);
+    [[nodiscard]] Value<uint64_t> integer();
+    [[nodiscard]] Value<std::string_view> string();
+};
+
+/**
+ * @brief Construct a new Reader object
+ *
+ * @param data The encoded data past the header
+ */
+inline Reader::Reader(std::string_view data)
+  : m_data(data)
+{
+}
+
+/**
+ * @brief Checks the header of a section and creates a reader for its contents
+ *
+ * @param data The encoded section
+ * @param kind The expected kind of the section
+ * @return Value<Reader> The reader, or the respective error
+ */
+[[nodiscard]] inline Value<Reader> Reader::open(std::string_view data, Kind kind)
+{
+  return_if(not is_compact(data), Error("E::Section is not in the compact encoding"));
+  Reader reader(data.substr(magic.size()));
+  uint64_t version_section = Pop(reader.integer());
+  return_if(version_section != version, Error("E::Unsupported section version '{}'", version_section));
+  uint64_t kind_section = Pop(reader.integer());
+  return_if(kind_section != static_cast<uint64_t>(kind)
+    , Error("E::Section kind '{}' does not match the expected '{}'", kind_section, static_cast<uint64_t>(kind))
+  );
+  return reader;
+}
+
+/**
+ * @brief Reads an integer
+ *
+ * @return Value<uint64_t> The integer, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> Reader::integer()
+{
+  uint64_t value = 0;
+  for(uint32_t shift = 0; shift < 64; shift += 7)
+  {
+    return_if(m_data.empty(), Error("E::Truncated integer in section"));
+    uint8_t byte = static_cast<uint8_t>(m_data.front());
+    m_data.remove_prefix(1);
+    // Only the lowest bit of the tenth byte fits in the value
+    return_if(shift == 63 and (byte & 0x7e), Error("E::Integer too large in section"));
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if(not (byte & 0x80))
+    {
+      return_if(value == 0, Error("E::Invalid integer in section"));
+      return value - 1;
+    }
+  }
+  return Error("E::Integer too large in section");
+}
+
+/**
+ * @brief Reads a length prefixed string
+ *
+ * @return Value<std::string_view> View of the string in the encoded data, or the respective error
+ */
+[[nodiscard]] inline Value<std::string_view> Reader::string()
+{
+  uint64_t size = Pop(integer());
+  return_if(size > m_data.size(), Error("E::Truncated string in section"));
+  std::string_view value = m_data.substr(0, size);
+  m_data.remove_prefix(size);
+  return value;
+}
+
+} // namespace ns_db::ns_compact
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -14,6 +14,7 @@
 #include "../std/expected.hpp"
 #include "../std/enum.hpp"
 #include "db.hpp"
+#include "compact.hpp"
 
 /**
  * @namespace ns_db::ns_desktop
@@ -70,6 +71,25 @@ inline Desktop::Desktop()
 {
   Desktop desktop;
   return_if(str_raw_json.empty(), Error("W::Empty json data"));
+  // Sections written by this version are in the compact encoding
+  if(ns_compact::is_compact(str_raw_json))
+  {
+    auto reader = Pop(ns_compact::Reader::open(str_raw_json, ns_compact::Kind::DESKTOP));
+    desktop.m_name = Pop(reader.string());
+    uint64_t count_integrations = Pop(reader.integer());
+    for(uint64_t i = 0; i < count_integrations; ++i)
+    {
+      uint64_t item = Pop(reader.integer());
+      return_if(item >= IntegrationItem().size, Error("E::Invalid integration item '{}'", item));
+      desktop.m_set_integrations.insert(IntegrationItem(static_cast<IntegrationItem::enum_t>(item)));
+    }
+    uint64_t count_categories = Pop(reader.integer());
+    for(uint64_t i = 0; i < count_categories; ++i)
+    {
+      desktop.m_set_categories.emplace(Pop(reader.string()));
+    }
+    return desktop;
+  }
   // Open DB
   auto db = Pop(ns_db::from_string(str_raw_json));
   // Parse name (required)
@@ -119,6 +139,31 @@ inline Desktop::Desktop()
   return db.dump();
 }
 
+/**
+ * @brief Encodes a `Desktop` class in the compact encoding of the reserved space
+ *
+ * Layout: name, count and values of the integrations, count and values of the categories. The
+ * icon path is not stored, the icon itself has its own section.
+ *
+ * @param desktop The `Desktop` object to encode
+ * @return The encoded data, or the respective error
+ */
+[[maybe_unused]] [[nodiscard]] inline Value<std::string> encode(Desktop const& desktop) noexcept
+{
+  ns_compact::Writer writer(ns_compact::Kind::DESKTOP);
+  writer.string(desktop.get_name()).integer(desktop.get_integrations().size());
+  for(auto&& item : desktop.get_integrations())
+  {
+    writer.integer(static_cast<uint64_t>(item.get()));
+  }
+  writer.integer(desktop.get_categories().size());
+  for(auto&& category : desktop.get_categories())
+  {
+    writer.string(category);
+  }
+  return writer.finish();
+}
+
 } // namespace ns_db::ns_desktop
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -11,11 +11,13 @@
 #include <ranges>
 #include <filesystem>
 #include <format>
+#include <map>
 
 #include "../std/expected.hpp"
 #include "../lib/env.hpp"
 #include "../reserved/env.hpp"
 #include "db.hpp"
+#include "compact.hpp"
 
 /**
  * @namespace ns_db::ns_env
@@ -72,6 +74,58 @@ namespace fs = std::filesystem;
   return {};
 }
 
+/**
+ * @brief Reads the environment variables from the reserved space
+ *
+ * The compact encoding is a count followed by the key and value of each variable, sections in
+ * json from older versions are still read.
+ *
+ * @param path_file_binary Path to the binary with the environment variables
+ * @return The variables sorted by key, or the respective error
+ */
+[[nodiscard]] inline Value<std::map<std::string,std::string>> read(fs::path const& path_file_binary)
+{
+  std::string data = Pop(ns_reserved::ns_env::read(path_file_binary));
+  std::map<std::string,std::string> variables;
+  if(ns_compact::is_compact(data))
+  {
+    auto reader = Pop(ns_compact::Reader::open(data, ns_compact::Kind::ENVIRONMENT));
+    uint64_t count = Pop(reader.integer());
+    return_if(count > data.size(), Error("E::Invalid variable count '{}'", count));
+    for(uint64_t i = 0; i < count; ++i)
+    {
+      std::string key{Pop(reader.string())};
+      variables[key] = Pop(reader.string());
+    }
+    return variables;
+  }
+  ns_db::Db db = ns_db::from_string(data).value_or(ns_db::Db());
+  for (auto&& [key,value] : db.items())
+  {
+    variables[key] = Pop(value.template value<std::string>());
+  }
+  return variables;
+}
+
+/**
+ * @brief Writes the environment variables to the reserved space
+ *
+ * @param path_file_binary Path to the binary with the environment variables
+ * @param variables The variables to write
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write(fs::path const& path_file_binary, std::map<std::string,std::string> const& variables)
+{
+  ns_compact::Writer writer(ns_compact::Kind::ENVIRONMENT);
+  writer.integer(variables.size());
+  for(auto&& [key,value] : variables)
+  {
+    writer.string(key).string(value);
+  }
+  Pop(ns_reserved::ns_env::write(path_file_binary, Pop(writer.finish())));
+  return {};
+}
+
 } // namespace
 
 /**
@@ -82,10 +136,10 @@ namespace fs = std::filesystem;
  */
 [[nodiscard]] inline Value<void> del(fs::path const& path_file_binary, std::vector<std::string> const& entries)
 {
-  ns_db::Db db = ns_db::from_string(Pop(ns_reserved::ns_env::read(path_file_binary))).value_or(ns_db::Db());
+  auto variables = Pop(read(path_file_binary));
   std::ranges::for_each(entries, [&](auto const& entry)
   {
-    if( db.erase(entry) )
+    if( variables.erase(entry) )
     {
       logger("I::Erase key '{}'", entry);
     }
@@ -94,7 +148,7 @@ namespace fs = std::filesystem;
       logger("I::Key '{}' not found for deletion", entry);
     }
   });
-  Pop(ns_reserved::ns_env::write(path_file_binary, Pop(db.dump())));
+  Pop(write(path_file_binary, variables));
   return {};
 }
 
@@ -110,14 +164,14 @@ namespace fs = std::filesystem;
   // Validate entries
   Pop(validate(entries));
   // Insert environment variables in the database
-  ns_db::Db db = ns_db::from_string(Pop(ns_reserved::ns_env::read(path_file_binary))).value_or(ns_db::Db());
+  auto variables = Pop(read(path_file_binary));
   for (auto&& [key,value] : map(entries))
   {
-    db(key) = value;
+    variables[key] = value;
     logger("I::Included variable '{}' with value '{}'", key, value);
   }
   // Write to the database
-  Pop(ns_reserved::ns_env::write(path_file_binary, Pop(db.dump())));
+  Pop(write(path_file_binary, variables));
   return {};
 }
 
@@ -130,7 +184,7 @@ namespace fs = std::filesystem;
  */
 [[nodiscard]] inline Value<void> set(fs::path const& path_file_binary, std::vector<std::string> const& entries)
 {
-  Pop(ns_reserved::ns_env::write(path_file_binary, Pop(ns_db::Db().dump())));
+  Pop(write(path_file_binary, {}));
   Pop(add(path_file_binary, entries));
   return {};
 }
@@ -144,17 +198,18 @@ namespace fs = std::filesystem;
 [[nodiscard]] inline Value<std::vector<std::string>> get(fs::path const& path_file_binary)
 {
   // Get environment
-  ns_db::Db db = ns_db::from_string(Pop(ns_reserved::ns_env::read(path_file_binary))).value_or(ns_db::Db());
+  auto variables = Pop(read(path_file_binary));
   // Merge variables with values
   std::vector<std::string> environment;
-  for (auto&& [key,value] : db.items())
+  environment.reserve(variables.size());
+  for (auto&& [key,value] : variables)
   {
-    environment.push_back(std::format("{}={}", key, Pop(value.template value<std::string>())));
-  }
-  // Expand variables
-  for(auto& variable : environment)
-  {
-    variable = ::ns_env::expand(variable).value_or(variable);
+    environment.push_back(std::format("{}={}", key, value));
+    // Only entries with variables are expanded
+    if(not ::ns_env::is_literal(environment.back()))
+    {
+      environment.back() = ::ns_env::expand(environment.back()).value_or(environment.back());
+    }
   }
   return environment;
 }
@@ -0,0 +1,226 @@
+/**
+ * @file limit.hpp
+ * @author Ruan Formigoni
+ * @brief Manages cgroup resource limits in flatimage
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <regex>
+#include <string>
+#include <filesystem>
+
+#include "../std/expected.hpp"
+#include "../std/enum.hpp"
+#include "../lib/affinity.hpp"
+#include "../lib/env.hpp"
+#include "../reserved/limit.hpp"
+#include "db.hpp"
+
+/**
+ * @namespace ns_db::ns_limit
+ * @brief Resource limits database management
+ *
+ * Manages the cgroup v2 limits stored in FlatImage's reserved space. The database has the
+ * format '{"cpu.max":"50000 100000","memory.max":"2G","accounting":"on","affinity":"0-3"}'. The
+ * keys other than 'accounting', 'affinity' and 'affinity.fuse' are the name of the cgroup
+ * interface file the value is written to. The affinity keys place the sandboxed program and the
+ * fuse filesystems on CPUs or NUMA nodes, FIM_AFFINITY and FIM_AFFINITY_FUSE take precedence.
+ */
+namespace ns_db::ns_limit
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Reads the limit database from the binary
+ *
+ * @param path_file_binary Path to the binary with the limit database
+ * @return The database, an empty one if the reserved space has no valid json
+ */
+[[nodiscard]] inline Value<ns_db::Db> read(fs::path const& path_file_binary)
+{
+  return ns_db::from_string(Pop(ns_reserved::ns_limit::read(path_file_binary))).value_or(ns_db::Db());
+}
+
+} // namespace
+
+// Limits of the sandbox, ACCOUNTING logs the usage of the sandbox when it exits, AFFINITY and
+// AFFINITY_FUSE set the placement of the program and of the fuse filesystems
+ENUM(LimitOption, CPU_MAX, CPU_WEIGHT, MEMORY_HIGH, MEMORY_MAX, IO_WEIGHT, PIDS_MAX, ACCOUNTING, AFFINITY, AFFINITY_FUSE);
+
+/**
+ * @brief Gets the key of an option, the name of its cgroup interface file
+ *
+ * @param option The option
+ * @return std::string The key of the option, e.g., 'cpu.max'
+ */
+[[nodiscard]] inline std::string key(LimitOption const& option)
+{
+  std::string str = option.lower();
+  std::ranges::replace(str, '_', '.');
+  return str;
+}
+
+/**
+ * @brief Resource limits of the sandbox
+ */
+struct Limit
+{
+  std::map<std::string,std::string> files; ///< Cgroup interface file and value to write
+  bool is_accounting = false;              ///< Log the resource usage of the sandbox on exit
+  std::string affinity;                    ///< Placement of the sandboxed program
+  std::string affinity_fuse;               ///< Placement of the fuse filesystems
+
+  /**
+   * @brief Gets the placement of the program or the fuse filesystems
+   *
+   * @param is_fuse True for the placement of the fuse filesystems
+   * @return std::optional<ns_affinity::Affinity> The placement, or nothing if not configured
+   */
+  [[nodiscard]] std::optional<ns_affinity::Affinity> placement(bool is_fuse) const
+  {
+    std::string str = ns_env::get_expected<"Q">(is_fuse? "FIM_AFFINITY_FUSE" : "FIM_AFFINITY")
+      .value_or(is_fuse? affinity_fuse : affinity);
+    return_if(str.empty(), std::nullopt);
+    auto ret = ns_affinity::parse(str);
+    return_if(not ret, std::nullopt, "W::Ignoring affinity '{}': {}", str, ret.error());
+    return *ret;
+  }
+};
+
+/**
+ * @brief Validates the value of an option, in the format the kernel accepts for its file
+ *
+ * @param option The option
+ * @param value The value to validate
+ * @return Nothing if the value is valid, or the respective error
+ */
+[[nodiscard]] inline Value<void> validate(LimitOption const& option, std::string const& value)
+{
+  auto f_match = [&](char const* pattern)
+  {
+    return std::regex_match(value, std::regex(pattern, std::regex::icase));
+  };
+  auto f_weight = [&]
+  {
+    uint64_t weight = f_match("[0-9]{1,5}")? Catch(std::stoul(value)).value_or(0) : 0;
+    return weight >= 1 and weight <= 10000;
+  };
+  bool is_valid = false;
+  switch(option)
+  {
+    case LimitOption::CPU_MAX: is_valid = f_match("(max|[0-9]+)( [0-9]+)?"); break;
+    case LimitOption::CPU_WEIGHT: is_valid = f_weight(); break;
+    case LimitOption::IO_WEIGHT: is_valid = f_weight(); break;
+    case LimitOption::MEMORY_HIGH:
+    case LimitOption::MEMORY_MAX: is_valid = f_match("max|[0-9]+[kmgt]?"); break;
+    case LimitOption::PIDS_MAX: is_valid = f_match("max|[0-9]+"); break;
+    case LimitOption::ACCOUNTING: is_valid = (value == "on" or value == "off"); break;
+    case LimitOption::AFFINITY:
+    case LimitOption::AFFINITY_FUSE: is_valid = f_match("(node:)?[0-9]+(-[0-9]+)?(,[0-9]+(-[0-9]+)?)*"); break;
+    case LimitOption::NONE: break;
+  }
+  return_if(not is_valid, Error("C::Invalid value '{}' for option '{}'", value, key(option)));
+  return {};
+}
+
+/**
+ * @brief Sets a limit in the database
+ *
+ * @param path_file_binary Path to the binary with the limit database
+ * @param option The option to set
+ * @param value The value of the option
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set(fs::path const& path_file_binary
+  , LimitOption const& option
+  , std::string const& value)
+{
+  return_if(option == LimitOption::NONE, Error("C::Invalid limit option"));
+  Pop(validate(option, value));
+  ns_db::Db db = Pop(read(path_file_binary));
+  db(key(option)) = value;
+  logger("I::Set '{}' to '{}'", key(option), value);
+  Pop(ns_reserved::ns_limit::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Deletes a limit from the database
+ *
+ * @param path_file_binary Path to the binary with the limit database
+ * @param option The option to delete
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> del(fs::path const& path_file_binary, LimitOption const& option)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  if(db.erase(key(option)))
+  {
+    logger("I::Erase option '{}'", key(option));
+  }
+  else
+  {
+    logger("I::Option '{}' not found for deletion", key(option));
+  }
+  Pop(ns_reserved::ns_limit::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Clears all limits from the database
+ *
+ * @param path_file_binary Path to the binary with the limit database
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clear(fs::path const& path_file_binary)
+{
+  Pop(ns_reserved::ns_limit::write(path_file_binary, Pop(ns_db::Db().dump())));
+  logger("I::Cleared limits");
+  return {};
+}
+
+/**
+ * @brief Gets the limits from the database
+ *
+ * @param path_file_binary Path to the binary with the limit database
+ * @return The limits, or the respective error
+ */
+[[nodiscard]] inline Value<Limit> get(fs::path const& path_file_binary)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  Limit limit;
+  for(auto&& [name,value] : db.items())
+  {
+    std::string str_value = Pop(value.template value<std::string>());
+    if(name == key(LimitOption::ACCOUNTING))
+    {
+      limit.is_accounting = (str_value == "on");
+    }
+    else if(name == key(LimitOption::AFFINITY))
+    {
+      limit.affinity = str_value;
+    }
+    else if(name == key(LimitOption::AFFINITY_FUSE))
+    {
+      limit.affinity_fuse = str_value;
+    }
+    else
+    {
+      limit.files[name] = str_value;
+    }
+  }
+  return limit;
+}
+
+} // namespace ns_db::ns_limit
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
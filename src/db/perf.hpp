@@ -0,0 +1,515 @@
+/**
+ * @file perf.hpp
+ * @author Ruan Formigoni
+ * @brief Manages dwarfs tuning options in flatimage
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <numeric>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../std/expected.hpp"
+#include "../std/enum.hpp"
+#include "../lib/env.hpp"
+#include "../reserved/perf.hpp"
+#include "db.hpp"
+
+/**
+ * @namespace ns_db::ns_perf
+ * @brief DwarFS tuning options database management
+ *
+ * Manages the dwarfs mount options stored in FlatImage's reserved space. Options are either
+ * global, applied to all layers, or specific to a layer index as shown by 'fim-layer list'.
+ * The database has the format '{"global":{"option":"value"},"layers":{"index":{...}}}'. Layer
+ * options take precedence over the global ones, and FIM_DWARFS_<OPTION> environment variables
+ * take precedence over both.
+ *
+ * An optional cache budget, '{"budget":"2g"}', bounds the sum of the block caches of the layers.
+ * It is split across the layers when they are mounted and replaces the global cachesize, a layer
+ * with its own cachesize keeps it.
+ *
+ * An optional shm mount, '{"shm":"4g"}' or '{"shm":"hugetlbfs"}', replaces the /dev/shm that the
+ * SHM permission binds from the host with a private tmpfs of that size or with the hugetlbfs
+ * mount of the host.
+ */
+namespace ns_db::ns_perf
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Smallest cache a layer gets from the budget, unless the budget is too small for all layers
+constexpr uint64_t const SIZE_CACHE_MIN = uint64_t{16} << 20;
+
+/**
+ * @brief Reads the perf database from the binary
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @return The database, an empty one if the reserved space has no valid json
+ */
+[[nodiscard]] inline Value<ns_db::Db> read(fs::path const& path_file_binary)
+{
+  return ns_db::from_string(Pop(ns_reserved::ns_perf::read(path_file_binary))).value_or(ns_db::Db());
+}
+
+} // namespace
+
+/**
+ * @brief Parses a size with an optional k, m, g or t suffix, as dwarfs does
+ *
+ * @param str_size The size, e.g., '512m'
+ * @return Value<uint64_t> The size in bytes, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> size_from_string(std::string_view str_size)
+{
+  return_if(str_size.empty(), Error("C::Empty size"));
+  uint32_t shift = 0;
+  switch(std::tolower(static_cast<unsigned char>(str_size.back())))
+  {
+    case 'k': shift = 10; break;
+    case 'm': shift = 20; break;
+    case 'g': shift = 30; break;
+    case 't': shift = 40; break;
+    default: break;
+  }
+  std::string_view str_digits = (shift == 0)? str_size : str_size.substr(0, str_size.size() - 1);
+  return_if(str_digits.empty() or not std::ranges::all_of(str_digits, ::isdigit)
+    , Error("C::Invalid size '{}'", str_size)
+  );
+  uint64_t size = Try(std::stoull(std::string{str_digits}), "C::Invalid size '{}'", str_size);
+  return_if(size > (UINT64_MAX >> shift), Error("C::Size '{}' is too large", str_size));
+  return size << shift;
+}
+
+/**
+ * @brief Splits a cache budget across layers in proportion to their weights
+ *
+ * Every layer gets SIZE_CACHE_MIN first, or an even share if the budget cannot cover that for
+ * all layers. The rest is split in proportion to the weights, evenly if all weights are zero.
+ *
+ * @param budget The total size of the caches in bytes
+ * @param weights The weight of each layer
+ * @return std::vector<uint64_t> The cache size of each layer, in the order of the weights
+ */
+[[nodiscard]] inline std::vector<uint64_t> split_budget(uint64_t budget, std::vector<uint64_t> const& weights)
+{
+  return_if(weights.empty(), {});
+  uint64_t floor = std::min(SIZE_CACHE_MIN, budget / weights.size());
+  uint64_t rest = budget - floor * weights.size();
+  long double total = std::accumulate(weights.begin(), weights.end(), 0.0L);
+  std::vector<uint64_t> sizes;
+  for(uint64_t weight : weights)
+  {
+    long double share = (total > 0)? rest * (weight / total) : static_cast<long double>(rest) / weights.size();
+    sizes.push_back(floor + static_cast<uint64_t>(share));
+  }
+  return sizes;
+}
+
+// Options forwarded to dwarfs with '-o', 'perfmon' takes '+' separated components
+ENUM(PerfOption, CACHESIZE, WORKERS, READAHEAD, MLOCK, TIDY_STRATEGY, PERFMON);
+
+/**
+ * @brief Mount of /dev/shm in the sandbox with the SHM permission
+ */
+struct Shm
+{
+  bool is_hugetlbfs; ///< Bind the hugetlbfs mount of the host instead of a private tmpfs
+  uint64_t size;     ///< Size of the private tmpfs in bytes, zero with is_hugetlbfs
+};
+
+/**
+ * @brief Parses the mount of /dev/shm
+ *
+ * @param str_shm A size for a private tmpfs, e.g., '4g', or 'hugetlbfs'
+ * @return Value<Shm> The mount, or the respective error
+ */
+[[nodiscard]] inline Value<Shm> shm_from_string(std::string_view str_shm)
+{
+  return_if(str_shm == "hugetlbfs", Shm{ .is_hugetlbfs = true, .size = 0 });
+  uint64_t size = Pop(size_from_string(str_shm), "C::Invalid shm '{}' (<size|hugetlbfs|none>)", str_shm);
+  return_if(size == 0, Error("C::The size of shm must be larger than zero"));
+  return Shm{ .is_hugetlbfs = false, .size = size };
+}
+
+/**
+ * @brief DwarFS options for all the layers and for specific layers
+ */
+struct Perf
+{
+  using Options = std::map<std::string,std::string>;
+  Options global;
+  std::map<uint64_t,Options> layers;
+  std::optional<std::string> budget;
+  std::optional<std::string> shm;
+
+  /**
+   * @brief Gets the mount of /dev/shm of the sandbox, FIM_SHM overrides the configured one
+   *
+   * @return std::optional<Shm> The mount, or std::nullopt to bind the /dev/shm of the host
+   */
+  [[nodiscard]] std::optional<Shm> get_shm() const
+  {
+    std::optional<std::string> str_shm = shm;
+    if(auto value = ns_env::get_expected<"Q">("FIM_SHM")) { str_shm = *value; }
+    return_if(not str_shm or *str_shm == "none", std::nullopt);
+    auto value = shm_from_string(*str_shm);
+    return_if(not value, std::nullopt, "W::Ignoring shm: {}", value.error());
+    return *value;
+  }
+
+  /**
+   * @brief Gets the cache budget of the layers, FIM_DWARFS_BUDGET overrides the configured one
+   *
+   * @return std::optional<uint64_t> The budget in bytes, or std::nullopt if there is no budget
+   */
+  [[nodiscard]] std::optional<uint64_t> get_budget() const
+  {
+    std::optional<std::string> str_budget = budget;
+    if(auto value = ns_env::get_expected<"Q">("FIM_DWARFS_BUDGET")) { str_budget = *value; }
+    return_if(not str_budget or *str_budget == "none", std::nullopt);
+    auto size = size_from_string(*str_budget);
+    return_if(not size, std::nullopt, "W::Ignoring cache budget: {}", size.error());
+    return *size;
+  }
+
+  /**
+   * @brief Builds the comma-separated dwarfs options of a layer
+   *
+   * @param index Index of the layer
+   * @param cachesize Share of the layer in the cache budget, replaces the global cachesize
+   * @return std::string The options to append to '-o', or an empty string if none
+   */
+  [[nodiscard]] std::string options(uint64_t index, std::optional<uint64_t> cachesize = std::nullopt) const
+  {
+    Options options = global;
+    if(cachesize)
+    {
+      options["cachesize"] = std::to_string(*cachesize);
+    }
+    if(auto it = layers.find(index); it != layers.end())
+    {
+      for(auto const& [key,value] : it->second) { options[key] = value; }
+    }
+    // Environment overrides
+    for(PerfOption option : { PerfOption::CACHESIZE, PerfOption::WORKERS, PerfOption::READAHEAD
+      , PerfOption::MLOCK, PerfOption::TIDY_STRATEGY, PerfOption::PERFMON })
+    {
+      if(auto value = ns_env::get_expected<"Q">(std::format("FIM_DWARFS_{}", std::string{option})))
+      {
+        options[option.lower()] = *value;
+      }
+    }
+    std::string out;
+    for(auto const& [key,value] : options)
+    {
+      out += std::format("{}{}={}", out.empty()? "" : ",", key, value);
+    }
+    return out;
+  }
+};
+
+/**
+ * @brief Sets a dwarfs option in the database
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @param option The option to set
+ * @param value The value of the option
+ * @param index The layer index, or std::nullopt to set the option for all layers
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set(fs::path const& path_file_binary
+  , PerfOption const& option
+  , std::string const& value
+  , std::optional<uint64_t> index)
+{
+  return_if(option == PerfOption::NONE, Error("C::Invalid perf option"));
+  return_if(value.empty() or value.find_first_of(", ") != std::string::npos
+    , Error("C::Invalid value '{}' for option '{}'", value, option.lower())
+  );
+  ns_db::Db db = Pop(read(path_file_binary));
+  if(index)
+  {
+    db("layers")(std::to_string(*index))(option.lower()) = value;
+    logger("I::Set '{}' to '{}' for layer '{}'", option.lower(), value, *index);
+  }
+  else
+  {
+    db("global")(option.lower()) = value;
+    logger("I::Set '{}' to '{}' for all layers", option.lower(), value);
+  }
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Deletes a dwarfs option from the database
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @param option The option to delete
+ * @param index The layer index, or std::nullopt to delete the global option
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> del(fs::path const& path_file_binary
+  , PerfOption const& option
+  , std::optional<uint64_t> index)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  ns_db::Db db_options = (index)? db("layers")(std::to_string(*index)) : db("global");
+  if(db_options.erase(option.lower()))
+  {
+    logger("I::Erase option '{}'", option.lower());
+  }
+  else
+  {
+    logger("I::Option '{}' not found for deletion", option.lower());
+  }
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Sets or clears the cache budget of the layers
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @param budget The total size of the caches, e.g., '2g', or 'none' to clear it
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set_budget(fs::path const& path_file_binary, std::string const& budget)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  if(budget == "none")
+  {
+    std::ignore = db.erase("budget");
+    logger("I::Cleared the cache budget");
+  }
+  else
+  {
+    uint64_t size = Pop(size_from_string(budget));
+    return_if(size == 0, Error("C::The cache budget must be larger than zero"));
+    db("budget") = budget;
+    logger("I::Set the cache budget to '{}'", budget);
+  }
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Sets or clears the mount of /dev/shm of the sandbox
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @param shm A size for a private tmpfs, e.g., '4g', 'hugetlbfs', or 'none' to clear it
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set_shm(fs::path const& path_file_binary, std::string const& shm)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  if(shm == "none")
+  {
+    std::ignore = db.erase("shm");
+    logger("I::Cleared the shm mount");
+  }
+  else
+  {
+    Pop(shm_from_string(shm));
+    db("shm") = shm;
+    logger("I::Set the shm mount to '{}'", shm);
+  }
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Clears all dwarfs options from the database
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clear(fs::path const& path_file_binary)
+{
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(ns_db::Db().dump())));
+  logger("I::Cleared perf options");
+  return {};
+}
+
+/**
+ * @brief Gets the dwarfs options from the database
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @return The options, or the respective error
+ */
+[[nodiscard]] inline Value<Perf> get(fs::path const& path_file_binary)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  auto f_options = [](ns_db::Db const& db_options) -> Value<Perf::Options>
+  {
+    Perf::Options options;
+    for(auto&& [key,value] : db_options.items())
+    {
+      options[key] = Pop(value.template value<std::string>());
+    }
+    return options;
+  };
+  Perf perf;
+  if(db.contains("budget"))
+  {
+    perf.budget = Pop(db("budget").value<std::string>());
+  }
+  if(db.contains("shm"))
+  {
+    perf.shm = Pop(db("shm").value<std::string>());
+  }
+  if(db.contains("global"))
+  {
+    perf.global = Pop(f_options(db("global")));
+  }
+  if(db.contains("layers"))
+  {
+    for(auto&& [key,value] : db("layers").items())
+    {
+      uint64_t index = Try(std::stoull(key), "E::Invalid layer index '{}'", key);
+      perf.layers[index] = Pop(f_options(value));
+    }
+  }
+  return perf;
+}
+
+// Profiles of mkdwarfs options for new layers
+ENUM(PerfProfile, FAST, BALANCED, SMALL, RANDOM_ACCESS);
+
+/**
+ * @brief Parses the name of a profile, e.g., 'random-access'
+ *
+ * @param str_profile The name of the profile, 'none' for no profile
+ * @return Value<PerfProfile> The profile, or the respective error
+ */
+[[nodiscard]] inline Value<PerfProfile> profile_from_string(std::string str_profile)
+{
+  std::ranges::replace(str_profile, '-', '_');
+  return_if(str_profile == "none", PerfProfile{});
+  return Pop(PerfProfile::from_string(str_profile), "C::Invalid profile '{}' (fast,balanced,small,random-access,none)", str_profile);
+}
+
+/**
+ * @brief Options of mkdwarfs to create new layers with
+ *
+ * A profile trades the size of a layer against its random read latency. Higher levels use
+ * larger blocks and slower decompression, which suits layers that are mostly read sequentially,
+ * like source code or documents. Smaller blocks and a faster codec suit layers with random
+ * reads, like game assets. Raw options are appended after the profile and take precedence.
+ */
+struct Mkdwarfs
+{
+  PerfProfile profile;              ///< The profile, NONE to use FIM_COMPRESSION_LEVEL
+  std::vector<std::string> options; ///< Raw options appended after the profile
+
+  /**
+   * @brief Builds the arguments of mkdwarfs for the profile and the raw options
+   *
+   * Options of the profile that the raw options also set, as '--key value' or '--key=value', are
+   * left out.
+   *
+   * @return std::vector<std::string> The arguments, without a compression level if there is no
+   * profile and the raw options do not set it
+   */
+  [[nodiscard]] std::vector<std::string> args() const
+  {
+    std::vector<std::pair<std::string,std::string>> defaults;
+    switch(profile)
+    {
+      // Fast compression and decompression, larger layers
+      case PerfProfile::FAST: defaults = {{"-l", "1"}}; break;
+      // The default level
+      case PerfProfile::BALANCED: defaults = {{"-l", "7"}}; break;
+      // Best compression, and deduplication across more blocks
+      case PerfProfile::SMALL: defaults = {{"-l", "9"}, {"--max-lookback-blocks", "8"}}; break;
+      // Blocks of 1 MiB and a faster codec, a random read decompresses less data
+      case PerfProfile::RANDOM_ACCESS: defaults = {{"-l", "4"}, {"--block-size-bits", "20"}}; break;
+      case PerfProfile::NONE: break;
+    }
+    std::vector<std::string> args;
+    for(auto const& [key,value] : defaults)
+    {
+      continue_if(std::ranges::any_of(options, [&](std::string const& option)
+      {
+        return option == key or option.starts_with(key + "=");
+      }));
+      args.push_back(key);
+      args.push_back(value);
+    }
+    std::ranges::copy(options, std::back_inserter(args));
+    return args;
+  }
+
+  /**
+   * @brief The name of the profile, as accepted by profile_from_string
+   *
+   * @return std::string The name, 'none' if there is no profile
+   */
+  [[nodiscard]] std::string name() const
+  {
+    std::string name = profile.lower();
+    std::ranges::replace(name, '_', '-');
+    return name;
+  }
+};
+
+/**
+ * @brief Sets the default mkdwarfs options of new layers
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @param mkdwarfs The profile and raw options, no profile and options to clear them
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set_mkdwarfs(fs::path const& path_file_binary, Mkdwarfs const& mkdwarfs)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  if(mkdwarfs.profile == PerfProfile::NONE and mkdwarfs.options.empty())
+  {
+    std::ignore = db.erase("mkdwarfs");
+    logger("I::Cleared the layer profile");
+  }
+  else
+  {
+    db("mkdwarfs")("profile") = mkdwarfs.name();
+    db("mkdwarfs")("options") = mkdwarfs.options;
+    logger("I::Set the layer profile to '{}' with options '{}'", mkdwarfs.name(), mkdwarfs.options);
+  }
+  Pop(ns_reserved::ns_perf::write(path_file_binary, Pop(db.dump())));
+  return {};
+}
+
+/**
+ * @brief Gets the default mkdwarfs options of new layers
+ *
+ * @param path_file_binary Path to the binary with the perf database
+ * @return Value<Mkdwarfs> The profile and raw options, or the respective error
+ */
+[[nodiscard]] inline Value<Mkdwarfs> get_mkdwarfs(fs::path const& path_file_binary)
+{
+  ns_db::Db db = Pop(read(path_file_binary));
+  Mkdwarfs mkdwarfs{};
+  return_if(not db.contains("mkdwarfs"), mkdwarfs);
+  mkdwarfs.profile = Pop(profile_from_string(Pop(db("mkdwarfs")("profile").value<std::string>())));
+  mkdwarfs.options = db("mkdwarfs")("options").value<std::vector<std::string>>().or_default();
+  return mkdwarfs;
+}
+
+} // namespace ns_db::ns_perf
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -15,6 +15,7 @@
 #include "../../std/expected.hpp"
 #include "../../std/enum.hpp"
 #include "../db.hpp"
+#include "../view.hpp"
 
 /**
  * @namespace ns_db::ns_portal::ns_daemon
@@ -100,8 +101,8 @@ inline Logs::Logs(fs::path const& path_dir_log)
 [[maybe_unused]] [[nodiscard]] inline Value<Logs> deserialize(std::string_view str_raw_json) noexcept
 {
   return_if(str_raw_json.empty(), Error("D::Empty json data"));
-  // Open DB
-  auto db = Pop(ns_db::from_string(str_raw_json));
+  // Open a read-only view, no json tree is built
+  ns_db::View db(str_raw_json);
   // Parse log directory path (optional)
   fs::path path_dir_log = Pop(db("path_dir_log").template value<std::string>());
   // Create Logs object with the parsed path
@@ -151,6 +152,8 @@ class Daemon
     [[maybe_unused]] pid_t get_pid_reference() const { return m_pid_reference; }
     [[maybe_unused]] fs::path const& get_path_bin_daemon() const { return m_path_bin_daemon; }
     [[maybe_unused]] fs::path const& get_path_fifo_listen() const { return path_fifo_listen; }
+    [[maybe_unused]] fs::path get_path_socket_listen() const { return fs::path(path_fifo_listen).replace_extension(".sock"); }
+    [[maybe_unused]] fs::path get_path_file_environment() const { return fs::path(path_fifo_listen).replace_extension(".env"); }
     [[maybe_unused]] Mode get_mode() const { return m_mode; }
 
     friend Value<Daemon> deserialize(std::string_view str_raw_json) noexcept;
@@ -187,8 +190,8 @@ inline Daemon::Daemon(Mode mode, fs::path const& path_bin_daemon, fs::path const
 {
   Daemon daemon;
   return_if(str_raw_json.empty(), Error("D::Empty json data"));
-  // Open DB
-  auto db = Pop(ns_db::from_string(str_raw_json));
+  // Open a read-only view, no json tree is built
+  ns_db::View db(str_raw_json);
   // Parse pid_reference (optional, defaults to current PID)
   std::string pid_reference = Pop(db("pid_reference").template value<std::string>());
   daemon.m_pid_reference = Try(std::stoi(pid_reference));
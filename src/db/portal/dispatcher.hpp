@@ -15,6 +15,7 @@
 #include "../../std/expected.hpp"
 #include "../../std/filesystem.hpp"
 #include "../db.hpp"
+#include "../view.hpp"
 #include "daemon.hpp"
 
 /**
@@ -58,6 +59,8 @@ class Dispatcher
 
     [[maybe_unused]] fs::path get_path_dir_fifo() const { return m_path_dir_fifo; }
     [[maybe_unused]] fs::path get_path_fifo_daemon() const { return m_path_fifo_daemon; }
+    [[maybe_unused]] fs::path get_path_socket_daemon() const { return fs::path(m_path_fifo_daemon).replace_extension(".sock"); }
+    [[maybe_unused]] fs::path get_path_file_environment_daemon() const { return fs::path(m_path_fifo_daemon).replace_extension(".env"); }
     [[maybe_unused]] fs::path get_path_file_log() const { return m_path_file_log; }
     // Serialization
     friend Value<Dispatcher> deserialize(std::string_view str_raw_json) noexcept;
@@ -101,8 +104,8 @@ inline Dispatcher::Dispatcher(pid_t pid, Mode mode, fs::path const& path_dir_app
 {
   Dispatcher dispatcher;
   return_if(str_raw_json.empty(), Error("D::Empty json data"));
-  // Open DB
-  auto db = Pop(ns_db::from_string(str_raw_json));
+  // Open a read-only view, no json tree is built
+  ns_db::View db(str_raw_json);
   // Parse path_dir_fifo
   dispatcher.m_path_dir_fifo = Pop(db("path_dir_fifo").template value<std::string>());
   // Parse path_fifo_daemon
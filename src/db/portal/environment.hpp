@@ -0,0 +1,167 @@
+/**
+ * @file environment.hpp
+ * @author Ruan Formigoni
+ * @brief Baseline environment shared by a portal daemon and its dispatchers
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../../std/expected.hpp"
+#include "../../macro.hpp"
+
+/**
+ * @namespace ns_db::ns_portal::ns_environment
+ * @brief Environment deltas against the environment of the portal daemon
+ *
+ * Processes spawned by the daemon start from the environment of the daemon. On startup the daemon
+ * writes a snapshot of it next to its fifo, the first entry is the id of the snapshot and the
+ * others are its variables, all separated by NUL bytes. Dispatchers read the snapshot and send only
+ * the variables that differ from it, along with the id, instead of their whole environment. The
+ * spawned process compares the id with the one of the environment it inherited.
+ */
+namespace ns_db::ns_portal::ns_environment
+{
+
+namespace
+{
+namespace fs = std::filesystem;
+} // anonymous namespace
+
+/**
+ * @brief Variables to set and remove on top of a baseline environment
+ */
+struct Delta
+{
+  std::vector<std::string> set;   ///< Added or changed variables in the format 'KEY=VALUE'
+  std::vector<std::string> unset; ///< Keys of the removed variables
+};
+
+/**
+ * @brief A snapshot of the environment of a daemon
+ */
+struct Baseline
+{
+  std::string id;                                             ///< Identifies the snapshot
+  std::unordered_map<std::string_view,std::string_view> vars; ///< Views over data, by key
+  std::string data;                                           ///< Contents of the snapshot
+
+  Baseline() = default;
+  Baseline(Baseline const&) = delete;
+  Baseline& operator=(Baseline const&) = delete;
+};
+
+/**
+ * @brief Computes the id of an environment
+ *
+ * @param env The environment, a null terminated array of 'KEY=VALUE' strings
+ * @return std::string The id, a hash of the contents
+ */
+[[nodiscard]] inline std::string id(char** env)
+{
+  size_t hash = 0;
+  for(char** i = env; *i != nullptr; ++i)
+  {
+    hash = hash * 31 + std::hash<std::string_view>{}(*i);
+  }
+  return std::format("{:x}", hash);
+}
+
+/**
+ * @brief Writes a snapshot of an environment
+ *
+ * @param path_file Where to write the snapshot
+ * @param env The environment, a null terminated array of 'KEY=VALUE' strings
+ * @return Value<std::string> The id of the snapshot, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> write(fs::path const& path_file, char** env)
+{
+  std::string str_id = id(env);
+  // Write to a temporary file and rename, dispatchers never read a partial snapshot
+  fs::path path_file_tmp = fs::path(path_file).concat(".tmp");
+  std::ofstream file(path_file_tmp, std::ios::binary | std::ios::trunc);
+  return_if(not file.is_open(), Error("E::Could not open environment snapshot '{}'", path_file_tmp));
+  file << str_id << '\0';
+  for(char** i = env; *i != nullptr; ++i)
+  {
+    file << *i << '\0';
+  }
+  file.close();
+  Try(fs::rename(path_file_tmp, path_file));
+  return str_id;
+}
+
+/**
+ * @brief Reads the snapshot of an environment
+ *
+ * @param path_file Path to the snapshot
+ * @param baseline Where to store the snapshot
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> read(fs::path const& path_file, Baseline& baseline)
+{
+  std::ifstream file(path_file, std::ios::binary);
+  return_if(not file.is_open(), Error("D::No environment snapshot in '{}'", path_file));
+  baseline.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  std::string_view data = baseline.data;
+  auto pos = data.find('\0');
+  return_if(pos == std::string_view::npos, Error("D::Invalid environment snapshot '{}'", path_file));
+  baseline.id = data.substr(0, pos);
+  for(data.remove_prefix(pos + 1); not data.empty();)
+  {
+    std::string_view entry = data.substr(0, data.find('\0'));
+    data.remove_prefix(std::min(data.size(), entry.size() + 1));
+    auto pos_eq = entry.find('=');
+    continue_if(pos_eq == std::string_view::npos);
+    baseline.vars[entry.substr(0, pos_eq)] = entry.substr(pos_eq + 1);
+  }
+  return {};
+}
+
+/**
+ * @brief Computes the variables of an environment that differ from a baseline
+ *
+ * @param baseline The baseline environment
+ * @param env The environment, a null terminated array of 'KEY=VALUE' strings
+ * @return Delta The variables to set and remove on top of the baseline
+ */
+[[nodiscard]] inline Delta delta(Baseline const& baseline, char** env)
+{
+  Delta delta;
+  std::unordered_set<std::string_view> keys;
+  for(char** i = env; *i != nullptr; ++i)
+  {
+    std::string_view entry(*i);
+    auto pos_eq = entry.find('=');
+    continue_if(pos_eq == std::string_view::npos);
+    std::string_view key = entry.substr(0, pos_eq);
+    keys.insert(key);
+    auto it = baseline.vars.find(key);
+    continue_if(it != baseline.vars.end() and it->second == entry.substr(pos_eq + 1));
+    delta.set.emplace_back(entry);
+  }
+  for(auto const& [key, value] : baseline.vars)
+  {
+    continue_if(keys.contains(key));
+    delta.unset.emplace_back(key);
+  }
+  return delta;
+}
+
+} // namespace ns_db::ns_portal::ns_environment
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -8,13 +8,18 @@
 
 #pragma once
 
+#include <cstdint>
+#include <cstring>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <filesystem>
 
 #include "../../std/expected.hpp"
 #include "../../std/filesystem.hpp"
 #include "../db.hpp"
+#include "../view.hpp"
 
 /**
  * @namespace ns_db::ns_portal::ns_message
@@ -24,6 +29,10 @@
  * Manages command vectors, stdio FIFO paths (stdin/stdout/stderr), exit code channels, PID
  * tracking, and environment variables for cross-boundary command execution with proper I/O
  * redirection.
+ *
+ * Messages travel through the fifo in frames, a header with the size of the payload in bytes
+ * followed by the json payload. The reader reassembles frames split across reads and extracts
+ * several frames from a single read, so messages have no size limit besides SIZE_FRAME_MAX.
  */
 namespace ns_db::ns_portal::ns_message
 {
@@ -33,6 +42,11 @@ namespace
 namespace fs = std::filesystem;
 } // anonymous namespace
 
+// Size of the frame header, the payload size as a host endian unsigned integer
+constexpr size_t const SIZE_FRAME_HEADER = sizeof(uint32_t);
+// Larger frames are rejected, a corrupt header would otherwise stall the reader
+constexpr size_t const SIZE_FRAME_MAX = 64 * 1024 * 1024;
+
 class Message
 {
   private:
@@ -43,6 +57,8 @@ class Message
     fs::path m_exit;
     fs::path m_pid;
     std::vector<std::string> m_environment;
+    std::vector<std::string> m_environment_unset;
+    std::string m_environment_base;
 
     Message();
 
@@ -51,6 +67,8 @@ class Message
       , std::vector<std::string> const& command
       , fs::path const& path_dir_fifo
       , std::vector<std::string> const& environment
+      , std::vector<std::string> const& environment_unset = {}
+      , std::string const& environment_base = {}
     );
 
     [[maybe_unused]] std::vector<std::string> const& get_command() const { return m_command; }
@@ -60,6 +78,8 @@ class Message
     [[maybe_unused]] fs::path get_exit() const { return m_exit; }
     [[maybe_unused]] fs::path get_pid() const { return m_pid; }
     [[maybe_unused]] std::vector<std::string> const& get_environment() const { return m_environment; }
+    [[maybe_unused]] std::vector<std::string> const& get_environment_unset() const { return m_environment_unset; }
+    [[maybe_unused]] std::string const& get_environment_base() const { return m_environment_base; }
 
     friend Value<Message> deserialize(std::string_view str_raw_json) noexcept;
     friend Value<std::string> serialize(Message const& message) noexcept;
@@ -76,16 +96,27 @@ inline Message::Message()
   , m_exit()
   , m_pid()
   , m_environment()
+  , m_environment_unset()
+  , m_environment_base()
 {}
 
 
 /**
  * @brief Construct a new Message:: Message object
+ *
+ * @param pid The pid of the dispatcher, names the directory of its fifos
+ * @param command The command to execute and its arguments
+ * @param path_dir_fifo The directory with the fifos of the dispatchers
+ * @param environment The environment of the command, or the variables to set on top of a baseline
+ * @param environment_unset The variables to remove from the baseline
+ * @param environment_base The id of the baseline, empty if environment is the whole environment
  */
 inline Message::Message(pid_t pid
     , std::vector<std::string> const& command
     , fs::path const& path_dir_fifo
     , std::vector<std::string> const& environment
+    , std::vector<std::string> const& environment_unset
+    , std::string const& environment_base
   ) : m_command(command)
     , m_stdin(ns_fs::placeholders_replace(path_dir_fifo / "{}" / "stdin.fifo", pid))
     , m_stdout(ns_fs::placeholders_replace(path_dir_fifo / "{}" / "stdout.fifo", pid))
@@ -93,6 +124,8 @@ inline Message::Message(pid_t pid
     , m_exit(ns_fs::placeholders_replace(path_dir_fifo / "{}" / "exit.fifo", pid))
     , m_pid(ns_fs::placeholders_replace(path_dir_fifo / "{}" / "pid.fifo", pid))
     , m_environment(environment)
+    , m_environment_unset(environment_unset)
+    , m_environment_base(environment_base)
 {}
 
 /**
@@ -105,8 +138,8 @@ inline Message::Message(pid_t pid
 {
   Message message;
   return_if(str_raw_json.empty(), Error("D::Empty json data"));
-  // Open DB
-  auto db = Pop(ns_db::from_string(str_raw_json));
+  // Open a read-only view, no json tree is built
+  ns_db::View db(str_raw_json);
   // Parse command (required)
   message.m_command = Pop(db("command").template value<std::vector<std::string>>());
   // Parse FIFO paths (required)
@@ -117,6 +150,11 @@ inline Message::Message(pid_t pid
   message.m_pid = Pop(db("pid").template value<std::string>());
   // Parse environment variables (required)
   message.m_environment = Pop(db("environment").template value<std::vector<std::string>>());
+  // Parse environment baseline (optional, the environment is complete without it)
+  message.m_environment_base = db("environment_base").template value<std::string>().value_or("");
+  message.m_environment_unset = db("environment_unset")
+    .template value<std::vector<std::string>>()
+    .value_or(std::vector<std::string>{});
   return message;
 }
 
@@ -136,9 +174,84 @@ inline Message::Message(pid_t pid
   db("exit") = message.get_exit().string();
   db("pid") = message.get_pid().string();
   db("environment") = message.get_environment();
+  if(not message.get_environment_base().empty())
+  {
+    db("environment_base") = message.get_environment_base();
+    db("environment_unset") = message.get_environment_unset();
+  }
   return db.dump();
 }
 
+/**
+ * @brief Wraps a payload into a frame
+ *
+ * @param payload The payload to wrap
+ * @return The frame, or the respective error
+ */
+[[maybe_unused]] [[nodiscard]] inline Value<std::string> frame(std::string_view payload) noexcept
+{
+  return_if(payload.size() > SIZE_FRAME_MAX, Error("E::Message too large: {} bytes", payload.size()));
+  uint32_t size = static_cast<uint32_t>(payload.size());
+  std::string data(SIZE_FRAME_HEADER + payload.size(), '\0');
+  std::memcpy(data.data(), &size, SIZE_FRAME_HEADER);
+  std::memcpy(data.data() + SIZE_FRAME_HEADER, payload.data(), payload.size());
+  return data;
+}
+
+/**
+ * @class Frames
+ * @brief Reassembles frames from a stream of bytes
+ */
+class Frames
+{
+  private:
+    std::string m_buffer;
+    size_t m_offset;
+
+  public:
+    Frames() : m_buffer(), m_offset(0) {}
+    void push(std::string_view data);
+    [[nodiscard]] Value<std::optional<std::string_view>> next();
+};
+
+/**
+ * @brief Appends bytes read from the stream
+ *
+ * Views returned by next() are invalidated.
+ *
+ * @param data The bytes to append
+ */
+inline void Frames::push(std::string_view data)
+{
+  // Drop the frames extracted so far
+  m_buffer.erase(0, m_offset);
+  m_offset = 0;
+  m_buffer.append(data);
+}
+
+/**
+ * @brief Extracts the next complete frame
+ *
+ * @return The payload of the frame, valid until the next call to push(), nothing if the frame is
+ * incomplete, or the respective error. On error the buffered bytes are discarded.
+ */
+inline Value<std::optional<std::string_view>> Frames::next()
+{
+  std::string_view pending = std::string_view(m_buffer).substr(m_offset);
+  return_if(pending.size() < SIZE_FRAME_HEADER, std::nullopt);
+  uint32_t size;
+  std::memcpy(&size, pending.data(), SIZE_FRAME_HEADER);
+  if(size > SIZE_FRAME_MAX)
+  {
+    m_buffer.clear();
+    m_offset = 0;
+    return Error("E::Invalid frame size: {} bytes", size);
+  }
+  return_if(pending.size() < SIZE_FRAME_HEADER + size, std::nullopt);
+  m_offset += SIZE_FRAME_HEADER + size;
+  return pending.substr(SIZE_FRAME_HEADER, size);
+}
+
 } // namespace ns_db::ns_portal::ns_message
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,204 @@
+/**
+ * @file snapshot.hpp
+ * @author Ruan Formigoni
+ * @brief A read-only snapshot of the portal configuration of an instance
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../std/filesystem.hpp"
+#include "../../lib/env.hpp"
+#include "../../macro.hpp"
+#include "../db.hpp"
+#include "../view.hpp"
+#include "daemon.hpp"
+#include "dispatcher.hpp"
+
+/**
+ * @namespace ns_db::ns_portal::ns_snapshot
+ * @brief Configuration of the portal helpers, written once per instance
+ *
+ * The boot process writes the configuration of its portal daemons and of the dispatcher that
+ * reaches the host daemon to 'portal/snapshot.json' in the instance directory, before spawning
+ * any of them, and passes its path in FIM_SNAPSHOT. Each helper maps the file read-only once and
+ * views its own section, instead of receiving the serialized objects in variables that every
+ * process of the sandbox inherits and copies on each exec.
+ *
+ * Sections:
+ * - 'dispatcher': Dispatcher of fim_portal, to the host daemon
+ * - 'daemon_host' and 'log_host': Host daemon and its logs
+ * - 'daemon_guest' and 'log_guest': Guest daemon and its logs
+ *
+ * The variables take precedence over the snapshot, e.g., FIM_DISPATCHER_CFG for dispatchers to
+ * the guest daemon of another instance.
+ */
+namespace ns_db::ns_portal::ns_snapshot
+{
+
+namespace
+{
+namespace fs = std::filesystem;
+} // anonymous namespace
+
+/**
+ * @class Snapshot
+ * @brief A read-only mapping of a snapshot file
+ */
+class Snapshot
+{
+  private:
+    char const* m_ptr_map;
+    size_t m_size_map;
+
+    Snapshot(char const* ptr_map, size_t size_map);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Snapshot>> map(fs::path const& path_file_snapshot);
+    [[nodiscard]] Value<std::string_view> section(std::string_view key) const;
+    ~Snapshot();
+    Snapshot(Snapshot const&) = delete;
+    Snapshot(Snapshot&&) = delete;
+    Snapshot& operator=(Snapshot const&) = delete;
+    Snapshot& operator=(Snapshot&&) = delete;
+};
+
+/**
+ * @brief Construct a new Snapshot object
+ *
+ * @param ptr_map Start of the mapping
+ * @param size_map Size of the mapping
+ */
+inline Snapshot::Snapshot(char const* ptr_map, size_t size_map)
+  : m_ptr_map(ptr_map)
+  , m_size_map(size_map)
+{
+}
+
+/**
+ * @brief Destroy the Snapshot object and un-map the file
+ */
+inline Snapshot::~Snapshot()
+{
+  ::munmap(const_cast<char*>(m_ptr_map), m_size_map);
+}
+
+/**
+ * @brief Maps a snapshot file
+ *
+ * @param path_file_snapshot Path to the snapshot file
+ * @return Value<std::unique_ptr<Snapshot>> The mapping, or the respective error
+ */
+inline Value<std::unique_ptr<Snapshot>> Snapshot::map(fs::path const& path_file_snapshot)
+{
+  int fd = ::open(path_file_snapshot.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("D::Could not open snapshot '{}': {}", path_file_snapshot, strerror(errno)));
+  struct stat st{};
+  if(::fstat(fd, &st) < 0 or st.st_size == 0)
+  {
+    ::close(fd);
+    return Error("D::Empty snapshot '{}'", path_file_snapshot);
+  }
+  void* ptr_map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  return_if(ptr_map == MAP_FAILED, Error("D::Could not map snapshot '{}': {}", path_file_snapshot, strerror(errno)));
+  return std::unique_ptr<Snapshot>(new Snapshot(static_cast<char const*>(ptr_map), st.st_size));
+}
+
+/**
+ * @brief Gets the json text of a section
+ *
+ * @param key The name of the section, e.g., 'daemon_host'
+ * @return Value<std::string_view> A view into the mapping, or the respective error
+ */
+inline Value<std::string_view> Snapshot::section(std::string_view key) const
+{
+  return Pop(ns_db::View(std::string_view(m_ptr_map, m_size_map))(key).json(), "D::No section '{}' in snapshot", key);
+}
+
+/**
+ * @brief Writes the snapshot of an instance
+ *
+ * The file is replaced at once and left read-only, helpers that map it never see a partial
+ * write.
+ *
+ * @param path_file_snapshot Path to the snapshot file
+ * @param dispatcher Dispatcher to the host daemon
+ * @param daemon_host Host daemon
+ * @param logs_host Logs of the host daemon
+ * @param daemon_guest Guest daemon
+ * @param logs_guest Logs of the guest daemon
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write(fs::path const& path_file_snapshot
+  , ns_dispatcher::Dispatcher const& dispatcher
+  , ns_daemon::Daemon const& daemon_host
+  , ns_daemon::ns_log::Logs const& logs_host
+  , ns_daemon::Daemon const& daemon_guest
+  , ns_daemon::ns_log::Logs const& logs_guest)
+{
+  // Each section holds the serialized object, as its deserializer reads it from a variable
+  ns_db::Db db;
+  db("dispatcher") = Pop(ns_db::from_string(Pop(ns_dispatcher::serialize(dispatcher)))).data();
+  db("daemon_host") = Pop(ns_db::from_string(Pop(ns_daemon::serialize(daemon_host)))).data();
+  db("log_host") = Pop(ns_db::from_string(Pop(ns_daemon::ns_log::serialize(logs_host)))).data();
+  db("daemon_guest") = Pop(ns_db::from_string(Pop(ns_daemon::serialize(daemon_guest)))).data();
+  db("log_guest") = Pop(ns_db::from_string(Pop(ns_daemon::ns_log::serialize(logs_guest)))).data();
+  std::string json = Pop(db.dump());
+  // Write to a temporary file and rename it over the snapshot
+  Pop(ns_fs::create_directories(path_file_snapshot.parent_path()));
+  fs::path path_file_tmp = fs::path(path_file_snapshot).concat(".tmp");
+  std::error_code ec;
+  fs::remove(path_file_tmp, ec);
+  int fd = ::open(path_file_tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+  return_if(fd < 0, Error("E::Could not create snapshot '{}': {}", path_file_tmp, strerror(errno)));
+  ssize_t written = ::write(fd, json.data(), json.size());
+  ::close(fd);
+  return_if(written != static_cast<ssize_t>(json.size())
+    , Error("E::Could not write snapshot '{}': {}", path_file_tmp, strerror(errno))
+  );
+  return_if(::rename(path_file_tmp.c_str(), path_file_snapshot.c_str()) < 0
+    , Error("E::Could not rename snapshot to '{}': {}", path_file_snapshot, strerror(errno))
+  );
+  return {};
+}
+
+/**
+ * @brief Gets the serialized configuration of a helper
+ *
+ * The snapshot in FIM_SNAPSHOT is mapped on the first call and kept until the process exits.
+ *
+ * @param var Variable that holds the configuration, which takes precedence, e.g., FIM_DAEMON_CFG
+ * @param key Section of the configuration in the snapshot, e.g., 'daemon_host'
+ * @return Value<std::string_view> The serialized configuration, or the respective error
+ */
+[[nodiscard]] inline Value<std::string_view> read(char const* var, std::string_view key)
+{
+  if(char const* value = ::getenv(var))
+  {
+    return std::string_view(value);
+  }
+  static Value<std::unique_ptr<Snapshot>> const snapshot = []() -> Value<std::unique_ptr<Snapshot>>
+  {
+    return Snapshot::map(Pop(ns_env::get_expected<"D">("FIM_SNAPSHOT"), "D::FIM_SNAPSHOT is not set"));
+  }();
+  return_if(not snapshot, Error("D::No {} and no snapshot: {}", var, snapshot.error()));
+  return Pop((*snapshot)->section(key));
+}
+
+} // namespace ns_db::ns_portal::ns_snapshot
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -10,10 +10,13 @@
 
 #include <filesystem>
 #include <string>
+#include <vector>
 
 #include "../std/expected.hpp"
+#include "../lib/ed25519.hpp"
 #include "../reserved/remote.hpp"
 #include "db.hpp"
+#include "compact.hpp"
 
 /**
  * @namespace ns_db::ns_remote
@@ -22,7 +25,8 @@
  * Manages the remote URL for FlatImage recipe repositories. Stores and retrieves the base URL
  * from which recipe JSON files are fetched during package installation. Provides simple get/set
  * operations with persistence to the binary's reserved space for distribution-specific recipe
- * sources.
+ * sources. The same space holds the URL that 'fim-update' fetches new versions of the image from,
+ * and the public key its manifests must be signed with.
  */
 namespace ns_db::ns_remote
 {
@@ -34,6 +38,70 @@ namespace fs = std::filesystem;
 
 }
 
+namespace
+{
+
+// Positions of the URLs in the database
+constexpr size_t const INDEX_RECIPES = 0;
+constexpr size_t const INDEX_UPDATE = 1;
+constexpr size_t const INDEX_UPDATE_KEY = 2;
+
+/**
+ * @brief Reads the URLs of the database, unset URLs are empty
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @return Value<std::vector<std::string>> The recipes URL followed by the update URL and key, or
+ * the respective error
+ */
+[[nodiscard]] inline Value<std::vector<std::string>> read_urls(fs::path const& path_file_binary)
+{
+  std::vector<std::string> urls(INDEX_UPDATE_KEY + 1);
+  std::string data = Pop(ns_reserved::ns_remote::read(path_file_binary));
+  // Compact encoding, a count followed by the URLs
+  if(ns_compact::is_compact(data))
+  {
+    auto reader = Pop(ns_compact::Reader::open(data, ns_compact::Kind::REMOTE));
+    uint64_t count = Pop(reader.integer());
+    for(uint64_t i = 0; i < count; ++i)
+    {
+      std::string url{Pop(reader.string(), "E::Could not read URL")};
+      if(i < urls.size()) { urls[i] = std::move(url); }
+    }
+    return urls;
+  }
+  // Read json database from older versions
+  ns_db::Db db = ns_db::from_string(data).value_or(ns_db::Db());
+  if (not db.empty() and db.contains("url"))
+  {
+    urls[INDEX_RECIPES] = Pop(db("url").value<std::string>(), "E::Could not read URL");
+  }
+  return urls;
+}
+
+/**
+ * @brief Writes the URLs of the database
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @param urls The recipes URL followed by the update URL and key, unset entries are empty
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_urls(fs::path const& path_file_binary, std::vector<std::string> const& urls)
+{
+  // Trailing unset URLs are not stored
+  size_t count = urls.size();
+  while(count > 0 and urls[count-1].empty()) { --count; }
+  ns_compact::Writer writer(ns_compact::Kind::REMOTE);
+  writer.integer(count);
+  for(size_t i = 0; i < count; ++i)
+  {
+    writer.string(urls[i]);
+  }
+  Pop(ns_reserved::ns_remote::write(path_file_binary, Pop(writer.finish())));
+  return {};
+}
+
+} // namespace
+
 /**
  * @brief Sets a remote URL in the database
  *
@@ -43,13 +111,11 @@ namespace fs = std::filesystem;
  */
 [[nodiscard]] inline Value<void> set(fs::path const& path_file_binary, std::string const& url)
 {
-  // Create database
-  ns_db::Db db;
-  // Insert URL
-  db("url") = url;
+  auto urls = Pop(read_urls(path_file_binary));
+  urls[INDEX_RECIPES] = url;
   logger("I::Set remote URL to '{}'", url);
   // Write to the database
-  Pop(ns_reserved::ns_remote::write(path_file_binary, Pop(db.dump())));
+  Pop(write_urls(path_file_binary, urls));
   return {};
 }
 
@@ -61,17 +127,9 @@ namespace fs = std::filesystem;
  */
 [[nodiscard]] inline Value<std::string> get(fs::path const& path_file_binary)
 {
-  // Read database
-  ns_db::Db db = ns_db::from_string(
-    Pop(ns_reserved::ns_remote::read(path_file_binary))
-  ).value_or(ns_db::Db());
-  // Check if URL exists
-  if (db.empty() or not db.contains("url"))
-  {
-    return Error("E::No remote URL configured");
-  }
-  // Return URL
-  return Pop(db("url").value<std::string>(), "E::Could not read URL");
+  auto urls = Pop(read_urls(path_file_binary));
+  return_if(urls[INDEX_RECIPES].empty(), Error("E::No remote URL configured"));
+  return urls[INDEX_RECIPES];
 }
 
 /**
@@ -82,14 +140,75 @@ namespace fs = std::filesystem;
  */
 [[nodiscard]] inline Value<void> clear(fs::path const& path_file_binary)
 {
-  // Create empty database
-  ns_db::Db db;
-  // Write empty database
-  Pop(ns_reserved::ns_remote::write(path_file_binary, Pop(db.dump())));
+  auto urls = Pop(read_urls(path_file_binary));
+  urls[INDEX_RECIPES].clear();
+  Pop(write_urls(path_file_binary, urls));
   logger("I::Cleared remote URL");
   return {};
 }
 
+/**
+ * @brief Sets the URL that 'fim-update' fetches the image from, and the key of its publisher
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @param url The https URL of the directory written by 'fim-update publish'
+ * @param key The public key the manifests are signed with, as hexadecimal
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> set_update(fs::path const& path_file_binary, std::string const& url, std::string const& key)
+{
+  return_if(not url.starts_with("https://"), Error("E::The update URL must use https: '{}'", url));
+  ns_ed25519::PublicKey key_public = Pop(ns_ed25519::from_hex<32>(key), "E::Invalid update key '{}'", key);
+  auto urls = Pop(read_urls(path_file_binary));
+  urls[INDEX_UPDATE] = url;
+  urls[INDEX_UPDATE_KEY] = ns_ed25519::to_hex(key_public);
+  logger("I::Set update URL to '{}'", url);
+  Pop(write_urls(path_file_binary, urls));
+  return {};
+}
+
+/**
+ * @brief Gets the URL that 'fim-update' fetches the image from
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @return The update URL on success, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> get_update(fs::path const& path_file_binary)
+{
+  auto urls = Pop(read_urls(path_file_binary));
+  return_if(urls[INDEX_UPDATE].empty(), Error("E::No update URL configured"));
+  return urls[INDEX_UPDATE];
+}
+
+/**
+ * @brief Gets the public key the manifests of the update URL must be signed with
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @return The key on success, or the respective error
+ */
+[[nodiscard]] inline Value<ns_ed25519::PublicKey> get_update_key(fs::path const& path_file_binary)
+{
+  auto urls = Pop(read_urls(path_file_binary));
+  return_if(urls[INDEX_UPDATE_KEY].empty(), Error("E::No update key configured"));
+  return Pop(ns_ed25519::from_hex<32>(urls[INDEX_UPDATE_KEY]), "E::Invalid update key");
+}
+
+/**
+ * @brief Clears the URL that 'fim-update' fetches the image from, and its key
+ *
+ * @param path_file_binary Path to the binary with remote URL database
+ * @return Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clear_update(fs::path const& path_file_binary)
+{
+  auto urls = Pop(read_urls(path_file_binary));
+  urls[INDEX_UPDATE].clear();
+  urls[INDEX_UPDATE_KEY].clear();
+  Pop(write_urls(path_file_binary, urls));
+  logger("I::Cleared update URL");
+  return {};
+}
+
 } // namespace ns_db::ns_remote
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
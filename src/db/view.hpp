@@ -0,0 +1,355 @@
+/**
+ * @file view.hpp
+ * @author Ruan Formigoni
+ * @brief A read-only view over json text that parses on demand
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "../std/expected.hpp"
+#include "../std/concept.hpp"
+#include "../macro.hpp"
+
+namespace ns_db
+{
+
+namespace
+{
+
+/**
+ * @brief Skips json whitespace
+ *
+ * @param json The json text
+ * @param pos Position to start from
+ * @return size_t Position of the first non-whitespace character
+ */
+[[nodiscard]] inline size_t view_skip_ws(std::string_view json, size_t pos) noexcept
+{
+  while(pos < json.size() and (json[pos] == ' ' or json[pos] == '\n' or json[pos] == '\r' or json[pos] == '\t'))
+  {
+    ++pos;
+  }
+  return pos;
+}
+
+/**
+ * @brief Skips a json string
+ *
+ * @param json The json text
+ * @param pos Position of the opening quote
+ * @return Value<size_t> Position past the closing quote, or the respective error
+ */
+[[nodiscard]] inline Value<size_t> view_skip_string(std::string_view json, size_t pos)
+{
+  return_if(pos >= json.size() or json[pos] != '"', Error("D::Expected json string"));
+  for(++pos; pos < json.size(); ++pos)
+  {
+    if(json[pos] == '\\') { ++pos; }
+    else if(json[pos] == '"') { return pos + 1; }
+  }
+  return Error("D::Unterminated json string");
+}
+
+/**
+ * @brief Skips a json value of any type
+ *
+ * @param json The json text
+ * @param pos Position of the first character of the value
+ * @return Value<size_t> Position past the value, or the respective error
+ */
+[[nodiscard]] inline Value<size_t> view_skip_value(std::string_view json, size_t pos)
+{
+  return_if(pos >= json.size(), Error("D::Expected json value"));
+  if(json[pos] == '"')
+  {
+    return view_skip_string(json, pos);
+  }
+  if(json[pos] == '{' or json[pos] == '[')
+  {
+    // Balance brackets, skipping strings that could contain them
+    size_t depth = 0;
+    while(pos < json.size())
+    {
+      char c = json[pos];
+      if(c == '"') { pos = Pop(view_skip_string(json, pos)); continue; }
+      if(c == '{' or c == '[') { ++depth; }
+      else if((c == '}' or c == ']') and --depth == 0) { return pos + 1; }
+      ++pos;
+    }
+    return Error("D::Unterminated json structure");
+  }
+  // Numbers and literals end on a delimiter
+  size_t end = json.find_first_of(",}] \n\r\t", pos);
+  return (end == std::string_view::npos)? json.size() : end;
+}
+
+/**
+ * @brief Appends a code point as utf-8
+ *
+ * @param out The string to append to
+ * @param code The code point
+ */
+inline void view_append_utf8(std::string& out, uint32_t code)
+{
+  if(code < 0x80)
+  {
+    out.push_back(static_cast<char>(code));
+  }
+  else if(code < 0x800)
+  {
+    out.push_back(static_cast<char>(0xc0 | (code >> 6)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  }
+  else if(code < 0x10000)
+  {
+    out.push_back(static_cast<char>(0xe0 | (code >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  }
+  else
+  {
+    out.push_back(static_cast<char>(0xf0 | (code >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  }
+}
+
+/**
+ * @brief Reads the four hex digits of a \\u escape
+ *
+ * @param json The json text
+ * @param pos Position of the first digit
+ * @return Value<uint32_t> The value of the digits, or the respective error
+ */
+[[nodiscard]] inline Value<uint32_t> view_hex4(std::string_view json, size_t pos)
+{
+  return_if(pos + 4 > json.size(), Error("D::Truncated json unicode escape"));
+  uint32_t code = 0;
+  for(char c : json.substr(pos, 4))
+  {
+    code <<= 4;
+    if(c >= '0' and c <= '9') { code |= c - '0'; }
+    else if(c >= 'a' and c <= 'f') { code |= c - 'a' + 10; }
+    else if(c >= 'A' and c <= 'F') { code |= c - 'A' + 10; }
+    else { return Error("D::Invalid json unicode escape"); }
+  }
+  return code;
+}
+
+/**
+ * @brief Decodes a json string
+ *
+ * @param json A json string, including the quotes
+ * @return Value<std::string> The decoded string, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> view_unescape(std::string_view json)
+{
+  return_if(json.size() < 2 or json.front() != '"' or json.back() != '"', Error("D::Json element is not a string"));
+  json = json.substr(1, json.size() - 2);
+  // Most strings have no escapes
+  if(not json.contains('\\'))
+  {
+    return std::string(json);
+  }
+  std::string out;
+  out.reserve(json.size());
+  for(size_t pos = 0; pos < json.size(); ++pos)
+  {
+    if(json[pos] != '\\') { out.push_back(json[pos]); continue; }
+    return_if(++pos >= json.size(), Error("D::Truncated json escape"));
+    switch(json[pos])
+    {
+      case '"': out.push_back('"'); break;
+      case '\\': out.push_back('\\'); break;
+      case '/': out.push_back('/'); break;
+      case 'b': out.push_back('\b'); break;
+      case 'f': out.push_back('\f'); break;
+      case 'n': out.push_back('\n'); break;
+      case 'r': out.push_back('\r'); break;
+      case 't': out.push_back('\t'); break;
+      case 'u':
+      {
+        uint32_t code = Pop(view_hex4(json, pos + 1));
+        pos += 4;
+        // Surrogate pair, lone surrogates are rejected as Db does
+        return_if(code >= 0xdc00 and code < 0xe000, Error("D::Invalid json surrogate pair"));
+        if(code >= 0xd800 and code < 0xdc00)
+        {
+          return_if(json.substr(pos + 1, 2) != "\\u", Error("D::Invalid json surrogate pair"));
+          uint32_t low = Pop(view_hex4(json, pos + 3));
+          return_if(low < 0xdc00 or low >= 0xe000, Error("D::Invalid json surrogate pair"));
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+          pos += 6;
+        }
+        view_append_utf8(out, code);
+      }
+      break;
+      default: return Error("D::Invalid json escape '\\{}'", json[pos]);
+    }
+  }
+  return out;
+}
+
+} // anonymous namespace
+
+/**
+ * @class View
+ * @brief A read-only view over json text with the lookup interface of Db
+ *
+ * Construction only checks that the text holds a single complete json value, each lookup scans
+ * the text of the current element for the key and skips the values in between. No tree is built, the only allocations are the values
+ * returned by value(). Meant for small documents read once, like the portal messages and
+ * configurations; Db stays for everything that modifies json. The text must outlive the view.
+ */
+class View
+{
+  private:
+    std::string_view m_json;
+    std::string m_error;
+
+    View(std::string_view json, std::string error) noexcept;
+
+  public:
+    explicit View(std::string_view json);
+    [[maybe_unused]] [[nodiscard]] View operator()(std::string_view key) const;
+    template<typename V>
+    [[maybe_unused]] [[nodiscard]] Value<V> value() const;
+    [[maybe_unused]] [[nodiscard]] Value<std::string_view> json() const;
+};
+
+/**
+ * @brief Construct a new View object of an element found by a lookup
+ *
+ * @param json The json text of the element
+ * @param error The error of the lookup, empty if the element was found
+ */
+inline View::View(std::string_view json, std::string error) noexcept
+  : m_json(json)
+  , m_error(std::move(error))
+{
+}
+
+/**
+ * @brief Construct a new View object of a json document
+ *
+ * An unterminated document, or one followed by anything but whitespace, fails on every lookup.
+ *
+ * @param json The json text of the document
+ */
+inline View::View(std::string_view json)
+  : m_json(json.substr(view_skip_ws(json, 0)))
+  , m_error()
+{
+  auto end = view_skip_value(m_json, 0);
+  if(not end)
+  {
+    m_error = end.error();
+  }
+  else if(view_skip_ws(m_json, *end) != m_json.size())
+  {
+    m_error = "Trailing characters after json document";
+  }
+}
+
+/**
+ * @brief Looks up the value of a key in the current object
+ *
+ * @param key The key to look for
+ * @return View A view of the value, or a view that fails on value() if the key is not found
+ */
+inline View View::operator()(std::string_view key) const
+{
+  View view({}, {});
+  auto f_find = [&]() -> Value<void>
+  {
+    return_if(not m_error.empty(), Error("D::{}", m_error));
+    return_if(m_json.empty() or m_json.front() != '{', Error("D::Json element is not an object"));
+    for(size_t pos = view_skip_ws(m_json, 1); pos < m_json.size() and m_json[pos] != '}';)
+    {
+      size_t end_key = Pop(view_skip_string(m_json, pos));
+      std::string_view json_key = m_json.substr(pos, end_key - pos);
+      pos = view_skip_ws(m_json, end_key);
+      return_if(pos >= m_json.size() or m_json[pos] != ':', Error("D::Expected ':' in json object"));
+      pos = view_skip_ws(m_json, pos + 1);
+      size_t end_value = Pop(view_skip_value(m_json, pos));
+      // Keys are compared raw unless they have escapes
+      bool is_match = json_key.contains('\\')?
+          Pop(view_unescape(json_key)) == key
+        : json_key.substr(1, json_key.size() - 2) == key;
+      if(is_match)
+      {
+        view.m_json = m_json.substr(pos, end_value - pos);
+        return {};
+      }
+      pos = view_skip_ws(m_json, end_value);
+      if(pos < m_json.size() and m_json[pos] == ',') { pos = view_skip_ws(m_json, pos + 1); }
+    }
+    return Error("D::Key '{}' not found", key);
+  };
+  if(auto ret = f_find(); not ret)
+  {
+    view.m_error = ret.error();
+  }
+  return view;
+}
+
+/**
+ * @brief Converts the current element to a specified type
+ *
+ * Supports strings and arrays of strings, like Db::value().
+ *
+ * @tparam V The target type to convert to
+ * @return Value<V> The converted object on success, or error on type mismatch/invalid json
+ */
+template<typename V>
+Value<V> View::value() const
+{
+  return_if(not m_error.empty(), Error("D::{}", m_error));
+  if constexpr ( ns_concept::IsVector<V> and ns_concept::Uniform<typename V::value_type, std::string>)
+  {
+    return_if(m_json.empty() or m_json.front() != '[', Error("D::Tried to create array with non-array entry"));
+    V values;
+    for(size_t pos = view_skip_ws(m_json, 1); pos < m_json.size() and m_json[pos] != ']';)
+    {
+      return_if(m_json[pos] != '"', Error("D::Invalid key type for string array"));
+      size_t end = Pop(view_skip_string(m_json, pos));
+      values.emplace_back(Pop(view_unescape(m_json.substr(pos, end - pos))));
+      pos = view_skip_ws(m_json, end);
+      if(pos < m_json.size() and m_json[pos] == ',') { pos = view_skip_ws(m_json, pos + 1); }
+    }
+    return values;
+  }
+  else if constexpr (ns_concept::StringConstructible<V>)
+  {
+    return V(Pop(view_unescape(m_json.substr(0, Pop(view_skip_value(m_json, 0))))));
+  }
+  else
+  {
+    static_assert(std::is_same_v<V, V> == false, "Unsupported type V for value()");
+    return Error("D::No viable type conversion");
+  }
+}
+
+/**
+ * @brief Gets the json text of the current element, without parsing it
+ *
+ * @return Value<std::string_view> A view into the text, or the respective error
+ */
+inline Value<std::string_view> View::json() const
+{
+  return_if(not m_error.empty(), Error("D::{}", m_error));
+  return m_json.substr(0, Pop(view_skip_value(m_json, 0)));
+}
+
+} // namespace ns_db
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
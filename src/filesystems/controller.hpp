@@ -8,13 +8,27 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <print>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <fcntl.h>
 
 #include "../std/expected.hpp"
+#include "../lib/affinity.hpp"
+#include "../lib/span.hpp"
+#include "../lib/stats.hpp"
 #include "../reserved/overlay.hpp"
+#include "../db/perf.hpp"
 #include "filesystem.hpp"
 #include "overlayfs.hpp"
 #include "unionfs.hpp"
@@ -22,6 +36,9 @@
 #include "ciopfs.hpp"
 #include "utils.hpp"
 #include "layers.hpp"
+#include "share.hpp"
+#include "supervisor.hpp"
+#include "trace.hpp"
 
 /**
  * @namespace ns_filesystems
@@ -51,12 +68,15 @@ struct Logs
   fs::path const path_file_overlayfs;
   fs::path const path_file_unionfs;
   fs::path const path_file_janitor;
+  fs::path const path_file_perfmon;
 };
 
 struct Config
 {
   // Filesystem configuration
   bool const is_casefold;
+  bool const is_share;
+  bool const is_trace;
   uint32_t const compression_level;
   ns_reserved::ns_overlay::OverlayType overlay_type;
   // Main mount point
@@ -65,14 +85,58 @@ struct Config
   fs::path const path_dir_work;
   fs::path const path_dir_upper;
   fs::path const path_dir_layers;
+  // Upper directory of a concurrent instance, stacked on the read-only persistent one
+  fs::path const path_dir_upper_instance;
+  // Whether a concurrent instance keeps its changes on exit
+  bool const is_merge;
+  // Directory in memory with the upper and work directories of a volatile run
+  fs::path const path_dir_volatile;
+  // Read-only layer mounts shared between instances
+  fs::path const path_dir_share;
+  // Access hints to record or prefetch
+  fs::path const path_dir_trace;
   // Ciopfs
   fs::path const path_dir_ciopfs;
   fs::path const path_bin_janitor;
+  // Mounts to clean by the host portal daemon instead of a janitor, empty to spawn the janitor
+  fs::path const path_file_supervisor;
   fs::path const path_bin_self;
   // Extra layers to mount
   ns_layers::Layers const layers;
+  // Dwarfs tuning options
+  ns_db::ns_perf::Perf const perf;
+  // Placement of the fuse filesystems, apart from the sandboxed program
+  std::optional<ns_affinity::Affinity> const affinity;
 };
 
+/**
+ * @brief Gets the upper directory where the changes of the instance are written
+ *
+ * @param config The filesystem configuration
+ * @return fs::path The upper directory of a concurrent instance, or the persistent one
+ */
+[[nodiscard]] inline fs::path get_upper(Config const& config)
+{
+  return config.path_dir_upper_instance.empty()? config.path_dir_upper : config.path_dir_upper_instance;
+}
+
+/**
+ * @brief Gets the read-only directories stacked below the upper directory
+ *
+ * @param config The filesystem configuration
+ * @return std::vector<fs::path> The mounted layers bottom-up, topped by the persistent upper
+ * directory for a concurrent instance
+ */
+[[nodiscard]] inline std::vector<fs::path> get_lowers(Config const& config)
+{
+  std::vector<fs::path> vec_path_dir_layer = ::ns_filesystems::ns_utils::get_mounted_layers(config.path_dir_layers);
+  if(not config.path_dir_upper_instance.empty())
+  {
+    vec_path_dir_layer.push_back(config.path_dir_upper);
+  }
+  return vec_path_dir_layer;
+}
+
 class Controller
 {
   private:
@@ -80,12 +144,25 @@ class Controller
     fs::path m_path_dir_mount;
     fs::path m_path_dir_work;
     std::vector<fs::path> m_vec_path_dir_mountpoints;
+    std::vector<fs::path> m_vec_path_dir_perfmon;
     std::vector<std::unique_ptr<ns_dwarfs::Dwarfs>> m_dwarfs;
+    std::vector<std::unique_ptr<ns_share::Share>> m_shares;
     std::vector<std::unique_ptr<ns_filesystem::Filesystem>> m_filesystems;
+    std::vector<ns_trace::Hint> m_hints;
+    std::unique_ptr<ns_trace::Recorder> m_recorder;
     std::unique_ptr<ns_subprocess::Child> m_child_janitor;
+    ns_subprocess::WaitSet m_wait_set;
+    std::jthread m_thread_monitor;
     ns_layers::Layers const m_layers;
+    ns_db::ns_perf::Perf const m_perf;
+    bool const m_is_share;
+    fs::path const m_path_dir_share;
+    fs::path const m_path_dir_trace;
+    fs::path const m_path_bin_janitor;
+    fs::path const m_path_file_supervisor;
 
-    [[nodiscard]] uint64_t mount_dwarfs(fs::path const& path_dir_mount);
+    [[nodiscard]] uint64_t mount_dwarfs(fs::path const& path_dir_mount, bool is_trace);
+    [[nodiscard]] std::jthread readahead(std::vector<bool> vec_is_skipped) const;
     void mount_ciopfs(fs::path const& path_dir_lower, fs::path const& path_dir_upper);
     void mount_unionfs(std::vector<fs::path> const& vec_path_dir_layer
       , fs::path const& path_dir_data
@@ -98,10 +175,13 @@ class Controller
     );
     // In case the parent process fails to clean the mountpoints, this child does it
     [[nodiscard]] Value<void> spawn_janitor(fs::path const& path_bin_janitor, fs::path const& path_file_log);
+    [[nodiscard]] ns_supervisor::Mounts mounts() const;
+    void monitor();
 
   public:
     Controller(Logs const& logs, Config const& config);
     ~Controller();
+    [[nodiscard]] Value<void> unsupervise();
     Controller(Controller const&) = delete;
     Controller(Controller&&) = delete;
     Controller& operator=(Controller const&) = delete;
@@ -118,19 +198,49 @@ inline Controller::Controller(Logs const& logs , Config const& config)
   , m_path_dir_mount(config.path_dir_mount)
   , m_path_dir_work(config.path_dir_work)
   , m_vec_path_dir_mountpoints()
+  , m_vec_path_dir_perfmon()
   , m_dwarfs()
+  , m_shares()
   , m_filesystems()
+  , m_hints()
+  , m_recorder(nullptr)
   , m_child_janitor(nullptr)
+  , m_wait_set()
+  , m_thread_monitor()
   , m_layers(config.layers)
+  , m_perf(config.perf)
+  , m_is_share(config.is_share)
+  , m_path_dir_share(config.path_dir_share)
+  , m_path_dir_trace(config.path_dir_trace)
+  , m_path_bin_janitor(config.path_bin_janitor)
+  , m_path_file_supervisor(config.path_file_supervisor)
 {
+  // The fuse processes and the threads that spawn them inherit the placement
+  ns_affinity::Scope scope_affinity(config.affinity);
+  auto time_mount = std::chrono::steady_clock::now();
   // Mount compressed layers
-  [[maybe_unused]] uint64_t index_fs = mount_dwarfs(config.path_dir_layers);
+  uint64_t index_fs = [&]
+  {
+    ns_span::Span span("mount_dwarfs");
+    return mount_dwarfs(config.path_dir_layers, config.is_trace);
+  }();
+  ns_stats::add(ns_stats::Counter::LAYERS_MOUNTED, index_fs);
+  // Record the files the application reads, or read the recorded ones ahead of it
+  if (config.is_trace)
+  {
+    m_recorder = std::make_unique<ns_trace::Recorder>(m_hints);
+  }
+  else
+  {
+    ns_span::Span span("prefetch");
+    ns_trace::prefetch(m_hints);
+  }
   // Use unionfs-fuse
-  if ( config.overlay_type == ns_reserved::ns_overlay::OverlayType::UNIONFS )
+  if ( ns_span::Span span("mount_overlay"); config.overlay_type == ns_reserved::ns_overlay::OverlayType::UNIONFS )
   {
     logger("D::Overlay type: UNIONFS_FUSE");
-    mount_unionfs(::ns_filesystems::ns_utils::get_mounted_layers(config.path_dir_layers)
-      , config.path_dir_upper
+    mount_unionfs(get_lowers(config)
+      , get_upper(config)
       , config.path_dir_mount
     );
   }
@@ -138,8 +248,8 @@ inline Controller::Controller(Logs const& logs , Config const& config)
   else if ( config.overlay_type == ns_reserved::ns_overlay::OverlayType::OVERLAYFS )
   {
     logger("D::Overlay type: FUSE_OVERLAYFS");
-    mount_overlayfs(::ns_filesystems::ns_utils::get_mounted_layers(config.path_dir_layers)
-      , config.path_dir_upper
+    mount_overlayfs(get_lowers(config)
+      , get_upper(config)
       , config.path_dir_mount
       , config.path_dir_work
     );
@@ -157,6 +267,7 @@ inline Controller::Controller(Logs const& logs , Config const& config)
     }
     else
     {
+      ns_span::Span span("mount_ciopfs");
       mount_ciopfs(config.path_dir_mount, config.path_dir_ciopfs);
       logger("D::casefold is enabled");
     }
@@ -165,8 +276,23 @@ inline Controller::Controller(Logs const& logs , Config const& config)
   {
     logger("D::casefold is disabled");
   }
+  ns_stats::add(ns_stats::Counter::MOUNT_US
+    , std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - time_mount).count()
+  );
   // Spawn janitor, make it permissive since flatimage works without it
-  spawn_janitor(config.path_bin_janitor, logs.path_file_janitor).discard("E::Could not spawn janitor");
+  ns_span::Span span("spawn_janitor");
+  if (m_path_file_supervisor.empty())
+  {
+    spawn_janitor(config.path_bin_janitor, logs.path_file_janitor).discard("E::Could not spawn janitor");
+  }
+  // Or leave the cleanup to the host portal daemon
+  else if (auto ret = ns_supervisor::write(m_path_file_supervisor, mounts()); not ret)
+  {
+    logger("W::Could not hand the mounts to the supervisor, spawning janitor: {}", ret.error());
+    spawn_janitor(config.path_bin_janitor, logs.path_file_janitor).discard("E::Could not spawn janitor");
+  }
+  // Report fuse processes that exit while their filesystems are in use
+  monitor();
 }
 
 /**
@@ -175,12 +301,68 @@ inline Controller::Controller(Logs const& logs , Config const& config)
  */
 inline Controller::~Controller()
 {
+  // The processes exit with the un-mount below
+  m_thread_monitor = std::jthread();
+  // Stop recording before the layers go away
+  m_recorder.reset();
+  // Keep the performance monitor summaries, they are gone with the un-mount
+  if(not m_vec_path_dir_perfmon.empty())
+  {
+    std::ofstream file_perfmon(m_logs.path_file_perfmon, std::ios::app);
+    for(fs::path const& path_dir_layer : m_vec_path_dir_perfmon)
+    {
+      auto summary = ns_dwarfs::perfmon(path_dir_layer);
+      continue_if(not summary, "W::Could not read performance monitor of layer '{}'", path_dir_layer.filename());
+      std::println(file_perfmon, "[layer {}]\n{}", path_dir_layer.filename().string(), *summary);
+    }
+  }
+  // Un-mount top-down in one pass, the filesystems only stop their processes afterwards
+  ns_span::Span span("unmount");
+  std::vector<fs::path> vec_path_dir_mountpoints(m_vec_path_dir_mountpoints.rbegin(), m_vec_path_dir_mountpoints.rend());
+  ns_fuse::unmount(vec_path_dir_mountpoints).discard("E::Could not un-mount filesystems");
+  // The supervisor skips the cleanup without the file
+  if (std::error_code ec; not m_path_file_supervisor.empty() and fs::remove(m_path_file_supervisor, ec))
+  {
+    logger("D::Released the mounts from the supervisor");
+  }
   // Check if janitor is running
-  return_if(not m_child_janitor,,"E::Janitor is not running");
+  return_if(not m_child_janitor,,"D::Janitor is not running");
   // Stop janitor loop
   m_child_janitor->kill(SIGTERM);
 }
 
+/**
+ * @brief Gets the filesystems to clean if the instance crashes
+ *
+ * @return ns_supervisor::Mounts The mountpoints of the instance and its shared mounts
+ */
+inline ns_supervisor::Mounts Controller::mounts() const
+{
+  return ns_supervisor::Mounts
+  {
+    .mountpoints = m_vec_path_dir_mountpoints,
+    .shared = m_shares
+      | std::views::transform([](auto&& e){ return e->path(); })
+      | std::ranges::to<std::vector<fs::path>>(),
+  };
+}
+
+/**
+ * @brief Takes the cleanup back from the supervisor and spawns a janitor for it
+ *
+ * Used when the host portal daemon could not be started, without it nothing would clean the
+ * mounts of a crashed instance.
+ *
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> Controller::unsupervise()
+{
+  return_if(m_path_file_supervisor.empty() or m_child_janitor, {});
+  std::error_code ec;
+  fs::remove(m_path_file_supervisor, ec);
+  return spawn_janitor(m_path_bin_janitor, m_logs.path_file_janitor);
+}
+
 /**
  * @brief Spawns the janitor.
  * In case the parent process fails to clean the mountpoints, this child does it
@@ -192,9 +374,12 @@ inline Controller::~Controller()
 [[nodiscard]] inline Value<void> Controller::spawn_janitor(fs::path const& path_bin_janitor
   , fs::path const& path_file_log)
 {
+  // Shared mounts are released instead of un-mounted, other instances might use them
+  ns_supervisor::Mounts mounts = this->mounts();
   // Spawn
   m_child_janitor = ns_subprocess::Subprocess(path_bin_janitor)
-    .with_args(getpid(), path_file_log, this->m_vec_path_dir_mountpoints)
+    .with_args(getpid(), path_file_log, mounts.mountpoints)
+    .with_args("--shared", mounts.shared)
     .with_log_file(path_file_log)
     .spawn();
   // Check if janitor is running
@@ -211,6 +396,49 @@ inline Controller::~Controller()
   return {};
 }
 
+/**
+ * @brief Watches the fuse processes and the janitor until the controller is destroyed
+ *
+ * A process that exits before the un-mount, like a dwarfs process killed by the OOM killer,
+ * leaves its mountpoint returning errors. It is reported as soon as it exits, instead of
+ * surfacing later as failed or hung file accesses in the application.
+ */
+inline void Controller::monitor()
+{
+  for(auto const& filesystem : m_dwarfs)
+  {
+    if(auto child = filesystem->child()) { m_wait_set.add(*child); }
+  }
+  for(auto const& filesystem : m_filesystems)
+  {
+    if(auto child = filesystem->child()) { m_wait_set.add(*child); }
+  }
+  if(m_child_janitor) { m_wait_set.add(*m_child_janitor); }
+  return_if(m_wait_set.empty(),);
+  // Log with the same verbosity as the thread that mounted the filesystems
+  m_thread_monitor = std::jthread([this, level = ns_log::get_level()](std::stop_token token)
+  {
+    using namespace std::chrono_literals;
+    ns_log::set_level(level);
+    while(not token.stop_requested() and not m_wait_set.empty())
+    {
+      auto exits = m_wait_set.wait(100ms);
+      break_if(not exits, "E::Stopped watching the filesystem processes: {}", exits.error());
+      for(auto const& exit : *exits)
+      {
+        ns_stats::add(ns_stats::Counter::FUSE_EXITS);
+        logger("E::Process '{}' with pid '{}' exited while the filesystems are mounted ({})"
+          , exit.description
+          , exit.pid
+          , exit.code? std::format("exit code {}", *exit.code)
+            : exit.signal? std::format("signal {}", strsignal(*exit.signal))
+            : std::string{"unknown status"}
+        );
+      }
+    }
+  });
+}
+
 /**
  * @brief Mounts all dwarfs filesystems from the layers collection
  *
@@ -218,24 +446,130 @@ inline Controller::~Controller()
  * Layers should be populated before Controller construction using Layers::push_binary()
  * for embedded filesystems and Layers::push() for external layer files.
  *
+ * All dwarfs processes are spawned first and then waited for at once, so the startup cost is
+ * that of the slowest layer rather than the sum of all layers. Mountpoint indexes follow the
+ * layer order, which is the order the overlay stack depends on.
+ *
+ * The layers are not validated again here, Layers only stores filesystems with a verified
+ * DwarFS magic (either checked on append or recorded as such in the layer index).
+ *
+ * When sharing is enabled, each layer is mounted once under the application directory and
+ * reused by every instance of the same image; the instance mountpoint is a symlink to it. Layers
+ * that cannot be shared fall back to a mount owned by the instance.
+ *
+ * With a cache budget, the block cache of each layer is its share of the budget. The shares are
+ * weighted by the number of files recorded in the access hints of the layers, so the layers the
+ * application reads get larger caches. Without recorded hints they are weighted by the layer size.
+ *
+ * The metadata of the layers is read ahead while the dwarfs processes start, see readahead().
+ *
+ * Lazy layers, see 'fim-layer lazy', are left out when the last recording of the access hints
+ * read none of their files, so the startup cost does not grow with the size of a library of
+ * optional layers. While recording every layer is mounted, so the layers the application starts
+ * to read are mounted again on the boots after it.
+ *
  * @param path_dir_mount Path to the directory to mount the filesystems
+ * @param is_trace Whether the access hints are recorded in this run
  * @return uint64_t The index of the last mounted dwarfs filesystem + 1
  */
-inline uint64_t Controller::mount_dwarfs(fs::path const& path_dir_mount)
+inline uint64_t Controller::mount_dwarfs(fs::path const& path_dir_mount, bool is_trace)
 {
   // Filesystem index
   uint64_t index_fs{};
+  // Mountpoints pending to be ready
+  std::vector<fs::path> vec_path_dir_pending;
+
+  // Lazy layers with an empty hint file were not read in the last recording
+  auto f_is_idle = [&](fs::path const& _path_file_layer, uint64_t _offset, uint64_t _size)
+  {
+    return_if(is_trace or not m_layers.is_lazy(_path_file_layer), false);
+    auto key = ns_share::key(_path_file_layer, _offset, _size, "");
+    std::error_code ec;
+    return key and fs::file_size(m_path_dir_trace / (*key + ".hint"), ec) == 0 and not ec;
+  };
+  std::vector<bool> vec_is_idle;
+  for (auto const& [path_file_layer, offset, size, fingerprint] : m_layers.get_layers())
+  {
+    vec_is_idle.push_back(f_is_idle(path_file_layer, offset, size));
+  }
+
+  // Copies of a layer, e.g., an embedded layer also given in FIM_LAYERS, are mounted once at the
+  // position of the topmost mounted copy, the ones below it are shadowed by it in the overlay
+  std::unordered_map<std::string_view,uint64_t> map_fingerprint_top;
+  for (uint64_t index_layer = 0; auto const& layer : m_layers.get_layers())
+  {
+    index_layer += 1;
+    continue_if(vec_is_idle[index_layer - 1]);
+    if (not layer.fingerprint.empty()) { map_fingerprint_top[layer.fingerprint] = index_layer; }
+  }
+  auto f_is_copy = [&](uint64_t _index_layer, std::string_view _fingerprint)
+  {
+    auto it = map_fingerprint_top.find(_fingerprint);
+    return it != map_fingerprint_top.end() and it->second != _index_layer;
+  };
+  auto f_is_skipped = [&](uint64_t _index_layer, std::string_view _fingerprint)
+  {
+    return vec_is_idle[_index_layer - 1] or f_is_copy(_index_layer, _fingerprint);
+  };
+
+  // Read the metadata of the layers while the dwarfs processes start, joined after they are ready
+  std::jthread thread_readahead = readahead([&]
+  {
+    std::vector<bool> vec_is_skipped;
+    for (uint64_t index_layer = 0; auto const& layer : m_layers.get_layers())
+    {
+      vec_is_skipped.push_back(f_is_skipped(++index_layer, layer.fingerprint));
+    }
+    return vec_is_skipped;
+  }());
+
+  // Shares of the cache budget by layer index
+  std::unordered_map<uint64_t,uint64_t> map_cachesize;
+  if (auto budget = m_perf.get_budget())
+  {
+    std::vector<uint64_t> vec_index_layer;
+    std::vector<uint64_t> vec_size;
+    std::vector<uint64_t> vec_hits;
+    for (uint64_t index_layer = 0; auto const& [path_file_layer, offset, size, fingerprint] : m_layers.get_layers())
+    {
+      index_layer += 1;
+      continue_if(f_is_skipped(index_layer, fingerprint));
+      vec_index_layer.push_back(index_layer - 1);
+      vec_size.push_back(size);
+      // Files recorded for the layer, one per line of its hint file
+      uint64_t hits = 0;
+      if (auto key = ns_share::key(path_file_layer, offset, size, ""))
+      {
+        std::ifstream file_hint(m_path_dir_trace / (*key + ".hint"));
+        hits = std::count(std::istreambuf_iterator<char>(file_hint), std::istreambuf_iterator<char>(), '\n');
+      }
+      vec_hits.push_back(hits);
+    }
+    bool is_hits = std::ranges::any_of(vec_hits, [](uint64_t e){ return e > 0; });
+    std::vector<uint64_t> vec_cachesize = ns_db::ns_perf::split_budget(*budget, is_hits? vec_hits : vec_size);
+    for (size_t i = 0; i < vec_index_layer.size(); ++i)
+    {
+      logger("D::Cache budget share of layer {}: {} bytes", vec_index_layer[i], vec_cachesize[i]);
+      map_cachesize[vec_index_layer[i]] = vec_cachesize[i];
+    }
+  }
+  auto f_options = [&](uint64_t _index_layer)
+  {
+    auto it = map_cachesize.find(_index_layer);
+    return m_perf.options(_index_layer, (it != map_cachesize.end())? std::optional(it->second) : std::nullopt);
+  };
 
-  auto f_mount = [this](fs::path const& _path_file_binary
+  auto f_spawn = [this, &vec_path_dir_pending, &f_options](fs::path const& _path_file_binary
     , fs::path const& _path_dir_mount
     , uint64_t _index_fs
+    , uint64_t _index_layer
     , uint64_t _offset
     , uint64_t _size_fs) -> Value<void>
   {
     // Create mountpoint
     fs::path path_dir_mount_index = _path_dir_mount / std::to_string(_index_fs);
     Try(fs::create_directories(path_dir_mount_index));
-    // Configure and mount the filesystem
+    // Configure and spawn the filesystem, do not wait for it to be ready
     // Keep the object alive in the filesystems vector
     this->m_dwarfs.emplace_back(
       std::make_unique<ns_dwarfs::Dwarfs>(getpid()
@@ -244,34 +578,149 @@ inline uint64_t Controller::mount_dwarfs(fs::path const& path_dir_mount)
         , m_logs.path_file_dwarfs
         , _offset
         , _size_fs
+        , f_options(_index_layer)
+        , false
       )
     );
     // Include current mountpoint in the mountpoints vector
     m_vec_path_dir_mountpoints.push_back(path_dir_mount_index);
+    vec_path_dir_pending.push_back(path_dir_mount_index);
+    return {};
+  };
+
+  auto f_share = [this, &vec_path_dir_pending, &f_options](fs::path const& _path_file_binary
+    , fs::path const& _path_dir_mount
+    , uint64_t _index_fs
+    , uint64_t _index_layer
+    , uint64_t _offset
+    , uint64_t _size_fs) -> Value<void>
+  {
+    std::string options = f_options(_index_layer);
+    std::string key = Pop(ns_share::key(_path_file_binary, _offset, _size_fs, options));
+    // Reference the shared mount, this blocks while another instance mounts the same layer
+    auto share = Pop(ns_share::Share::acquire(m_path_dir_share / key));
+    // Mount it if this is the first instance to use it
+    if(not share->is_mounted())
+    {
+      Pop(ns_dwarfs::spawn_detached(share->path(), _path_file_binary, _offset, _size_fs, options));
+      vec_path_dir_pending.push_back(share->path());
+    }
+    // Link the instance mountpoint to the shared mount
+    fs::path path_dir_mount_index = _path_dir_mount / std::to_string(_index_fs);
+    Try(fs::create_symlink(share->path(), path_dir_mount_index));
+    this->m_shares.push_back(std::move(share));
     return {};
   };
 
-  // Mount all filesystems (both embedded and external)
-  for (auto const& [path_file_layer, offset, size] : m_layers.get_layers())
+  // Access hints are named after the contents of the layer
+  auto f_hint = [this](fs::path const& _path_file_binary
+    , fs::path const& _path_dir_mount
+    , uint64_t _index_fs
+    , uint64_t _offset
+    , uint64_t _size_fs)
+  {
+    auto key = ns_share::key(_path_file_binary, _offset, _size_fs, "");
+    return_if(not key,, "E::Could not create access hint key: {}", key.error());
+    m_hints.push_back(ns_trace::Hint{
+        .path_dir_mount = _path_dir_mount / std::to_string(_index_fs)
+      , .path_file_hint = m_path_dir_trace / (*key + ".hint")
+    });
+  };
+
+  // Spawn all filesystems (both embedded and external)
+  for (uint64_t index_layer = 0; auto const& [path_file_layer, offset, size, fingerprint] : m_layers.get_layers())
   {
+    // Layer index as shown by 'fim-layer list', used to select the tuning options
+    index_layer += 1;
+    if (vec_is_idle[index_layer - 1])
+    {
+      logger("D::Layer {} is lazy and was not read in the last recording, not mounted", index_layer - 1);
+      continue;
+    }
+    if (f_is_copy(index_layer, fingerprint))
+    {
+      logger("D::Layer {} is a copy of layer {}, mounted once", index_layer - 1, map_fingerprint_top.at(fingerprint) - 1);
+      continue;
+    }
     logger("D::Mounting layer from '{}' with offset '{}'", path_file_layer.filename(), offset);
-    // Check if filesystem is of type 'DWARFS'
-    continue_if(not ns_dwarfs::is_dwarfs(path_file_layer, offset)
-      , "E::Invalid dwarfs filesystem appended on the image"
-    );
-    // Mount file as a filesystem
-    if (not f_mount(path_file_layer, path_dir_mount, index_fs, offset, size))
+    // Layers with the performance monitor enabled report it on un-mount
+    bool is_perfmon = f_options(index_layer - 1).contains("perfmon=");
+    // Share the filesystem with other instances, or spawn an instance mount
+    if (m_is_share)
+    {
+      if (auto ret = f_share(path_file_layer, path_dir_mount, index_fs, index_layer - 1, offset, size))
+      {
+        f_hint(path_file_layer, path_dir_mount, index_fs, offset, size);
+        if (is_perfmon) { m_vec_path_dir_perfmon.push_back(path_dir_mount / std::to_string(index_fs)); }
+        index_fs += 1;
+        continue;
+      }
+      else
+      {
+        logger("W::Could not share layer '{}', mounting it for this instance: {}", path_file_layer.filename(), ret.error());
+      }
+    }
+    // Spawn file as a filesystem
+    if (not f_spawn(path_file_layer, path_dir_mount, index_fs, index_layer - 1, offset, size))
     {
       logger("E::Failed to mount filesystem at index {}", index_fs);
       continue;
     }
+    f_hint(path_file_layer, path_dir_mount, index_fs, offset, size);
+    if (is_perfmon) { m_vec_path_dir_perfmon.push_back(path_dir_mount / std::to_string(index_fs)); }
     // Go to next filesystem if exists
     index_fs += 1;
   } // for
 
+  // Wait for all mounts to be ready
+  ns_fuse::wait_fuse(vec_path_dir_pending);
+  thread_readahead.join();
+
+  // Let other instances use the shared mounts
+  std::ranges::for_each(m_shares, [](auto&& e){ e->unlock(); });
+
   return index_fs;
 }
 
+/**
+ * @brief Hints the kernel about the pages of the layers that are read to mount them
+ *
+ * On slow media, like USB drives or network shares, each dwarfs process pulls the metadata and
+ * the first block of its layer with small random reads. The kernel is asked to read these ranges
+ * ahead instead, from a thread so the hints overlap the spawn of the dwarfs processes. Layers
+ * that are not mounted, like copies of a layer, are never read again, the pages read to
+ * fingerprint them are dropped from the page cache.
+ *
+ * @param vec_is_skipped Whether each layer, in the layer order, is left unmounted
+ * @return std::jthread The thread issuing the hints
+ */
+inline std::jthread Controller::readahead(std::vector<bool> vec_is_skipped) const
+{
+  return std::jthread([this, vec_is_skipped = std::move(vec_is_skipped), level = ns_log::get_level()]
+  {
+    ns_log::set_level(level);
+    ns_span::Span span("readahead");
+    for (size_t i = 0; auto const& [path_file_layer, offset, size, fingerprint] : m_layers.get_layers())
+    {
+      bool is_skipped = vec_is_skipped.at(i++);
+      int fd = ::open(path_file_layer.c_str(), O_RDONLY | O_CLOEXEC);
+      continue_if(fd < 0, "D::Could not open layer '{}' for readahead: {}", path_file_layer.filename(), strerror(errno));
+      if (is_skipped)
+      {
+        ::posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+      }
+      else if (auto ranges = ns_dwarfs::mount_ranges(fd, offset, size))
+      {
+        for (auto const& range : *ranges)
+        {
+          ::posix_fadvise(fd, range.offset, range.size, POSIX_FADV_WILLNEED);
+        }
+      }
+      ::close(fd);
+    }
+  });
+}
+
 /**
  * @brief Mounts an unionfs filesystem
  *
@@ -8,7 +8,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
 
 #include "../lib/subprocess.hpp"
 #include "../lib/env.hpp"
@@ -32,6 +43,24 @@ namespace
 
 namespace fs = std::filesystem;
 
+/**
+ * @brief Creates the '-o' argument of dwarfs
+ *
+ * @param offset Offset to the filesystem start
+ * @param size_image Image length
+ * @param options Extra comma-separated dwarfs options, they go last to override the defaults
+ * @return std::string The mount options
+ */
+inline std::string mount_options(uint64_t offset, uint64_t size_image, std::string const& options)
+{
+  std::string result = std::format("uid={},gid={},auto_unmount,offset={},imagesize={}", getuid(), getgid(), offset, size_image);
+  if(not options.empty())
+  {
+    result += "," + options;
+  }
+  return result;
+}
+
 };
 
 class Dwarfs final : public ns_filesystem::Filesystem
@@ -40,13 +69,17 @@ class Dwarfs final : public ns_filesystem::Filesystem
     fs::path m_path_file_image;
     uint64_t m_offset;
     uint64_t m_size_image;
+    std::string m_options;
   public:
     Dwarfs(pid_t pid_to_die_for
       , fs::path const& path_dir_mount
       , fs::path const& path_file_image
       , fs::path const& path_file_log
       , uint64_t offset
-      , uint64_t size_image);
+      , uint64_t size_image
+      , std::string const& options = ""
+      , bool is_wait = true);
+    Value<void> spawn();
     Value<void> mount() override;
 };
 
@@ -58,6 +91,8 @@ class Dwarfs final : public ns_filesystem::Filesystem
  * @param path_file_image Path to the flatimage file
  * @param offset Offset to the filesystem start
  * @param size_image Image length
+ * @param options Extra comma-separated dwarfs options (e.g., cachesize=512m,workers=4)
+ * @param is_wait Wait for the mount to be ready, if false the caller must wait on the mountpoint
  */
 inline Dwarfs::Dwarfs(pid_t pid_to_die_for
   , fs::path const& path_dir_mount
@@ -65,21 +100,31 @@ inline Dwarfs::Dwarfs(pid_t pid_to_die_for
   , fs::path const& path_file_log
   , uint64_t offset
   , uint64_t size_image
+  , std::string const& options
+  , bool is_wait
 )
   : ns_filesystem::Filesystem(pid_to_die_for, path_dir_mount, path_file_log)
   , m_path_file_image(path_file_image)
   , m_offset(offset)
   , m_size_image(size_image)
+  , m_options(options)
 {
-  this->mount().discard("E::Could not mount dwarfs filesystem '{}' to '{}'", path_file_image, path_dir_mount);
+  if(is_wait)
+  {
+    this->mount().discard("E::Could not mount dwarfs filesystem '{}' to '{}'", path_file_image, path_dir_mount);
+  }
+  else
+  {
+    this->spawn().discard("E::Could not spawn dwarfs filesystem '{}' to '{}'", path_file_image, path_dir_mount);
+  }
 }
 
 /**
- * @brief Mounts the filesystem
+ * @brief Spawns the dwarfs process without waiting for the mount to be ready
  *
  * @return Value<void> Nothing on success or the respective error
  */
-inline Value<void> Dwarfs::mount()
+inline Value<void> Dwarfs::spawn()
 {
   // Check if image exists and is a regular file
   return_if(not Try(fs::is_regular_file(m_path_file_image))
@@ -91,19 +136,96 @@ inline Value<void> Dwarfs::mount()
   );
   // Find command in PATH
   auto path_file_dwarfs = Pop(ns_env::search_path("dwarfs"), "E::Could not find dwarfs in PATH");
+  // Mount options, the tuning options go last so they can override the defaults of dwarfs
+  log_if(not m_options.empty(), "D::Dwarfs options for '{}': {}", m_path_dir_mount, m_options);
   // Spawn command
   m_child = ns_subprocess::Subprocess(path_file_dwarfs)
     .with_args(m_path_file_image, m_path_dir_mount)
-    .with_args("-f", "-o", std::format("uid={},gid={},auto_unmount,offset={},imagesize={}", getuid(), getgid(), m_offset, m_size_image))
+    .with_args("-f", "-o", mount_options(m_offset, m_size_image, m_options))
     .with_die_on_pid(m_pid_to_die_for)
     .with_stdio(ns_subprocess::Stream::Pipe)
     .with_log_file(m_path_file_log)
     .spawn();
+  return_if(not m_child, Error("E::Could not spawn dwarfs for '{}'", m_path_dir_mount));
+  return {};
+}
+
+/**
+ * @brief Mounts the filesystem
+ *
+ * @return Value<void> Nothing on success or the respective error
+ */
+inline Value<void> Dwarfs::mount()
+{
+  Pop(this->spawn());
   // Wait for mount
   ns_fuse::wait_fuse(m_path_dir_mount);
   return {};
 }
 
+/**
+ * @brief Spawns a dwarfs process that outlives the current instance
+ *
+ * Used for mounts shared between instances, the process is detached as a daemon and exits when
+ * the filesystem is un-mounted by the last instance that uses it. The caller must wait on the
+ * mountpoint.
+ *
+ * @param path_dir_mount Path to the mount directory
+ * @param path_file_image Path to the flatimage file
+ * @param offset Offset to the filesystem start
+ * @param size_image Image length
+ * @param options Extra comma-separated dwarfs options
+ * @return Value<void> Nothing on success or the respective error
+ */
+[[nodiscard]] inline Value<void> spawn_detached(fs::path const& path_dir_mount
+  , fs::path const& path_file_image
+  , uint64_t offset
+  , uint64_t size_image
+  , std::string const& options = "")
+{
+  auto path_file_dwarfs = Pop(ns_env::search_path("dwarfs"), "E::Could not find dwarfs in PATH");
+  log_if(not options.empty(), "D::Dwarfs options for '{}': {}", path_dir_mount, options);
+  auto child = ns_subprocess::Subprocess(path_file_dwarfs)
+    .with_args(path_file_image, path_dir_mount)
+    .with_args("-f", "-o", mount_options(offset, size_image, options))
+    .with_daemon()
+    .spawn();
+  return_if(not child or child->get_pid().value_or(-1) < 0
+    , Error("E::Could not spawn dwarfs for '{}'", path_dir_mount)
+  );
+  return {};
+}
+
+/**
+ * @brief Reads the performance monitor summary of a mounted dwarfs filesystem
+ *
+ * Dwarfs started with the 'perfmon' option exposes the summary of its monitored components, e.g.,
+ * cache hits and misses of the block cache, and the latency of the fuse operations, in an
+ * extended attribute of the root directory. The summary covers every process that reads the
+ * filesystem, including other instances for a shared mount.
+ *
+ * @param path_dir_mount Path to the mount directory
+ * @return Value<std::string> The summary, or the respective error if the filesystem does not
+ * monitor itself
+ */
+[[nodiscard]] inline Value<std::string> perfmon(fs::path const& path_dir_mount)
+{
+  constexpr char const* name = "user.dwarfs.driver.perfmon";
+  // The summary grows between the calls while the filesystem is in use, retry on a short buffer
+  for(int tries = 0; tries < 3; ++tries)
+  {
+    ssize_t size = ::getxattr(path_dir_mount.c_str(), name, nullptr, 0);
+    return_if(size < 0, Error("D::No performance monitor for '{}': {}", path_dir_mount, strerror(errno)));
+    std::string summary(static_cast<size_t>(size) + 1024, '\0');
+    size = ::getxattr(path_dir_mount.c_str(), name, summary.data(), summary.size());
+    continue_if(size < 0 and errno == ERANGE);
+    return_if(size < 0, Error("D::Could not read performance monitor of '{}': {}", path_dir_mount, strerror(errno)));
+    summary.resize(static_cast<size_t>(size));
+    return summary;
+  }
+  return Error("D::Could not read performance monitor of '{}': {}", path_dir_mount, strerror(ERANGE));
+}
+
 /**
  * @brief Checks if the filesystem is a `Dwarfs` filesystem with a given offset
  *
@@ -128,6 +250,153 @@ inline bool is_dwarfs(fs::path const& path_file_dwarfs, uint64_t offset = 0)
   return std::ranges::equal(header, std::string_view("DWARFS"));
 }
 
+/**
+ * @brief The header of a section of a DwarFS image, format version 2
+ *
+ * An image is a sequence of sections, each one is this header followed by 'length' bytes of data.
+ * The checksums cover the header fields after them and the data of the section.
+ */
+struct SectionHeader
+{
+  std::array<char,6> magic;                ///< "DWARFS"
+  uint8_t major;                           ///< Major version of the format
+  uint8_t minor;                           ///< Minor version of the format
+  std::array<uint8_t,32> sha2_512_256;     ///< SHA2-512/256 of the section
+  uint64_t xxh3_64;                        ///< XXH3-64 of the section
+  uint32_t number;                         ///< Position of the section in the image
+  uint16_t type;                           ///< Type of the section, e.g., block or metadata
+  uint16_t compression;                    ///< Compression of the section data
+  uint64_t length;                         ///< Size of the section data
+};
+static_assert(sizeof(SectionHeader) == 64);
+
+/**
+ * @brief Checks the chain of section headers of a DwarFS image
+ *
+ * The image is mapped and only the pages of the headers are touched, so the cost depends on the
+ * number of sections and not on the size of the image. Each header must carry the magic and the
+ * version 2 of the format, be numbered after the previous one, and the last section must end at
+ * the end of the image.
+ *
+ * @param path_file_dwarfs Path to the file that contains the image
+ * @param offset Offset in the file at which the image starts
+ * @param size Size of the image
+ * @return Value<uint64_t> The number of sections, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> check_sections(fs::path const& path_file_dwarfs, uint64_t offset, uint64_t size)
+{
+  int fd = ::open(path_file_dwarfs.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("D::Could not open '{}': {}", path_file_dwarfs, strerror(errno)));
+  struct stat st{};
+  if(::fstat(fd, &st) < 0 or static_cast<uint64_t>(st.st_size) < offset + size)
+  {
+    ::close(fd);
+    return Error("D::The image ends past the end of '{}'", path_file_dwarfs);
+  }
+  // The offset of a mapping must be a multiple of the page size
+  uint64_t size_page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  uint64_t offset_map = offset - offset % size_page;
+  uint64_t size_map = size + offset - offset_map;
+  void* ptr = ::mmap(nullptr, size_map, PROT_READ, MAP_PRIVATE, fd, offset_map);
+  ::close(fd);
+  return_if(ptr == MAP_FAILED, Error("D::Could not map '{}': {}", path_file_dwarfs, strerror(errno)));
+  ::madvise(ptr, size_map, MADV_RANDOM);
+  char const* image = static_cast<char const*>(ptr) + (offset - offset_map);
+  // Walk the sections
+  auto f_walk = [&]() -> Value<uint64_t>
+  {
+    uint64_t count = 0;
+    for(uint64_t pos = 0; pos < size; ++count)
+    {
+      return_if(size - pos < sizeof(SectionHeader), Error("D::Truncated header of section {} at {}", count, pos));
+      SectionHeader header;
+      std::memcpy(&header, image + pos, sizeof(header));
+      return_if(not std::ranges::equal(header.magic, std::string_view("DWARFS"))
+        , Error("D::Missing magic of section {} at {}", count, pos)
+      );
+      return_if(header.major != 2, Error("D::Unsupported format version {} of section {}", header.major, count));
+      return_if(header.number != count, Error("D::Section {} is numbered {}", count, header.number));
+      pos += sizeof(header);
+      return_if(header.length > size - pos, Error("D::Section {} ends past the image", count));
+      pos += header.length;
+    }
+    return_if(count == 0, Error("D::Empty image"));
+    return count;
+  };
+  auto count = f_walk();
+  ::munmap(ptr, size_map);
+  return count;
+}
+
+/**
+ * @brief A range of bytes in a file
+ */
+struct Range
+{
+  uint64_t offset; ///< Offset in the file
+  uint64_t size;   ///< Size in bytes
+};
+
+/**
+ * @brief Finds the sections of a DwarFS image that dwarfs reads to mount it
+ *
+ * The last section of an image is the section index, the type and offset of every section, and
+ * its last entry points to the index itself. The metadata sections are written after the blocks,
+ * so the metadata is the tail of the image from the first metadata section. Only the index is
+ * read, the sections are not walked.
+ *
+ * @param fd The open binary or layer file
+ * @param offset Offset in the file at which the image starts
+ * @param size Size of the image
+ * @return Value<std::vector<Range>> The first block, if any, and the metadata tail, or the
+ * respective error
+ */
+[[nodiscard]] inline Value<std::vector<Range>> mount_ranges(int fd, uint64_t offset, uint64_t size)
+{
+  constexpr uint16_t type_block = 0;
+  constexpr uint16_t type_schema = 7;
+  constexpr uint16_t type_metadata = 8;
+  constexpr uint16_t type_index = 9;
+  // Each entry is the section type in the upper 16 bits and its offset in the image below it
+  auto f_type = [](uint64_t entry) { return static_cast<uint16_t>(entry >> 48); };
+  auto f_offset = [](uint64_t entry) { return entry & ((uint64_t{1} << 48) - 1); };
+  return_if(size < sizeof(SectionHeader) + sizeof(uint64_t), Error("D::Image too small for a section index"));
+  // The last entry is the index
+  uint64_t last{};
+  return_if(::pread(fd, &last, sizeof(last), offset + size - sizeof(last)) != sizeof(last)
+    , Error("D::Could not read the section index: {}", strerror(errno))
+  );
+  return_if(f_type(last) != type_index, Error("D::Image without a section index"));
+  uint64_t offset_index = f_offset(last);
+  return_if(offset_index > size - sizeof(SectionHeader) - sizeof(uint64_t), Error("D::Section index past the image"));
+  SectionHeader header;
+  return_if(::pread(fd, &header, sizeof(header), offset + offset_index) != sizeof(header)
+    , Error("D::Could not read the section index header: {}", strerror(errno))
+  );
+  return_if(not std::ranges::equal(header.magic, std::string_view("DWARFS"))
+      or header.type != type_index
+      or header.compression != 0
+      or header.length != size - offset_index - sizeof(header)
+      or header.length % sizeof(uint64_t) != 0
+    , Error("D::Invalid section index at {}", offset_index)
+  );
+  std::vector<uint64_t> entries(header.length / sizeof(uint64_t));
+  return_if(::pread(fd, entries.data(), header.length, offset + offset_index + sizeof(header)) != static_cast<ssize_t>(header.length)
+    , Error("D::Could not read the section index entries: {}", strerror(errno))
+  );
+  std::vector<Range> ranges;
+  // First block, up to the next section
+  if(entries.size() > 1 and f_type(entries[0]) == type_block and f_offset(entries[0]) < f_offset(entries[1]))
+  {
+    ranges.push_back(Range{offset + f_offset(entries[0]), f_offset(entries[1]) - f_offset(entries[0])});
+  }
+  // Metadata up to the end of the image, with the index
+  auto it = std::ranges::find_if(entries, [&](uint64_t e){ return f_type(e) == type_schema or f_type(e) == type_metadata; });
+  uint64_t offset_metadata = std::min((it != entries.end())? f_offset(*it) : offset_index, offset_index);
+  ranges.push_back(Range{offset + offset_metadata, size - offset_metadata});
+  return ranges;
+}
+
 } // namespace ns_filesystems::ns_dwarfs
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
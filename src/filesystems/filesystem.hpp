@@ -41,6 +41,7 @@ class Filesystem
   public:
     virtual ~Filesystem();
     [[nodiscard]] virtual Value<void> mount() = 0;
+    [[nodiscard]] ns_subprocess::Child const* child() const;
     Filesystem(Filesystem&&) = default;
     Filesystem(Filesystem const&) = delete;
     Filesystem& operator=(Filesystem&&) = default;
@@ -65,6 +66,16 @@ inline Filesystem::Filesystem(pid_t pid_to_die_for
 {
 }
 
+/**
+ * @brief The fuse process that serves the filesystem
+ *
+ * @return ns_subprocess::Child const* The process, or nullptr if it was not spawned
+ */
+inline ns_subprocess::Child const* Filesystem::child() const
+{
+  return m_child.get();
+}
+
 /**
  * @brief Destroy the Filesystem:: Filesystem object, it
  * un-mounts the filesystem and sends a termination signal
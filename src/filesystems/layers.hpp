@@ -9,17 +9,34 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <vector>
 #include <ranges>
 #include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include <format>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../std/expected.hpp"
 #include "../std/filesystem.hpp"
 #include "../lib/env.hpp"
+#include "../lib/sha256.hpp"
 #include "../macro.hpp"
+#include "../db/db.hpp"
 #include "dwarfs.hpp"
+#include "remote.hpp"
 
 namespace ns_filesystems::ns_layers
 {
@@ -29,6 +46,88 @@ namespace
 
 namespace fs = std::filesystem;
 
+/**
+ * @brief Creates a key that identifies the current state of a binary or layer file
+ *
+ * The key changes whenever the file is replaced or modified, e.g., by 'fim-layer add'.
+ *
+ * @param path_file_binary Path to the binary or layer file
+ * @param offset Offset in bytes where the layer scan begins, zero for layer files
+ * @return Value<std::string> The key on success, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> index_key(fs::path const& path_file_binary, uint64_t offset)
+{
+  struct stat st{};
+  return_if(::stat(path_file_binary.c_str(), &st) != 0
+    , Error("D::Could not stat '{}': {}", path_file_binary, strerror(errno))
+  );
+  return std::format("{}:{}:{}:{}.{}:{}"
+    , st.st_dev
+    , st.st_ino
+    , st.st_size
+    , st.st_mtim.tv_sec
+    , st.st_mtim.tv_nsec
+    , offset
+  );
+}
+
+/**
+ * @brief Normalizes the path of a layer file to look it up in the lazy layers of the index
+ *
+ * @param path_file_layer Path to the layer file
+ * @return fs::path The absolute and normalized path
+ */
+[[nodiscard]] inline fs::path lazy_path(fs::path const& path_file_layer)
+{
+  std::error_code ec;
+  fs::path path_file_absolute = fs::absolute(path_file_layer, ec);
+  return (ec? path_file_layer : path_file_absolute).lexically_normal();
+}
+
+}
+
+/**
+ * @brief Computes a fingerprint that tells apart distinct layers
+ *
+ * The fingerprint is "<size>-<hash>", the SHA-256 hash of the size and of five sampled blocks
+ * spread over the layer, so it costs a few reads on boot whatever the size of the layer. Layers
+ * with distinct fingerprints are distinct, layers with the same fingerprint are possible copies
+ * that Layers::resolve_copies() compares by the hash of their whole contents.
+ *
+ * @param fd The open binary or layer file
+ * @param offset Offset in bytes where the layer begins
+ * @param size Size in bytes of the layer
+ * @return std::string The fingerprint, or empty if the layer could not be read
+ */
+[[nodiscard]] inline std::string fingerprint(int fd, uint64_t offset, uint64_t size)
+{
+  constexpr uint64_t size_block = 4096;
+  ns_sha256::Sha256 hash;
+  hash.update(std::string_view(reinterpret_cast<char const*>(&size), sizeof(size)));
+  std::array<char,size_block> block;
+  uint64_t offset_last = size > size_block? size - size_block : 0;
+  for(uint64_t offset_block : {uint64_t{0}, offset_last / 4, offset_last / 2, offset_last / 4 * 3, offset_last})
+  {
+    uint64_t size_read = std::min(size_block, size);
+    return_if(::pread(fd, block.data(), size_read, offset + offset_block) != static_cast<ssize_t>(size_read), std::string{});
+    hash.update(std::string_view(block.data(), size_read));
+  }
+  return std::format("{:x}-{}", size, hash.hex());
+}
+
+/**
+ * @brief Checks that a fingerprint of the layer index was created by fingerprint()
+ *
+ * Indexes of older versions hold fingerprints of other formats, so their entries are computed
+ * again.
+ *
+ * @param str_fingerprint The fingerprint, empty if unknown
+ * @return bool Whether the fingerprint is empty or has the format of fingerprint()
+ */
+[[nodiscard]] inline bool is_fingerprint(std::string_view str_fingerprint)
+{
+  auto pos = str_fingerprint.find('-');
+  return str_fingerprint.empty() or (pos != std::string_view::npos and str_fingerprint.size() - pos - 1 == 64);
 }
 
 /**
@@ -42,17 +141,34 @@ namespace fs = std::filesystem;
  * **Directory Scanning:**
  * - Non-recursive (only scans direct children)
  * - Alphabetical order within each directory
- * - Validates files as DwarFS filesystems
+ * - Validates files as DwarFS filesystems, in parallel and cached in the layer index
  *
  * **File Processing:**
  * - Direct file paths are validated and added immediately
  * - Invalid files are skipped with a warning
  *
+ * **Fingerprints:**
+ * - Each layer carries a fingerprint of its size and sampled blocks, stored in the layer index
+ * - resolve_copies() replaces the fingerprints that collide with the SHA-256 hash of the layers,
+ *   after it layers with the same fingerprint are copies, e.g., an embedded layer also given in
+ *   FIM_LAYERS
+ *
+ * **Lazy Layers:**
+ * - Layer files marked as lazy in the layer index, with 'fim-layer lazy', are optional
+ * - The controller leaves out a lazy layer none of whose files were read in the last recording
+ *
+ * **Remote Layers:**
+ * - http and https URLs are downloaded once to the remote cache, see ns_remote, once enabled
+ *   with set_remote()
+ * - The local copy is validated, indexed and traced as any other layer file
+ *
  * @example
  * @code
  * Layers layers;
  * layers.push_from_var("FIM_LAYERS");  // Process FIM_LAYERS env var
  * layers.push("/path/to/layers");       // Add directory or file
+ * layers.set_remote("/path/to/wget", "/home/user/.cache/flatimage/remote");
+ * layers.push("https://example.com/app.layer"); // Download and add a layer
  * auto const& paths = layers.get_layers();  // Retrieve all layer paths
  * @endcode
  */
@@ -64,68 +180,103 @@ class Layers
       fs::path const path;
       uint64_t offset;
       uint64_t size;
+      std::string fingerprint; ///< Identifies the contents, empty if unknown
     };
     std::vector<Layer> layers;  ///< Collection of validated layer file paths with offsets
+    std::set<fs::path> lazy;    ///< Normalized paths of the layer files marked as lazy
+    std::optional<ns_remote::Remote> remote; ///< Downloads the layers given by URL
 
     /**
-     * @brief Validates and appends a single layer file
+     * @brief Collects the candidate layer files of a path
      *
-     * Checks if the file is a valid DwarFS filesystem by examining magic bytes.
-     * Invalid files are skipped with a warning.
+     * Performs non-recursive directory scanning to collect regular files, sorted
+     * lexicographically. A regular file is collected as is, and a URL is collected as its
+     * local copy in the remote cache.
      *
-     * @param path Path to the layer file to validate and add
+     * @param path Path to a layer file, a directory of layer files or the URL of a layer file
+     * @param candidates Where to append the candidate files, in mount order
+     * @return Value<void> Success or error
      */
-    [[nodiscard]] Value<void> append_file(fs::path const& path)
+    [[nodiscard]] Value<void> collect(fs::path const& path, std::vector<fs::path>& candidates) const
     {
-      return_if(not ns_dwarfs::is_dwarfs(path), Error("W::Skipping invalid dwarfs filesystem '{}'", path));
-      layers.push_back({path, 0, std::filesystem::file_size(path)});
+      if(ns_remote::is_url(path.string()))
+      {
+        return_if(not remote, Error("E::Remote layers are not enabled for '{}'", path));
+        candidates.push_back(Pop(remote->fetch(path.string())));
+      }
+      else if(Try(fs::is_regular_file(path)))
+      {
+        candidates.push_back(path);
+      }
+      else if(Try(fs::is_directory(path)))
+      {
+        // Get all regular files from the directory
+        auto result = Pop(ns_fs::regular_files(path));
+        // Sort layers files
+        std::ranges::sort(result);
+        std::ranges::move(result, std::back_inserter(candidates));
+      }
       return {};
     }
 
     /**
-     * @brief Scans a directory for layer files and appends them
+     * @brief Validates and appends candidate layer files
      *
-     * Performs non-recursive directory scanning to collect regular files.
-     * Sorts files lexicographically
-     * Each file is validated via append_file() before being added.
+     * Invalid files are skipped with a warning, the order of the valid ones is kept.
      *
-     * @param path Path to directory to scan
+     * @param candidates The candidate layer files, in mount order
+     * @param path_file_index Path to the layer index file, empty to validate every file
      */
-    [[nodiscard]] Value<void> append_directory(fs::path const& path)
+    void append_files(std::vector<fs::path> const& candidates, fs::path const& path_file_index)
     {
-      // Get all regular files from the directory
-      auto result = Pop(ns_fs::regular_files(path));
-      // Sort layers files
-      std::ranges::sort(result);
-      // Process each file
-      for(auto&& file : result)
+      ns_db::Db db = path_file_index.empty()?
+          ns_db::Db{}
+        : ns_db::read_file(path_file_index).value_or(ns_db::Db{});
+      if(db.contains("lazy"))
       {
-        append_file(file).discard("W::Failed to append layer from directory");
+        std::ranges::copy(db("lazy").value<std::vector<std::string>>().or_default(), std::inserter(lazy, lazy.end()));
+      }
+      std::vector<std::string> fingerprints;
+      auto valid = validate(candidates, db, path_file_index, fingerprints);
+      for(auto&& [path, is_valid, str_fingerprint] : std::views::zip(candidates, valid, fingerprints))
+      {
+        continue_if(not is_valid, "W::Skipping invalid dwarfs filesystem '{}'", path);
+        std::error_code ec;
+        uint64_t size = fs::file_size(path, ec);
+        continue_if(ec, "W::Could not get size of layer '{}': {}", path, ec.message());
+        layers.push_back({path, 0, size, str_fingerprint});
       }
-      return {};
     }
 
   public:
+    /**
+     * @brief Enables layers given by URL in push() and push_from_var()
+     *
+     * @param path_file_downloader Path to the downloader executable, e.g., wget
+     * @param path_dir_cache Directory of the downloaded layers
+     */
+    void set_remote(fs::path const& path_file_downloader, fs::path const& path_dir_cache)
+    {
+      remote = ns_remote::Remote{.path_file_downloader = path_file_downloader, .path_dir_cache = path_dir_cache};
+    }
+
     /**
      * @brief Adds a layer from a file or directory path
      *
      * Automatically detects whether the path is a file or directory and processes accordingly:
      * - **File:** Validates and adds directly
      * - **Directory:** Scans for layer files and adds them alphabetically
+     * - **URL:** Downloads the layer to the remote cache and adds it, see set_remote()
      *
-     * @param path Filesystem path (file or directory)
+     * @param path Filesystem path (file or directory) or URL
+     * @param path_file_index Path to the layer index file, empty to validate every file
      * @return Value<void> Success or error
      */
-    [[nodiscard]] Value<void> push(fs::path const& path)
+    [[nodiscard]] Value<void> push(fs::path const& path, fs::path const& path_file_index = {})
     {
-      if(Try(fs::is_regular_file(path)))
-      {
-        append_file(path).discard("W::Failed to append layer from regular file");
-      }
-      else if(Try(fs::is_directory(path)))
-      {
-        append_directory(path).discard("W::Failed to append layer from directory");
-      }
+      std::vector<fs::path> candidates;
+      collect(path, candidates).discard("W::Failed to append layer from '{}'", path);
+      append_files(candidates, path_file_index);
       return {};
     }
 
@@ -139,27 +290,45 @@ class Layers
      * **Processing Steps:**
      * 1. Retrieves environment variable value
      * 2. Performs word expansion (variables, subshells)
-     * 3. Splits on ':' delimiter
-     * 4. Processes each path via push()
+     * 3. Splits on ':' delimiter, except after the scheme of a URL
+     * 4. Collects the layer files of each path, as push() does
+     * 5. Validates all the collected files at once
+     *
+     * When an index file is given, files whose device, inode, size and modification time match
+     * the ones stored in it are not read again. The order is the same as calling push() for
+     * each path.
      *
      * @param var Name of environment variable to read (e.g., "FIM_LAYERS")
+     * @param path_file_index Path to the layer index file, empty to validate every file
      * @return Value<void> Success or error
      */
-    [[nodiscard]] Value<void> push_from_var(std::string_view var)
+    [[nodiscard]] Value<void> push_from_var(std::string_view var, fs::path const& path_file_index = {})
     {
-      for(fs::path const& path : ns_env::get_expected<"Q">(var)
+      std::vector<fs::path> candidates;
+      std::vector<std::string> sources;
+      for(std::string source : ns_env::get_expected<"Q">(var)
         // Perform word expansions (variables, run subshells...)
         .transform([](auto&& e){ return ns_env::expand(e).value_or(std::string{e}); })
         // Get value or default to empty
         .value_or(std::string{})
         // Split values variable on ':'
         | std::views::split(':')
-        // Create a path
-        | std::views::transform([](auto&& e){ return fs::path(e.begin(), e.end()); })
+        | std::views::transform([](auto&& e){ return std::string(e.begin(), e.end()); })
       )
       {
-        Pop(push(path));
+        // Join the scheme of a URL with the rest of it, e.g., 'https' and '//host/file.layer'
+        if(not sources.empty() and (sources.back() == "http" or sources.back() == "https") and source.starts_with("//"))
+        {
+          sources.back() += ":" + source;
+          continue;
+        }
+        sources.push_back(std::move(source));
+      }
+      for(fs::path const& path : sources)
+      {
+        collect(path, candidates).discard("W::Failed to append layer from '{}'", path);
       }
+      append_files(candidates, path_file_index);
       return {};
     }
 
@@ -176,6 +345,68 @@ class Layers
       return layers;
     }
 
+    /**
+     * @brief Tells the copies of a layer apart from layers that only share its fingerprint
+     *
+     * Only the layers whose fingerprint collides with the one of another layer are hashed, their
+     * fingerprint is replaced by the SHA-256 hash of their contents. The hashes are kept in the
+     * 'hashes' entry of the index, keyed by the offset, size and fingerprint of embedded layers
+     * and by the identity of layer files, so neither configuration writes to the binary nor a
+     * copy of it hash them again.
+     *
+     * @param path_file_binary Path to the binary the embedded layers are in
+     * @param path_file_index Path to the layer index file, empty to not store the hashes
+     */
+    void resolve_copies(fs::path const& path_file_binary, fs::path const& path_file_index = {})
+    {
+      std::map<std::string,size_t> map_count;
+      for(auto const& layer : layers)
+      {
+        if(not layer.fingerprint.empty()) { map_count[layer.fingerprint] += 1; }
+      }
+      ns_db::Db db_index = path_file_index.empty()?
+          ns_db::Db{}
+        : ns_db::read_file(path_file_index).value_or(ns_db::Db{});
+      std::map<std::string,std::string> map_hashed;
+      for(auto& layer : layers)
+      {
+        continue_if(layer.fingerprint.empty() or map_count[layer.fingerprint] < 2);
+        std::string key = (layer.path == path_file_binary)?
+            std::format("{}:{}:{}", layer.offset, layer.size, layer.fingerprint)
+          : index_key(layer.path, layer.offset).value_or(std::string{});
+        std::string hash = key.empty()? std::string{} : db_index("hashes")(key).value<std::string>().value_or("");
+        if(hash.empty())
+        {
+          logger("D::Layer '{}' at offset {} has the fingerprint of another layer, hashing it", layer.path.filename(), layer.offset);
+          int fd = ::open(layer.path.c_str(), O_RDONLY | O_CLOEXEC);
+          continue_if(fd < 0, "E::Could not open layer '{}': {}", layer.path, strerror(errno));
+          ::posix_fadvise(fd, layer.offset, layer.size, POSIX_FADV_SEQUENTIAL);
+          hash = ns_sha256::sha256(fd, layer.offset, layer.size).value_or(std::string{});
+          ::close(fd);
+          // Without the hash the layer is mounted, as one of a distinct fingerprint
+          if(hash.empty()) { layer.fingerprint.clear(); continue; }
+          if(not key.empty()) { map_hashed[key] = hash; }
+        }
+        layer.fingerprint = hash;
+      }
+      return_if(path_file_index.empty() or map_hashed.empty(),);
+      update_index(path_file_index, [&](ns_db::Db& db)
+      {
+        for(auto const& [key, hash] : map_hashed) { db("hashes")(key) = hash; }
+      }).discard("W::Could not write layer hashes");
+    }
+
+    /**
+     * @brief Checks if a layer file is marked as lazy in the layer index
+     *
+     * @param path_file_layer Path to the layer file
+     * @return bool True if the layer is lazy, embedded layers never are
+     */
+    [[nodiscard]] bool is_lazy(fs::path const& path_file_layer) const
+    {
+      return lazy.contains(lazy_path(path_file_layer));
+    }
+
     /**
      * @brief Scans a binary file for embedded DwarFS filesystems
      *
@@ -188,24 +419,128 @@ class Layers
      * - N bytes: DwarFS filesystem data
      * - (repeats for additional filesystems)
      *
+     * When an index file is given, the layers are loaded from it if its key matches the
+     * device, inode, size and modification time of the binary. Otherwise the binary is
+     * scanned and the index is rewritten, so only the first boot after a change pays for it.
+     *
      * @param path_file_binary Path to the binary file to scan
      * @param offset Initial offset in bytes where scanning begins
-     * @return Value<void> Success or error
+     * @param path_file_index Path to the layer index file, empty to always scan
+     */
+    void push_binary(fs::path const& path_file_binary, uint64_t offset, fs::path const& path_file_index = {})
+    {
+      // Scan without an index
+      if(path_file_index.empty())
+      {
+        auto scanned = scan_binary(path_file_binary, offset);
+        std::ranges::copy(scanned, std::back_inserter(layers));
+        return;
+      }
+      // Try to use the stored index
+      auto key = index_key(path_file_binary, offset);
+      if(key)
+      {
+        if(auto indexed = read_index(path_file_binary, path_file_index, *key))
+        {
+          logger("D::Loaded {} layers from index '{}'", indexed->size(), path_file_index);
+          std::ranges::copy(*indexed, std::back_inserter(layers));
+          return;
+        }
+      }
+      // Scan the binary and refresh the index
+      auto scanned = scan_binary(path_file_binary, offset);
+      if(key)
+      {
+        write_index(path_file_index, *key, scanned).discard("W::Could not write layer index");
+      }
+      std::ranges::copy(scanned, std::back_inserter(layers));
+    }
+
+    /**
+     * @brief Updates the entries of the index file
+     *
+     * The index is written to a temporary file and renamed over the previous one. Entries not
+     * touched by the update function are preserved.
+     *
+     * @param path_file_index Path to the layer index file
+     * @param f_update Function that modifies the index
+     * @return Value<void> Nothing on success, or the respective error
+     */
+    [[nodiscard]] static Value<void> update_index(fs::path const& path_file_index
+      , std::function<void(ns_db::Db&)> const& f_update)
+    {
+      ns_db::Db db = ns_db::read_file(path_file_index).value_or(ns_db::Db{});
+      f_update(db);
+      fs::path path_file_tmp = path_file_index.string() + std::format(".{}", getpid());
+      Pop(ns_db::write_file(path_file_tmp, db));
+      Try(fs::rename(path_file_tmp, path_file_index));
+      return {};
+    }
+
+    /**
+     * @brief Scans a binary file and rewrites its entry in the index file
+     *
+     * Used after the layers of the binary are rewritten, so the next boot does not scan it.
+     *
+     * @param path_file_binary Path to the binary file to scan
+     * @param offset Initial offset in bytes where scanning begins
+     * @param path_file_index Path to the layer index file
+     * @return Value<void> Nothing on success, or the respective error
+     */
+    [[nodiscard]] static Value<void> reindex(fs::path const& path_file_binary
+      , uint64_t offset
+      , fs::path const& path_file_index)
+    {
+      std::string key = Pop(index_key(path_file_binary, offset));
+      return write_index(path_file_index, key, scan_binary(path_file_binary, offset));
+    }
+
+    /**
+     * @brief Marks a layer file as lazy or as mounted on every boot in the index file
+     *
+     * @param path_file_index Path to the layer index file
+     * @param path_file_layer Path to the layer file
+     * @param is_lazy Whether the layer is lazy
+     * @return Value<void> Nothing on success, or the respective error
+     */
+    [[nodiscard]] static Value<void> set_lazy(fs::path const& path_file_index
+      , fs::path const& path_file_layer
+      , bool is_lazy)
+    {
+      std::string str_path_file_layer = lazy_path(path_file_layer).string();
+      return update_index(path_file_index, [&](ns_db::Db& db)
+      {
+        std::vector<std::string> paths = db.contains("lazy")?
+            db("lazy").value<std::vector<std::string>>().or_default()
+          : std::vector<std::string>{};
+        std::erase(paths, str_path_file_layer);
+        if(is_lazy) { paths.push_back(str_path_file_layer); }
+        db("lazy") = paths;
+      });
+    }
+
+  private:
+    /**
+     * @brief Scans a binary file for embedded DwarFS filesystems
+     *
+     * @param path_file_binary Path to the binary file to scan
+     * @param offset Initial offset in bytes where scanning begins
+     * @return std::vector<Layer> The validated layers found in the binary
      */
-    void push_binary(fs::path const& path_file_binary, uint64_t offset)
+    static std::vector<Layer> scan_binary(fs::path const& path_file_binary, uint64_t offset)
     {
-      // Open the binary file
-      std::ifstream file_binary(path_file_binary, std::ios::binary);
+      std::vector<Layer> found;
 
-      // Advance to starting offset
-      file_binary.seekg(offset);
+      // Open the binary file, the headers, magic bytes and fingerprints are read from it with pread
+      int fd_binary = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+      return_if(fd_binary < 0, found, "E::Could not open binary '{}': {}", path_file_binary, strerror(errno));
 
       // Scan for filesystems concatenated in the binary
       while (true)
       {
         // Read filesystem size
         uint64_t size_fs;
-        break_if(not file_binary.read(reinterpret_cast<char*>(&size_fs), sizeof(size_fs))
+        break_if(::pread(fd_binary, &size_fs, sizeof(size_fs), offset) != sizeof(size_fs)
           , "D::Stopped reading at offset {}", offset
         );
         logger("D::Filesystem size is '{}'", size_fs);
@@ -214,17 +549,166 @@ class Layers
         // Skip size bytes to point to filesystem data
         offset += 8;
         // Check if filesystem is of type 'DWARFS'
-        break_if(not ns_dwarfs::is_dwarfs(path_file_binary, offset)
+        std::array<char,6> header{};
+        break_if(::pread(fd_binary, header.data(), header.size(), offset) != header.size()
+            or not std::ranges::equal(header, std::string_view("DWARFS"))
           , "E::Invalid dwarfs filesystem appended on the image"
         );
         // Store the filesystem with its offset
-        layers.push_back({path_file_binary, offset, size_fs});
+        found.push_back({path_file_binary, offset, size_fs, fingerprint(fd_binary, offset, size_fs)});
         // Move to next filesystem position
         offset += size_fs;
-        file_binary.seekg(offset);
       }
 
-      file_binary.close();
+      ::close(fd_binary);
+
+      return found;
+    }
+
+    /**
+     * @brief Reads the layers of a binary from the index file
+     *
+     * **Format:**
+     * - key: Identity of the binary as created by index_key()
+     * - layers: Array of "<offset>:<size>:<fingerprint>" entries of magic-verified filesystems
+     *
+     * @param path_file_binary Path to the binary file the layers belong to
+     * @param path_file_index Path to the layer index file
+     * @param key The expected key of the binary
+     * @return Value<std::vector<Layer>> The indexed layers, or an error if the index is stale
+     */
+    [[nodiscard]] static Value<std::vector<Layer>> read_index(fs::path const& path_file_binary
+      , fs::path const& path_file_index
+      , std::string const& key)
+    {
+      ns_db::Db db = Pop(ns_db::read_file(path_file_index));
+      return_if(Pop(db("key").value<std::string>()) != key, Error("D::Stale layer index"));
+      std::vector<Layer> found;
+      for(std::string const& entry : Pop(db("layers").value<std::vector<std::string>>()))
+      {
+        // Entries of older indexes have no fingerprint, they are rescanned
+        auto pos = entry.find(':');
+        auto pos_fingerprint = entry.find(':', pos == std::string::npos? pos : pos+1);
+        return_if(pos_fingerprint == std::string::npos, Error("D::Invalid layer index entry '{}'", entry));
+        uint64_t offset = Try(std::stoull(entry.substr(0, pos)));
+        uint64_t size = Try(std::stoull(entry.substr(pos+1, pos_fingerprint-pos-1)));
+        std::string str_fingerprint = entry.substr(pos_fingerprint+1);
+        return_if(not is_fingerprint(str_fingerprint), Error("D::Outdated fingerprint in layer index entry '{}'", entry));
+        found.push_back({path_file_binary, offset, size, std::move(str_fingerprint)});
+      }
+      return found;
+    }
+
+    /**
+     * @brief Writes the layers of a binary to the index file
+     *
+     * The index is written to a temporary file and renamed over the previous one, so concurrent
+     * instances never read a partially written index.
+     *
+     * @param path_file_index Path to the layer index file
+     * @param key The key of the binary as created by index_key()
+     * @param indexed The validated layers of the binary
+     * @return Value<void> Nothing on success, or the respective error
+     */
+    [[nodiscard]] static Value<void> write_index(fs::path const& path_file_index
+      , std::string const& key
+      , std::vector<Layer> const& indexed)
+    {
+      Pop(update_index(path_file_index, [&](ns_db::Db& db)
+      {
+        db("key") = key;
+        db("layers") = indexed
+          | std::views::transform([](auto&& e){ return std::format("{}:{}:{}", e.offset, e.size, e.fingerprint); })
+          | std::ranges::to<std::vector<std::string>>();
+      }));
+      logger("D::Wrote {} layers to index '{}'", indexed.size(), path_file_index);
+      return {};
+    }
+
+    /**
+     * @brief Checks which files are DwarFS filesystems
+     *
+     * Results are looked up in the 'files' entry of the index, keyed by path, and only valid if
+     * the stored device, inode, size and modification time match the file. The remaining files
+     * are checked in parallel by reading their magic bytes with pread, and the results are stored
+     * in the index for the next boot. Entries are "<key>:<fingerprint>:<valid>".
+     *
+     * @param candidates The files to check
+     * @param db The contents of the layer index, empty to check every file
+     * @param path_file_index Path to the layer index file, empty to not store the results
+     * @param fingerprints Where to store the fingerprint of each file, empty if it is not valid
+     * @return std::vector<char> For each file, whether it is a DwarFS filesystem
+     */
+    static std::vector<char> validate(std::vector<fs::path> const& candidates
+      , ns_db::Db& db
+      , fs::path const& path_file_index
+      , std::vector<std::string>& fingerprints)
+    {
+      std::vector<char> valid(candidates.size(), 0);
+      fingerprints.assign(candidates.size(), std::string{});
+      std::vector<std::string> keys(candidates.size());
+      std::vector<size_t> pending;
+      // Look up cached results
+      for(size_t i = 0; i < candidates.size(); ++i)
+      {
+        keys[i] = index_key(candidates[i], 0).value_or(std::string{});
+        auto cached = db("files")(candidates[i].string()).value<std::string>();
+        // Entries of older caches have no fingerprint or a sampled one, they are checked again
+        if(not keys[i].empty() and cached and cached->starts_with(keys[i] + ":")
+          and std::ranges::count(*cached, ':') == std::ranges::count(keys[i], ':') + 2)
+        {
+          std::string_view entry = std::string_view(*cached).substr(keys[i].size() + 1);
+          std::string_view str_fingerprint = entry.substr(0, entry.rfind(':'));
+          if(is_fingerprint(str_fingerprint))
+          {
+            valid[i] = entry.ends_with(":1");
+            fingerprints[i] = str_fingerprint;
+            continue;
+          }
+        }
+        pending.push_back(i);
+      }
+      logger("D::Layer files cached: {}, to check: {}", candidates.size() - pending.size(), pending.size());
+      return_if(pending.empty(), valid);
+      // Check the magic bytes in parallel
+      std::atomic<size_t> index{0};
+      auto f_worker = [&]
+      {
+        for(size_t j = index++; j < pending.size(); j = index++)
+        {
+          size_t i = pending[j];
+          int fd = ::open(candidates[i].c_str(), O_RDONLY | O_CLOEXEC);
+          continue_if(fd < 0, "E::Could not open file '{}': {}", candidates[i], strerror(errno));
+          std::array<char,6> header{};
+          valid[i] = ::pread(fd, header.data(), header.size(), 0) == header.size()
+            and std::ranges::equal(header, std::string_view("DWARFS"));
+          struct stat st{};
+          if(valid[i] and ::fstat(fd, &st) == 0)
+          {
+            fingerprints[i] = fingerprint(fd, 0, st.st_size);
+          }
+          ::close(fd);
+        }
+      };
+      {
+        size_t count_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+        std::vector<std::jthread> threads;
+        for(size_t i = 0; i < std::min(count_threads, pending.size()); ++i)
+        {
+          threads.emplace_back(f_worker);
+        }
+      }
+      // Store the results
+      return_if(path_file_index.empty(), valid);
+      update_index(path_file_index, [&](ns_db::Db& db)
+      {
+        for(size_t i : pending)
+        {
+          continue_if(keys[i].empty());
+          db("files")(candidates[i].string()) = std::format("{}:{}:{}", keys[i], fingerprints[i], valid[i]? 1 : 0);
+        }
+      }).discard("W::Could not write layer file cache");
+      return valid;
     }
 };
 
@@ -0,0 +1,445 @@
+/**
+ * @file remote.hpp
+ * @author Ruan Formigoni
+ * @brief Layers downloaded from a web server into a local cache
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../std/filesystem.hpp"
+#include "../lib/env.hpp"
+#include "../lib/sha256.hpp"
+#include "../lib/subprocess.hpp"
+#include "../db/db.hpp"
+#include "../db/perf.hpp"
+#include "../macro.hpp"
+#include "dwarfs.hpp"
+
+/**
+ * @namespace ns_filesystems::ns_remote
+ * @brief Layers given by URL, e.g., 'https://example.com/firefox.layer'
+ *
+ * A remote layer is downloaded once into the cache directory and mounted from there like any
+ * other layer file, the following boots do not contact the server. The cache directory is
+ * private to the user and each layer is named after the SHA-256 hash of its URL, '<key>'. The
+ * layer is fetched in chunks of CHUNK bytes with HTTP range requests, DOWNLOADS at a time, into
+ * '<key>.part', and '<key>.done' holds one byte per chunk that is set once the chunk is written,
+ * so an interrupted download resumes with the missing chunks. The complete layer is renamed to
+ * '<key>.layer'.
+ *
+ * '<key>.json' records the URL, the size and the ETag or Last-Modified header of the layer, a
+ * download only resumes while the server reports the same ones. Once the layer is complete it
+ * also records its SHA-256 hash and the identity of the file, its device, inode, size and change
+ * time. A cached layer is only reused if its identity matches, or if its hash matches when the
+ * file was touched, otherwise it is downloaded again.
+ *
+ * The cache is capped by FIM_REMOTE_CACHE, the least recently used layers are removed once
+ * their total size exceeds it. Instances that have a removed layer mounted keep reading it.
+ */
+namespace ns_filesystems::ns_remote
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Size of the range requests
+constexpr uint64_t const CHUNK = 8 << 20;
+// Number of parallel range requests
+constexpr size_t const DOWNLOADS = 4;
+// Size of the cache when FIM_REMOTE_CACHE is not set
+constexpr std::string_view const SIZE_CACHE_DEFAULT = "8g";
+
+/**
+ * @brief What the headers of the server tell about a remote file
+ */
+struct Head
+{
+  uint64_t size;         ///< Content-Length
+  std::string validator; ///< ETag, or Last-Modified without an ETag, empty if the server sent none
+};
+
+/**
+ * @brief Gets the size and validator of a remote file from the headers of the server
+ *
+ * @param path_file_downloader Path to the downloader executable, e.g., wget
+ * @param url URL of the file
+ * @return Value<Head> The size and validator, or the respective error
+ */
+[[nodiscard]] inline Value<Head> remote_head(fs::path const& path_file_downloader, std::string const& url)
+{
+  std::stringstream ss_stderr;
+  auto child = ns_subprocess::Subprocess(path_file_downloader)
+    .with_args("-S", "--spider", url)
+    .with_streams(ns_subprocess::stream::null(), ns_subprocess::stream::null(), ss_stderr)
+    .spawn();
+  return_if(not child, Error("E::Failed to spawn downloader for '{}'", url));
+  int code = Pop(child->wait());
+  return_if(code != 0, Error("E::Could not reach '{}', exit code {}", url, code));
+  // The last header wins, redirects print the headers of every response
+  std::optional<uint64_t> size;
+  std::string etag, last_modified;
+  auto f_value = [](std::string const& line, size_t pos, std::string_view name)
+  {
+    std::string value = line.substr(pos + name.size());
+    auto beg = value.find_first_not_of(" \t\r");
+    auto end = value.find_last_not_of(" \t\r");
+    return (beg == std::string::npos)? std::string{} : value.substr(beg, end - beg + 1);
+  };
+  for(std::string line; std::getline(ss_stderr, line);)
+  {
+    std::string lower = line
+      | std::views::transform([](unsigned char c){ return static_cast<char>(std::tolower(c)); })
+      | std::ranges::to<std::string>();
+    if(auto pos = lower.find("etag:"); pos != std::string::npos)
+    {
+      etag = f_value(line, pos, "etag:");
+      continue;
+    }
+    if(auto pos = lower.find("last-modified:"); pos != std::string::npos)
+    {
+      last_modified = f_value(line, pos, "last-modified:");
+      continue;
+    }
+    auto pos = lower.find("content-length:");
+    continue_if(pos == std::string::npos);
+    std::string str_size = f_value(lower, pos, "content-length:");
+    continue_if(str_size.empty() or not std::ranges::all_of(str_size, ::isdigit));
+    size = std::stoull(str_size);
+  }
+  return_if(not size, Error("E::The server did not send the size of '{}'", url));
+  return Head{ .size = *size, .validator = etag.empty()? last_modified : etag };
+}
+
+/**
+ * @brief Identifies a file by its device, inode, size and change time
+ *
+ * Writing to the file, changing its times or replacing it changes the identity.
+ *
+ * @param path_file The file
+ * @return std::string The identity, empty if the file could not be stat'ed
+ */
+[[nodiscard]] inline std::string identity(fs::path const& path_file)
+{
+  struct stat st{};
+  return_if(::lstat(path_file.c_str(), &st) < 0 or not S_ISREG(st.st_mode), std::string{});
+  return std::format("{}:{}:{}:{}.{}", st.st_dev, st.st_ino, st.st_size, st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+}
+
+/**
+ * @brief Writes the record of a cached layer
+ *
+ * @param path_file_record Path to '<key>.json'
+ * @param db The record
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_record(fs::path const& path_file_record, ns_db::Db& db)
+{
+  fs::path path_file_tmp = std::format("{}.tmp.{}", path_file_record.string(), getpid());
+  Pop(ns_db::write_file(path_file_tmp, db));
+  Try(fs::rename(path_file_tmp, path_file_record));
+  return {};
+}
+
+/**
+ * @brief Downloads a range of a remote file into a local file
+ *
+ * @param path_file_downloader Path to the downloader executable, e.g., wget
+ * @param url URL of the file
+ * @param fd The file to write to, at the same offset
+ * @param path_file_tmp Where to save the range while it is downloaded
+ * @param offset Offset of the range
+ * @param size Size of the range
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> fetch_range(fs::path const& path_file_downloader
+  , std::string const& url
+  , int fd
+  , fs::path const& path_file_tmp
+  , uint64_t offset
+  , uint64_t size)
+{
+  auto child = ns_subprocess::Subprocess(path_file_downloader)
+    .with_args("-q", "-O", path_file_tmp, "--header", std::format("Range: bytes={}-{}", offset, offset + size - 1), url)
+    .spawn();
+  return_if(not child, Error("E::Failed to spawn downloader for '{}'", url));
+  int code = Pop(child->wait());
+  // One byte more to detect a response larger than the range
+  std::vector<char> buffer(size + 1);
+  int fd_tmp = ::open(path_file_tmp.c_str(), O_RDONLY | O_CLOEXEC);
+  ssize_t bytes = (fd_tmp < 0)? -1 : ::pread(fd_tmp, buffer.data(), size + 1, 0);
+  if(fd_tmp >= 0) { ::close(fd_tmp); }
+  std::error_code ec;
+  fs::remove(path_file_tmp, ec);
+  return_if(code != 0, Error("E::Failed to download range {} of '{}', exit code {}", offset, url, code));
+  // A server without range requests sends the whole file
+  return_if(bytes != static_cast<ssize_t>(size)
+    , Error("E::The server sent {} bytes for range {} of '{}', expected {}", bytes, offset, url, size)
+  );
+  return_if(::pwrite(fd, buffer.data(), size, offset) != static_cast<ssize_t>(size)
+    , Error("E::Could not write range {} of '{}': {}", offset, url, strerror(errno))
+  );
+  return {};
+}
+
+/**
+ * @brief Removes the least recently used layers until the cache fits its size
+ *
+ * @param path_dir_cache The cache directory
+ * @param size_cache The maximum size of the cached layers
+ * @param path_file_keep A layer that is never removed, i.e., the one that is being used
+ */
+inline void evict(fs::path const& path_dir_cache, uint64_t size_cache, fs::path const& path_file_keep)
+{
+  struct Entry
+  {
+    fs::path path;
+    uint64_t size;
+    int64_t time;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  for(fs::path const& path : ns_fs::regular_files(path_dir_cache).value_or(std::vector<fs::path>{}))
+  {
+    continue_if(path.extension() != ".layer" or path == path_file_keep);
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    continue_if(ec);
+    fs::path path_file_record = fs::path(path).replace_extension(".json");
+    ns_db::Db db = ns_db::read_file(path_file_record).value_or(ns_db::Db{});
+    entries.push_back({path, size, db("used").value<int64_t>().value_or(0)});
+    total += size;
+  }
+  std::error_code ec;
+  total += fs::file_size(path_file_keep, ec);
+  std::ranges::sort(entries, {}, &Entry::time);
+  for(Entry const& entry : entries)
+  {
+    break_if(total <= size_cache);
+    std::error_code ec;
+    continue_if(not fs::remove(entry.path, ec), "W::Could not remove remote layer '{}'", entry.path);
+    fs::remove(fs::path(entry.path).replace_extension(".json"), ec);
+    logger("D::Removed least recently used remote layer '{}'", entry.path);
+    total -= entry.size;
+  }
+}
+
+} // namespace
+
+/**
+ * @brief Checks whether a layer source is a URL
+ *
+ * @param source The layer source, a path or a URL
+ * @return bool True for http and https URLs
+ */
+[[nodiscard]] inline bool is_url(std::string_view source)
+{
+  return source.starts_with("http://") or source.starts_with("https://");
+}
+
+/**
+ * @brief Downloads remote layers into a local cache
+ */
+struct Remote
+{
+  fs::path path_file_downloader; ///< Path to the downloader executable, e.g., wget
+  fs::path path_dir_cache;       ///< Directory of the cached layers, created private to the user
+
+  /**
+   * @brief Gets the local copy of a remote layer, downloading the chunks it misses
+   *
+   * @param url URL of the layer
+   * @return Value<fs::path> Path to the local copy of the layer, or the respective error
+   */
+  [[nodiscard]] Value<fs::path> fetch(std::string const& url) const
+  {
+    std::string key = ns_sha256::sha256(url);
+    fs::path path_file_layer = path_dir_cache / (key + ".layer");
+    Pop(ns_fs::create_private_directory(path_dir_cache));
+    // Another instance could be downloading the same layer
+    int fd_lock = ::open((path_dir_cache / (key + ".lock")).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    return_if(fd_lock < 0, Error("E::Could not open the lock of '{}': {}", url, strerror(errno)));
+    ::flock(fd_lock, LOCK_EX);
+    auto result = fetch_locked(url, key, path_file_layer);
+    if(result)
+    {
+      // The time of the last use orders the layers for eviction, the layer file is not touched
+      fs::path path_file_record = path_dir_cache / (key + ".json");
+      ns_db::Db db = ns_db::read_file(path_file_record).value_or(ns_db::Db{});
+      db("used") = std::chrono::system_clock::now().time_since_epoch().count();
+      write_record(path_file_record, db).discard("W::Could not update the record of '{}'", url);
+    }
+    ::close(fd_lock);
+    if(result)
+    {
+      auto str_size = ns_env::get_expected<"Q">("FIM_REMOTE_CACHE").value_or(std::string{SIZE_CACHE_DEFAULT});
+      auto size_cache = ns_db::ns_perf::size_from_string(str_size);
+      if(size_cache) { evict(path_dir_cache, *size_cache, path_file_layer); }
+      else { logger("W::Ignoring FIM_REMOTE_CACHE: {}", size_cache.error()); }
+    }
+    return result;
+  }
+
+  private:
+    /**
+     * @brief Downloads a remote layer, the caller holds the lock of the layer
+     *
+     * @param url URL of the layer
+     * @param key Name of the layer in the cache
+     * @param path_file_layer Where to place the complete layer
+     * @return Value<fs::path> Path to the local copy of the layer, or the respective error
+     */
+    [[nodiscard]] Value<fs::path> fetch_locked(std::string const& url
+      , std::string const& key
+      , fs::path const& path_file_layer) const
+    {
+      fs::path path_file_part = path_dir_cache / (key + ".part");
+      fs::path path_file_done = path_dir_cache / (key + ".done");
+      fs::path path_file_record = path_dir_cache / (key + ".json");
+      ns_db::Db db = ns_db::read_file(path_file_record).value_or(ns_db::Db{});
+      std::error_code ec;
+      // Reuse the cached layer only if it is the one that was downloaded and checked
+      if(Try(fs::exists(path_file_layer)))
+      {
+        std::string str_identity = identity(path_file_layer);
+        std::string str_sha256 = db("sha256").value<std::string>().value_or("");
+        bool is_same_source = db("url").value<std::string>().value_or("") == url
+          and db("size").value<uint64_t>().value_or(0) == fs::file_size(path_file_layer, ec)
+          and not str_sha256.empty()
+          and not str_identity.empty();
+        return_if(is_same_source and db("identity").value<std::string>().value_or("") == str_identity, path_file_layer);
+        // The file was touched, check its contents again
+        if(is_same_source)
+        {
+          int fd_layer = ::open(path_file_layer.c_str(), O_RDONLY | O_CLOEXEC);
+          auto hash = (fd_layer < 0)?
+              Value<std::string>(Error("E::Could not open '{}': {}", path_file_layer, strerror(errno)))
+            : ns_sha256::sha256(fd_layer, 0, fs::file_size(path_file_layer, ec));
+          if(fd_layer >= 0) { ::close(fd_layer); }
+          if(hash and *hash == str_sha256)
+          {
+            db("identity") = str_identity;
+            write_record(path_file_record, db).discard("W::Could not update the record of '{}'", url);
+            return path_file_layer;
+          }
+        }
+        logger("W::Cached remote layer '{}' does not match its record, downloading it again", url);
+        fs::remove(path_file_layer, ec);
+        db.clear();
+      }
+      Head head = Pop(remote_head(path_file_downloader, url));
+      uint64_t size = head.size;
+      // Chunks of another version of the layer are discarded
+      bool is_same_version = db("url").value<std::string>().value_or("") == url
+        and db("size").value<uint64_t>().value_or(0) == size
+        and not head.validator.empty()
+        and db("validator").value<std::string>().value_or("") == head.validator;
+      if(not is_same_version)
+      {
+        db.clear();
+        db("url") = url;
+        db("size") = size;
+        db("validator") = head.validator;
+        Pop(write_record(path_file_record, db), "E::Could not write the record of '{}'", url);
+      }
+      uint64_t count = (size + CHUNK - 1) / CHUNK;
+      // Chunks that were downloaded before, discarded if the size of the layer changed
+      std::vector<char> done(count, 0);
+      int fd_done = ::open(path_file_done.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      return_if(fd_done < 0, Error("E::Could not open '{}': {}", path_file_done, strerror(errno)));
+      if(not is_same_version or fs::file_size(path_file_done, ec) != count or fs::file_size(path_file_part, ec) != size
+        or ::pread(fd_done, done.data(), count, 0) != static_cast<ssize_t>(count))
+      {
+        std::ranges::fill(done, 0);
+        log_if(::ftruncate(fd_done, 0) < 0 or ::pwrite(fd_done, done.data(), count, 0) != static_cast<ssize_t>(count)
+          , "W::Could not reset '{}': {}", path_file_done, strerror(errno)
+        );
+      }
+      int fd_part = ::open(path_file_part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      if(fd_part < 0 or ::ftruncate(fd_part, size) < 0)
+      {
+        int err = errno;
+        if(fd_part >= 0) { ::close(fd_part); }
+        ::close(fd_done);
+        return Error("E::Could not create '{}': {}", path_file_part, strerror(err));
+      }
+      std::vector<uint64_t> pending;
+      for(uint64_t i = 0; i < count; ++i) { if(not done[i]) { pending.push_back(i); } }
+      logger("I::Downloading {} of {} chunks of remote layer '{}'", pending.size(), count, url);
+      std::vector<std::string> errors(pending.size());
+      std::atomic<size_t> index{0};
+      auto f_worker = [&, level = ns_log::get_level()]
+      {
+        ns_log::set_level(level);
+        for(size_t i = index++; i < pending.size(); i = index++)
+        {
+          uint64_t chunk = pending[i];
+          uint64_t offset = chunk * CHUNK;
+          auto fetched = fetch_range(path_file_downloader
+            , url
+            , fd_part
+            , path_dir_cache / std::format("{}.{}", key, chunk)
+            , offset
+            , std::min(CHUNK, size - offset)
+          );
+          if(not fetched) { errors[i] = fetched.error(); continue; }
+          char byte = 1;
+          log_if(::pwrite(fd_done, &byte, 1, chunk) != 1, "W::Could not record chunk {} of '{}'", chunk, url);
+        }
+      };
+      {
+        std::vector<std::jthread> threads;
+        for(size_t i = 0; i < std::min(DOWNLOADS, pending.size()); ++i) { threads.emplace_back(f_worker); }
+      }
+      ::close(fd_done);
+      int err_sync = (::fsync(fd_part) < 0)? errno : 0;
+      auto it_error = std::ranges::find_if(errors, [](auto const& e){ return not e.empty(); });
+      auto hash = (it_error == errors.end() and err_sync == 0)? ns_sha256::sha256(fd_part, 0, size) : Value<std::string>("");
+      ::close(fd_part);
+      return_if(it_error != errors.end(), Error("E::Could not download remote layer '{}': {}", url, *it_error));
+      return_if(err_sync != 0, Error("E::Could not sync '{}': {}", path_file_part, strerror(err_sync)));
+      return_if(not hash, Error("E::Could not hash remote layer '{}': {}", url, hash.error()));
+      if(not ns_dwarfs::is_dwarfs(path_file_part))
+      {
+        fs::remove(path_file_part, ec);
+        fs::remove(path_file_done, ec);
+        return Error("E::Remote layer '{}' is not a dwarfs filesystem", url);
+      }
+      Try(fs::rename(path_file_part, path_file_layer));
+      fs::remove(path_file_done, ec);
+      // The identity is taken after the rename, which changes the change time
+      db("sha256") = *hash;
+      db("identity") = identity(path_file_layer);
+      Pop(write_record(path_file_record, db), "E::Could not write the record of '{}'", url);
+      logger("D::Downloaded remote layer '{}' to '{}', sha256 {}", url, path_file_layer, *hash);
+      return path_file_layer;
+    }
+};
+
+} // namespace ns_filesystems::ns_remote
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,267 @@
+/**
+ * @file share.hpp
+ * @author Ruan Formigoni
+ * @brief Reference counted read-only mounts shared between instances
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../lib/fuse.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_filesystems::ns_share
+ * @brief Read-only layer mounts shared between instances of the same application
+ *
+ * A shared mount lives in a directory under the application directory, identified by a key that
+ * changes with the contents of the layer. Each shared mount has two lock files next to it:
+ *
+ * - '<key>.lock': Exclusive lock held while an instance mounts or un-mounts the filesystem
+ * - '<key>.ref': Shared lock held by every instance that uses the filesystem
+ *
+ * The last instance to release the mount (the one that can take an exclusive lock on the
+ * reference file) un-mounts it. Locks are released by the kernel when a process dies, so a
+ * crashed instance never keeps a mount alive, the janitor un-mounts it on its behalf.
+ */
+namespace ns_filesystems::ns_share
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Opens a lock file and acquires a lock on it
+ *
+ * @param path_file_lock Path to the lock file, it is created if it does not exist
+ * @param operation The flock operation
+ * @return Value<int> The file descriptor that holds the lock, or the respective error
+ */
+[[nodiscard]] inline Value<int> lock(fs::path const& path_file_lock, int operation)
+{
+  // Close on exec so spawned processes do not hold the lock
+  int fd = ::open(path_file_lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  return_if(fd < 0, Error("E::Could not open lock file '{}': {}", path_file_lock, strerror(errno)));
+  if(::flock(fd, operation) < 0)
+  {
+    int err = errno;
+    ::close(fd);
+    return Error("D::Could not lock '{}': {}", path_file_lock, strerror(err));
+  }
+  return fd;
+}
+
+/**
+ * @brief Un-mounts a shared mount if no instance holds a reference to it
+ *
+ * Must be called with the exclusive mount lock held.
+ *
+ * @param path_dir_mount Path to the shared mountpoint
+ */
+inline void unmount_if_unused(fs::path const& path_dir_mount)
+{
+  auto fd_ref = lock(path_dir_mount.string() + ".ref", LOCK_EX | LOCK_NB);
+  return_if(not fd_ref,, "D::Shared mount '{}' is still in use", path_dir_mount);
+  logger("D::Un-mount unused shared mount '{}'", path_dir_mount);
+  ns_fuse::unmount(path_dir_mount).discard("E::Could not un-mount shared mount '{}'", path_dir_mount);
+  ::close(*fd_ref);
+}
+
+} // namespace
+
+/**
+ * @class Share
+ * @brief A reference to a shared read-only mount
+ *
+ * While the object is alive the filesystem stays mounted, destroying the last reference on the
+ * system un-mounts it.
+ */
+class Share
+{
+  private:
+    fs::path m_path_dir_mount;
+    int m_fd_guard;
+    int m_fd_ref;
+    bool m_is_mounted;
+
+    Share(fs::path const& path_dir_mount, int fd_guard, int fd_ref, bool is_mounted);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Share>> acquire(fs::path const& path_dir_mount);
+    void unlock();
+    [[nodiscard]] bool is_mounted() const;
+    [[nodiscard]] fs::path const& path() const;
+    ~Share();
+    Share(Share const&) = delete;
+    Share(Share&&) = delete;
+    Share& operator=(Share const&) = delete;
+    Share& operator=(Share&&) = delete;
+};
+
+/**
+ * @brief Construct a new Share object
+ *
+ * @param path_dir_mount Path to the shared mountpoint
+ * @param fd_guard File descriptor of the exclusive mount lock
+ * @param fd_ref File descriptor of the shared reference lock
+ * @param is_mounted Whether the filesystem was already mounted by another instance
+ */
+inline Share::Share(fs::path const& path_dir_mount, int fd_guard, int fd_ref, bool is_mounted)
+  : m_path_dir_mount(path_dir_mount)
+  , m_fd_guard(fd_guard)
+  , m_fd_ref(fd_ref)
+  , m_is_mounted(is_mounted)
+{
+}
+
+/**
+ * @brief Acquires a reference to a shared mount
+ *
+ * Holds the exclusive mount lock until unlock() is called, so the caller can mount the filesystem
+ * if is_mounted() is false without racing with other instances. Stale mounts, left by a mount
+ * process that died, are un-mounted so the caller mounts them again.
+ *
+ * @param path_dir_mount Path to the shared mountpoint
+ * @return Value<std::unique_ptr<Share>> The reference, or the respective error
+ */
+[[nodiscard]] inline Value<std::unique_ptr<Share>> Share::acquire(fs::path const& path_dir_mount)
+{
+  Try(fs::create_directories(path_dir_mount));
+  int fd_guard = Pop(lock(path_dir_mount.string() + ".lock", LOCK_EX));
+  auto fd_ref = lock(path_dir_mount.string() + ".ref", LOCK_SH);
+  if(not fd_ref)
+  {
+    ::close(fd_guard);
+    return Error("E::Could not reference shared mount '{}': {}", path_dir_mount, fd_ref.error());
+  }
+  // Check for an existing mount
+  auto is_fuse = ns_fuse::is_fuse(path_dir_mount);
+  if(not is_fuse)
+  {
+    logger("W::Shared mount '{}' is stale, re-mounting", path_dir_mount);
+    ns_fuse::unmount(path_dir_mount).discard("E::Could not un-mount stale mount '{}'", path_dir_mount);
+  }
+  bool is_mounted = is_fuse.value_or(false);
+  logger("D::Shared mount '{}' is {}", path_dir_mount, is_mounted? "reused" : "new");
+  return std::unique_ptr<Share>(new Share(path_dir_mount, fd_guard, *fd_ref, is_mounted));
+}
+
+/**
+ * @brief Releases the exclusive mount lock, the reference is kept
+ *
+ * Call after the filesystem is mounted and ready.
+ */
+inline void Share::unlock()
+{
+  return_if(m_fd_guard < 0,);
+  ::close(m_fd_guard);
+  m_fd_guard = -1;
+}
+
+/**
+ * @brief Checks if the filesystem was mounted by another instance
+ *
+ * @return bool True if the mount was reused, false if the caller must mount it
+ */
+inline bool Share::is_mounted() const
+{
+  return m_is_mounted;
+}
+
+/**
+ * @brief The path to the shared mountpoint
+ *
+ * @return fs::path const& The path to the shared mountpoint
+ */
+inline fs::path const& Share::path() const
+{
+  return m_path_dir_mount;
+}
+
+/**
+ * @brief Destroy the Share object, releasing the reference and un-mounting the filesystem if
+ * this was the last reference to it
+ */
+inline Share::~Share()
+{
+  // Serialize with instances that are mounting
+  if(m_fd_guard < 0)
+  {
+    m_fd_guard = lock(m_path_dir_mount.string() + ".lock", LOCK_EX).value_or(-1);
+  }
+  // Drop own reference
+  ::close(m_fd_ref);
+  // Un-mount if there are no references left
+  if(m_fd_guard >= 0)
+  {
+    unmount_if_unused(m_path_dir_mount);
+    ::close(m_fd_guard);
+  }
+}
+
+/**
+ * @brief Creates the key of a shared mount
+ *
+ * The key identifies the user, the file and its current contents, the location of the filesystem
+ * in it and the mount options. Any change to them yields a new mount.
+ *
+ * @param path_file_image Path to the file that contains the filesystem
+ * @param offset Offset to the filesystem start
+ * @param size_image Filesystem length
+ * @param options Mount options
+ * @return Value<std::string> The key, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> key(fs::path const& path_file_image
+  , uint64_t offset
+  , uint64_t size_image
+  , std::string const& options)
+{
+  struct stat st{};
+  return_if(::stat(path_file_image.c_str(), &st) != 0
+    , Error("E::Could not stat '{}': {}", path_file_image, strerror(errno))
+  );
+  std::string identity = std::format("{}:{}:{}:{}:{}.{}:{}:{}:{}"
+    , getuid()
+    , st.st_dev
+    , st.st_ino
+    , st.st_size
+    , st.st_mtim.tv_sec
+    , st.st_mtim.tv_nsec
+    , offset
+    , size_image
+    , options
+  );
+  return std::format("{:016x}", std::hash<std::string>{}(identity));
+}
+
+/**
+ * @brief Releases the shared mount of an instance that exited without doing so
+ *
+ * Used by the janitor, the references of the dead instance were already dropped by the kernel.
+ *
+ * @param path_dir_mount Path to the shared mountpoint
+ */
+inline void release(fs::path const& path_dir_mount)
+{
+  auto fd_guard = lock(path_dir_mount.string() + ".lock", LOCK_EX);
+  return_if(not fd_guard,, "E::Could not lock shared mount '{}'", path_dir_mount);
+  unmount_if_unused(path_dir_mount);
+  ::close(*fd_guard);
+}
+
+} // namespace ns_filesystems::ns_share
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
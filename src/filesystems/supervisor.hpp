@@ -0,0 +1,134 @@
+/**
+ * @file supervisor.hpp
+ * @author Ruan Formigoni
+ * @brief Cleanup of the mounts of an instance that exits without un-mounting them
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../std/expected.hpp"
+#include "../lib/fuse.hpp"
+#include "../lib/stats.hpp"
+#include "../macro.hpp"
+#include "share.hpp"
+
+/**
+ * @namespace ns_filesystems::ns_supervisor
+ * @brief Mounts to clean after a crash, for the janitor and for the host portal daemon
+ *
+ * By default each instance spawns a janitor process that waits for it and un-mounts its
+ * filesystems if it crashes. With FIM_SUPERVISOR=1 the host portal daemon, which already waits for
+ * the instance, takes that role instead: the controller writes its mounts to a file of the
+ * instance directory after mounting, and removes it after a clean un-mount. A daemon that
+ * outlives its instance and still finds the file cleans the mounts listed in it.
+ *
+ * The file holds one mountpoint per line, bottom-up, then a '--shared' line followed by the
+ * shared mounts the instance references, the same layout as the arguments of the janitor.
+ */
+namespace ns_filesystems::ns_supervisor
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+} // namespace
+
+/**
+ * @brief The filesystems of an instance
+ */
+struct Mounts
+{
+  std::vector<fs::path> mountpoints; ///< Mountpoints owned by the instance, bottom-up
+  std::vector<fs::path> shared;      ///< Shared mounts referenced by the instance
+};
+
+/**
+ * @brief Parses the mounts from the arguments of the janitor or the lines of a supervisor file
+ *
+ * @param args The mountpoints, then '--shared' and the shared mounts
+ * @return Mounts The parsed mounts
+ */
+[[nodiscard]] inline Mounts from_args(std::vector<fs::path> args)
+{
+  auto it_shared = std::ranges::find(args, fs::path{"--shared"});
+  Mounts mounts;
+  mounts.shared.assign(std::next(it_shared, it_shared != args.end()), args.end());
+  args.erase(it_shared, args.end());
+  mounts.mountpoints = std::move(args);
+  return mounts;
+}
+
+/**
+ * @brief Writes the mounts of an instance to a supervisor file
+ *
+ * @param path_file_supervisor Path to the file, it is replaced atomically
+ * @param mounts The mounts to clean if the instance crashes
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write(fs::path const& path_file_supervisor, Mounts const& mounts)
+{
+  fs::path path_file_tmp = fs::path{path_file_supervisor}.concat(".tmp");
+  {
+    std::ofstream file(path_file_tmp, std::ios::trunc);
+    return_if(not file.is_open(), Error("E::Could not open '{}'", path_file_tmp));
+    for(fs::path const& path : mounts.mountpoints) { file << path.string() << '\n'; }
+    file << "--shared\n";
+    for(fs::path const& path : mounts.shared) { file << path.string() << '\n'; }
+    return_if(not file.flush(), Error("E::Could not write '{}'", path_file_tmp));
+  }
+  Try(fs::rename(path_file_tmp, path_file_supervisor));
+  return {};
+}
+
+/**
+ * @brief Reads the mounts of an instance from a supervisor file
+ *
+ * @param path_file_supervisor Path to the file
+ * @return Value<Mounts> The mounts, or the respective error
+ */
+[[nodiscard]] inline Value<Mounts> read(fs::path const& path_file_supervisor)
+{
+  std::ifstream file(path_file_supervisor);
+  return_if(not file.is_open(), Error("D::Could not open '{}'", path_file_supervisor));
+  std::vector<fs::path> args;
+  for(std::string line; std::getline(file, line);)
+  {
+    continue_if(line.empty());
+    args.emplace_back(line);
+  }
+  return from_args(std::move(args));
+}
+
+/**
+ * @brief Un-mounts the filesystems of a crashed instance and releases its shared mounts
+ *
+ * @param mounts The mounts of the instance
+ */
+inline void cleanup(Mounts const& mounts)
+{
+  // Mountpoints are given bottom-up, un-mount them top-down in one pass
+  std::vector<fs::path> vec_path_dir_mountpoints(mounts.mountpoints.rbegin(), mounts.mountpoints.rend());
+  logger("I::Un-mount {} filesystems", vec_path_dir_mountpoints.size());
+  ns_stats::add(ns_stats::Counter::JANITOR_CLEANUPS);
+  ns_stats::add(ns_stats::Counter::JANITOR_UNMOUNTS, vec_path_dir_mountpoints.size());
+  ns_fuse::unmount(vec_path_dir_mountpoints).discard("E::Could not un-mount filesystems");
+  for (auto&& path_dir_mountpoint : mounts.shared)
+  {
+    logger("I::Release shared mount '{}'", path_dir_mountpoint);
+    ns_filesystems::ns_share::release(path_dir_mountpoint);
+  }
+}
+
+} // namespace ns_filesystems::ns_supervisor
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
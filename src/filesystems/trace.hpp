@@ -0,0 +1,271 @@
+/**
+ * @file trace.hpp
+ * @author Ruan Formigoni
+ * @brief Records the files read from the layers and prefetches them on later boots
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <ranges>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../lib/linux.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_filesystems::ns_trace
+ * @brief Access recording and prefetching of layer files
+ *
+ * DwarFS decompresses blocks on demand, so the files an application reads on startup are
+ * decompressed serially, one page fault at a time. In record mode (FIM_TRACE_ACCESS=1) the files
+ * opened from each layer are recorded in order to a hint file. On later boots the files listed
+ * in the hint files are read in parallel right after the layers are mounted, so their blocks are
+ * already in the dwarfs cache when the application asks for them.
+ *
+ * Hint files hold one path per line, relative to the root of the layer.
+ */
+namespace ns_filesystems::ns_trace
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Maximum number of files recorded per layer
+constexpr size_t const max_files = 4096;
+
+} // namespace
+
+/**
+ * @brief A mounted layer and its hint file
+ */
+struct Hint
+{
+  fs::path path_dir_mount;
+  fs::path path_file_hint;
+};
+
+/**
+ * @class Recorder
+ * @brief Records the files opened from the layers with inotify
+ *
+ * Every directory of every layer is watched for IN_OPEN events in a background thread. The
+ * hint files are written when the recorder is destroyed. A layer whose directories were all
+ * watched and none of whose files were opened gets an empty hint file, the controller leaves it
+ * out on later boots if it is lazy.
+ */
+class Recorder
+{
+  private:
+    struct Watch
+    {
+      size_t index_hint;
+      fs::path path_dir_relative;
+    };
+    std::vector<Hint> m_hints;
+    std::vector<std::vector<fs::path>> m_files;
+    std::vector<char> m_is_watched;
+    std::map<int,Watch> m_watches;
+    int m_fd_inotify;
+    std::jthread m_thread;
+
+    void watch(size_t index_hint);
+    void loop(std::stop_token token);
+
+  public:
+    Recorder(std::vector<Hint> const& hints);
+    ~Recorder();
+    Recorder(Recorder const&) = delete;
+    Recorder(Recorder&&) = delete;
+    Recorder& operator=(Recorder const&) = delete;
+    Recorder& operator=(Recorder&&) = delete;
+};
+
+/**
+ * @brief Construct a new Recorder object and start recording
+ *
+ * @param hints The mounted layers and the hint files to write
+ */
+inline Recorder::Recorder(std::vector<Hint> const& hints)
+  : m_hints(hints)
+  , m_files(hints.size())
+  , m_is_watched(hints.size(), 0)
+  , m_watches()
+  , m_fd_inotify(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+  , m_thread()
+{
+  return_if(m_fd_inotify < 0,, "E::Could not initialize inotify: {}", strerror(errno));
+  for(size_t index_hint = 0; index_hint < m_hints.size(); ++index_hint)
+  {
+    watch(index_hint);
+  }
+  logger("D::Recording file accesses with {} watches", m_watches.size());
+  m_thread = std::jthread([this](std::stop_token token){ this->loop(token); });
+}
+
+/**
+ * @brief Adds watches to all the directories of a layer
+ *
+ * @param index_hint Index of the layer in the hints vector
+ */
+inline void Recorder::watch(size_t index_hint)
+{
+  fs::path const& path_dir_mount = m_hints[index_hint].path_dir_mount;
+  auto f_add = [&](fs::path const& path_dir)
+  {
+    int wd = ::inotify_add_watch(m_fd_inotify, path_dir.c_str(), IN_OPEN | IN_ONLYDIR);
+    return_if(wd < 0, false, "E::Could not watch '{}': {}", path_dir, strerror(errno));
+    m_watches[wd] = Watch{index_hint, path_dir.lexically_relative(path_dir_mount)};
+    return true;
+  };
+  return_if(not f_add(path_dir_mount),);
+  std::error_code ec;
+  for(auto it = fs::recursive_directory_iterator(path_dir_mount, ec); not ec and it != fs::recursive_directory_iterator(); it.increment(ec))
+  {
+    std::error_code ec_entry;
+    continue_if(it->is_symlink(ec_entry) or not it->is_directory(ec_entry));
+    // Stop on the watch limit, the directories watched so far are still recorded
+    return_if(not f_add(it->path()),);
+  }
+  m_is_watched[index_hint] = not ec;
+}
+
+/**
+ * @brief Reads inotify events until stopped
+ *
+ * @param token Stop token of the thread
+ */
+inline void Recorder::loop(std::stop_token token)
+{
+  using namespace std::chrono_literals;
+  alignas(struct inotify_event) std::array<char, 16384> buffer;
+  std::vector<std::set<fs::path>> seen(m_hints.size());
+  // Keep going after the stop request until there are no pending events
+  while(true)
+  {
+    bool is_ready = ns_linux::poll_with_timeout(m_fd_inotify, POLLIN, 100ms);
+    break_if(not is_ready and token.stop_requested());
+    continue_if(not is_ready);
+    ssize_t bytes = ::read(m_fd_inotify, buffer.data(), buffer.size());
+    continue_if(bytes <= 0);
+    for(char* ptr = buffer.data(); ptr < buffer.data() + bytes;)
+    {
+      auto event = reinterpret_cast<struct inotify_event*>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+      continue_if(event->len == 0 or (event->mask & IN_ISDIR));
+      auto it = m_watches.find(event->wd);
+      continue_if(it == m_watches.end());
+      auto const& [index_hint, path_dir_relative] = it->second;
+      fs::path path_file = path_dir_relative / event->name;
+      continue_if(m_files[index_hint].size() >= max_files);
+      // Keep the first access only, the order is the order of the prefetch
+      if(seen[index_hint].insert(path_file).second)
+      {
+        m_files[index_hint].push_back(path_file.lexically_normal());
+      }
+    }
+  }
+}
+
+/**
+ * @brief Destroy the Recorder object, stops recording and writes the hint files
+ */
+inline Recorder::~Recorder()
+{
+  return_if(m_fd_inotify < 0,);
+  m_thread.request_stop();
+  if(m_thread.joinable())
+  {
+    m_thread.join();
+  }
+  ::close(m_fd_inotify);
+  for(auto&& [hint, files, is_watched] : std::views::zip(m_hints, m_files, m_is_watched))
+  {
+    // Without all the watches, no access does not mean the layer is not read
+    continue_if(files.empty() and not is_watched);
+    std::error_code ec;
+    fs::create_directories(hint.path_file_hint.parent_path(), ec);
+    std::ofstream file_hint(hint.path_file_hint, std::ios::trunc);
+    continue_if(not file_hint.is_open(), "E::Could not open hint file '{}'", hint.path_file_hint);
+    std::ranges::for_each(files, [&](auto&& e){ file_hint << e.string() << '\n'; });
+    logger("D::Recorded {} files to '{}'", files.size(), hint.path_file_hint);
+  }
+}
+
+/**
+ * @brief Reads the files listed in the hint files in parallel
+ *
+ * Files are read to the end and the data discarded, which makes dwarfs decompress their blocks
+ * into its cache. Layers without a hint file are skipped.
+ *
+ * @param hints The mounted layers and their hint files
+ */
+inline void prefetch(std::vector<Hint> const& hints)
+{
+  auto time_beg = std::chrono::steady_clock::now();
+  // Gather the files to read, in recorded order
+  std::vector<fs::path> files;
+  for(auto&& hint : hints)
+  {
+    std::ifstream file_hint(hint.path_file_hint);
+    continue_if(not file_hint.is_open());
+    for(std::string line; std::getline(file_hint, line);)
+    {
+      continue_if(line.empty());
+      files.push_back(hint.path_dir_mount / line);
+    }
+  }
+  return_if(files.empty(),);
+  // Read with a pool of threads, each takes the next file in order
+  std::atomic<size_t> index{0};
+  std::atomic<uint64_t> bytes_total{0};
+  auto f_worker = [&]
+  {
+    std::vector<char> buffer(128 * 1024);
+    for(size_t i = index++; i < files.size(); i = index++)
+    {
+      int fd = ::open(files[i].c_str(), O_RDONLY | O_CLOEXEC);
+      continue_if(fd < 0);
+      for(ssize_t bytes; (bytes = ::read(fd, buffer.data(), buffer.size())) > 0;)
+      {
+        bytes_total += bytes;
+      }
+      ::close(fd);
+    }
+  };
+  size_t count_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+  {
+    std::vector<std::jthread> threads;
+    for(size_t i = 0; i < std::min(count_threads, files.size()); ++i)
+    {
+      threads.emplace_back(f_worker);
+    }
+  }
+  logger("D::Prefetched {} files ({} bytes) in {}ms"
+    , files.size()
+    , bytes_total.load()
+    , std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_beg).count()
+  );
+}
+
+} // namespace ns_filesystems::ns_trace
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -8,22 +8,48 @@
 
 #pragma once
 
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
 #include <filesystem>
 #include <ranges>
 #include <chrono>
 #include <thread>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
 
 #include "../std/expected.hpp"
+#include "../db/db.hpp"
 #include "../macro.hpp"
 
 /**
  * @namespace ns_filesystems::ns_utils
  * @brief Filesystem utility functions
  *
- * Provides utility functions for filesystem management including busy state detection by
- * scanning /proc/[pid]/mountinfo, layer enumeration, and instance cleanup operations.
+ * Provides utility functions for filesystem management including busy state detection with an
+ * ownership lock on the data directory, layer enumeration, and instance cleanup operations.
  * Supports filesystem state queries and validation for safe mount/unmount operations.
+ *
+ * Instances that mount filesystems which reference the data directory own it:
+ *
+ * - '<data>/owner.lock': Exclusive lock held by the owner, the kernel releases it on exit
+ * - '<data>/owners/<pid>': Registry of owners, removed when the owner releases the directory
+ *
+ * The directory is free when an exclusive lock can be taken on the lock file. A registry entry
+ * left behind by an owner that died means its mounts might still be alive in orphaned
+ * processes, only then /proc/[pid]/mountinfo is scanned to confirm.
  */
 namespace ns_filesystems::ns_utils
 {
@@ -35,9 +61,81 @@ namespace fs = std::filesystem;
 
 }
 
+inline bool is_busy(fs::path const& path_dir);
+
+namespace
+{
+
+/**
+ * @brief Tries to take the exclusive lock of a data directory
+ *
+ * Stale registry entries, left by owners that died, fall back to scanning mountinfo. They are
+ * removed once no process references the directory.
+ *
+ * @param path_dir Path to the data directory
+ * @return Value<int> The file descriptor that holds the exclusive lock, or the respective error
+ */
+[[nodiscard]] inline Value<int> try_lock(fs::path const& path_dir)
+{
+  fs::path path_file_lock = path_dir / "owner.lock";
+  int fd = ::open(path_file_lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  return_if(fd < 0, Error("E::Could not open lock file '{}': {}", path_file_lock, strerror(errno)));
+  if(::flock(fd, LOCK_EX | LOCK_NB) < 0)
+  {
+    ::close(fd);
+    return Error("D::Busy '{}' due to a running owner", path_dir);
+  }
+  // No owner is alive, check for owners that did not release the directory
+  std::error_code ec;
+  fs::path path_dir_owners = path_dir / "owners";
+  bool is_stale = fs::exists(path_dir_owners, ec) and not fs::is_empty(path_dir_owners, ec);
+  if(is_stale and is_busy(path_dir))
+  {
+    ::close(fd);
+    return Error("D::Busy '{}' due to a stale owner", path_dir);
+  }
+  if(is_stale)
+  {
+    logger("D::Remove stale owners of '{}'", path_dir);
+    for(auto&& entry : fs::directory_iterator(path_dir_owners, ec))
+    {
+      fs::remove(entry.path(), ec);
+    }
+  }
+  return fd;
+}
+
+/**
+ * @brief Waits for the exclusive lock of a data directory
+ *
+ * @param path_dir Path to the data directory
+ * @param timeout Maximum time to wait
+ * @return Value<int> The file descriptor that holds the exclusive lock, or the respective error
+ */
+[[nodiscard]] inline Value<int> wait_lock(fs::path const& path_dir, std::chrono::nanoseconds timeout)
+{
+  using namespace std::chrono;
+  auto const start_time = steady_clock::now();
+  constexpr auto poll_interval = milliseconds(100);
+  while(true)
+  {
+    // Checking the lock is a single system call, the scan only runs for stale owners
+    auto fd = try_lock(path_dir);
+    return_if(fd, *fd);
+    if(steady_clock::now() - start_time >= timeout)
+    {
+      auto const timeout_ms = duration_cast<milliseconds>(timeout).count();
+      return Error("C::Another instance is running on {} (timeout after {}ms)", path_dir, timeout_ms);
+    }
+    std::this_thread::sleep_for(poll_interval);
+  }
+}
+
+} // namespace
+
 /** @brief Checks if a filesystem path is currently in use by any active process.
  *
- * Scans all processes in /proc/[pid]/mountinfo to determine if the given path
+ * Costly with many processes running, used as a fallback for the ownership lock. Scans all processes in /proc/[pid]/mountinfo to determine if the given path
  * is mounted or actively used. Iterates through each process's mount
  * information and returns true if the path is found in any mountinfo entry,
  * indicating the path is busy/in-use.
@@ -79,39 +177,367 @@ inline bool is_busy(fs::path const& path_dir)
 }
 
 /**
- * @brief Waits for a filesystem path to become available (not busy).
+ * @brief Waits for a data directory to become available (not owned).
  *
- * Polls the is_busy() function at 100ms intervals until either the path becomes
+ * Tries the ownership lock at 100ms intervals until either the directory becomes
  * available or the timeout is reached. Uses chrono duration for precise time tracking.
  *
- * @param path_dir The filesystem path to monitor for busy status.
+ * @param path_dir The data directory to monitor for busy status.
  * @param timeout Maximum time to wait before timing out (accepts any chrono duration type).
  * @return Value<void> Success if the path became available within the timeout,
  *         or an error if the timeout was reached while the path was still busy.
  */
 [[nodiscard]] inline Value<void> wait_busy(fs::path const& path_dir, std::chrono::nanoseconds timeout)
 {
-  using namespace std::chrono;
+  ::close(Pop(wait_lock(path_dir, timeout)));
+  return {};
+}
 
-  auto const start_time = steady_clock::now();
-  constexpr auto poll_interval = milliseconds(100);
+/**
+ * @class Owner
+ * @brief Ownership of a data directory by a running instance
+ *
+ * While the object is alive other instances wait for the directory in wait_busy.
+ */
+class Owner
+{
+  private:
+    fs::path m_path_file_owner;
+    int m_fd_lock;
 
-  while(true)
+    Owner(fs::path const& path_file_owner, int fd_lock);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Owner>> acquire(fs::path const& path_dir, std::chrono::nanoseconds timeout);
+    ~Owner();
+    Owner(Owner const&) = delete;
+    Owner(Owner&&) = delete;
+    Owner& operator=(Owner const&) = delete;
+    Owner& operator=(Owner&&) = delete;
+};
+
+/**
+ * @brief Construct a new Owner object
+ *
+ * @param path_file_owner Path to the registry entry of this instance
+ * @param fd_lock File descriptor of the exclusive ownership lock
+ */
+inline Owner::Owner(fs::path const& path_file_owner, int fd_lock)
+  : m_path_file_owner(path_file_owner)
+  , m_fd_lock(fd_lock)
+{
+}
+
+/**
+ * @brief Waits for a data directory to become available and takes ownership of it
+ *
+ * @param path_dir The data directory
+ * @param timeout Maximum time to wait for other owners
+ * @return Value<std::unique_ptr<Owner>> The ownership, or the respective error
+ */
+[[nodiscard]] inline Value<std::unique_ptr<Owner>> Owner::acquire(fs::path const& path_dir, std::chrono::nanoseconds timeout)
+{
+  // The exclusive lock is kept until the instance exits
+  int fd_lock = Pop(wait_lock(path_dir, timeout));
+  fs::path path_file_owner = path_dir / "owners" / std::to_string(getpid());
+  if(auto ret = Catch(fs::create_directories(path_file_owner.parent_path())); not ret)
   {
-    if(!is_busy(path_dir))
-    {
-      return {}; // Directory is no longer busy
-    }
+    ::close(fd_lock);
+    return Error("E::Could not create owner registry: {}", ret.error());
+  }
+  std::ofstream(path_file_owner, std::ios::trunc).flush();
+  logger("D::Owner of '{}'", path_dir);
+  return std::unique_ptr<Owner>(new Owner(path_file_owner, fd_lock));
+}
+
+/**
+ * @brief Destroy the Owner object, releases the data directory
+ */
+inline Owner::~Owner()
+{
+  std::error_code ec;
+  fs::remove(m_path_file_owner, ec);
+  ::close(m_fd_lock);
+}
+
+/**
+ * @class Concurrent
+ * @brief Shared use of a data directory by an instance with its own upper directory
+ *
+ * Concurrent instances hold a shared lock on the ownership lock, so they start together while
+ * owners and instances that write the persistent upper directory wait for all of them to exit.
+ * The persistent upper directory is read-only for them, their changes go to an upper directory
+ * of their own, discarded on exit. With is_merge the changes are kept in 'pending/' instead, and
+ * merged into the persistent upper directory by the first concurrent instance that finds no other
+ * running, on exit or startup.
+ */
+class Concurrent
+{
+  public:
+    using merge_t = std::function<Value<void>(fs::path const& path_dir_src, fs::path const& path_dir_dst)>;
+
+  private:
+    fs::path m_path_dir;
+    fs::path m_path_dir_upper;
+    fs::path m_path_dir_upper_instance;
+    bool m_is_merge;
+    merge_t m_merge;
+    int m_fd_lock;
+
+    Concurrent(fs::path const& path_dir
+      , fs::path const& path_dir_upper
+      , fs::path const& path_dir_upper_instance
+      , bool is_merge
+      , merge_t merge
+      , int fd_lock
+    );
+    [[nodiscard]] Value<void> merge_pending() const;
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Concurrent>> acquire(fs::path const& path_dir
+      , fs::path const& path_dir_upper
+      , fs::path const& path_dir_upper_instance
+      , bool is_merge
+      , merge_t merge
+      , std::chrono::nanoseconds timeout
+    );
+    ~Concurrent();
+    Concurrent(Concurrent const&) = delete;
+    Concurrent(Concurrent&&) = delete;
+    Concurrent& operator=(Concurrent const&) = delete;
+    Concurrent& operator=(Concurrent&&) = delete;
+};
+
+/**
+ * @brief Construct a new Concurrent object
+ *
+ * @param path_dir The data directory
+ * @param path_dir_upper The persistent upper directory
+ * @param path_dir_upper_instance The upper directory of this instance
+ * @param is_merge Whether to keep the changes of this instance
+ * @param merge Stacks an upper directory on top of another
+ * @param fd_lock File descriptor of the shared lock
+ */
+inline Concurrent::Concurrent(fs::path const& path_dir
+  , fs::path const& path_dir_upper
+  , fs::path const& path_dir_upper_instance
+  , bool is_merge
+  , merge_t merge
+  , int fd_lock)
+  : m_path_dir(path_dir)
+  , m_path_dir_upper(path_dir_upper)
+  , m_path_dir_upper_instance(path_dir_upper_instance)
+  , m_is_merge(is_merge)
+  , m_merge(std::move(merge))
+  , m_fd_lock(fd_lock)
+{
+}
+
+/**
+ * @brief Merges the kept changes into the persistent upper directory, oldest first
+ *
+ * Requires the exclusive lock, with it no other concurrent instance is running and the upper
+ * directories left in 'instances/' belong to instances that crashed.
+ *
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> Concurrent::merge_pending() const
+{
+  std::error_code ec;
+  for(auto&& entry : fs::directory_iterator(m_path_dir / "instances", ec))
+  {
+    continue_if(entry.path() == m_path_dir_upper_instance);
+    logger("D::Remove stale upper directory '{}'", entry.path());
+    fs::remove_all(entry.path(), ec);
+  }
+  fs::path path_dir_pending = m_path_dir / "pending";
+  return_if(not fs::exists(path_dir_pending, ec), {});
+  // Entries are named after the time of the exit, the names sort in the order of the changes
+  std::vector<fs::path> vec_path_dir_pending = Try(fs::directory_iterator(path_dir_pending))
+    | std::views::transform([](auto&& e){ return e.path(); })
+    | std::ranges::to<std::vector<fs::path>>();
+  std::ranges::sort(vec_path_dir_pending);
+  for(fs::path const& path_dir_src : vec_path_dir_pending)
+  {
+    Pop(m_merge(path_dir_src, m_path_dir_upper), "E::Could not merge '{}'", path_dir_src);
+    Try(fs::remove_all(path_dir_src));
+  }
+  log_if(not vec_path_dir_pending.empty(), "D::Merged the changes of {} instances into '{}'"
+    , vec_path_dir_pending.size()
+    , m_path_dir_upper
+  );
+  return {};
+}
 
-    auto const elapsed = steady_clock::now() - start_time;
-    if(elapsed >= timeout)
+/**
+ * @brief Waits for the owners of a data directory to exit and joins the concurrent instances
+ *
+ * @param path_dir The data directory
+ * @param path_dir_upper The persistent upper directory
+ * @param path_dir_upper_instance The upper directory of this instance
+ * @param is_merge Whether to keep the changes of this instance
+ * @param merge Stacks an upper directory on top of another, markers included
+ * @param timeout Maximum time to wait for the owners
+ * @return Value<std::unique_ptr<Concurrent>> The shared use, or the respective error
+ */
+[[nodiscard]] inline Value<std::unique_ptr<Concurrent>> Concurrent::acquire(fs::path const& path_dir
+  , fs::path const& path_dir_upper
+  , fs::path const& path_dir_upper_instance
+  , bool is_merge
+  , merge_t merge
+  , std::chrono::nanoseconds timeout)
+{
+  using namespace std::chrono;
+  Try(fs::create_directories(path_dir_upper_instance), "E::Could not create the upper directory of the instance");
+  // Without other instances the lock is exclusive, take the chance to merge the kept changes
+  if(auto fd = try_lock(path_dir))
+  {
+    std::unique_ptr<Concurrent> concurrent(new Concurrent(path_dir, path_dir_upper, path_dir_upper_instance, is_merge, merge, *fd));
+    concurrent->merge_pending().discard("E::Could not merge the changes of concurrent instances");
+    ::flock(*fd, LOCK_SH);
+    logger("D::Concurrent instance on '{}'", path_dir);
+    return concurrent;
+  }
+  fs::path path_file_lock = path_dir / "owner.lock";
+  int fd_lock = ::open(path_file_lock.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  return_if(fd_lock < 0, Error("E::Could not open lock file '{}': {}", path_file_lock, strerror(errno)));
+  // Shared locks only wait for an exclusive owner
+  auto const start_time = steady_clock::now();
+  while(::flock(fd_lock, LOCK_SH | LOCK_NB) < 0)
+  {
+    if(steady_clock::now() - start_time >= timeout)
     {
+      ::close(fd_lock);
       auto const timeout_ms = duration_cast<milliseconds>(timeout).count();
-      return Error("C::Another instance is running on {} (timeout after {}ms)", path_dir, timeout_ms);
+      return Error("C::Another instance owns {} (timeout after {}ms)", path_dir, timeout_ms);
     }
+    std::this_thread::sleep_for(milliseconds(100));
+  }
+  logger("D::Concurrent instance on '{}'", path_dir);
+  return std::unique_ptr<Concurrent>(new Concurrent(path_dir, path_dir_upper, path_dir_upper_instance, is_merge, merge, fd_lock));
+}
 
-    std::this_thread::sleep_for(poll_interval);
+/**
+ * @brief Destroy the Concurrent object, keeps or discards the changes of the instance
+ *
+ * Expects the filesystems that use the upper directory of the instance to be un-mounted.
+ */
+inline Concurrent::~Concurrent()
+{
+  std::error_code ec;
+  if(m_is_merge)
+  {
+    auto const time = std::chrono::system_clock::now().time_since_epoch();
+    fs::path path_dir_pending = m_path_dir / "pending"
+      / std::format("{:020}-{}", std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), getpid());
+    fs::create_directories(path_dir_pending.parent_path(), ec);
+    fs::rename(m_path_dir_upper_instance, path_dir_pending, ec);
+    log_if(ec, "E::Could not keep the changes of the instance in '{}': {}", path_dir_pending, ec.message());
+  }
+  fs::remove_all(m_path_dir_upper_instance, ec);
+  // The last concurrent instance merges the kept changes
+  if(::flock(m_fd_lock, LOCK_EX | LOCK_NB) == 0)
+  {
+    this->merge_pending().discard("E::Could not merge the changes of concurrent instances");
   }
+  ::close(m_fd_lock);
+}
+
+/**
+ * @brief Checks if a directory is on a filesystem in memory
+ *
+ * @param path_dir The directory
+ * @return bool True if the directory is on a tmpfs, false otherwise
+ */
+[[nodiscard]] inline bool is_tmpfs(fs::path const& path_dir)
+{
+  struct statfs buf;
+  return ::statfs(path_dir.c_str(), &buf) == 0 and buf.f_type == TMPFS_MAGIC;
+}
+
+/**
+ * @brief Removes a directory tree, directories without the write permission included
+ *
+ * Directories copied up from read-only layers keep their permissions in the upper directory.
+ *
+ * @param path_dir The directory to remove
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> remove_tree(fs::path const& path_dir)
+{
+  std::error_code ec;
+  for(auto it = fs::recursive_directory_iterator(path_dir, ec); not ec and it != fs::recursive_directory_iterator(); it.increment(ec))
+  {
+    if(it->is_directory(ec) and not it->is_symlink(ec)) { ::chmod(it->path().c_str(), 0755); }
+  }
+  fs::remove_all(path_dir, ec);
+  return_if(ec, Error("E::Could not remove '{}': {}", path_dir, ec.message()));
+  return {};
+}
+
+/**
+ * @class Volatile
+ * @brief The upper and work directories of a volatile run, removed with the object
+ *
+ * Expects the filesystems that use the directories to be un-mounted.
+ */
+class Volatile
+{
+  private:
+    fs::path m_path_dir;
+
+    explicit Volatile(fs::path const& path_dir);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Volatile>> create(fs::path const& path_dir, fs::path const& path_dir_work);
+    ~Volatile();
+    Volatile(Volatile const&) = delete;
+    Volatile(Volatile&&) = delete;
+    Volatile& operator=(Volatile const&) = delete;
+    Volatile& operator=(Volatile&&) = delete;
+};
+
+/**
+ * @brief Construct a new Volatile object
+ *
+ * @param path_dir The directory with the upper and work directories of the run
+ */
+inline Volatile::Volatile(fs::path const& path_dir)
+  : m_path_dir(path_dir)
+{
+}
+
+/**
+ * @brief Creates the directories of a volatile run
+ *
+ * The directory is created with mkdir and mode 0700, which fails if it exists. Another user of
+ * the shared '/dev/shm' can neither prepare the directory nor read the changes of the run.
+ *
+ * @param path_dir The directory with the upper and work directories of the run, it must not exist
+ * @param path_dir_work The work directory of the overlay, inside path_dir
+ * @return Value<std::unique_ptr<Volatile>> The directories, or the respective error
+ */
+[[nodiscard]] inline Value<std::unique_ptr<Volatile>> Volatile::create(fs::path const& path_dir, fs::path const& path_dir_work)
+{
+  return_if(::mkdir(path_dir.c_str(), 0700) < 0
+    , Error("E::Could not create volatile directory '{}': {}", path_dir, strerror(errno))
+  );
+  struct stat st{};
+  return_if(::lstat(path_dir.c_str(), &st) < 0 or not S_ISDIR(st.st_mode) or st.st_uid != ::geteuid()
+    , Error("E::Volatile directory '{}' is not owned by the current user", path_dir)
+  );
+  std::unique_ptr<Volatile> path_volatile(new Volatile(path_dir));
+  Try(fs::create_directories(path_dir_work), "E::Could not create volatile directory '{}'", path_dir);
+  logger("D::Volatile changes in '{}'", path_dir);
+  return path_volatile;
+}
+
+/**
+ * @brief Destroy the Volatile object, discards the changes of the run
+ */
+inline Volatile::~Volatile()
+{
+  remove_tree(m_path_dir).discard("E::Could not remove volatile directory");
 }
 
 /**
@@ -171,6 +597,113 @@ struct Instance
   return vec_path_dir_layer;
 }
 
-
+/**
+ * @brief Checks if the kernel allows overlayfs mounts in an unprivileged user namespace
+ *
+ * Forks a child that unshares a user and a mount namespace, maps the current user to root and
+ * mounts a throwaway overlay with the 'userxattr' option, the same kind of mount bwrap performs
+ * with '--overlay'. It requires a kernel >= 5.11 with unprivileged user namespaces enabled, and
+ * a host filesystem that supports being an upper directory.
+ *
+ * The result is cached for the boot session of the host, keyed by its boot id, kernel release,
+ * user namespace settings and the filesystem of the probe, so later launches skip the fork.
+ *
+ * @param path_dir_probe Scratch directory for the probe, it is removed afterwards
+ * @param path_file_cache Cache of the probe, none to always probe
+ * @return bool True if the overlay was mounted, false otherwise
+ */
+[[nodiscard]] inline bool is_overlay_userns(fs::path const& path_dir_probe
+  , std::optional<fs::path> const& path_file_cache)
+{
+  auto f_read = [](fs::path const& path)
+  {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+  };
+  // Hosts that share the cache directory, e.g., through a network home, have a section each
+  struct utsname uts{};
+  ::uname(&uts);
+  std::string const host = uts.nodename;
+  std::string key;
+  struct stat st{};
+  if(std::string boot_id = f_read("/proc/sys/kernel/random/boot_id");
+    path_file_cache and not boot_id.empty() and ::stat(path_dir_probe.parent_path().c_str(), &st) == 0)
+  {
+    key = std::format("{}|{}|{}|{}|{}|{}"
+      , boot_id
+      , uts.release
+      , f_read("/proc/sys/kernel/apparmor_restrict_unprivileged_userns")
+      , f_read("/proc/sys/kernel/unprivileged_userns_clone")
+      , f_read("/proc/sys/user/max_user_namespaces")
+      , st.st_dev
+    );
+  }
+  // Reuse the result of a previous probe on this host
+  if(not key.empty())
+  {
+    ns_db::Db db = ns_db::read_file(*path_file_cache).value_or(ns_db::Db{});
+    if(db("overlay")(host)("key").value<std::string>().value_or("") == key)
+    {
+      if(auto result = db("overlay")(host)("result").value<std::string>())
+      {
+        logger("D::Using cached overlay probe: {}", *result);
+        return *result == "supported";
+      }
+    }
+  }
+  // Create scratch directories
+  for(auto&& name : {"lower", "upper", "work", "mount"})
+  {
+    return_if(not Catch(fs::create_directories(path_dir_probe / name)), false, "E::Could not create probe directories");
+  }
+  // Prepare the strings before forking, the child only performs system calls
+  std::string const str_uid_map = std::format("0 {} 1", getuid());
+  std::string const str_gid_map = std::format("0 {} 1", getgid());
+  std::string const str_options = std::format("lowerdir={},upperdir={},workdir={},userxattr"
+    , (path_dir_probe / "lower").string()
+    , (path_dir_probe / "upper").string()
+    , (path_dir_probe / "work").string()
+  );
+  std::string const str_dir_mount = (path_dir_probe / "mount").string();
+  pid_t pid = fork();
+  return_if(pid < 0, false, "E::Could not fork overlay probe");
+  if(pid == 0)
+  {
+    auto f_write = [](char const* path, std::string const& data)
+    {
+      int fd = ::open(path, O_WRONLY | O_CLOEXEC);
+      if(fd < 0) { return false; }
+      bool is_ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+      ::close(fd);
+      return is_ok;
+    };
+    if(::unshare(CLONE_NEWUSER | CLONE_NEWNS) != 0) { _exit(1); }
+    if(not f_write("/proc/self/setgroups", "deny")) { _exit(1); }
+    if(not f_write("/proc/self/uid_map", str_uid_map)) { _exit(1); }
+    if(not f_write("/proc/self/gid_map", str_gid_map)) { _exit(1); }
+    _exit(::mount("overlay", str_dir_mount.c_str(), "overlay", 0, str_options.c_str()) == 0? 0 : 1);
+  }
+  // Wait for the probe result
+  int status{};
+  return_if(::waitpid(pid, &status, 0) < 0, false, "E::Could not wait for overlay probe");
+  Catch(fs::remove_all(path_dir_probe)).discard("W::Could not remove probe directory '{}'", path_dir_probe);
+  bool is_supported = WIFEXITED(status) and WEXITSTATUS(status) == 0;
+  logger("D::Overlay in user namespace {}", is_supported? "is supported" : "is not supported");
+  // Save the probe, other sections of the cache are kept
+  if(not key.empty())
+  {
+    ns_db::Db db = ns_db::read_file(*path_file_cache).value_or(ns_db::Db{});
+    db("overlay")(host)("key") = key;
+    db("overlay")(host)("result") = std::string{is_supported? "supported" : "unsupported"};
+    fs::path path_file_cache_temp = std::format("{}.tmp.{}", path_file_cache->string(), getpid());
+    if(ns_db::write_file(path_file_cache_temp, db))
+    {
+      Catch(fs::rename(path_file_cache_temp, *path_file_cache)).discard("E::Could not rename overlay probe cache");
+    }
+  }
+  return is_supported;
+}
 
 } // namespace ns_filesystems::ns_utils
\ No newline at end of file
@@ -8,15 +8,18 @@
  */
 
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <thread>
 #include <filesystem>
 #include <csignal>
+#include <sys/prctl.h>
 
 #include "../std/expected.hpp"
 #include "../lib/log.hpp"
-#include "../lib/fuse.hpp"
+#include "../lib/linux.hpp"
+#include "../filesystems/supervisor.hpp"
 #include "../macro.hpp"
 
 // https://stackoverflow.com/questions/24931456/how-does-sig-atomic-t-actually-work
@@ -24,6 +27,7 @@
 // https://man7.org/linux/man-pages/man7/signal-safety.7.html
 // https://www.cs.wm.edu/~smherwig/courses/csci415-common/signals/sig_atomic/index.html
 volatile std::sig_atomic_t G_PARENT_OK = 0;
+volatile std::sig_atomic_t G_PARENT_DEAD = 0;
 
 /**
  * @brief Signal handler for parent process exit detection
@@ -38,6 +42,18 @@ void cleanup([[maybe_unused]] int sig)
   G_PARENT_OK = 1;
 }
 
+/**
+ * @brief Signal handler for the parent death signal
+ *
+ * Used when pidfd_open is not available, the kernel sends it when the parent exits.
+ *
+ * @param sig Signal number (unused)
+ */
+void parent_death([[maybe_unused]] int sig)
+{
+  G_PARENT_DEAD = 1;
+}
+
 
 /**
  * @brief Boots the main janitor program
@@ -53,7 +69,7 @@ void cleanup([[maybe_unused]] int sig)
   // Ignore SIGPIPE - when parent dies and pipe readers close, we can still cleanup
   signal(SIGPIPE, SIG_IGN);
   // Check argc
-  return_if(argc < 3, Error("E::Incorrect usage: fim_janitor <parent_pid> <log_path>"));
+  return_if(argc < 3, Error("E::Incorrect usage: fim_janitor <parent_pid> <log_path> [mountpoints...] [--shared mountpoints...]"));
   // Get pid to wait for
   pid_t pid_parent = Try(std::stoi(argv[1]));
   // Get log path from parent
@@ -67,10 +83,17 @@ void cleanup([[maybe_unused]] int sig)
   // Configure logger sink to write directly to file (fallback if pipe readers die)
   ns_log::set_sink_file(path_log_file);
   logger("I::Session id is '{}'", pid_session);
-  // Wait for parent process to exit
-  while (not G_PARENT_OK and kill(pid_parent, 0) == 0)
+  // Sleep until the parent process exits or sends the skip signal, which interrupts the wait
+  ns_linux::PidFd pidfd(pid_parent);
+  // Without pidfd, the kernel can signal the death of the parent if it is the direct parent
+  signal(SIGUSR1, parent_death);
+  bool const is_pdeathsig = pidfd.fd() < 0
+    and ::prctl(PR_SET_PDEATHSIG, SIGUSR1) == 0
+    and ::getppid() == pid_parent;
+  logger("D::Waiting for parent with {}", (pidfd.fd() >= 0)? "pidfd" : is_pdeathsig? "PR_SET_PDEATHSIG" : "polling");
+  while (not G_PARENT_OK and not G_PARENT_DEAD and pidfd.is_alive())
   {
-    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    if(is_pdeathsig) { ::pause(); } else { std::ignore = pidfd.wait(); }
   }
   // Check if should skip clean
   if(G_PARENT_OK)
@@ -80,12 +103,10 @@ void cleanup([[maybe_unused]] int sig)
   }
   // Log that parent exited abnormally
   logger("E::Parent process with pid '{}' failed to send skip signal", pid_parent);
-  // Cleanup of mountpoints
-  for (auto&& path_dir_mountpoint : std::vector<std::filesystem::path>(argv+2, argv+argc))
-  {
-    logger("I::Un-mount '{}'", path_dir_mountpoint);
-    ns_fuse::unmount(path_dir_mountpoint).discard("E::Could not un-mount '{}'", path_dir_mountpoint);
-  }
+  // Cleanup of mountpoints, the ones after '--shared' are used by other instances
+  ns_filesystems::ns_supervisor::cleanup(
+    ns_filesystems::ns_supervisor::from_args(std::vector<std::filesystem::path>(argv+3, argv+argc))
+  );
   return {};
 }
 
@@ -0,0 +1,190 @@
+/**
+ * @file affinity.hpp
+ * @author Ruan Formigoni
+ * @brief CPU affinity and NUMA memory placement of processes
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_affinity
+ * @brief Placement of processes on a set of CPUs or NUMA nodes
+ *
+ * A placement is either a list of CPUs, e.g., '0-3,8', or a list of NUMA nodes prefixed with
+ * 'node:', e.g., 'node:0'. Nodes expand to their CPUs and also bind the memory of the process to
+ * them. Both the affinity mask and the memory policy are inherited by children and kept across
+ * execve, so a placement applied between fork and exec covers the whole process tree.
+ */
+namespace ns_affinity
+{
+
+namespace
+{
+
+// From linux/mempolicy.h, there is no libc wrapper for set_mempolicy
+constexpr int const MPOL_DEFAULT = 0;
+constexpr int const MPOL_BIND = 2;
+
+/**
+ * @brief Parses a list of indices in the kernel list format, e.g., '0-3,8'
+ *
+ * @param list The list to parse
+ * @param f Callback called with each index of the list
+ * @return Value<void> Nothing on success, or the respective error
+ */
+template<typename F>
+[[nodiscard]] inline Value<void> parse_list(std::string_view list, F&& f)
+{
+  return_if(list.empty(), Error("C::Empty list"));
+  while(not list.empty())
+  {
+    std::string_view range = list.substr(0, list.find(','));
+    list.remove_prefix(std::min(list.size(), range.size() + 1));
+    auto pos_dash = range.find('-');
+    std::string str_begin(range.substr(0, pos_dash));
+    std::string str_end((pos_dash == std::string_view::npos)? str_begin : range.substr(pos_dash + 1));
+    return_if(str_begin.empty() or str_end.empty()
+      or not std::ranges::all_of(str_begin, ::isdigit) or not std::ranges::all_of(str_end, ::isdigit)
+      , Error("C::Invalid range '{}'", range)
+    );
+    uint64_t begin = Try(std::stoull(str_begin), "C::Invalid range '{}'", range);
+    uint64_t end = Try(std::stoull(str_end), "C::Invalid range '{}'", range);
+    return_if(begin > end or end >= CPU_SETSIZE, Error("C::Invalid range '{}'", range));
+    for(uint64_t i = begin; i <= end; ++i) { f(i); }
+  }
+  return {};
+}
+
+} // namespace
+
+/**
+ * @brief A set of CPUs and optionally a set of NUMA nodes for memory
+ */
+struct Affinity
+{
+  cpu_set_t cpus;         ///< CPUs the process can run on
+  unsigned long nodes;    ///< Bit mask of NUMA nodes for memory, zero to keep the default policy
+};
+
+/**
+ * @brief Parses a placement
+ *
+ * @param str The placement, a list of CPUs or 'node:' followed by a list of NUMA nodes
+ * @return Value<Affinity> The parsed placement, or the respective error
+ */
+[[nodiscard]] inline Value<Affinity> parse(std::string_view str)
+{
+  Affinity affinity{};
+  CPU_ZERO(&affinity.cpus);
+  if(str.starts_with("node:"))
+  {
+    Pop(parse_list(str.substr(5), [&](uint64_t node)
+    {
+      if(node < sizeof(affinity.nodes) * 8) { affinity.nodes |= 1UL << node; }
+    }), "C::Invalid NUMA node list '{}'", str);
+    // The CPUs of each node
+    for(uint64_t node = 0; node < sizeof(affinity.nodes) * 8; ++node)
+    {
+      continue_if(not (affinity.nodes & (1UL << node)));
+      std::ifstream file(std::format("/sys/devices/system/node/node{}/cpulist", node));
+      std::string cpulist;
+      return_if(not std::getline(file, cpulist), Error("C::NUMA node '{}' does not exist", node));
+      Pop(parse_list(cpulist, [&](uint64_t cpu){ CPU_SET(cpu, &affinity.cpus); }));
+    }
+  }
+  else
+  {
+    Pop(parse_list(str, [&](uint64_t cpu){ CPU_SET(cpu, &affinity.cpus); }), "C::Invalid CPU list '{}'", str);
+  }
+  return affinity;
+}
+
+/**
+ * @brief Applies a placement to the calling thread, safe to call between fork and exec
+ *
+ * @param affinity The placement to apply
+ * @return bool True on success, false otherwise
+ */
+inline bool apply(Affinity const& affinity) noexcept
+{
+  bool is_ok = ::sched_setaffinity(0, sizeof(affinity.cpus), &affinity.cpus) == 0;
+  if(affinity.nodes != 0)
+  {
+    is_ok &= ::syscall(SYS_set_mempolicy, MPOL_BIND, &affinity.nodes, sizeof(affinity.nodes) * 8 + 1) == 0;
+  }
+  return is_ok;
+}
+
+/**
+ * @class Scope
+ * @brief Applies a placement to the calling thread and restores the previous one on destruction
+ *
+ * Processes and threads created inside the scope inherit the placement.
+ */
+class Scope
+{
+  private:
+    cpu_set_t m_cpus;
+    bool m_is_active;
+    bool m_is_nodes;
+
+  public:
+    explicit Scope(std::optional<Affinity> const& affinity);
+    ~Scope();
+    Scope(Scope const&) = delete;
+    Scope(Scope&&) = delete;
+    Scope& operator=(Scope const&) = delete;
+    Scope& operator=(Scope&&) = delete;
+};
+
+/**
+ * @brief Construct a new Scope object
+ *
+ * @param affinity The placement to apply, or std::nullopt to keep the current one
+ */
+inline Scope::Scope(std::optional<Affinity> const& affinity)
+  : m_cpus()
+  , m_is_active(false)
+  , m_is_nodes(affinity and affinity->nodes != 0)
+{
+  if(not affinity) { return; }
+  CPU_ZERO(&m_cpus);
+  m_is_active = ::sched_getaffinity(0, sizeof(m_cpus), &m_cpus) == 0;
+  log_if(not apply(*affinity), "W::Could not apply CPU affinity: {}", strerror(errno));
+}
+
+/**
+ * @brief Destroy the Scope object, restores the placement of the calling thread
+ */
+inline Scope::~Scope()
+{
+  if(m_is_active)
+  {
+    std::ignore = ::sched_setaffinity(0, sizeof(m_cpus), &m_cpus);
+  }
+  if(m_is_nodes)
+  {
+    std::ignore = ::syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+  }
+}
+
+} // namespace ns_affinity
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
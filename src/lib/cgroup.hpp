@@ -0,0 +1,314 @@
+/**
+ * @file cgroup.hpp
+ * @author Ruan Formigoni
+ * @brief Resource limits of process trees with cgroup v2
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_cgroup
+ * @brief Creates a cgroup for a process tree in the delegated cgroup v2 hierarchy of the user
+ *
+ * Unprivileged processes can only create cgroups below a cgroup they own, and the controllers
+ * of a cgroup are only available when its parent enables them in 'cgroup.subtree_control'. The
+ * cgroup of the current process usually has processes in it, e.g., the shell, and the kernel does
+ * not enable controllers on a cgroup with processes. So the parent of the new cgroup is the first
+ * cgroup, from the current one up to the root, that is owned by the user and already enables the
+ * required controllers, like the slices of the systemd user manager. The current cgroup is used
+ * when no ancestor qualifies, in that case only the controllers it can enable are available.
+ */
+namespace ns_cgroup
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+fs::path const path_dir_cgroup_root = "/sys/fs/cgroup";
+
+/**
+ * @brief Reads the first line of a cgroup interface file
+ *
+ * @param path_file Path to the file
+ * @return std::string The contents of the line, or an empty string on failure
+ */
+[[nodiscard]] inline std::string read_line(fs::path const& path_file)
+{
+  std::ifstream file(path_file);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+/**
+ * @brief Writes a value to a cgroup interface file
+ *
+ * @param path_file Path to the file
+ * @param value The value to write
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_value(fs::path const& path_file, std::string_view value)
+{
+  int fd = ::open(path_file.c_str(), O_WRONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("D::Could not open '{}': {}", path_file, strerror(errno)));
+  ssize_t written = ::write(fd, value.data(), value.size());
+  int err = errno;
+  ::close(fd);
+  return_if(written < 0, Error("D::Could not write '{}' to '{}': {}", value, path_file, strerror(err)));
+  return {};
+}
+
+/**
+ * @brief Splits the controllers of a 'cgroup.controllers' or 'cgroup.subtree_control' file
+ *
+ * @param path_file Path to the file
+ * @return std::set<std::string> The set of controllers
+ */
+[[nodiscard]] inline std::set<std::string> read_controllers(fs::path const& path_file)
+{
+  std::istringstream ss(read_line(path_file));
+  std::set<std::string> controllers;
+  for(std::string controller; ss >> controller;)
+  {
+    controllers.insert(controller);
+  }
+  return controllers;
+}
+
+/**
+ * @brief Gets the cgroup v2 directory of the current process
+ *
+ * @return Value<fs::path> The directory of the cgroup, or the respective error
+ */
+[[nodiscard]] inline Value<fs::path> path_dir_self()
+{
+  std::ifstream file("/proc/self/cgroup");
+  // The unified hierarchy is the entry with id zero and no controllers
+  for(std::string line; std::getline(file, line);)
+  {
+    continue_if(not line.starts_with("0::"));
+    return path_dir_cgroup_root / fs::path(line.substr(3)).relative_path();
+  }
+  return Error("D::No cgroup v2 hierarchy for the current process");
+}
+
+} // namespace
+
+/**
+ * @class Cgroup
+ * @brief A cgroup that is removed on destruction
+ */
+class Cgroup
+{
+  private:
+    fs::path m_path_dir;
+
+    explicit Cgroup(fs::path const& path_dir);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Cgroup>> create(std::string const& name
+      , std::set<std::string> const& controllers
+    );
+    ~Cgroup();
+    Cgroup(Cgroup const&) = delete;
+    Cgroup(Cgroup&&) = delete;
+    Cgroup& operator=(Cgroup const&) = delete;
+    Cgroup& operator=(Cgroup&&) = delete;
+    [[nodiscard]] fs::path const& path() const { return m_path_dir; }
+    [[nodiscard]] bool has_controller(std::string const& controller) const;
+    [[nodiscard]] Value<void> set(std::string const& file, std::string const& value) const;
+    [[nodiscard]] Value<int> open_procs() const;
+    [[nodiscard]] std::map<std::string,uint64_t> stat(fs::path const& file) const;
+    [[nodiscard]] std::string accounting() const;
+};
+
+/**
+ * @brief Construct a new Cgroup object
+ *
+ * @param path_dir Path to the directory of the cgroup
+ */
+inline Cgroup::Cgroup(fs::path const& path_dir)
+  : m_path_dir(path_dir)
+{
+}
+
+/**
+ * @brief Creates a cgroup in the delegated hierarchy of the user
+ *
+ * @param name Name of the cgroup directory
+ * @param controllers The controllers required by the caller, e.g. 'cpu', 'memory'
+ * @return Value<std::unique_ptr<Cgroup>> The cgroup, or the respective error
+ */
+inline Value<std::unique_ptr<Cgroup>> Cgroup::create(std::string const& name
+  , std::set<std::string> const& controllers)
+{
+  fs::path path_dir_self = Pop(ns_cgroup::path_dir_self());
+  return_if(not fs::exists(path_dir_self / "cgroup.procs"), Error("E::Cgroup v2 is not mounted"));
+  // Look for an owned ancestor that already enables the controllers
+  fs::path path_dir_parent = path_dir_self;
+  uid_t uid = ::getuid();
+  for(fs::path path_dir = path_dir_self; path_dir != path_dir_cgroup_root; path_dir = path_dir.parent_path())
+  {
+    struct stat st{};
+    break_if(::stat(path_dir.c_str(), &st) < 0 or st.st_uid != uid);
+    continue_if(::access(path_dir.c_str(), W_OK) < 0);
+    auto subtree = read_controllers(path_dir / "cgroup.subtree_control");
+    if(std::ranges::all_of(controllers, [&](auto&& e){ return subtree.contains(e); }))
+    {
+      path_dir_parent = path_dir;
+      break;
+    }
+  }
+  // Enable the missing controllers on the parent, fails on a cgroup with processes
+  auto subtree = read_controllers(path_dir_parent / "cgroup.subtree_control");
+  for(auto const& controller : controllers)
+  {
+    continue_if(subtree.contains(controller));
+    write_value(path_dir_parent / "cgroup.subtree_control", "+" + controller)
+      .discard("D::Could not enable controller '{}' in '{}'", controller, path_dir_parent);
+  }
+  fs::path path_dir = path_dir_parent / name;
+  return_if(::mkdir(path_dir.c_str(), 0755) < 0 and errno != EEXIST
+    , Error("E::Could not create cgroup '{}': {}", path_dir, strerror(errno))
+  );
+  logger("D::Cgroup: {}", path_dir);
+  return std::unique_ptr<Cgroup>(new Cgroup(path_dir));
+}
+
+/**
+ * @brief Destroy the Cgroup object, the cgroup is removed once its processes exit
+ */
+inline Cgroup::~Cgroup()
+{
+  // Processes that outlive the sandbox by a few milliseconds keep the cgroup busy
+  for(int i = 0; i < 10; ++i)
+  {
+    break_if(::rmdir(m_path_dir.c_str()) == 0 or errno != EBUSY);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  log_if(fs::exists(m_path_dir), "D::Could not remove cgroup '{}'", m_path_dir);
+}
+
+/**
+ * @brief Checks if a controller is available in the cgroup
+ *
+ * @param controller The name of the controller
+ * @return bool True if the controller is available, false otherwise
+ */
+inline bool Cgroup::has_controller(std::string const& controller) const
+{
+  return read_controllers(m_path_dir / "cgroup.controllers").contains(controller);
+}
+
+/**
+ * @brief Writes a value to an interface file of the cgroup
+ *
+ * @param file Name of the interface file, e.g. 'memory.max'
+ * @param value The value to write
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> Cgroup::set(std::string const& file, std::string const& value) const
+{
+  std::string controller = file.substr(0, file.find('.'));
+  return_if(not has_controller(controller)
+    , Error("W::Controller '{}' is not available for '{}'", controller, file)
+  );
+  return_if(not write_value(m_path_dir / file, value), Error("W::Could not set '{}' to '{}'", file, value));
+  return {};
+}
+
+/**
+ * @brief Opens the file to move processes into the cgroup
+ *
+ * A forked child writes "0" to the returned descriptor to move itself into the cgroup before it
+ * executes, so none of its descendants start outside of it.
+ *
+ * @return Value<int> The file descriptor of 'cgroup.procs', or the respective error
+ */
+inline Value<int> Cgroup::open_procs() const
+{
+  fs::path path_file_procs = m_path_dir / "cgroup.procs";
+  int fd = ::open(path_file_procs.c_str(), O_WRONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("E::Could not open '{}': {}", path_file_procs, strerror(errno)));
+  return fd;
+}
+
+/**
+ * @brief Reads a flat keyed interface file, like 'cpu.stat'
+ *
+ * Values of lines with several keys, like the devices of 'io.stat', are summed by key.
+ *
+ * @param file Name of the interface file
+ * @return std::map<std::string,uint64_t> The values by key
+ */
+inline std::map<std::string,uint64_t> Cgroup::stat(fs::path const& file) const
+{
+  std::map<std::string,uint64_t> values;
+  std::ifstream stream(m_path_dir / file);
+  for(std::string token; stream >> token;)
+  {
+    // Flat files are 'key value', nested files are 'device key=value...'
+    if(auto pos = token.find('='); pos != std::string::npos)
+    {
+      values[token.substr(0, pos)] += Catch(std::stoull(token.substr(pos + 1))).value_or(0);
+    }
+    else if(uint64_t value; stream.peek() == ' ' and (stream >> value))
+    {
+      values[token] += value;
+    }
+    else
+    {
+      stream.clear();
+    }
+  }
+  return values;
+}
+
+/**
+ * @brief Builds a summary of the resources used by the cgroup
+ *
+ * @return std::string The cpu time, peak memory, io bytes and peak number of processes
+ */
+inline std::string Cgroup::accounting() const
+{
+  auto cpu = stat("cpu.stat");
+  auto io = stat("io.stat");
+  std::string memory_peak = read_line(m_path_dir / "memory.peak");
+  std::string pids_peak = read_line(m_path_dir / "pids.peak");
+  return std::format("cpu_usec={} user_usec={} system_usec={} memory_peak={} io_rbytes={} io_wbytes={} pids_peak={}"
+    , cpu["usage_usec"]
+    , cpu["user_usec"]
+    , cpu["system_usec"]
+    , memory_peak.empty()? "n/a" : memory_peak
+    , io["rbytes"]
+    , io["wbytes"]
+    , pids_peak.empty()? "n/a" : pids_peak
+  );
+}
+
+} // namespace ns_cgroup
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,176 @@
+/**
+ * @file ed25519.hpp
+ * @author Ruan Formigoni
+ * @brief Ed25519 signatures, to authenticate data published by the owner of a key
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <array>
+#include <format>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sodium.h>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_ed25519
+ * @brief Signs and verifies messages with Ed25519 keys, as in RFC 8032
+ *
+ * A key is its 32 byte seed, the public key is derived from it. The arithmetic is left to
+ * libsodium, which rejects signatures with a non-canonical scalar, so a signature can not be
+ * altered into another valid one.
+ */
+namespace ns_ed25519
+{
+
+namespace
+{
+
+/**
+ * @brief Initializes libsodium once
+ *
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> init()
+{
+  static int const code = ::sodium_init();
+  return_if(code < 0, Error("E::Could not initialize libsodium"));
+  return {};
+}
+
+} // namespace
+
+using Seed = std::array<uint8_t,32>;
+using PublicKey = std::array<uint8_t,32>;
+using Signature = std::array<uint8_t,64>;
+
+/**
+ * @brief Derives the public key of a seed
+ *
+ * @param seed The secret key
+ * @return Value<PublicKey> The public key, or the respective error
+ */
+[[nodiscard]] inline Value<PublicKey> public_key(Seed const& seed)
+{
+  Pop(init());
+  PublicKey key;
+  std::array<uint8_t,crypto_sign_SECRETKEYBYTES> key_secret;
+  int code = ::crypto_sign_seed_keypair(key.data(), key_secret.data(), seed.data());
+  ::sodium_memzero(key_secret.data(), key_secret.size());
+  return_if(code != 0, Error("E::Could not derive the public key"));
+  return key;
+}
+
+/**
+ * @brief Signs a message
+ *
+ * @param message The message
+ * @param seed The secret key
+ * @return Value<Signature> The signature, the same message and key always give the same signature
+ */
+[[nodiscard]] inline Value<Signature> sign(std::string_view message, Seed const& seed)
+{
+  Pop(init());
+  PublicKey key;
+  std::array<uint8_t,crypto_sign_SECRETKEYBYTES> key_secret;
+  Signature signature;
+  int code = ::crypto_sign_seed_keypair(key.data(), key_secret.data(), seed.data());
+  if(code == 0)
+  {
+    code = ::crypto_sign_detached(signature.data()
+      , nullptr
+      , reinterpret_cast<unsigned char const*>(message.data())
+      , message.size()
+      , key_secret.data()
+    );
+  }
+  ::sodium_memzero(key_secret.data(), key_secret.size());
+  return_if(code != 0, Error("E::Could not sign the message"));
+  return signature;
+}
+
+/**
+ * @brief Verifies the signature of a message
+ *
+ * @param message The message
+ * @param signature The signature
+ * @param key The public key of the signer
+ * @return bool Whether the signature was made for the message with the secret key of 'key'
+ */
+[[nodiscard]] inline bool verify(std::string_view message, Signature const& signature, PublicKey const& key)
+{
+  return_if(not init(), false);
+  return ::crypto_sign_verify_detached(signature.data()
+    , reinterpret_cast<unsigned char const*>(message.data())
+    , message.size()
+    , key.data()
+  ) == 0;
+}
+
+/**
+ * @brief Generates a random seed
+ *
+ * @return Value<Seed> The seed, or the respective error
+ */
+[[nodiscard]] inline Value<Seed> generate()
+{
+  Pop(init());
+  Seed seed;
+  ::randombytes_buf(seed.data(), seed.size());
+  return seed;
+}
+
+/**
+ * @brief Encodes bytes as hexadecimal
+ *
+ * @param data The bytes
+ * @return std::string The lowercase hexadecimal digits
+ */
+[[nodiscard]] inline std::string to_hex(std::span<uint8_t const> data)
+{
+  std::string str_hex;
+  for(uint8_t byte : data) { str_hex += std::format("{:02x}", byte); }
+  return str_hex;
+}
+
+/**
+ * @brief Decodes a key or signature from hexadecimal
+ *
+ * @tparam N The number of bytes
+ * @param str_hex The hexadecimal digits, surrounding whitespace is ignored
+ * @return Value<std::array<uint8_t,N>> The bytes, or the respective error
+ */
+template<size_t N>
+[[nodiscard]] inline Value<std::array<uint8_t,N>> from_hex(std::string_view str_hex)
+{
+  auto pos_begin = str_hex.find_first_not_of(" \t\n");
+  auto pos_end = str_hex.find_last_not_of(" \t\n");
+  str_hex = (pos_begin == std::string_view::npos)? std::string_view{} : str_hex.substr(pos_begin, pos_end - pos_begin + 1);
+  return_if(str_hex.size() != N * 2, Error("E::Expected {} hexadecimal digits, got {}", N * 2, str_hex.size()));
+  auto f_digit = [](char c) -> int
+  {
+    if(c >= '0' and c <= '9') { return c - '0'; }
+    if(c >= 'a' and c <= 'f') { return c - 'a' + 10; }
+    if(c >= 'A' and c <= 'F') { return c - 'A' + 10; }
+    return -1;
+  };
+  std::array<uint8_t,N> bytes;
+  for(size_t i = 0; i < N; ++i)
+  {
+    int high = f_digit(str_hex[2 * i]);
+    int low = f_digit(str_hex[2 * i + 1]);
+    return_if(high < 0 or low < 0, Error("E::Invalid hexadecimal digit in '{}'", str_hex));
+    bytes[i] = static_cast<uint8_t>(high * 16 + low);
+  }
+  return bytes;
+}
+
+} // namespace ns_ed25519
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
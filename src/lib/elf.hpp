@@ -14,7 +14,11 @@
 #include <elf.h>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <expected>
@@ -41,73 +45,148 @@ namespace fs = std::filesystem;
 #define ElfW(type) Elf32_ ## type
 #endif
 
+/**
+ * @brief Copies the binary data between [section.first, section.second] from fd_in to the start of fd_out
+ *
+ * The data is copied in the kernel with copy_file_range, falling back to sendfile when it is not
+ * available for the pair of files, e.g., across filesystems or into a memfd.
+ *
+ * @param fd_in The source file descriptor
+ * @param fd_out The target file descriptor, written from its current position
+ * @param section The section[start,end] to read from the input
+ * @return Value<void> Nothing on success or the respective error
+ */
+[[nodiscard]] inline Value<void> copy_range(int fd_in, int fd_out, std::pair<uint64_t,uint64_t> section)
+{
+  off_t offset_in = static_cast<off_t>(section.first);
+  bool is_copy_range = true;
+  for(uint64_t remaining = section.second - section.first; remaining > 0;)
+  {
+    ssize_t bytes = -1;
+    if(is_copy_range)
+    {
+      bytes = ::copy_file_range(fd_in, &offset_in, fd_out, nullptr, remaining, 0);
+      // Not available for this pair of files, e.g., across filesystems on older kernels
+      if(bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP or errno == EINVAL))
+      {
+        is_copy_range = false;
+        continue;
+      }
+    }
+    else
+    {
+      bytes = ::sendfile(fd_out, fd_in, &offset_in, remaining);
+    }
+    continue_if(bytes < 0 and errno == EINTR);
+    return_if(bytes <= 0, Error("E::Failed to copy data: {}", strerror(errno)));
+    remaining -= bytes;
+  }
+  return {};
+}
+
+/**
+ * @brief Copies the binary data between [offset.first, offset.second] from fd_in to path_file_output
+ *
+ * The data is copied with copy_range into a temporary file next to the output that is renamed over it once complete. An interrupted copy
+ * never leaves a truncated output behind. The input is read at explicit offsets, so threads can
+ * share its descriptor.
+ *
+ * @param fd_in The source file descriptor where to read the bytes from
+ * @param path_file_output The target file where to write the bytes to
+ * @param section The section[start,end] The section to read from the input and write to the output
+ * @param perms Permissions of the output file
+ * @return Value<void> Nothing on success or the respective error
+ */
+[[nodiscard]] inline Value<void> copy_binary(int fd_in
+  , fs::path const& path_file_output
+  , std::pair<uint64_t,uint64_t> section
+  , fs::perms perms = fs::perms::owner_all | fs::perms::group_all)
+{
+  fs::path path_file_temp = std::format("{}.tmp.{}", path_file_output.string(), getpid());
+  // Copies the section between the file descriptors
+  auto f_copy = [&](int fd_out) -> Value<void>
+  {
+    Pop(copy_range(fd_in, fd_out, section), "E::Failed to copy to '{}'", path_file_output);
+    return_if(::fchmod(fd_out, static_cast<mode_t>(perms)) < 0
+      , Error("E::Failed to set permissions of '{}': {}", path_file_output, strerror(errno))
+    );
+    return {};
+  };
+  // Open output file
+  int fd_out = ::open(path_file_temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0700);
+  return_if(fd_out < 0, Error("E::Failed to open out file {}", path_file_temp));
+  auto result = f_copy(fd_out);
+  ::close(fd_out);
+  // Publish the complete file, or drop the partial one
+  if(result and ::rename(path_file_temp.c_str(), path_file_output.c_str()) < 0)
+  {
+    result = Error("E::Failed to rename '{}' to '{}': {}", path_file_temp, path_file_output, strerror(errno));
+  }
+  if(not result)
+  {
+    ::unlink(path_file_temp.c_str());
+  }
+  return result;
+}
+
 /**
  * @brief Copies the binary data between [offset.first, offset.second] from path_file_input to path_file_output
- * 
+ *
  * @param path_file_input The source file where to read the bytes from
  * @param path_file_output The target file where to write the bytes to
  * @param section The section[start,end] The section to read from the input and write to the output
+ * @param perms Permissions of the output file
  * @return Value<void> Nothing on success or the respective error
  */
 [[nodiscard]] inline Value<void> copy_binary(fs::path const& path_file_input
   , fs::path const& path_file_output
-  , std::pair<uint64_t,uint64_t> section)
+  , std::pair<uint64_t,uint64_t> section
+  , fs::perms perms = fs::perms::owner_all | fs::perms::group_all)
 {
-  // Open source and output files
-  std::ifstream f_in{path_file_input, std::ios::binary};
-  return_if(not f_in.is_open(), Error("E::Failed to open in file {}", path_file_input));
-  std::ofstream f_out{path_file_output, std::ios::binary};
-  return_if(not f_out.is_open(), Error("E::Failed to open out file {}", path_file_output));
-  // Calculate the size of the data to read
-  uint64_t size = section.second - section.first;
-  // Seek to the start offset in the input file
-  f_in.seekg(section.first, std::ios::beg);
-  // Read in chunks
-  const size_t size_buf = 4096;
-  char buffer[size_buf];
-  while( size > 0 )
-  {
-    std::streamsize read_size = static_cast<std::streamsize>(std::min(static_cast<uint64_t>(size_buf), size));
-    f_in.read(buffer, read_size);
-    f_out.write(buffer, read_size);
-    size -= read_size;
-  } // while
-  return {};
+  int fd_in = ::open(path_file_input.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd_in < 0, Error("E::Failed to open in file {}", path_file_input));
+  auto result = copy_binary(fd_in, path_file_output, section, perms);
+  ::close(fd_in);
+  return result;
 }
 
 /**
  * @brief Skips the elf header starting from 'offset' and returns the offset to the first byte afterwards
  *
- * @param path_file_elf Path to the respective elf file
+ * The header is read with a single pread, so one descriptor serves every ELF of a file.
+ *
+ * @param fd File descriptor of the respective elf file
  * @param offset Offset where the elf section starts
  * @return Value<uint64_t> The offset to the first byte after the ELF header, or the respective error
  */
-[[nodiscard]] inline Value<uint64_t> skip_elf_header(fs::path const& path_file_elf
-  , uint64_t offset = 0)
+[[nodiscard]] inline Value<uint64_t> skip_elf_header(int fd, uint64_t offset = 0)
 {
-  struct File
-  {
-    FILE* ptr;
-    File(FILE* ptr) : ptr(ptr) {};
-    ~File() { if(ptr) { ::fclose(ptr); } }
-  };
   // Either Elf64_Ehdr or Elf32_Ehdr depending on architecture.
   ElfW(Ehdr) header;
-  // Try to open header file
-  File file(fopen(path_file_elf.c_str(), "rb"));
-  return_if(file.ptr == nullptr, Error("E::Could not open file '{}': {}", path_file_elf, strerror(errno)));
-  // Seek the position to read the header
-  return_if(fseek(file.ptr, offset, SEEK_SET) < 0
-    , Error("E::Could not seek in file '{}': {}", path_file_elf, strerror(errno))
-  )
   // read the header
-  return_if(fread(&header, sizeof(header), 1, file.ptr) != 1
+  return_if(::pread(fd, &header, sizeof(header), static_cast<off_t>(offset)) != sizeof(header)
     , Error("E::Could not read elf header")
   );
   // check so its really an elf file
-  return_if(std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0, Error("E::'{}' not an elf file", path_file_elf));
-  offset = header.e_shoff + (header.e_ehsize * header.e_shnum);
-  return offset;
+  return_if(std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0, Error("E::Not an elf file at offset '{}'", offset));
+  return header.e_shoff + (header.e_ehsize * header.e_shnum);
+}
+
+/**
+ * @brief Skips the elf header starting from 'offset' and returns the offset to the first byte afterwards
+ *
+ * @param path_file_elf Path to the respective elf file
+ * @param offset Offset where the elf section starts
+ * @return Value<uint64_t> The offset to the first byte after the ELF header, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> skip_elf_header(fs::path const& path_file_elf
+  , uint64_t offset = 0)
+{
+  int fd = ::open(path_file_elf.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("E::Could not open file '{}': {}", path_file_elf, strerror(errno)));
+  auto ret = skip_elf_header(fd, offset);
+  ::close(fd);
+  return ret;
 }
 
 } // namespace ns_elf
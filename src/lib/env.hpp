@@ -8,8 +8,14 @@
 
 #pragma once
 
+#include <cctype>
 #include <concepts>
 #include <cstdlib>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <wordexp.h>
 #include <ranges>
 
@@ -86,9 +92,76 @@ inline bool exists(std::string_view name, std::string_view value)
   return std::string_view{value_real} == value;
 }
 
+/**
+ * @brief Checks if expand() returns a string unchanged
+ *
+ * A string is literal when it has no variable references, no leading tilde and nothing else
+ * a shell would interpret. Literal strings can be used as they are, without expanding them.
+ *
+ * @param var The string to check
+ * @return bool True if the string is literal, false otherwise
+ */
+[[nodiscard]] inline bool is_literal(std::string_view var) noexcept
+{
+  return not var.starts_with('~') and var.find_first_of("$`'\"\\*?[|&;<>()") == std::string_view::npos;
+}
+
+/**
+ * @brief Expands the variables of a string without a shell
+ *
+ * Handles `$VAR`, `${VAR}` and a leading `~` or `~/`, undefined variables expand to an empty
+ * string. Anything else a shell would interpret, like quotes, escapes, globs, command
+ * substitutions or `${VAR:-default}`, makes it give up. Variable values are not split into words.
+ *
+ * @param var Source string to expand
+ * @return std::optional<std::string> The expanded string, or nothing if it needs a shell
+ */
+[[nodiscard]] inline std::optional<std::string> expand_builtin(std::string_view var)
+{
+  auto f_is_name = [](char c, bool is_first)
+  {
+    return c == '_' or std::isalpha(static_cast<unsigned char>(c)) or (not is_first and std::isdigit(static_cast<unsigned char>(c)));
+  };
+  return_if(var.find_first_of("`'\"\\*?[|&;<>()") != std::string_view::npos, std::nullopt);
+  std::string expanded;
+  // Tilde prefix, ~user is left to wordexp
+  if(var.starts_with('~'))
+  {
+    return_if(var.size() > 1 and var[1] != '/', std::nullopt);
+    char const* home = std::getenv("HOME");
+    return_if(home == nullptr, std::nullopt);
+    expanded = home;
+    var.remove_prefix(1);
+  }
+  for(size_t pos = 0; pos < var.size();)
+  {
+    size_t dollar = var.find('$', pos);
+    expanded.append(var.substr(pos, dollar - pos));
+    break_if(dollar == std::string_view::npos);
+    size_t beg = dollar + 1;
+    bool is_braced = beg < var.size() and var[beg] == '{';
+    if(is_braced) { ++beg; }
+    size_t end = beg;
+    while(end < var.size() and f_is_name(var[end], end == beg)) { ++end; }
+    // Special parameters ($$, $1, ...) or operators inside the braces
+    return_if(end == beg, std::nullopt);
+    return_if(is_braced and (end >= var.size() or var[end] != '}'), std::nullopt);
+    if(char const* value = std::getenv(std::string(var.substr(beg, end - beg)).c_str()))
+    {
+      expanded.append(value);
+    }
+    pos = is_braced? end + 1 : end;
+  }
+  return expanded;
+}
+
 /**
  * @brief Performs variable expansion analogous to a POSIX shell
  *
+ * Plain variable references are expanded in-process by expand_builtin. Strings that need a shell
+ * go through wordexp on every call, their result depends on the environment and on the commands
+ * they substitute, so it is not cached.
+ *
  * @tparam auto Type that is string representable (constrained by concept)
  * @param var Source string to expand
  * @return Value<std::string> The expanded value or the respective error
@@ -97,6 +170,18 @@ inline Value<std::string> expand(ns_concept::StringRepresentable auto&& var)
 {
   std::string expanded = ns_string::to_string(var);
 
+  // Nothing to expand
+  if(is_literal(expanded))
+  {
+    return expanded;
+  }
+
+  // Expand without a shell
+  if(auto builtin = expand_builtin(expanded))
+  {
+    return *builtin;
+  }
+
   // Perform word expansion
   wordexp_t data;
   if (int ret = wordexp(expanded.c_str(), &data, 0); ret == 0)
@@ -141,27 +226,106 @@ inline Value<T> xdg_data_home() noexcept
   return std::string{home} + "/.local/share";
 }
 
+/**
+ * @brief Returns or computes the value of XDG_CACHE_HOME
+ *
+ * @tparam T The return type for the path (defaults to std::string, can be fs::path or other string-convertible types)
+ * @return Value<T> The path to XDG_CACHE_HOME or the respective error
+ */
+template<typename T = std::string>
+inline Value<T> xdg_cache_home() noexcept
+{
+  const char* var = std::getenv("XDG_CACHE_HOME");
+  return_if(var, var);
+  const char* home = std::getenv("HOME");
+  return_if(not home, Error("E::HOME is undefined"));
+  return std::string{home} + "/.cache";
+}
+
+/**
+ * @brief Hook called by search_path before it searches the PATH directories
+ *
+ * Lets the program provide files on demand, e.g., extract them, right before they are needed.
+ *
+ * @return std::function<void(std::string const&)>& The hook, empty by default
+ */
+inline std::function<void(std::string const&)>& search_path_hook()
+{
+  static std::function<void(std::string const&)> hook;
+  return hook;
+}
+
+/**
+ * @brief Files known to exist in a directory, which search_path returns without a stat
+ *
+ * Set by the program for the tools it ships, only used while the directory is the first entry of
+ * PATH, so the result is the same as a search.
+ */
+struct SearchPathShipped
+{
+  fs::path path_dir;
+  std::set<std::string> names;
+};
+
+/**
+ * @brief The tools shipped in a directory, for search_path
+ *
+ * @return SearchPathShipped& The shipped tools, none by default
+ */
+inline SearchPathShipped& search_path_shipped()
+{
+  static SearchPathShipped shipped;
+  return shipped;
+}
+
 /**
  * @brief Search the directories in the PATH variable for the given input file name
  *
+ * Results are cached per process until PATH changes.
+ *
  * @param query The file name to search for in PATH directories
  * @return Value<fs::path> The path of the found file or the respective error
  */
 [[nodiscard]] inline Value<fs::path> search_path(std::string const& query)
 {
+  if(auto const& hook = search_path_hook()) { hook(query); }
   std::string env_path = Pop(ns_env::get_expected("PATH"));
   // Query should be a file name
   if ( fs::path{query}.is_absolute() )
   {
     return Error("E::Query should be a file name, not an absolute path");
   }
-  // Search directories in PATH
-  for(fs::path directory : env_path
+  // Lookup previous results, they are valid while PATH stays the same
+  static std::mutex mutex;
+  static std::string cache_path;
+  static std::map<std::string,fs::path> cache;
+  std::lock_guard lock(mutex);
+  if(cache_path != env_path)
+  {
+    cache.clear();
+    cache_path = env_path;
+  }
+  if(auto it = cache.find(query); it != cache.end())
+  {
+    return it->second;
+  }
+  std::vector<std::string> directories = env_path
     | std::views::split(':')
-    | std::ranges::to<std::vector<std::string>>())
+    | std::ranges::to<std::vector<std::string>>();
+  // Tools shipped in the first directory of PATH
+  if(auto const& shipped = search_path_shipped();
+    not directories.empty()
+    and not shipped.path_dir.empty()
+    and fs::path{directories.front()} == shipped.path_dir
+    and shipped.names.contains(query))
+  {
+    return cache[query] = shipped.path_dir / query;
+  }
+  // Search directories in PATH
+  for(fs::path directory : directories)
   {
     fs::path path_full = directory / query;
-    return_if(fs::exists(path_full), path_full);
+    return_if(fs::exists(path_full), cache[query] = path_full);
   }
   return Error("E::File not found in PATH");
 }
@@ -8,14 +8,21 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
+#include <fcntl.h>
+#include <poll.h>
 #include <filesystem>
 #include <expected>
 #include <sys/vfs.h>
 #include <sys/mount.h>
+#include <optional>
 #include <thread>
+#include <vector>
 
 #include "subprocess.hpp"
+#include "linux.hpp"
 #include "env.hpp"
 #include "../std/expected.hpp"
 
@@ -59,70 +66,155 @@ inline Value<bool> is_fuse(fs::path const& path_dir_mount)
   return buf.f_type == FUSE_SUPER_MAGIC;
 }
 
+namespace
+{
+
 /**
- * @brief Waits for the given directory to not be fuse
+ * @brief Waits for all the given directories to be fuse, or to stop being fuse
  *
- * @param path_dir_filesystem Path to the directory to wait for
- * @return void This function does not return a value. It waits until the filesystem is no longer a FUSE mount or timeout occurs.
+ * Instead of spinning on statfs, the mount table at '/proc/self/mountinfo' is watched with
+ * poll, which the kernel wakes with POLLPRI whenever a mount is added or removed. Every pending
+ * mountpoint is checked on each wake, so the total wait is bounded by the slowest mount instead
+ * of the sum of all of them. The time each mountpoint took to become ready is logged.
+ *
+ * @param vec_path_dir_filesystem Paths to the directories to wait for
+ * @param is_mounted True to wait for the mounts, false to wait for the un-mounts
+ * @param timeout Maximum time to wait for all the filesystems
  */
-inline void wait_fuse(fs::path const& path_dir_filesystem)
+inline void wait_state(std::vector<fs::path> vec_path_dir_filesystem
+  , bool is_mounted
+  , std::chrono::milliseconds const& timeout)
 {
   using namespace std::chrono_literals;
-  auto time_beg = std::chrono::system_clock::now();
+  auto time_beg = std::chrono::steady_clock::now();
+  // Open the mount table before the first check, so no mount event is missed
+  // The poll event counter is snapshotted on open
+  int fd_mountinfo = ::open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+  log_if(fd_mountinfo < 0, "W::Could not watch mountinfo, falling back to polling: {}", strerror(errno));
   while ( true )
   {
-    auto expected_is_fuse = ns_fuse::is_fuse(path_dir_filesystem);
-    break_if(not expected_is_fuse, "E::Could not check if filesystem is fuse");
-    break_if(*expected_is_fuse, "D::Filesystem '{}' is fuse", path_dir_filesystem.string());
-    auto time_cur = std::chrono::system_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(time_cur - time_beg);
-    break_if(elapsed.count() > 60, "E::Reached timeout to wait for fuse filesystems");
+    // Drop the mountpoints that are ready or that can no longer be checked
+    std::erase_if(vec_path_dir_filesystem, [&](fs::path const& path_dir_filesystem)
+    {
+      struct statfs buf;
+      return_if(::statfs(path_dir_filesystem.c_str(), &buf) < 0, true
+        , "E::Could not check if filesystem '{}' is fuse: {}", path_dir_filesystem, strerror(errno)
+      );
+      return_if((buf.f_type == FUSE_SUPER_MAGIC) == is_mounted, true, "D::Filesystem '{}' is {} after {}ms"
+        , path_dir_filesystem
+        , is_mounted? "fuse" : "un-mounted"
+        , std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_beg).count()
+      );
+      return false;
+    });
+    break_if(vec_path_dir_filesystem.empty());
+    // Check for timeout
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_beg);
+    break_if(elapsed > timeout, "E::Reached timeout to wait for '{}' fuse filesystems", vec_path_dir_filesystem.size());
+    // Sleep until the mount table changes, the cap on the wait covers a mount that happens in
+    // another mount namespace or a failed watch
+    auto wait = std::min(std::chrono::duration_cast<std::chrono::milliseconds>(timeout - elapsed), 100ms);
+    if (fd_mountinfo < 0)
+    {
+      std::this_thread::sleep_for(std::min(wait, 10ms));
+    }
+    else
+    {
+      std::ignore = ns_linux::poll_with_timeout(fd_mountinfo, POLLPRI, wait);
+    }
   } // while
-} // function: wait_fuse
+  if (fd_mountinfo >= 0) { ::close(fd_mountinfo); }
+} // function: wait_state
 
+} // namespace
 
 /**
- * @brief Un-mounts the given fuse mount point
+ * @brief Waits for all the given directories to be fuse
  *
- * @param path_dir_mount Path to the mount point to un-mount
- * @return Value<void> Nothing on success, or the respective error
+ * @param vec_path_dir_filesystem Paths to the directories to wait for
+ * @param timeout Maximum time to wait for all the filesystems
  */
-inline Value<int> unmount(fs::path const& path_dir_mount)
+inline void wait_fuse(std::vector<fs::path> vec_path_dir_filesystem
+  , std::chrono::milliseconds const& timeout = std::chrono::seconds(60))
 {
-  using namespace std::chrono_literals;
-
-  // Find fusermount
-  auto path_file_fusermount = Pop(ns_env::search_path("fusermount"));
-
-  // Un-mount filesystem
-  using enum ns_subprocess::Stream;
-  auto child = ns_subprocess::Subprocess(path_file_fusermount)
-    .with_args("-zu", path_dir_mount)
-    .spawn();
-
-  // Check if process was started
-  return_if(not child, Error("E::Could not spawn fusermount"));
+  wait_state(std::move(vec_path_dir_filesystem), true, timeout);
+} // function: wait_fuse
 
-  // Retrieve return code
-  int code = Pop(child->wait());
+/**
+ * @brief Waits for the given directory to be fuse
+ *
+ * @param path_dir_filesystem Path to the directory to wait for
+ * @return void This function does not return a value. It waits until the filesystem is a FUSE mount or timeout occurs.
+ */
+inline void wait_fuse(fs::path const& path_dir_filesystem)
+{
+  wait_fuse(std::vector<fs::path>{path_dir_filesystem});
+} // function: wait_fuse
 
-  // Check for successful un-mount
-  if(code == 0)
-  {
-    logger("D::Un-mounted filesystem '{}'", path_dir_mount.string());
-  }
-  else
+/**
+ * @brief Un-mounts the given fuse mount points in one pass
+ *
+ * Mount points should be ordered top-down, e.g., casefold, overlay then the layers. Each one is
+ * first detached with umount2, which succeeds when the mount namespace is owned by the caller.
+ * The others are detached by fusermount processes that run concurrently, then the removal of
+ * all of them is awaited at once. Directories that are not fuse mounts are skipped.
+ *
+ * @param vec_path_dir_mount Paths to the mount points to un-mount
+ * @param timeout Maximum time to wait for all the filesystems to disappear
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> unmount(std::vector<fs::path> const& vec_path_dir_mount
+  , std::chrono::milliseconds const& timeout = std::chrono::seconds(60))
+{
+  std::vector<fs::path> vec_path_dir_pending;
+  std::vector<std::pair<fs::path,std::unique_ptr<ns_subprocess::Child>>> vec_children;
+  std::optional<fs::path> path_file_fusermount;
+  for(fs::path const& path_dir_mount : vec_path_dir_mount)
   {
-    logger("D::Failed to un-mount filesystem '{}'", path_dir_mount.string());
+    // Disconnected mounts fail to stat, they are still un-mounted
+    auto is_fuse = ns_fuse::is_fuse(path_dir_mount);
+    continue_if(is_fuse and not *is_fuse);
+    vec_path_dir_pending.push_back(path_dir_mount);
+    // Detach directly, without forking
+    if(::umount2(path_dir_mount.c_str(), MNT_DETACH) == 0)
+    {
+      logger("D::Un-mounted filesystem '{}'", path_dir_mount.string());
+      continue;
+    }
+    // Fall back to the setuid helper
+    if(not path_file_fusermount)
+    {
+      path_file_fusermount = Pop(ns_env::search_path("fusermount"));
+    }
+    auto child = ns_subprocess::Subprocess(*path_file_fusermount)
+      .with_args("-zu", path_dir_mount)
+      .spawn();
+    continue_if(not child, "E::Could not spawn fusermount for '{}'", path_dir_mount);
+    vec_children.emplace_back(path_dir_mount, std::move(child));
   }
-
-  // Filesystem could be busy for a bit after un-mount
-  while(Pop(ns_fuse::is_fuse(path_dir_mount)))
+  // Retrieve return codes
+  uint64_t count_failed = 0;
+  for(auto&& [path_dir_mount, child] : vec_children)
   {
-    std::this_thread::sleep_for(100ms);
+    int code = child->wait().value_or(-1);
+    count_failed += (code != 0);
+    logger("D::{} filesystem '{}'", (code == 0)? "Un-mounted" : "Failed to un-mount", path_dir_mount.string());
   }
+  // Filesystems could be busy for a bit after un-mount
+  wait_state(vec_path_dir_pending, false, timeout);
+  return_if(count_failed > 0, Error("E::Failed to un-mount {} filesystems", count_failed));
+  return {};
+} // function: unmount
 
-  return code;
+/**
+ * @brief Un-mounts the given fuse mount point
+ *
+ * @param path_dir_mount Path to the mount point to un-mount
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> unmount(fs::path const& path_dir_mount)
+{
+  return unmount(std::vector<fs::path>{path_dir_mount});
 } // function: unmount
 
 } // namespace ns_fuse
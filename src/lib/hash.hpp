@@ -0,0 +1,217 @@
+/**
+ * @file hash.hpp
+ * @author Ruan Formigoni
+ * @brief A streaming implementation of the XXH64 hash
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/**
+ * @namespace ns_hash
+ * @brief Non-cryptographic hashes of large inputs
+ *
+ * XXH64 processes 32 bytes per step in four independent lanes, which the compiler keeps in
+ * registers, so hashing runs close to the memory bandwidth. The output matches the reference
+ * implementation, hashes computed here can be checked with 'xxhsum -H1'.
+ */
+namespace ns_hash
+{
+
+namespace
+{
+
+constexpr uint64_t const PRIME_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t const PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t const PRIME_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t const PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t const PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+[[nodiscard]] inline uint64_t read_u64(char const* data)
+{
+  uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+[[nodiscard]] inline uint32_t read_u32(char const* data)
+{
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+[[nodiscard]] inline uint64_t round(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME_2;
+  acc = std::rotl(acc, 31);
+  return acc * PRIME_1;
+}
+
+[[nodiscard]] inline uint64_t merge(uint64_t acc, uint64_t lane)
+{
+  acc ^= round(0, lane);
+  return acc * PRIME_1 + PRIME_4;
+}
+
+} // namespace
+
+/**
+ * @class Xxh64
+ * @brief Computes the XXH64 hash of data given in chunks
+ *
+ * @code
+ * ns_hash::Xxh64 hash;
+ * hash.update("hello ");
+ * hash.update("world");
+ * uint64_t value = hash.digest();
+ * @endcode
+ */
+class Xxh64
+{
+  private:
+    std::array<uint64_t,4> m_lanes;
+    std::array<char,32> m_buffer{};
+    size_t m_size_buffer;
+    uint64_t m_size_total;
+    uint64_t m_seed;
+
+    void stripe(char const* data);
+
+  public:
+    explicit Xxh64(uint64_t seed = 0);
+    void update(std::string_view data);
+    [[nodiscard]] uint64_t digest() const;
+};
+
+/**
+ * @brief Creates a hash state
+ *
+ * @param seed Seed of the hash
+ */
+inline Xxh64::Xxh64(uint64_t seed)
+  : m_lanes{seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1}
+  , m_size_buffer(0)
+  , m_size_total(0)
+  , m_seed(seed)
+{
+}
+
+/**
+ * @brief Mixes 32 bytes into the lanes
+ *
+ * @param data Pointer to the 32 bytes
+ */
+inline void Xxh64::stripe(char const* data)
+{
+  for(size_t i = 0; i < m_lanes.size(); ++i)
+  {
+    m_lanes[i] = round(m_lanes[i], read_u64(data + i * sizeof(uint64_t)));
+  }
+}
+
+/**
+ * @brief Adds data to the hash
+ *
+ * @param data The next chunk of the input
+ */
+inline void Xxh64::update(std::string_view data)
+{
+  if(data.empty()) { return; }
+  m_size_total += data.size();
+  // Complete the buffered stripe
+  if(m_size_buffer > 0)
+  {
+    size_t size_fill = std::min(m_buffer.size() - m_size_buffer, data.size());
+    std::memcpy(m_buffer.data() + m_size_buffer, data.data(), size_fill);
+    m_size_buffer += size_fill;
+    data.remove_prefix(size_fill);
+    if(m_size_buffer < m_buffer.size()) { return; }
+    stripe(m_buffer.data());
+    m_size_buffer = 0;
+  }
+  // Mix whole stripes directly from the input
+  for(; data.size() >= m_buffer.size(); data.remove_prefix(m_buffer.size()))
+  {
+    stripe(data.data());
+  }
+  // Keep the rest for the next update
+  std::memcpy(m_buffer.data(), data.data(), data.size());
+  m_size_buffer = data.size();
+}
+
+/**
+ * @brief Computes the hash of the data added so far
+ *
+ * @return uint64_t The hash, the state is not modified
+ */
+inline uint64_t Xxh64::digest() const
+{
+  uint64_t hash;
+  if(m_size_total >= m_buffer.size())
+  {
+    hash = std::rotl(m_lanes[0], 1) + std::rotl(m_lanes[1], 7) + std::rotl(m_lanes[2], 12) + std::rotl(m_lanes[3], 18);
+    for(uint64_t lane : m_lanes)
+    {
+      hash = merge(hash, lane);
+    }
+  }
+  else
+  {
+    hash = m_seed + PRIME_5;
+  }
+  hash += m_size_total;
+  // Mix the buffered bytes
+  char const* data = m_buffer.data();
+  size_t size = m_size_buffer;
+  for(; size >= 8; data += 8, size -= 8)
+  {
+    hash ^= round(0, read_u64(data));
+    hash = std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+  }
+  if(size >= 4)
+  {
+    hash ^= static_cast<uint64_t>(read_u32(data)) * PRIME_1;
+    hash = std::rotl(hash, 23) * PRIME_2 + PRIME_3;
+    data += 4;
+    size -= 4;
+  }
+  for(; size > 0; ++data, --size)
+  {
+    hash ^= static_cast<uint64_t>(static_cast<uint8_t>(*data)) * PRIME_5;
+    hash = std::rotl(hash, 11) * PRIME_1;
+  }
+  // Avalanche
+  hash ^= hash >> 33;
+  hash *= PRIME_2;
+  hash ^= hash >> 29;
+  hash *= PRIME_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+/**
+ * @brief Computes the XXH64 hash of a buffer
+ *
+ * @param data The input
+ * @param seed Seed of the hash
+ * @return uint64_t The hash
+ */
+[[nodiscard]] inline uint64_t xxh64(std::string_view data, uint64_t seed = 0)
+{
+  Xxh64 hash(seed);
+  hash.update(data);
+  return hash.digest();
+}
+
+} // namespace ns_hash
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
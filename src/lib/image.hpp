@@ -8,25 +8,32 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <format>
+#include <span>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <boost/gil.hpp>
 #include <boost/gil/extension/io/jpeg.hpp>
 #include <boost/gil/extension/io/png.hpp>
 #include <boost/gil/extension/numeric/sampler.hpp>
 #include <boost/gil/extension/numeric/resample.hpp>
 
-#include "env.hpp"
 #include "log.hpp"
-#include "subprocess.hpp"
 #include "../std/enum.hpp"
+#include "../std/expected.hpp"
 
 /**
  * @namespace ns_image
  * @brief Image processing utilities
  *
- * Handles image file operations including PNG and JPEG processing, icon resizing using
- * ImageMagick, and format conversion. Supports reading image dimensions, resizing to
- * standard icon sizes, and converting between image formats for desktop integration.
+ * Handles image file operations including PNG and JPEG processing, icon resizing and format
+ * conversion. Images are decoded and resized in-process with Boost.GIL, a source image is decoded
+ * once and resized to all the standard icon sizes in parallel.
  */
 namespace ns_image
 {
@@ -35,73 +42,216 @@ namespace
 {
 
 namespace fs = std::filesystem;
+namespace gil = boost::gil;
 
 ENUM(ImageFormat, JPG, PNG);
 
 /**
- * @brief Internal implementation for resizing an image
+ * @brief Determines the format of an image from the extension of its file
  *
- * Reads an image file, determines its format (JPG or PNG), and resizes it
- * using ImageMagick to the specified dimensions. The resize maintains aspect
- * ratio by using the larger dimension (width or height) as the constraint.
+ * @param path_file The path to the image file
+ * @return Value<ImageFormat> The format of the image, or the respective error
+ */
+[[nodiscard]] inline Value<ImageFormat> get_format(fs::path const& path_file)
+{
+  std::string ext = Try(path_file.extension().string());
+  std::ranges::transform(ext, ext.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
+  return (ext == ".jpg" || ext == ".jpeg") ? Value<ImageFormat>(ImageFormat::JPG) :
+    (ext == ".png") ? Value<ImageFormat>(ImageFormat::PNG) :
+    Error("E::Image of invalid format: '{}'", ext);
+}
+
+/**
+ * @brief Halves the dimensions of an image by averaging blocks of 2x2 pixels
+ *
+ * Bilinear sampling reads only four source pixels for each target pixel, large reductions skip
+ * most of the source and alias. Halving first keeps the detail of every source pixel.
+ *
+ * @param src The image to halve, at least 2x2 pixels
+ * @return gil::rgba8_image_t The halved image
+ */
+[[nodiscard]] inline gil::rgba8_image_t halve(gil::rgba8_image_t const& src)
+{
+  auto view_src = gil::const_view(src);
+  gil::rgba8_image_t dst(view_src.width() / 2, view_src.height() / 2);
+  auto view_dst = gil::view(dst);
+  for(std::ptrdiff_t y = 0; y < view_dst.height(); ++y)
+  {
+    auto it_top = view_src.row_begin(2 * y);
+    auto it_bottom = view_src.row_begin(2 * y + 1);
+    auto it_dst = view_dst.row_begin(y);
+    for(std::ptrdiff_t x = 0; x < view_dst.width(); ++x)
+    {
+      for(int c = 0; c < 4; ++c)
+      {
+        uint32_t sum = it_top[2 * x][c] + it_top[2 * x + 1][c] + it_bottom[2 * x][c] + it_bottom[2 * x + 1][c];
+        it_dst[x][c] = static_cast<uint8_t>((sum + 2) / 4);
+      }
+    }
+  }
+  return dst;
+}
+
+/**
+ * @brief Resizes an image and writes it to a file
+ *
+ * The resize maintains the aspect ratio by using the larger dimension (width or height) of the
+ * source as the constraint.
  *
- * @param path_file_src Path to the source image file
- * @param path_file_dst Path to the destination image file
+ * @param img The decoded source image
+ * @param path_file_dst Path to the destination image file, its extension selects the format
  * @param width Target width for the resized image
  * @param height Target height for the resized image
- * @return Value<void> Nothing on success, or error if file doesn't exist,
- *         format is invalid, or ImageMagick resize fails
+ * @return Value<void> Nothing on success, or the respective error
  */
-inline Value<void> resize_impl(fs::path const& path_file_src
+[[nodiscard]] inline Value<void> write_resized(gil::rgba8_image_t const& img
   , fs::path const& path_file_dst
   , uint32_t width
   , uint32_t height)
 {
-  namespace gil = boost::gil;
+  ImageFormat format = Pop(get_format(path_file_dst));
+  return_if(img.width() <= 0 or img.height() <= 0 or width == 0 or height == 0
+    , Error("E::Invalid dimensions to resize to '{}'", path_file_dst)
+  );
+  // Target dimensions, keep the aspect ratio of the source
+  double ratio = static_cast<double>(img.width()) / static_cast<double>(img.height());
+  auto [width_dst, height_dst] = (img.width() > img.height())?
+      std::pair<std::ptrdiff_t,std::ptrdiff_t>(width, std::max<std::ptrdiff_t>(1, std::lround(width / ratio)))
+    : std::pair<std::ptrdiff_t,std::ptrdiff_t>(std::max<std::ptrdiff_t>(1, std::lround(height * ratio)), height);
+  // Halve large sources close to the target size
+  gil::rgba8_image_t img_half;
+  gil::rgba8_image_t const* ptr_src = &img;
+  while(ptr_src->width() >= 2 * width_dst and ptr_src->height() >= 2 * height_dst)
+  {
+    img_half = halve(*ptr_src);
+    ptr_src = &img_half;
+  }
+  gil::rgba8_image_t img_dst(width_dst, height_dst);
+  gil::resize_view(gil::const_view(*ptr_src), gil::view(img_dst), gil::bilinear_sampler());
+  logger("I::Saving image to {} ({}x{})", path_file_dst, std::to_string(width_dst), std::to_string(height_dst));
+  if (format == ImageFormat::JPG)
+  {
+    Try(gil::write_view(path_file_dst.string()
+      , gil::color_converted_view<gil::rgb8_pixel_t>(gil::const_view(img_dst))
+      , gil::jpeg_tag()
+    ));
+  }
+  else
+  {
+    Try(gil::write_view(path_file_dst.string(), gil::const_view(img_dst), gil::png_tag()));
+  }
+  return {};
+}
+
+} // namespace
 
-  // Create icon directory and set file name
+/**
+ * @brief A file to write a resized image to
+ */
+struct Target
+{
+  fs::path path_file_dst; ///< Path to the output image file
+  uint32_t width;         ///< Target width of the output image
+  uint32_t height;        ///< Target height of the output image
+};
+
+/**
+ * @brief Decodes an image file
+ *
+ * @param path_file_src Path to the image file, a JPG or PNG
+ * @return Value<gil::rgba8_image_t> The decoded image, or error if the file doesn't exist, its
+ * format is invalid, or it fails to decode
+ */
+[[nodiscard]] inline Value<gil::rgba8_image_t> read(fs::path const& path_file_src)
+{
   logger("I::Reading image {}", path_file_src);
   return_if(not Try(fs::is_regular_file(path_file_src))
     , Error("E::File '{}' does not exist or is not a regular file", path_file_src)
   );
-
-  // Determine image format
-  std::string ext = Try(path_file_src.extension().string());
-  std::ranges::transform(ext, ext.begin(), [](unsigned char c){ return static_cast<char>(std::tolower(c)); });
-
-  ImageFormat format = Pop(
-    (ext == ".jpg" || ext == ".jpeg") ? Value<ImageFormat>(ImageFormat::JPG) :
-    (ext == ".png") ? Value<ImageFormat>(ImageFormat::PNG) :
-    Error("E::Input image of invalid format: '{}'", ext)
-  );
-
-  // Read image into memory
+  ImageFormat format = Pop(get_format(path_file_src));
   gil::rgba8_image_t img;
   if (format == ImageFormat::JPG)
   {
-    Try(gil::read_and_convert_image(path_file_src, img, gil::jpeg_tag()));
+    Try(gil::read_and_convert_image(path_file_src.string(), img, gil::jpeg_tag()));
   }
-  else if (format == ImageFormat::PNG)
+  else
   {
-    Try(gil::read_and_convert_image(path_file_src, img, gil::png_tag()));
+    Try(gil::read_and_convert_image(path_file_src.string(), img, gil::png_tag()));
   }
   logger("I::Image size is {}x{}", std::to_string(img.width()), std::to_string(img.height()));
-  logger("I::Saving image to {}", path_file_dst);
-  // Search for imagemagick
-  fs::path path_bin_magick = Pop(ns_env::search_path("magick"));
-  // Resize
-  Pop(ns_subprocess::Subprocess(path_bin_magick)
-    .with_args(path_file_src)
-    .with_args("-resize", (img.width() > img.height())? std::format("{}x", width) : std::format("x{}", height))
-    .with_args(path_file_dst)
-    .spawn()->wait());
-  return {};
+  return img;
 }
 
-} // namespace
-
+/**
+ * @brief Decodes an image from memory
+ *
+ * @param data The contents of an image file
+ * @param ext The extension of the image file, 'jpg', 'jpeg' or 'png'
+ * @return Value<gil::rgba8_image_t> The decoded image, or error if the format is invalid or it
+ * fails to decode
+ */
+[[nodiscard]] inline Value<gil::rgba8_image_t> read(std::string_view data, std::string_view ext)
+{
+  ImageFormat format = Pop(get_format(fs::path{std::format("image.{}", ext)}));
+  std::istringstream stream{std::string(data), std::ios::binary};
+  gil::rgba8_image_t img;
+  if (format == ImageFormat::JPG)
+  {
+    Try(gil::read_and_convert_image(stream, img, gil::jpeg_tag()));
+  }
+  else
+  {
+    Try(gil::read_and_convert_image(stream, img, gil::png_tag()));
+  }
+  logger("D::Decoded image of {} bytes, size is {}x{}", data.size(), std::to_string(img.width()), std::to_string(img.height()));
+  return img;
+}
 
+/**
+ * @brief Resizes a decoded image to several sizes
+ *
+ * Each target is resized and written by its own thread.
+ *
+ * @param img The decoded source image
+ * @param targets The output files and their sizes
+ * @return Value<void> Nothing on success, or the first error
+ */
+[[nodiscard]] inline Value<void> resize(gil::rgba8_image_t const& img, std::span<Target const> targets)
+{
+  std::vector<Value<void>> results(targets.size());
+  {
+    std::vector<std::jthread> threads;
+    for(size_t i = 0; i < targets.size(); ++i)
+    {
+      threads.emplace_back([&, i, level = ns_log::get_level()]
+      {
+        ns_log::set_level(level);
+        results[i] = write_resized(img, targets[i].path_file_dst, targets[i].width, targets[i].height);
+      });
+    }
+  }
+  for(auto& result : results)
+  {
+    Pop(result);
+  }
+  return {};
+}
 
+/**
+ * @brief Resizes an input image to several sizes
+ *
+ * The image is decoded once, and each target is resized and written by its own thread.
+ *
+ * @param path_file_src Path to the input image file
+ * @param targets The output files and their sizes
+ * @return Value<void> Nothing on success, or the first error
+ */
+[[nodiscard]] inline Value<void> resize(fs::path const& path_file_src, std::span<Target const> targets)
+{
+  gil::rgba8_image_t const img = Pop(read(path_file_src));
+  Pop(resize(img, targets));
+  return {};
+}
 
 /**
  * @brief Resizes an input image to the specified width and height
@@ -112,12 +262,14 @@ inline Value<void> resize_impl(fs::path const& path_file_src
  * @param height Target height of the output image
  * @return Value<void> Nothing on success, or the respective error
  */
-inline Value<void> resize(fs::path const& path_file_src
+[[nodiscard]] inline Value<void> resize(fs::path const& path_file_src
   , fs::path const& path_file_dst
   , uint32_t width
   , uint32_t height)
 {
-  return resize_impl(path_file_src, path_file_dst, width, height);
+  gil::rgba8_image_t const img = Pop(read(path_file_src));
+  Pop(write_resized(img, path_file_dst, width, height));
+  return {};
 }
 
 } // namespace ns_image
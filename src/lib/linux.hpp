@@ -16,6 +16,7 @@
 #include <string>
 #include <filesystem>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <cassert>
@@ -254,6 +255,116 @@ template<typename Data>
   return false;
 }
 
+/**
+ * @class PidFd
+ * @brief A file descriptor that becomes readable when a process exits
+ *
+ * Lets a process sleep until another one exits instead of polling it with kill(pid, 0). Uses
+ * pidfd_open, available on Linux >= 5.3. When it is not available the descriptor is invalid and
+ * the wait falls back to polling the process every 100ms.
+ */
+class PidFd
+{
+  private:
+    pid_t m_pid;
+    int m_fd;
+
+  public:
+    explicit PidFd(pid_t pid);
+    ~PidFd();
+    PidFd(PidFd const&) = delete;
+    PidFd(PidFd&&) = delete;
+    PidFd& operator=(PidFd const&) = delete;
+    PidFd& operator=(PidFd&&) = delete;
+    [[nodiscard]] int fd() const;
+    [[nodiscard]] bool is_alive() const;
+    [[nodiscard]] bool wait(std::chrono::milliseconds const& timeout) const;
+    [[nodiscard]] bool wait() const;
+};
+
+/**
+ * @brief Construct a new PidFd object
+ *
+ * @param pid The process to watch
+ */
+inline PidFd::PidFd(pid_t pid)
+  : m_pid(pid)
+  , m_fd(static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)))
+{
+  log_if(m_fd < 0, "D::pidfd_open is not available for '{}', polling instead: {}", pid, strerror(errno));
+  if(m_fd >= 0)
+  {
+    ::fcntl(m_fd, F_SETFD, FD_CLOEXEC);
+  }
+}
+
+/**
+ * @brief Destroy the PidFd object
+ */
+inline PidFd::~PidFd()
+{
+  if(m_fd >= 0) { ::close(m_fd); }
+}
+
+/**
+ * @brief The pidfd, to include in a poll set
+ *
+ * @return int The file descriptor, or -1 if pidfd_open is not available
+ */
+inline int PidFd::fd() const
+{
+  return m_fd;
+}
+
+/**
+ * @brief Checks if the process is still running
+ *
+ * @return bool True if the process has not exited
+ */
+inline bool PidFd::is_alive() const
+{
+  if(m_fd < 0) { return ::kill(m_pid, 0) == 0; }
+  struct pollfd pfd{ .fd = m_fd, .events = POLLIN, .revents = 0 };
+  return ::poll(&pfd, 1, 0) == 0;
+}
+
+/**
+ * @brief Waits for the process to exit
+ *
+ * Returns early if a signal interrupts the wait.
+ *
+ * @param timeout Maximum time to wait
+ * @return bool True if the process exited, false on timeout or interruption
+ */
+inline bool PidFd::wait(std::chrono::milliseconds const& timeout) const
+{
+  if(m_fd < 0)
+  {
+    std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds(100)));
+    return not is_alive();
+  }
+  struct pollfd pfd{ .fd = m_fd, .events = POLLIN, .revents = 0 };
+  return ::poll(&pfd, 1, static_cast<int>(timeout.count())) > 0;
+}
+
+/**
+ * @brief Waits for the process to exit, without a timeout
+ *
+ * Returns early if a signal interrupts the wait.
+ *
+ * @return bool True if the process exited, false on interruption
+ */
+inline bool PidFd::wait() const
+{
+  if(m_fd < 0)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return not is_alive();
+  }
+  struct pollfd pfd{ .fd = m_fd, .events = POLLIN, .revents = 0 };
+  return ::poll(&pfd, 1, -1) > 0;
+}
+
 } // namespace ns_linux
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
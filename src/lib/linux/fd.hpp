@@ -9,12 +9,27 @@
 #pragma once
 
 #include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <functional>
+#include <istream>
+#include <limits>
+#include <optional>
+#include <ranges>
 #include <span>
+#include <string_view>
+#include <vector>
+#if defined(__GLIBCXX__)
+#include <ext/stdio_filebuf.h>
+#include <ext/stdio_sync_filebuf.h>
+#endif
 
 #include "../linux.hpp"
 
@@ -23,8 +38,36 @@ namespace ns_linux::ns_fd
 
 constexpr uint32_t const SECONDS_TIMEOUT = 5;
 constexpr uint32_t const SIZE_BUFFER_READ = 16384;
+constexpr uint32_t const SIZE_BUFFER_RELAY = 1 << 20;
 constexpr auto const TIMEOUT_RETRY = std::chrono::milliseconds(50);
 
+/**
+ * @brief Sleeps until a file descriptor is readable or a process exits
+ *
+ * @param pidfd The process to watch
+ * @param fd_src File descriptor to read from
+ * @return Value<bool> True if the file descriptor is ready, false if the process exited
+ */
+[[nodiscard]] inline Value<bool> wait_read(ns_linux::PidFd const& pidfd, int fd_src)
+{
+  struct pollfd pfds[2]
+  {
+      { .fd = fd_src, .events = POLLIN, .revents = 0 }
+    , { .fd = pidfd.fd(), .events = POLLIN, .revents = 0 }
+  };
+  // Without a pidfd, check the process periodically
+  nfds_t nfds = (pidfd.fd() < 0)? 1 : 2;
+  int timeout = (pidfd.fd() < 0)? static_cast<int>(TIMEOUT_RETRY.count()) : -1;
+  while(true)
+  {
+    int ret = ::poll(pfds, nfds, timeout);
+    continue_if(ret < 0 and errno == EINTR);
+    return_if(ret < 0, Error("E::Could not poll file descriptor '{}': {}", fd_src, strerror(errno)));
+    return_if(pfds[0].revents != 0, true);
+    return_if((nfds == 2)? pfds[1].revents != 0 : not pidfd.is_alive(), false);
+  }
+}
+
 /**
  * @brief Redirects the output of one file descriptor as input of another
  *
@@ -38,47 +81,56 @@ constexpr auto const TIMEOUT_RETRY = std::chrono::milliseconds(50);
   return_if (ppid < 0, Error("E::Invalid pid to wait for: {}", ppid));
   return_if (fd_src < 0, Error("E::Invalid source file descriptor: {}", fd_src));
   return_if (fd_dst < 0, Error("E::Invalid destination file descriptor: {}", fd_dst));
-  // Read lambda
-  auto f_rw = [](int fd_src, int fd_dst) -> Value<bool>
+  // Moves data between pipes in the kernel, splice fails with EINVAL when neither end is a pipe
+  bool is_splice = true;
+  std::vector<char> buf;
+  // Forward the available data, false on EOF
+  auto f_rw = [&]() -> Value<bool>
   {
-    alignas(16) char buf[SIZE_BUFFER_READ];
-
-    ssize_t n = ns_linux::read_with_timeout(fd_src
-      , std::chrono::milliseconds(100)
-      , std::span(buf, sizeof(buf))
-    );
-    // EOF
-    if(n == 0)
+    ssize_t n = is_splice? ::splice(fd_src, nullptr, fd_dst, nullptr, SIZE_BUFFER_RELAY, SPLICE_F_MOVE) : -1;
+    if(is_splice and n < 0 and errno == EINVAL)
     {
-      return false;
+      logger("D::Relay from '{}' to '{}' with read/write", fd_src, fd_dst);
+      is_splice = false;
+      buf.resize(SIZE_BUFFER_RELAY);
     }
-    // Possible non-recoverable error
-    else if(n < 0)
+    if(not is_splice)
     {
-      // Timeout or would block - keep trying
-      if((errno == EAGAIN) or (errno == ETIMEDOUT))
+      n = ::read(fd_src, buf.data(), buf.size());
+      for(ssize_t offset = 0; offset < n;)
       {
-        return true;
+        ssize_t written = ::write(fd_dst, buf.data() + offset, n - offset);
+        continue_if(written < 0 and errno == EINTR);
+        // The destination is non-blocking and full
+        if(written < 0 and errno == EAGAIN)
+        {
+          std::ignore = ns_linux::poll_with_timeout(fd_dst, POLLOUT, std::chrono::seconds(SECONDS_TIMEOUT));
+          continue;
+        }
+        return_if(written < 0
+          , Error("D::Could not write to file descriptor '{}' with error '{}'", fd_dst, strerror(errno))
+        );
+        offset += written;
       }
-      // Non-recoverable error
-      return Error("E::Failed to read from file descriptor '{}' with error '{}'"
-        , fd_src
-        , strerror(errno)
-      );
     }
-    // n > 0, try to write read data
-    return_if(::write(fd_dst, buf, n) < 0
-      , Error("D::Could not write to file descriptor '{}' with error '{}'", fd_dst, strerror(errno))
+    // EOF
+    return_if(n == 0, false);
+    // Data forwarded
+    return_if(n > 0, true);
+    // Nothing to read from a non-blocking source, or a signal
+    return_if(errno == EINTR or errno == EAGAIN, true);
+    // Non-recoverable error, also when the destination closed
+    return Error("D::Failed to relay from file descriptor '{}' to '{}' with error '{}'"
+      , fd_src
+      , fd_dst
+      , strerror(errno)
     );
-    return true;
   };
-  // Try to read from the src fifo with 50ms delays
-  while (::kill(ppid, 0) == 0 and Pop(f_rw(fd_src, fd_dst)))
-  {
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-  }
-  // After the process exited, check for any leftover output
-  std::ignore = Pop(f_rw(fd_src, fd_dst));
+  // Sleep until there is data to forward or the process exits
+  ns_linux::PidFd pidfd(ppid);
+  while (Pop(wait_read(pidfd, fd_src)) and Pop(f_rw())) {}
+  // After the process exited, forward the leftover output
+  while (ns_linux::poll_with_timeout(fd_src, POLLIN, std::chrono::milliseconds(0)) and Pop(f_rw())) {}
   return {};
 }
 
@@ -137,66 +189,363 @@ constexpr auto const TIMEOUT_RETRY = std::chrono::milliseconds(50);
     return {};
 }
 
+/**
+ * @brief A one way relay between two file descriptors, see relay()
+ */
+struct Relay
+{
+  int fd_src;    ///< File descriptor to read from
+  int fd_dst;    ///< File descriptor to write to
+  bool is_input; ///< Feeds the process instead of carrying its output
+};
+
+namespace
+{
+
+/**
+ * @brief State of a relay in the event loop of relay()
+ */
+struct RelayState
+{
+  Relay relay;
+  bool is_open = true;     ///< The source did not end and no error occurred
+  bool is_splice = true;   ///< Splice is used until it fails with EINVAL
+  bool is_blocked = false; ///< Waiting for the destination to become writable
+  bool is_polled = true;   ///< False for sources epoll does not support, like regular files
+  int fd_watched = -1;     ///< File descriptor registered in epoll
+  uint32_t events = 0;     ///< Events registered in epoll
+  std::vector<char> buf;   ///< Data read and not written yet, without splice
+  size_t offset = 0;       ///< Position of the pending data in buf
+  size_t size = 0;         ///< End of the pending data in buf
+  uint64_t bytes = 0;      ///< Data written to the destination
+};
+
+/**
+ * @brief Moves the available data of a relay
+ *
+ * The relayed fifos are non-blocking, and splice does not block on the pipe end either. When
+ * nothing moves because the destination is full, the relay waits for it to become writable.
+ *
+ * @param state The relay
+ * @return Value<bool> True if data moved, or the respective error
+ */
+[[nodiscard]] inline Value<bool> relay_step(RelayState& state)
+{
+  int const fd_src = state.relay.fd_src;
+  int const fd_dst = state.relay.fd_dst;
+  // Write the pending data first
+  if(state.offset < state.size)
+  {
+    ssize_t written = ::write(fd_dst, state.buf.data() + state.offset, state.size - state.offset);
+    return_if(written < 0 and errno == EINTR, false);
+    state.is_blocked = (written < 0 and errno == EAGAIN);
+    return_if(state.is_blocked, false);
+    return_if(written < 0, Error("D::Could not write to '{}': {}", fd_dst, strerror(errno)));
+    state.offset += written;
+    state.bytes += written;
+    state.is_blocked = state.offset < state.size;
+    if(not state.is_blocked) { state.offset = state.size = 0; }
+    return true;
+  }
+  ssize_t n = state.is_splice?
+      ::splice(fd_src, nullptr, fd_dst, nullptr, SIZE_BUFFER_RELAY, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+    : -1;
+  // Splice fails with EINVAL when the destination is opened with O_APPEND, or neither end is a pipe
+  if(state.is_splice and n < 0 and errno == EINVAL)
+  {
+    logger("D::Relay from '{}' to '{}' with read/write", fd_src, fd_dst);
+    state.is_splice = false;
+    state.buf.resize(SIZE_BUFFER_RELAY);
+  }
+  if(not state.is_splice and (n = ::read(fd_src, state.buf.data(), state.buf.size())) > 0)
+  {
+    state.size = n;
+    std::ignore = Pop(relay_step(state));
+    return true;
+  }
+  if(state.is_splice and n > 0) { state.bytes += n; }
+  // End of the source
+  state.is_open = (n != 0);
+  return_if(n >= 0, n > 0);
+  return_if(errno == EINTR, false);
+  // Nothing to read, or the destination is full
+  if(errno == EAGAIN)
+  {
+    state.is_blocked = state.is_splice and not ns_linux::poll_with_timeout(fd_dst, POLLOUT, std::chrono::milliseconds(0));
+    return false;
+  }
+  return Error("D::Failed to relay from '{}' to '{}': {}", fd_src, fd_dst, strerror(errno));
+}
+
+} // namespace
+
+/**
+ * @brief Relays the stdio of a process in a single event loop
+ *
+ * Waits with epoll for the sources to become readable, the destinations that are full to become
+ * writable, and the process to exit. The destination of an input relay is closed when its source
+ * ends, so the process sees the end of its input, the relay owns it. Once the process exits, or
+ * all output relays ended, the output still in the sources is forwarded and the relay returns.
+ * Sources epoll does not support, like regular files, are read on every iteration.
+ *
+ * @param pid The process that reads the inputs and writes the outputs
+ * @param relays The relays, output sources and input destinations should be non-blocking fifos
+ * @return Value<uint64_t> The number of bytes relayed, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> relay(pid_t pid, std::span<Relay const> relays)
+{
+  constexpr uint32_t const ID_PIDFD = std::numeric_limits<uint32_t>::max();
+  int fd_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+  if(fd_epoll < 0)
+  {
+    int err = errno;
+    std::ranges::for_each(relays, [](Relay const& e){ if(e.is_input) { ::close(e.fd_dst); } });
+    return Error("E::Could not create epoll instance: {}", strerror(err));
+  }
+  std::vector<RelayState> states;
+  std::ranges::transform(relays, std::back_inserter(states), [](Relay const& e){ return RelayState{ .relay = e }; });
+  // Register the file descriptor each relay waits for, the source or the full destination
+  auto f_watch = [&](uint32_t id)
+  {
+    RelayState& state = states[id];
+    int fd = (not state.is_open)? -1 : state.is_blocked? state.relay.fd_dst : state.relay.fd_src;
+    uint32_t events = state.is_blocked? EPOLLOUT : EPOLLIN;
+    if(fd == state.fd_watched and events == state.events) { return; }
+    if(state.fd_watched >= 0) { ::epoll_ctl(fd_epoll, EPOLL_CTL_DEL, state.fd_watched, nullptr); }
+    state.fd_watched = -1;
+    epoll_event event{ .events = events, .data = { .u32 = id } };
+    if(fd >= 0 and ::epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &event) == 0)
+    {
+      state.fd_watched = fd;
+      state.events = events;
+    }
+    // Regular files cannot be registered, they are always ready
+    state.is_polled = (fd < 0 or state.fd_watched >= 0);
+  };
+  // Stops a relay, the process sees the end of an input
+  auto f_stop = [&](RelayState& state)
+  {
+    state.is_open = false;
+    if(state.relay.is_input) { ::close(state.relay.fd_dst); }
+  };
+  // Stops a relay that ended or failed
+  auto f_close = [&](RelayState& state, Value<bool> const& ret)
+  {
+    log_if(not ret, "D::Relay from '{}' to '{}' stopped: {}", state.relay.fd_src, state.relay.fd_dst, ret.error());
+    if(not ret or not state.is_open) { f_stop(state); }
+  };
+  auto f_is_output_open = [&]
+  {
+    return std::ranges::any_of(states, [](auto&& e){ return e.is_open and not e.relay.is_input; });
+  };
+  // Readable when the process exits, without a pidfd check the process periodically
+  ns_linux::PidFd pidfd(pid);
+  if(epoll_event event{ .events = EPOLLIN, .data = { .u32 = ID_PIDFD } }; pidfd.fd() >= 0)
+  {
+    ::epoll_ctl(fd_epoll, EPOLL_CTL_ADD, pidfd.fd(), &event);
+  }
+  for(uint32_t id = 0; id < states.size(); ++id) { f_watch(id); }
+  std::array<epoll_event, 8> events;
+  for(bool is_exited = false; not is_exited and f_is_output_open();)
+  {
+    bool is_ready = std::ranges::any_of(states, [](auto&& e){ return e.is_open and not e.is_polled; });
+    int timeout = is_ready? 0 : (pidfd.fd() < 0)? static_cast<int>(TIMEOUT_RETRY.count()) : -1;
+    int count = ::epoll_wait(fd_epoll, events.data(), events.size(), timeout);
+    continue_if(count < 0 and errno == EINTR);
+    break_if(count < 0, "E::Could not wait for relay events: {}", strerror(errno));
+    for(auto const& event : std::span(events.data(), count))
+    {
+      if(event.data.u32 == ID_PIDFD) { is_exited = true; continue; }
+      f_close(states[event.data.u32], relay_step(states[event.data.u32]));
+    }
+    for(auto& state : states | std::views::filter([](auto&& e){ return e.is_open and not e.is_polled; }))
+    {
+      f_close(state, relay_step(state));
+    }
+    is_exited |= (pidfd.fd() < 0 and count == 0 and not pidfd.is_alive());
+    for(uint32_t id = 0; id < states.size(); ++id) { f_watch(id); }
+  }
+  // Forward the output left in the sources, descendants of the process might keep them open
+  for(auto& state : states | std::views::filter([](auto&& e){ return not e.relay.is_input; }))
+  {
+    while(state.is_open)
+    {
+      auto ret = relay_step(state);
+      f_close(state, ret);
+      continue_if(ret and *ret);
+      break_if(not state.is_blocked);
+      std::ignore = ns_linux::poll_with_timeout(state.relay.fd_dst, POLLOUT, std::chrono::seconds(SECONDS_TIMEOUT));
+    }
+  }
+  // The process no longer reads its inputs
+  for(auto& state : states | std::views::filter([](auto&& e){ return e.is_open and e.relay.is_input; }))
+  {
+    f_stop(state);
+  }
+  ::close(fd_epoll);
+  return std::ranges::fold_left(states, uint64_t{0}, [](uint64_t acc, auto&& e){ return acc + e.bytes; });
+}
+
+/**
+ * @class LineSplitter
+ * @brief Splits a byte stream into lines without allocating for each line
+ *
+ * Data is read straight into a fixed buffer, complete lines are handed to a sink as views into the
+ * buffer, and the unfinished line at its end is moved to the front before the next read. A line
+ * longer than the buffer is split at the size of the buffer. Both '\n' and '\r' end a line, so
+ * progress updates that rewrite a terminal line show up as separate lines.
+ */
+class LineSplitter
+{
+  private:
+    std::vector<char> m_buffer;
+    size_t m_size;
+
+  public:
+    explicit LineSplitter(size_t capacity = SIZE_BUFFER_READ);
+    [[nodiscard]] std::span<char> free();
+    template<typename F> void commit(size_t size, F&& f_line);
+    template<typename F> void flush(F&& f_line);
+};
+
+/**
+ * @brief Construct a new LineSplitter object
+ *
+ * @param capacity The size of the buffer, and the maximum length of a line
+ */
+inline LineSplitter::LineSplitter(size_t capacity)
+  : m_buffer(std::max<size_t>(capacity, 1))
+  , m_size(0)
+{}
+
+/**
+ * @brief Gets the free space of the buffer, where the next read should go
+ *
+ * @return std::span<char> The free space, never empty
+ */
+inline std::span<char> LineSplitter::free()
+{
+  return std::span(m_buffer).subspan(m_size);
+}
+
+/**
+ * @brief Hands the complete lines to a sink after data was read into the free space
+ *
+ * @param size The number of bytes read into the free space
+ * @param f_line Called with each complete line, without its terminator, the view is only valid
+ * during the call
+ */
+template<typename F>
+void LineSplitter::commit(size_t size, F&& f_line)
+{
+  size_t begin = 0;
+  for(size_t i = m_size; i < m_size + size; ++i)
+  {
+    continue_if(m_buffer[i] != '\n' and m_buffer[i] != '\r');
+    f_line(std::string_view(m_buffer.data() + begin, i - begin));
+    begin = i + 1;
+  }
+  m_size += size;
+  // A line as large as the buffer is handed over as is
+  if(begin == 0 and m_size == m_buffer.size())
+  {
+    f_line(std::string_view(m_buffer.data(), m_size));
+    m_size = 0;
+    return;
+  }
+  // Keep the unfinished line at the start of the buffer
+  std::memmove(m_buffer.data(), m_buffer.data() + begin, m_size - begin);
+  m_size -= begin;
+}
+
+/**
+ * @brief Hands the unfinished line to a sink, at the end of the stream
+ *
+ * @param f_line Called with the unfinished line, if any
+ */
+template<typename F>
+void LineSplitter::flush(F&& f_line)
+{
+  if(m_size > 0) { f_line(std::string_view(m_buffer.data(), m_size)); }
+  m_size = 0;
+}
+
 /**
  * @brief Redirects the output of a file descriptor to a stream
  *
- * Reads data from a file descriptor and writes it to an output stream.
- * Continues reading while the specified process is alive.
+ * Reads data from a file descriptor and writes it to an output stream, one line at a time,
+ * skipping empty and whitespace-only lines. Sleeps in poll until there is output, and continues
+ * while the specified process is alive.
  *
  * @param ppid Keep trying to read and write while this pid is alive
  * @param fd_src File descriptor to read from
  * @param stream_dst Output stream to write to
- * @param transform Optionally transforms the read data before writing to the stream
+ * @param f_line Optionally called with each line before it is written to the stream
  */
 [[nodiscard]] inline Value<void> redirect_fd_to_stream(pid_t ppid
   , int fd_src
   , std::ostream& stream_dst
-  , std::function<std::string(std::string const&)> transform = [](std::string e) -> std::string { return e; })
+  , std::function<void(std::string_view)> const& f_line = {})
 {
   // Validate file descriptors
   return_if(fd_src < 0, Error("E::Invalid src file descriptor"));
-  // aligas is used because this gives out SIGILL when allocating the buffer
-  // if the memory is un-aligned. Pain.
-  for (alignas(16) char buf[SIZE_BUFFER_READ]; ::kill(ppid, 0) == 0;)
+  LineSplitter splitter;
+  auto f_sink = [&](std::string_view line)
   {
-    ssize_t n = ns_linux::read_with_timeout(fd_src, TIMEOUT_RETRY, std::span(buf, sizeof(buf)));
-    if (n > 0)
-    {
-      // Split on both newlines and carriage returns, filter empty/whitespace-only lines
-      std::string chunk(buf, n);
-      // Replace all \r with \n to handle Windows-style line endings and progress updates
-      std::ranges::replace(chunk, '\r', '\n');
-      // Split by newline and process each line
-      std::ranges::for_each(chunk
-          | std::views::split('\n')
-          | std::views::transform([](auto&& e){ return std::string{e.begin(), e.end()}; })
-          | std::views::filter([](auto const& s){ return not s.empty(); })
-          | std::views::filter([](auto const& s){ return not std::ranges::all_of(s, ::isspace); })
-          | std::views::transform([&](auto&& e){ return transform(e); })
-        , [&](auto line) { stream_dst << line << '\n'; }
-      );
-      stream_dst.flush();
-    }
+    if(std::ranges::all_of(line, [](unsigned char c){ return std::isspace(c); })) { return; }
+    if(f_line) { f_line(line); }
+    stream_dst.write(line.data(), line.size()).put('\n');
+  };
+  ns_linux::PidFd pidfd(ppid);
+  while(Pop(wait_read(pidfd, fd_src)))
+  {
+    std::span<char> buf = splitter.free();
+    ssize_t n = ::read(fd_src, buf.data(), buf.size());
+    // Timeout or retry
+    continue_if(n < 0 and (errno == EAGAIN or errno == EINTR));
+    return_if(n < 0, Error("E::Failed to read from file descriptor '{}' with error '{}'", fd_src, strerror(errno)));
     // If the fd was given EOF (closed), then stop.
-    if(n == 0)
-    {
-      break;
-    }
-    // Possible error when n < 0 that is not a timeout nor a retry
-    return_if(n < 0 and (errno != EAGAIN) and (errno != ETIMEDOUT)
-      , Error("E::Failed to read from file descriptor '{}' with error '{}'", fd_src, strerror(errno));
-    );
-    // Retry
-    std::this_thread::sleep_for(TIMEOUT_RETRY);
+    break_if(n == 0);
+    splitter.commit(n, f_sink);
+    stream_dst.flush();
   }
+  // The last line might not be terminated
+  splitter.flush(f_sink);
+  stream_dst.flush();
   return {};
 }
 
+/**
+ * @brief Gets the file descriptor an input stream reads from
+ *
+ * @param stream The input stream
+ * @return std::optional<int> The file descriptor, or nullopt for streams without one, like string
+ * streams
+ */
+[[nodiscard]] inline std::optional<int> stream_fd(std::istream& stream)
+{
+#if defined(__GLIBCXX__)
+  std::streambuf* buf = stream.rdbuf();
+  // Buffers of std::cin, and of streams opened over a file descriptor
+  if(auto buf_sync = dynamic_cast<__gnu_cxx::stdio_sync_filebuf<char>*>(buf))
+  {
+    return ::fileno(buf_sync->file());
+  }
+  if(auto buf_file = dynamic_cast<__gnu_cxx::stdio_filebuf<char>*>(buf))
+  {
+    return buf_file->fd();
+  }
+#endif
+  return std::nullopt;
+}
+
 /**
  * @brief Redirects the output of a stream to a file descriptor
  *
- * Reads lines from an input stream and writes them to a file descriptor.
- * Continues reading while the specified process is alive.
+ * Reads data from an input stream and writes it to a file descriptor, waiting while it is full.
+ * Continues reading while the specified process is alive. Streams backed by a file descriptor
+ * sleep in poll on it until there is input, and the end of their input ends the redirection. Other
+ * streams cannot be polled, so they are checked periodically.
  *
  * @param ppid Keep trying to read and write while this pid is alive
  * @param stream_src Input stream to read from
@@ -204,13 +553,52 @@ constexpr auto const TIMEOUT_RETRY = std::chrono::milliseconds(50);
  */
 [[nodiscard]] inline Value<void> redirect_stream_to_fd(pid_t ppid, std::istream& stream_src, int fd_dst)
 {
-  using namespace std::chrono_literals;
   // Align to avoid SIGILL
   alignas(16) char buf[SIZE_BUFFER_READ];
   // Validate file descriptors
   return_if(fd_dst < 0, Error("E::Invalid src file descriptor"));
-  // Query stream for data & forward to fd
-  for(; ::kill(ppid, 0) == 0; std::this_thread::sleep_for(TIMEOUT_RETRY))
+  // Writes all the data, fails when the process closed its end
+  auto f_write = [&](std::span<char const> data) -> Value<void>
+  {
+    while(not data.empty())
+    {
+      ssize_t written = ::write(fd_dst, data.data(), data.size());
+      continue_if(written < 0 and errno == EINTR);
+      // The destination is non-blocking and full
+      if(written < 0 and errno == EAGAIN)
+      {
+        std::ignore = ns_linux::poll_with_timeout(fd_dst, POLLOUT, TIMEOUT_RETRY);
+        continue;
+      }
+      return_if(written < 0
+        , Error("E::Could not write data to file descriptor '{}': {}", fd_dst, strerror(errno))
+      );
+      data = data.subspan(written);
+    }
+    return {};
+  };
+  ns_linux::PidFd pidfd(ppid);
+  if(std::optional<int> fd_src = stream_fd(stream_src))
+  {
+    // Forward what the stream already buffered, then read the file descriptor itself
+    for(std::streamsize avail; (avail = stream_src.rdbuf()->in_avail()) > 0;)
+    {
+      stream_src.read(buf, std::min(avail, static_cast<std::streamsize>(sizeof(buf))));
+      Pop(f_write(std::span(buf, stream_src.gcount())));
+    }
+    while(Pop(wait_read(pidfd, *fd_src)))
+    {
+      ssize_t n = ::read(*fd_src, buf, sizeof(buf));
+      continue_if(n < 0 and (errno == EINTR or errno == EAGAIN));
+      return_if(n < 0, Error("E::Could not read from file descriptor '{}': {}", *fd_src, strerror(errno)));
+      // End of input, the caller closes the destination to forward it
+      break_if(n == 0);
+      Pop(f_write(std::span(buf, n)));
+    }
+    return {};
+  }
+  // Query stream for data & forward to fd, streams cannot be polled so check periodically
+  for(; pidfd.is_alive(); std::ignore = pidfd.wait(TIMEOUT_RETRY))
   {
     // Use a non-blocking approach, checking if there's data available to read.
     // in_avail: Returns the number of characters available for non-blocking
@@ -230,10 +618,7 @@ constexpr auto const TIMEOUT_RETRY = std::chrono::milliseconds(50);
       // "Except in the constructors of std::strstreambuf, negative values of std::streamsize are never used."
       continue_if (n <= 0);
       // Write to file descriptor
-      ssize_t bytes = ns_linux::write_with_timeout(fd_dst, 1s, std::span(buf, n));
-      return_if (bytes < 0
-        , Error("E::Could not write data to file descriptor '{}': {}", fd_dst, strerror(errno));
-      );
+      Pop(f_write(std::span(buf, n)));
     }
     // Custom stringstream streams with have eof on no data to read
     // instead of hanging like std::cin
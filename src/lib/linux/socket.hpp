@@ -0,0 +1,211 @@
+/**
+ * @file socket.hpp
+ * @author Ruan Formigoni
+ * @brief Linux unix domain socket related operation wrappers
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../macro.hpp"
+
+/**
+ * @namespace ns_linux::ns_socket
+ * @brief Stream unix domain sockets bound to a path, with file descriptor passing
+ *
+ * Sockets bound to a path are reachable from any mount namespace that sees the path, like the
+ * host and the sandbox through the bind mounted instance directory. File descriptors sent with
+ * SCM_RIGHTS are duplicated into the receiving process, which then uses the same open files as the
+ * sender.
+ */
+namespace ns_linux::ns_socket
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Maximum number of file descriptors sent in a single message
+constexpr size_t const MAX_FDS = 8;
+
+/**
+ * @brief Fills the address of a socket path
+ *
+ * @param path_file_socket Path to the socket
+ * @return Value<sockaddr_un> The address, or the respective error
+ */
+[[nodiscard]] inline Value<sockaddr_un> address(fs::path const& path_file_socket)
+{
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  return_if(path_file_socket.string().size() >= sizeof(addr.sun_path)
+    , Error("D::Socket path is too long '{}'", path_file_socket)
+  );
+  std::strncpy(addr.sun_path, path_file_socket.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+} // namespace
+
+/**
+ * @brief Creates a listening socket, replaces an existing socket file
+ *
+ * The socket file is only accessible by its owner. The mode is set between bind and listen,
+ * connections are refused until the socket listens, so no other user connects with the mode of
+ * the umask. The umask is not changed, as it is shared by the threads of the process.
+ *
+ * @param path_file_socket Path to bind the socket to
+ * @return Value<int> The non-blocking file descriptor of the socket, or the respective error
+ */
+[[nodiscard]] inline Value<int> listen(fs::path const& path_file_socket)
+{
+  sockaddr_un addr = Pop(address(path_file_socket));
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  return_if(fd < 0, Error("E::Could not create socket: {}", strerror(errno)));
+  ::unlink(path_file_socket.c_str());
+  if(::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+    or ::chmod(path_file_socket.c_str(), S_IRUSR | S_IWUSR) < 0
+    or ::listen(fd, SOMAXCONN) < 0)
+  {
+    int err = errno;
+    ::close(fd);
+    return Error("E::Could not listen on socket '{}': {}", path_file_socket, strerror(err));
+  }
+  return fd;
+}
+
+/**
+ * @brief Gets the user of the process at the other end of a connection
+ *
+ * The kernel records the credentials of the peer when it connects, translated to the user
+ * namespace of the caller. A user without a mapping in it reads as the overflow user.
+ *
+ * @param fd_socket The connected socket
+ * @return Value<uid_t> The user ID of the peer, or the respective error
+ */
+[[nodiscard]] inline Value<uid_t> peer_uid(int fd_socket)
+{
+  ucred cred{};
+  socklen_t size = sizeof(cred);
+  return_if(::getsockopt(fd_socket, SOL_SOCKET, SO_PEERCRED, &cred, &size) < 0
+    , Error("E::Could not get the credentials of the peer: {}", strerror(errno))
+  );
+  return cred.uid;
+}
+
+/**
+ * @brief Connects to a listening socket
+ *
+ * @param path_file_socket Path of the socket
+ * @return Value<int> The file descriptor of the connection, or the respective error
+ */
+[[nodiscard]] inline Value<int> connect(fs::path const& path_file_socket)
+{
+  sockaddr_un addr = Pop(address(path_file_socket));
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  return_if(fd < 0, Error("E::Could not create socket: {}", strerror(errno)));
+  if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+  {
+    int err = errno;
+    ::close(fd);
+    return Error("D::Could not connect to socket '{}': {}", path_file_socket, strerror(err));
+  }
+  return fd;
+}
+
+/**
+ * @brief Sends data and file descriptors through a connected socket
+ *
+ * The file descriptors travel with the first byte of the data, the remaining data is sent until
+ * complete.
+ *
+ * @param fd_socket The connected socket
+ * @param data The data to send, must not be empty
+ * @param fds The file descriptors to send
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> send(int fd_socket, std::string_view data, std::span<int const> fds)
+{
+  return_if(data.empty() or fds.size() > MAX_FDS, Error("E::Invalid socket message"));
+  alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * MAX_FDS)> control{};
+  iovec iov{ .iov_base = const_cast<char*>(data.data()), .iov_len = data.size() };
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if(not fds.empty())
+  {
+    msg.msg_control = control.data();
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+  while(not data.empty())
+  {
+    ssize_t sent = ::sendmsg(fd_socket, &msg, MSG_NOSIGNAL);
+    continue_if(sent < 0 and errno == EINTR);
+    return_if(sent <= 0, Error("E::Could not send through socket: {}", strerror(errno)));
+    data.remove_prefix(sent);
+    // The descriptors were sent with the first chunk
+    iov = { .iov_base = const_cast<char*>(data.data()), .iov_len = data.size() };
+    msg.msg_control = nullptr;
+    msg.msg_controllen = 0;
+  }
+  return {};
+}
+
+/**
+ * @brief Receives data and file descriptors from a connected socket
+ *
+ * @param fd_socket The connected socket
+ * @param buf Where to store the received data
+ * @param fds Received file descriptors are appended here, with close-on-exec set
+ * @return Value<size_t> The number of bytes received, zero on end of stream, or the respective error
+ */
+[[nodiscard]] inline Value<size_t> recv(int fd_socket, std::span<char> buf, std::vector<int>& fds)
+{
+  alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int) * MAX_FDS)> control{};
+  iovec iov{ .iov_base = buf.data(), .iov_len = buf.size() };
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  ssize_t received;
+  do
+  {
+    received = ::recvmsg(fd_socket, &msg, MSG_CMSG_CLOEXEC);
+  } while(received < 0 and errno == EINTR);
+  return_if(received < 0, Error("E::Could not receive from socket: {}", strerror(errno)));
+  for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    continue_if(cmsg->cmsg_level != SOL_SOCKET or cmsg->cmsg_type != SCM_RIGHTS);
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for(size_t i = 0; i < count; ++i)
+    {
+      int fd;
+      std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      fds.push_back(fd);
+    }
+  }
+  return static_cast<size_t>(received);
+}
+
+} // namespace ns_linux::ns_socket
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -122,6 +122,9 @@
 #pragma once
 
 #include <pthread.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
@@ -158,12 +161,39 @@ namespace
 
 namespace fs = std::filesystem;
 
+// Maximum time a message below the warning level waits in the buffer of the sink
+constexpr auto const INTERVAL_FLUSH = std::chrono::milliseconds(250);
+
+// Size of a sink file before it is rotated
+constexpr uint64_t const SIZE_SINK_MAX = uint64_t{8} << 20;
+
+/**
+ * @brief Gets the size of a sink file before it is rotated
+ *
+ * @return uint64_t The size in bytes from FIM_LOG_MAX_SIZE, SIZE_SINK_MAX if unset or invalid,
+ * zero disables the rotation
+ */
+[[nodiscard]] inline uint64_t size_sink_max()
+{
+  char const* var = std::getenv("FIM_LOG_MAX_SIZE");
+  if(var == nullptr or *var == '\0') { return SIZE_SINK_MAX; }
+  char* end = nullptr;
+  uint64_t size = std::strtoull(var, &end, 10);
+  return (*end == '\0')? size : SIZE_SINK_MAX;
+}
+
 class Logger
 {
   private:
     std::ofstream m_sink;
+    fs::path m_path_sink;
+    bool m_is_sink;  ///< False while the sink is /dev/null
+    uint64_t m_size; ///< Bytes written to the sink since it was opened
+    uint64_t m_size_max; ///< Bytes after which the sink is rotated, zero to never rotate
     Level m_level;
     pid_t m_pid;  ///< PID at logger initialization (used to detect forked children)
+    std::chrono::steady_clock::time_point m_time_flush;
+    void rotate();
   public:
     Logger();
     Logger(Logger const&) = delete;
@@ -175,7 +205,11 @@ class Logger
     [[nodiscard]] pid_t get_pid() const;
     void set_sink_file(fs::path const& path_file_sink);
     void set_as_fork();
+    [[nodiscard]] bool is_enabled(Level level) const;
+    [[nodiscard]] bool is_sink() const;
     void flush();
+    void flush_after(Level level);
+    void write(std::string_view line, Level level);
     [[nodiscard]] std::ofstream& get_sink_file();
 };
 
@@ -195,10 +229,12 @@ thread_local Logger logger;
  * automatically executes in the parent process BEFORE fork() happens. It ensures
  * all buffered output is written.
  *
- * The fflush(nullptr) call flushes ALL streams
+ * The fflush(nullptr) call flushes ALL streams, the logger of the forking thread is flushed first
  */
 static void fork_handler_parent()
 {
+  // The child would write the buffered messages again when it replaces the sink
+  logger.flush();
   std::cout.flush();
   std::cerr.flush();
   ::fflush(nullptr);
@@ -226,8 +262,13 @@ void fork_handler_child()
  */
 inline Logger::Logger()
   : m_sink("/dev/null")
+  , m_path_sink("/dev/null")
+  , m_is_sink(false)
+  , m_size(0)
+  , m_size_max(0)
   , m_level(Level::CRITICAL)
   , m_pid(getpid())
+  , m_time_flush(std::chrono::steady_clock::now())
 {
   static thread_local bool registered = false;
   if (!registered)
@@ -240,6 +281,10 @@ inline Logger::Logger()
 /**
  * @brief Sets the sink file of the logger
  *
+ * The file is truncated. Once it reaches FIM_LOG_MAX_SIZE bytes it is renamed with a '.1'
+ * suffix, which replaces the previous one, and a new file is started. A sink takes at most twice
+ * that size on disk.
+ *
  * @param path_file_sink The path to the logger sink file
  */
 inline void Logger::set_sink_file(fs::path const& path_file_sink)
@@ -254,6 +299,11 @@ inline void Logger::set_sink_file(fs::path const& path_file_sink)
   }
   // File output stream
   m_sink = std::ofstream(path_file_sink, std::ios::out | std::ios::trunc);
+  m_path_sink = path_file_sink;
+  m_is_sink = m_sink.is_open() and path_file_sink != "/dev/null";
+  m_size = 0;
+  m_size_max = m_is_sink? size_sink_max() : 0;
+  m_time_flush = std::chrono::steady_clock::now();
   // Check if file was opened successfully
   if(not m_sink.is_open())
   {
@@ -271,6 +321,27 @@ inline std::ofstream& Logger::get_sink_file()
   return m_sink;
 }
 
+/**
+ * @brief Checks if a message of a level is written anywhere
+ *
+ * @param level The level of the message
+ * @return bool True if there is a sink file or the level is shown in the console
+ */
+inline bool Logger::is_enabled(Level level) const
+{
+  return m_is_sink or m_level >= level;
+}
+
+/**
+ * @brief Checks if messages are written to a sink file
+ *
+ * @return bool False if there is no sink file, or it is /dev/null
+ */
+inline bool Logger::is_sink() const
+{
+  return m_is_sink;
+}
+
 /**
  * @brief Flushes the buffer content to the log file if it is defined
  */
@@ -280,6 +351,64 @@ inline void Logger::flush()
   {
     file.flush();
   }
+  m_time_flush = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Flushes the buffer after a message was written to it, if due
+ *
+ * Warnings, errors and critical messages are flushed immediately, they often precede an exit.
+ * Other messages stay in the buffer of the sink for at most INTERVAL_FLUSH, since the last flush.
+ * The buffer is also flushed when the thread exits, when the process exits normally, and before
+ * a fork.
+ *
+ * @param level The level of the message
+ */
+inline void Logger::flush_after(Level level)
+{
+  if (level <= Level::WARN or std::chrono::steady_clock::now() - m_time_flush >= INTERVAL_FLUSH)
+  {
+    this->flush();
+  }
+}
+
+/**
+ * @brief Writes a message to the sink file, rotates the file when it is full
+ *
+ * @param line The formatted message
+ * @param level The level of the message
+ */
+inline void Logger::write(std::string_view line, Level level)
+{
+  m_sink.write(line.data(), line.size());
+  m_size += line.size();
+  if (m_size_max > 0 and m_size >= m_size_max)
+  {
+    this->rotate();
+    return;
+  }
+  this->flush_after(level);
+}
+
+/**
+ * @brief Moves the sink file to its '.1' backup and starts a new one
+ *
+ * Threads and processes that share the file rotate it independently. A file smaller than the
+ * limit was already rotated by another writer, which this one then joins.
+ */
+inline void Logger::rotate()
+{
+  m_sink.close();
+  std::error_code ec;
+  if (fs::file_size(m_path_sink, ec) >= m_size_max and not ec)
+  {
+    fs::rename(m_path_sink, fs::path(m_path_sink).concat(".1"), ec);
+  }
+  // Append, other writers of the file might have created it already
+  m_sink = std::ofstream(m_path_sink, std::ios::out | std::ios::app);
+  m_is_sink = m_sink.is_open();
+  m_size = 0;
+  m_time_flush = std::chrono::steady_clock::now();
 }
 
 /**
@@ -361,6 +490,16 @@ inline void set_sink_file(fs::path const& path_file_sink)
   logger.set_sink_file(path_file_sink);
 }
 
+/**
+ * @brief Writes the buffered messages to the sink file
+ *
+ * Call before replacing the process with execve, which discards the buffer.
+ */
+inline void flush()
+{
+  logger.flush();
+}
+
 /**
  * @brief Marks the logger as being in a forked child process
  *
@@ -447,6 +586,7 @@ std::string vformat(std::string_view fmt, Ts&&... ts)
  *
  * Handles the actual formatting and output of log messages to both the sink file
  * (if set) and the console (if level is enabled). Thread-safe due to thread_local logger.
+ * Messages that go nowhere are not formatted, and the sink file is flushed on a timer.
  */
 class Writer
 {
@@ -483,6 +623,11 @@ class Writer
     requires ( ( ns_concept::StringRepresentable<Args> or ns_concept::Iterable<Args> ) and ... )
     void operator()(T&& format, Args&&... args)
     {
+      // Skip the formatting of messages that are not written anywhere
+      if(not logger.is_enabled(m_level))
+      {
+        return;
+      }
       // Get current PID to detect if this is a forked child process
       pid_t pid = getpid();
       // Create string
@@ -490,25 +635,23 @@ class Writer
       // Parent: show "PREFIX::file::line::", Child: show "PREFIX::child_pid::"
       line += (pid == logger.get_pid())? std::format("{}::{}::", m_prefix, m_loc.get())
         : std::format("{}::{}::", m_prefix, pid);
+      size_t size_prefix = line.size();
       // Append format and args
-      line += vformat(ns_string::to_string(format), ns_string::to_string(args)...)
-        // Remove new lines to avoid printing without a prefix
-        | std::views::filter([](char c){ return c != '\n'; })
-        // Make it into a string
-        | std::ranges::to<std::string>();
+      line += vformat(ns_string::to_string(format), ns_string::to_string(args)...);
+      // Remove new lines to avoid printing without a prefix
+      line.erase(std::remove(line.begin() + size_prefix, line.end(), '\n'), line.end());
       // Append a single newline
       line += '\n';
-      // Push to file
-      if(std::ofstream& sink = logger.get_sink_file(); sink.is_open())
+      // Push to the buffer of the file
+      if(logger.is_sink())
       {
-        sink << line;
+        logger.write(line, m_level);
       }
       // Push to stream
       if(logger.get_level() >= m_level)
       {
         ostream.get() << line;
       }
-      logger.flush();
     }
 };
 
@@ -0,0 +1,234 @@
+/**
+ * @file sha256.hpp
+ * @author Ruan Formigoni
+ * @brief A streaming implementation of the SHA-256 hash
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_sha256
+ * @brief Cryptographic hash of data that comes from an untrusted source
+ *
+ * Used where a hash identifies contents another party could craft, e.g., downloaded layers or
+ * the regions of an update, where the XXH64 hash of ns_hash can be collided on purpose. The
+ * output matches FIPS 180-4, hashes computed here can be checked with 'sha256sum'.
+ */
+namespace ns_sha256
+{
+
+namespace
+{
+
+constexpr std::array<uint32_t,64> const K =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+[[nodiscard]] inline uint32_t read_be32(unsigned char const* data)
+{
+  return (uint32_t{data[0]} << 24) | (uint32_t{data[1]} << 16) | (uint32_t{data[2]} << 8) | uint32_t{data[3]};
+}
+
+} // namespace
+
+using Digest = std::array<uint8_t,32>;
+
+/**
+ * @class Sha256
+ * @brief Computes the SHA-256 hash of data given in chunks
+ *
+ * @code
+ * ns_sha256::Sha256 hash;
+ * hash.update("hello ");
+ * hash.update("world");
+ * std::string hex = hash.hex();
+ * @endcode
+ */
+class Sha256
+{
+  private:
+    std::array<uint32_t,8> m_state;
+    std::array<unsigned char,64> m_buffer{};
+    size_t m_size_buffer;
+    uint64_t m_size_total;
+
+    void block(unsigned char const* data);
+
+  public:
+    Sha256();
+    void update(std::string_view data);
+    [[nodiscard]] Digest digest() const;
+    [[nodiscard]] std::string hex() const;
+};
+
+/**
+ * @brief Creates a hash state
+ */
+inline Sha256::Sha256()
+  : m_state{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+  , m_size_buffer(0)
+  , m_size_total(0)
+{
+}
+
+/**
+ * @brief Compresses a block of 64 bytes into the state
+ *
+ * @param data Pointer to the 64 bytes
+ */
+inline void Sha256::block(unsigned char const* data)
+{
+  std::array<uint32_t,64> w;
+  for(size_t i = 0; i < 16; ++i) { w[i] = read_be32(data + i * 4); }
+  for(size_t i = 16; i < 64; ++i)
+  {
+    uint32_t s0 = std::rotr(w[i-15], 7) ^ std::rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t s1 = std::rotr(w[i-2], 17) ^ std::rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+  auto [a, b, c, d, e, f, g, h] = m_state;
+  for(size_t i = 0; i < 64; ++i)
+  {
+    uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  for(size_t i = 0; uint32_t v : {a, b, c, d, e, f, g, h}) { m_state[i++] += v; }
+}
+
+/**
+ * @brief Adds data to the hash
+ *
+ * @param data The next chunk of the input
+ */
+inline void Sha256::update(std::string_view data)
+{
+  auto const* ptr = reinterpret_cast<unsigned char const*>(data.data());
+  size_t size = data.size();
+  m_size_total += size;
+  // Complete the buffered block
+  if(m_size_buffer > 0)
+  {
+    size_t size_fill = std::min(m_buffer.size() - m_size_buffer, size);
+    std::memcpy(m_buffer.data() + m_size_buffer, ptr, size_fill);
+    m_size_buffer += size_fill;
+    ptr += size_fill;
+    size -= size_fill;
+    if(m_size_buffer < m_buffer.size()) { return; }
+    block(m_buffer.data());
+    m_size_buffer = 0;
+  }
+  // Compress whole blocks directly from the input
+  for(; size >= m_buffer.size(); ptr += m_buffer.size(), size -= m_buffer.size())
+  {
+    block(ptr);
+  }
+  // Keep the rest for the next update
+  std::memcpy(m_buffer.data(), ptr, size);
+  m_size_buffer = size;
+}
+
+/**
+ * @brief Computes the hash of the data added so far
+ *
+ * @return Digest The hash, the state is not modified
+ */
+inline Digest Sha256::digest() const
+{
+  Sha256 copy = *this;
+  uint64_t size_bits = m_size_total * 8;
+  // Padding, then the size in bits
+  std::array<char,72> padding{};
+  padding[0] = static_cast<char>(0x80);
+  size_t size_padding = (m_size_buffer < 56)? 56 - m_size_buffer : 120 - m_size_buffer;
+  for(size_t i = 0; i < 8; ++i)
+  {
+    padding[size_padding + i] = static_cast<char>(size_bits >> (56 - i * 8));
+  }
+  copy.update(std::string_view(padding.data(), size_padding + 8));
+  Digest digest;
+  for(size_t i = 0; i < 8; ++i)
+  {
+    for(size_t j = 0; j < 4; ++j) { digest[i * 4 + j] = static_cast<uint8_t>(copy.m_state[i] >> (24 - j * 8)); }
+  }
+  return digest;
+}
+
+/**
+ * @brief Computes the hash of the data added so far, as hexadecimal
+ *
+ * @return std::string The 64 lowercase hexadecimal digits of the hash
+ */
+inline std::string Sha256::hex() const
+{
+  std::string str_hex;
+  for(uint8_t byte : digest()) { str_hex += std::format("{:02x}", byte); }
+  return str_hex;
+}
+
+/**
+ * @brief Computes the SHA-256 hash of a buffer
+ *
+ * @param data The input
+ * @return std::string The hash, as hexadecimal
+ */
+[[nodiscard]] inline std::string sha256(std::string_view data)
+{
+  Sha256 hash;
+  hash.update(data);
+  return hash.hex();
+}
+
+/**
+ * @brief Computes the SHA-256 hash of a region of a file
+ *
+ * @param fd The file to read with pread, its offset is not changed
+ * @param offset Offset of the region
+ * @param size Size of the region
+ * @return Value<std::string> The hash as hexadecimal, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> sha256(int fd, uint64_t offset, uint64_t size)
+{
+  Sha256 hash;
+  std::vector<char> buffer(1 << 20);
+  while(size > 0)
+  {
+    ssize_t bytes = ::pread(fd, buffer.data(), std::min<uint64_t>(buffer.size(), size), static_cast<off_t>(offset));
+    if(bytes < 0 and errno == EINTR) { continue; }
+    return_if(bytes <= 0, Error("E::Could not read region at {}: {}", offset, bytes < 0? strerror(errno) : "end of file"));
+    hash.update(std::string_view(buffer.data(), bytes));
+    offset += bytes;
+    size -= bytes;
+  }
+  return hash.hex();
+}
+
+} // namespace ns_sha256
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,132 @@
+/**
+ * @file span.hpp
+ * @author Ruan Formigoni
+ * @brief A library to trace the duration of program phases
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @namespace ns_span
+ * @brief Phase tracing in the Chrome trace event format
+ *
+ * When FIM_TRACE=<file> is set, each span is appended to the file as a complete event ("ph":"X")
+ * of the JSON array format, which chrome://tracing and Perfetto load directly. The closing bracket
+ * of the array is optional in that format, so the file is never rewritten: every event is a
+ * single O_APPEND write. Events from threads, forked children and the process image that
+ * replaces the current one with execve land in the same file without coordination.
+ *
+ * Timestamps are taken from the monotonic clock, so the spans of different processes line up.
+ * With FIM_TRACE unset a span costs one branch.
+ */
+namespace ns_span
+{
+
+namespace
+{
+
+/**
+ * @brief Opens the trace file on the first use
+ *
+ * @return int The file descriptor of the trace file, or -1 if tracing is disabled
+ */
+[[nodiscard]] inline int fd_trace()
+{
+  static int const fd = []
+  {
+    char const* path_file_trace = std::getenv("FIM_TRACE");
+    if(path_file_trace == nullptr or *path_file_trace == '\0') { return -1; }
+    // The first process to create the file opens the array
+    int fd = ::open(path_file_trace, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd >= 0)
+    {
+      std::ignore = ::write(fd, "[\n", 2);
+      return fd;
+    }
+    return ::open(path_file_trace, O_WRONLY | O_APPEND | O_CLOEXEC);
+  }();
+  return fd;
+}
+
+/**
+ * @brief Current monotonic time in microseconds
+ *
+ * @return int64_t The time in microseconds
+ */
+[[nodiscard]] inline int64_t now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+/**
+ * @brief Checks if tracing is enabled
+ *
+ * @return bool True if FIM_TRACE points to a writable file
+ */
+[[nodiscard]] inline bool is_enabled()
+{
+  return fd_trace() >= 0;
+}
+
+/**
+ * @class Span
+ * @brief Records the time between its construction and destruction as a trace event
+ */
+class Span
+{
+  private:
+    char const* m_name;
+    int64_t m_time_beg;
+
+  public:
+    explicit Span(char const* name);
+    ~Span();
+    Span(Span const&) = delete;
+    Span(Span&&) = delete;
+    Span& operator=(Span const&) = delete;
+    Span& operator=(Span&&) = delete;
+};
+
+/**
+ * @brief Construct a new Span object and start timing
+ *
+ * @param name Name of the phase, a string literal that needs no escaping
+ */
+inline Span::Span(char const* name)
+  : m_name(name)
+  , m_time_beg(is_enabled()? now_us() : 0)
+{
+}
+
+/**
+ * @brief Destroy the Span object and write its event
+ */
+inline Span::~Span()
+{
+  int fd = fd_trace();
+  if(fd < 0) { return; }
+  std::string event = std::format(R"({{"name":"{}","cat":"fim","ph":"X","ts":{},"dur":{},"pid":{},"tid":{}}},)" "\n"
+    , m_name
+    , m_time_beg
+    , now_us() - m_time_beg
+    , ::getpid()
+    , ::gettid()
+  );
+  std::ignore = ::write(fd, event.data(), event.size());
+}
+
+} // namespace ns_span
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
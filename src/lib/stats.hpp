@@ -0,0 +1,191 @@
+/**
+ * @file stats.hpp
+ * @author Ruan Formigoni
+ * @brief A library of runtime counters shared by the processes of an instance
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+
+/**
+ * @namespace ns_stats
+ * @brief Counters of an instance in a file of its instance directory
+ *
+ * The counters live in '$FIM_DIR_INSTANCE/stats', an array of 64-bit slots that every process of
+ * the instance maps shared on first use: the main process, the janitor, the portal daemons and
+ * their dispatchers. An update is a single relaxed atomic operation on the mapping, no locks or
+ * system calls are involved. Other processes, like 'fim-stats', read the file of a running
+ * instance. With FIM_DIR_INSTANCE unset an update costs one branch.
+ */
+namespace ns_stats
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Number of slots in the file, leaves room for new counters without changing its size
+constexpr size_t const SLOTS = 64;
+constexpr size_t const SIZE_FILE = SLOTS * sizeof(uint64_t);
+
+} // namespace
+
+/**
+ * @brief The counters of an instance, the order is the layout of the file
+ */
+enum class Counter : uint32_t
+{
+  LAYERS_MOUNTED,        ///< Layers mounted by the instance
+  MOUNT_US,              ///< Time to mount the filesystems, in microseconds
+  FUSE_EXITS,            ///< Filesystem processes that exited while mounted
+  SPAWNS,                ///< Subprocesses spawned
+  SPAWNS_VFORK,          ///< Subprocesses spawned without fork
+  PORTAL_REQUESTS,       ///< Requests sent by the portal dispatchers
+  PORTAL_LATENCY_US,     ///< Sum of the times until requested processes started, in microseconds
+  PORTAL_LATENCY_MAX_US, ///< Longest time until a requested process started, in microseconds
+  PORTAL_BYTES_RELAYED,  ///< Bytes relayed between dispatchers and requested processes
+  PORTAL_WORKERS,        ///< Requests served by pre-forked portal workers
+  PORTAL_FORKS,          ///< Requests served by children forked by the portal daemon
+  JANITOR_CLEANUPS,      ///< Cleanups performed by the janitor after the instance crashed
+  JANITOR_UNMOUNTS,      ///< Filesystems un-mounted by the janitor
+  COUNT,
+};
+
+using Counters = std::array<uint64_t, static_cast<size_t>(Counter::COUNT)>;
+
+static_assert(static_cast<size_t>(Counter::COUNT) <= SLOTS);
+
+/**
+ * @brief Names of the counters, in the order of the enumeration
+ */
+constexpr std::array<std::string_view, static_cast<size_t>(Counter::COUNT)> const NAMES
+{
+  "layers_mounted",
+  "mount_us",
+  "fuse_exits",
+  "spawns",
+  "spawns_vfork",
+  "portal_requests",
+  "portal_latency_us",
+  "portal_latency_max_us",
+  "portal_bytes_relayed",
+  "portal_workers",
+  "portal_forks",
+  "janitor_cleanups",
+  "janitor_unmounts",
+};
+
+/**
+ * @brief Maps the counters file, creates it if missing
+ *
+ * @param path_file_stats Path to the counters file
+ * @return Value<uint64_t*> The slots of the file, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t*> map(fs::path const& path_file_stats)
+{
+  int fd = ::open(path_file_stats.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  return_if(fd < 0, Error("D::Could not open stats file '{}': {}", path_file_stats, strerror(errno)));
+  // Growing the file is idempotent, processes that race here end with the same size
+  struct stat st{};
+  if(::fstat(fd, &st) < 0 or (static_cast<size_t>(st.st_size) < SIZE_FILE and ::ftruncate(fd, SIZE_FILE) < 0))
+  {
+    int err = errno;
+    ::close(fd);
+    return Error("D::Could not size stats file '{}': {}", path_file_stats, strerror(err));
+  }
+  void* ptr = ::mmap(nullptr, SIZE_FILE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  return_if(ptr == MAP_FAILED, Error("D::Could not map stats file '{}': {}", path_file_stats, strerror(errno)));
+  return static_cast<uint64_t*>(ptr);
+}
+
+namespace
+{
+
+/**
+ * @brief Maps the counters of the current instance on the first use
+ *
+ * @return uint64_t* The slots of the counters, or nullptr if there is no instance directory
+ */
+[[nodiscard]] inline uint64_t* slots()
+{
+  static uint64_t* const ptr = []() -> uint64_t*
+  {
+    char const* path_dir_instance = std::getenv("FIM_DIR_INSTANCE");
+    if(path_dir_instance == nullptr or *path_dir_instance == '\0') { return nullptr; }
+    return map(fs::path{path_dir_instance} / "stats").value_or(nullptr);
+  }();
+  return ptr;
+}
+
+} // namespace
+
+/**
+ * @brief Adds to a counter of the current instance
+ *
+ * @param counter The counter to increment
+ * @param value The amount to add
+ */
+inline void add(Counter counter, uint64_t value = 1)
+{
+  uint64_t* ptr = slots();
+  if(ptr == nullptr) { return; }
+  std::atomic_ref<uint64_t>(ptr[static_cast<size_t>(counter)]).fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Raises a counter of the current instance to a value, if it is lower
+ *
+ * @param counter The counter to raise
+ * @param value The candidate maximum
+ */
+inline void max(Counter counter, uint64_t value)
+{
+  uint64_t* ptr = slots();
+  if(ptr == nullptr) { return; }
+  std::atomic_ref<uint64_t> slot(ptr[static_cast<size_t>(counter)]);
+  uint64_t current = slot.load(std::memory_order_relaxed);
+  while(current < value and not slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+/**
+ * @brief Reads the counters of an instance
+ *
+ * @param path_dir_instance Path to the instance directory
+ * @return Value<Counters> The counters, zero for an instance that did not update them, or the
+ * respective error
+ */
+[[nodiscard]] inline Value<Counters> read(fs::path const& path_dir_instance)
+{
+  Counters counters{};
+  fs::path path_file_stats = path_dir_instance / "stats";
+  return_if(not fs::exists(path_file_stats), counters);
+  uint64_t* ptr = Pop(map(path_file_stats));
+  for(size_t i = 0; i < counters.size(); ++i)
+  {
+    counters[i] = std::atomic_ref<uint64_t>(ptr[i]).load(std::memory_order_relaxed);
+  }
+  ::munmap(ptr, SIZE_FILE);
+  return counters;
+}
+
+} // namespace ns_stats
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
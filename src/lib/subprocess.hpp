@@ -8,12 +8,16 @@
 
 #pragma once
 
+#include <array>
 #include <cstring>
 #include <functional>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/wait.h>
 #include <csignal>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/prctl.h>
@@ -26,10 +30,13 @@
 #include <memory>
 
 #include "log.hpp"
+#include "affinity.hpp"
+#include "stats.hpp"
 #include "../macro.hpp"
 #include "../std/vector.hpp"
 #include "subprocess/pipe.hpp"
 #include "subprocess/child.hpp"
+#include "subprocess/wait.hpp"
 
 /**
  * @namespace ns_subprocess
@@ -105,6 +112,105 @@ inline std::unique_ptr<const char*[]> to_carray(std::vector<std::string> const&
   return arr;
 }
 
+/**
+ * @brief What the child of a vfork spawn does before execve, prepared by the parent
+ *
+ * The child shares the memory of the parent until it calls execve, so it only makes system calls
+ * on data prepared beforehand, without allocations or logging.
+ */
+struct Shim
+{
+  char const* program;                   ///< Program to execute
+  char* const* argv;                     ///< Null terminated arguments
+  char* const* envp;                     ///< Null terminated environment
+  std::array<int,3> fds_stdio;           ///< Duplicated to stdin, stdout and stderr, -1 to inherit
+  std::array<int,6> fds_close;           ///< Closed before execve, -1 to skip
+  pid_t pid_die;                         ///< The child dies with this pid, -1 to disable
+  ns_affinity::Affinity const* affinity; ///< Placement of the child, nullptr to inherit
+  sigset_t mask;                         ///< Signal mask restored before execve
+  char const* failure;                   ///< The step that failed, read by the parent
+  int err;                               ///< The errno of the failure
+};
+
+namespace
+{
+
+/**
+ * @brief Entry point of the child of a vfork spawn
+ *
+ * @param arg The Shim that describes the child
+ * @return int Does not return on success
+ */
+inline int shim_exec(void* arg)
+{
+  Shim* shim = static_cast<Shim*>(arg);
+  auto f_fail = [&](char const* failure)
+  {
+    shim->failure = failure;
+    shim->err = errno;
+    _exit(1);
+  };
+  // Signals are blocked, handlers of the parent must not run on its memory once they are unblocked
+  struct sigaction action_default{};
+  action_default.sa_handler = SIG_DFL;
+  sigemptyset(&action_default.sa_mask);
+  for(int sig = 1; sig < _NSIG; ++sig)
+  {
+    struct sigaction action{};
+    if(::sigaction(sig, nullptr, &action) == 0 and action.sa_handler != SIG_IGN and action.sa_handler != SIG_DFL)
+    {
+      ::sigaction(sig, &action_default, nullptr);
+    }
+  }
+  for(int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+  {
+    if(shim->fds_stdio[fd] >= 0 and ::dup2(shim->fds_stdio[fd], fd) < 0) { f_fail("dup2()"); }
+  }
+  for(int fd : shim->fds_close)
+  {
+    if(fd > STDERR_FILENO) { ::close(fd); }
+  }
+  if(shim->pid_die >= 0 and ::prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) { f_fail("prctl()"); }
+  if(shim->pid_die >= 0 and ::kill(shim->pid_die, 0) < 0) { f_fail("kill()"); }
+  if(shim->affinity != nullptr) { std::ignore = ns_affinity::apply(*shim->affinity); }
+  ::sigprocmask(SIG_SETMASK, &shim->mask, nullptr);
+  ::execve(shim->program, shim->argv, shim->envp);
+  f_fail("execve()");
+  return 1;
+}
+
+} // namespace
+
+/**
+ * @brief Starts the child described by a Shim with clone(CLONE_VM | CLONE_VFORK)
+ *
+ * Returns once the child called execve or exited, a failed step of the child is logged.
+ *
+ * @param shim The child to start, its mask is filled with the one of the caller
+ * @param is_mask_clear Start the program with an empty signal mask instead of the one of the caller
+ * @return pid_t The pid of the child, or -1 on failure
+ */
+inline pid_t clone_shim(Shim& shim, bool is_mask_clear = false)
+{
+  constexpr size_t const size_stack = 64 * 1024;
+  void* stack = ::mmap(nullptr, size_stack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  return_if(stack == MAP_FAILED, -1, "E::Failed to allocate the stack of the child: {}", strerror(errno));
+  // Block signals until the child resets the handlers of the parent
+  sigset_t mask_all, mask_parent;
+  sigfillset(&mask_all);
+  ::pthread_sigmask(SIG_SETMASK, &mask_all, &mask_parent);
+  shim.mask = mask_parent;
+  if(is_mask_clear) { sigemptyset(&shim.mask); }
+  // Returns once the child called execve or exited
+  pid_t pid = ::clone(shim_exec, static_cast<char*>(stack) + size_stack, CLONE_VM | CLONE_VFORK | SIGCHLD, &shim);
+  int err = errno;
+  ::pthread_sigmask(SIG_SETMASK, &mask_parent, nullptr);
+  ::munmap(stack, size_stack);
+  return_if(pid < 0, -1, "E::Failed to clone: {}", strerror(err));
+  log_if(shim.failure != nullptr, "E::{} failed for '{}': {}", shim.failure, shim.program, strerror(shim.err));
+  return pid;
+}
+
 class Subprocess
 {
   private:
@@ -116,10 +222,12 @@ class Subprocess
     std::reference_wrapper<std::ostream> m_stderr;
     Stream m_stream_mode;
     std::optional<pid_t> m_die_on_pid;
+    std::optional<ns_affinity::Affinity> m_affinity;
     std::filesystem::path m_path_file_log;
     ns_log::Level m_log_level;
     std::optional<std::function<void(ArgsCallbackChild)>> m_callback_child;
     std::optional<std::function<void(ArgsCallbackParent)>> m_callback_parent;
+    std::function<void(std::string_view)> m_callback_line;
     bool m_daemon_mode;
 
     void die_on_pid(pid_t pid);
@@ -130,6 +238,7 @@ class Subprocess
       , int pipestderr[2]
       , std::filesystem::path const& path_file_log);
     [[noreturn]] void exec_child();
+    [[nodiscard]] pid_t spawn_vfork(int pipestdin[2], int pipestdout[2], int pipestderr[2]);
 
   public:
     template<ns_concept::StringRepresentable T>
@@ -159,6 +268,8 @@ class Subprocess
 
     [[maybe_unused]] [[nodiscard]] Subprocess& with_die_on_pid(pid_t pid);
 
+    [[maybe_unused]] [[nodiscard]] Subprocess& with_affinity(std::optional<ns_affinity::Affinity> const& affinity);
+
     [[maybe_unused]] [[nodiscard]] Subprocess& with_stdio(Stream mode);
 
     [[maybe_unused]] [[nodiscard]] Subprocess& with_log_file(std::filesystem::path const& path);
@@ -173,6 +284,9 @@ class Subprocess
     template<typename F>
     [[maybe_unused]] [[nodiscard]] Subprocess& with_callback_parent(F&& f);
 
+    template<typename F>
+    [[maybe_unused]] [[nodiscard]] Subprocess& with_callback_line(F&& f);
+
     [[maybe_unused]] [[nodiscard]] Subprocess& with_daemon();
 
     [[maybe_unused]] [[nodiscard]] std::unique_ptr<Child> spawn();
@@ -210,10 +324,12 @@ Subprocess::Subprocess(T&& t)
   , m_stderr(stream::null())
   , m_stream_mode(Stream::Inherit)
   , m_die_on_pid(std::nullopt)
+  , m_affinity(std::nullopt)
   , m_path_file_log("/dev/null")
   , m_log_level(ns_log::get_level())
   , m_callback_child(std::nullopt)
   , m_callback_parent(std::nullopt)
+  , m_callback_line()
   , m_daemon_mode(false)
 {
   // argv0 is program name
@@ -515,6 +631,27 @@ inline Subprocess& Subprocess::with_die_on_pid(pid_t pid)
   return *this;
 }
 
+/**
+ * @brief Sets the CPU affinity and NUMA memory placement of the child process
+ *
+ * The placement is applied in the child before it executes, so the program and all of its
+ * descendants start on the given CPUs.
+ *
+ * @param affinity The placement, or std::nullopt to inherit the placement of the parent
+ * @return Subprocess& A reference to *this for method chaining
+ *
+ * @code
+ * Subprocess("/usr/bin/server")
+ *   .with_affinity(ns_affinity::parse("0-3").value())
+ *   .spawn();
+ * @endcode
+ */
+inline Subprocess& Subprocess::with_affinity(std::optional<ns_affinity::Affinity> const& affinity)
+{
+  m_affinity = affinity;
+  return *this;
+}
+
 /**
  * @brief Sets the stdio redirection mode for the child process
  *
@@ -694,6 +831,7 @@ inline std::vector<std::jthread> Subprocess::setup_pipes(pid_t child_pid
     , m_stdout.get()
     , m_stderr.get()
     , log
+    , m_callback_line
   );
 }
 
@@ -716,6 +854,56 @@ inline std::vector<std::jthread> Subprocess::setup_pipes(pid_t child_pid
   _exit(1);
 }
 
+/**
+ * @brief Spawns the child with clone(CLONE_VM | CLONE_VFORK) and executes the program
+ *
+ * The page tables of the parent are not copied, and the parent is suspended until the child
+ * calls execve or exits, so the cost does not grow with the memory of the parent. Only usable
+ * when nothing arbitrary runs in the child, the stdio, death signal and affinity are prepared in
+ * a Shim.
+ *
+ * @param pipestdin Stdin pipe array [read_end, write_end], used with Stream::Pipe
+ * @param pipestdout Stdout pipe array [read_end, write_end], used with Stream::Pipe
+ * @param pipestderr Stderr pipe array [read_end, write_end], used with Stream::Pipe
+ * @return pid_t The pid of the child, or -1 on failure
+ */
+inline pid_t Subprocess::spawn_vfork(int pipestdin[2], int pipestdout[2], int pipestderr[2])
+{
+  auto argv_custom = to_carray(m_args);
+  auto envp_custom = to_carray(m_env);
+  Shim shim
+  {
+    .program = m_program.c_str(),
+    .argv = const_cast<char* const*>(argv_custom.get()),
+    .envp = const_cast<char* const*>(envp_custom.get()),
+    .fds_stdio = { -1, -1, -1 },
+    .fds_close = { -1, -1, -1, -1, -1, -1 },
+    .pid_die = m_die_on_pid.value_or(-1),
+    .affinity = m_affinity? &m_affinity.value() : nullptr,
+    .mask = {},
+    .failure = nullptr,
+    .err = 0,
+  };
+  // Same redirections as to_dev_null() and ns_pipe::pipes_child()
+  int fd_null = -1;
+  if(m_stream_mode == Stream::Null)
+  {
+    fd_null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    return_if(fd_null < 0, -1, "E::Failed to open /dev/null: {}", strerror(errno));
+    shim.fds_stdio = { fd_null, fd_null, fd_null };
+  }
+  else if(m_stream_mode == Stream::Pipe)
+  {
+    if(not ns_pipe::is_standard_stream(m_stdin.get())) { shim.fds_stdio[0] = pipestdin[0]; }
+    if(not ns_pipe::is_standard_stream(m_stdout.get())) { shim.fds_stdio[1] = pipestdout[1]; }
+    if(not ns_pipe::is_standard_stream(m_stderr.get())) { shim.fds_stdio[2] = pipestderr[1]; }
+    shim.fds_close = { pipestdin[0], pipestdin[1], pipestdout[0], pipestdout[1], pipestderr[0], pipestderr[1] };
+  }
+  pid_t pid = clone_shim(shim);
+  if(fd_null >= 0) { ::close(fd_null); }
+  return pid;
+}
+
 /**
  * @brief Configures stream handlers for stdin, stdout, and stderr of the child process
  *
@@ -863,6 +1051,33 @@ inline Subprocess& Subprocess::with_callback_parent(F&& f)
   return *this;
 }
 
+/**
+ * @brief Sets a callback for each line the child writes to its stdout and stderr pipes
+ *
+ * The callback runs in the pipe reader threads, which only exist in Stream::Pipe mode with
+ * streams other than the standard ones, e.g., after with_log_file(). Lines are split on newlines
+ * and carriage returns, so progress updates arrive one by one. A callback shared by stdout and
+ * stderr is called from both threads concurrently.
+ *
+ * @tparam F Function type compatible with std::function<void(std::string_view)>
+ * @param f Callback function that receives each non-blank line
+ * @return Subprocess& A reference to *this for method chaining
+ *
+ * @code
+ * std::atomic<uint64_t> count_lines{0};
+ * Subprocess("/usr/bin/app")
+ *   .with_log_file("/tmp/app.log")
+ *   .with_callback_line([&](std::string_view){ ++count_lines; })
+ *   .spawn();
+ * @endcode
+ */
+template<typename F>
+inline Subprocess& Subprocess::with_callback_line(F&& f)
+{
+  m_callback_line = std::forward<F>(f);
+  return *this;
+}
+
 /**
  * @brief Enable daemon mode using double fork pattern
  *
@@ -898,7 +1113,9 @@ inline Subprocess& Subprocess::with_daemon()
  *
  * Creates a child process via fork() and executes the configured program.
  * When daemon mode is enabled via with_daemon(), performs a double fork pattern
- * to fully detach the process from the terminal and parent.
+ * to fully detach the process from the terminal and parent. Without a child callback
+ * or daemon mode, the child is created with clone(CLONE_VM | CLONE_VFORK) instead,
+ * see spawn_vfork().
  *
  * The parent process returns a Child handle immediately while the
  * child runs asynchronously. Call wait() on the returned handle
@@ -979,8 +1196,12 @@ inline std::unique_ptr<Child> Subprocess::spawn()
     *grandchild_pid_ptr = -1;  // Initialize
   }
 
+  // Without a child callback nothing arbitrary runs before execve, so the child does not need a
+  // copy of the address space of the parent
+  bool const is_vfork = not m_callback_child and not m_daemon_mode;
+
   // Create child
-  pid_t pid = fork();
+  pid_t pid = is_vfork? this->spawn_vfork(pipestdin, pipestdout, pipestderr) : fork();
 
   // Failed to fork
   if (pid < 0)
@@ -989,13 +1210,15 @@ inline std::unique_ptr<Child> Subprocess::spawn()
     {
       munmap(grandchild_pid_ptr, sizeof(pid_t));
     }
-    logger("E::Failed to fork");
+    logger("E::Failed to spawn '{}'", m_program);
     return Child::create(-1, m_program);
   }
 
   // Parent returns here, child continues to execve
   if ( pid > 0 )
   {
+    ns_stats::add(ns_stats::Counter::SPAWNS);
+    if (is_vfork) { ns_stats::add(ns_stats::Counter::SPAWNS_VFORK); }
     std::vector<std::jthread> pipe_threads;
 
     // If daemon mode, wait for intermediate child to exit and read grandchild PID
@@ -1101,6 +1324,12 @@ inline std::unique_ptr<Child> Subprocess::spawn()
     this->die_on_pid(m_die_on_pid.value());
   }
 
+  // Place the child on its CPUs and NUMA nodes
+  if(m_affinity and not ns_affinity::apply(m_affinity.value()))
+  {
+    logger("W::Could not apply CPU affinity to '{}'", m_program);
+  }
+
   // Execute child callback if provided
   if (m_callback_child)
   {
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <sys/wait.h>
@@ -21,6 +22,7 @@
 
 #include "../../macro.hpp"
 #include "../../std/expected.hpp"
+#include "../linux.hpp"
 
 namespace ns_subprocess
 {
@@ -175,6 +177,46 @@ class Child
         : Error("E::The process {} exited abnormally", m_description);
     }
 
+    /**
+     * @brief Waits for the child process to finish, up to a timeout
+     *
+     * Like wait(), but returns an empty optional if the child is still running after the
+     * timeout. Without pidfd support, it returns after at most 100ms.
+     *
+     * @param timeout Maximum time to wait
+     * @return Value<std::optional<int>> The exit code, nothing if the child is still running, or
+     * the respective error
+     *
+     * @code
+     * auto child = Subprocess("/bin/sleep").with_args("10").spawn();
+     * if (auto code = child->wait(std::chrono::seconds(1)); code and not *code) {
+     *     child->kill(SIGTERM);
+     * }
+     * @endcode
+     */
+    [[nodiscard]] Value<std::optional<int>> wait(std::chrono::milliseconds const& timeout)
+    {
+      return_if(m_pid <= 0, Error("E::Invalid pid to wait for in {}", m_description));
+      std::ignore = ns_linux::PidFd(m_pid).wait(timeout);
+      // Daemons are not children of this process, wait() reports them
+      siginfo_t info{};
+      if (::waitid(P_PID, m_pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 and info.si_pid == 0)
+      {
+        return std::optional<int>{};
+      }
+      return std::optional<int>(Pop(wait()));
+    }
+
+    /**
+     * @brief Gets the description of the child process
+     *
+     * @return std::string const& The description, typically the program name
+     */
+    [[nodiscard]] std::string const& description() const
+    {
+      return m_description;
+    }
+
     /**
      * @brief Gets the PID of the child process
      *
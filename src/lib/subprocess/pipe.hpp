@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstring>
 #include <istream>
 #include <thread>
@@ -17,7 +18,9 @@
 #include <sys/wait.h>
 #include <sys/prctl.h>
 #include <csignal>
+#include <pthread.h>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <sys/types.h>
 #include <filesystem>
@@ -40,11 +43,20 @@ namespace ns_subprocess
 namespace ns_pipe
 {
 
+namespace
+{
+
+// Lines of the output of a child that each pipe reader logs per second, the others are counted
+constexpr uint64_t const LINES_PER_SECOND = 1000;
+
+} // namespace
+
 /**
  * @brief Write from an input stream to a pipe file descriptor
  *
- * Reads lines from the input stream and writes them to the pipe.
- * Continues until the child process exits or stream errors occur.
+ * Reads data from the input stream and writes it to the pipe.
+ * Continues until the child process exits, the input of a stream backed by a file
+ * descriptor ends, or stream errors occur. Closing the pipe gives the child EOF.
  *
  * @param child_pid PID of the child process to monitor
  * @param pipe_fd File descriptor of the pipe write end
@@ -52,6 +64,12 @@ namespace ns_pipe
  */
 inline void write_pipe(pid_t child_pid, int pipe_fd, std::istream& stream)
 {
+  // A child that exits before reading its input fails the write instead of raising SIGPIPE, the
+  // signal stays pending on this thread and is discarded with it
+  sigset_t set_pipe;
+  sigemptyset(&set_pipe);
+  sigaddset(&set_pipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set_pipe, nullptr);
   ns_linux::ns_fd::redirect_stream_to_fd(child_pid, stream, pipe_fd).discard();
   close(pipe_fd);
 }
@@ -61,23 +79,50 @@ inline void write_pipe(pid_t child_pid, int pipe_fd, std::istream& stream)
  *
  * Reads data from the pipe and writes it to the output stream.
  * Handles line splitting and filtering of empty/whitespace-only lines.
- * Replaces carriage returns with newlines to handle Windows-style line endings
- * and progress updates.
+ * Carriage returns end lines, to handle Windows-style line endings
+ * and progress updates. At most LINES_PER_SECOND lines are copied to the
+ * log file each second, the stream receives all of them.
  *
  * @param child_pid PID of the child process to monitor
  * @param pipe_fd File descriptor of the pipe read end
  * @param stream Output stream to write to
  * @param path_file_log Log file path for logging output
+ * @param f_line Optional callback for each line, called before the line is logged
  */
-inline void read_pipe(pid_t child_pid, int pipe_fd, std::ostream& stream, std::filesystem::path const& path_file_log)
+inline void read_pipe(pid_t child_pid
+  , int pipe_fd
+  , std::ostream& stream
+  , std::filesystem::path const& path_file_log
+  , std::function<void(std::string_view)> const& f_line)
 {
   ns_log::set_sink_file(path_file_log);
 
+  auto time_window = std::chrono::steady_clock::now();
+  uint64_t lines_window = 0;
+  uint64_t lines_dropped = 0;
+  auto f_dropped = [&]
+  {
+    log_if(lines_dropped > 0, "W::Dropped {} lines of the output of pid '{}' from the log", lines_dropped, child_pid);
+    lines_dropped = 0;
+  };
   ns_linux::ns_fd::redirect_fd_to_stream(child_pid
     , pipe_fd
     , stream
-    , [](std::string const& s) { logger("D::STD(OUT|ERR)::{}", s); return s; }
+    , [&](std::string_view line)
+    {
+      if(f_line) { f_line(line); }
+      // Report the lines dropped in the previous window
+      if(auto now = std::chrono::steady_clock::now(); now - time_window >= std::chrono::seconds(1))
+      {
+        f_dropped();
+        time_window = now;
+        lines_window = 0;
+      }
+      if(++lines_window > LINES_PER_SECOND) { ++lines_dropped; return; }
+      logger("D::STD(OUT|ERR)::{}", line);
+    }
   ).discard();
+  f_dropped();
   close(pipe_fd);
 }
 
@@ -143,6 +188,7 @@ void pipes_child(bool is_istream, int pipe[2], Stream& stream, int fileno)
  * @param pipe Pipe array [read_end, write_end]
  * @param stream The stream reference to use
  * @param path_file_log Optional log file path (unused for stdin)
+ * @param f_line Optional callback for each line of output (unused for stdin)
  * @return std::optional<std::jthread> The created thread, or std::nullopt if no thread was created
  */
 template<typename Stream>
@@ -151,7 +197,8 @@ std::optional<std::jthread> pipes_parent(
   bool is_istream,
   int pipe[2],
   Stream& stream,
-  std::filesystem::path const& path_file_log)
+  std::filesystem::path const& path_file_log,
+  std::function<void(std::string_view)> const& f_line = {})
 {
   // For input streams (stdin):  parent uses write end [1], child uses read end [0]
   // For output streams (stdout/stderr): parent uses read end [0], child uses write end [1]
@@ -177,7 +224,7 @@ std::optional<std::jthread> pipes_parent(
   else // std::ostream
   {
     // Output stream: read from child's stdout/stderr pipe and write to Stream
-    return std::jthread(read_pipe, child_pid, pipe[idx_parent], std::ref(stream), path_file_log);
+    return std::jthread(read_pipe, child_pid, pipe[idx_parent], std::ref(stream), path_file_log, f_line);
   }
 }
 
@@ -199,6 +246,7 @@ std::optional<std::jthread> pipes_parent(
  * @param stdout Output stream to write to (for child's stdout)
  * @param stderr Error stream to write to (for child's stderr)
  * @param path_file_log Log file path for pipe reader threads
+ * @param f_line Optional callback for each line of stdout and stderr, called from the reader threads
  * @return std::vector<std::jthread> Vector of created threads (empty for child process)
  */
 inline std::vector<std::jthread> setup(
@@ -209,7 +257,8 @@ inline std::vector<std::jthread> setup(
   std::istream& stdin,
   std::ostream& stdout,
   std::ostream& stderr,
-  std::filesystem::path const& path_file_log)
+  std::filesystem::path const& path_file_log,
+  std::function<void(std::string_view)> const& f_line = {})
 {
   std::vector<std::jthread> threads;
 
@@ -220,11 +269,11 @@ inline std::vector<std::jthread> setup(
     {
       threads.push_back(std::move(*t));
     }
-    if (auto t = pipes_parent(pid, false, pipestdout, stdout, path_file_log))
+    if (auto t = pipes_parent(pid, false, pipestdout, stdout, path_file_log, f_line))
     {
       threads.push_back(std::move(*t));
     }
-    if (auto t = pipes_parent(pid, false, pipestderr, stderr, path_file_log))
+    if (auto t = pipes_parent(pid, false, pipestderr, stderr, path_file_log, f_line))
     {
       threads.push_back(std::move(*t));
     }
@@ -0,0 +1,189 @@
+/**
+ * @file wait.hpp
+ * @author Ruan Formigoni
+ * @brief Waits on many child processes at once
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "../../macro.hpp"
+#include "../../std/expected.hpp"
+#include "../linux.hpp"
+#include "child.hpp"
+
+namespace ns_subprocess
+{
+
+/**
+ * @brief The exit of a process in a wait set
+ */
+struct Exit
+{
+  pid_t pid;                 ///< The pid of the process
+  std::string description;   ///< Description of the process, typically the program name
+  std::optional<int> code;   ///< The exit code, if the process exited normally
+  std::optional<int> signal; ///< The signal that terminated the process, if any
+};
+
+/**
+ * @class WaitSet
+ * @brief Sleeps until any of a set of processes exits
+ *
+ * Each process is watched through a pidfd, and all of them are polled together. Exits are
+ * reported without reaping the processes, so their Child handles still wait on them and collect
+ * the exit code. A reported process leaves the set. Without pidfd support the processes are
+ * checked periodically.
+ *
+ * @note Not thread-safe, add processes before waiting on the set from another thread.
+ *
+ * @code
+ * auto child_a = Subprocess("/bin/sleep").with_args("1").spawn();
+ * auto child_b = Subprocess("/bin/sleep").with_args("2").spawn();
+ * WaitSet wait_set;
+ * wait_set.add(*child_a);
+ * wait_set.add(*child_b);
+ * while(not wait_set.empty())
+ * {
+ *   for(auto const& exit : wait_set.wait(std::chrono::seconds(5)).value_or(std::vector<Exit>{}))
+ *   {
+ *     std::println("{} exited", exit.description);
+ *   }
+ * }
+ * @endcode
+ */
+class WaitSet
+{
+  private:
+    struct Entry
+    {
+      pid_t pid;
+      std::string description;
+      std::unique_ptr<ns_linux::PidFd> pidfd;
+    };
+    std::vector<Entry> m_entries;
+
+  public:
+    WaitSet() = default;
+    WaitSet(WaitSet const&) = delete;
+    WaitSet& operator=(WaitSet const&) = delete;
+    void add(pid_t pid, std::string const& description);
+    void add(Child const& child);
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] Value<std::vector<Exit>> wait(std::chrono::milliseconds timeout);
+};
+
+namespace
+{
+
+// Interval to check processes without a pidfd
+constexpr auto const TIMEOUT_CHECK = std::chrono::milliseconds(100);
+
+/**
+ * @brief Gets the exit status of a process without reaping it
+ *
+ * @param pid The process
+ * @param exit Where to store the exit code or the signal
+ * @return bool True if the process exited, false if it is a child that is still running
+ */
+[[nodiscard]] inline bool peek(pid_t pid, Exit& exit)
+{
+  siginfo_t info{};
+  // Processes that are not children of this one, like daemons, have no status to peek
+  return_if(::waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0, true);
+  return_if(info.si_pid == 0, false);
+  if(info.si_code == CLD_EXITED) { exit.code = info.si_status; }
+  else { exit.signal = info.si_status; }
+  return true;
+}
+
+} // namespace
+
+/**
+ * @brief Adds a process to the set
+ *
+ * @param pid The process to watch, non-positive pids are ignored
+ * @param description Description of the process, used in the reported exit
+ */
+inline void WaitSet::add(pid_t pid, std::string const& description)
+{
+  return_if(pid <= 0,);
+  m_entries.push_back(Entry{ pid, description, std::make_unique<ns_linux::PidFd>(pid) });
+}
+
+/**
+ * @brief Adds a child process to the set
+ *
+ * @param child The child to watch, ignored if it was already waited on
+ */
+inline void WaitSet::add(Child const& child)
+{
+  this->add(child.get_pid().value_or(-1), child.description());
+}
+
+/**
+ * @brief Checks if there are processes left to wait on
+ *
+ * @return bool True if all the processes were reported
+ */
+inline bool WaitSet::empty() const
+{
+  return m_entries.empty();
+}
+
+/**
+ * @brief Waits for processes in the set to exit
+ *
+ * Returns early if a signal interrupts the wait.
+ *
+ * @param timeout Maximum time to wait, negative to wait indefinitely
+ * @return Value<std::vector<Exit>> The processes that exited, empty on timeout, or the respective
+ * error
+ */
+inline Value<std::vector<Exit>> WaitSet::wait(std::chrono::milliseconds timeout)
+{
+  return_if(m_entries.empty(), std::vector<Exit>{});
+  std::vector<pollfd> pfds;
+  for(auto const& entry : m_entries)
+  {
+    // Poll ignores negative file descriptors
+    pfds.push_back(pollfd{ .fd = entry.pidfd->fd(), .events = POLLIN, .revents = 0 });
+    if(entry.pidfd->fd() < 0 and (timeout.count() < 0 or timeout > TIMEOUT_CHECK))
+    {
+      timeout = TIMEOUT_CHECK;
+    }
+  }
+  int ret = ::poll(pfds.data(), pfds.size(), static_cast<int>(timeout.count()));
+  return_if(ret < 0 and errno != EINTR, Error("E::Could not poll the wait set: {}", strerror(errno)));
+  std::vector<Exit> exits;
+  for(size_t i = 0; i < m_entries.size(); ++i)
+  {
+    Entry const& entry = m_entries[i];
+    continue_if(pfds[i].fd >= 0 and pfds[i].revents == 0);
+    Exit exit{ .pid = entry.pid, .description = entry.description, .code = {}, .signal = {} };
+    continue_if(not peek(entry.pid, exit));
+    // Without a pidfd, processes that are not children are checked for existence
+    continue_if(pfds[i].fd < 0 and not exit.code and not exit.signal and ::kill(entry.pid, 0) == 0);
+    exits.push_back(exit);
+  }
+  std::erase_if(m_entries, [&](Entry const& entry)
+  {
+    return std::ranges::any_of(exits, [&](Exit const& exit){ return exit.pid == entry.pid; });
+  });
+  return exits;
+}
+
+} // namespace ns_subprocess
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
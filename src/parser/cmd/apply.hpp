@@ -0,0 +1,192 @@
+/**
+ * @file apply.hpp
+ * @author Ruan Formigoni
+ * @brief Applies a declarative configuration to the reserved space in one write
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../../std/expected.hpp"
+#include "../../db/db.hpp"
+#include "../../db/env.hpp"
+#include "../../db/boot.hpp"
+#include "../../db/bind.hpp"
+#include "../../db/remote.hpp"
+#include "../../reserved/reserved.hpp"
+#include "../../reserved/permissions.hpp"
+#include "../../reserved/overlay.hpp"
+#include "../../reserved/notify.hpp"
+#include "../../reserved/casefold.hpp"
+#include "../../reserved/volatile.hpp"
+#include "../../reserved/boot.hpp"
+#include "../../reserved/unshare.hpp"
+#include "../../macro.hpp"
+#include "../../config.hpp"
+#include "../interface.hpp"
+#include "bind.hpp"
+#include "desktop.hpp"
+#include "unshare.hpp"
+
+/**
+ * @namespace ns_cmd::ns_apply
+ * @brief Implementation of 'fim-config apply'
+ *
+ * The configuration is a json object whose keys replace the respective configuration, each
+ * with the same values as the command that sets it:
+ *
+ * - 'permissions': Array of permissions, as 'fim-perms set'
+ * - 'environment': Array of 'KEY=VALUE' entries, as 'fim-env set'
+ * - 'bind': Object of bindings by index, as printed by 'fim-bind list'
+ * - 'boot': Object with 'program' and 'args', as printed by 'fim-boot show'
+ * - 'desktop': Path to the json file of 'fim-desktop setup'
+ * - 'remote': URL, as 'fim-remote set'
+ * - 'overlay': Overlay type, as 'fim-overlay set'
+ * - 'unshare': Array of namespaces, as 'fim-unshare set'
+ * - 'notify', 'casefold', 'volatile': 'on' or 'off'
+ *
+ * Missing keys leave their configuration as is. All of them are written in a single
+ * transaction, an invalid entry leaves the binary unchanged.
+ */
+namespace ns_cmd::ns_apply
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Keys accepted in the configuration, in the order they are applied
+constexpr std::array<std::string_view,11> const KEYS
+{
+  "permissions", "environment", "bind", "boot", "desktop", "remote", "overlay", "unshare", "notify", "casefold", "volatile"
+};
+
+/**
+ * @brief Parses a set of enumeration values from a json array of strings
+ *
+ * @tparam E The enumeration, e.g., a Permission
+ * @param db The json array
+ * @param key Name of the array for the error messages
+ * @return Value<std::set<E>> The values, or the respective error
+ */
+template<typename E>
+[[nodiscard]] inline Value<std::set<E>> to_set(ns_db::Db db, std::string_view key)
+{
+  std::set<E> values;
+  for(std::string const& str : Pop(db.value<std::vector<std::string>>(), "C::'{}' must be an array of strings", key))
+  {
+    values.insert(Pop(E::from_string(str), "C::Invalid value '{}' in '{}'", str, key));
+  }
+  return values;
+}
+
+/**
+ * @brief Parses an 'on' or 'off' switch
+ *
+ * @param db The json string
+ * @param key Name of the switch for the error messages
+ * @return Value<bool> True for 'on', or the respective error
+ */
+[[nodiscard]] inline Value<bool> to_switch(ns_db::Db db, std::string_view key)
+{
+  std::string str = Pop(db.value<std::string>(), "C::'{}' must be 'on' or 'off'", key);
+  return_if(str != "on" and str != "off", Error("C::'{}' must be 'on' or 'off', found '{}'", key, str));
+  return str == "on";
+}
+
+} // namespace
+
+/**
+ * @brief Applies a configuration file to the binary
+ *
+ * @param fim The FlatImage configuration object
+ * @param path_file_config Path to the json configuration
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> apply(ns_config::FlatImage const& fim, fs::path const& path_file_config)
+{
+  fs::path const& path_file_binary = fim.path.bin.self;
+  ns_db::Db db = Pop(ns_db::read_file(path_file_config), "C::Could not read configuration '{}'", path_file_config);
+  for(std::string const& key : db.keys())
+  {
+    return_if(not std::ranges::contains(KEYS, key), Error("C::Unknown key '{}' in '{}'", key, path_file_config));
+  }
+  // Every write below is staged and written at once on commit
+  ns_reserved::Transaction transaction(path_file_binary);
+  for(std::string_view key : KEYS)
+  {
+    std::string str_key{key};
+    continue_if(not db.contains(str_key));
+    ns_db::Db value = db(str_key);
+    if(key == "permissions")
+    {
+      auto permissions = Pop(to_set<ns_reserved::ns_permissions::Permission>(value, key));
+      Pop(ns_reserved::ns_permissions::Permissions(path_file_binary).set(permissions), "E::Failed to set permissions");
+    }
+    else if(key == "environment")
+    {
+      auto variables = Pop(value.value<std::vector<std::string>>(), "C::'environment' must be an array of strings");
+      Pop(ns_db::ns_env::set(path_file_binary, variables), "E::Failed to set variables");
+    }
+    else if(key == "bind")
+    {
+      auto binds = Pop(ns_db::ns_bind::deserialize(Pop(value.dump())), "C::Invalid bindings");
+      Pop(ns_cmd::ns_bind::db_write(path_file_binary, binds), "E::Failed to set bindings");
+    }
+    else if(key == "boot")
+    {
+      auto boot = Pop(ns_db::ns_boot::deserialize(Pop(value.dump())), "C::Invalid boot configuration");
+      Pop(ns_reserved::ns_boot::write(path_file_binary, Pop(ns_db::ns_boot::encode(boot))), "E::Failed to set boot configuration");
+    }
+    else if(key == "desktop")
+    {
+      auto path_file_desktop = Pop(value.value<std::string>(), "C::'desktop' must be the path to a json file");
+      Pop(ns_desktop::setup(fim, path_file_desktop), "E::Failed to setup desktop integration");
+    }
+    else if(key == "remote")
+    {
+      auto url = Pop(value.value<std::string>(), "C::'remote' must be a string");
+      Pop(ns_db::ns_remote::set(path_file_binary, url), "E::Failed to set remote URL");
+    }
+    else if(key == "overlay")
+    {
+      auto str_overlay = Pop(value.value<std::string>(), "C::'overlay' must be a string");
+      auto overlay = Pop(ns_reserved::ns_overlay::OverlayType::from_string(str_overlay), "C::Invalid overlay type");
+      Pop(ns_reserved::ns_overlay::write(path_file_binary, overlay), "E::Failed to set overlay");
+    }
+    else if(key == "unshare")
+    {
+      auto unshares = Pop(to_set<ns_reserved::ns_unshare::Unshare>(value, key));
+      Pop(ns_cmd::ns_unshare::set(path_file_binary, unshares), "E::Failed to set unshare options");
+    }
+    else if(key == "notify")
+    {
+      Pop(ns_reserved::ns_notify::write(path_file_binary, Pop(to_switch(value, key))), "E::Failed to write notify status");
+    }
+    else if(key == "casefold")
+    {
+      Pop(ns_reserved::ns_casefold::write(path_file_binary, Pop(to_switch(value, key))), "E::Failed to write casefold status");
+    }
+    else if(key == "volatile")
+    {
+      Pop(ns_reserved::ns_volatile::write(path_file_binary, Pop(to_switch(value, key))), "E::Failed to write volatile status");
+    }
+  }
+  Pop(transaction.commit(), "E::Could not write the configuration");
+  logger("I::Applied configuration '{}'", path_file_config);
+  return {};
+}
+
+} // namespace ns_cmd::ns_apply
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
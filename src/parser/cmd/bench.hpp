@@ -0,0 +1,428 @@
+/**
+ * @file bench.hpp
+ * @author Ruan Formigoni
+ * @brief Micro-benchmarks of the overlay backends on the layers of the image
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <filesystem>
+#include <format>
+#include <print>
+#include <ranges>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../filesystems/controller.hpp"
+#include "../../filesystems/utils.hpp"
+#include "../../reserved/overlay.hpp"
+#include "../../macro.hpp"
+
+/**
+ * @namespace ns_cmd::ns_bench
+ * @brief Implementation of the fim-bench command
+ *
+ * Mounts the layers of the image through each overlay backend, with a scratch upper directory,
+ * and measures a fixed set of operations on the merged view:
+ *
+ * - stat: lstat on the entries of the image
+ * - readdir: list the directories of the image
+ * - read: sequential read of the regular files of the image
+ * - create: create and write small files
+ * - copy-up: open files of the layers for writing, which copies them to the upper directory
+ *
+ * The FUSE backends are mounted with the filesystem controller. The bwrap backend is the kernel
+ * overlayfs in a user namespace, so it is mounted the way bwrap does it, in a forked child.
+ */
+namespace ns_cmd::ns_bench
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+using OverlayType = ns_reserved::ns_overlay::OverlayType;
+
+// Limits of the operations of each test
+constexpr size_t const max_entries = 2000;
+constexpr size_t const max_dirs = 200;
+constexpr size_t const max_copy_up = 200;
+constexpr size_t const count_create = 500;
+constexpr uint64_t const max_bytes_read = 64 * 1024 * 1024;
+
+} // namespace
+
+/**
+ * @brief Result of a test on a backend
+ */
+struct Sample
+{
+  std::string test;
+  uint64_t ops;
+  uint64_t ns_elapsed;
+  uint64_t ns_p50;
+  uint64_t ns_p99;
+};
+
+/**
+ * @brief Entries of the image the tests operate on, relative to the root
+ */
+struct Targets
+{
+  std::vector<fs::path> entries;
+  std::vector<fs::path> dirs;
+  std::vector<fs::path> files;
+};
+
+/**
+ * @brief Times an operation over a range of inputs
+ *
+ * Failed operations are not counted.
+ *
+ * @param test Name of the test
+ * @param count Number of times to run the operation
+ * @param f_op Operation, receives the iteration index and returns whether it succeeded
+ * @return Sample The throughput and latency percentiles of the operation
+ */
+inline Sample measure(std::string const& test, size_t count, auto&& f_op)
+{
+  using clock = std::chrono::steady_clock;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(count);
+  auto time_beg = clock::now();
+  for(size_t i = 0; i < count; ++i)
+  {
+    auto time_op = clock::now();
+    continue_if(not f_op(i));
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_op).count());
+  }
+  uint64_t ns_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - time_beg).count();
+  std::ranges::sort(latencies);
+  auto f_percentile = [&](double p) -> uint64_t
+  {
+    return latencies.empty()? 0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+  };
+  return Sample{test, latencies.size(), ns_elapsed, f_percentile(0.50), f_percentile(0.99)};
+}
+
+/**
+ * @brief Collects the entries of the image to operate on
+ *
+ * @param path_dir_root Merged view of the layers
+ * @return Targets The entries, directories and regular files, up to the limits of the tests
+ */
+inline Targets targets(fs::path const& path_dir_root)
+{
+  Targets targets;
+  std::error_code ec;
+  for(auto it = fs::recursive_directory_iterator(path_dir_root, fs::directory_options::skip_permission_denied, ec)
+    ; not ec and it != fs::recursive_directory_iterator() and targets.entries.size() < max_entries
+    ; it.increment(ec))
+  {
+    fs::path path_relative = it->path().lexically_relative(path_dir_root);
+    targets.entries.push_back(path_relative);
+    std::error_code ec_entry;
+    if(it->is_directory(ec_entry) and not it->is_symlink(ec_entry))
+    {
+      if(targets.dirs.size() < max_dirs) { targets.dirs.push_back(path_relative); }
+    }
+    else if(it->is_regular_file(ec_entry) and not it->is_symlink(ec_entry))
+    {
+      targets.files.push_back(path_relative);
+    }
+  }
+  return targets;
+}
+
+/**
+ * @brief Runs the tests on a merged view of the layers
+ *
+ * @param path_dir_root Merged view of the layers, its upper directory is modified
+ * @param targets Entries to operate on, relative to the root
+ * @return std::vector<Sample> The results of each test
+ */
+inline std::vector<Sample> run(fs::path const& path_dir_root, Targets const& targets)
+{
+  std::vector<Sample> samples;
+  // Absolute paths, so their construction is not timed
+  auto f_absolute = [&](std::vector<fs::path> const& paths)
+  {
+    return paths
+      | std::views::transform([&](auto&& e){ return (path_dir_root / e).string(); })
+      | std::ranges::to<std::vector<std::string>>();
+  };
+  auto entries = f_absolute(targets.entries);
+  auto dirs = f_absolute(targets.dirs);
+  auto files = f_absolute(targets.files);
+  // stat storm
+  samples.push_back(measure("stat", entries.size(), [&](size_t i)
+  {
+    struct stat st;
+    return ::lstat(entries[i].c_str(), &st) == 0;
+  }));
+  // readdir
+  samples.push_back(measure("readdir", dirs.size(), [&](size_t i)
+  {
+    DIR* dir = ::opendir(dirs[i].c_str());
+    if(not dir) { return false; }
+    while(::readdir(dir) != nullptr) {}
+    ::closedir(dir);
+    return true;
+  }));
+  // sequential read, until the byte limit
+  uint64_t bytes_read = 0;
+  std::vector<char> buffer(128 * 1024);
+  samples.push_back(measure("read", files.size(), [&](size_t i)
+  {
+    if(bytes_read >= max_bytes_read) { return false; }
+    int fd = ::open(files[i].c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    for(ssize_t bytes; (bytes = ::read(fd, buffer.data(), buffer.size())) > 0;)
+    {
+      bytes_read += bytes;
+    }
+    ::close(fd);
+    return true;
+  }));
+  // small file create
+  std::string const str_dir_create = (path_dir_root / "fim-bench").string();
+  ::mkdir(str_dir_create.c_str(), 0755);
+  std::string const data(4096, 'x');
+  samples.push_back(measure("create", count_create, [&](size_t i)
+  {
+    std::string str_file = std::format("{}/{}", str_dir_create, i);
+    int fd = ::open(str_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) { return false; }
+    bool is_ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ::close(fd);
+    return is_ok;
+  }));
+  // copy-up, opening for writing copies the file to the upper directory
+  samples.push_back(measure("copy-up", std::min(files.size(), max_copy_up), [&](size_t i)
+  {
+    int fd = ::open(files[i].c_str(), O_WRONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    ::close(fd);
+    return true;
+  }));
+  logger("D::Read {} bytes from '{}'", bytes_read, path_dir_root);
+  return samples;
+}
+
+/**
+ * @brief Runs the tests on a kernel overlayfs mounted in a user namespace, as bwrap does
+ *
+ * @param vec_path_dir_layer Mounted layers, bottom-most first
+ * @param path_dir_upper Scratch upper directory
+ * @param path_dir_work Scratch work directory
+ * @param path_dir_mount Mountpoint of the overlay
+ * @param targets Entries to operate on, relative to the root
+ * @return Value<std::vector<Sample>> The results of each test, or the respective error
+ */
+[[nodiscard]] inline Value<std::vector<Sample>> run_userns(std::vector<fs::path> const& vec_path_dir_layer
+  , fs::path const& path_dir_upper
+  , fs::path const& path_dir_work
+  , fs::path const& path_dir_mount
+  , Targets const& targets)
+{
+  // Overlayfs lists the top-most layer first
+  std::string str_lowerdir;
+  for(auto const& path_dir_layer : vec_path_dir_layer | std::views::reverse)
+  {
+    str_lowerdir += (str_lowerdir.empty()? "" : ":") + path_dir_layer.string();
+  }
+  std::string const str_options = std::format("lowerdir={},upperdir={},workdir={},userxattr"
+    , str_lowerdir
+    , path_dir_upper.string()
+    , path_dir_work.string()
+  );
+  std::string const str_uid_map = std::format("0 {} 1", getuid());
+  std::string const str_gid_map = std::format("0 {} 1", getgid());
+  // The process is multithreaded, the child only makes system calls on the data prepared above.
+  // It holds the mount until the parent closes its pipe, the tests run in the parent through
+  // the root of the child.
+  int fds_ready[2], fds_done[2];
+  return_if(::pipe2(fds_ready, O_CLOEXEC) != 0, Error("E::Could not create pipe: {}", strerror(errno)));
+  if(::pipe2(fds_done, O_CLOEXEC) != 0)
+  {
+    std::ranges::for_each(fds_ready, ::close);
+    return Error("E::Could not create pipe: {}", strerror(errno));
+  }
+  pid_t pid = ::fork();
+  if(pid < 0)
+  {
+    std::ranges::for_each(fds_ready, ::close);
+    std::ranges::for_each(fds_done, ::close);
+    return Error("E::Could not fork: {}", strerror(errno));
+  }
+  if(pid == 0)
+  {
+    ::close(fds_ready[0]);
+    ::close(fds_done[1]);
+    auto f_write = [](char const* path, std::string const& data)
+    {
+      int fd = ::open(path, O_WRONLY | O_CLOEXEC);
+      if(fd < 0) { return false; }
+      bool is_ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+      ::close(fd);
+      return is_ok;
+    };
+    if(::prctl(PR_SET_PDEATHSIG, SIGKILL) != 0) { _exit(1); }
+    if(::unshare(CLONE_NEWUSER | CLONE_NEWNS) != 0) { _exit(1); }
+    if(not f_write("/proc/self/setgroups", "deny")) { _exit(1); }
+    if(not f_write("/proc/self/uid_map", str_uid_map)) { _exit(1); }
+    if(not f_write("/proc/self/gid_map", str_gid_map)) { _exit(1); }
+    if(::mount("overlay", path_dir_mount.c_str(), "overlay", 0, str_options.c_str()) != 0) { _exit(1); }
+    char const ready = 1;
+    if(::write(fds_ready[1], &ready, 1) != 1) { _exit(1); }
+    // Returns once the parent closes its end
+    char done;
+    while(::read(fds_done[0], &done, 1) < 0 and errno == EINTR) {}
+    _exit(0);
+  }
+  ::close(fds_ready[1]);
+  ::close(fds_done[0]);
+  char ready = 0;
+  ssize_t bytes_ready;
+  while((bytes_ready = ::read(fds_ready[0], &ready, 1)) < 0 and errno == EINTR) {}
+  ::close(fds_ready[0]);
+  std::vector<Sample> samples;
+  if(bytes_ready == 1)
+  {
+    samples = run(fs::path(std::format("/proc/{}/root", pid)) / path_dir_mount.relative_path(), targets);
+  }
+  ::close(fds_done[1]);
+  int status{};
+  return_if(::waitpid(pid, &status, 0) < 0, Error("E::Could not wait for benchmark process"));
+  return_if(bytes_ready != 1 or not WIFEXITED(status) or WEXITSTATUS(status) != 0
+    , Error("E::Could not mount overlayfs in a user namespace")
+  );
+  return samples;
+}
+
+/**
+ * @brief Benchmarks the overlay backends on the layers of the image
+ *
+ * Each backend gets its own scratch mountpoints and upper directory in 'path_dir_bench', the
+ * data directory of the image is not touched. The fastest backend is the one with the highest
+ * geometric mean of the throughput of the tests.
+ *
+ * @param logs Log files of the filesystems
+ * @param config Filesystem configuration of the image
+ * @param path_dir_bench Scratch directory, removed afterwards
+ * @return Value<OverlayType> The fastest backend, or the respective error
+ */
+[[nodiscard]] inline Value<OverlayType> overlay(ns_filesystems::ns_controller::Logs const& logs
+  , ns_filesystems::ns_controller::Config const& config
+  , fs::path const& path_dir_bench)
+{
+  Try(fs::remove_all(path_dir_bench));
+  std::optional<Targets> targets;
+  std::optional<std::pair<OverlayType,double>> fastest;
+  std::println("{:<10} {:<8} {:>8} {:>12} {:>10} {:>10}", "backend", "test", "ops", "ops/s", "p50(us)", "p99(us)");
+  for(OverlayType overlay_type : {OverlayType::OVERLAYFS, OverlayType::UNIONFS, OverlayType::BWRAP})
+  {
+    fs::path const path_dir_backend = path_dir_bench / std::string{overlay_type};
+    for(auto&& name : {"mount", "work", "upper", "layers"})
+    {
+      Pop(ns_fs::create_directories(path_dir_backend / name));
+    }
+    std::vector<Sample> samples;
+    {
+      // Mount the layers, and the overlay for the FUSE backends
+      ns_filesystems::ns_controller::Controller controller(logs, ns_filesystems::ns_controller::Config
+      {
+        .is_casefold = false,
+        .is_share = false,
+        .is_trace = false,
+        .compression_level = config.compression_level,
+        .overlay_type = overlay_type,
+        .path_dir_mount = path_dir_backend / "mount",
+        .path_dir_work = path_dir_backend / "work",
+        .path_dir_upper = path_dir_backend / "upper",
+        .path_dir_layers = path_dir_backend / "layers",
+        .path_dir_share = config.path_dir_share,
+        .path_dir_trace = config.path_dir_trace,
+        .path_dir_ciopfs = config.path_dir_ciopfs,
+        .path_bin_janitor = config.path_bin_janitor,
+        .path_bin_self = config.path_bin_self,
+        .layers = config.layers,
+        .perf = config.perf,
+      });
+      auto vec_path_dir_layer = ns_filesystems::ns_utils::get_mounted_layers(path_dir_backend / "layers");
+      // The entries are collected once, from the merged layers, so all backends do the same work
+      if(not targets)
+      {
+        Targets merged;
+        for(auto const& path_dir_layer : vec_path_dir_layer)
+        {
+          Targets layer = ns_bench::targets(path_dir_layer);
+          std::ranges::move(layer.entries, std::back_inserter(merged.entries));
+          std::ranges::move(layer.dirs, std::back_inserter(merged.dirs));
+          std::ranges::move(layer.files, std::back_inserter(merged.files));
+        }
+        merged.entries.resize(std::min(merged.entries.size(), max_entries));
+        merged.dirs.resize(std::min(merged.dirs.size(), max_dirs));
+        targets = std::move(merged);
+      }
+      if(overlay_type == OverlayType::BWRAP)
+      {
+        auto ret = run_userns(vec_path_dir_layer
+          , path_dir_backend / "upper"
+          , path_dir_backend / "work"
+          , path_dir_backend / "mount"
+          , *targets
+        );
+        continue_if(not ret, "W::Skipping backend '{}': {}", std::string{overlay_type}, ret.error());
+        samples = std::move(*ret);
+      }
+      else
+      {
+        samples = run(path_dir_backend / "mount", *targets);
+      }
+    } // Un-mount
+    // Report
+    double score = 0;
+    for(auto const& sample : samples)
+    {
+      double ops_per_sec = sample.ns_elapsed == 0? 0 : sample.ops * 1e9 / sample.ns_elapsed;
+      std::println("{:<10} {:<8} {:>8} {:>12.1f} {:>10.1f} {:>10.1f}"
+        , std::string{overlay_type}
+        , sample.test
+        , sample.ops
+        , ops_per_sec
+        , sample.ns_p50 / 1e3
+        , sample.ns_p99 / 1e3
+      );
+      score += std::log(std::max(ops_per_sec, 1.0));
+    }
+    score /= std::max<size_t>(samples.size(), 1);
+    if(not fastest or score > fastest->second)
+    {
+      fastest = std::make_pair(overlay_type, score);
+    }
+  }
+  Catch(fs::remove_all(path_dir_bench)).discard("W::Could not remove '{}'", path_dir_bench);
+  return_if(not fastest, Error("E::No overlay backend could be benchmarked"));
+  std::println("Fastest overlay: {}", std::string{fastest->first});
+  return fastest->first;
+}
+
+} // namespace ns_cmd::ns_bench
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -31,21 +31,6 @@ namespace
 
 namespace fs = std::filesystem;
 
-/**
- * @brief Get the highest index object
- * 
- * @param db The database to query
- * @return index_t The highest index element or -1 or error
- */
-[[nodiscard]] inline uint64_t get_highest_index(ns_db::ns_bind::Binds const& binds)
-{
-  auto it = std::ranges::max_element(binds.get(), {}, [](ns_db::ns_bind::Bind const& bind)
-  {
-    return bind.index;
-  });
-  return (it == std::ranges::end(binds.get()))? -1 : it->index;
-}
-
 } // namespace
 
 /**
@@ -71,7 +56,7 @@ inline Value<ns_db::ns_bind::Binds> db_read(fs::path const& path_file_binary)
 inline Value<void> db_write(fs::path const& path_file_binary, ns_db::ns_bind::Binds const& binds)
 {
   Pop(ns_reserved::ns_bind::write(path_file_binary
-    , Pop(Pop(ns_db::ns_bind::serialize(binds)).dump())
+    , Pop(ns_db::ns_bind::encode(binds))
   ));
   return {};
 }
@@ -91,16 +76,15 @@ inline Value<void> db_write(fs::path const& path_file_binary, ns_db::ns_bind::Bi
 {
   // Deserialize bindings
   ns_db::ns_bind::Binds binds = Pop(db_read(path_file_binary));
-  // Find out the highest bind index
-  ns_db::ns_bind::Bind bind
+  // Append with the next index
+  size_t index = binds.push_back(ns_db::ns_bind::Bind
   {
-    .index = get_highest_index(binds) + 1,
+    .index = 0,
     .path_src = path_src,
     .path_dst = path_dst,
     .type = bind_type,
-  };
-  binds.push_back(bind);
-  logger("I::Binding index is '{}'", bind.index);
+  });
+  logger("I::Binding index is '{}'", index);
   // Write database
   Pop(db_write(path_file_binary, binds));
   return {};
@@ -10,7 +10,10 @@
 
 #include <filesystem>
 #include <print>
+#include <ranges>
 #include <sstream>
+#include <utility>
+#include <sys/stat.h>
 
 #include "../../std/expected.hpp"
 #include "../../db/desktop.hpp"
@@ -129,6 +132,46 @@ namespace fs = std::filesystem;
   return xdg_data_home / "mime/packages/flatimage.xml";
 }
 
+/**
+ * @brief Get the file path to the integration stamp of an application
+ *
+ * @return Value<fs::path> The path to the stamp file, or the respective error
+ */
+[[nodiscard]] Value<fs::path> get_path_file_stamp(ns_db::ns_desktop::Desktop const& desktop)
+{
+  fs::path xdg_data_home = Pop(ns_env::xdg_data_home<fs::path>());
+  return xdg_data_home / std::format("flatimage/desktop/{}.stamp", desktop.get_name());
+}
+
+/**
+ * @brief Computes the integration stamp of the current binary
+ *
+ * The stamp changes with the desktop configuration, the path of the binary, the FlatImage build
+ * and the binary itself. Writes to the binary, like a new icon, change its size or modification
+ * time.
+ *
+ * @param fim FlatImage configuration object
+ * @param str_raw_json The desktop configuration stored in the binary
+ * @return Value<std::string> The stamp, or the respective error
+ */
+[[nodiscard]] Value<std::string> get_stamp(ns_config::FlatImage const& fim, std::string_view str_raw_json)
+{
+  struct stat st{};
+  return_if(::stat(fim.path.bin.self.c_str(), &st) < 0
+    , Error("E::Could not stat '{}': {}", fim.path.bin.self, strerror(errno))
+  );
+  std::string str_key = std::format("{}:{}:{}:{}.{}:{}:{}"
+    , FIM_VERSION
+    , FIM_COMMIT
+    , fim.path.bin.self.string()
+    , st.st_size
+    , st.st_mtim.tv_sec
+    , st.st_mtim.tv_nsec
+    , str_raw_json
+  );
+  return std::format("{:x}", std::hash<std::string>{}(str_key));
+}
+
 /**
  * @brief Generates the desktop entry
  *
@@ -309,31 +352,26 @@ namespace fs = std::filesystem;
  * @brief Integrates an svg icon for the flatimage mimetype
  *
  * @param desktop The desktop entry object
- * @param path_file_icon The path to the icon file to integrate
+ * @param icon The icon to integrate
  */
-[[nodiscard]] inline Value<void> integrate_icons_svg(ns_db::ns_desktop::Desktop const& desktop, fs::path const& path_file_icon)
+[[nodiscard]] inline Value<void> integrate_icons_svg(ns_db::ns_desktop::Desktop const& desktop, ns_reserved::ns_icon::Icon const& icon)
 {
   // Path to mimetype icon
   auto [path_icon_mimetype, path_icon_app] = Pop(get_path_file_icon_svg(desktop.get_name()));
   Pop(ns_fs::create_directories(path_icon_mimetype.parent_path()));
   Pop(ns_fs::create_directories(path_icon_app.parent_path()));
-  auto f_copy_icon = [](fs::path const& path_icon_src, fs::path const& path_icon_dst)
+  auto f_write_icon = [&](fs::path const& path_icon_dst)
   {
-    logger("D::Copy '{}' to '{}'", path_icon_src, path_icon_dst);
-    std::error_code ec;
-    if (not fs::exists(path_icon_dst, ec)
-    and not fs::copy_file(path_icon_src, path_icon_dst, ec))
+    logger("D::Write icon to '{}'", path_icon_dst);
+    std::ofstream file_icon(path_icon_dst, std::ios::binary | std::ios::trunc);
+    if (not file_icon.write(icon.m_data.data(), icon.m_data.size()))
     {
-      logger("E::Could not copy file '{}' to '{}': '{}'"
-        , path_icon_src
-        , path_icon_dst
-        , (ec)? ec.message() : "Unknown error"
-      );
+      logger("E::Could not write icon file '{}'", path_icon_dst);
     }
   };
-  // Copy mimetype and app icons
-  f_copy_icon(path_file_icon, path_icon_mimetype);
-  f_copy_icon(path_file_icon, path_icon_app);
+  // Write mimetype and app icons
+  f_write_icon(path_icon_mimetype);
+  f_write_icon(path_icon_app);
   return {};
 }
 
@@ -341,28 +379,32 @@ namespace fs = std::filesystem;
  * @brief Integrates PNG icons for the flatimage mimetype
  *
  * @param desktop The desktop entry object
- * @param path_file_icon The path to the icon file to integrate
+ * @param icon The icon to integrate, a PNG or JPEG image
  */
-[[nodiscard]] inline Value<void> integrate_icons_png(ns_db::ns_desktop::Desktop const& desktop, fs::path const& path_file_icon)
+[[nodiscard]] inline Value<void> integrate_icons_png(ns_db::ns_desktop::Desktop const& desktop, ns_reserved::ns_icon::Icon const& icon)
 {
   std::error_code ec;
-  auto f_create_parent = [](fs::path const& path_src) -> Value<void>
-  {
-    Pop(ns_fs::create_directories(path_src.parent_path()));
-    return {};
-  };
+  std::vector<ns_image::Target> targets;
+  std::vector<fs::path> vec_path_icon_app;
   for(auto&& size : arr_sizes)
   {
     // Path to mimetype and application icons
     auto [path_icon_mimetype,path_icon_app] = Pop(get_path_file_icon_png(desktop.get_name(), size));
-    Pop(f_create_parent(path_icon_mimetype));
-    Pop(f_create_parent(path_icon_app));
-    // Avoid overwrite
-    continue_if(fs::exists(path_icon_mimetype, ec));
-    // Copy icon with target widthXheight
-    Pop(ns_image::resize(path_file_icon, path_icon_mimetype, size, size));
-    // Duplicate icon to app directory
-    if (not fs::copy_file(path_icon_mimetype, path_icon_app, fs::copy_options::skip_existing, ec))
+    Pop(ns_fs::create_directories(path_icon_mimetype.parent_path()));
+    Pop(ns_fs::create_directories(path_icon_app.parent_path()));
+    targets.push_back(ns_image::Target{ .path_file_dst = path_icon_mimetype, .width = size, .height = size });
+    vec_path_icon_app.push_back(path_icon_app);
+  }
+  // Create the icons of all sizes from a single decode of the source, straight from memory
+  auto img = Pop(ns_image::read(icon.m_data, icon.m_ext));
+  return_if(icon.m_width != 0 and (std::cmp_not_equal(img.width(), icon.m_width) or std::cmp_not_equal(img.height(), icon.m_height))
+    , Error("E::Decoded icon is {}x{}, expected {}x{}", img.width(), img.height(), icon.m_width, icon.m_height)
+  );
+  Pop(ns_image::resize(img, targets));
+  // Duplicate icons to app directory
+  for(auto&& [target, path_icon_app] : std::views::zip(targets, vec_path_icon_app))
+  {
+    if (not fs::copy_file(target.path_file_dst, path_icon_app, fs::copy_options::overwrite_existing, ec))
     {
       logger("E::Could not copy file '{}': '{}'", path_icon_app, ec.message());
     }
@@ -406,63 +448,52 @@ namespace fs = std::filesystem;
 [[nodiscard]] inline Value<void> integrate_icons(ns_config::FlatImage const& fim, ns_db::ns_desktop::Desktop const& desktop)
 {
   std::error_code ec;
-  // Try to get a valid icon path to a png or svg file
-  fs::path path_file_icon = ({
-    fs::path path_file_icon_png = Pop(get_path_file_icon_png(desktop.get_name(), 64)).second;
-    fs::path path_file_icon_svg = Pop(get_path_file_icon_svg(desktop.get_name())).second;
-    fs::exists(path_file_icon_png, ec)? path_file_icon_png : path_file_icon_svg;
-  });
-  // Check for existing integration
-  if (fs::exists(path_file_icon, ec))
+  // Read picture from flatimage binary
+  ns_reserved::ns_icon::Icon icon = Pop(ns_reserved::ns_icon::read(fim.path.bin.self));
+  bool const is_svg = std::string_view(icon.m_ext) == "svg";
+  // The hash of the icon is stored next to the generated application icon
+  fs::path path_file_icon = is_svg?
+      Pop(get_path_file_icon_svg(desktop.get_name())).second
+    : Pop(get_path_file_icon_png(desktop.get_name(), 64)).second;
+  fs::path path_file_hash = fs::path(path_file_icon).concat(".hash");
+  std::string str_hash = std::format("{:x}", std::hash<std::string_view>{}(icon.m_data));
+  // Check for existing integration of the same icon
+  std::string str_hash_integrated;
+  std::ifstream(path_file_hash) >> str_hash_integrated;
+  if (fs::exists(path_file_icon, ec) and str_hash_integrated == str_hash)
   {
     logger("D::Icons are integrated, found {}", path_file_icon.string());
     return {};
   }
-  return_if(ec, Error("E::Could not check if icon exists: {}", ec.message()));
-  // Read picture from flatimage binary
-  ns_reserved::ns_icon::Icon icon = Pop(ns_reserved::ns_icon::read(fim.path.bin.self));
-  // Create temporary file to write icon to
-  auto path_file_tmp_icon = fim.path.dir.app / std::format("icon.{}", icon.m_ext);
-  // Write icon to temporary file
-  std::ofstream file_icon(path_file_tmp_icon, std::ios::out | std::ios::trunc);
-  return_if(not file_icon.is_open(), Error("E::Could not open temporary icon file for desktop integration"));
-  file_icon.write(icon.m_data, icon.m_size);
-  file_icon.close();
+  return_if(icon.m_data.empty(), Error("E::Empty icon data"));
   // Create icons
-  if ( path_file_tmp_icon.string().ends_with(".svg") )
+  if ( is_svg )
   {
-    Pop(integrate_icons_svg(desktop, path_file_tmp_icon));
+    Pop(integrate_icons_svg(desktop, icon));
   }
   else
   {
-    Pop(integrate_icons_png(desktop, path_file_tmp_icon));
+    Pop(integrate_icons_png(desktop, icon));
   }
   Pop(integrate_icon_flatimage());
-  // Remove temporary file
-  fs::remove(path_file_tmp_icon, ec);
-  return_if(ec, Error("E::Could not remove temporary icon file: {}", ec.message()));
+  // Skip the icons on the next integration, unless the icon changes
+  std::ofstream file_hash(path_file_hash, std::ios::out | std::ios::trunc);
+  return_if(not file_hash.is_open(), Error("E::Could not open icon hash file '{}'", path_file_hash));
+  file_hash << str_hash;
+  file_hash.close();
   return {};
 }
 
-} // namespace
-
 /**
- * @brief Integrates flatimage desktop data in current system
+ * @brief Integrates the enabled desktop entry, mime database and icons
  *
- * @param config Flatimage configuration object
- * @return Value<void> Nothing or success, or the respective error
+ * @param fim FlatImage configuration object
+ * @param desktop Desktop object
+ * @return Value<bool> True if all the enabled items were integrated, false if the icons failed,
+ * or the respective error
  */
-[[nodiscard]] inline Value<void> integrate(ns_config::FlatImage const& fim)
+[[nodiscard]] inline Value<bool> integrate_items(ns_config::FlatImage const& fim, ns_db::ns_desktop::Desktop const& desktop)
 {
-  // Deserialize json from binary
-  auto str_raw_json = Pop(ns_reserved::ns_desktop::read(fim.path.bin.self)
-    , "E::Could not read desktop json from binary"
-  );
-  auto desktop = Pop(ns_db::ns_desktop::deserialize(str_raw_json)
-    , "D::Missing or misconfigured desktop integration"
-  );
-  logger("D::Json desktop data: {}", str_raw_json);
-
   // Create desktop entry
   if(desktop.get_integrations().contains(IntegrationItem::ENTRY))
   {
@@ -482,8 +513,51 @@ namespace fs = std::filesystem;
     if(auto ret = integrate_icons(fim, desktop); not ret)
     {
       logger("D::Could not integrate icons: '{}'", ret.error());
+      return false;
     }
   }
+  return true;
+}
+
+} // namespace
+
+/**
+ * @brief Integrates flatimage desktop data in current system
+ *
+ * Integration is skipped while the stamp written by the last complete one matches the current
+ * binary, so integrated applications only read the stamp on launch.
+ *
+ * @param config Flatimage configuration object
+ * @return Value<void> Nothing or success, or the respective error
+ */
+[[nodiscard]] inline Value<void> integrate(ns_config::FlatImage const& fim)
+{
+  // Deserialize json from binary
+  auto str_raw_json = Pop(ns_reserved::ns_desktop::read(fim.path.bin.self)
+    , "E::Could not read desktop json from binary"
+  );
+  auto desktop = Pop(ns_db::ns_desktop::deserialize(str_raw_json)
+    , "D::Missing or misconfigured desktop integration"
+  );
+  logger("D::Desktop data: {}", ns_db::ns_desktop::serialize(desktop).value_or(""));
+
+  // Compare the stamp of the last integration
+  fs::path path_file_stamp = Pop(get_path_file_stamp(desktop));
+  std::string str_stamp = Pop(get_stamp(fim, str_raw_json));
+  std::string str_stamp_found;
+  std::ifstream(path_file_stamp) >> str_stamp_found;
+  if(str_stamp_found == str_stamp)
+  {
+    logger("D::Desktop integration is up to date");
+  }
+  else if(Pop(integrate_items(fim, desktop)))
+  {
+    // Publish the stamp atomically, concurrent launches write the same content
+    Pop(ns_fs::create_directories(path_file_stamp.parent_path()));
+    fs::path path_file_stamp_temp = std::format("{}.tmp.{}", path_file_stamp.string(), getpid());
+    std::ofstream(path_file_stamp_temp, std::ios::trunc) << str_stamp << '\n';
+    Try(fs::rename(path_file_stamp_temp, path_file_stamp));
+  }
   // Check if should notify
   if (fim.flags.is_notify)
   {
@@ -579,33 +653,37 @@ namespace fs = std::filesystem;
     : "";
   return_if(str_ext.empty(), Error("E::Icon extension '{}' is not supported", path_file_icon.extension()));
   // Read icon into memory
-  auto image_data = ({
+  ns_reserved::ns_icon::Icon icon{ .m_ext = str_ext, .m_width = 0, .m_height = 0, .m_data = {} };
+  {
     std::streamsize size_file_icon = fs::file_size(path_file_icon, ec);
     return_if(ec, Error("E::Could not get size of file '{}': {}", path_file_icon, ec.message()));
     return_if(static_cast<uint64_t>(size_file_icon) >= ns_reserved::FIM_RESERVED_OFFSET_ICON_END - ns_reserved::FIM_RESERVED_OFFSET_ICON_BEGIN
       , Error("E::File is too large, '{}' bytes", size_file_icon)
     );
-    std::unique_ptr<char[]> ptr_data = std::make_unique<char[]>(size_file_icon);
-    std::streamsize bytes = Pop(ns_reserved::read(path_file_icon, 0, ptr_data.get(), size_file_icon));
+    icon.m_data.resize(size_file_icon);
+    std::streamsize bytes = Pop(ns_reserved::read(path_file_icon, 0, icon.m_data.data(), size_file_icon));
     return_if(bytes != size_file_icon
       , Error("E::Icon read bytes '{}' do not match target size of '{}'", bytes, size_file_icon)
     );
-    std::make_pair(std::move(ptr_data), bytes);
-  });
-  // Create icon struct
-  ns_reserved::ns_icon::Icon icon;
-  std::memset(icon.m_ext, 0, sizeof(icon.m_ext));
-  std::memcpy(icon.m_ext, str_ext.data(), std::min(str_ext.size(), sizeof(icon.m_ext)-1));
-  std::memcpy(icon.m_data, image_data.first.get(), image_data.second);
-  icon.m_size = image_data.second;
+  }
+  // Validate the image and cache its dimensions, integration checks them against its decode
+  if(str_ext != "svg")
+  {
+    auto img = Pop(ns_image::read(icon.m_data, str_ext), "E::Could not decode icon '{}'", path_file_icon);
+    icon.m_width = static_cast<uint32_t>(img.width());
+    icon.m_height = static_cast<uint32_t>(img.height());
+  }
+  // Write the icon and the desktop configuration in one pass over the binary
+  ns_reserved::Transaction transaction(fim.path.bin.self);
   // Write icon struct to the flatimage binary
   Pop(ns_reserved::ns_icon::write(fim.path.bin.self, icon), "E::Could not write image data");
-  // Write json to flatimage binary, excluding the input icon path
+  // Write desktop configuration to flatimage binary, the encoding excludes the input icon path
+  Pop(ns_reserved::ns_desktop::write(fim.path.bin.self, Pop(ns_db::ns_desktop::encode(desktop))));
+  Pop(transaction.commit(), "E::Could not write desktop integration data");
+  // Print written json, excluding the input icon path
   auto str_raw_json = Pop(ns_db::ns_desktop::serialize(desktop), "E::Failed to serialize desktop integration" );
   auto db = Pop(ns_db::from_string(str_raw_json), "E::Could not parse serialized json source");
   return_if(not db.erase("icon"), Error("E::Could not erase icon field"));
-  Pop(ns_reserved::ns_desktop::write(fim.path.bin.self, Pop(db.dump())));
-  // Print written json
   std::println("{}", Pop(db.dump()));
   return {};
 }
@@ -630,10 +708,8 @@ namespace fs = std::filesystem;
   {
     std::println("{}", std::string{str_integration});
   }
-  // Serialize json
-  auto str_raw_json = Pop(ns_db::ns_desktop::serialize(desktop));
-  // Write json
-  Pop(ns_reserved::ns_desktop::write(fim.path.bin.self, str_raw_json));
+  // Write desktop configuration
+  Pop(ns_reserved::ns_desktop::write(fim.path.bin.self, Pop(ns_db::ns_desktop::encode(desktop))));
   return {};
 }
 
@@ -678,8 +754,8 @@ namespace fs = std::filesystem;
   // Remove icons
   if(integrations.contains(ns_db::ns_desktop::IntegrationItem::ICON))
   {
-    ns_reserved::ns_icon::Icon icon = Pop(ns_reserved::ns_icon::read(fim.path.bin.self));
-    if(std::string_view(icon.m_ext) == "png")
+    ns_reserved::ns_icon::Header header = Pop(ns_reserved::ns_icon::read_header(fim.path.bin.self));
+    if(std::string_view(header.m_ext) != "svg")
     {
       for(auto size : arr_sizes)
       {
@@ -687,14 +763,18 @@ namespace fs = std::filesystem;
         f_try_erase(path_icon_mime);
         f_try_erase(path_icon_app);
       }
+      f_try_erase(Pop(get_path_file_icon_png(desktop.get_name(), 64)).second.concat(".hash"));
     }
     else
     {
       auto [path_icon_mime,path_icon_app] = Pop(get_path_file_icon_svg(desktop.get_name()));
       f_try_erase(path_icon_mime);
       f_try_erase(path_icon_app);
+      f_try_erase(fs::path(path_icon_app).concat(".hash"));
     }
   }
+  // Integrate again on the next launch
+  f_try_erase(Pop(get_path_file_stamp(desktop)));
   return {};
 }
 
@@ -710,9 +790,7 @@ namespace fs = std::filesystem;
   // Read icon data
   ns_reserved::ns_icon::Icon icon = Pop(ns_reserved::ns_icon::read(fim.path.bin.self));
   // Make sure it has valid data
-  return_if(std::all_of(icon.m_data, icon.m_data+sizeof(icon.m_data), [](char c){ return c == 0; })
-    , Error("E::Empty icon data");
-  );
+  return_if(icon.m_data.empty(), Error("E::Empty icon data"));
   // Get extension
   std::string_view ext = icon.m_ext;
   // Check if extension is valid
@@ -726,10 +804,10 @@ namespace fs = std::filesystem;
   std::fstream file_dst(path_file_dst, std::ios::out | std::ios::trunc);
   return_if(not file_dst.is_open(), Error("E::Could not open output file '{}'", path_file_dst));
   // Write data to output file
-  file_dst.write(icon.m_data, icon.m_size);
+  file_dst.write(icon.m_data.data(), icon.m_data.size());
   // Check bytes written
   return_if(not file_dst
-    , Error("E::Could not write all '{}' bytes to output file", icon.m_size)
+    , Error("E::Could not write all '{}' bytes to output file", icon.m_data.size())
   );
   return {};
 }
@@ -84,7 +84,7 @@ inline std::string help_usage()
     .with_args({
       { "cmd", "Name of the command to display help details" },
     })
-    .with_note("Available commands: fim-{bind,boot,casefold,desktop,env,exec,instance,layer,notify,overlay,perms,recipe,remote,root,unshare,version}")
+    .with_note("Available commands: fim-{bench,bind,boot,casefold,config,desktop,env,exec,instance,layer,limit,notify,overlay,perf,perms,recipe,remote,root,stats,unshare,update,version,volatile}")
     .with_example(R"(fim-help bind)")
     .get();
 }
@@ -143,6 +143,21 @@ inline std::string casefold_usage()
     .get();
 }
 
+inline std::string config_usage()
+{
+  return HelpEntry{"fim-config"}
+    .with_description("Applies a whole configuration with a single write to the binary")
+    .with_usage("fim-config <apply> <file>")
+    .with_args({
+      { "apply", "Replaces the configurations given in <file>, the others are kept" },
+      { "file", "A json object with any of the keys permissions, environment, bind, boot, desktop, remote, overlay, unshare, notify, casefold and volatile" },
+    })
+    .with_example(R"(fim-config apply config.json)")
+    .with_note("Each key takes the values of the command that sets it, e.g., 'permissions' takes an array as 'fim-perms set'")
+    .with_note("An invalid key or value leaves the binary unchanged")
+    .get();
+}
+
 inline std::string desktop_usage()
 {
   return HelpEntry{"fim-desktop"}
@@ -235,6 +250,12 @@ inline std::string instance_usage()
     .with_args({
       { "list", "Lists current instances" },
     })
+    .with_usage("fim-instance <serve> [timeout]")
+    .with_args({
+      { "serve", "Keep an instance running to serve the later invocations of this binary" },
+      { "timeout", "Seconds without invocations before the instance exits, defaults to 60" },
+    })
+    .with_example("fim-instance serve 300")
     .get();
 }
 
@@ -251,20 +272,81 @@ inline std::string layer_usage()
     .with_usage("fim-layer <add> <in-file>")
     .with_args({
       { "add", "Includes the novel layer <in-file> in the image in the top of the layer stack" },
-      { "in-file", "Path to the layer file to include in the FlatImage"},
+      { "in-file", "Path to the layer file to include in the FlatImage, '-' to read it from stdin"},
     })
-    .with_usage("fim-layer <commit> <binary|layer|file> [path]")
+    .with_usage("fim-layer <commit> <binary|layer|file|stream> [path] [profile [options...]]")
     .with_args({
       { "commit", "Compresses current changes into a layer" },
       { "binary", "Appends the layer to the FlatImage binary" },
       { "layer", "Saves the layer to $FIM_DIR_DATA/layers with auto-increment naming" },
       { "file", "Saves the layer to the specified file path" },
-      { "path", "File path (required when using 'file' mode)" },
-    })
+      { "stream", "Writes the layer to [path] while it is compressed, '-' for stdout" },
+      { "path", "File path (required when using 'file' or 'stream' mode)" },
+      { "profile", "Profile of mkdwarfs for this layer, overrides 'fim-perf profile' (fast,balanced,small,random-access,none)" },
+      { "options", "Raw options of mkdwarfs appended after the profile" },
+    })
+    .with_example("fim-layer commit binary random-access")
+    .with_example("fim-layer commit file ./assets.layer none -l 5 --block-size-bits 21")
+    .with_example("fim-layer commit stream - | ssh host ./app.flatimage fim-layer add -")
     .with_usage("fim-layer <list>")
     .with_args({
       { "list", "Lists all embedded and external layers in the format index:offset:size:path" },
     })
+    .with_usage("fim-layer <verify> [quick]")
+    .with_args({
+      { "verify", "Checks the integrity of all embedded and external layers in parallel" },
+      { "quick", "Only checks the section headers, fast enough to run on every boot" },
+    })
+    .with_usage("fim-layer <lazy> <on|off> <file>")
+    .with_args({
+      { "lazy", "Mounts the layer <file> only if the last recording of FIM_TRACE_ACCESS read from it" },
+      { "on", "Marks the layer as lazy" },
+      { "off", "Mounts the layer on every boot" },
+      { "file", "Path to a layer file given in FIM_LAYERS or in $FIM_DIR_DATA/layers" },
+    })
+    .with_usage("fim-layer <squash> [begin end]")
+    .with_args({
+      { "squash", "Merges the embedded layers from <begin> to <end> into a single layer" },
+      { "begin", "Index of the bottom-most layer to merge, defaults to 1" },
+      { "end", "Index of the top-most layer to merge, defaults to the last embedded layer" },
+    })
+    .with_usage("fim-layer <rebase> <begin> <end>")
+    .with_args({
+      { "rebase", "Rebuilds the embedded layers from <begin> to <end> without the files hidden by upper layers" },
+      { "begin", "Index of the bottom-most layer to rebuild, 0 for the base layer" },
+      { "end", "Index of the top-most layer to rebuild" },
+    })
+    .with_usage("fim-layer <remove> <index>")
+    .with_args({
+      { "remove", "Removes the embedded layer <index> from the binary" },
+      { "index", "Index of the layer as shown by 'fim-layer list', the base layer 0 cannot be removed" },
+    })
+    .with_usage("fim-layer <compact>")
+    .with_args({
+      { "compact", "Drops the embedded layers shadowed by an identical layer above and the data after the last layer" },
+    })
+    .with_usage("fim-layer <snapshot> <create|restore|delete|list> [name]")
+    .with_args({
+      { "snapshot", "Checkpoints the changes not yet committed, with reflinks where the filesystem supports them" },
+      { "create", "Saves the changes as snapshot [name], which defaults to the current time" },
+      { "restore", "Replaces the changes with the ones of snapshot <name>, the snapshot is kept" },
+      { "delete", "Deletes snapshot <name>" },
+      { "list", "Lists the snapshots by name" },
+    })
+    .with_example("fim-layer snapshot create before-upgrade")
+    .get();
+}
+
+inline std::string bench_usage()
+{
+  return HelpEntry{"fim-bench"}
+    .with_description("Benchmark the filesystem backends on the layers of the current FlatImage")
+    .with_usage("fim-bench <overlay> [set]")
+    .with_args({
+      { "overlay", "Measures stat, readdir, read, create and copy-up on each overlay filesystem" },
+      { "set", "Sets the fastest overlay filesystem as the default" },
+    })
+    .with_note("Results are reported in operations per second and p50/p99 latency in microseconds")
     .get();
 }
 
@@ -295,6 +377,10 @@ inline std::string overlay_usage()
     .with_args({
       { "show", "Shows the current overlay filesystem" },
     })
+    .with_usage("fim-overlay <fallback> <overlayfs|unionfs>")
+    .with_args({
+      { "fallback", "Sets the fuse overlay used when the kernel overlay of 'bwrap' is unavailable, unionfs by default" },
+    })
     .get();
 }
 
@@ -321,6 +407,87 @@ inline std::string perms_usage()
     .get();
 }
 
+inline std::string limit_usage()
+{
+  return HelpEntry{"fim-limit"}
+    .with_description("Configure the cgroup resource limits of the sandbox")
+    .with_note("Limit options: cpu.max,cpu.weight,memory.high,memory.max,io.weight,pids.max,accounting,affinity,affinity.fuse")
+    .with_usage("fim-limit <set> <option> <value>")
+    .with_args({
+      { "set", "Set a resource limit, the value is written to the cgroup file of the option" },
+      { "option", "The cgroup file to write, or 'accounting' to log the usage of the sandbox on exit" },
+      { "value", "The value of the option, as accepted by the kernel, or on/off for accounting" },
+    })
+    .with_example("fim-limit set cpu.max \"50000 100000\"")
+    .with_example("fim-limit set memory.max 2G")
+    .with_example("fim-limit set accounting on")
+    .with_example("fim-limit set affinity 0-3")
+    .with_example("fim-limit set affinity.fuse node:1")
+    .with_usage("fim-limit <del> <option>")
+    .with_args({
+      { "del", "Delete a resource limit" },
+    })
+    .with_usage("fim-limit <list|clear>")
+    .with_args({
+      { "list", "Lists the configured limits in the format option=value" },
+      { "clear", "Clears all the configured limits" },
+    })
+    .with_note("FIM_AFFINITY and FIM_AFFINITY_FUSE override the configured placements, e.g., FIM_AFFINITY=4-7")
+    .get();
+}
+
+inline std::string perf_usage()
+{
+  return HelpEntry{"fim-perf"}
+    .with_description("Configure the dwarfs options of the layers and the mkdwarfs profile of new layers")
+    .with_note("Perf options: cachesize,workers,readahead,mlock,tidy_strategy,perfmon")
+    .with_usage("fim-perf <set> <option> <value> [layer]")
+    .with_args({
+      { "set", "Set a dwarfs option for all layers, or for the layer with index [layer]" },
+      { "option", "The dwarfs option to set" },
+      { "value", "The value of the option, as accepted by dwarfs" },
+      { "layer", "Index of the layer as shown by 'fim-layer list'" },
+    })
+    .with_example("fim-perf set cachesize 1g")
+    .with_example("fim-perf set workers 4 0")
+    .with_example("fim-perf set perfmon fuse+block_cache 0")
+    .with_usage("fim-perf <del> <option> [layer]")
+    .with_args({
+      { "del", "Delete a dwarfs option for all layers, or for the layer with index [layer]" },
+    })
+    .with_usage("fim-perf <profile> <fast|balanced|small|random-access|none> [options...]")
+    .with_args({
+      { "profile", "Set the default profile of mkdwarfs to create new layers with" },
+      { "options", "Raw options of mkdwarfs appended after the profile" },
+    })
+    .with_example("fim-perf profile small")
+    .with_example("fim-perf profile random-access --block-size-bits 19")
+    .with_usage("fim-perf <budget> <size|none>")
+    .with_args({
+      { "budget", "Split a total cache size across the layers, weighted by their size or their recorded accesses" },
+      { "size", "The total size of the block caches, e.g., 2g, or none to remove the budget" },
+    })
+    .with_example("fim-perf budget 1g")
+    .with_usage("fim-perf <shm> <size|hugetlbfs|none>")
+    .with_args({
+      { "shm", "Select the /dev/shm mounted by the 'shm' permission" },
+      { "size", "Size of a private tmpfs for the instance, e.g., 4g, requires bubblewrap 0.10 or later" },
+      { "hugetlbfs", "Bind a directory of the hugetlbfs mount of the host, shared memory is backed by huge pages (mmap only)" },
+      { "none", "Bind the /dev/shm of the host, the default" },
+    })
+    .with_example("fim-perf shm 4g")
+    .with_usage("fim-perf <list|clear>")
+    .with_args({
+      { "list", "Lists the configured options in the format <global|layer>:option=value, the cache budget, the shm mount and the layer profile" },
+      { "clear", "Clears all the configured options, including the cache budget, the shm mount and the layer profile" },
+    })
+    .with_note("FIM_DWARFS_<OPTION> variables override the configured options, e.g., FIM_DWARFS_CACHESIZE=2g")
+    .with_note("FIM_DWARFS_BUDGET overrides the configured cache budget")
+    .with_note("FIM_SHM overrides the configured shm mount")
+    .with_note("Pages of a private shm follow the NUMA nodes of 'fim-limit set affinity node:<list>'")
+    .get();
+}
+
 inline std::string remote_usage()
 {
   return HelpEntry{"fim-remote"}
@@ -342,6 +509,45 @@ inline std::string remote_usage()
     .get();
 }
 
+inline std::string update_usage()
+{
+  return HelpEntry{"fim-update"}
+    .with_description("Update the FlatImage from a published copy, downloading only the changed regions")
+    .with_usage("fim-update <apply>")
+    .with_args({
+      { "apply", "Downloads the changed regions from the update URL, verifies the new image and replaces the current one" },
+    })
+    .with_usage("fim-update <keygen> <key-file>")
+    .with_args({
+      { "keygen", "Generates a signing key, saves the secret key to <key-file> and prints the public key" },
+      { "key-file", "Where to save the secret key, it must not exist" },
+    })
+    .with_example("fim-update keygen ~/.config/app.key")
+    .with_usage("fim-update <publish> <dir> <key-file>")
+    .with_args({
+      { "publish", "Writes the signed manifest and the regions of the current image to <dir>, to serve at the update URL" },
+      { "dir", "Directory to publish to, regions already in it are kept" },
+      { "key-file", "The secret key of the update key of the image" },
+    })
+    .with_example("fim-update publish /srv/www/app ~/.config/app.key")
+    .with_usage("fim-update <set> <url> <key>")
+    .with_args({
+      { "set", "Set the update URL and the public key its manifests must be signed with" },
+      { "url", "The https URL of a directory written by 'fim-update publish'" },
+      { "key", "The public key printed by 'fim-update keygen'" },
+    })
+    .with_example("fim-update set https://updates.example.com/app 3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c")
+    .with_usage("fim-update <show>")
+    .with_args({
+      { "show", "Display the current update URL and key" },
+    })
+    .with_usage("fim-update <clear>")
+    .with_args({
+      { "clear", "Clear the configured update URL and key" },
+    })
+    .get();
+}
+
 inline std::string recipe_usage()
 {
   return HelpEntry{"fim-recipe"}
@@ -386,6 +592,23 @@ inline std::string root_usage()
     .get();
 }
 
+inline std::string stats_usage()
+{
+  return HelpEntry{"fim-stats"}
+    .with_description("Show the runtime counters of running instances")
+    .with_usage("fim-stats <show|json> [id]")
+    .with_args({
+      { "show", "Lists the counters as 'name=value' lines" },
+      { "json", "Prints the counters as a JSON object, keyed by the pid of each instance" },
+      { "id", "ID of the instance as shown by 'fim-instance list', defaults to all instances" },
+    })
+    .with_note("Counters include mounted layers, mount time, portal requests and their latency, relayed bytes and janitor cleanups")
+    .with_note("Layers mounted with 'fim-perf set perfmon' also show the summary of the dwarfs performance monitor")
+    .with_example("fim-stats show 0")
+    .with_example("fim-stats json")
+    .get();
+}
+
 inline std::string unshare_usage()
 {
   return HelpEntry{"fim-unshare"}
@@ -423,6 +646,18 @@ inline std::string version_usage()
     .get();
 }
 
+inline std::string volatile_usage()
+{
+  return HelpEntry{"fim-volatile"}
+    .with_description("Discards the changes to the filesystem on exit, they are kept in memory during the run")
+    .with_usage("fim-volatile <on|off>")
+    .with_args({
+      { "on", "Enables the volatile mode" },
+      { "off", "Disables the volatile mode" },
+    })
+    .get();
+}
+
 } // namespace ns_cmd::ns_help
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,255 @@
+/**
+ * @file instance.hpp
+ * @author Ruan Formigoni
+ * @brief Warm instances that serve the invocations of a FlatImage binary
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../filesystems/utils.hpp"
+#include "../../macro.hpp"
+
+/**
+ * @namespace ns_cmd::ns_instance
+ * @brief Implementation of the fim-instance serve command
+ *
+ * A served instance is a regular instance whose program waits on the file '<instance>/serve',
+ * which holds the path of the binary it serves. Later invocations of that binary find it among
+ * the running instances and forward their command through the guest portal instead of mounting
+ * and sandboxing again.
+ *
+ * The file doubles as the lease of the instance:
+ * - Clients hold a shared lock on it while their command runs, and touch it when done
+ * - The server takes the exclusive lock once a second, and removes the file when it has not been
+ *   touched for the idle timeout, which ends the program of the instance
+ *
+ * A client that got the shared lock after the removal sees a file without links and falls back
+ * to a regular launch.
+ */
+namespace ns_cmd::ns_instance
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+} // namespace
+
+/**
+ * @brief Gets the path of the serve file of an instance
+ *
+ * @param path_dir_instance Path to the instance directory
+ * @return fs::path The path to the serve file
+ */
+[[nodiscard]] inline fs::path path_file_serve(fs::path const& path_dir_instance)
+{
+  return path_dir_instance / "serve";
+}
+
+/**
+ * @class Server
+ * @brief Publishes the current instance as served, and tears it down when idle
+ */
+class Server
+{
+  private:
+    fs::path m_path_file_serve;
+    int m_fd;
+    std::mutex m_mutex;
+    std::condition_variable_any m_cv;
+    std::jthread m_thread;
+
+    Server(fs::path const& path_file_serve, int fd, std::chrono::seconds timeout);
+    void watch(std::stop_token token, std::chrono::seconds timeout);
+
+  public:
+    [[nodiscard]] static Value<std::unique_ptr<Server>> create(fs::path const& path_dir_instance
+      , fs::path const& path_file_binary
+      , std::chrono::seconds timeout
+    );
+    ~Server();
+    Server(Server const&) = delete;
+    Server(Server&&) = delete;
+    Server& operator=(Server const&) = delete;
+    Server& operator=(Server&&) = delete;
+};
+
+/**
+ * @brief Construct a new Server object and start the idle watcher
+ *
+ * @param path_file_serve Path to the serve file
+ * @param fd Open file descriptor of the serve file
+ * @param timeout Idle time after which the instance is torn down
+ */
+inline Server::Server(fs::path const& path_file_serve, int fd, std::chrono::seconds timeout)
+  : m_path_file_serve(path_file_serve)
+  , m_fd(fd)
+  , m_mutex()
+  , m_cv()
+  , m_thread([this, timeout](std::stop_token token){ watch(token, timeout); })
+{
+}
+
+/**
+ * @brief Creates the serve file of the current instance
+ *
+ * @param path_dir_instance Path to the directory of the current instance
+ * @param path_file_binary Path to the flatimage binary being served
+ * @param timeout Idle time after which the instance is torn down
+ * @return Value<std::unique_ptr<Server>> The server, or the respective error
+ */
+inline Value<std::unique_ptr<Server>> Server::create(fs::path const& path_dir_instance
+  , fs::path const& path_file_binary
+  , std::chrono::seconds timeout)
+{
+  fs::path path_file = path_file_serve(path_dir_instance);
+  // Write the served binary, clients compare it before connecting
+  std::ofstream file(path_file, std::ios::trunc);
+  return_if(not file.is_open(), Error("E::Could not create serve file '{}'", path_file));
+  file << path_file_binary.string();
+  file.close();
+  int fd = ::open(path_file.c_str(), O_RDWR | O_CLOEXEC);
+  return_if(fd < 0, Error("E::Could not open serve file '{}': {}", path_file, strerror(errno)));
+  return std::unique_ptr<Server>(new Server(path_file, fd, timeout));
+}
+
+/**
+ * @brief Removes the serve file once no client holds it and it was idle for the timeout
+ *
+ * @param token Stop token of the watcher thread
+ * @param timeout Idle time after which the serve file is removed
+ */
+inline void Server::watch(std::stop_token token, std::chrono::seconds timeout)
+{
+  std::unique_lock lock(m_mutex);
+  while(not m_cv.wait_for(lock, token, std::chrono::seconds(1), []{ return false; }))
+  {
+    // Busy while a client holds the shared lock
+    continue_if(::flock(m_fd, LOCK_EX | LOCK_NB) < 0);
+    struct stat st{};
+    auto idle = (::fstat(m_fd, &st) == 0)?
+        std::chrono::system_clock::now() - std::chrono::system_clock::from_time_t(st.st_mtime)
+      : std::chrono::system_clock::duration::max();
+    if(idle >= timeout)
+    {
+      logger("D::Served instance idle for {}s, tearing down", timeout.count());
+      std::error_code ec;
+      fs::remove(m_path_file_serve, ec);
+      ::flock(m_fd, LOCK_UN);
+      return;
+    }
+    ::flock(m_fd, LOCK_UN);
+  }
+}
+
+/**
+ * @brief Destroy the Server object, the instance is no longer served
+ */
+inline Server::~Server()
+{
+  m_thread.request_stop();
+  if(m_thread.joinable()) { m_thread.join(); }
+  std::error_code ec;
+  fs::remove(m_path_file_serve, ec);
+  ::close(m_fd);
+}
+
+/**
+ * @class Lease
+ * @brief Keeps a served instance alive while a client command runs in it
+ */
+class Lease
+{
+  private:
+    ns_filesystems::ns_utils::Instance m_instance;
+    int m_fd;
+
+    Lease(ns_filesystems::ns_utils::Instance instance, int fd);
+
+  public:
+    [[nodiscard]] static std::optional<std::unique_ptr<Lease>> acquire(fs::path const& path_dir_instances
+      , fs::path const& path_file_binary
+    );
+    [[nodiscard]] ns_filesystems::ns_utils::Instance const& instance() const { return m_instance; }
+    ~Lease();
+    Lease(Lease const&) = delete;
+    Lease(Lease&&) = delete;
+    Lease& operator=(Lease const&) = delete;
+    Lease& operator=(Lease&&) = delete;
+};
+
+/**
+ * @brief Construct a new Lease object
+ *
+ * @param instance The served instance
+ * @param fd File descriptor of its serve file, with the shared lock held
+ */
+inline Lease::Lease(ns_filesystems::ns_utils::Instance instance, int fd)
+  : m_instance(std::move(instance))
+  , m_fd(fd)
+{
+}
+
+/**
+ * @brief Looks for an instance that serves a binary and leases it
+ *
+ * @param path_dir_instances Path to the directory with the instances of the application
+ * @param path_file_binary Path to the flatimage binary
+ * @return std::optional<std::unique_ptr<Lease>> The lease, or nothing if no instance serves the binary
+ */
+inline std::optional<std::unique_ptr<Lease>> Lease::acquire(fs::path const& path_dir_instances
+  , fs::path const& path_file_binary)
+{
+  for(auto&& instance : ns_filesystems::ns_utils::get_instances(path_dir_instances))
+  {
+    fs::path path_file = path_file_serve(instance.path);
+    int fd = ::open(path_file.c_str(), O_RDWR | O_CLOEXEC);
+    continue_if(fd < 0);
+    // Compare the served binary
+    std::string buf(path_file_binary.string().size() + 1, '\0');
+    ssize_t size = ::pread(fd, buf.data(), buf.size(), 0);
+    bool is_match = size >= 0 and std::string_view(buf.data(), size) == path_file_binary.string();
+    // The server might have removed the file before the lock was acquired
+    struct stat st{};
+    if(not is_match or ::flock(fd, LOCK_SH) < 0 or ::fstat(fd, &st) < 0 or st.st_nlink == 0)
+    {
+      ::close(fd);
+      continue;
+    }
+    logger("D::Using served instance '{}'", instance.pid);
+    return std::unique_ptr<Lease>(new Lease(instance, fd));
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Destroy the Lease object, restarts the idle time of the instance
+ */
+inline Lease::~Lease()
+{
+  ::futimens(m_fd, nullptr);
+  ::close(m_fd);
+}
+
+} // namespace ns_cmd::ns_instance
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -9,22 +9,89 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <csignal>
+#include <dirent.h>
+#include <fcntl.h>
 #include <regex>
 #include <unistd.h>
 #include <iostream>
 #include <format>
+#include <linux/falloc.h>
+#include <sys/sendfile.h>
+#include <sys/statfs.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "../../lib/subprocess.hpp"
 #include "../../lib/env.hpp"
+#include "../../lib/fuse.hpp"
+#include "../../lib/hash.hpp"
 #include "../../std/expected.hpp"
 #include "../../filesystems/layers.hpp"
+#include "../../filesystems/dwarfs.hpp"
+#include "snapshot.hpp"
 
 namespace
 {
 
 namespace fs = std::filesystem;
 
+// Whiteout markers of fuse-overlayfs and overlayfs
+constexpr std::string_view const whiteout_prefix = ".wh.";
+constexpr std::string_view const whiteout_opaque = ".wh..wh..opq";
+// Whiteout markers of unionfs-fuse
+constexpr std::string_view const unionfs_meta = ".unionfs-fuse";
+constexpr std::string_view const unionfs_hidden = "_HIDDEN~";
+// Interval between the progress reports of a layer creation
+constexpr auto const PROGRESS_INTERVAL = std::chrono::seconds(1);
+// Lines of the output of mkdwarfs shown when it fails
+constexpr size_t const OUTPUT_TAIL = 20;
+
+/**
+ * @brief Formats a number of bytes with a binary unit, e.g., '12.3 MiB'
+ *
+ * @param bytes The number of bytes
+ * @return std::string The formatted size
+ */
+[[nodiscard]] inline std::string to_size(double bytes)
+{
+  constexpr std::array<std::string_view,5> const units{"B", "KiB", "MiB", "GiB", "TiB"};
+  size_t i = 0;
+  for(; bytes >= 1024 and i + 1 < units.size(); ++i) { bytes /= 1024; }
+  return std::format("{:.1f} {}", bytes, units[i]);
+}
+
+/**
+ * @brief Parses a size printed by mkdwarfs, e.g., '47.01' and 'MiB'
+ *
+ * @param number The number of units
+ * @param unit The unit, 'B' or a binary prefix followed by 'iB'
+ * @return std::optional<uint64_t> The number of bytes, or nullopt for an unknown unit
+ */
+[[nodiscard]] inline std::optional<uint64_t> from_size(std::string const& number, std::string_view unit)
+{
+  constexpr std::string_view const prefixes = "KMGT";
+  double bytes = Catch(std::stod(number)).value_or(0);
+  return_if(unit == "B", static_cast<uint64_t>(bytes));
+  return_if(unit.size() != 3 or not unit.ends_with("iB"), std::nullopt);
+  auto pos = prefixes.find(unit.front());
+  return_if(pos == std::string_view::npos, std::nullopt);
+  return static_cast<uint64_t>(bytes * std::pow(1024.0, pos + 1));
+}
+
 }
 
 /**
@@ -38,113 +105,539 @@ namespace fs = std::filesystem;
 namespace ns_layers
 {
 
+/**
+ * @brief Result of walking a directory tree to compress it
+ */
+struct Gathered
+{
+  uint64_t count_entries;                 ///< Number of entries in the list of files
+  std::vector<fs::path> vec_path_skipped; ///< Entries left out of the list, relative paths
+};
+
+/**
+ * @brief Result of creating a layer
+ */
+struct Created
+{
+  std::vector<fs::path> vec_path_skipped;   ///< Entries left out of the layer, relative paths
+  std::chrono::milliseconds duration_scan;     ///< Time to walk the source directory
+  std::chrono::milliseconds duration_compress; ///< Time until mkdwarfs finished, includes the walk
+};
+
+/**
+ * @brief Progress of a layer creation, shared by the walk, the output readers and the reporter
+ */
+struct Progress
+{
+  std::atomic<uint64_t> count_entries{0}; ///< Entries streamed to mkdwarfs
+  std::atomic<bool> is_scanned{false};    ///< Whether the walk is over
+  std::atomic<uint64_t> permille{0};      ///< Completion reported by mkdwarfs, in tenths of a percent
+  std::atomic<uint64_t> bytes_in{0};      ///< Input bytes reported by mkdwarfs when it finishes
+  std::atomic<uint64_t> bytes_out{0};     ///< Compressed bytes reported by mkdwarfs when it finishes
+};
+
+/**
+ * @brief Walks a directory tree in parallel and streams the viable entries to a file descriptor
+ *
+ * Workers take directories from a shared queue, list them with readdir (the entry type comes
+ * from the directory itself, so regular entries need no stat) and push the sub-directories back
+ * in the queue. Each worker buffers its relative paths and flushes them to the descriptors in
+ * blocks, so the consumer starts reading before the walk ends.
+ *
+ * Entries included are regular files, symlinks and empty directories. Directories that cannot be
+ * opened and other file types are skipped, and reported back to the caller.
+ *
+ * @param path_dir_src Path to the source directory
+ * @param vec_fd_list File descriptors to write the newline-separated relative paths to
+ * @param count_entries Counter of the entries written, readable while the walk runs
+ * @return Value<Gathered> The number of entries written and the skipped entries, or the respective error
+ */
+[[nodiscard]] inline Value<Gathered> gather(fs::path const& path_dir_src
+  , std::vector<int> const& vec_fd_list
+  , std::atomic<uint64_t>& count_entries)
+{
+  std::deque<fs::path> queue{fs::path{}};
+  std::mutex mutex_queue;
+  std::condition_variable cv_queue;
+  std::mutex mutex_list;
+  uint64_t count_active = 0;
+  std::atomic<bool> is_failed{false};
+  std::mutex mutex_skipped;
+  std::vector<fs::path> vec_path_skipped;
+  auto f_skip = [&](fs::path const& path_entry)
+  {
+    std::lock_guard lock(mutex_skipped);
+    vec_path_skipped.push_back(path_entry);
+  };
+  // Writes a block of paths to the lists
+  auto f_flush = [&](std::string& buffer)
+  {
+    std::lock_guard lock(mutex_list);
+    for(int fd_list : vec_fd_list)
+    {
+      for(size_t offset = 0; offset < buffer.size() and not is_failed;)
+      {
+        ssize_t bytes = ::write(fd_list, buffer.data() + offset, buffer.size() - offset);
+        if(bytes < 0 and errno == EINTR) { continue; }
+        if(bytes <= 0)
+        {
+          logger("E::Could not write to list of files: {}", strerror(errno));
+          is_failed = true;
+          break;
+        }
+        offset += bytes;
+      }
+    }
+    buffer.clear();
+  };
+  // Lists one directory, relative to the source directory
+  auto f_list = [&](fs::path const& path_dir_relative, std::string& buffer)
+  {
+    fs::path path_dir = path_dir_src / path_dir_relative;
+    DIR* dir = ::opendir(path_dir.c_str());
+    if(dir == nullptr)
+    {
+      logger("I::Insufficient permissions to enter directory '{}'", path_dir);
+      f_skip(path_dir_relative);
+      return;
+    }
+    bool is_empty = true;
+    std::vector<fs::path> dirs;
+    for(struct dirent* entry; (entry = ::readdir(dir)) != nullptr;)
+    {
+      std::string_view name = entry->d_name;
+      continue_if(name == "." or name == "..");
+      is_empty = false;
+      fs::path path_entry = path_dir_relative / name;
+      unsigned char type = entry->d_type;
+      // Some filesystems do not report the type of the entry
+      if(type == DT_UNKNOWN)
+      {
+        struct stat st;
+        continue_if(::fstatat(::dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0);
+        type = S_ISREG(st.st_mode)? DT_REG : S_ISLNK(st.st_mode)? DT_LNK : S_ISDIR(st.st_mode)? DT_DIR : DT_UNKNOWN;
+      }
+      if(type == DT_REG or type == DT_LNK)
+      {
+        buffer += path_entry.string();
+        buffer += '\n';
+        count_entries += 1;
+      }
+      else if(type == DT_DIR)
+      {
+        dirs.push_back(std::move(path_entry));
+      }
+      else
+      {
+        logger("I::Ignoring file '{}'", path_dir_src / path_entry);
+        f_skip(path_entry);
+      }
+    }
+    ::closedir(dir);
+    // Add empty directory to the list, the source directory itself is implicit
+    if(is_empty and not path_dir_relative.empty())
+    {
+      buffer += path_dir_relative.string();
+      buffer += '\n';
+      count_entries += 1;
+    }
+    // Share the sub-directories with the other workers
+    if(not dirs.empty())
+    {
+      std::lock_guard lock(mutex_queue);
+      std::ranges::move(dirs, std::back_inserter(queue));
+      cv_queue.notify_all();
+    }
+  };
+  // Takes directories from the queue until the walk is over
+  auto f_worker = [&]
+  {
+    std::string buffer;
+    while(true)
+    {
+      fs::path path_dir_relative;
+      {
+        std::unique_lock lock(mutex_queue);
+        cv_queue.wait(lock, [&]{ return not queue.empty() or count_active == 0 or is_failed; });
+        break_if(queue.empty() or is_failed);
+        path_dir_relative = std::move(queue.front());
+        queue.pop_front();
+        count_active += 1;
+      }
+      f_list(path_dir_relative, buffer);
+      if(buffer.size() > 64 * 1024)
+      {
+        f_flush(buffer);
+      }
+      {
+        std::lock_guard lock(mutex_queue);
+        count_active -= 1;
+        cv_queue.notify_all();
+      }
+    }
+    f_flush(buffer);
+  };
+  // Run the workers, the first one starts on the source directory
+  {
+    size_t count_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    std::vector<std::jthread> workers;
+    for(size_t i = 0; i < count_threads; ++i)
+    {
+      workers.emplace_back(f_worker);
+    }
+  }
+  return_if(is_failed, Error("E::Failed to stream list of files to compress"));
+  return Gathered{count_entries.load(), std::move(vec_path_skipped)};
+}
+
 /**
  * @brief Creates a layer (filesystem) from a source directory
  *
+ * The directory is walked in parallel and the list of files is streamed to mkdwarfs through a
+ * pipe, so mkdwarfs starts reading the list while the walk is still running. The list is also
+ * saved to a file for callers that need it afterwards.
+ *
+ * The output of mkdwarfs goes to a log file next to the list of files, its lines are parsed for
+ * the completion and the input size. Every PROGRESS_INTERVAL the number of entries walked, the
+ * bytes written and the estimated time left are reported.
+ *
  * @param path_dir_src Path to the source directory
  * @param path_file_dst Path to the output filesystem file
  * @param path_file_list Path to a temporary file to store the list of files to compress
  * @param compression_level The compression level to create the filesystem
- * @return Value<void> Nothing on success, or the respective error
+ * @param options Extra options of mkdwarfs, like the ones of a profile, a level in them takes
+ * precedence over compression_level
+ * @return Value<Created> The entries that were not compressed, relative to the source directory,
+ * and the duration of each phase, or the respective error
  */
-[[nodiscard]] inline Value<void> create(fs::path const& path_dir_src
+[[nodiscard]] inline Value<Created> create(fs::path const& path_dir_src
   , fs::path const& path_file_dst
   , fs::path const& path_file_list
-  , uint64_t compression_level)
+  , uint64_t compression_level
+  , std::vector<std::string> const& options = {})
 {
   // Find mkdwarfs binary
   auto path_file_mkdwarfs = Pop(ns_env::search_path("mkdwarfs"));
   // Compression level
   return_if(compression_level > 9, Error("E::Out-of-bounds compression level '{}'", compression_level));
-  // Search for all viable files to compress
-  logger("I::Gathering files to compress...");
-  std::ofstream file_list(path_file_list, std::ios::out | std::ios::trunc);
-  return_if(not file_list.is_open()
-    , Error("E::Could not open list of files '{}' to compress", path_file_list)
-  );
   // Check if source directory exists and is a directory
   return_if(not Catch(fs::exists(path_dir_src)).value_or(false), Error("E::Source directory '{}' does not exist", path_dir_src));
   return_if(not Catch(fs::is_directory(path_dir_src)).value_or(false), Error("E::Source '{}' is not a directory", path_dir_src));
-  // Gather files to compress
-  for(auto&& entry = Try(fs::recursive_directory_iterator(path_dir_src))
-    ; entry != fs::recursive_directory_iterator()
-    ; ++entry)
+  // Open the saved list of files
+  int fd_file = ::open(path_file_list.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  return_if(fd_file < 0, Error("E::Could not open list of files '{}' to compress", path_file_list));
+  // Create the pipe for the list of files, only the read end is inherited by mkdwarfs
+  int fds[2];
+  if(::pipe2(fds, O_CLOEXEC) < 0)
+  {
+    ::close(fd_file);
+    return Error("E::Could not create pipe for list of files: {}", strerror(errno));
+  }
+  auto [fd_read, fd_write] = fds;
+  ::fcntl(fd_read, F_SETFD, 0);
+  // Compress filesystem, mkdwarfs rejects an option given twice
+  auto f_has = [&](std::string_view prefix)
+  {
+    return std::ranges::any_of(options, [&](std::string const& option){ return option.starts_with(prefix); });
+  };
+  std::vector<std::string> args = options;
+  if(not std::ranges::contains(options, "-l") and not f_has("--compress-level"))
+  {
+    args.insert(args.begin(), {"-l", std::to_string(compression_level)});
+  }
+  // Progress lines instead of a terminal animation
+  if(not f_has("--progress"))
+  {
+    args.push_back("--progress=simple");
+  }
+  logger("I::Options of mkdwarfs: '{}'", args);
+  logger("I::Compress filesystem to '{}'", path_file_dst);
+  // Parse the output of mkdwarfs, the last lines are kept to report a failure
+  Progress progress;
+  std::mutex mutex_output;
+  std::deque<std::string> tail_output;
+  std::regex const regex_percent(R"(([0-9]+(\.[0-9]+)?)%)");
+  std::regex const regex_compressed(R"(compressed ([0-9.]+) ([KMGT]?i?B) to ([0-9.]+) ([KMGT]?i?B))");
+  auto f_line = [&](std::string_view line)
   {
-    // Get full file path to entry
-    fs::path path_entry = entry->path();
-    // Regular file or symlink
-    if(entry->is_regular_file() or entry->is_symlink())
+    std::string str_line(line);
+    std::smatch match;
+    if(std::regex_search(str_line, match, regex_percent))
     {
-      file_list
-        << path_entry.lexically_relative(path_dir_src).string()
-        << '\n';
+      progress.permille = static_cast<uint64_t>(Catch(std::stod(match[1].str())).value_or(0) * 10);
     }
-    // Is a directory
-    else if(entry->is_directory())
+    if(std::regex_search(str_line, match, regex_compressed))
     {
-      // Ignore directory as it is not traverseable
-      if(::access(path_entry.c_str(), R_OK | X_OK) != 0)
-      {
-        logger("I::Insufficient permissions to enter directory '{}'", path_entry);
-        entry.disable_recursion_pending();
-        continue;
-      }
-      // Add empty directory to the list
-      if(Catch(fs::is_empty(path_entry)).value_or(false))
-      {
-        file_list
-          << path_entry.lexically_relative(path_dir_src).string()
-          << '\n';
-      }
+      progress.bytes_in = from_size(match[1].str(), match[2].str()).value_or(0);
+      progress.bytes_out = from_size(match[3].str(), match[4].str()).value_or(0);
     }
-    // Unsupported for compression
-    else
+    std::lock_guard lock(mutex_output);
+    tail_output.push_back(std::move(str_line));
+    if(tail_output.size() > OUTPUT_TAIL) { tail_output.pop_front(); }
+  };
+  auto time_start = std::chrono::steady_clock::now();
+  auto child = ns_subprocess::Subprocess(path_file_mkdwarfs)
+    .with_args("-f")
+    .with_args("-i", path_dir_src, "-o", path_file_dst)
+    .with_args(args)
+    .with_args("--input-list", std::format("/dev/fd/{}", fd_read))
+    .with_log_file(fs::path{path_file_list}.replace_filename("mkdwarfs.log"))
+    .with_callback_line(f_line)
+    .spawn();
+  ::close(fd_read);
+  // Report the progress until mkdwarfs finishes
+  std::jthread reporter([&, level = ns_log::get_level()](std::stop_token token)
+  {
+    ns_log::set_level(level);
+    std::mutex mutex;
+    std::condition_variable_any cv;
+    std::unique_lock lock(mutex);
+    for(uint64_t count_entries_last = 0, bytes_out_last = 0;;)
     {
-      logger("I::Ignoring file '{}'", path_entry);
+      std::ignore = cv.wait_for(lock, token, PROGRESS_INTERVAL, []{ return false; });
+      break_if(token.stop_requested());
+      double seconds = std::chrono::duration<double>(PROGRESS_INTERVAL).count();
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+      uint64_t count_entries = progress.count_entries;
+      std::string str_scan = (progress.is_scanned)? std::format("{} entries", count_entries)
+        : std::format("{} entries ({:.0f}/s)", count_entries, (count_entries - count_entries_last) / seconds);
+      // The size of a streamed layer is unknown until mkdwarfs reports it
+      auto bytes_out = Catch(fs::file_size(path_file_dst));
+      std::string str_compress = (not bytes_out)? "streaming" : std::format("{} written ({}/s)"
+        , to_size(*bytes_out)
+        , to_size((*bytes_out - std::min(*bytes_out, bytes_out_last)) / seconds)
+      );
+      if(uint64_t permille = progress.permille; permille > 0 and permille < 1000)
+      {
+        str_compress += std::format(", {:.1f}%, ETA {:.0f}s", permille / 10.0, elapsed * (1000 - permille) / permille);
+      }
+      logger("I::Progress: scan {}, compress {}", str_scan, str_compress);
+      count_entries_last = count_entries;
+      bytes_out_last = bytes_out.value_or(0);
     }
+  });
+  // Search for all viable files to compress
+  logger("I::Gathering files to compress...");
+  // A failed mkdwarfs closes the pipe, report it as a write error instead of dying on SIGPIPE
+  auto handler_sigpipe = ::signal(SIGPIPE, SIG_IGN);
+  Value<Gathered> gathered = gather(path_dir_src, {fd_write, fd_file}, progress.count_entries);
+  ::close(fd_write);
+  ::close(fd_file);
+  ::signal(SIGPIPE, handler_sigpipe);
+  auto duration_scan = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_start);
+  progress.is_scanned = true;
+  // Wait for compression to finish
+  Value<int> code = child->wait();
+  auto duration_compress = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_start);
+  reporter.request_stop();
+  reporter.join();
+  auto [count_entries, vec_path_skipped] = Pop(gathered);
+  logger("I::Gathered {} entries to compress", count_entries);
+  if(not code or *code != 0)
+  {
+    for(auto const& line : tail_output) { logger("E::mkdwarfs: {}", line); }
+    return Error("E::mkdwarfs exited with code '{}'", code.value_or(-1));
   }
-  file_list.close();
-
-  // Compress filesystem
-  logger("I::Compression level: '{}'", compression_level);
-  logger("I::Compress filesystem to '{}'", path_file_dst);
-  Pop(ns_subprocess::Subprocess(path_file_mkdwarfs)
-    .with_args("-f")
-    .with_args("-i", path_dir_src, "-o", path_file_dst)
-    .with_args("-l", compression_level)
-    .with_args("--input-list", path_file_list)
-    .spawn()->wait());
-  return{};
+  // Summary of the compression
+  double seconds_compress = std::chrono::duration<double>(duration_compress).count();
+  uint64_t bytes_in = progress.bytes_in;
+  uint64_t bytes_out = Catch(fs::file_size(path_file_dst)).value_or(progress.bytes_out);
+  logger("I::Compressed {} entries ({:.0f}/s) from {} to {} (ratio {}) in {:.2f}s"
+    , count_entries
+    , count_entries / std::max(seconds_compress, 0.001)
+    , (bytes_in > 0)? to_size(bytes_in) : "an unknown size"
+    , to_size(bytes_out)
+    , (bytes_in > 0)? std::format("{:.3f}", static_cast<double>(bytes_out) / bytes_in) : "unknown"
+    , seconds_compress
+  );
+  return Created{std::move(vec_path_skipped), duration_scan, duration_compress};
 }
 
 /**
  * @brief Includes a filesystem in the target FlatImage
  *
+ * The data is copied in the kernel with copy_file_range, which shares the extents instead of
+ * copying them on filesystems that support reflinks, falling back to sendfile across filesystems
+ * that do not support it. The space is preallocated beforehand. The size header is written only
+ * after the data is synced; until then it reads as zero, which stops the layer scan of
+ * Layers::push_binary instead of pointing it into a truncated filesystem. If any step fails the
+ * binary is truncated back to its previous size, the reserved space is not left behind.
+ *
  * @param path_file_binary Path to the target FlatImage in which to include the filesystem
  * @param path_file_layer Path to the filesystem to include in the FlatImage
  * @return Value<void> Nothing on success, or the respective error
  */
 [[nodiscard]] inline Value<void> add(fs::path const& path_file_binary, fs::path const& path_file_layer)
 {
-  // Open binary file for writing
-  std::ofstream file_binary(path_file_binary, std::ios::app | std::ios::binary);
-  return_if(not file_binary.is_open(), Error("E::Failed to open output file '{}'", path_file_binary));
-  std::ifstream file_layer(path_file_layer, std::ios::in | std::ios::binary);
-  return_if(not file_layer.is_open(), Error("E::Failed to open input file '{}'", path_file_layer));
   // Get byte size
   uint64_t file_size = Try(fs::file_size(path_file_layer));
-  // Write byte size
-  file_binary.write(reinterpret_cast<char*>(&file_size), sizeof(file_size));
-  char buff[8192];
-  while( file_layer.read(buff, sizeof(buff)) or file_layer.gcount() > 0 )
+  // Appends the header and the data, the header goes at the end of the binary and the data right
+  // after it
+  auto f_append = [&](int fd_layer, int fd_binary, off_t offset_header) -> Value<void>
+  {
+    off_t offset_out = offset_header + sizeof(file_size);
+    // Reserve the space, the header reads as zero until it is written
+    if(::fallocate(fd_binary, 0, offset_header, sizeof(file_size) + file_size) < 0)
+    {
+      return_if(errno != EOPNOTSUPP and errno != ENOSYS
+        , Error("E::Failed to allocate space for the layer: {}", strerror(errno))
+      );
+      return_if(::ftruncate(fd_binary, offset_out) < 0
+        , Error("E::Failed to extend output file: {}", strerror(errno))
+      );
+    }
+    // Copy the data
+    off_t offset_in = 0;
+    bool is_copy_range = true;
+    for(uint64_t remaining = file_size; remaining > 0;)
+    {
+      ssize_t bytes = -1;
+      if(is_copy_range)
+      {
+        bytes = ::copy_file_range(fd_layer, &offset_in, fd_binary, &offset_out, remaining, 0);
+        // Not available for this pair of files, e.g., across filesystems on older kernels
+        if(bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP or errno == EINVAL))
+        {
+          logger("D::copy_file_range is unavailable, falling back to sendfile");
+          is_copy_range = false;
+          continue;
+        }
+      }
+      else
+      {
+        // sendfile writes at the file position of the output
+        return_if(::lseek(fd_binary, offset_out, SEEK_SET) < 0
+          , Error("E::Failed to seek output file: {}", strerror(errno))
+        );
+        bytes = ::sendfile(fd_binary, fd_layer, &offset_in, remaining);
+        if(bytes > 0) { offset_out += bytes; }
+      }
+      continue_if(bytes < 0 and errno == EINTR);
+      return_if(bytes <= 0, Error("E::Error writing data to file: {}", strerror(errno)));
+      remaining -= bytes;
+    }
+    // Make the data durable before it becomes reachable
+    return_if(::fdatasync(fd_binary) < 0, Error("E::Failed to sync layer data: {}", strerror(errno)));
+    // Write byte size
+    return_if(::pwrite(fd_binary, &file_size, sizeof(file_size), offset_header) != sizeof(file_size)
+      , Error("E::Failed to write layer size: {}", strerror(errno))
+    );
+    return_if(::fdatasync(fd_binary) < 0, Error("E::Failed to sync layer size: {}", strerror(errno)));
+    return {};
+  };
+  // Open input and output files
+  int fd_layer = ::open(path_file_layer.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd_layer < 0, Error("E::Failed to open input file '{}'", path_file_layer));
+  int fd_binary = ::open(path_file_binary.c_str(), O_WRONLY | O_CLOEXEC);
+  if(fd_binary < 0)
+  {
+    ::close(fd_layer);
+    return Error("E::Failed to open output file '{}'", path_file_binary);
+  }
+  off_t offset_header = ::lseek(fd_binary, 0, SEEK_END);
+  if(offset_header < 0)
+  {
+    ::close(fd_layer);
+    ::close(fd_binary);
+    return Error("E::Failed to seek output file: {}", strerror(errno));
+  }
+  auto result = f_append(fd_layer, fd_binary, offset_header);
+  // Drop the reserved space and a partial layer, the binary is left as it was
+  if(not result and ::ftruncate(fd_binary, offset_header) < 0)
   {
-    file_binary.write(buff, file_layer.gcount());
-    return_if(not file_binary, Error("E::Error writing data to file"));
+    logger("E::Could not truncate '{}' after a failed layer: {}", path_file_binary, strerror(errno));
   }
+  ::close(fd_layer);
+  ::close(fd_binary);
+  Pop(result);
   logger("I::Included novel layer from file '{}'", path_file_layer);
   return {};
 }
 
+/**
+ * @brief Includes a filesystem read from a stream in the target FlatImage
+ *
+ * The size of the layer is unknown until the stream ends, so the header is written as zero, the
+ * data is appended as it arrives and the header is set after the data is synced. Pipes are moved
+ * into the binary with splice, other inputs are copied through a buffer. If the stream fails the
+ * binary is truncated back to its previous size.
+ *
+ * @param path_file_binary Path to the target FlatImage in which to include the filesystem
+ * @param fd_layer File descriptor to read the filesystem from, e.g., the standard input
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> add_stream(fs::path const& path_file_binary, int fd_layer)
+{
+  return_if(::isatty(fd_layer), Error("E::Refusing to read a layer from a terminal, redirect the input"));
+  auto f_append = [&](int fd_binary, off_t offset_header) -> Value<void>
+  {
+    uint64_t file_size = 0;
+    return_if(::pwrite(fd_binary, &file_size, sizeof(file_size), offset_header) != sizeof(file_size)
+      , Error("E::Failed to write layer size: {}", strerror(errno))
+    );
+    off_t offset_out = offset_header + sizeof(file_size);
+    bool is_splice = true;
+    std::vector<char> buffer;
+    while(true)
+    {
+      ssize_t bytes = -1;
+      if(is_splice)
+      {
+        bytes = ::splice(fd_layer, nullptr, fd_binary, &offset_out, 1 << 20, SPLICE_F_MOVE);
+        // The input is not a pipe
+        if(bytes < 0 and errno == EINVAL)
+        {
+          logger("D::splice is unavailable, falling back to read and write");
+          is_splice = false;
+          continue;
+        }
+      }
+      else
+      {
+        buffer.resize(1 << 20);
+        bytes = ::read(fd_layer, buffer.data(), buffer.size());
+        for(ssize_t written = 0; bytes > 0 and written < bytes;)
+        {
+          ssize_t ret = ::pwrite(fd_binary, buffer.data() + written, bytes - written, offset_out);
+          continue_if(ret < 0 and errno == EINTR);
+          return_if(ret <= 0, Error("E::Error writing data to file: {}", strerror(errno)));
+          written += ret;
+          offset_out += ret;
+        }
+      }
+      continue_if(bytes < 0 and errno == EINTR);
+      return_if(bytes < 0, Error("E::Error reading the layer stream: {}", strerror(errno)));
+      break_if(bytes == 0);
+      file_size += bytes;
+    }
+    return_if(file_size == 0, Error("E::The layer stream is empty"));
+    // Make the data durable before it becomes reachable
+    return_if(::fdatasync(fd_binary) < 0, Error("E::Failed to sync layer data: {}", strerror(errno)));
+    return_if(::pwrite(fd_binary, &file_size, sizeof(file_size), offset_header) != sizeof(file_size)
+      , Error("E::Failed to write layer size: {}", strerror(errno))
+    );
+    return_if(::fdatasync(fd_binary) < 0, Error("E::Failed to sync layer size: {}", strerror(errno)));
+    logger("I::Included novel layer of {} bytes from stream", file_size);
+    return {};
+  };
+  int fd_binary = ::open(path_file_binary.c_str(), O_WRONLY | O_CLOEXEC);
+  return_if(fd_binary < 0, Error("E::Failed to open output file '{}'", path_file_binary));
+  off_t offset_header = ::lseek(fd_binary, 0, SEEK_END);
+  if(offset_header < 0)
+  {
+    ::close(fd_binary);
+    return Error("E::Failed to seek output file: {}", strerror(errno));
+  }
+  auto result = f_append(fd_binary, offset_header);
+  // Drop a partial layer, the binary is left as it was
+  if(not result and ::ftruncate(fd_binary, offset_header) < 0)
+  {
+    logger("E::Could not truncate '{}' after a failed stream: {}", path_file_binary, strerror(errno));
+  }
+  ::close(fd_binary);
+  return result;
+}
+
 /**
  * @brief Finds the next available layer number in the layers directory
  *
@@ -178,11 +671,11 @@ namespace ns_layers
  *
  * @param path_file_binary Path to the FlatImage binary
  * @param path_file_layer_tmp Temporary layer file path
- * @param mode Commit mode (binary, layer, or file)
- * @param path_dst Destination path (required for layer/file modes)
+ * @param mode Commit mode (binary, layer, file, or stream)
+ * @param path_dst Destination path (required for layer/file/stream modes)
  * @return Value<void> Nothing on success, or the respective error
  */
-enum class CommitMode { BINARY, LAYER, FILE };
+enum class CommitMode { BINARY, LAYER, FILE, STREAM };
 
 [[nodiscard]] inline Value<void> commit_mode(
     fs::path const& path_file_binary
@@ -231,41 +724,56 @@ enum class CommitMode { BINARY, LAYER, FILE };
       logger("I::Layer saved to '{}'", path_dst.value().string());
     }
     break;
+    case CommitMode::STREAM:
+    {
+      // mkdwarfs already wrote the layer to the stream
+      logger("I::Layer streamed to '{}'", path_dst.value_or("-").string());
+    }
+    break;
   }
   return {};
 }
 
 /**
- * @brief Commit changes into a novel layer (binary/layer/file modes)
+ * @brief Opens the destination of a streamed layer, to be inherited by mkdwarfs
  *
- * @param path_file_binary Path to the FlatImage binary
- * @param path_dir_src Source directory with overlay changes
- * @param path_file_layer_tmp Temporary layer file path
- * @param path_file_list_tmp Temporary file list path
- * @param layer_compression_level Compression level for the layer
- * @param mode Commit mode (binary, layer, or file)
- * @param path_dst Destination path (only for file mode)
+ * With '-' the layer goes to the standard output, which is then pointed to the standard error so
+ * that the logs do not mix with the layer. Other paths are opened for writing, e.g., a fifo or a
+ * character device.
+ *
+ * @param path_stream Path to the destination, or '-' for the standard output
+ * @return Value<int> The file descriptor to write the layer to, or the respective error
+ */
+[[nodiscard]] inline Value<int> open_stream(fs::path const& path_stream)
+{
+  if(path_stream == "-")
+  {
+    return_if(::isatty(STDOUT_FILENO), Error("E::Refusing to write a layer to a terminal, redirect the output"));
+    std::cout.flush();
+    int fd_stream = ::dup(STDOUT_FILENO);
+    return_if(fd_stream < 0, Error("E::Could not duplicate the standard output: {}", strerror(errno)));
+    if(::dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+      ::close(fd_stream);
+      return Error("E::Could not redirect the standard output: {}", strerror(errno));
+    }
+    return fd_stream;
+  }
+  int fd_stream = ::open(path_stream.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  return_if(fd_stream < 0, Error("E::Could not open stream '{}': {}", path_stream, strerror(errno)));
+  return fd_stream;
+}
+
+/**
+ * @brief Erases the committed files from a directory, one by one
+ *
+ * @param path_dir_src Path to the committed directory
+ * @param path_file_list Path to the list of committed files, relative to the directory
  * @return Value<void> Nothing on success, or the respective error
  */
-[[nodiscard]] inline Value<void> commit(
-    fs::path const& path_file_binary
-  , fs::path const& path_dir_src
-  , fs::path const& path_file_layer_tmp
-  , fs::path const& path_file_list_tmp
-  , uint32_t layer_compression_level
-  , CommitMode mode
-  , std::optional<fs::path> const& path_dst = std::nullopt)
+[[nodiscard]] inline Value<void> erase_list(fs::path const& path_dir_src, fs::path const& path_file_list)
 {
-  // Create filesystem based on the contents of src
-  Pop(ns_layers::create(path_dir_src
-    , path_file_layer_tmp
-    , path_file_list_tmp
-    , layer_compression_level
-  ));
-  // Handle the layer based on the commit mode
-  Pop(commit_mode(path_file_binary, path_file_layer_tmp, mode, path_dst));
-  // Remove files from the compression list
-  std::ifstream file_list(path_file_list_tmp);
+  std::ifstream file_list(path_file_list);
   return_if(not file_list.is_open(), Error("E::Could not open file list for erasing files..."));
   std::string line;
   // getline doesn't throw by default, no need to wrap
@@ -292,17 +800,1212 @@ enum class CommitMode { BINARY, LAYER, FILE };
 }
 
 /**
- * @brief Lists all layers in the format index:offset:size:path
+ * @brief Removes directory trees in a detached process, with parallel workers
  *
- * @param layers The Layers object containing all filesystem layers
+ * @param vec_path_dir Paths to the trees to remove
  */
-inline void list(ns_filesystems::ns_layers::Layers const& layers)
+inline void erase_detached(std::vector<fs::path> const& vec_path_dir)
 {
-  for(uint64_t index = 0; auto const& layer : layers.get_layers())
+  return_if(vec_path_dir.empty(),);
+  pid_t pid = ::fork();
+  return_if(pid < 0,, "E::Could not fork to erase files: {}", strerror(errno));
+  return_if(pid > 0,, "D::Erasing {} trees in the background with pid '{}'", vec_path_dir.size(), pid);
+  // Child: detach from the terminal session and keep quiet
+  ::setsid();
+  ns_log::set_as_fork();
+  // Each worker removes whole sub-trees, taken from the entries at the top of the trees
+  std::vector<fs::path> vec_path_entry;
+  for(fs::path const& path_dir : vec_path_dir)
   {
-    std::cout << std::format("{}:{}:{}:{}\n", index, layer.offset, layer.size, layer.path.string());
-    ++index;
+    std::error_code ec;
+    for(auto it = fs::directory_iterator(path_dir, ec); not ec and it != fs::directory_iterator(); it.increment(ec))
+    {
+      vec_path_entry.push_back(it->path());
+    }
+  }
+  std::atomic<size_t> index{0};
+  {
+    std::vector<std::jthread> workers;
+    for(size_t i = 0; i < std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8); ++i)
+    {
+      workers.emplace_back([&]
+      {
+        for(size_t j = index++; j < vec_path_entry.size(); j = index++)
+        {
+          std::error_code ec;
+          fs::remove_all(vec_path_entry[j], ec);
+        }
+      });
+    }
+  }
+  for(fs::path const& path_dir : vec_path_dir)
+  {
+    std::error_code ec;
+    fs::remove_all(path_dir, ec);
+  }
+  ::_exit(0);
+}
+
+/**
+ * @brief Erases the committed files by swapping the directory for an empty one
+ *
+ * The committed directory is renamed aside and replaced by an empty directory, which makes the
+ * cleanup atomic and O(1) for the caller. The entries that were not committed are moved back
+ * into the novel directory, then the old tree is removed by a background process. Trees left
+ * behind by an interrupted removal are removed as well.
+ *
+ * @param path_dir_src Path to the committed directory
+ * @param vec_path_skipped Entries that were not committed, relative to the directory
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> erase_swap(fs::path const& path_dir_src
+  , std::vector<fs::path> const& vec_path_skipped)
+{
+  std::string const prefix = path_dir_src.filename().string() + ".commit.";
+  fs::path const path_dir_old = path_dir_src.parent_path() / std::format("{}{}", prefix, getpid());
+  // Swap the committed directory for a novel one with the same permissions
+  auto perms = Try(fs::status(path_dir_src).permissions());
+  Try(fs::rename(path_dir_src, path_dir_old));
+  if(auto ret = Catch(fs::create_directory(path_dir_src)); not ret)
+  {
+    Try(fs::rename(path_dir_old, path_dir_src));
+    return Error("E::Could not create directory '{}': {}", path_dir_src, ret.error());
+  }
+  Try(fs::permissions(path_dir_src, perms));
+  // Move back what was not committed
+  for(fs::path const& path_entry : vec_path_skipped)
+  {
+    Catch(fs::create_directories((path_dir_src / path_entry).parent_path()))
+      .discard("W::Could not create parent directory for '{}'", path_entry);
+    Catch(fs::rename(path_dir_old / path_entry, path_dir_src / path_entry))
+      .discard("W::Could not restore uncommitted entry '{}'", path_entry);
+  }
+  // Remove the old tree and the ones left by interrupted commits
+  std::vector<fs::path> vec_path_dir_old;
+  for(auto&& entry : Try(fs::directory_iterator(path_dir_src.parent_path())))
+  {
+    if(entry.path().filename().string().starts_with(prefix))
+    {
+      vec_path_dir_old.push_back(entry.path());
+    }
+  }
+  erase_detached(vec_path_dir_old);
+  logger("I::Finished erasing files");
+  return {};
+}
+
+/**
+ * @brief Commit changes into a novel layer (binary/layer/file modes)
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param path_dir_src Source directory with overlay changes
+ * @param path_file_layer_tmp Temporary layer file path
+ * @param path_file_list_tmp Temporary file list path
+ * @param layer_compression_level Compression level for the layer
+ * @param mode Commit mode (binary, layer, file, or stream)
+ * @param path_dst Destination path (file mode), or stream path, '-' for the standard output
+ * @param options Extra options of mkdwarfs for the layer
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> commit(
+    fs::path const& path_file_binary
+  , fs::path const& path_dir_src
+  , fs::path const& path_file_layer_tmp
+  , fs::path const& path_file_list_tmp
+  , uint32_t layer_compression_level
+  , CommitMode mode
+  , std::optional<fs::path> const& path_dst = std::nullopt
+  , std::vector<std::string> const& options = {})
+{
+  // A streamed layer is written by mkdwarfs straight to its destination, without a temporary file
+  int fd_stream = -1;
+  if(mode == CommitMode::STREAM)
+  {
+    return_if(not path_dst.has_value(), Error("E::Stream mode requires a destination"));
+    fd_stream = Pop(open_stream(*path_dst));
+  }
+  // Create filesystem based on the contents of src
+  Value<Created> result = ns_layers::create(path_dir_src
+    , (fd_stream < 0)? path_file_layer_tmp : fs::path{std::format("/dev/fd/{}", fd_stream)}
+    , path_file_list_tmp
+    , layer_compression_level
+    , options
+  );
+  if(fd_stream >= 0) { ::close(fd_stream); }
+  auto created = Pop(result);
+  auto f_elapsed = [](auto const& time_start)
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_start);
+  };
+  // Handle the layer based on the commit mode
+  auto time_append = std::chrono::steady_clock::now();
+  Pop(commit_mode(path_file_binary, path_file_layer_tmp, mode, path_dst));
+  auto duration_append = f_elapsed(time_append);
+  // Remove the committed files from the source directory
+  auto time_cleanup = std::chrono::steady_clock::now();
+  if(auto ret = erase_swap(path_dir_src, created.vec_path_skipped); not ret)
+  {
+    logger("W::Could not swap '{}' for a clean directory, erasing file by file: {}", path_dir_src, ret.error());
+    Pop(erase_list(path_dir_src, path_file_list_tmp));
+  }
+  auto duration_cleanup = f_elapsed(time_cleanup);
+  // The walk runs while mkdwarfs compresses, the compression phase starts when it ends
+  using seconds = std::chrono::duration<double>;
+  logger("I::Commit phases: scan {:.2f}s, compress {:.2f}s, append {:.2f}s, cleanup {:.2f}s"
+    , seconds(created.duration_scan).count()
+    , seconds(created.duration_compress - created.duration_scan).count()
+    , seconds(duration_append).count()
+    , seconds(duration_cleanup).count()
+  );
+  return {};
+}
+
+/**
+ * @brief Copies a layer embedded in a binary to a standalone layer file
+ *
+ * @param path_file_binary Path to the binary that contains the layer
+ * @param offset Offset of the layer data in the binary
+ * @param size Size of the layer data
+ * @param path_file_dst Path to the output layer file
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> extract(fs::path const& path_file_binary
+  , uint64_t offset
+  , uint64_t size
+  , fs::path const& path_file_dst)
+{
+  std::ifstream file_binary(path_file_binary, std::ios::in | std::ios::binary);
+  return_if(not file_binary.is_open(), Error("E::Failed to open input file '{}'", path_file_binary));
+  std::ofstream file_dst(path_file_dst, std::ios::out | std::ios::trunc | std::ios::binary);
+  return_if(not file_dst.is_open(), Error("E::Failed to open output file '{}'", path_file_dst));
+  return_if(not file_binary.seekg(offset), Error("E::Failed to seek offset '{}'", offset));
+  char buff[8192];
+  while(size > 0)
+  {
+    uint64_t count = std::min<uint64_t>(size, sizeof(buff));
+    return_if(not file_binary.read(buff, count), Error("E::Short read from '{}'", path_file_binary));
+    file_dst.write(buff, count);
+    return_if(not file_dst, Error("E::Error writing data to file"));
+    size -= count;
   }
+  return {};
+}
+
+/**
+ * @brief Stacks the contents of a layer directory on top of a staging directory
+ *
+ * Applies the overlay rules of the layer: whiteouts erase the entry they mark, opaque
+ * directories drop what was stacked below them and any other entry replaces the previous one,
+ * along with a whiteout left for it by the layers below. With is_keep_markers the markers are
+ * also copied, so they keep hiding the entries of layers below the squashed range. Entries are
+ * cloned with their permissions, timestamps and extended attributes, where fuse-overlayfs keeps
+ * its opaque markers, and directories stay writable until their contents are stacked.
+ *
+ * @param path_dir_src Directory of the layer to stack
+ * @param path_dir_dst Staging directory
+ * @param is_keep_markers Whether to copy whiteout and opaque markers to the staging directory
+ * @param clone Hard links of the layer already cloned
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> squash_merge(fs::path const& path_dir_src
+  , fs::path const& path_dir_dst
+  , bool is_keep_markers
+  , ns_cmd::ns_snapshot::Clone& clone)
+{
+  // An opaque directory hides everything stacked below it
+  if(Try(fs::exists(fs::symlink_status(path_dir_src / whiteout_opaque))))
+  {
+    for(auto const& entry : Try(fs::directory_iterator(path_dir_dst)))
+    {
+      Pop(ns_filesystems::ns_utils::remove_tree(entry.path()));
+    }
+  }
+  for(auto const& entry : Try(fs::directory_iterator(path_dir_src)))
+  {
+    std::string const name = entry.path().filename().string();
+    fs::path const path_dst = path_dir_dst / name;
+    struct stat st;
+    return_if(::lstat(entry.path().c_str(), &st) < 0, Error("E::Could not stat '{}': {}", entry.path(), strerror(errno)));
+    // unionfs-fuse metadata is applied by the caller
+    continue_if(name == unionfs_meta and not is_keep_markers);
+    // Opaque marker, already applied
+    if(name == whiteout_opaque)
+    {
+      Pop(ns_filesystems::ns_utils::remove_tree(path_dst));
+      if(is_keep_markers) { Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone)); }
+      continue;
+    }
+    // File whiteout
+    if(name.starts_with(whiteout_prefix))
+    {
+      Pop(ns_filesystems::ns_utils::remove_tree(path_dir_dst / name.substr(whiteout_prefix.size())));
+      Pop(ns_filesystems::ns_utils::remove_tree(path_dst));
+      if(is_keep_markers) { Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone)); }
+      continue;
+    }
+    // Character device whiteout
+    if(S_ISCHR(st.st_mode))
+    {
+      continue_if(st.st_rdev != makedev(0, 0), "I::Ignoring file '{}'", entry.path());
+      Pop(ns_filesystems::ns_utils::remove_tree(path_dst));
+      // Creating a device requires privileges, fallback to a file whiteout
+      if(is_keep_markers and ::mknod(path_dst.c_str(), S_IFCHR, makedev(0, 0)) != 0)
+      {
+        std::ofstream{path_dir_dst / (std::string{whiteout_prefix} + name)};
+      }
+      continue;
+    }
+    continue_if(not S_ISDIR(st.st_mode) and not S_ISREG(st.st_mode) and not S_ISLNK(st.st_mode)
+      , "I::Ignoring file '{}'", entry.path()
+    );
+    // The entry replaces the whiteout a layer below left for it
+    fs::path const path_whiteout = path_dir_dst / (std::string{whiteout_prefix} + name);
+    bool const is_whiteout = Try(fs::exists(fs::symlink_status(path_whiteout)));
+    Pop(ns_filesystems::ns_utils::remove_tree(path_whiteout));
+    // Directories are merged with the existing ones
+    if(S_ISDIR(st.st_mode))
+    {
+      if(Try(fs::exists(fs::symlink_status(path_dst))) and not Try(fs::is_directory(fs::symlink_status(path_dst))))
+      {
+        Pop(ns_filesystems::ns_utils::remove_tree(path_dst));
+      }
+      return_if(::mkdir(path_dst.c_str(), S_IRWXU) < 0 and errno != EEXIST
+        , Error("E::Could not create '{}': {}", path_dst, strerror(errno))
+      );
+      return_if(::chmod(path_dst.c_str(), S_IRWXU) < 0, Error("E::Could not change the mode of '{}': {}", path_dst, strerror(errno)));
+      // The directory still hides the entries of the layers below the range
+      if(is_whiteout and is_keep_markers) { std::ofstream{path_dst / whiteout_opaque}; }
+      Pop(squash_merge(entry.path(), path_dst, is_keep_markers, clone));
+      ns_cmd::ns_snapshot::copy_attributes(entry.path(), path_dst, st);
+      continue;
+    }
+    // Regular files and symlinks replace the existing ones
+    Pop(ns_filesystems::ns_utils::remove_tree(path_dst));
+    Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone));
+  }
+  return {};
+}
+
+/**
+ * @brief Stacks a mounted layer on top of a staging directory
+ *
+ * Applies the unionfs-fuse hidden markers of the layer, then merges its contents.
+ *
+ * @param path_dir_layer Mountpoint of the layer to stack
+ * @param path_dir_dst Staging directory
+ * @param is_keep_markers Whether to copy whiteout and opaque markers to the staging directory
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> squash_layer(fs::path const& path_dir_layer
+  , fs::path const& path_dir_dst
+  , bool is_keep_markers)
+{
+  fs::path const path_dir_meta = path_dir_layer / unionfs_meta;
+  if(Try(fs::is_directory(path_dir_meta)))
+  {
+    for(auto const& entry : Try(fs::recursive_directory_iterator(path_dir_meta)))
+    {
+      std::string const str_relative = entry.path().lexically_relative(path_dir_meta).string();
+      continue_if(not entry.is_regular_file() or not str_relative.ends_with(unionfs_hidden));
+      Pop(ns_filesystems::ns_utils::remove_tree(path_dir_dst / str_relative.substr(0, str_relative.size() - unionfs_hidden.size())));
+    }
+  }
+  ns_cmd::ns_snapshot::Clone clone;
+  return squash_merge(path_dir_layer, path_dir_dst, is_keep_markers, clone);
+}
+
+/**
+ * @brief Replaces the layers appended to the binary from an offset on
+ *
+ * The binary up to the offset is copied to a hidden file next to it, copy_file_range shares
+ * the extents on filesystems with reflinks, the layers are appended to the copy and it is renamed
+ * over the binary, so the binary is left intact if any step fails. When the directory of the
+ * binary is not writable the binary is truncated and the layers are appended in place, if that
+ * fails the steps to recover the binary from the layers, which are not removed, are logged.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param offset Offset of the size field of the first layer replaced
+ * @param vec_path_file_layer Layers to append at the offset, in order
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> rewrite(fs::path const& path_file_binary
+  , uint64_t offset
+  , std::vector<fs::path> const& vec_path_file_layer)
+{
+  struct stat st{};
+  return_if(::stat(path_file_binary.c_str(), &st) < 0, Error("E::Could not stat '{}': {}", path_file_binary, strerror(errno)));
+  fs::path const path_file_rewrite = path_file_binary.parent_path()
+    / std::format(".{}.rewrite", path_file_binary.filename().string());
+  ns_filesystems::ns_utils::remove_tree(path_file_rewrite).discard("W::Could not remove '{}'", path_file_rewrite);
+  int fd_rewrite = ::open(path_file_rewrite.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0700);
+  // Rewrite in place, the layers are kept until they are all appended
+  if(fd_rewrite < 0)
+  {
+    return_if(errno != EACCES and errno != EPERM and errno != EROFS
+      , Error("E::Could not create '{}': {}", path_file_rewrite, strerror(errno))
+    );
+    logger("W::Could not create '{}', rewriting the binary in place: {}", path_file_rewrite, strerror(errno));
+    Try(fs::resize_file(path_file_binary, offset));
+    for(auto it = vec_path_file_layer.begin(); it != vec_path_file_layer.end(); ++it)
+    {
+      continue_if(add(path_file_binary, *it));
+      logger("E::The binary was truncated, to recover it append these layers in order with 'fim-layer add':");
+      std::ranges::for_each(it, vec_path_file_layer.end(), [](auto&& e){ logger("E::{}", e); });
+      return Error("E::Failed to append layer '{}'", *it);
+    }
+    return {};
+  }
+  // Copy the binary up to the offset
+  auto f_copy = [&]() -> Value<void>
+  {
+    int fd_binary = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+    return_if(fd_binary < 0, Error("E::Could not open '{}': {}", path_file_binary, strerror(errno)));
+    off_t offset_in = 0;
+    bool is_copy_range = true;
+    for(uint64_t remaining = offset; remaining > 0;)
+    {
+      ssize_t bytes = is_copy_range
+        ? ::copy_file_range(fd_binary, &offset_in, fd_rewrite, nullptr, remaining, 0)
+        : ::sendfile(fd_rewrite, fd_binary, &offset_in, remaining);
+      if(is_copy_range and bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP or errno == EINVAL))
+      {
+        is_copy_range = false;
+        continue;
+      }
+      continue_if(bytes < 0 and errno == EINTR);
+      if(bytes <= 0)
+      {
+        int err = (bytes < 0)? errno : EIO;
+        ::close(fd_binary);
+        return Error("E::Could not copy '{}': {}", path_file_binary, strerror(err));
+      }
+      remaining -= bytes;
+    }
+    ::close(fd_binary);
+    // Creation is subject to the umask
+    ::fchmod(fd_rewrite, st.st_mode & 07777);
+    return {};
+  };
+  // Append the layers and replace the binary
+  auto f_rewrite = [&]() -> Value<void>
+  {
+    Pop(f_copy());
+    for(auto const& path_file_layer : vec_path_file_layer)
+    {
+      Pop(add(path_file_rewrite, path_file_layer));
+    }
+    return_if(::fdatasync(fd_rewrite) < 0, Error("E::Could not sync '{}': {}", path_file_rewrite, strerror(errno)));
+    return_if(::rename(path_file_rewrite.c_str(), path_file_binary.c_str()) < 0
+      , Error("E::Could not replace '{}': {}", path_file_binary, strerror(errno))
+    );
+    return {};
+  };
+  auto ret = f_rewrite();
+  ::close(fd_rewrite);
+  if(not ret)
+  {
+    ns_filesystems::ns_utils::remove_tree(path_file_rewrite).discard("W::Could not remove '{}'", path_file_rewrite);
+    return Error("E::The binary was not modified: {}", ret.error());
+  }
+  return {};
+}
+
+/**
+ * @brief Location of a layer embedded in the binary
+ */
+struct Embedded
+{
+  uint64_t offset; ///< Offset of the layer data
+  uint64_t size;   ///< Size of the layer data
+};
+
+/**
+ * @brief Replaces the layers appended to the binary from a layer on
+ *
+ * Saves the embedded layers to keep in the staging directory, then rewrites the binary with the
+ * novel layers followed by the saved layers. The staging directory is kept on failure, it holds
+ * the layers to recover a binary rewritten in place.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param offset Offset of the size field of the first layer replaced
+ * @param vec_path_file_layer Novel layers, in order
+ * @param vec_embedded Embedded layers to append after the novel layers, in order
+ * @param path_dir_stage Staging directory, removed on success
+ * @return Value<uint64_t> The size of the layers appended, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> replace_layers(fs::path const& path_file_binary
+  , uint64_t offset
+  , std::vector<fs::path> vec_path_file_layer
+  , std::vector<Embedded> const& vec_embedded
+  , fs::path const& path_dir_stage)
+{
+  for(uint64_t index = 0; auto const& e : vec_embedded)
+  {
+    fs::path path_file_tail = path_dir_stage / std::format("tail-{}.layer", index++);
+    Pop(extract(path_file_binary, e.offset, e.size, path_file_tail));
+    vec_path_file_layer.push_back(path_file_tail);
+  }
+  uint64_t size = 0;
+  for(auto const& path_file_layer : vec_path_file_layer)
+  {
+    size += Try(fs::file_size(path_file_layer));
+  }
+  Pop(rewrite(path_file_binary, offset, vec_path_file_layer));
+  ns_filesystems::ns_utils::remove_tree(path_dir_stage).discard("W::Could not remove '{}'", path_dir_stage);
+  return size;
+}
+
+/**
+ * @brief Gets the layers embedded in the binary from an index on
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param index Index of the first layer
+ * @return std::vector<Embedded> The embedded layers, in order
+ */
+[[nodiscard]] inline std::vector<Embedded> embedded(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , uint64_t index)
+{
+  std::vector<Embedded> vec_embedded;
+  for(auto const& layer : layers.get_layers() | std::views::drop(index))
+  {
+    break_if(layer.path != path_file_binary);
+    vec_embedded.push_back(Embedded{layer.offset, layer.size});
+  }
+  return vec_embedded;
+}
+
+/**
+ * @brief Merges a range of layers appended to the binary into a single layer
+ *
+ * Mounts the layers within [index_begin, index_end], stacks them bottom-up in a staging
+ * directory honoring whiteouts and opaque directories, compresses the result and rewrites the
+ * appended region of the binary with the novel layer followed by the layers above the range.
+ * When the range does not start at the base layer the markers are preserved, as they still
+ * hide entries of the layers below it.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param index_begin Index of the bottom-most layer to squash
+ * @param index_end Index of the top-most layer to squash
+ * @param path_dir_tmp Directory to store the mountpoints and the staging files
+ * @param path_file_log Path to the log file of the dwarfs processes
+ * @param compression_level Compression level of the novel layer
+ * @param options Extra options of mkdwarfs for the novel layer
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> squash(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , uint64_t index_begin
+  , uint64_t index_end
+  , fs::path const& path_dir_tmp
+  , fs::path const& path_file_log
+  , uint32_t compression_level
+  , std::vector<std::string> const& options = {})
+{
+  auto const& vec_layers = layers.get_layers();
+  return_if(index_begin >= index_end, Error("E::Squash range requires at least two layers"));
+  return_if(index_end >= vec_layers.size(), Error("E::Layer index '{}' is out of bounds", index_end));
+  // Only layers appended to the binary can be rewritten
+  for(uint64_t index = index_begin; index <= index_end; ++index)
+  {
+    return_if(vec_layers[index].path != path_file_binary
+      , Error("E::Layer '{}' is not embedded in the binary", index)
+    );
+  }
+  // Create working directories
+  fs::path const path_dir_squash = path_dir_tmp / "squash";
+  fs::path const path_dir_mount = path_dir_squash / "mount";
+  fs::path const path_dir_root = path_dir_squash / "root";
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_squash));
+  Pop(ns_fs::create_directories(path_dir_root));
+  // Mount the layers of the range and stack them bottom-up
+  {
+    std::vector<std::unique_ptr<ns_filesystems::ns_dwarfs::Dwarfs>> vec_dwarfs;
+    std::vector<fs::path> vec_path_dir_mount;
+    for(uint64_t index = index_begin; index <= index_end; ++index)
+    {
+      fs::path path_dir_mount_index = path_dir_mount / std::to_string(index);
+      Pop(ns_fs::create_directories(path_dir_mount_index));
+      vec_dwarfs.emplace_back(std::make_unique<ns_filesystems::ns_dwarfs::Dwarfs>(getpid()
+        , path_dir_mount_index
+        , path_file_binary
+        , path_file_log
+        , vec_layers[index].offset
+        , vec_layers[index].size
+        , ""
+        , false
+      ));
+      vec_path_dir_mount.push_back(path_dir_mount_index);
+    }
+    ns_fuse::wait_fuse(vec_path_dir_mount);
+    for(uint64_t index = index_begin; auto const& path_dir_mount_index : vec_path_dir_mount)
+    {
+      logger("I::Stacking layer {}", index++);
+      return_if(not Pop(ns_fuse::is_fuse(path_dir_mount_index))
+        , Error("E::Failed to mount layer '{}'", path_dir_mount_index)
+      );
+      Pop(squash_layer(path_dir_mount_index, path_dir_root, index_begin > 0));
+    }
+  } // Un-mount layers
+  // Compress the stacked layers
+  fs::path const path_file_layer = path_dir_squash / "layer.tmp";
+  Pop(create(path_dir_root, path_file_layer, path_dir_squash / "compression.list", compression_level, options));
+  // Replace the binary from the size field of the first layer in the range with the novel layer
+  // and the layers above the range
+  Pop(replace_layers(path_file_binary
+    , vec_layers[index_begin].offset - sizeof(uint64_t)
+    , {path_file_layer}
+    , embedded(path_file_binary, layers, index_end + 1)
+    , path_dir_squash
+  ));
+  logger("I::Squashed layers {} to {} into layer {}", index_begin, index_end, index_begin);
+  return {};
+}
+
+/**
+ * @brief Entries of the layers above, that hide the entries of the layers below
+ */
+struct Shadow
+{
+  std::set<fs::path> hidden; ///< Entries hidden with their sub-tree
+  std::set<fs::path> opaque; ///< Directories whose contents are hidden
+  std::set<fs::path> dirs;   ///< Directories, which hide non-directory entries
+
+  /**
+   * @brief Checks if an entry of a lower layer is hidden
+   *
+   * @param path_relative Path of the entry relative to the layer root
+   * @param is_dir Whether the entry is a directory
+   * @return bool True if the entry is not visible in the overlay
+   */
+  [[nodiscard]] bool is_hidden(fs::path const& path_relative, bool is_dir) const
+  {
+    return_if(not is_dir and dirs.contains(path_relative), true);
+    for(fs::path path = path_relative; not path.empty(); path = path.parent_path())
+    {
+      return_if(hidden.contains(path), true);
+      return_if(path != path_relative and opaque.contains(path), true);
+    }
+    return false;
+  }
+
+  /**
+   * @brief Adds the entries of another shadow
+   *
+   * @param other The shadow of the layer above
+   */
+  void merge(Shadow&& other)
+  {
+    hidden.merge(other.hidden);
+    opaque.merge(other.opaque);
+    dirs.merge(other.dirs);
+  }
+};
+
+/**
+ * @brief Copies the visible entries of a layer directory to a staging directory
+ *
+ * Entries hidden by the layers above are dropped. Whiteout and opaque markers are copied, and
+ * recorded with the other entries of the layer in the novel shadow, to be applied to the layers
+ * below. Entries are cloned with their permissions, timestamps and extended attributes.
+ *
+ * @param path_dir_layer Mountpoint of the layer
+ * @param path_dir_dst Staging directory of the layer
+ * @param path_dir_relative Directory being copied, relative to the layer root
+ * @param shadow Entries hidden by the layers above
+ * @param shadow_layer Entries of the layer, which hide the ones of the layers below
+ * @param clone Hard links of the layer already cloned
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> rebase_prune(fs::path const& path_dir_layer
+  , fs::path const& path_dir_dst
+  , fs::path const& path_dir_relative
+  , Shadow const& shadow
+  , Shadow& shadow_layer
+  , ns_cmd::ns_snapshot::Clone& clone)
+{
+  fs::path const path_dir_src = path_dir_layer / path_dir_relative;
+  for(auto const& entry : Try(fs::directory_iterator(path_dir_src)))
+  {
+    std::string const name = entry.path().filename().string();
+    fs::path const path_relative = path_dir_relative / name;
+    fs::path const path_dst = path_dir_dst / path_relative;
+    struct stat st;
+    return_if(::lstat(entry.path().c_str(), &st) < 0, Error("E::Could not stat '{}': {}", entry.path(), strerror(errno)));
+    bool const is_dir = S_ISDIR(st.st_mode);
+    // unionfs-fuse metadata is kept as is, and the entries it hides are recorded
+    if(path_dir_relative.empty() and name == unionfs_meta)
+    {
+      Pop(ns_cmd::ns_snapshot::clone_tree(entry.path(), path_dst, clone));
+      for(auto const& entry_meta : Try(fs::recursive_directory_iterator(entry.path())))
+      {
+        std::string const str_relative = entry_meta.path().lexically_relative(entry.path()).string();
+        continue_if(not entry_meta.is_regular_file() or not str_relative.ends_with(unionfs_hidden));
+        shadow_layer.hidden.insert(str_relative.substr(0, str_relative.size() - unionfs_hidden.size()));
+      }
+      continue;
+    }
+    // Drop the entries that are not visible in the overlay
+    continue_if(shadow.is_hidden(path_relative, is_dir), "D::Dropping shadowed entry '{}'", path_relative);
+    // Opaque marker
+    if(name == whiteout_opaque)
+    {
+      Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone));
+      shadow_layer.opaque.insert(path_dir_relative);
+      continue;
+    }
+    // File whiteout
+    if(name.starts_with(whiteout_prefix))
+    {
+      Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone));
+      shadow_layer.hidden.insert(path_dir_relative / name.substr(whiteout_prefix.size()));
+      continue;
+    }
+    // Character device whiteout
+    if(S_ISCHR(st.st_mode))
+    {
+      continue_if(st.st_rdev != makedev(0, 0), "I::Ignoring file '{}'", entry.path());
+      // Creating a device requires privileges, fallback to a file whiteout
+      if(::mknod(path_dst.c_str(), S_IFCHR, makedev(0, 0)) != 0)
+      {
+        std::ofstream{path_dir_dst / path_dir_relative / (std::string{whiteout_prefix} + name)};
+      }
+      shadow_layer.hidden.insert(path_relative);
+      continue;
+    }
+    // Directories are merged with the ones below, they stay writable until their contents are copied
+    if(is_dir)
+    {
+      return_if(::mkdir(path_dst.c_str(), S_IRWXU) < 0, Error("E::Could not create '{}': {}", path_dst, strerror(errno)));
+      shadow_layer.dirs.insert(path_relative);
+      Pop(rebase_prune(path_dir_layer, path_dir_dst, path_relative, shadow, shadow_layer, clone));
+      ns_cmd::ns_snapshot::copy_attributes(entry.path(), path_dst, st);
+      continue;
+    }
+    // Regular files and symlinks hide the ones below
+    continue_if(not S_ISREG(st.st_mode) and not S_ISLNK(st.st_mode), "I::Ignoring file '{}'", entry.path());
+    Pop(ns_cmd::ns_snapshot::clone_entry(entry.path(), path_dst, st, clone));
+    shadow_layer.hidden.insert(path_relative);
+  }
+  return {};
+}
+
+/**
+ * @brief Rebuilds a range of layers appended to the binary without their shadowed entries
+ *
+ * Mounts the layers within [index_begin, index_end] and walks them top-down. Entries of a layer
+ * that are hidden by a layer above it in the range, either replaced, erased by a whiteout or
+ * under an opaque directory, are dropped. Markers are kept, so the overlay view is the same as
+ * before. Each layer is compressed again and the appended region of the binary is rewritten
+ * with the novel layers followed by the layers above the range. Layers left empty are removed.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param index_begin Index of the bottom-most layer to rebase
+ * @param index_end Index of the top-most layer to rebase
+ * @param path_dir_tmp Directory to store the mountpoints and the staging files
+ * @param path_file_log Path to the log file of the dwarfs processes
+ * @param compression_level Compression level of the novel layers
+ * @param options Extra options of mkdwarfs for the novel layers
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> rebase(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , uint64_t index_begin
+  , uint64_t index_end
+  , fs::path const& path_dir_tmp
+  , fs::path const& path_file_log
+  , uint32_t compression_level
+  , std::vector<std::string> const& options = {})
+{
+  auto const& vec_layers = layers.get_layers();
+  return_if(index_begin >= index_end, Error("E::Rebase range requires at least two layers"));
+  return_if(index_end >= vec_layers.size(), Error("E::Layer index '{}' is out of bounds", index_end));
+  // Only layers appended to the binary can be rewritten
+  for(uint64_t index = index_begin; index <= index_end; ++index)
+  {
+    return_if(vec_layers[index].path != path_file_binary
+      , Error("E::Layer '{}' is not embedded in the binary", index)
+    );
+  }
+  // Create working directories
+  fs::path const path_dir_rebase = path_dir_tmp / "rebase";
+  fs::path const path_dir_mount = path_dir_rebase / "mount";
+  fs::path const path_dir_root = path_dir_rebase / "root";
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_rebase));
+  Pop(ns_fs::create_directories(path_dir_root));
+  // Mount the layers of the range and copy their visible entries top-down
+  {
+    std::vector<std::unique_ptr<ns_filesystems::ns_dwarfs::Dwarfs>> vec_dwarfs;
+    std::vector<fs::path> vec_path_dir_mount;
+    for(uint64_t index = index_begin; index <= index_end; ++index)
+    {
+      fs::path path_dir_mount_index = path_dir_mount / std::to_string(index);
+      Pop(ns_fs::create_directories(path_dir_mount_index));
+      vec_dwarfs.emplace_back(std::make_unique<ns_filesystems::ns_dwarfs::Dwarfs>(getpid()
+        , path_dir_mount_index
+        , path_file_binary
+        , path_file_log
+        , vec_layers[index].offset
+        , vec_layers[index].size
+        , ""
+        , false
+      ));
+      vec_path_dir_mount.push_back(path_dir_mount_index);
+    }
+    ns_fuse::wait_fuse(vec_path_dir_mount);
+    Shadow shadow;
+    for(uint64_t index = index_end + 1; index-- > index_begin;)
+    {
+      fs::path const& path_dir_mount_index = vec_path_dir_mount[index - index_begin];
+      logger("I::Pruning layer {}", index);
+      return_if(not Pop(ns_fuse::is_fuse(path_dir_mount_index))
+        , Error("E::Failed to mount layer '{}'", path_dir_mount_index)
+      );
+      fs::path const path_dir_root_index = path_dir_root / std::to_string(index);
+      Pop(ns_fs::create_directories(path_dir_root_index));
+      Shadow shadow_layer;
+      ns_cmd::ns_snapshot::Clone clone;
+      Pop(rebase_prune(path_dir_mount_index, path_dir_root_index, {}, shadow, shadow_layer, clone));
+      shadow.merge(std::move(shadow_layer));
+    }
+  } // Un-mount layers
+  // Compress the pruned layers
+  std::vector<fs::path> vec_path_file_layer;
+  for(uint64_t index = index_begin; index <= index_end; ++index)
+  {
+    fs::path const path_dir_root_index = path_dir_root / std::to_string(index);
+    continue_if(Try(fs::is_empty(path_dir_root_index)), "I::Removing empty layer {}", index);
+    fs::path path_file_layer = path_dir_rebase / std::format("layer-{}.tmp", index);
+    Pop(create(path_dir_root_index, path_file_layer, path_dir_rebase / "compression.list", compression_level, options));
+    vec_path_file_layer.push_back(path_file_layer);
+  }
+  // Size of the appended region that is rewritten
+  uint64_t size_before = 0;
+  for(auto const& e : embedded(path_file_binary, layers, index_begin)) { size_before += e.size; }
+  // Replace the binary from the size field of the first layer in the range with the novel layers
+  // and the layers above the range
+  uint64_t size_after = Pop(replace_layers(path_file_binary
+    , vec_layers[index_begin].offset - sizeof(uint64_t)
+    , vec_path_file_layer
+    , embedded(path_file_binary, layers, index_end + 1)
+    , path_dir_rebase
+  ));
+  logger("I::Rebased layers {} to {}, appended region went from {} to {} bytes"
+    , index_begin
+    , index_end
+    , size_before
+    , size_after
+  );
+  return {};
+}
+
+/**
+ * @brief Computes the XXH64 hash of a region of a file
+ *
+ * The region is read with pread, so a read error is reported instead of raising SIGBUS as a
+ * mapping would.
+ *
+ * @param path_file Path to the file
+ * @param offset Offset in bytes where the region begins
+ * @param size Size in bytes of the region
+ * @return Value<uint64_t> The hash, or the respective error
+ */
+[[nodiscard]] inline Value<uint64_t> hash(fs::path const& path_file, uint64_t offset, uint64_t size)
+{
+  int fd = ::open(path_file.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd < 0, Error("D::Could not open '{}': {}", path_file, strerror(errno)));
+  ::posix_fadvise(fd, offset, size, POSIX_FADV_SEQUENTIAL);
+  ns_hash::Xxh64 hash;
+  std::vector<char> buffer(4 << 20);
+  for(uint64_t pos = 0; pos < size;)
+  {
+    ssize_t bytes = ::pread(fd, buffer.data(), std::min<uint64_t>(buffer.size(), size - pos), offset + pos);
+    continue_if(bytes < 0 and errno == EINTR);
+    if(bytes <= 0)
+    {
+      int err = (bytes < 0)? errno : EIO;
+      ::close(fd);
+      return Error("D::Could not read byte {} of '{}': {}", offset + pos, path_file, strerror(err));
+    }
+    hash.update(std::string_view(buffer.data(), bytes));
+    pos += bytes;
+  }
+  ::close(fd);
+  return hash.digest();
+}
+
+/**
+ * @brief Verifies the integrity of the layers in parallel
+ *
+ * Each layer is checked for a valid chain of DwarFS section headers, which only reads the
+ * headers. Unless in quick mode, every byte of the layer is then read and hashed with XXH64, and
+ * the hash is compared with the one stored in the 'hashes' entry of the layer index. A layer
+ * without a stored hash, or with one stored for a previous version of its file, has its hash
+ * recorded, so later runs detect data that changed without its file being modified.
+ *
+ * @param layers The layers to verify
+ * @param path_file_index Path to the layer index file
+ * @param is_quick Whether to only check the section headers
+ * @return Value<void> Nothing if all the layers are intact, or the respective error
+ */
+[[nodiscard]] inline Value<void> verify(ns_filesystems::ns_layers::Layers const& layers
+  , fs::path const& path_file_index
+  , bool is_quick)
+{
+  auto const& vec_layers = layers.get_layers();
+  return_if(vec_layers.empty(), Error("E::No layers to verify"));
+  // Stored hashes are keyed by location, the value is "<key of the file>:<hash>"
+  ns_db::Db db = ns_db::read_file(path_file_index).value_or(ns_db::Db{});
+  struct Verified
+  {
+    std::string error;
+    uint64_t count_sections{};
+    std::optional<uint64_t> hash;
+    std::string key;
+    std::chrono::duration<double> duration{};
+  };
+  std::vector<Verified> results(vec_layers.size());
+  auto time_start = std::chrono::steady_clock::now();
+  std::atomic<size_t> index{0};
+  auto f_worker = [&, level = ns_log::get_level()]
+  {
+    ns_log::set_level(level);
+    for(size_t i = index++; i < vec_layers.size(); i = index++)
+    {
+      auto const& layer = vec_layers[i];
+      Verified& result = results[i];
+      auto time_layer = std::chrono::steady_clock::now();
+      auto count_sections = ns_filesystems::ns_dwarfs::check_sections(layer.path, layer.offset, layer.size);
+      if(not count_sections)
+      {
+        result.error = count_sections.error();
+        continue;
+      }
+      result.count_sections = *count_sections;
+      if(not is_quick)
+      {
+        auto hash = ns_layers::hash(layer.path, layer.offset, layer.size);
+        if(not hash)
+        {
+          result.error = hash.error();
+          continue;
+        }
+        result.hash = *hash;
+        result.key = ns_filesystems::ns_layers::index_key(layer.path, layer.offset).value_or(std::string{});
+      }
+      result.duration = std::chrono::steady_clock::now() - time_layer;
+    }
+  };
+  {
+    size_t count_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    std::vector<std::jthread> threads;
+    for(size_t i = 0; i < std::min(count_threads, vec_layers.size()); ++i)
+    {
+      threads.emplace_back(f_worker);
+    }
+  }
+  std::chrono::duration<double> duration = std::chrono::steady_clock::now() - time_start;
+  // Report each layer and compare the hashes
+  uint64_t count_failed = 0;
+  uint64_t bytes_total = 0;
+  std::vector<size_t> vec_index_record;
+  for(size_t i = 0; i < vec_layers.size(); ++i)
+  {
+    auto const& layer = vec_layers[i];
+    Verified const& result = results[i];
+    std::string str_location = std::format("{}:{}", layer.path.string(), layer.offset);
+    if(not result.error.empty())
+    {
+      logger("E::Layer {} '{}' is corrupted: {}", i, str_location, result.error);
+      count_failed += 1;
+      continue;
+    }
+    bytes_total += layer.size;
+    std::string str_hash;
+    if(result.hash)
+    {
+      auto stored = db("hashes")(str_location).value<std::string>();
+      str_hash = std::format(", hash {:016x}", *result.hash);
+      if(stored and not result.key.empty() and stored->starts_with(result.key + ":"))
+      {
+        if(not stored->ends_with(std::format(":{:016x}", *result.hash)))
+        {
+          logger("E::Layer {} '{}' is corrupted: hash {:016x} differs from the stored hash {}"
+            , i, str_location, *result.hash, stored->substr(stored->rfind(':') + 1)
+          );
+          count_failed += 1;
+          continue;
+        }
+        str_hash += " (matches)";
+      }
+      else if(not result.key.empty())
+      {
+        str_hash += " (recorded)";
+        vec_index_record.push_back(i);
+      }
+    }
+    logger("I::Layer {} is intact: {} sections, {} in {:.2f}s ({}/s){}"
+      , i
+      , result.count_sections
+      , to_size(layer.size)
+      , result.duration.count()
+      , to_size(layer.size / std::max(result.duration.count(), 1e-6))
+      , str_hash
+    );
+  }
+  // Record the hashes seen for the first time
+  if(not vec_index_record.empty())
+  {
+    ns_filesystems::ns_layers::Layers::update_index(path_file_index, [&](ns_db::Db& db)
+    {
+      for(size_t i : vec_index_record)
+      {
+        db("hashes")(std::format("{}:{}", vec_layers[i].path.string(), vec_layers[i].offset))
+          = std::format("{}:{:016x}", results[i].key, *results[i].hash);
+      }
+    }).discard("W::Could not store the hashes of the layers");
+  }
+  logger("I::Verified {} layers, {} in {:.2f}s ({}/s)"
+    , vec_layers.size()
+    , to_size(bytes_total)
+    , duration.count()
+    , to_size(bytes_total / std::max(duration.count(), 1e-6))
+  );
+  return_if(count_failed > 0, Error("E::{} of {} layers failed verification", count_failed, vec_layers.size()));
+  return {};
+}
+
+/**
+ * @brief Drops layers from the region appended to the binary
+ *
+ * The runs of consecutive dropped layers are removed top-down, so the offsets of the runs below
+ * stay valid. A run at the end of the binary is truncated away. A run in the middle is collapsed
+ * with fallocate(FALLOC_FL_COLLAPSE_RANGE), which moves the extents of the layers above it
+ * without copying their data, if the filesystem supports it and the run is aligned to its block
+ * size. Otherwise the binary is rewritten from the lowest remaining run with the layers above it,
+ * as squash and rebase do. The layer index is rewritten afterwards.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param set_index Indexes of the embedded layers to drop
+ * @param offset_layers Offset of the region of appended layers in the binary
+ * @param path_file_index Path to the layer index file
+ * @param path_dir_tmp Directory to store the saved layers
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> drop(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , std::set<uint64_t> const& set_index
+  , uint64_t offset_layers
+  , fs::path const& path_file_index
+  , fs::path const& path_dir_tmp)
+{
+  // The embedded layers come first
+  struct Slot
+  {
+    uint64_t offset;
+    uint64_t size;
+    bool is_drop;
+  };
+  std::vector<Slot> slots;
+  for(uint64_t index = 0; auto const& layer : layers.get_layers())
+  {
+    break_if(layer.path != path_file_binary);
+    slots.push_back(Slot{layer.offset, layer.size, set_index.contains(index++)});
+  }
+  for(uint64_t index : set_index)
+  {
+    return_if(index >= slots.size(), Error("E::Layer '{}' is not embedded in the binary", index));
+  }
+  int fd_binary = ::open(path_file_binary.c_str(), O_RDWR | O_CLOEXEC);
+  return_if(fd_binary < 0, Error("E::Failed to open '{}': {}", path_file_binary, strerror(errno)));
+  struct statfs st_fs{};
+  uint64_t size_block = (::fstatfs(fd_binary, &st_fs) == 0)? st_fs.f_bsize : 0;
+  // Drops the runs in place, returns the slot of the lowest run left to rewrite, if any
+  auto f_drop_in_place = [&]() -> Value<std::optional<size_t>>
+  {
+    for(size_t end = slots.size(); end > 0;)
+    {
+      if(not slots[end-1].is_drop) { --end; continue; }
+      size_t beg = end - 1;
+      while(beg > 0 and slots[beg-1].is_drop) { --beg; }
+      // The run spans the size headers and the data of its layers
+      uint64_t offset_beg = slots[beg].offset - sizeof(uint64_t);
+      uint64_t length = slots[end-1].offset + slots[end-1].size - offset_beg;
+      if(end == slots.size())
+      {
+        return_if(::ftruncate(fd_binary, offset_beg) < 0, Error("E::Failed to truncate the binary: {}", strerror(errno)));
+        logger("D::Truncated {} of layers at offset {}", to_size(length), offset_beg);
+      }
+      else if(size_block > 0 and offset_beg % size_block == 0 and length % size_block == 0
+        and ::fallocate(fd_binary, FALLOC_FL_COLLAPSE_RANGE, offset_beg, length) == 0)
+      {
+        logger("D::Collapsed {} of layers at offset {}", to_size(length), offset_beg);
+        std::ranges::for_each(slots | std::views::drop(end), [&](Slot& e){ e.offset -= length; });
+      }
+      else
+      {
+        return std::optional<size_t>(std::ranges::find_if(slots, [](auto&& e){ return e.is_drop; }) - slots.begin());
+      }
+      slots.erase(slots.begin() + beg, slots.begin() + end);
+      end = beg;
+    }
+    return std::optional<size_t>{};
+  };
+  auto ret = f_drop_in_place();
+  bool is_synced = ::fdatasync(fd_binary) == 0;
+  ::close(fd_binary);
+  std::optional<size_t> lowest = Pop(ret, "E::Failed to drop layers");
+  return_if(not is_synced, Error("E::Failed to sync the binary: {}", strerror(errno)));
+  // Rewrite the layers above the lowest run left
+  if(lowest)
+  {
+    logger("D::Rewriting the layers above layer {}", *lowest);
+    fs::path const path_dir_drop = path_dir_tmp / "drop";
+    Pop(ns_filesystems::ns_utils::remove_tree(path_dir_drop));
+    Pop(ns_fs::create_directories(path_dir_drop));
+    std::vector<Embedded> vec_embedded;
+    for(Slot const& slot : slots | std::views::drop(*lowest))
+    {
+      continue_if(slot.is_drop);
+      vec_embedded.push_back(Embedded{slot.offset, slot.size});
+    }
+    Pop(replace_layers(path_file_binary, slots[*lowest].offset - sizeof(uint64_t), {}, vec_embedded, path_dir_drop));
+  }
+  // Skip the scan of the binary on the next boot
+  ns_filesystems::ns_layers::Layers::reindex(path_file_binary, offset_layers, path_file_index)
+    .discard("W::Could not update the layer index");
+  return {};
+}
+
+/**
+ * @brief Removes a layer embedded in the binary
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param index Index of the layer to remove, as shown by 'fim-layer list'
+ * @param offset_layers Offset of the region of appended layers in the binary
+ * @param path_file_index Path to the layer index file
+ * @param path_dir_tmp Directory to store the saved layers
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> remove(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , uint64_t index
+  , uint64_t offset_layers
+  , fs::path const& path_file_index
+  , fs::path const& path_dir_tmp)
+{
+  return_if(index == 0, Error("E::The base layer cannot be removed"));
+  auto const& vec_layers = layers.get_layers();
+  return_if(index >= vec_layers.size() or vec_layers[index].path != path_file_binary
+    , Error("E::Layer '{}' is not embedded in the binary", index)
+  );
+  uint64_t size = vec_layers[index].size;
+  Pop(drop(path_file_binary, layers, {index}, offset_layers, path_file_index, path_dir_tmp));
+  logger("I::Removed layer {}, the binary is {} smaller", index, to_size(size + sizeof(uint64_t)));
+  return {};
+}
+
+/**
+ * @brief Drops the dead data of the region appended to the binary
+ *
+ * The dead data is:
+ * - Embedded layers identical to an embedded layer above them, the controller only mounts the
+ *   topmost copy. Layers with the same fingerprint are compared by hash before they are dropped.
+ * - Data after the last layer, e.g., left by an interrupted 'fim-layer add'.
+ *
+ * @param path_file_binary Path to the FlatImage binary
+ * @param layers The Layers object containing all filesystem layers
+ * @param offset_layers Offset of the region of appended layers in the binary
+ * @param path_file_index Path to the layer index file
+ * @param path_dir_tmp Directory to store the saved layers
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> compact(fs::path const& path_file_binary
+  , ns_filesystems::ns_layers::Layers const& layers
+  , uint64_t offset_layers
+  , fs::path const& path_file_index
+  , fs::path const& path_dir_tmp)
+{
+  auto vec_layers = layers.get_layers()
+    | std::views::take_while([&](auto&& e){ return e.path == path_file_binary; })
+    | std::ranges::to<std::vector>();
+  uint64_t size_before = Try(fs::file_size(path_file_binary));
+  // Data after the last layer
+  uint64_t offset_end = vec_layers.empty()? offset_layers : vec_layers.back().offset + vec_layers.back().size;
+  if(size_before > offset_end)
+  {
+    logger("I::Dropping {} after the last layer", to_size(size_before - offset_end));
+    Try(fs::resize_file(path_file_binary, offset_end));
+  }
+  // Copies of a layer above, top-down
+  std::set<uint64_t> set_index;
+  std::unordered_map<std::string_view,uint64_t> map_fingerprint_top;
+  for(uint64_t index = vec_layers.size(); index > 0; --index)
+  {
+    auto const& layer = vec_layers[index-1];
+    continue_if(layer.fingerprint.empty());
+    auto [it, is_top] = map_fingerprint_top.try_emplace(layer.fingerprint, index-1);
+    continue_if(is_top);
+    auto const& layer_top = vec_layers[it->second];
+    continue_if(Pop(hash(path_file_binary, layer.offset, layer.size)) != Pop(hash(path_file_binary, layer_top.offset, layer_top.size))
+      , "W::Layer {} has the fingerprint of layer {} with different contents", index-1, it->second
+    );
+    logger("I::Dropping layer {}, a copy of layer {}", index-1, it->second);
+    set_index.insert(index-1);
+  }
+  if(not set_index.empty())
+  {
+    Pop(drop(path_file_binary, layers, set_index, offset_layers, path_file_index, path_dir_tmp));
+  }
+  else if(size_before > offset_end)
+  {
+    ns_filesystems::ns_layers::Layers::reindex(path_file_binary, offset_layers, path_file_index)
+      .discard("W::Could not update the layer index");
+  }
+  uint64_t size_after = Try(fs::file_size(path_file_binary));
+  logger("I::Compacted the binary from {} to {}", to_size(size_before), to_size(size_after));
+  return {};
+}
+
+/**
+ * @brief Lists all layers in the format index:offset:size:path
+ *
+ * @param layers The Layers object containing all filesystem layers
+ */
+inline void list(ns_filesystems::ns_layers::Layers const& layers)
+{
+  for(uint64_t index = 0; auto const& layer : layers.get_layers())
+  {
+    std::cout << std::format("{}:{}:{}:{}\n", index, layer.offset, layer.size, layer.path.string());
+    ++index;
+  }
+}
+
+/**
+ * @brief Marks a layer file as lazy, or as mounted on every boot
+ *
+ * A lazy layer is left out of the boots after a recording of the access hints, see
+ * FIM_TRACE_ACCESS, that read none of its files. The mark is kept in the layer index.
+ *
+ * @param path_file_index Path to the layer index file
+ * @param path_file_layer Path to the layer file
+ * @param is_lazy Whether the layer is lazy
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> lazy(fs::path const& path_file_index
+  , fs::path const& path_file_layer
+  , bool is_lazy)
+{
+  return_if(not Try(fs::is_regular_file(path_file_layer)), Error("E::Layer '{}' is not a file", path_file_layer));
+  return_if(not ns_filesystems::ns_dwarfs::is_dwarfs(path_file_layer), Error("E::Layer '{}' is not a dwarfs filesystem", path_file_layer));
+  Pop(ns_filesystems::ns_layers::Layers::set_lazy(path_file_index, path_file_layer, is_lazy));
+  logger("I::Layer '{}' is {}", path_file_layer, is_lazy? "lazy" : "mounted on every boot");
+  return {};
 }
 
 } // namespace ns_layers
@@ -8,15 +8,36 @@
 
 #pragma once
 
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
-#include <unordered_set>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 #include "../../lib/subprocess.hpp"
 #include "../../lib/log.hpp"
+#include "../../std/enum.hpp"
 #include "../../std/expected.hpp"
 #include "../../std/filesystem.hpp"
+#include "../../std/string.hpp"
 #include "../../db/recipe.hpp"
 #include "../../config.hpp"
 #include "desktop.hpp"
@@ -43,6 +64,12 @@ inline fs::path get_path_recipe(
   return path_dir_download / "recipes" / distribution.lower() / "latest" / std::format("{}.json", recipe);
 }
 
+// Maximum number of recipes fetched at once
+constexpr size_t const FETCH_CONCURRENCY = 8;
+
+// Minutes the package indexes in the shared package cache are used before a refresh
+constexpr uint64_t const PACKAGE_CACHE_MAX_AGE = 60;
+
 } // namespace
 
 /**
@@ -89,127 +116,295 @@ namespace ns_recipe
 }
 
 /**
- * @brief Internal implementation that fetches a recipe and its dependencies recursively with cycle detection
+ * @brief Where a resolved recipe came from
+ */
+ENUM(Source, CACHE, REVALIDATE, DOWNLOAD);
+
+/**
+ * @brief A recipe resolved by fetch()
+ */
+struct Resolved
+{
+  std::string name;                ///< Name of the recipe
+  ns_db::ns_recipe::Recipe recipe; ///< Parsed contents of the recipe
+  Source source;                   ///< Cache, unchanged on the remote, or downloaded
+};
+
+/**
+ * @brief Downloads a recipe, revalidating a cached copy with a conditional request
+ *
+ * The ETag and Last-Modified headers of a download are saved next to the recipe, along with a hash
+ * of its contents. A later download sends them as If-None-Match and If-Modified-Since if the cached
+ * copy still matches the hash, and the server answers with '304 Not Modified' when the recipe did
+ * not change. The recipe is downloaded to a temporary file and renamed, a failed download keeps
+ * the cached copy.
  *
- * @param distribution Name of the distribution
- * @param url_remote Remote repository URL
  * @param path_file_downloader Path to the downloader executable
- * @param path_dir_download Directory where the recipe will be downloaded
- * @param recipe Name of the recipe to download
- * @param use_existing If true, use existing local file if available; if false, always download
- * @param dependencies Set of fetched recipes to track and detect cycles
- * @return Value<void> Nothing on success, or error on failure/cycle detection
+ * @param url URL of the recipe
+ * @param path_file_output Path to the cached recipe
+ * @return Value<bool> True if the recipe was downloaded, false if the cached copy is up to date, or
+ * the respective error
  */
-[[nodiscard]] inline Value<void> fetch_impl(
-    ns_config::Distribution const& distribution
-  , std::string url_remote
-  , fs::path const& path_file_downloader
-  , fs::path const& path_dir_download
-  , std::string const& recipe
-  , bool use_existing
-  , std::unordered_set<std::string>& dependencies
-)
+[[nodiscard]] inline Value<bool> download(fs::path const& path_file_downloader
+  , std::string const& url
+  , fs::path const& path_file_output)
 {
-  auto f_fetch_dependencies = [&](ns_db::ns_recipe::Recipe const& recipe_obj) -> Value<void>
+  std::error_code ec;
+  fs::path path_file_meta = fs::path(path_file_output).concat(".meta");
+  fs::path path_file_tmp = fs::path(path_file_output).concat(".tmp");
+  auto f_hash = [](fs::path const& path_file) -> std::string
+  {
+    std::ifstream file(path_file, std::ios::binary);
+    std::string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    return std::format("{:x}", std::hash<std::string>{}(contents));
+  };
+  // Send the validators of the cached copy, '-S' prints the response headers to stderr
+  std::vector<std::string> args{"-S", "-O", path_file_tmp.string()};
+  if(std::ifstream file_meta(path_file_meta); file_meta.is_open() and fs::exists(path_file_output, ec))
   {
-    auto const& deps = recipe_obj.get_dependencies();
-    if (!deps.empty())
+    std::vector<std::string> headers;
+    bool is_match = false;
+    for(std::string line; std::getline(file_meta, line);)
     {
-      for (auto const& sub_recipe : deps)
+      if(line.starts_with("Hash: ")) { is_match = line.substr(6) == f_hash(path_file_output); }
+      else if(line.starts_with("ETag: ")) { headers.push_back("If-None-Match: " + line.substr(6)); }
+      else if(line.starts_with("Last-Modified: ")) { headers.push_back("If-Modified-Since: " + line.substr(15)); }
+    }
+    if(is_match)
+    {
+      for(auto const& header : headers)
       {
-        Pop(fetch_impl(distribution, url_remote, path_file_downloader, path_dir_download, sub_recipe, use_existing, dependencies));
+        args.insert(args.end(), {"--header", header});
       }
     }
-    return {};
-  };
-  // Check cycle
-  if(dependencies.contains(recipe))
+  }
+  args.push_back(url);
+  // Download the recipe
+  std::ostringstream ss_stderr;
+  auto child = ns_subprocess::Subprocess(path_file_downloader)
+    .with_args(args)
+    .with_stdio(ns_subprocess::Stream::Pipe)
+    .with_streams(ns_subprocess::stream::null(), std::cout, ss_stderr)
+    .spawn();
+  return_if(not child, Error("E::Failed to spawn downloader for '{}'", url));
+  int code = Pop(child->wait());
+  // Forward the output of the download at once, others may run in parallel
+  std::cerr << ss_stderr.str() << std::flush;
+  // Collect the status and the validators of the last response, after redirects
+  std::string status, etag, last_modified;
+  std::istringstream ss_headers(ss_stderr.str());
+  for(std::string line; std::getline(ss_headers, line);)
   {
-    return Error("E::Cyclic dependency for recipe '{}'", recipe);
+    std::string_view view = line;
+    view.remove_prefix(std::min(view.find_first_not_of(' '), view.size()));
+    std::string lower(view);
+    std::ranges::transform(lower, lower.begin(), [](unsigned char c){ return std::tolower(c); });
+    if(lower.starts_with("http/")) { status = lower.substr(std::min(lower.find(' '), lower.size())); etag.clear(); last_modified.clear(); }
+    else if(lower.starts_with("etag:")) { etag = std::string(view.substr(5)); }
+    else if(lower.starts_with("last-modified:")) { last_modified = std::string(view.substr(14)); }
   }
-  else
+  auto f_trim = [](std::string& str){ str.erase(0, std::min(str.find_first_not_of(' '), str.size())); };
+  f_trim(status);
+  f_trim(etag);
+  f_trim(last_modified);
+  if(status.starts_with("304"))
+  {
+    fs::remove(path_file_tmp, ec);
+    return false;
+  }
+  if(code != 0)
   {
-    dependencies.insert(recipe);
+    fs::remove(path_file_tmp, ec);
+    return Error("E::Failed to download '{}', exit code {}", url, code);
   }
+  Try(fs::rename(path_file_tmp, path_file_output));
+  // Save the validators of the downloaded copy
+  if(etag.empty() and last_modified.empty())
+  {
+    fs::remove(path_file_meta, ec);
+    return true;
+  }
+  std::ofstream file_meta(path_file_meta, std::ios::out | std::ios::trunc);
+  return_if(not file_meta.is_open(), true, "W::Could not save the validators of '{}'", path_file_output);
+  file_meta << "Hash: " << f_hash(path_file_output) << '\n';
+  if(not etag.empty()) { file_meta << "ETag: " << etag << '\n'; }
+  if(not last_modified.empty()) { file_meta << "Last-Modified: " << last_modified << '\n'; }
+  return true;
+}
+
+/**
+ * @brief Fetches a single recipe, without its dependencies
+ *
+ * @param distribution Name of the distribution
+ * @param url_remote Remote repository URL, without a trailing slash
+ * @param path_file_downloader Path to the downloader executable
+ * @param path_dir_download Directory where the recipe will be downloaded
+ * @param recipe Name of the recipe to download
+ * @param use_existing If true, use existing local file if available; if false, always revalidate
+ * @return Value<Resolved> The parsed recipe, or the respective error
+ */
+[[nodiscard]] inline Value<Resolved> fetch_recipe(
+    ns_config::Distribution const& distribution
+  , std::string const& url_remote
+  , fs::path const& path_file_downloader
+  , fs::path const& path_dir_download
+  , std::string const& recipe
+  , bool use_existing
+)
+{
+  Resolved resolved{ .name = recipe, .recipe = {}, .source = Source::CACHE };
   // Construct the output path
   fs::path path_file_output = get_path_recipe(path_dir_download, distribution, recipe);
-  fs::path path_dir_output = path_file_output.parent_path();
   // If use_existing is true and file exists, use the cached version
   if (use_existing && Try(fs::exists(path_file_output)))
   {
     logger("I::Using existing recipe from '{}'", path_file_output.string());
-    // Read the local JSON file
-    std::ifstream file(path_file_output);
-    if (!file.is_open())
-    {
-      return Error("E::Could not open existing recipe file '{}'", path_file_output.string());
-    }
-    // Read file contents
-    std::string json_contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-    // Parse JSON
-    ns_db::ns_recipe::Recipe recipe_obj = Pop(ns_db::ns_recipe::deserialize(json_contents));
-    // Fetch dependencies recursively if they exist
-    Pop(f_fetch_dependencies(recipe_obj));
-    return {};
-  }
-  // Download the recipe (either use_existing=false or file doesn't exist)
-  // Remove trailing slash from URL if present
-  if (url_remote.ends_with('/'))
-  {
-    url_remote.pop_back();
   }
-  // Construct the recipe URL: URL/DISTRO/VERSION/<recipe>.json
-  std::string recipe_url = std::format("{}/{}/latest/{}.json", url_remote, distribution.lower(), recipe);
-  // Create the output directory if it doesn't exist
-  Pop(ns_fs::create_directories(path_dir_output));
-  // Download the recipe using wget
-  logger("I::Downloading recipe from '{}'", recipe_url);
-  logger("I::Saving to '{}'", path_file_output.string());
-  // Execute wget to download the file
-  Pop(ns_subprocess::Subprocess(path_file_downloader)
-    .with_args("-O", path_file_output.string(), recipe_url)
-    .spawn()->wait());
-  logger("I::Successfully downloaded recipe '{}' to '{}'", recipe, path_file_output.string());
-  // Read the downloaded JSON file
-  std::ifstream file(path_file_output);
-  if (!file.is_open())
+  else
   {
-    return Error("E::Could not open downloaded recipe file '{}'", path_file_output.string());
+    // Construct the recipe URL: URL/DISTRO/VERSION/<recipe>.json
+    std::string recipe_url = std::format("{}/{}/latest/{}.json", url_remote, distribution.lower(), recipe);
+    // Create the output directory if it doesn't exist
+    Pop(ns_fs::create_directories(path_file_output.parent_path()));
+    logger("I::Downloading recipe from '{}'", recipe_url);
+    logger("I::Saving to '{}'", path_file_output.string());
+    if(Pop(download(path_file_downloader, recipe_url, path_file_output)))
+    {
+      resolved.source = Source::DOWNLOAD;
+      logger("I::Successfully downloaded recipe '{}' to '{}'", recipe, path_file_output.string());
+    }
+    else
+    {
+      resolved.source = Source::REVALIDATE;
+      logger("I::Recipe '{}' is up to date in '{}'", recipe, path_file_output.string());
+    }
   }
-  // Read file contents
-  std::string json_contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-  file.close();
-  // Parse JSON
-  ns_db::ns_recipe::Recipe recipe_obj = Pop(ns_db::ns_recipe::deserialize(json_contents));
-  // Fetch dependencies recursively if they exist
-  Pop(f_fetch_dependencies(recipe_obj));
-  return {};
+  // Parse JSON, once for the whole resolution
+  resolved.recipe = Pop(load_recipe(distribution, path_dir_download, recipe));
+  return resolved;
 }
 
 /**
- * @brief Fetches a recipe from the remote repository along with all its dependencies recursively
+ * @brief Fetches recipes from the remote repository along with all their dependencies recursively
+ *
+ * The dependency graph is fetched by a bounded pool of workers, a recipe is fetched as soon as a
+ * recipe that depends on it is parsed, so independent recipes are downloaded in parallel. Cycles
+ * are detected once the whole graph is known. Each recipe is parsed once, even if several recipes
+ * depend on it, and the resolution reports where each recipe came from.
  *
  * @param distribution Name of the distribution
  * @param url_remote Remote repository URL
  * @param path_file_downloder Path to the downloader executable
  * @param path_dir_download Directory where the recipe will be downloaded
- * @param recipe Name of the recipe to download
- * @param use_existing If true, use existing local file if available; if false, always download
- * @return Value<std::vector<std::string>> Vector of all fetched recipe names (including dependencies) on success, or error
+ * @param recipes Names of the recipes to download
+ * @param use_existing If true, use existing local file if available; if false, always revalidate
+ * @return Value<std::vector<Resolved>> All fetched recipes, each after its dependencies, on success,
+ * or error
  */
-[[nodiscard]] inline Value<std::vector<std::string>> fetch(
+[[nodiscard]] inline Value<std::vector<Resolved>> fetch(
     ns_config::Distribution const& distribution
   , std::string url_remote
   , fs::path const& path_file_downloder
   , fs::path const& path_dir_download
-  , std::string const& recipe
+  , std::vector<std::string> const& recipes
   , bool use_existing = false
 )
 {
-  std::unordered_set<std::string> dependencies;
-  Pop(fetch_impl(distribution, url_remote, path_file_downloder, path_dir_download, recipe, use_existing, dependencies));
-  return std::vector(dependencies.begin(), dependencies.end());
+  // Remove trailing slash from URL if present
+  if (url_remote.ends_with('/'))
+  {
+    url_remote.pop_back();
+  }
+  // Fetch the graph, each worker takes the next discovered recipe
+  std::map<std::string,Resolved> graph;
+  std::set<std::string> discovered(recipes.begin(), recipes.end());
+  std::deque<std::string> queue(discovered.begin(), discovered.end());
+  std::optional<std::string> error;
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t count_active = 0;
+  auto f_worker = [&, level = ns_log::get_level()]
+  {
+    ns_log::set_level(level);
+    while(true)
+    {
+      std::string recipe;
+      {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&]{ return error or not queue.empty() or count_active == 0; });
+        break_if(error or queue.empty());
+        recipe = queue.front();
+        queue.pop_front();
+        count_active += 1;
+      }
+      auto resolved = fetch_recipe(distribution, url_remote, path_file_downloder, path_dir_download, recipe, use_existing);
+      std::lock_guard lock(mutex);
+      count_active -= 1;
+      if(not resolved)
+      {
+        error = error.value_or(resolved.error());
+      }
+      else
+      {
+        for(auto const& dependency : resolved->recipe.get_dependencies())
+        {
+          if(discovered.insert(dependency).second) { queue.push_back(dependency); }
+        }
+        graph.emplace(recipe, std::move(*resolved));
+      }
+      cv.notify_all();
+    }
+  };
+  {
+    std::vector<std::jthread> workers;
+    for(size_t i = 0; i < FETCH_CONCURRENCY; ++i)
+    {
+      workers.emplace_back(f_worker);
+    }
+  }
+  // The error was logged by the worker that failed
+  return_if(error, std::unexpected(*error));
+  // Order the recipes after their dependencies, and detect cycles
+  std::vector<Resolved> order;
+  std::map<std::string,bool> is_done;
+  std::function<Value<void>(std::string const&)> f_visit = [&](std::string const& recipe) -> Value<void>
+  {
+    if(auto it = is_done.find(recipe); it != is_done.end())
+    {
+      return_if(not it->second, Error("E::Cyclic dependency for recipe '{}'", recipe));
+      return {};
+    }
+    is_done[recipe] = false;
+    Resolved const& resolved = graph.at(recipe);
+    for(auto const& dependency : resolved.recipe.get_dependencies())
+    {
+      Pop(f_visit(dependency));
+    }
+    is_done[recipe] = true;
+    order.push_back(resolved);
+    return {};
+  };
+  for(auto const& recipe : recipes)
+  {
+    Pop(f_visit(recipe));
+  }
+  // Report the resolution
+  auto f_names = [&](std::optional<Source> source)
+  {
+    auto names = order
+      | std::views::filter([&](Resolved const& resolved){ return not source or resolved.source == *source; })
+      | std::views::transform([](Resolved const& resolved){ return resolved.name; });
+    return ns_string::from_container(std::vector<std::string>(names.begin(), names.end()), ',');
+  };
+  logger("I::Resolved {} recipes: {}", order.size(), f_names(std::nullopt));
+  for(auto [source, description] : { std::pair{Source::CACHE, "From cache"}
+    , std::pair{Source::REVALIDATE, "Unchanged on the remote"}
+    , std::pair{Source::DOWNLOAD, "Downloaded"}})
+  {
+    std::string names = f_names(source);
+    log_if(not names.empty(), "I::{}: {}", description, names);
+  }
+  return order;
 }
 
 /**
@@ -259,14 +454,74 @@ namespace ns_recipe
   return {};
 }
 
+/**
+ * @brief A host directory shared by the package managers of all FlatImages of the distribution
+ */
+struct PackageCache
+{
+  fs::path path_dir;                                ///< Host directory of the cache
+  uint64_t max_age;                                 ///< Minutes before the indexes are refreshed
+  std::vector<std::pair<fs::path,fs::path>> binds;  ///< Host directories and their guest paths
+};
+
+/**
+ * @brief Gets the shared package cache, enabled with FIM_PACKAGE_CACHE=1
+ *
+ * The cache lives in '$FIM_DIR_GLOBAL/cache/packages/<distribution>' and is bound over the package
+ * cache of the guest during installs, so FlatImages of the same distribution download each package
+ * once. FIM_PACKAGE_CACHE_MAX_AGE sets the minutes the shared indexes are used before a refresh.
+ *
+ * @param fim FlatImage configuration object
+ * @return Value<std::optional<PackageCache>> The cache, nothing if disabled or unsupported by the
+ * distribution, or the respective error
+ */
+[[nodiscard]] inline Value<std::optional<PackageCache>> get_package_cache(ns_config::FlatImage const& fim)
+{
+  char const* var = std::getenv("FIM_PACKAGE_CACHE");
+  return_if(var == nullptr or std::string_view{var} != "1", std::nullopt);
+  PackageCache cache
+  {
+    .path_dir = fim.path.dir.global / "cache" / "packages" / fim.distribution.lower(),
+    .max_age = PACKAGE_CACHE_MAX_AGE,
+    .binds = {},
+  };
+  if(char const* var_max_age = std::getenv("FIM_PACKAGE_CACHE_MAX_AGE"))
+  {
+    std::string_view str_max_age{var_max_age};
+    auto [ptr, ec] = std::from_chars(str_max_age.data(), str_max_age.data() + str_max_age.size(), cache.max_age);
+    if(ec != std::errc{} or ptr != str_max_age.data() + str_max_age.size())
+    {
+      cache.max_age = PACKAGE_CACHE_MAX_AGE;
+      logger("W::Invalid FIM_PACKAGE_CACHE_MAX_AGE '{}', using {} minutes", str_max_age, cache.max_age);
+    }
+  }
+  switch(fim.distribution)
+  {
+    // Packages and indexes
+    case ns_config::Distribution::ALPINE: cache.binds = {{cache.path_dir / "apk", "/var/cache/apk"}}; break;
+    // Packages and sync databases
+    case ns_config::Distribution::ARCH: cache.binds = {{cache.path_dir / "pkg", "/var/cache/pacman/pkg"}
+      , {cache.path_dir / "sync", "/var/lib/pacman/sync"}};
+    break;
+    case ns_config::Distribution::BLUEPRINT:
+    case ns_config::Distribution::NONE: return std::nullopt;
+  }
+  for(auto const& [path_dir_host, path_dir_guest] : cache.binds)
+  {
+    Pop(ns_fs::create_directories(path_dir_host));
+  }
+  logger("I::Using the shared package cache in '{}'", cache.path_dir);
+  return cache;
+}
+
 /**
  * @brief Installs packages from recipes using the appropriate package manager
  *
  * @tparam F Callable type for executing commands (signature: F(std::string, std::vector<std::string>&))
  * @param fim FlatImage configuration object
  * @param distribution Name of the current linux distribution (e.g., "arch", "alpine")
- * @param path_dir_download Directory where recipes are cached
- * @param recipes Vector of recipe names to install packages from
+ * @param recipes The resolved recipes to install packages from, in dependency order
+ * @param cache The shared package cache bound in the guest by the callback, if enabled
  * @param callback Function to execute the package manager command, receives program name and arguments
  * @return Value<int> Exit code on success, or the respective error
  */
@@ -274,21 +529,22 @@ template<typename F>
 requires std::invocable<F,std::string,std::vector<std::string>&>
 [[nodiscard]] inline Value<int> install(ns_config::FlatImage const& fim
   , ns_config::Distribution const& distribution
-  , fs::path const& path_dir_download
-  , std::vector<std::string> const& recipes
+  , std::vector<Resolved> const& recipes
+  , std::optional<PackageCache> const& cache
   , F&& callback)
 {
 
   // Get packages from recipes and find desktop integration data
   std::vector<std::string> packages;
+  std::unordered_set<std::string> set_packages;
   Value<ns_db::ns_desktop::Desktop> desktop = std::unexpected("No desktop integration found");
-  for(auto&& recipe : recipes)
+  for(auto&& [recipe, recipe_obj, source] : recipes)
   {
-    // Load recipe
-    ns_db::ns_recipe::Recipe recipe_obj = Pop(load_recipe(distribution, path_dir_download, recipe), "E::Could not load json recipe");
-    // Extract and collect packages
-    auto const& recipe_packages = recipe_obj.get_packages();
-    std::ranges::copy(recipe_packages, std::back_inserter(packages));
+    // Collect packages, each one once in the order of the recipes
+    for(auto const& package : recipe_obj.get_packages())
+    {
+      if(set_packages.insert(package).second) { packages.push_back(package); }
+    }
     // Check for desktop integration data (use last one found)
     if(recipe_obj.get_desktop())
     {
@@ -304,13 +560,31 @@ requires std::invocable<F,std::string,std::vector<std::string>&>
     case ns_config::Distribution::ALPINE:
     {
       program = "apk";
-      args = {"add", "--no-cache", "--update-cache", "--no-progress"};
+      // With the shared cache, apk refreshes the indexes older than the window
+      args = (cache)?
+          std::vector<std::string>{"add", "--cache-dir", "/var/cache/apk", "--cache-max-age", std::to_string(cache->max_age), "--no-progress"}
+        : std::vector<std::string>{"add", "--no-cache", "--update-cache", "--no-progress"};
     }
     break;
     case ns_config::Distribution::ARCH:
     {
       program = "pacman";
-      args = {"-Syu", "--noconfirm", "--needed"};
+      // With the shared cache, skip the refresh of sync databases updated within the window
+      bool is_fresh = cache and ({
+        std::error_code ec;
+        auto time_min = fs::file_time_type::clock::now() - std::chrono::minutes(cache->max_age);
+        std::vector<fs::path> dbs;
+        for(auto const& entry : fs::directory_iterator(cache->path_dir / "sync", ec))
+        {
+          if(entry.path().extension() == ".db") { dbs.push_back(entry.path()); }
+        }
+        not dbs.empty() and std::ranges::all_of(dbs, [&](fs::path const& path_file_db)
+        {
+          return fs::last_write_time(path_file_db, ec) >= time_min and not ec;
+        });
+      });
+      log_if(is_fresh, "I::Sync databases in the shared package cache are up to date");
+      args = {is_fresh? "-Su" : "-Syu", "--noconfirm", "--needed"};
     }
     break;
     case ns_config::Distribution::BLUEPRINT:
@@ -325,8 +599,16 @@ requires std::invocable<F,std::string,std::vector<std::string>&>
   }
   // Copy packages to arguments
   std::ranges::copy(packages, std::back_inserter(args));
-  // Execute package manager using the provided callback
-  int exit_code = Pop(callback(program, args));
+  // Execute package manager using the provided callback, one install at a time uses the shared cache
+  int fd_lock = -1;
+  if(cache)
+  {
+    fd_lock = ::open((cache->path_dir / "lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    log_if(fd_lock < 0 or ::flock(fd_lock, LOCK_EX) < 0, "W::Could not lock the shared package cache: {}", strerror(errno));
+  }
+  auto ret = callback(program, args);
+  if(fd_lock >= 0) { ::close(fd_lock); }
+  int exit_code = Pop(ret);
   // Setup desktop integration if found
   if(desktop)
   {
@@ -0,0 +1,407 @@
+/**
+ * @file snapshot.hpp
+ * @author Ruan Formigoni
+ * @brief Snapshots of the upper directory, to checkpoint and roll back its changes
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../filesystems/utils.hpp"
+#include "../../macro.hpp"
+
+/**
+ * @namespace ns_cmd::ns_snapshot
+ * @brief Copies of the upper directory in '$FIM_DIR_DATA/snapshots'
+ *
+ * A snapshot is a copy of the upper directory with its permissions, timestamps, extended
+ * attributes, hard links and whiteouts. Files are cloned with FICLONE, on filesystems with
+ * reflinks (btrfs, xfs, bcachefs) they share the extents of the original until either is
+ * modified, so a snapshot costs a pass over the metadata regardless of the size of the files.
+ * Elsewhere copy_file_range copies in the kernel. Hard links to the original would not work as a
+ * fallback, the overlay writes to the files of the upper directory in place.
+ *
+ * Restoring clones the snapshot next to the upper directory and swaps them with two renames, the
+ * snapshot is kept and can be restored again.
+ */
+namespace ns_cmd::ns_snapshot
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Counts the files of a clone by how they were copied
+ */
+struct Clone
+{
+  uint64_t reflinks = 0; ///< Files that share the extents of the original
+  uint64_t copies = 0;   ///< Files copied
+  uint64_t links = 0;    ///< Hard links to files of the clone
+  std::map<std::pair<dev_t,ino_t>,fs::path> map_links; ///< Clones of the files with many links
+};
+
+/**
+ * @brief Checks the name of a snapshot
+ *
+ * @param name The name
+ * @return Value<void> Nothing if the name is valid, or the respective error
+ */
+[[nodiscard]] inline Value<void> validate(std::string_view name)
+{
+  return_if(name.empty() or name.starts_with('.'), Error("E::Invalid snapshot name '{}'", name));
+  return_if(not std::ranges::all_of(name, [](char c){ return std::isalnum(static_cast<unsigned char>(c)) or c == '-' or c == '_' or c == '.'; })
+    , Error("E::Invalid snapshot name '{}', use letters, digits, '-', '_' and '.'", name)
+  );
+  return {};
+}
+
+/**
+ * @brief Copies the extended attributes of a file, the overlays keep opaque markers in them
+ *
+ * @param path_src The original file
+ * @param path_dst The clone
+ */
+inline void copy_xattrs(fs::path const& path_src, fs::path const& path_dst)
+{
+  ssize_t size = ::llistxattr(path_src.c_str(), nullptr, 0);
+  return_if(size <= 0,);
+  std::string names(size, '\0');
+  size = ::llistxattr(path_src.c_str(), names.data(), names.size());
+  return_if(size <= 0,);
+  names.resize(size);
+  for(auto&& range : names | std::views::split('\0'))
+  {
+    std::string name(range.begin(), range.end());
+    continue_if(name.empty());
+    ssize_t size_value = ::lgetxattr(path_src.c_str(), name.c_str(), nullptr, 0);
+    continue_if(size_value < 0);
+    std::string value(size_value, '\0');
+    size_value = ::lgetxattr(path_src.c_str(), name.c_str(), value.data(), value.size());
+    continue_if(size_value < 0);
+    log_if(::lsetxattr(path_dst.c_str(), name.c_str(), value.data(), size_value, 0) < 0
+      , "D::Could not copy attribute '{}' of '{}': {}", name, path_src, strerror(errno)
+    );
+  }
+}
+
+/**
+ * @brief Clones a regular file
+ *
+ * @param path_src The original file
+ * @param path_dst The clone, must not exist
+ * @param st Status of the original file
+ * @param clone Counters of the clone
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clone_file(fs::path const& path_src
+  , fs::path const& path_dst
+  , struct stat const& st
+  , Clone& clone)
+{
+  int fd_src = ::open(path_src.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd_src < 0, Error("E::Could not open '{}': {}", path_src, strerror(errno)));
+  int fd_dst = ::open(path_dst.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if(fd_dst < 0)
+  {
+    ::close(fd_src);
+    return Error("E::Could not create '{}': {}", path_dst, strerror(errno));
+  }
+  auto f_copy = [&]() -> Value<void>
+  {
+    if(::ioctl(fd_dst, FICLONE, fd_src) == 0)
+    {
+      ++clone.reflinks;
+      return {};
+    }
+    // Shares the extents where the kernel supports it, copies in the kernel otherwise
+    std::vector<char> buffer;
+    for(off_t offset = 0; offset < st.st_size;)
+    {
+      ssize_t bytes = -1;
+      if(buffer.empty())
+      {
+        bytes = ::copy_file_range(fd_src, &offset, fd_dst, nullptr, st.st_size - offset, 0);
+        if(bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP or errno == EINVAL))
+        {
+          buffer.resize(1 << 20);
+          continue;
+        }
+      }
+      else
+      {
+        bytes = ::pread(fd_src, buffer.data(), buffer.size(), offset);
+        if(bytes > 0)
+        {
+          return_if(::write(fd_dst, buffer.data(), bytes) != bytes, Error("E::Could not write '{}': {}", path_dst, strerror(errno)));
+          offset += bytes;
+        }
+      }
+      continue_if(bytes < 0 and errno == EINTR);
+      // The file shrunk while it was copied
+      break_if(bytes == 0);
+      return_if(bytes < 0, Error("E::Could not copy '{}': {}", path_src, strerror(errno)));
+    }
+    ++clone.copies;
+    return {};
+  };
+  auto ret = f_copy();
+  // Creation is subject to the umask
+  ::fchmod(fd_dst, st.st_mode & 07777);
+  ::close(fd_src);
+  ::close(fd_dst);
+  return ret;
+}
+
+/**
+ * @brief Copies the extended attributes, the permissions of directories and the timestamps
+ *
+ * @param path_src The original entry
+ * @param path_dst The clone
+ * @param st Status of the original entry
+ */
+inline void copy_attributes(fs::path const& path_src, fs::path const& path_dst, struct stat const& st)
+{
+  copy_xattrs(path_src, path_dst);
+  if(S_ISDIR(st.st_mode)) { ::chmod(path_dst.c_str(), st.st_mode & 07777); }
+  struct timespec times[2] = { st.st_atim, st.st_mtim };
+  ::utimensat(AT_FDCWD, path_dst.c_str(), times, AT_SYMLINK_NOFOLLOW);
+}
+
+/**
+ * @brief Clones an entry that is not a directory
+ *
+ * @param path_src The original entry
+ * @param path_dst The clone, must not exist
+ * @param st Status of the original entry
+ * @param clone Counters of the clone
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clone_entry(fs::path const& path_src
+  , fs::path const& path_dst
+  , struct stat const& st
+  , Clone& clone)
+{
+  // Hard links within the tree are kept
+  if(st.st_nlink > 1)
+  {
+    auto [it, is_new] = clone.map_links.try_emplace({st.st_dev, st.st_ino}, path_dst);
+    if(not is_new and ::link(it->second.c_str(), path_dst.c_str()) == 0)
+    {
+      ++clone.links;
+      return {};
+    }
+  }
+  if(S_ISREG(st.st_mode))
+  {
+    Pop(clone_file(path_src, path_dst, st, clone));
+  }
+  else if(S_ISLNK(st.st_mode))
+  {
+    fs::path path_target = Try(fs::read_symlink(path_src));
+    return_if(::symlink(path_target.c_str(), path_dst.c_str()) < 0
+      , Error("E::Could not create symlink '{}': {}", path_dst, strerror(errno))
+    );
+  }
+  // Whiteouts are character devices 0/0, which unprivileged users create since linux 5.8
+  else
+  {
+    return_if(::mknod(path_dst.c_str(), st.st_mode, st.st_rdev) < 0
+      , Error("E::Could not create '{}': {}", path_dst, strerror(errno))
+    );
+  }
+  copy_attributes(path_src, path_dst, st);
+  return {};
+}
+
+/**
+ * @brief Clones a directory tree
+ *
+ * Directories are created writable and get their permissions after their contents, so read-only
+ * directories copied up from the layers are cloned as well.
+ *
+ * @param path_dir_src The original directory
+ * @param path_dir_dst The clone, must not exist
+ * @param clone Counters of the clone
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> clone_tree(fs::path const& path_dir_src, fs::path const& path_dir_dst, Clone& clone)
+{
+  struct stat st_dir;
+  return_if(::lstat(path_dir_src.c_str(), &st_dir) < 0, Error("E::Could not stat '{}': {}", path_dir_src, strerror(errno)));
+  return_if(::mkdir(path_dir_dst.c_str(), 0700) < 0, Error("E::Could not create '{}': {}", path_dir_dst, strerror(errno)));
+  for(auto const& entry : Try(fs::directory_iterator(path_dir_src)))
+  {
+    fs::path const& path_src = entry.path();
+    fs::path const path_dst = path_dir_dst / path_src.filename();
+    struct stat st;
+    return_if(::lstat(path_src.c_str(), &st) < 0, Error("E::Could not stat '{}': {}", path_src, strerror(errno)));
+    if(S_ISDIR(st.st_mode))
+    {
+      Pop(clone_tree(path_src, path_dst, clone));
+      continue;
+    }
+    Pop(clone_entry(path_src, path_dst, st, clone));
+  }
+  copy_attributes(path_dir_src, path_dir_dst, st_dir);
+  return {};
+}
+
+/**
+ * @brief Clones a directory tree and reports how the files were copied
+ *
+ * @param path_dir_src The original directory
+ * @param path_dir_dst The clone, removed on failure
+ * @return Value<Clone> The counters of the clone, or the respective error
+ */
+[[nodiscard]] inline Value<Clone> clone(fs::path const& path_dir_src, fs::path const& path_dir_dst)
+{
+  Clone clone;
+  if(auto ret = clone_tree(path_dir_src, path_dir_dst, clone); not ret)
+  {
+    ns_filesystems::ns_utils::remove_tree(path_dir_dst).discard("E::Could not remove the incomplete copy");
+    return Error("E::Could not copy '{}': {}", path_dir_src, ret.error());
+  }
+  return clone;
+}
+
+} // namespace
+
+/**
+ * @brief Creates a snapshot of the upper directory
+ *
+ * @param path_dir_upper The upper directory
+ * @param path_dir_snapshots Directory of the snapshots, on the filesystem of the upper directory
+ * @param name Name of the snapshot, defaults to the current time
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> create(fs::path const& path_dir_upper
+  , fs::path const& path_dir_snapshots
+  , std::optional<std::string> const& name)
+{
+  std::string const name_snapshot = name.value_or(
+    std::format("{:%Y%m%d-%H%M%S}", std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now()))
+  );
+  Pop(validate(name_snapshot));
+  fs::path const path_dir_snapshot = path_dir_snapshots / name_snapshot;
+  return_if(Try(fs::exists(fs::symlink_status(path_dir_snapshot))), Error("E::Snapshot '{}' already exists", name_snapshot));
+  Try(fs::create_directories(path_dir_snapshots));
+  // Names do not start with a dot, so the incomplete copy never shadows a snapshot
+  fs::path const path_dir_tmp = path_dir_snapshots / std::format(".{}.tmp", name_snapshot);
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_tmp));
+  auto const time_start = std::chrono::steady_clock::now();
+  Clone clone = Pop(ns_snapshot::clone(path_dir_upper, path_dir_tmp));
+  Try(fs::rename(path_dir_tmp, path_dir_snapshot));
+  logger("I::Created snapshot '{}' in {:.2f}s: {} files shared with reflinks, {} copied and {} hard links"
+    , name_snapshot
+    , std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count()
+    , clone.reflinks
+    , clone.copies
+    , clone.links
+  );
+  return {};
+}
+
+/**
+ * @brief Replaces the upper directory with a copy of a snapshot
+ *
+ * @param path_dir_upper The upper directory
+ * @param path_dir_snapshots Directory of the snapshots, on the filesystem of the upper directory
+ * @param name Name of the snapshot
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> restore(fs::path const& path_dir_upper
+  , fs::path const& path_dir_snapshots
+  , std::string const& name)
+{
+  Pop(validate(name));
+  fs::path const path_dir_snapshot = path_dir_snapshots / name;
+  return_if(not Try(fs::is_directory(path_dir_snapshot)), Error("E::Snapshot '{}' does not exist", name));
+  // Clone next to the upper directory, so the swap is two renames on the same filesystem
+  fs::path const path_dir_tmp = path_dir_snapshots / ".restore.tmp";
+  fs::path const path_dir_old = path_dir_snapshots / ".restore.old";
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_tmp));
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_old));
+  auto const time_start = std::chrono::steady_clock::now();
+  Clone clone = Pop(ns_snapshot::clone(path_dir_snapshot, path_dir_tmp));
+  Try(fs::rename(path_dir_upper, path_dir_old));
+  if(auto ret = Catch(fs::rename(path_dir_tmp, path_dir_upper)); not ret)
+  {
+    Try(fs::rename(path_dir_old, path_dir_upper));
+    return Error("E::Could not replace the upper directory: {}", ret.error());
+  }
+  Pop(ns_filesystems::ns_utils::remove_tree(path_dir_old));
+  logger("I::Restored snapshot '{}' in {:.2f}s: {} files shared with reflinks, {} copied and {} hard links"
+    , name
+    , std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count()
+    , clone.reflinks
+    , clone.copies
+    , clone.links
+  );
+  return {};
+}
+
+/**
+ * @brief Deletes a snapshot
+ *
+ * @param path_dir_snapshots Directory of the snapshots
+ * @param name Name of the snapshot
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> remove(fs::path const& path_dir_snapshots, std::string const& name)
+{
+  Pop(validate(name));
+  fs::path const path_dir_snapshot = path_dir_snapshots / name;
+  return_if(not Try(fs::is_directory(path_dir_snapshot)), Error("E::Snapshot '{}' does not exist", name));
+  return ns_filesystems::ns_utils::remove_tree(path_dir_snapshot);
+}
+
+/**
+ * @brief Lists the snapshots by name, one per line
+ *
+ * @param path_dir_snapshots Directory of the snapshots
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> list(fs::path const& path_dir_snapshots)
+{
+  return_if(not Try(fs::exists(path_dir_snapshots)), {});
+  std::vector<std::string> names = Try(fs::directory_iterator(path_dir_snapshots))
+    | std::views::transform([](auto&& e){ return e.path().filename().string(); })
+    | std::views::filter([](auto&& e){ return not e.starts_with('.'); })
+    | std::ranges::to<std::vector<std::string>>();
+  std::ranges::sort(names);
+  for(std::string const& name : names)
+  {
+    std::cout << name << '\n';
+  }
+  return {};
+}
+
+} // namespace ns_cmd::ns_snapshot
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,595 @@
+/**
+ * @file update.hpp
+ * @author Ruan Formigoni
+ * @brief Updates a FlatImage from a published copy, downloading only the regions that changed
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../std/expected.hpp"
+#include "../../std/filesystem.hpp"
+#include "../../db/db.hpp"
+#include "../../lib/ed25519.hpp"
+#include "../../lib/sha256.hpp"
+#include "../../lib/subprocess.hpp"
+#include "../../filesystems/layers.hpp"
+#include "../../macro.hpp"
+#include "layers.hpp"
+
+/**
+ * @namespace ns_cmd::ns_update
+ * @brief Delta updates of a FlatImage
+ *
+ * A FlatImage is the ELF with its tools and the reserved region, followed by size-prefixed DwarFS
+ * layers. 'fim-update publish' splits an image in regions: the head up to the first layer in
+ * chunks of CHUNK bytes, and each layer whole, without its size header. Each region is stored as
+ * an object named after its SHA-256 hash, and 'manifest.json' lists the regions in order. Layers
+ * keep their hash when layers are added or removed around them, and a change to the reserved
+ * region changes a single chunk of the head. The manifest is signed with the Ed25519 key of the
+ * publisher, in 'manifest.json.sig'.
+ *
+ * 'fim-update apply' only accepts a manifest signed by the key stored in the image, fetched over
+ * https. It hashes the regions of the local binary, downloads the objects it does not have,
+ * assembles the new binary next to the current one, verifies it and renames it over the current
+ * one. Downloaded objects are kept until the update succeeds, an interrupted update resumes with
+ * the objects that were already downloaded.
+ */
+namespace ns_cmd::ns_update
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Size of the chunks of the head
+constexpr uint64_t const CHUNK = 1 << 20;
+// Number of parallel downloads
+constexpr size_t const DOWNLOADS = 4;
+// Version of the manifest format
+constexpr uint64_t const VERSION = 2;
+
+} // namespace
+
+/**
+ * @brief A region of an image
+ */
+struct Region
+{
+  uint64_t offset;  ///< Offset of the data in the image
+  uint64_t size;    ///< Size of the data
+  std::string hash; ///< SHA-256 of the data, as hexadecimal
+  bool is_layer;    ///< Whether the data is a layer, which is preceded by its size header
+};
+
+namespace
+{
+
+/**
+ * @brief Checks that a hash from a manifest is a SHA-256 digest, before it names an object
+ *
+ * @param hash The hash
+ * @return bool Whether the hash has 64 lowercase hexadecimal digits
+ */
+[[nodiscard]] inline bool is_hash(std::string_view hash)
+{
+  return hash.size() == 64 and std::ranges::all_of(hash, [](char c){ return (c >= '0' and c <= '9') or (c >= 'a' and c <= 'f'); });
+}
+
+/**
+ * @brief Checks that an update URL is fetched over https
+ *
+ * @param url The URL
+ * @return Value<void> Nothing if the URL uses https, or the respective error
+ */
+[[nodiscard]] inline Value<void> check_url(std::string const& url)
+{
+  return_if(not url.starts_with("https://"), Error("E::The update URL must use https: '{}'", url));
+  return {};
+}
+
+/**
+ * @brief Copies a region between two files
+ *
+ * @param fd_in The file to read from
+ * @param offset_in Offset of the region in the input file
+ * @param size Size of the region
+ * @param fd_out The file to write to
+ * @param offset_out Offset of the region in the output file
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> copy_range(int fd_in, uint64_t offset_in, uint64_t size, int fd_out, uint64_t offset_out)
+{
+  off_t off_in = offset_in;
+  off_t off_out = offset_out;
+  bool is_copy_range = true;
+  std::vector<char> buffer;
+  for(uint64_t remaining = size; remaining > 0;)
+  {
+    ssize_t bytes = -1;
+    if(is_copy_range)
+    {
+      bytes = ::copy_file_range(fd_in, &off_in, fd_out, &off_out, remaining, 0);
+      // Not available for this pair of files, e.g., across filesystems on older kernels
+      if(bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EOPNOTSUPP or errno == EINVAL))
+      {
+        is_copy_range = false;
+        buffer.resize(CHUNK);
+        continue;
+      }
+    }
+    else
+    {
+      bytes = ::pread(fd_in, buffer.data(), std::min<uint64_t>(buffer.size(), remaining), off_in);
+      if(bytes > 0)
+      {
+        return_if(::pwrite(fd_out, buffer.data(), bytes, off_out) != bytes
+          , Error("E::Could not write to the new image: {}", strerror(errno))
+        );
+        off_in += bytes;
+        off_out += bytes;
+      }
+    }
+    continue_if(bytes < 0 and errno == EINTR);
+    return_if(bytes <= 0, Error("E::Could not copy region at offset {}: {}", offset_in, strerror(errno)));
+    remaining -= bytes;
+  }
+  return {};
+}
+
+/**
+ * @brief Runs a function for each index in parallel
+ *
+ * @param count The number of indexes
+ * @param count_threads The maximum number of threads
+ * @param f The function, it receives the index
+ */
+template<typename F>
+inline void parallel(size_t count, size_t count_threads, F&& f)
+{
+  std::atomic<size_t> index{0};
+  auto f_worker = [&, level = ns_log::get_level()]
+  {
+    ns_log::set_level(level);
+    for(size_t i = index++; i < count; i = index++) { f(i); }
+  };
+  std::vector<std::jthread> threads;
+  for(size_t i = 0; i < std::min(count_threads, count); ++i)
+  {
+    threads.emplace_back(f_worker);
+  }
+}
+
+/**
+ * @brief Splits an image in regions and hashes them in parallel
+ *
+ * @param path_file_binary Path to the image
+ * @param offset_layers Offset of the size header of the first layer
+ * @return Value<std::vector<Region>> The regions in the order of the image, or the respective error
+ */
+[[nodiscard]] inline Value<std::vector<Region>> regions(fs::path const& path_file_binary, uint64_t offset_layers)
+{
+  uint64_t size_binary = Try(fs::file_size(path_file_binary));
+  return_if(size_binary < offset_layers, Error("E::The image '{}' is truncated", path_file_binary));
+  std::vector<Region> vec_regions;
+  // The head, in chunks
+  for(uint64_t offset = 0; offset < offset_layers; offset += CHUNK)
+  {
+    vec_regions.push_back(Region{offset, std::min(CHUNK, offset_layers - offset), {}, false});
+  }
+  // The layers, without their size header
+  ns_filesystems::ns_layers::Layers layers;
+  layers.push_binary(path_file_binary, offset_layers);
+  uint64_t offset_end = offset_layers;
+  for(auto const& layer : layers.get_layers())
+  {
+    vec_regions.push_back(Region{layer.offset, layer.size, {}, true});
+    offset_end = layer.offset + layer.size;
+  }
+  return_if(offset_end != size_binary
+    , Error("E::Unexpected data after the last layer of '{}' at offset {}", path_file_binary, offset_end)
+  );
+  // Hash the regions
+  int fd_binary = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd_binary < 0, Error("E::Could not open '{}': {}", path_file_binary, strerror(errno)));
+  std::vector<std::string> errors(vec_regions.size());
+  parallel(vec_regions.size(), std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8), [&](size_t i)
+  {
+    auto hash = ns_sha256::sha256(fd_binary, vec_regions[i].offset, vec_regions[i].size);
+    if(hash) { vec_regions[i].hash = *hash; }
+    else { errors[i] = hash.error(); }
+  });
+  ::close(fd_binary);
+  auto it = std::ranges::find_if(errors, [](auto const& e){ return not e.empty(); });
+  return_if(it != errors.end(), Error("E::Could not hash '{}': {}", path_file_binary, *it));
+  return vec_regions;
+}
+
+/**
+ * @brief Reads the regions listed in a manifest
+ *
+ * @param manifest The contents of a manifest whose signature was verified
+ * @return Value<std::vector<Region>> The regions, with their offsets in the published image, or
+ * the respective error
+ */
+[[nodiscard]] inline Value<std::vector<Region>> read_manifest(std::string const& manifest)
+{
+  ns_db::Db db = Pop(ns_db::from_string(manifest), "E::Invalid manifest");
+  uint64_t version = Pop(db("version").value<uint64_t>(), "E::Missing version in manifest");
+  return_if(version != VERSION, Error("E::Unsupported manifest version {}", version));
+  std::vector<Region> vec_regions;
+  uint64_t offset = 0;
+  for(auto const& [key, is_layer] : { std::pair{"head", false}, std::pair{"layers", true} })
+  {
+    for(std::string const& entry : Pop(db(key).value<std::vector<std::string>>(), "E::Missing {} in manifest", key))
+    {
+      auto pos = entry.find(':');
+      return_if(pos == std::string::npos, Error("E::Invalid manifest entry '{}'", entry));
+      std::string hash = entry.substr(0, pos);
+      return_if(not is_hash(hash), Error("E::Invalid hash in manifest entry '{}'", entry));
+      uint64_t size = Try(std::stoull(entry.substr(pos+1)), "E::Invalid size in manifest");
+      // Layers are preceded by their size header
+      if(is_layer) { offset += sizeof(uint64_t); }
+      vec_regions.push_back(Region{offset, size, std::move(hash), is_layer});
+      offset += size;
+    }
+  }
+  return_if(offset != Pop(db("size").value<uint64_t>(), "E::Missing size in manifest")
+    , Error("E::The regions of the manifest do not add up to the size of the image")
+  );
+  return vec_regions;
+}
+
+/**
+ * @brief Downloads a file
+ *
+ * @param path_file_downloader Path to the downloader executable, e.g., wget
+ * @param url URL of the file
+ * @param path_file_output Where to save the file, it is only created if the download succeeds
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> download(fs::path const& path_file_downloader
+  , std::string const& url
+  , fs::path const& path_file_output)
+{
+  fs::path path_file_tmp = fs::path(path_file_output).concat(".tmp");
+  auto child = ns_subprocess::Subprocess(path_file_downloader)
+    .with_args("-q", "-O", path_file_tmp, url)
+    .spawn();
+  return_if(not child, Error("E::Failed to spawn downloader for '{}'", url));
+  int code = Pop(child->wait());
+  if(code != 0)
+  {
+    std::error_code ec;
+    fs::remove(path_file_tmp, ec);
+    return Error("E::Failed to download '{}', exit code {}", url, code);
+  }
+  Try(fs::rename(path_file_tmp, path_file_output));
+  return {};
+}
+
+/**
+ * @brief Reads a whole file
+ *
+ * @param path_file Path to the file
+ * @return Value<std::string> The contents, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> read_text(fs::path const& path_file)
+{
+  std::ifstream file(path_file, std::ios::binary);
+  return_if(not file.is_open(), Error("E::Could not open '{}'", path_file));
+  return std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+/**
+ * @brief Writes a file and renames it over the destination
+ *
+ * @param path_file Path to the file
+ * @param contents The contents
+ * @param mode The permissions of a new file
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_text(fs::path const& path_file, std::string_view contents, mode_t mode)
+{
+  fs::path path_file_tmp = fs::path(path_file).concat(".tmp");
+  int fd = ::open(path_file_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+  return_if(fd < 0, Error("E::Could not create '{}': {}", path_file_tmp, strerror(errno)));
+  ssize_t written = ::write(fd, contents.data(), contents.size());
+  ::close(fd);
+  return_if(written != static_cast<ssize_t>(contents.size())
+    , Error("E::Could not write '{}': {}", path_file_tmp, strerror(errno))
+  );
+  Try(fs::rename(path_file_tmp, path_file));
+  return {};
+}
+
+} // namespace
+
+/**
+ * @brief Generates a signing key for 'fim-update publish'
+ *
+ * @param path_file_key Where to save the secret key, it must not exist
+ * @return Value<std::string> The public key, as hexadecimal, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> keygen(fs::path const& path_file_key)
+{
+  ns_ed25519::Seed seed = Pop(ns_ed25519::generate());
+  std::string str_seed = ns_ed25519::to_hex(seed) + "\n";
+  // Only the owner may read the secret key
+  int fd = ::open(path_file_key.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  return_if(fd < 0, Error("E::Could not create key '{}': {}", path_file_key, strerror(errno)));
+  ssize_t written = ::write(fd, str_seed.data(), str_seed.size());
+  ::close(fd);
+  return_if(written != static_cast<ssize_t>(str_seed.size())
+    , Error("E::Could not write key '{}': {}", path_file_key, strerror(errno))
+  );
+  return ns_ed25519::to_hex(Pop(ns_ed25519::public_key(seed)));
+}
+
+/**
+ * @brief Publishes an image to a directory, to serve it to 'fim-update apply'
+ *
+ * Objects that are already in the directory are kept, so publishing each version of an image to
+ * the same directory only adds the regions that changed. The secret key must match the update key
+ * of the image, which is the key its updated copies verify the next manifest with.
+ *
+ * @param path_file_binary Path to the image to publish
+ * @param offset_layers Offset of the size header of the first layer
+ * @param path_dir_dst The directory to publish to
+ * @param path_file_key Path to the secret key written by 'keygen'
+ * @param key The update key of the image
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> publish(fs::path const& path_file_binary
+  , uint64_t offset_layers
+  , fs::path const& path_dir_dst
+  , fs::path const& path_file_key
+  , ns_ed25519::PublicKey const& key)
+{
+  ns_ed25519::Seed seed = Pop(ns_ed25519::from_hex<32>(Pop(read_text(path_file_key))), "E::Invalid key '{}'", path_file_key);
+  return_if(Pop(ns_ed25519::public_key(seed)) != key
+    , Error("E::The key '{}' does not match the update key of the image", path_file_key)
+  );
+  std::vector<Region> vec_regions = Pop(regions(path_file_binary, offset_layers));
+  fs::path path_dir_objects = path_dir_dst / "objects";
+  Pop(ns_fs::create_directories(path_dir_objects));
+  int fd_binary = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd_binary < 0, Error("E::Could not open '{}': {}", path_file_binary, strerror(errno)));
+  // Write the objects that are missing
+  uint64_t count_new = 0;
+  uint64_t bytes_new = 0;
+  auto f_write = [&]() -> Value<void>
+  {
+    std::unordered_set<std::string> set_written;
+    for(Region const& region : vec_regions)
+    {
+      continue_if(not set_written.insert(region.hash).second);
+      fs::path path_file_object = path_dir_objects / region.hash;
+      std::error_code ec;
+      continue_if(fs::file_size(path_file_object, ec) == region.size and not ec);
+      fs::path path_file_tmp = fs::path(path_file_object).concat(".tmp");
+      int fd_object = ::open(path_file_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      return_if(fd_object < 0, Error("E::Could not create object '{}': {}", path_file_tmp, strerror(errno)));
+      auto copied = copy_range(fd_binary, region.offset, region.size, fd_object, 0);
+      ::close(fd_object);
+      Pop(copied);
+      Try(fs::rename(path_file_tmp, path_file_object));
+      count_new += 1;
+      bytes_new += region.size;
+    }
+    return {};
+  };
+  auto written = f_write();
+  ::close(fd_binary);
+  Pop(written);
+  // The manifest goes last, clients never see regions without their objects
+  auto f_entries = [&](bool is_layer)
+  {
+    return vec_regions
+      | std::views::filter([&](Region const& region){ return region.is_layer == is_layer; })
+      | std::views::transform([](Region const& region){ return std::format("{}:{}", region.hash, region.size); })
+      | std::ranges::to<std::vector<std::string>>();
+  };
+  ns_db::Db db;
+  db("version") = VERSION;
+  db("size") = Try(fs::file_size(path_file_binary));
+  db("head") = f_entries(false);
+  db("layers") = f_entries(true);
+  std::string manifest = Pop(db.dump());
+  // A client that fetches between the renames sees a signature that does not match and retries
+  Pop(write_text(path_dir_dst / "manifest.json", manifest, 0644));
+  Pop(write_text(path_dir_dst / "manifest.json.sig", ns_ed25519::to_hex(Pop(ns_ed25519::sign(manifest, seed))) + "\n", 0644));
+  logger("I::Published {} regions to '{}', {} new objects of {}"
+    , vec_regions.size()
+    , path_dir_dst
+    , count_new
+    , to_size(bytes_new)
+  );
+  return {};
+}
+
+/**
+ * @brief Updates an image from the copy published at an URL
+ *
+ * @param path_file_binary Path to the image to update
+ * @param offset_layers Offset of the size header of the first layer
+ * @param url The https URL of the directory written by 'fim-update publish'
+ * @param key The public key the manifest must be signed with
+ * @param path_file_downloader Path to the downloader executable, e.g., wget
+ * @param path_dir_tmp Directory for the manifest and the downloaded objects
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> apply(fs::path const& path_file_binary
+  , uint64_t offset_layers
+  , std::string const& url
+  , ns_ed25519::PublicKey const& key
+  , fs::path const& path_file_downloader
+  , fs::path const& path_dir_tmp)
+{
+  Pop(check_url(url));
+  fs::path path_dir_objects = path_dir_tmp / "objects";
+  Pop(ns_fs::create_directories(path_dir_objects));
+  // Fetch the manifest and its signature, which is checked before the manifest is parsed
+  fs::path path_file_manifest = path_dir_tmp / "manifest.json";
+  fs::path path_file_signature = path_dir_tmp / "manifest.json.sig";
+  logger("I::Fetching manifest from '{}'", url);
+  Pop(download(path_file_downloader, url + "/manifest.json", path_file_manifest));
+  Pop(download(path_file_downloader, url + "/manifest.json.sig", path_file_signature));
+  std::string manifest = Pop(read_text(path_file_manifest));
+  ns_ed25519::Signature signature = Pop(ns_ed25519::from_hex<64>(Pop(read_text(path_file_signature)))
+    , "E::Invalid manifest signature"
+  );
+  return_if(not ns_ed25519::verify(manifest, signature, key)
+    , Error("E::The manifest is not signed by the update key of the image")
+  );
+  std::vector<Region> vec_regions_remote = Pop(read_manifest(manifest));
+  // Find the regions available locally
+  std::vector<Region> vec_regions_local = Pop(regions(path_file_binary, offset_layers));
+  if(std::ranges::equal(vec_regions_local, vec_regions_remote, [](Region const& a, Region const& b)
+    {
+      return a.hash == b.hash and a.size == b.size and a.is_layer == b.is_layer;
+    }))
+  {
+    logger("I::The image is up to date");
+    return {};
+  }
+  std::unordered_map<std::string,Region> map_local;
+  for(Region const& region : vec_regions_local)
+  {
+    map_local.try_emplace(region.hash, region);
+  }
+  // Download the missing objects, objects left by an interrupted update are reused
+  std::vector<Region> vec_missing;
+  std::unordered_set<std::string> set_missing;
+  for(Region const& region : vec_regions_remote)
+  {
+    auto it = map_local.find(region.hash);
+    continue_if(it != map_local.end() and it->second.size == region.size);
+    continue_if(not set_missing.insert(region.hash).second);
+    vec_missing.push_back(region);
+  }
+  uint64_t bytes_download = 0;
+  for(Region const& region : vec_missing) { bytes_download += region.size; }
+  logger("I::Downloading {} of {} regions, {}", vec_missing.size(), vec_regions_remote.size(), to_size(bytes_download));
+  std::vector<std::string> errors(vec_missing.size());
+  parallel(vec_missing.size(), DOWNLOADS, [&](size_t i)
+  {
+    Region const& region = vec_missing[i];
+    fs::path path_file_object = path_dir_objects / region.hash;
+    auto f_valid = [&]
+    {
+      std::error_code ec;
+      return_if(fs::file_size(path_file_object, ec) != region.size or ec, false);
+      int fd_object = ::open(path_file_object.c_str(), O_RDONLY | O_CLOEXEC);
+      return_if(fd_object < 0, false);
+      auto hash = ns_sha256::sha256(fd_object, 0, region.size);
+      ::close(fd_object);
+      return hash and *hash == region.hash;
+    };
+    return_if(f_valid(),);
+    auto downloaded = download(path_file_downloader, std::format("{}/objects/{}", url, region.hash), path_file_object);
+    if(not downloaded) { errors[i] = downloaded.error(); }
+    else if(not f_valid()) { errors[i] = std::format("Object {} does not match its hash", region.hash); }
+  });
+  auto it_error = std::ranges::find_if(errors, [](auto const& e){ return not e.empty(); });
+  return_if(it_error != errors.end(), Error("E::Could not download the update: {}", *it_error));
+  // Assemble the new image next to the current one, so it can be renamed over it
+  fs::path path_file_new = path_file_binary.parent_path() / std::format(".{}.update", path_file_binary.filename().string());
+  struct stat st{};
+  return_if(::stat(path_file_binary.c_str(), &st) < 0, Error("E::Could not stat '{}': {}", path_file_binary, strerror(errno)));
+  auto f_assemble = [&]() -> Value<void>
+  {
+    int fd_local = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+    return_if(fd_local < 0, Error("E::Could not open '{}': {}", path_file_binary, strerror(errno)));
+    int fd_new = ::open(path_file_new.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if(fd_new < 0)
+    {
+      ::close(fd_local);
+      return Error("E::Could not create '{}': {}", path_file_new, strerror(errno));
+    }
+    auto f_write = [&]() -> Value<void>
+    {
+      for(Region const& region : vec_regions_remote)
+      {
+        if(region.is_layer)
+        {
+          uint64_t size = region.size;
+          return_if(::pwrite(fd_new, &size, sizeof(size), region.offset - sizeof(size)) != sizeof(size)
+            , Error("E::Could not write layer size: {}", strerror(errno))
+          );
+        }
+        if(auto it = map_local.find(region.hash); it != map_local.end() and it->second.size == region.size)
+        {
+          Pop(copy_range(fd_local, it->second.offset, region.size, fd_new, region.offset));
+          continue;
+        }
+        fs::path path_file_object = path_dir_objects / region.hash;
+        int fd_object = ::open(path_file_object.c_str(), O_RDONLY | O_CLOEXEC);
+        return_if(fd_object < 0, Error("E::Could not open object '{}': {}", path_file_object, strerror(errno)));
+        auto copied = copy_range(fd_object, 0, region.size, fd_new, region.offset);
+        ::close(fd_object);
+        Pop(copied);
+      }
+      return_if(::fdatasync(fd_new) < 0, Error("E::Could not sync the new image: {}", strerror(errno)));
+      return {};
+    };
+    auto written = f_write();
+    ::close(fd_local);
+    ::close(fd_new);
+    return written;
+  };
+  // Verify the new image before it replaces the current one
+  auto f_verify = [&]() -> Value<void>
+  {
+    uint64_t offset_layers_new = 0;
+    for(Region const& region : vec_regions_remote)
+    {
+      if(not region.is_layer) { offset_layers_new = region.offset + region.size; }
+    }
+    std::vector<Region> vec_regions_new = Pop(regions(path_file_new, offset_layers_new));
+    return_if(not std::ranges::equal(vec_regions_new, vec_regions_remote, [](Region const& a, Region const& b)
+      {
+        return a.hash == b.hash and a.size == b.size and a.offset == b.offset;
+      }), Error("E::The new image does not match the manifest")
+    );
+    return {};
+  };
+  if(auto ret = f_assemble().and_then([&]{ return f_verify(); }); not ret)
+  {
+    std::error_code ec;
+    fs::remove(path_file_new, ec);
+    return Error("E::Could not assemble the update: {}", ret.error());
+  }
+  Try(fs::rename(path_file_new, path_file_binary));
+  uint64_t bytes_total = vec_regions_remote.empty()? 0 : vec_regions_remote.back().offset + vec_regions_remote.back().size;
+  logger("I::Updated '{}' to {}, downloaded {}", path_file_binary, to_size(bytes_total), to_size(bytes_download));
+  // The objects are only needed to resume an interrupted update
+  std::error_code ec;
+  fs::remove_all(path_dir_tmp, ec);
+  return {};
+}
+
+} // namespace ns_cmd::ns_update
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
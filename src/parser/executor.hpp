@@ -16,19 +16,27 @@
 #include <string>
 #include <expected>
 #include <print>
+#include <ranges>
+#include <thread>
 
 #include "../filesystems/controller.hpp"
 #include "../filesystems/utils.hpp"
 #include "../db/env.hpp"
 #include "../db/remote.hpp"
+#include "../db/perf.hpp"
+#include "../db/limit.hpp"
 #include "../db/boot.hpp"
+#include "../db/portal/snapshot.hpp"
 #include "../macro.hpp"
 #include "../reserved/overlay.hpp"
 #include "../reserved/notify.hpp"
 #include "../reserved/casefold.hpp"
+#include "../reserved/volatile.hpp"
 #include "../reserved/boot.hpp"
 #include "../bwrap/bwrap.hpp"
 #include "../config.hpp"
+#include "../lib/span.hpp"
+#include "../lib/stats.hpp"
 #include "../lib/subprocess.hpp"
 #include "../portal/portal.hpp"
 #include "interface.hpp"
@@ -38,6 +46,11 @@
 #include "cmd/bind.hpp"
 #include "cmd/recipe.hpp"
 #include "cmd/unshare.hpp"
+#include "cmd/bench.hpp"
+#include "cmd/instance.hpp"
+#include "cmd/update.hpp"
+#include "cmd/snapshot.hpp"
+#include "cmd/apply.hpp"
 
 namespace ns_parser
 {
@@ -69,29 +82,143 @@ using namespace ns_parser::ns_interface;
   // Parse args
   CmdType variant_cmd = Pop(ns_parser::parse(argc, argv), "C::Could not parse arguments");
 
+  // Bindings of the current command, on top of the configured ones
+  std::vector<std::pair<fs::path,fs::path>> vec_bind_command;
+
+  // Boot runs as a small dependency graph, only the bwrap launch needs the mounted filesystems:
+  // - reserved space reads, the sandbox user and the permission bindings depend on nothing
+  // - the host portal depends on nothing, its supervisor reads the mounts when it cleans them
+  // - the GPU symlinks depend on the upper directory, which exists after waiting for it
+  // - the filesystems depend on the data directory, they mount in the calling thread
+  // Probe caches are kept in the cache directory of the user, disabled if it is not private
+  auto f_dir_cache = [&]() -> std::optional<fs::path>
+  {
+    auto ret_dir_cache = ns_fs::create_private_directory(fim.path.dir.cache);
+    return_if(not ret_dir_cache, std::nullopt, "D::Probe caches disabled: {}", ret_dir_cache.error());
+    return *ret_dir_cache;
+  };
+
   auto f_bwrap_impl = [&](auto&& program, auto&& args) -> Value<ns_bwrap::bwrap_run_ret_t>
   {
+    // Retrieve permissions
+    ns_reserved::ns_permissions::Permissions permissions(fim.path.bin.self);
+    // Retrieve unshare options
+    ns_reserved::ns_unshare::Unshares unshares(fim.path.bin.self);
+    // Bubblewrap user data
+    ns_bwrap::ns_proxy::User user = Pop(fim.configure_bwrap());
+    logger("D::User: {}", std::string{user.data});
+    // Read the configuration and probe the host while the filesystems are mounted
+    std::optional<fs::path> path_dir_cache = f_dir_cache();
+    std::vector<std::string> environment;
+    Value<ns_db::ns_bind::Binds> binds;
+    ns_db::ns_limit::Limit limit;
+    ns_bwrap::ns_grant::Args args_grant;
+    std::jthread thread_prepare([&, level = ns_log::get_level()]
+    {
+      ns_log::set_level(level);
+      ns_span::Span span("bwrap_prepare");
+      environment = ns_db::ns_env::get(fim.path.bin.self).or_default();
+      binds = ns_cmd::ns_bind::db_read(fim.path.bin.self);
+      limit = ns_db::ns_limit::get(fim.path.bin.self).value_or(ns_db::ns_limit::Limit{});
+      args_grant = ns_bwrap::ns_grant::args(permissions, ns_bwrap::ns_grant::Context
+      {
+        .is_root = user.data.id.uid == 0,
+        .path_dir_xdg_runtime = ns_bwrap::ns_grant::xdg_runtime_dir(),
+        .path_file_probe = path_dir_cache.transform([](auto&& e){ return e / "probe.json"; }),
+        .shm = fuse.perf.get_shm(),
+      });
+    });
+    // Build the dispatcher object pointing it to the fifo of the host daemon
+    ns_dispatcher::Dispatcher dispatcher(fim.pid
+      , ns_daemon::Mode::HOST
+      , fim.path.dir.app
+      , fim.logs.dispatcher.path_dir_log
+    );
+    // Write the configuration of the portal helpers once, they map it instead of each receiving it
+    Pop(ns_db::ns_portal::ns_snapshot::write(fim.path.file.snapshot
+      , dispatcher
+      , fim.config.daemon.host
+      , fim.logs.daemon_host
+      , fim.config.daemon.guest
+      , fim.logs.daemon_guest
+    ), "E::Could not write the portal configuration");
+    // Start host portal, permissive
+    [[maybe_unused]] auto portal = [&]
+    {
+      ns_span::Span span("spawn_portal");
+      return ns_portal::spawn(fim.config.daemon.host, fim.path.file.snapshot, fuse.path_file_supervisor)
+        .forward("E::Could not start portal daemon");
+    }();
     // Check if linux has the fuse module loaded
     ns_linux::module_check("fuse").discard("W::'fuse' module might not be loaded");
     // Check for fusermount
     Pop(ns_env::search_path("fusermount3"), "C::Could not find 'fusermount3'");
-    // Check if the data directory is busy
-    Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+    // Wait for the data directory, and own it if the instance writes to it
+    std::unique_ptr<ns_filesystems::ns_utils::Owner> owner;
+    std::unique_ptr<ns_filesystems::ns_utils::Concurrent> concurrent;
+    // Volatile runs only read the persistent upper directory, like concurrent instances
+    std::unique_ptr<ns_filesystems::ns_utils::Volatile> dir_volatile;
+    if(not fuse.path_dir_volatile.empty())
+    {
+      dir_volatile = Pop(ns_filesystems::ns_utils::Volatile::create(fuse.path_dir_volatile, fuse.path_dir_work));
+    }
+    if(ns_span::Span span("wait_busy"); not fuse.path_dir_upper_instance.empty())
+    {
+      // Markers are kept, they hide the entries of the layers below the persistent upper directory
+      concurrent = Pop(ns_filesystems::ns_utils::Concurrent::acquire(fim.path.dir.host_data
+        , fuse.path_dir_upper
+        , fuse.path_dir_upper_instance
+        , fuse.is_merge
+        , [](fs::path const& path_dir_src, fs::path const& path_dir_dst)
+          {
+            return ns_layers::squash_layer(path_dir_src, path_dir_dst, true);
+          }
+        , std::chrono::seconds(60)
+      ));
+    }
+    else if(dir_volatile and not fim.flags.is_casefold and fuse.overlay_type != ns_reserved::ns_overlay::OverlayType::BWRAP)
+    {
+      Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+    }
+    // Every other instance writes to the persistent upper directory until it exits
+    else
+    {
+      owner = Pop(ns_filesystems::ns_utils::Owner::acquire(fim.path.dir.host_data, std::chrono::seconds(60)));
+    }
+    // Link the GPU drivers in the upper directory while the filesystems are mounted
+    ns_bwrap::ns_grant::Args args_gpu;
+    std::jthread thread_gpu;
+    if (permissions.contains(ns_reserved::ns_permissions::Permission::GPU))
+    {
+      thread_gpu = std::jthread([&, level = ns_log::get_level()]
+      {
+        ns_log::set_level(level);
+        ns_span::Span span("bwrap_gpu");
+        ns_bwrap::ns_grant::bind_gpu(args_gpu
+          , ns_filesystems::ns_controller::get_upper(fuse)
+          , fim.path.dir.runtime_host
+          , fim.path.dir.host_data / "nvidia.json"
+        );
+      });
+    }
     // Mount filesystems
     [[maybe_unused]] auto filesystem_controller =
       ns_filesystems::ns_controller::Controller(fim.logs.filesystems
         , fuse
       );
-    // Execute specified command
-    auto environment = ns_db::ns_env::get(fim.path.bin.self).or_default();
+    // Without the daemon, a janitor cleans the mounts if this process crashes
+    if(not portal)
+    {
+      filesystem_controller.unsupervise().discard("E::Could not spawn janitor");
+    }
+    // Wait for the preparation
+    thread_prepare.join();
+    if(thread_gpu.joinable()) { thread_gpu.join(); }
     // Get path to root directory
     fs::path path_dir_root = ( fim.flags.is_casefold and fuse.overlay_type != ns_reserved::ns_overlay::OverlayType::BWRAP )?
         fuse.path_dir_ciopfs
       : fuse.path_dir_mount;
     logger("D::Bwrap root: {}", path_dir_root);
-    // Bubblewrap user data
-    ns_bwrap::ns_proxy::User user = Pop(fim.configure_bwrap());
-    logger("D::User: {}", std::string{user.data});
     // Bwrap wrapper
     ns_bwrap::Bwrap bwrap = ns_bwrap::Bwrap(fim.logs.bwrap
       , user
@@ -100,49 +227,50 @@ using namespace ns_parser::ns_interface;
       , args
       , environment
     );
+    // Reuse the bwrap probe of previous launches of the user
+    if(path_dir_cache) { bwrap.set_probe_cache(*path_dir_cache / "bwrap.json"); }
+    // Resource limits of the sandbox
+    bwrap.set_limit(limit);
     // Check for an overlapping data directory
     // Optionally user bwrap overlays
     if(fuse.overlay_type == ns_reserved::ns_overlay::OverlayType::BWRAP)
     {
       bwrap.set_overlay(ns_bwrap::ns_proxy::Overlay
       {
-          .vec_path_dir_layer = ns_filesystems::ns_utils::get_mounted_layers(fuse.path_dir_layers)
-        , .path_dir_upper = fuse.path_dir_upper
+          .vec_path_dir_layer = ns_filesystems::ns_controller::get_lowers(fuse)
+        , .path_dir_upper = ns_filesystems::ns_controller::get_upper(fuse)
         , .path_dir_work = fuse.path_dir_work
       });
     }
     // Include root binding and custom user-defined bindings
     std::ignore = bwrap
       .with_bind_ro("/", fim.path.dir.runtime_host)
-      .with_binds(Pop(ns_cmd::ns_bind::db_read(fim.path.bin.self), "E::Failed to configure bindings"));
-    // Retrieve permissions
-    ns_reserved::ns_permissions::Permissions permissions(fim.path.bin.self);
-    // Retrieve unshare options
-    ns_reserved::ns_unshare::Unshares unshares(fim.path.bin.self);
-    // Check if should enable GPU
-    if (permissions.contains(ns_reserved::ns_permissions::Permission::GPU))
+      .with_binds(Pop(std::move(binds), "E::Failed to configure bindings"));
+    for(auto const& [path_src, path_dst] : vec_bind_command)
     {
-      std::ignore = bwrap.with_bind_gpu(fuse.path_dir_upper, fim.path.dir.runtime_host);
+      std::ignore = bwrap.with_bind(path_src, path_dst);
     }
-    // Build the dispatcher object pointing it to the fifo of the host daemon
-    ns_dispatcher::Dispatcher dispatcher(fim.pid
-      , ns_daemon::Mode::HOST
-      , fim.path.dir.app
-      , fim.logs.dispatcher.path_dir_log
-    );
-    // Start host portal, permissive
-    [[maybe_unused]] auto portal = ns_portal::spawn(fim.config.daemon.host
-      , fim.logs.daemon_host
-    ).forward("E::Could not start portal daemon");
+    // Bindings granted by the permissions, GPU first as before the others
+    args_gpu.insert(args_gpu.end(), std::make_move_iterator(args_grant.begin()), std::make_move_iterator(args_grant.end()));
+    bwrap.set_grant(std::move(args_gpu));
     // Run the portal program with the guest dispatcher configuration
     // Run bwrap
-    return bwrap.run(permissions
+    auto bwrap_run_ret = bwrap.run(permissions
       , unshares
       , fim.path.bin.portal_daemon
-      , dispatcher
-      , fim.config.daemon.guest
-      , fim.logs.daemon_guest
+      , fim.path.file.snapshot
     );
+    // Return the huge pages of the shared memory segments to the pool
+    if(auto shm = fuse.perf.get_shm(); shm and shm->is_hugetlbfs)
+    {
+      if(auto path_dir_hugetlbfs = ns_bwrap::ns_grant::find_hugetlbfs())
+      {
+        std::error_code ec;
+        fs::remove_all(ns_bwrap::ns_grant::hugetlbfs_instance(*path_dir_hugetlbfs, getpid()), ec);
+        log_if(ec, "W::Could not remove the hugetlbfs directory: {}", ec.message());
+      }
+    }
+    return bwrap_run_ret;
   };
 
 
@@ -150,6 +278,16 @@ using namespace ns_parser::ns_interface;
   {
     // Setup desktop integration, permissive
     ns_desktop::integrate(fim).discard("W::Could not perform desktop integration");
+    // Probe the kernel overlay before launching bwrap, so an unsupported host does not pay
+    // for a failed sandbox startup before the fallback
+    ns_reserved::ns_overlay::OverlayType const overlay_fallback = fim.overlay_fallback();
+    if ( fuse.overlay_type == ns_reserved::ns_overlay::OverlayType::BWRAP
+      and not ns_filesystems::ns_utils::is_overlay_userns(fuse.path_dir_work / "probe"
+        , f_dir_cache().transform([](auto&& e){ return e / "overlay.json"; })) )
+    {
+      logger("W::Kernel overlay is unavailable in user namespaces, falling back to {}...", std::string{overlay_fallback});
+      fuse.overlay_type = overlay_fallback;
+    }
     // Run bwrap
     ns_bwrap::bwrap_run_ret_t bwrap_run_ret = Pop(f_bwrap_impl(program, args), "E::Failed to execute bwrap");
     // Log bwrap errors
@@ -157,17 +295,39 @@ using namespace ns_parser::ns_interface;
     // Retry with fallback if bwrap overlayfs failed
     if ( fuse.overlay_type == ns_reserved::ns_overlay::OverlayType::BWRAP and bwrap_run_ret.syscall_nr == SYS_mount )
     {
-      logger("E::Bwrap failed SYS_mount, retrying with fuse-unionfs...");
-      fuse.overlay_type = ns_reserved::ns_overlay::OverlayType::UNIONFS;
+      logger("E::Bwrap failed SYS_mount, retrying with {}...", std::string{overlay_fallback});
+      fuse.overlay_type = overlay_fallback;
       bwrap_run_ret = Pop(f_bwrap_impl(program, args), "E::Failed to execute bwrap");
     } // if
     return bwrap_run_ret.code;
   };
 
+  // Forward the command to an instance that serves this binary, or start a new instance
+  auto f_exec = [&]<typename T, typename U>(T&& program, U&& args) -> Value<int>
+  {
+    auto lease = ns_cmd::ns_instance::Lease::acquire(fim.path.dir.app / "instance", fim.path.bin.self);
+    if(not lease)
+    {
+      return f_bwrap(program, args);
+    }
+    // Build the dispatcher object pointing it to the fifo of the served guest daemon
+    ns_dispatcher::Dispatcher dispatcher((*lease)->instance().pid
+      , ns_daemon::Mode::GUEST
+      , fim.path.dir.app
+      , fim.logs.dispatcher
+    );
+    // The guest daemon spawns the command with the environment of the portal
+    return Pop(ns_subprocess::Subprocess(fim.path.dir.app_bin / "fim_portal")
+      .with_env(ns_db::ns_env::get(fim.path.bin.self).or_default())
+      .with_var("FIM_DISPATCHER_CFG", Pop(ns_dispatcher::serialize(dispatcher)))
+      .with_args(program, args)
+      .spawn()->wait());
+  };
+
   // Execute a command as a regular user
   if ( auto cmd = std::get_if<ns_parser::CmdExec>(&variant_cmd) )
   {
-    return f_bwrap(cmd->program, cmd->args);
+    return f_exec(cmd->program, cmd->args);
   } // if
   // Execute a command as root
   else if ( auto cmd = std::get_if<ns_parser::CmdRoot>(&variant_cmd) )
@@ -238,6 +398,18 @@ using namespace ns_parser::ns_interface;
       return Error("C::Invalid environment sub-command");
     }
   }
+  // Apply a whole configuration in one write
+  else if ( auto cmd = std::get_if<ns_parser::CmdConfig>(&variant_cmd) )
+  {
+    if(auto cmd_apply = std::get_if<CmdConfig::Apply>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_cmd::ns_apply::apply(fim, cmd_apply->path_file_config), "E::Failed to apply configuration");
+    }
+    else
+    {
+      return Error("C::Invalid config sub-command");
+    }
+  }
   // Configure desktop integration
   else if (auto cmd = std::get_if<CmdDesktop>(&variant_cmd))
   {
@@ -280,9 +452,19 @@ using namespace ns_parser::ns_interface;
   // Manager layers
   else if ( auto cmd = std::get_if<ns_parser::CmdLayer>(&variant_cmd) )
   {
+    // Options of mkdwarfs for new layers, from the profile stored in the binary
+    auto mkdwarfs = Pop(ns_db::ns_perf::get_mkdwarfs(fim.path.bin.self), "E::Failed to read the layer profile");
     if(auto cmd_add = std::get_if<CmdLayer::Add>(&(cmd->sub_cmd)))
     {
-      Pop(ns_layers::add(fim.path.bin.self, cmd_add->path_file_src), "E::Failed to add layer");
+      // A layer from the standard input
+      if(cmd_add->path_file_src == "-")
+      {
+        Pop(ns_layers::add_stream(fim.path.bin.self, STDIN_FILENO), "E::Failed to add layer");
+      }
+      else
+      {
+        Pop(ns_layers::add(fim.path.bin.self, cmd_add->path_file_src), "E::Failed to add layer");
+      }
     }
     else if(auto cmd_commit = std::get_if<CmdLayer::Commit>(&(cmd->sub_cmd)))
     {
@@ -303,6 +485,11 @@ using namespace ns_parser::ns_interface;
         mode = ns_layers::CommitMode::FILE;
         path_file_dst = cmd_file->path_file_dst;
       }
+      else if(auto cmd_stream = std::get_if<CmdLayer::Commit::Stream>(&(cmd_commit->sub_cmd)))
+      {
+        mode = ns_layers::CommitMode::STREAM;
+        path_file_dst = cmd_stream->path_stream;
+      }
       else
       {
         return Error("E::Invalid commit sub-command");
@@ -315,6 +502,7 @@ using namespace ns_parser::ns_interface;
         , fuse.compression_level
         , mode
         , path_file_dst
+        , cmd_commit->mkdwarfs.value_or(mkdwarfs).args()
       ), "E::Failed to commit layer");
     }
     else if(auto cmd_create = std::get_if<CmdLayer::Create>(&(cmd->sub_cmd)))
@@ -323,6 +511,7 @@ using namespace ns_parser::ns_interface;
         , cmd_create->path_file_target
         , fim.path.dir.host_data_tmp / "compression.list"
         , fuse.compression_level
+        , mkdwarfs.args()
       ), "E::Failed to create layer");
       logger("I::Filesystem created without errors");
     }
@@ -330,6 +519,96 @@ using namespace ns_parser::ns_interface;
     {
       ns_layers::list(fuse.layers);
     }
+    else if(auto cmd_verify = std::get_if<CmdLayer::Verify>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_layers::verify(fuse.layers, fim.path.dir.host_data / "layers.json", cmd_verify->is_quick));
+    }
+    else if(auto cmd_lazy = std::get_if<CmdLayer::Lazy>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_layers::lazy(fim.path.dir.host_data / "layers.json", cmd_lazy->path_file_layer, cmd_lazy->is_lazy));
+    }
+    else if(auto cmd_snapshot = std::get_if<CmdLayer::Snapshot>(&(cmd->sub_cmd)))
+    {
+      fs::path path_dir_snapshots = fim.path.dir.host_data / "snapshots";
+      // Instances that write to the upper directory or read it must not run meanwhile
+      std::unique_ptr<ns_filesystems::ns_utils::Owner> owner;
+      if(not std::get_if<CmdLayer::Snapshot::List>(&(cmd_snapshot->sub_cmd)))
+      {
+        owner = Pop(ns_filesystems::ns_utils::Owner::acquire(fim.path.dir.host_data, std::chrono::seconds(60)));
+      }
+      if(std::get_if<CmdLayer::Snapshot::List>(&(cmd_snapshot->sub_cmd)))
+      {
+        Pop(ns_cmd::ns_snapshot::list(path_dir_snapshots));
+      }
+      else if(auto cmd_create = std::get_if<CmdLayer::Snapshot::Create>(&(cmd_snapshot->sub_cmd)))
+      {
+        Pop(ns_cmd::ns_snapshot::create(fuse.path_dir_upper, path_dir_snapshots, cmd_create->name), "E::Failed to create snapshot");
+      }
+      else if(auto cmd_restore = std::get_if<CmdLayer::Snapshot::Restore>(&(cmd_snapshot->sub_cmd)))
+      {
+        Pop(ns_cmd::ns_snapshot::restore(fuse.path_dir_upper, path_dir_snapshots, cmd_restore->name), "E::Failed to restore snapshot");
+      }
+      else if(auto cmd_delete = std::get_if<CmdLayer::Snapshot::Delete>(&(cmd_snapshot->sub_cmd)))
+      {
+        Pop(ns_cmd::ns_snapshot::remove(path_dir_snapshots, cmd_delete->name), "E::Failed to delete snapshot");
+      }
+    }
+    else if(auto cmd_squash = std::get_if<CmdLayer::Squash>(&(cmd->sub_cmd)))
+    {
+      // The binary cannot be rewritten while other instances have its layers mounted
+      Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+      // Defaults to all the layers committed on top of the base layer
+      auto const& vec_layers = fuse.layers.get_layers();
+      uint64_t count_embedded = std::ranges::count_if(vec_layers
+        , [&](auto&& e){ return e.path == fim.path.bin.self; }
+      );
+      Pop(ns_layers::squash(fim.path.bin.self
+        , fuse.layers
+        , cmd_squash->index_begin.value_or(1)
+        , cmd_squash->index_end.value_or(count_embedded - 1)
+        , fim.path.dir.host_data_tmp
+        , fim.logs.filesystems.path_file_dwarfs
+        , fuse.compression_level
+        , mkdwarfs.args()
+      ), "E::Failed to squash layers");
+    }
+    else if(auto cmd_rebase = std::get_if<CmdLayer::Rebase>(&(cmd->sub_cmd)))
+    {
+      // The binary cannot be rewritten while other instances have its layers mounted
+      Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+      Pop(ns_layers::rebase(fim.path.bin.self
+        , fuse.layers
+        , cmd_rebase->index_begin
+        , cmd_rebase->index_end
+        , fim.path.dir.host_data_tmp
+        , fim.logs.filesystems.path_file_dwarfs
+        , fuse.compression_level
+        , mkdwarfs.args()
+      ), "E::Failed to rebase layers");
+    }
+    else if(auto cmd_remove = std::get_if<CmdLayer::Remove>(&(cmd->sub_cmd)))
+    {
+      // The binary cannot be rewritten while other instances have its layers mounted
+      Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+      Pop(ns_layers::remove(fim.path.bin.self
+        , fuse.layers
+        , cmd_remove->index
+        , FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE
+        , fim.path.dir.host_data / "layers.json"
+        , fim.path.dir.host_data_tmp
+      ), "E::Failed to remove layer");
+    }
+    else if(std::get_if<CmdLayer::Compact>(&(cmd->sub_cmd)))
+    {
+      // The binary cannot be rewritten while other instances have its layers mounted
+      Pop(ns_filesystems::ns_utils::wait_busy(fim.path.dir.host_data, std::chrono::seconds(60)));
+      Pop(ns_layers::compact(fim.path.bin.self
+        , fuse.layers
+        , FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE
+        , fim.path.dir.host_data / "layers.json"
+        , fim.path.dir.host_data_tmp
+      ), "E::Failed to compact the binary");
+    }
     else
     {
       return Error("C::Invalid layer operation");
@@ -368,6 +647,11 @@ using namespace ns_parser::ns_interface;
   {
     Pop(ns_reserved::ns_casefold::write(fim.path.bin.self, cmd->status == CmdCaseFoldSwitch::ON), "E::Failed to write casefold status");
   } // else if
+  // Enable or disable discarding the changes of each run
+  else if ( auto cmd = std::get_if<ns_parser::CmdVolatile>(&variant_cmd) )
+  {
+    Pop(ns_reserved::ns_volatile::write(fim.path.bin.self, cmd->status == CmdVolatileSwitch::ON), "E::Failed to write volatile status");
+  } // else if
   // Update default command on database
   else if ( auto cmd = std::get_if<ns_parser::CmdBoot>(&variant_cmd) )
   {
@@ -376,7 +660,7 @@ using namespace ns_parser::ns_interface;
       // Create empty boot configuration
       ns_db::ns_boot::Boot boot;
       // Write empty boot configuration
-      Pop(ns_reserved::ns_boot::write(fim.path.bin.self, Pop(ns_db::ns_boot::serialize(boot), "E::Failed to serialize boot configuration")), "E::Failed to clear boot configuration");
+      Pop(ns_reserved::ns_boot::write(fim.path.bin.self, Pop(ns_db::ns_boot::encode(boot), "E::Failed to encode boot configuration")), "E::Failed to clear boot configuration");
     }
     else if(auto cmd_set = std::get_if<CmdBoot::Set>(&(cmd->sub_cmd)))
     {
@@ -386,7 +670,7 @@ using namespace ns_parser::ns_interface;
       boot.set_program(cmd_set->program);
       boot.set_args(cmd_set->args);
       // Write boot configuration
-      Pop(ns_reserved::ns_boot::write(fim.path.bin.self, Pop(ns_db::ns_boot::serialize(boot), "E::Failed to serialize boot configuration")), "E::Failed to set boot configuration");
+      Pop(ns_reserved::ns_boot::write(fim.path.bin.self, Pop(ns_db::ns_boot::encode(boot), "E::Failed to encode boot configuration")), "E::Failed to set boot configuration");
     }
     else if(std::get_if<CmdBoot::Show>(&(cmd->sub_cmd)))
     {
@@ -407,6 +691,106 @@ using namespace ns_parser::ns_interface;
       return Error("C::Invalid boot sub-command");
     }
   }
+  // Configure dwarfs tuning options
+  else if ( auto cmd = std::get_if<ns_parser::CmdPerf>(&variant_cmd) )
+  {
+    if(auto cmd_set = std::get_if<CmdPerf::Set>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::set(fim.path.bin.self, cmd_set->option, cmd_set->value, cmd_set->index), "E::Failed to set perf option");
+    }
+    else if(auto cmd_del = std::get_if<CmdPerf::Del>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::del(fim.path.bin.self, cmd_del->option, cmd_del->index), "E::Failed to delete perf option");
+    }
+    else if(std::get_if<CmdPerf::List>(&(cmd->sub_cmd)))
+    {
+      auto perf = Pop(ns_db::ns_perf::get(fim.path.bin.self), "E::Failed to read perf options");
+      if(perf.budget)
+      {
+        std::println("budget:{}", *perf.budget);
+      }
+      if(perf.shm)
+      {
+        std::println("shm:{}", *perf.shm);
+      }
+      for(auto const& [key,value] : perf.global)
+      {
+        std::println("global:{}={}", key, value);
+      }
+      for(auto const& [index,options] : perf.layers)
+      {
+        for(auto const& [key,value] : options)
+        {
+          std::println("{}:{}={}", index, key, value);
+        }
+      }
+      auto mkdwarfs = Pop(ns_db::ns_perf::get_mkdwarfs(fim.path.bin.self), "E::Failed to read the layer profile");
+      if(mkdwarfs.profile != ns_db::ns_perf::PerfProfile::NONE or not mkdwarfs.options.empty())
+      {
+        std::println("profile:{}{}{}", mkdwarfs.name(), mkdwarfs.options.empty()? "" : " ", ns_string::from_container(mkdwarfs.options, ' '));
+      }
+    }
+    else if(std::get_if<CmdPerf::Clear>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::clear(fim.path.bin.self), "E::Failed to clear perf options");
+    }
+    else if(auto cmd_profile = std::get_if<CmdPerf::Profile>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::set_mkdwarfs(fim.path.bin.self, cmd_profile->mkdwarfs), "E::Failed to set the layer profile");
+    }
+    else if(auto cmd_budget = std::get_if<CmdPerf::Budget>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::set_budget(fim.path.bin.self, cmd_budget->value), "E::Failed to set the cache budget");
+    }
+    else if(auto cmd_shm = std::get_if<CmdPerf::Shm>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_perf::set_shm(fim.path.bin.self, cmd_shm->value), "E::Failed to set the shm mount");
+    }
+    else
+    {
+      return Error("C::Invalid perf sub-command");
+    }
+  }
+  // Configure resource limits
+  else if ( auto cmd = std::get_if<ns_parser::CmdLimit>(&variant_cmd) )
+  {
+    if(auto cmd_set = std::get_if<CmdLimit::Set>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_limit::set(fim.path.bin.self, cmd_set->option, cmd_set->value), "E::Failed to set limit");
+    }
+    else if(auto cmd_del = std::get_if<CmdLimit::Del>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_limit::del(fim.path.bin.self, cmd_del->option), "E::Failed to delete limit");
+    }
+    else if(std::get_if<CmdLimit::List>(&(cmd->sub_cmd)))
+    {
+      auto limit = Pop(ns_db::ns_limit::get(fim.path.bin.self), "E::Failed to read limits");
+      for(auto const& [file,value] : limit.files)
+      {
+        std::println("{}={}", file, value);
+      }
+      if(limit.is_accounting)
+      {
+        std::println("accounting=on");
+      }
+      if(not limit.affinity.empty())
+      {
+        std::println("affinity={}", limit.affinity);
+      }
+      if(not limit.affinity_fuse.empty())
+      {
+        std::println("affinity.fuse={}", limit.affinity_fuse);
+      }
+    }
+    else if(std::get_if<CmdLimit::Clear>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_limit::clear(fim.path.bin.self), "E::Failed to clear limits");
+    }
+    else
+    {
+      return Error("C::Invalid limit sub-command");
+    }
+  }
   // Configure remote URL
   else if ( auto cmd = std::get_if<ns_parser::CmdRemote>(&variant_cmd) )
   {
@@ -427,28 +811,70 @@ using namespace ns_parser::ns_interface;
       return Error("C::Invalid remote sub-command");
     }
   }
+  // Update the image from a published copy
+  else if ( auto cmd = std::get_if<ns_parser::CmdUpdate>(&variant_cmd) )
+  {
+    uint64_t offset_layers = FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE;
+    if(std::get_if<CmdUpdate::Apply>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_cmd::ns_update::apply(fim.path.bin.self
+        , offset_layers
+        , Pop(ns_db::ns_remote::get_update(fim.path.bin.self), "E::Failed to get update URL")
+        , Pop(ns_db::ns_remote::get_update_key(fim.path.bin.self), "E::Failed to get update key")
+        , fim.path.dir.app_sbin / "wget"
+        , fim.path.dir.host_data_tmp / "update"
+      ), "E::Failed to update the image");
+    }
+    else if(auto cmd_publish = std::get_if<CmdUpdate::Publish>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_cmd::ns_update::publish(fim.path.bin.self
+        , offset_layers
+        , cmd_publish->path_dir_dst
+        , cmd_publish->path_file_key
+        , Pop(ns_db::ns_remote::get_update_key(fim.path.bin.self), "E::Failed to get update key")
+      ), "E::Failed to publish the image");
+    }
+    else if(auto cmd_keygen = std::get_if<CmdUpdate::Keygen>(&(cmd->sub_cmd)))
+    {
+      std::println("{}", Pop(ns_cmd::ns_update::keygen(cmd_keygen->path_file_key), "E::Failed to generate key"));
+    }
+    else if(auto cmd_set = std::get_if<CmdUpdate::Set>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_remote::set_update(fim.path.bin.self, cmd_set->url, cmd_set->key), "E::Failed to set update URL");
+    }
+    else if(std::get_if<CmdUpdate::Show>(&(cmd->sub_cmd)))
+    {
+      std::println("{}", Pop(ns_db::ns_remote::get_update(fim.path.bin.self), "E::Failed to get update URL"));
+      std::println("{}", ns_ed25519::to_hex(Pop(ns_db::ns_remote::get_update_key(fim.path.bin.self), "E::Failed to get update key")));
+    }
+    else if(std::get_if<CmdUpdate::Clear>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_db::ns_remote::clear_update(fim.path.bin.self), "E::Failed to clear update URL");
+    }
+    else
+    {
+      return Error("C::Invalid update sub-command");
+    }
+  }
   // Fetch and install recipes
   else if ( auto cmd = std::get_if<ns_parser::CmdRecipe>(&variant_cmd) )
   {
-    auto f_fetch = [&fim](std::string const& recipe, bool use_existing) -> Value<std::vector<std::string>>
+    auto f_fetch = [&fim](std::vector<std::string> const& recipes, bool use_existing) -> Value<std::vector<ns_recipe::Resolved>>
     {
       return ns_recipe::fetch(
           fim.distribution
         , Pop(ns_db::ns_remote::get(fim.path.bin.self), "E::Failed to get remote URL")
         , fim.path.dir.app_sbin / "wget"
         , fim.path.dir.host_data
-        , recipe
+        , recipes
         , use_existing
       );
     };
 
     if(auto cmd_fetch = std::get_if<CmdRecipe::Fetch>(&(cmd->sub_cmd)))
     {
-      // Fetch recipes with dependencies, always download when fetch command is called directly
-      for(auto const& recipe : cmd_fetch->recipes)
-      {
-        Pop(f_fetch(recipe, false), "E::Failed to fetch recipe");
-      }
+      // Fetch recipes with dependencies, always revalidate when fetch command is called directly
+      Pop(f_fetch(cmd_fetch->recipes, false), "E::Failed to fetch recipe");
     }
     else if(auto cmd_info = std::get_if<CmdRecipe::Info>(&(cmd->sub_cmd)))
     {
@@ -459,16 +885,14 @@ using namespace ns_parser::ns_interface;
     }
     else if(auto cmd_install = std::get_if<CmdRecipe::Install>(&(cmd->sub_cmd)))
     {
-      std::vector<std::string> all_recipes;
-      // Fetch all recipes and dependencies, overwrite existing
-      for(auto const& recipe : cmd_install->recipes)
-      {
-        std::vector<std::string> sub_recipes = Pop(f_fetch(recipe, true), "E::Failed to fetch recipe");
-        std::ranges::copy(sub_recipes, std::back_inserter(all_recipes));
-      }
+      // Fetch all recipes and dependencies, use existing
+      std::vector<ns_recipe::Resolved> all_recipes = Pop(f_fetch(cmd_install->recipes, true), "E::Failed to fetch recipe");
       fim.flags.is_root = 1;
+      // Share the package cache with other flatimages, if enabled
+      auto cache = Pop(ns_recipe::get_package_cache(fim), "E::Failed to configure the shared package cache");
+      if(cache) { vec_bind_command = cache->binds; }
       // Install all packages and dependencies
-      return ns_recipe::install(fim, fim.distribution, fim.path.dir.host_data, all_recipes, f_bwrap);
+      return ns_recipe::install(fim, fim.distribution, all_recipes, cache, f_bwrap);
     }
     else
     {
@@ -508,6 +932,22 @@ using namespace ns_parser::ns_interface;
         std::println("{}:{}", i++, instance.path.filename().string());
       }
     }
+    else if(auto cmd_serve = std::get_if<CmdInstance::Serve>(&(cmd->sub_cmd)))
+    {
+      return_if(ns_cmd::ns_instance::Lease::acquire(fim.path.dir.app / "instance", fim.path.bin.self)
+        , Error("C::An instance already serves this binary")
+      );
+      // Publish this instance, the server removes the serve file once idle
+      [[maybe_unused]] auto server = Pop(ns_cmd::ns_instance::Server::create(fim.path.dir.instance
+        , fim.path.bin.self
+        , std::chrono::seconds(cmd_serve->timeout)
+      ));
+      // The program of the instance lives as long as the serve file
+      fs::path path_file_serve = ns_cmd::ns_instance::path_file_serve(fim.path.dir.instance);
+      return f_bwrap(std::string{"sh"}
+        , std::vector<std::string>{"-c", R"(while [ -e "$0" ]; do sleep 1; done)", path_file_serve.string()}
+      );
+    }
     else
     {
       return Error("C::Invalid instance operation");
@@ -523,11 +963,33 @@ using namespace ns_parser::ns_interface;
     {
       std::println("{}", std::string{fuse.overlay_type});
     }
+    else if(auto cmd_fallback = std::get_if<CmdOverlay::Fallback>(&(cmd->sub_cmd)))
+    {
+      Pop(ns_reserved::ns_overlay::write_fallback(fim.path.bin.self, cmd_fallback->overlay), "E::Failed to set overlay fallback");
+    }
     else
     {
       return Error("C::Invalid operation for fim-overlay");
     }
   }
+  else if ( auto cmd = std::get_if<ns_parser::CmdBench>(&variant_cmd) )
+  {
+    if(auto cmd_overlay = std::get_if<CmdBench::Overlay>(&(cmd->sub_cmd)))
+    {
+      auto overlay = Pop(ns_cmd::ns_bench::overlay(fim.logs.filesystems
+        , fuse
+        , fim.path.dir.host_data_tmp / "bench"
+      ), "E::Failed to benchmark overlay filesystems");
+      if(cmd_overlay->is_set)
+      {
+        Pop(ns_reserved::ns_overlay::write(fim.path.bin.self, overlay), "E::Failed to set overlay type");
+      }
+    }
+    else
+    {
+      return Error("C::Invalid operation for fim-bench");
+    }
+  }
   else if ( auto cmd = std::get_if<ns_parser::CmdUnshare>(&variant_cmd) )
   {
     if(auto cmd_set = std::get_if<CmdUnshare::Set>(&(cmd->sub_cmd)))
@@ -555,6 +1017,66 @@ using namespace ns_parser::ns_interface;
       return Error("C::Invalid operation for fim-unshare");
     }
   }
+  else if ( auto cmd = std::get_if<ns_parser::CmdStats>(&variant_cmd) )
+  {
+    using ns_filesystems::ns_utils::Instance;
+    // Get instances, with their ids as listed by fim-instance
+    auto instances = ns_filesystems::ns_utils::get_instances(fim.path.dir.app / "instance");
+    return_if(instances.size() == 0, Error("C::No instances are running"));
+    return_if(cmd->id and (*cmd->id < 0 or static_cast<size_t>(*cmd->id) >= instances.size())
+      , Error("C::Instance index out of bounds")
+    );
+    ns_db::Db db;
+    for(int32_t i = 0; Instance const& instance : instances)
+    {
+      int32_t id = i++;
+      continue_if(cmd->id and *cmd->id != id);
+      ns_stats::Counters counters = Pop(ns_stats::read(instance.path), "E::Could not read the counters of an instance");
+      // Summaries of the layers mounted with the performance monitor
+      std::vector<std::pair<std::string,std::string>> perfmons;
+      if(fs::path path_dir_layers = instance.path / "layers"; Try(fs::is_directory(path_dir_layers)))
+      {
+        for(fs::path const& path_dir_layer : ns_filesystems::ns_utils::get_mounted_layers(path_dir_layers))
+        {
+          auto summary = ns_filesystems::ns_dwarfs::perfmon(path_dir_layer);
+          continue_if(not summary);
+          perfmons.emplace_back(path_dir_layer.filename().string(), *summary);
+        }
+      }
+      if(cmd->op == CmdStatsOp::JSON)
+      {
+        for(size_t j = 0; j < counters.size(); ++j)
+        {
+          db(std::to_string(instance.pid))(std::string{ns_stats::NAMES[j]}) = counters[j];
+        }
+        for(auto const& [layer,summary] : perfmons)
+        {
+          db(std::to_string(instance.pid))("perfmon")(layer) = summary;
+        }
+      }
+      else
+      {
+        std::println("{}:{}", id, instance.path.filename().string());
+        for(size_t j = 0; j < counters.size(); ++j)
+        {
+          std::println("{}={}", ns_stats::NAMES[j], counters[j]);
+        }
+        for(auto const& [layer,summary] : perfmons)
+        {
+          std::println("perfmon.{}:", layer);
+          for(auto&& line : summary | std::views::split('\n'))
+          {
+            continue_if(std::ranges::empty(line));
+            std::println("  {}", std::string_view(line));
+          }
+        }
+      }
+    }
+    if(cmd->op == CmdStatsOp::JSON)
+    {
+      std::println("{}", Pop(db.dump(), "E::Failed to dump the counters"));
+    }
+  }
   else if ( auto cmd = std::get_if<ns_parser::CmdVersion>(&variant_cmd) )
   {
     if(auto cmd_short = std::get_if<CmdVersion::Short>(&(cmd->sub_cmd)))
@@ -589,7 +1111,7 @@ using namespace ns_parser::ns_interface;
     // Append arguments from argv
     std::copy(argv+1, argv+argc, std::back_inserter(args));
     // Run Bwrap
-    return f_bwrap(program, args);
+    return f_exec(program, args);
   } // else if
   else if ( std::get_if<ns_parser::CmdExit>(&variant_cmd) )
   {
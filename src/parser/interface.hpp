@@ -9,12 +9,15 @@
 #pragma once
 
 #include <filesystem>
+#include <optional>
 #include <set>
 #include <string>
 #include <vector>
 
 #include "../reserved/permissions.hpp"
 #include "../reserved/unshare.hpp"
+#include "../db/perf.hpp"
+#include "../db/limit.hpp"
 #include "../std/enum.hpp"
 #include "../db/bind.hpp"
 #include "cmd/desktop.hpp"
@@ -99,6 +102,16 @@ struct CmdEnv
   std::variant<Add,Clear,Del,List,Set> sub_cmd;
 };
 
+ENUM(CmdConfigOp,APPLY);
+struct CmdConfig
+{
+  struct Apply
+  {
+    fs::path path_file_config;
+  };
+  std::variant<Apply> sub_cmd;
+};
+
 ENUM(CmdDesktopOp,CLEAN,DUMP,ENABLE,SETUP);
 ENUM(CmdDesktopDump,ENTRY,ICON,MIMETYPE);
 struct CmdDesktop
@@ -164,6 +177,91 @@ struct CmdRemote
   std::variant<Clear,Set,Show> sub_cmd;
 };
 
+ENUM(CmdUpdateOp,APPLY,CLEAR,KEYGEN,PUBLISH,SET,SHOW);
+struct CmdUpdate
+{
+  struct Apply
+  {
+  };
+  struct Clear
+  {
+  };
+  struct Keygen
+  {
+    fs::path path_file_key;
+  };
+  struct Publish
+  {
+    fs::path path_dir_dst;
+    fs::path path_file_key;
+  };
+  struct Set
+  {
+    std::string url;
+    std::string key;
+  };
+  struct Show
+  {
+  };
+  std::variant<Apply,Clear,Keygen,Publish,Set,Show> sub_cmd;
+};
+
+ENUM(CmdPerfOp,SET,DEL,LIST,CLEAR,PROFILE,BUDGET,SHM);
+struct CmdPerf
+{
+  struct Set
+  {
+    ns_db::ns_perf::PerfOption option;
+    std::string value;
+    std::optional<uint64_t> index;
+  };
+  struct Del
+  {
+    ns_db::ns_perf::PerfOption option;
+    std::optional<uint64_t> index;
+  };
+  struct List
+  {
+  };
+  struct Clear
+  {
+  };
+  struct Profile
+  {
+    ns_db::ns_perf::Mkdwarfs mkdwarfs;
+  };
+  struct Budget
+  {
+    std::string value;
+  };
+  struct Shm
+  {
+    std::string value;
+  };
+  std::variant<Set,Del,List,Clear,Profile,Budget,Shm> sub_cmd;
+};
+
+ENUM(CmdLimitOp,SET,DEL,LIST,CLEAR);
+struct CmdLimit
+{
+  struct Set
+  {
+    ns_db::ns_limit::LimitOption option;
+    std::string value;
+  };
+  struct Del
+  {
+    ns_db::ns_limit::LimitOption option;
+  };
+  struct List
+  {
+  };
+  struct Clear
+  {
+  };
+  std::variant<Set,Del,List,Clear> sub_cmd;
+};
+
 ENUM(CmdRecipeOp,FETCH,INFO,INSTALL);
 struct CmdRecipe
 {
@@ -182,8 +280,9 @@ struct CmdRecipe
   std::variant<Fetch,Info,Install> sub_cmd;
 };
 
-ENUM(CmdLayerOp,ADD,COMMIT,CREATE,LIST);
-ENUM(CmdLayerCommitOp,BINARY,LAYER,FILE);
+ENUM(CmdLayerOp,ADD,COMMIT,CREATE,LIST,SQUASH,REBASE,VERIFY,SNAPSHOT,LAZY,REMOVE,COMPACT);
+ENUM(CmdLayerCommitOp,BINARY,LAYER,FILE,STREAM);
+ENUM(CmdLayerSnapshotOp,CREATE,DELETE,LIST,RESTORE);
 struct CmdLayer
 {
   struct Add
@@ -202,7 +301,12 @@ struct CmdLayer
     {
       fs::path path_file_dst;
     };
-    std::variant<Binary,Layer,File> sub_cmd;
+    struct Stream
+    {
+      fs::path path_stream;
+    };
+    std::variant<Binary,Layer,File,Stream> sub_cmd;
+    std::optional<ns_db::ns_perf::Mkdwarfs> mkdwarfs;
   };
   struct Create
   {
@@ -212,7 +316,52 @@ struct CmdLayer
   struct List
   {
   };
-  std::variant<Add,Commit,Create,List> sub_cmd;
+  struct Squash
+  {
+    std::optional<uint64_t> index_begin;
+    std::optional<uint64_t> index_end;
+  };
+  struct Rebase
+  {
+    uint64_t index_begin;
+    uint64_t index_end;
+  };
+  struct Verify
+  {
+    bool is_quick;
+  };
+  struct Lazy
+  {
+    bool is_lazy;
+    fs::path path_file_layer;
+  };
+  struct Remove
+  {
+    uint64_t index;
+  };
+  struct Compact
+  {
+  };
+  struct Snapshot
+  {
+    struct Create
+    {
+      std::optional<std::string> name;
+    };
+    struct Delete
+    {
+      std::string name;
+    };
+    struct List
+    {
+    };
+    struct Restore
+    {
+      std::string name;
+    };
+    std::variant<Create,Delete,List,Restore> sub_cmd;
+  };
+  std::variant<Add,Commit,Create,List,Squash,Rebase,Verify,Snapshot,Lazy,Remove,Compact> sub_cmd;
 };
 
 ENUM(CmdBindOp,ADD,DEL,LIST);
@@ -246,7 +395,13 @@ struct CmdCaseFold
   CmdCaseFoldSwitch status;
 };
 
-ENUM(CmdInstanceOp,EXEC,LIST);
+ENUM(CmdVolatileSwitch,ON,OFF);
+struct CmdVolatile
+{
+  CmdVolatileSwitch status;
+};
+
+ENUM(CmdInstanceOp,EXEC,LIST,SERVE);
 struct CmdInstance
 {
   struct Exec
@@ -257,10 +412,14 @@ struct CmdInstance
   struct List
   {
   };
-  std::variant<Exec,List> sub_cmd;
+  struct Serve
+  {
+    uint32_t timeout;
+  };
+  std::variant<Exec,List,Serve> sub_cmd;
 };
 
-ENUM(CmdOverlayOp,SET,SHOW);
+ENUM(CmdOverlayOp,SET,SHOW,FALLBACK);
 struct CmdOverlay
 {
   struct Set
@@ -270,7 +429,21 @@ struct CmdOverlay
   struct Show
   {
   };
-  std::variant<Set,Show> sub_cmd;
+  struct Fallback
+  {
+    ns_reserved::ns_overlay::OverlayType overlay;
+  };
+  std::variant<Set,Show,Fallback> sub_cmd;
+};
+
+ENUM(CmdBenchOp,OVERLAY);
+struct CmdBench
+{
+  struct Overlay
+  {
+    bool is_set;
+  };
+  std::variant<Overlay> sub_cmd;
 };
 
 ENUM(CmdUnshareOp,ADD,CLEAR,DEL,LIST,SET);
@@ -298,6 +471,13 @@ struct CmdUnshare
   std::variant<Add,Clear,Del,List,Set> sub_cmd;
 };
 
+ENUM(CmdStatsOp,SHOW,JSON);
+struct CmdStats
+{
+  CmdStatsOp op;
+  std::optional<int32_t> id;
+};
+
 ENUM(CmdVersionOp,SHORT,FULL,DEPS);
 struct CmdVersion
 {
@@ -347,17 +527,24 @@ using CmdType = std::variant<CmdRoot
   , CmdExec
   , CmdPerms
   , CmdEnv
+  , CmdConfig
   , CmdDesktop
   , CmdLayer
   , CmdBind
   , CmdNotify
   , CmdCaseFold
+  , CmdVolatile
   , CmdBoot
   , CmdRemote
+  , CmdPerf
+  , CmdLimit
   , CmdRecipe
   , CmdInstance
   , CmdOverlay
+  , CmdBench
   , CmdUnshare
+  , CmdStats
+  , CmdUpdate
   , CmdNone
   , CmdExit
   , CmdVersion
@@ -8,10 +8,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <ranges>
 #include <set>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <expected>
 #include <print>
 
@@ -42,6 +46,7 @@ enum class FimCommand
   ROOT,
   PERMS,
   ENV,
+  CONFIG,
   DESKTOP,
   LAYER,
   BIND,
@@ -49,14 +54,53 @@ enum class FimCommand
   CASEFOLD,
   BOOT,
   REMOTE,
+  PERF,
+  LIMIT,
   RECIPE,
   INSTANCE,
   OVERLAY,
+  BENCH,
   UNSHARE,
+  STATS,
+  UPDATE,
   VERSION,
+  VOLATILE,
   HELP
 };
 
+/**
+ * @brief FimCommand entries by name, sorted for a binary search
+ */
+constexpr std::array<std::pair<std::string_view,FimCommand>,24> const FIM_COMMANDS
+{{
+  {"fim-bench",    FimCommand::BENCH},
+  {"fim-bind",     FimCommand::BIND},
+  {"fim-boot",     FimCommand::BOOT},
+  {"fim-casefold", FimCommand::CASEFOLD},
+  {"fim-config",   FimCommand::CONFIG},
+  {"fim-desktop",  FimCommand::DESKTOP},
+  {"fim-env",      FimCommand::ENV},
+  {"fim-exec",     FimCommand::EXEC},
+  {"fim-help",     FimCommand::HELP},
+  {"fim-instance", FimCommand::INSTANCE},
+  {"fim-layer",    FimCommand::LAYER},
+  {"fim-limit",    FimCommand::LIMIT},
+  {"fim-notify",   FimCommand::NOTIFY},
+  {"fim-overlay",  FimCommand::OVERLAY},
+  {"fim-perf",     FimCommand::PERF},
+  {"fim-perms",    FimCommand::PERMS},
+  {"fim-recipe",   FimCommand::RECIPE},
+  {"fim-remote",   FimCommand::REMOTE},
+  {"fim-root",     FimCommand::ROOT},
+  {"fim-stats",    FimCommand::STATS},
+  {"fim-unshare",  FimCommand::UNSHARE},
+  {"fim-update",   FimCommand::UPDATE},
+  {"fim-version",  FimCommand::VERSION},
+  {"fim-volatile", FimCommand::VOLATILE},
+}};
+
+static_assert(std::ranges::is_sorted(FIM_COMMANDS, {}, &std::pair<std::string_view,FimCommand>::first));
+
 /**
  * @brief Convert string to FimCommand enum
  *
@@ -65,24 +109,8 @@ enum class FimCommand
  */
 [[nodiscard]] inline Value<FimCommand> fim_command_from_string(std::string_view str)
 {
-  if (str == "fim-bind")     return FimCommand::BIND;
-  if (str == "fim-boot")     return FimCommand::BOOT;
-  if (str == "fim-casefold") return FimCommand::CASEFOLD;
-  if (str == "fim-desktop")  return FimCommand::DESKTOP;
-  if (str == "fim-env")      return FimCommand::ENV;
-  if (str == "fim-exec")     return FimCommand::EXEC;
-  if (str == "fim-help")     return FimCommand::HELP;
-  if (str == "fim-instance") return FimCommand::INSTANCE;
-  if (str == "fim-layer")    return FimCommand::LAYER;
-  if (str == "fim-notify")   return FimCommand::NOTIFY;
-  if (str == "fim-overlay")  return FimCommand::OVERLAY;
-  if (str == "fim-perms")    return FimCommand::PERMS;
-  if (str == "fim-recipe")   return FimCommand::RECIPE;
-  if (str == "fim-remote")   return FimCommand::REMOTE;
-  if (str == "fim-root")     return FimCommand::ROOT;
-  if (str == "fim-unshare")  return FimCommand::UNSHARE;
-  if (str == "fim-version")  return FimCommand::VERSION;
-
+  auto it = std::ranges::lower_bound(FIM_COMMANDS, str, {}, &std::pair<std::string_view,FimCommand>::first);
+  return_if(it != FIM_COMMANDS.end() and it->first == str, it->second);
   return Error("C::Unknown command: {}", str);
 }
 
@@ -321,6 +349,28 @@ class VecArgs
       return CmdType{cmd_env};
     }
 
+    // Apply a whole configuration at once
+    case FimCommand::CONFIG:
+    {
+      CmdConfigOp op = Pop(CmdConfigOp::from_string(
+        Pop(args.pop_front<"C::Missing op for 'fim-config' (<apply>)">())
+      ), "C::Invalid config operation");
+      CmdConfig cmd_config;
+      switch(op)
+      {
+        case CmdConfigOp::APPLY:
+        {
+          cmd_config.sub_cmd = CmdConfig::Apply {
+            .path_file_config = Pop(args.pop_front<"C::Missing json file for 'apply' operation">())
+          };
+        }
+        break;
+        case CmdConfigOp::NONE: return Error("C::Invalid config operation");
+      }
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-config: {}", args.data()));
+      return cmd_config;
+    }
+
     // Configure desktop
     case FimCommand::DESKTOP:
     {
@@ -413,7 +463,7 @@ class VecArgs
       CmdLayer cmd;
       // Get op
       CmdLayerOp op = Pop(
-        CmdLayerOp::from_string(Pop(args.pop_front<"C::Missing op for 'fim-layer' (create,add,commit,list)">())), "C::Invalid layer operation"
+        CmdLayerOp::from_string(Pop(args.pop_front<"C::Missing op for 'fim-layer' (create,add,commit,list,squash,rebase,verify,snapshot,lazy,remove,compact)">())), "C::Invalid layer operation"
       );
       // Process command
       switch(op)
@@ -442,7 +492,7 @@ class VecArgs
         case CmdLayerOp::COMMIT:
         {
           CmdLayerCommitOp commit_op = Pop(
-              CmdLayerCommitOp::from_string(Pop(args.pop_front<"C::Missing op for 'commit' (binary,layer,file)">()))
+              CmdLayerCommitOp::from_string(Pop(args.pop_front<"C::Missing op for 'commit' (binary,layer,file,stream)">()))
             , "C::Invalid commit operation"
           );
           CmdLayer::Commit cmd_commit;
@@ -465,9 +515,26 @@ class VecArgs
               };
             }
             break;
+            case CmdLayerCommitOp::STREAM:
+            {
+              cmd_commit.sub_cmd = CmdLayer::Commit::Stream{
+                .path_stream = Pop(args.pop_front<"C::Missing destination for 'stream' operation (- or path)">())
+              };
+            }
+            break;
             case CmdLayerCommitOp::NONE: return Error("C::Invalid commit operation");
           }
-          return_if(not args.empty(), Error("C::Trailing arguments for fim-layer commit: {}", args.data()));
+          // Optional trailing profile and mkdwarfs options, overrides the ones of the binary
+          if(not args.empty())
+          {
+            ns_db::ns_perf::Mkdwarfs mkdwarfs;
+            mkdwarfs.profile = Pop(ns_db::ns_perf::profile_from_string(Pop(args.pop_front<"C::Missing profile">())));
+            while(not args.empty())
+            {
+              mkdwarfs.options.push_back(Pop(args.pop_front<"C::Missing mkdwarfs option">()));
+            }
+            cmd_commit.mkdwarfs = mkdwarfs;
+          }
           cmd.sub_cmd = cmd_commit;
         }
         break;
@@ -477,6 +544,127 @@ class VecArgs
           return_if(not args.empty(), Error("C::Trailing arguments for fim-layer list: {}", args.data()));
         }
         break;
+        case CmdLayerOp::SQUASH:
+        {
+          constexpr ns_string::static_string error_msg = "C::squash requires zero or two arguments (<begin> <end>)";
+          CmdLayer::Squash cmd_squash;
+          if(not args.empty())
+          {
+            std::string str_begin = Pop(args.pop_front<error_msg>());
+            std::string str_end = Pop(args.pop_front<error_msg>());
+            return_if(not std::ranges::all_of(str_begin, ::isdigit) or not std::ranges::all_of(str_end, ::isdigit)
+              , Error("C::Index arguments for 'squash' must be numbers")
+            );
+            cmd_squash.index_begin = Try(std::stoull(str_begin), "C::Invalid index");
+            cmd_squash.index_end = Try(std::stoull(str_end), "C::Invalid index");
+          }
+          return_if(not args.empty(), Error("C::{}", error_msg));
+          cmd.sub_cmd = cmd_squash;
+        }
+        break;
+        case CmdLayerOp::REBASE:
+        {
+          // The range is required, rebuilding the base layer by default is too costly
+          constexpr ns_string::static_string error_msg = "C::rebase requires two arguments (<begin> <end>)";
+          std::string str_begin = Pop(args.pop_front<error_msg>());
+          std::string str_end = Pop(args.pop_front<error_msg>());
+          return_if(not std::ranges::all_of(str_begin, ::isdigit) or not std::ranges::all_of(str_end, ::isdigit)
+            , Error("C::Index arguments for 'rebase' must be numbers")
+          );
+          return_if(not args.empty(), Error("C::{}", error_msg));
+          cmd.sub_cmd = CmdLayer::Rebase{
+            .index_begin = Try(std::stoull(str_begin), "C::Invalid index"),
+            .index_end = Try(std::stoull(str_end), "C::Invalid index"),
+          };
+        }
+        break;
+        case CmdLayerOp::VERIFY:
+        {
+          CmdLayer::Verify cmd_verify{.is_quick = false};
+          if(not args.empty())
+          {
+            std::string str_mode = Pop(args.pop_front<"C::Missing mode for fim-layer verify">());
+            return_if(str_mode != "quick", Error("C::Invalid mode '{}' for fim-layer verify (quick)", str_mode));
+            cmd_verify.is_quick = true;
+          }
+          return_if(not args.empty(), Error("C::Trailing arguments for fim-layer verify: {}", args.data()));
+          cmd.sub_cmd = cmd_verify;
+        }
+        break;
+        case CmdLayerOp::SNAPSHOT:
+        {
+          CmdLayerSnapshotOp snapshot_op = Pop(
+              CmdLayerSnapshotOp::from_string(Pop(args.pop_front<"C::Missing op for 'snapshot' (create,delete,list,restore)">()))
+            , "C::Invalid snapshot operation"
+          );
+          CmdLayer::Snapshot cmd_snapshot;
+          switch(snapshot_op)
+          {
+            case CmdLayerSnapshotOp::CREATE:
+            {
+              CmdLayer::Snapshot::Create cmd_create;
+              if(not args.empty())
+              {
+                cmd_create.name = Pop(args.pop_front<"C::Missing name for fim-layer snapshot create">());
+              }
+              cmd_snapshot.sub_cmd = cmd_create;
+            }
+            break;
+            case CmdLayerSnapshotOp::DELETE:
+            {
+              cmd_snapshot.sub_cmd = CmdLayer::Snapshot::Delete
+              {
+                .name = Pop(args.pop_front<"C::Missing name for fim-layer snapshot delete">())
+              };
+            }
+            break;
+            case CmdLayerSnapshotOp::LIST:
+            {
+              cmd_snapshot.sub_cmd = CmdLayer::Snapshot::List{};
+            }
+            break;
+            case CmdLayerSnapshotOp::RESTORE:
+            {
+              cmd_snapshot.sub_cmd = CmdLayer::Snapshot::Restore
+              {
+                .name = Pop(args.pop_front<"C::Missing name for fim-layer snapshot restore">())
+              };
+            }
+            break;
+            case CmdLayerSnapshotOp::NONE: return Error("C::Invalid snapshot operation");
+          }
+          return_if(not args.empty(), Error("C::Trailing arguments for fim-layer snapshot: {}", args.data()));
+          cmd.sub_cmd = cmd_snapshot;
+        }
+        break;
+        case CmdLayerOp::LAZY:
+        {
+          constexpr ns_string::static_string error_msg = "C::lazy requires exactly two arguments (on|off /path/to/file.layer)";
+          std::string str_mode = Pop(args.pop_front<error_msg>());
+          return_if(str_mode != "on" and str_mode != "off", Error("C::Invalid mode '{}' for fim-layer lazy (on,off)", str_mode));
+          cmd.sub_cmd = CmdLayer::Lazy
+          {
+            .is_lazy = (str_mode == "on"),
+            .path_file_layer = Pop(args.pop_front<error_msg>())
+          };
+          return_if(not args.empty(), Error("C::{}", error_msg));
+        }
+        break;
+        case CmdLayerOp::REMOVE:
+        {
+          constexpr ns_string::static_string error_msg = "C::remove requires exactly one argument (<index>)";
+          std::string str_index = Pop(args.pop_front<error_msg>());
+          return_if(not std::ranges::all_of(str_index, ::isdigit), Error("C::Index argument for 'remove' must be a number"));
+          cmd.sub_cmd = CmdLayer::Remove{ .index = Try(std::stoull(str_index), "C::Invalid index") };
+          return_if(not args.empty(), Error("C::{}", error_msg));
+        }
+        break;
+        case CmdLayerOp::COMPACT:
+        {
+          cmd.sub_cmd = CmdLayer::Compact{};
+          return_if(not args.empty(), Error("C::Trailing arguments for fim-layer compact: {}", args.data()));
+        }
+        break;
         case CmdLayerOp::NONE: return Error("C::Invalid layer operation");
       }
       return CmdType(cmd);
@@ -553,6 +741,18 @@ class VecArgs
       return cmd_casefold;
     }
 
+    // Enables or disable discarding the changes of each run
+    case FimCommand::VOLATILE:
+    {
+      constexpr ns_string::static_string msg = "C::Incorrect number of arguments for 'fim-volatile' (<on|off>)";
+      return_if(args.empty(), Error("C::{}", msg));
+      auto cmd_volatile = CmdType(CmdVolatile{
+        Pop(CmdVolatileSwitch::from_string(Pop(args.pop_front<msg>())), "C::Invalid volatile switch")
+      });
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-volatile: {}", args.data()));
+      return cmd_volatile;
+    }
+
     // Set the default startup command
     case FimCommand::BOOT:
     {
@@ -590,6 +790,146 @@ class VecArgs
       return cmd_boot;
     }
 
+    // Configure the dwarfs options of the layers
+    case FimCommand::PERF:
+    {
+      // Check op
+      CmdPerfOp op = Pop(CmdPerfOp::from_string(
+        Pop(args.pop_front<"C::Missing op for 'fim-perf' (<set|del|list|clear|profile|budget|shm>)">())
+      ), "C::Invalid perf operation");
+      // Optional trailing layer index
+      auto f_index = [&]() -> Value<std::optional<uint64_t>>
+      {
+        return_if(args.empty(), std::optional<uint64_t>{});
+        std::string str_index = Pop(args.pop_front<"C::Missing layer index">());
+        return_if(not std::ranges::all_of(str_index, ::isdigit)
+          , Error("C::Layer index argument for 'fim-perf' is not a number")
+        );
+        return Try(std::stoull(str_index), "C::Invalid index");
+      };
+      // Build command
+      CmdPerf cmd_perf;
+      switch(op)
+      {
+        case CmdPerfOp::SET:
+        {
+          constexpr ns_string::static_string msg = "C::Incorrect number of arguments for 'set' (<option> <value> [layer])";
+          auto option = Pop(ns_db::ns_perf::PerfOption::from_string(Pop(args.pop_front<msg>())), "C::Invalid perf option");
+          auto value = Pop(args.pop_front<msg>());
+          cmd_perf.sub_cmd = CmdPerf::Set {
+            .option = option,
+            .value = value,
+            .index = Pop(f_index()),
+          };
+        }
+        break;
+        case CmdPerfOp::DEL:
+        {
+          constexpr ns_string::static_string msg = "C::Incorrect number of arguments for 'del' (<option> [layer])";
+          auto option = Pop(ns_db::ns_perf::PerfOption::from_string(Pop(args.pop_front<msg>())), "C::Invalid perf option");
+          cmd_perf.sub_cmd = CmdPerf::Del {
+            .option = option,
+            .index = Pop(f_index()),
+          };
+        }
+        break;
+        case CmdPerfOp::LIST:
+        {
+          cmd_perf.sub_cmd = CmdPerf::List{};
+        }
+        break;
+        case CmdPerfOp::CLEAR:
+        {
+          cmd_perf.sub_cmd = CmdPerf::Clear{};
+        }
+        break;
+        case CmdPerfOp::PROFILE:
+        {
+          ns_db::ns_perf::Mkdwarfs mkdwarfs;
+          mkdwarfs.profile = Pop(ns_db::ns_perf::profile_from_string(
+            Pop(args.pop_front<"C::Missing profile for 'profile' (<fast|balanced|small|random-access|none> [mkdwarfs options...])">())
+          ));
+          while(not args.empty())
+          {
+            mkdwarfs.options.push_back(Pop(args.pop_front<"C::Missing mkdwarfs option">()));
+          }
+          cmd_perf.sub_cmd = CmdPerf::Profile{ .mkdwarfs = mkdwarfs };
+        }
+        break;
+        case CmdPerfOp::BUDGET:
+        {
+          cmd_perf.sub_cmd = CmdPerf::Budget{
+            .value = Pop(args.pop_front<"C::Missing size for 'budget' (<size|none>)">())
+          };
+        }
+        break;
+        case CmdPerfOp::SHM:
+        {
+          cmd_perf.sub_cmd = CmdPerf::Shm{
+            .value = Pop(args.pop_front<"C::Missing value for 'shm' (<size|hugetlbfs|none>)">())
+          };
+        }
+        break;
+        case CmdPerfOp::NONE: return Error("C::Invalid perf operation");
+      }
+      // Check for trailing arguments
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-perf: {}", args.data()));
+      return cmd_perf;
+    }
+
+    // Set, delete, list or clear the resource limits
+    case FimCommand::LIMIT:
+    {
+      // Check op
+      CmdLimitOp op = Pop(CmdLimitOp::from_string(
+        Pop(args.pop_front<"C::Missing op for 'fim-limit' (<set|del|list|clear>)">())
+      ), "C::Invalid limit operation");
+      // Options are named after their cgroup file, e.g., 'cpu.max'
+      auto f_option = [](std::string str_option) -> Value<ns_db::ns_limit::LimitOption>
+      {
+        std::ranges::replace(str_option, '.', '_');
+        return Pop(ns_db::ns_limit::LimitOption::from_string(str_option), "C::Invalid limit option");
+      };
+      // Build command
+      CmdLimit cmd_limit;
+      switch(op)
+      {
+        case CmdLimitOp::SET:
+        {
+          constexpr ns_string::static_string msg = "C::Incorrect number of arguments for 'set' (<option> <value>)";
+          auto option = Pop(f_option(Pop(args.pop_front<msg>())));
+          auto value = Pop(args.pop_front<msg>());
+          cmd_limit.sub_cmd = CmdLimit::Set {
+            .option = option,
+            .value = value,
+          };
+        }
+        break;
+        case CmdLimitOp::DEL:
+        {
+          constexpr ns_string::static_string msg = "C::Incorrect number of arguments for 'del' (<option>)";
+          cmd_limit.sub_cmd = CmdLimit::Del {
+            .option = Pop(f_option(Pop(args.pop_front<msg>()))),
+          };
+        }
+        break;
+        case CmdLimitOp::LIST:
+        {
+          cmd_limit.sub_cmd = CmdLimit::List{};
+        }
+        break;
+        case CmdLimitOp::CLEAR:
+        {
+          cmd_limit.sub_cmd = CmdLimit::Clear{};
+        }
+        break;
+        case CmdLimitOp::NONE: return Error("C::Invalid limit operation");
+      }
+      // Check for trailing arguments
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-limit: {}", args.data()));
+      return cmd_limit;
+    }
+
     // Set, show, or clear the remote URL
     case FimCommand::REMOTE:
     {
@@ -625,6 +965,47 @@ class VecArgs
       return cmd_remote;
     }
 
+    // Update the image from a published copy
+    case FimCommand::UPDATE:
+    {
+      CmdUpdateOp op = Pop(CmdUpdateOp::from_string(
+        Pop(args.pop_front<"C::Missing op for 'fim-update' (<apply|keygen|publish|set|show|clear>)">())
+      ), "C::Invalid update operation");
+      CmdUpdate cmd_update;
+      switch(op)
+      {
+        case CmdUpdateOp::APPLY: cmd_update.sub_cmd = CmdUpdate::Apply{}; break;
+        case CmdUpdateOp::CLEAR: cmd_update.sub_cmd = CmdUpdate::Clear{}; break;
+        case CmdUpdateOp::SHOW: cmd_update.sub_cmd = CmdUpdate::Show{}; break;
+        case CmdUpdateOp::KEYGEN:
+        {
+          cmd_update.sub_cmd = CmdUpdate::Keygen {
+            .path_file_key = Pop(args.pop_front<"C::Missing key file for 'keygen' operation">())
+          };
+        }
+        break;
+        case CmdUpdateOp::PUBLISH:
+        {
+          cmd_update.sub_cmd = CmdUpdate::Publish {
+            .path_dir_dst = Pop(args.pop_front<"C::Missing directory for 'publish' operation">()),
+            .path_file_key = Pop(args.pop_front<"C::Missing key file for 'publish' operation">())
+          };
+        }
+        break;
+        case CmdUpdateOp::SET:
+        {
+          cmd_update.sub_cmd = CmdUpdate::Set {
+            .url = Pop(args.pop_front<"C::Missing URL for 'set' operation">()),
+            .key = Pop(args.pop_front<"C::Missing key for 'set' operation">())
+          };
+        }
+        break;
+        case CmdUpdateOp::NONE: return Error("C::Invalid update operation");
+      }
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-update: {}", args.data()));
+      return cmd_update;
+    }
+
     // Fetch and install recipes
     case FimCommand::RECIPE:
     {
@@ -669,7 +1050,7 @@ class VecArgs
     // Run a command in an existing instance
     case FimCommand::INSTANCE:
     {
-      constexpr ns_string::static_string msg = "C::Missing op for 'fim-instance' (<exec|list>)";
+      constexpr ns_string::static_string msg = "C::Missing op for 'fim-instance' (<exec|list|serve>)";
       CmdInstanceOp op = Pop(CmdInstanceOp::from_string(Pop(args.pop_front<msg>())), "C::Invalid instance operation");
       CmdInstance cmd;
       switch(op)
@@ -692,6 +1073,23 @@ class VecArgs
           cmd.sub_cmd = CmdInstance::List{};
         }
         break;
+        case CmdInstanceOp::SERVE:
+        {
+          // Idle timeout in seconds, defaults to one minute
+          std::string str_timeout = "60";
+          if(not args.empty())
+          {
+            str_timeout = Pop(args.pop_front<"C::Missing 'timeout' argument">());
+          }
+          return_if(str_timeout.empty() or not std::ranges::all_of(str_timeout, ::isdigit)
+            , Error("C::Timeout argument must be a digit")
+          );
+          cmd.sub_cmd = CmdInstance::Serve
+          {
+            .timeout = static_cast<uint32_t>(Try(std::stoul(str_timeout), "C::Invalid timeout")),
+          };
+        }
+        break;
         case CmdInstanceOp::NONE: return Error("C::Invalid instance operation");
       }
       return_if(not args.empty(), Error("C::Trailing arguments for fim-instance: {}", args.data()));
@@ -701,7 +1099,7 @@ class VecArgs
     // Select or show the current overlay filesystem
     case FimCommand::OVERLAY:
     {
-      constexpr ns_string::static_string msg = "C::Missing op for 'fim-overlay' (<set|show>)";
+      constexpr ns_string::static_string msg = "C::Missing op for 'fim-overlay' (<set|show|fallback>)";
       // Get op
       CmdOverlayOp op = Pop(CmdOverlayOp::from_string(Pop(args.pop_front<msg>())), "C::Invalid overlay operation");
       // Build command
@@ -723,6 +1121,17 @@ class VecArgs
           cmd.sub_cmd = CmdOverlay::Show{};
         }
         break;
+        case CmdOverlayOp::FALLBACK:
+        {
+          auto overlay = Pop(ns_reserved::ns_overlay::OverlayType::from_string(
+            Pop(args.pop_front<"C::Missing argument for 'fallback'">())
+          ), "C::Invalid overlay type");
+          return_if(overlay == ns_reserved::ns_overlay::OverlayType::BWRAP
+            , Error("C::The fallback must be a fuse overlay (<overlayfs|unionfs>)")
+          );
+          cmd.sub_cmd = CmdOverlay::Fallback{ .overlay = overlay };
+        }
+        break;
         case CmdOverlayOp::NONE:
         {
           return Error("C::Invalid operation for fim-overlay");
@@ -732,6 +1141,36 @@ class VecArgs
       return CmdType(cmd);
     }
 
+    // Benchmark the filesystem backends
+    case FimCommand::BENCH:
+    {
+      constexpr ns_string::static_string msg = "C::Missing op for 'fim-bench' (<overlay>)";
+      // Get op
+      CmdBenchOp op = Pop(CmdBenchOp::from_string(Pop(args.pop_front<msg>())), "C::Invalid bench operation");
+      // Build command
+      CmdBench cmd;
+      switch(op)
+      {
+        case CmdBenchOp::OVERLAY:
+        {
+          bool is_set = not args.empty();
+          if(is_set)
+          {
+            std::string str_set = Pop(args.pop_front<"C::Missing argument for 'overlay'">());
+            return_if(str_set != "set", Error("C::Invalid argument for 'overlay': {}", str_set));
+          }
+          cmd.sub_cmd = CmdBench::Overlay{ .is_set = is_set };
+        }
+        break;
+        case CmdBenchOp::NONE:
+        {
+          return Error("C::Invalid operation for fim-bench");
+        }
+      }
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-bench: {}", args.data()));
+      return CmdType(cmd);
+    }
+
     // Configure unshare namespace options
     case FimCommand::UNSHARE:
     {
@@ -787,6 +1226,23 @@ class VecArgs
       return CmdType{cmd_unshare};
     }
 
+    // Show the counters of running instances
+    case FimCommand::STATS:
+    {
+      constexpr ns_string::static_string msg = "C::Missing op for 'fim-stats' (<show|json>)";
+      CmdStats cmd;
+      cmd.op = Pop(CmdStatsOp::from_string(Pop(args.pop_front<msg>())), "C::Invalid stats operation");
+      return_if(cmd.op == CmdStatsOp::NONE, Error("C::Invalid stats operation"));
+      if(not args.empty())
+      {
+        std::string str_id = Pop(args.pop_front<"C::Missing 'id' argument for 'fim-stats'">());
+        return_if(str_id.empty() or not std::ranges::all_of(str_id, ::isdigit), Error("C::Id argument must be a digit"));
+        cmd.id = Try(std::stoi(str_id), "C::Invalid instance ID");
+      }
+      return_if(not args.empty(), Error("C::Trailing arguments for fim-stats: {}", args.data()));
+      return CmdType(cmd);
+    }
+
     // Select or show the current overlay filesystem
     case FimCommand::VERSION:
     {
@@ -818,22 +1274,29 @@ class VecArgs
       std::string help_topic = Pop(args.pop_front<"C::Missing argument for 'fim-help'">());
       std::string message;
 
-      if      (help_topic == "bind")     { message = ns_cmd::ns_help::bind_usage(); }
+      if      (help_topic == "bench")    { message = ns_cmd::ns_help::bench_usage(); }
+      else if (help_topic == "bind")     { message = ns_cmd::ns_help::bind_usage(); }
       else if (help_topic == "boot")     { message = ns_cmd::ns_help::boot_usage(); }
       else if (help_topic == "casefold") { message = ns_cmd::ns_help::casefold_usage(); }
+      else if (help_topic == "config")   { message = ns_cmd::ns_help::config_usage(); }
       else if (help_topic == "desktop")  { message = ns_cmd::ns_help::desktop_usage(); }
       else if (help_topic == "env")      { message = ns_cmd::ns_help::env_usage(); }
       else if (help_topic == "exec")     { message = ns_cmd::ns_help::exec_usage(); }
       else if (help_topic == "instance") { message = ns_cmd::ns_help::instance_usage(); }
       else if (help_topic == "layer")    { message = ns_cmd::ns_help::layer_usage(); }
+      else if (help_topic == "limit")    { message = ns_cmd::ns_help::limit_usage(); }
       else if (help_topic == "notify")   { message = ns_cmd::ns_help::notify_usage(); }
       else if (help_topic == "overlay")  { message = ns_cmd::ns_help::overlay_usage(); }
+      else if (help_topic == "perf")     { message = ns_cmd::ns_help::perf_usage(); }
       else if (help_topic == "perms")    { message = ns_cmd::ns_help::perms_usage(); }
       else if (help_topic == "recipe")   { message = ns_cmd::ns_help::recipe_usage(); }
       else if (help_topic == "remote")   { message = ns_cmd::ns_help::remote_usage(); }
       else if (help_topic == "root")     { message = ns_cmd::ns_help::root_usage(); }
+      else if (help_topic == "stats")    { message = ns_cmd::ns_help::stats_usage(); }
       else if (help_topic == "unshare")  { message = ns_cmd::ns_help::unshare_usage(); }
+      else if (help_topic == "update")   { message = ns_cmd::ns_help::update_usage(); }
       else if (help_topic == "version")  { message = ns_cmd::ns_help::version_usage(); }
+      else if (help_topic == "volatile") { message = ns_cmd::ns_help::volatile_usage(); }
       else
       {
         return Error("C::Invalid argument for help command: {}", help_topic);
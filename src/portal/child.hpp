@@ -8,17 +8,23 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <fcntl.h>
+#include <optional>
 #include <string>
+#include <vector>
 #include <sys/prctl.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "../std/expected.hpp"
 #include "../lib/linux.hpp"
+#include "../lib/linux/socket.hpp"
 #include "../lib/env.hpp"
 #include "../lib/subprocess.hpp"
+#include "../db/portal/environment.hpp"
 #include "../db/portal/message.hpp"
 #include "../db/portal/daemon.hpp"
 #include "config.hpp"
@@ -33,6 +39,9 @@ namespace fs = std::filesystem;
  * It provides functions for spawning processes with their standard I/O streams redirected to
  * FIFO pipes, enabling communication between host and containerized processes. The spawned
  * processes can have custom environments and communicate their PID and exit codes through FIFOs.
+ *
+ * With the socket transport, the dispatcher sends its stdin, stdout and stderr with the message,
+ * the spawned process uses them directly, and the PID and exit code go back through the socket.
  */
 namespace ns_portal::ns_child
 {
@@ -41,6 +50,15 @@ namespace ns_daemon = ns_db::ns_portal::ns_daemon;
 namespace ns_message = ns_db::ns_portal::ns_message;
 
 
+/**
+ * @brief Where a request came from, the fifos of the message or a connected socket
+ */
+struct Channel
+{
+  int fd_socket = -1;                        ///< Connection of the dispatcher, -1 for the fifo transport
+  std::array<int,3> fds_stdio{ -1, -1, -1 }; ///< Stdin, stdout and stderr of the dispatcher
+};
+
 /**
  * @brief Writes a value to a fifo given a file path
  *
@@ -62,6 +80,22 @@ namespace ns_message = ns_db::ns_portal::ns_message;
   return {};
 }
 
+/**
+ * @brief Reports a value to the dispatcher, through the socket or the given fifo
+ *
+ * @param channel The channel of the request
+ * @param value The value to report
+ * @param path_fifo The fifo to write when the request came through the fifo transport
+ * @return Value<void> Success or error
+ */
+[[nodiscard]] inline Value<void> report(Channel const& channel, int const value, fs::path const& path_fifo)
+{
+  return_if(channel.fd_socket < 0, write_fifo(value, path_fifo));
+  std::string_view data(reinterpret_cast<char const*>(&value), sizeof(value));
+  Pop(ns_linux::ns_socket::send(channel.fd_socket, data, {}), "E::Failed to report to dispatcher");
+  return {};
+}
+
 /**
  * @brief Forks a child process and waits for it to complete
  *
@@ -72,12 +106,14 @@ namespace ns_message = ns_db::ns_portal::ns_message;
  * @param logs Logging configuration with paths for log files
  * @param vec_argv Arguments to the child process (first element is the command)
  * @param message Message containing FIFO paths and environment for IPC
+ * @param channel Where the request came from
  * @return Value<void> Success or error
  *
  * @todo Forward grand child pid to a log file
  */
 [[nodiscard]] inline Value<void> spawn(std::vector<std::string> const& vec_argv
-  , ns_db::ns_portal::ns_message::Message const& message)
+  , ns_db::ns_portal::ns_message::Message const& message
+  , Channel const& channel)
 {
   using ns_subprocess::ArgsCallbackParent;
   using ns_subprocess::ArgsCallbackChild;
@@ -87,19 +123,42 @@ namespace ns_message = ns_db::ns_portal::ns_message;
     auto path_bin_program = ns_env::search_path(program);
     if(not path_bin_program)
     {
-      write_fifo(-1, message.get_pid()).discard("C::Failed to write pid to fifo");
-      write_fifo(1, message.get_exit()).discard("C::Failed to write exit code to fifo");
+      report(channel, -1, message.get_pid()).discard("C::Failed to write pid to fifo");
+      report(channel, 1, message.get_exit()).discard("C::Failed to write exit code to fifo");
       return Error("E::Could not find program '{}'", program);
     }
     path_bin_program.value();
   });
   std::vector<std::string> args(vec_argv.begin()+1, vec_argv.end());
+  // The environment is a delta on top of the one inherited from the daemon
+  log_if(not message.get_environment_base().empty()
+      and message.get_environment_base() != ns_db::ns_portal::ns_environment::id(environ)
+    , "W::Environment baseline '{}' does not match the daemon", message.get_environment_base()
+  );
   // Spawn child with a callback to open and redirect FIFOs
-  auto child = ns_subprocess::Subprocess(command)
+  auto subprocess = ns_subprocess::Subprocess(command);
+  for(auto const& key : message.get_environment_unset())
+  {
+    std::ignore = subprocess.rm_var(key);
+  }
+  auto child = subprocess
     .with_args(args)
     .with_env(message.get_environment())
     .with_die_on_pid(getpid())
-    .with_callback_child([&message]([[maybe_unused]] ns_subprocess::ArgsCallbackChild args) {
+    .with_callback_child([&message, &channel]([[maybe_unused]] ns_subprocess::ArgsCallbackChild args) {
+      // Use the stdio of the dispatcher received through the socket
+      if(channel.fd_socket >= 0)
+      {
+        for(int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+        {
+          if(dup2(channel.fds_stdio[fd], fd) < 0)
+          {
+            logger("E::Failed to redirect fd '{}': {}", fd, strerror(errno));
+            _exit(1);
+          }
+        }
+        return;
+      }
       // Open stdin FIFO for reading and redirect to stdin (FD 0)
       int fd_stdin = ns_linux::open_with_timeout(message.get_stdin()
         , std::chrono::seconds(SECONDS_TIMEOUT)
@@ -137,12 +196,12 @@ namespace ns_message = ns_db::ns_portal::ns_message;
 
   // Write pid to fifo
   pid_t pid_child = child->get_pid().value_or(-1);
-  write_fifo(pid_child, message.get_pid()).discard("C::Failed to write pid to fifo");
+  report(channel, pid_child, message.get_pid()).discard("C::Failed to write pid to fifo");
   // Wait for child to finish
   int code = Pop(child->wait(), "E::Child exited abnormally");
   logger("D::Exit code: {}", code);
   // Send exit code of child through a fifo
-  write_fifo(code, message.get_exit()).discard("C::Failed to write exit code to fifo");
+  report(channel, code, message.get_exit()).discard("C::Failed to write exit code to fifo");
   return {};
 }
 
@@ -154,9 +213,12 @@ namespace ns_message = ns_db::ns_portal::ns_message;
  *
  * @param logs Logging configuration with paths for log files
  * @param message The message containing the command, environment, and FIFO paths
+ * @param channel Where the request came from
  * @return Value<void> Success or error (note: exits on success via _exit(0))
  */
-[[nodiscard]] inline Value<void> spawn(ns_daemon::ns_log::Logs logs, ns_message::Message const& message)
+[[nodiscard]] inline Value<void> spawn(ns_daemon::ns_log::Logs logs
+  , ns_message::Message const& message
+  , Channel const& channel = Channel{})
 {
   // Setup child logging
   fs::path path_file_log = ns_fs::placeholders_replace(logs.get_path_file_child(), getpid());
@@ -167,8 +229,63 @@ namespace ns_message = ns_db::ns_portal::ns_message;
   // Ignore on empty command
   if ( vec_argv.empty() ) { return Error("E::Empty command"); }
   // Perform execve
-  Pop(spawn(vec_argv, message));
+  Pop(spawn(vec_argv, message, channel));
   return {};
 }
 
+/**
+ * @brief Receives a request from a connected dispatcher
+ *
+ * The request is a single frame, the stdio of the dispatcher arrives with its first bytes. A
+ * session sends its requests one after the other through the same connection, each after the exit
+ * code of the previous one was reported.
+ *
+ * @param fd_socket The accepted connection of the dispatcher
+ * @param channel Where to store the connection and the received stdio
+ * @return Value<std::optional<ns_message::Message>> The request, nothing if the dispatcher closed
+ * the connection between requests, or the respective error
+ */
+[[nodiscard]] inline Value<std::optional<ns_message::Message>> receive(int fd_socket, Channel& channel)
+{
+  ns_message::Frames frames;
+  std::vector<int> fds;
+  std::array<char, SIZE_BUFFER_READ> buffer;
+  for(bool is_partial = false; true; is_partial = true)
+  {
+    size_t size = Pop(ns_linux::ns_socket::recv(fd_socket, buffer, fds));
+    return_if(size == 0 and not is_partial, std::nullopt);
+    return_if(size == 0, Error("E::Dispatcher closed the connection during a request"));
+    frames.push(std::string_view(buffer.data(), size));
+    auto frame = Pop(frames.next());
+    continue_if(not frame);
+    if(fds.size() != 3)
+    {
+      std::ranges::for_each(fds, ::close);
+      return Error("E::Expected 3 file descriptors, received {}", fds.size());
+    }
+    channel = Channel{ .fd_socket = fd_socket, .fds_stdio = { fds[0], fds[1], fds[2] } };
+    return Pop(ns_message::deserialize(*frame));
+  }
+}
+
+/**
+ * @brief Receives the requests of a connected dispatcher and spawns them, until it disconnects
+ *
+ * @param logs Logging configuration with paths for log files
+ * @param fd_socket The accepted connection of the dispatcher
+ * @return Value<void> Success or error
+ */
+[[nodiscard]] inline Value<void> serve(ns_daemon::ns_log::Logs logs, int fd_socket)
+{
+  while(true)
+  {
+    Channel channel;
+    auto message = Pop(receive(fd_socket, channel));
+    return_if(not message, {});
+    auto ret = spawn(logs, *message, channel);
+    std::ranges::for_each(channel.fds_stdio, ::close);
+    Pop(ret);
+  }
+}
+
 } // namespace ns_portal::ns_child
\ No newline at end of file
@@ -34,9 +34,6 @@ namespace fs = std::filesystem;
 } // anonymous namespace
 
 using Daemon = ns_db::ns_portal::ns_daemon::Daemon;
-using Logs = ns_db::ns_portal::ns_daemon::ns_log::Logs;
-
-namespace ns_daemon = ns_db::ns_portal::ns_daemon;
 
 /**
  * @brief Manages portal daemon for inter-process communication
@@ -51,7 +48,7 @@ class Portal
     Portal();
 
   public:
-    friend Value<std::unique_ptr<Portal>> spawn(Daemon const& daemon, Logs const& logs);
+    friend Value<std::unique_ptr<Portal>> spawn(Daemon const& daemon, fs::path const& path_file_snapshot, fs::path const& path_file_supervisor);
     friend constexpr std::unique_ptr<Portal> std::make_unique<Portal>();
 };
 
@@ -68,10 +65,14 @@ inline Portal::Portal()
  * @brief Spawns a new portal daemon instance
  *
  * @param daemon Daemon configuration
- * @param logs Logging configuration
+ * @param path_file_snapshot Snapshot with the configuration and the logs of the daemon
+ * @param path_file_supervisor File with the mounts the daemon cleans if the reference process
+ * exits without removing it, empty to leave the cleanup to the janitor
  * @return Value containing unique pointer to Portal or error
  */
-[[nodiscard]] inline Value<std::unique_ptr<Portal>> spawn(Daemon const& daemon, Logs const& logs)
+[[nodiscard]] inline Value<std::unique_ptr<Portal>> spawn(Daemon const& daemon
+  , fs::path const& path_file_snapshot
+  , fs::path const& path_file_supervisor = {})
 {
   auto portal = std::make_unique<Portal>();
   // Path to daemon
@@ -81,10 +82,14 @@ inline Portal::Portal()
   // Create a portal that uses the reference file to create an unique communication key
   // Spawn process to background
   portal->m_child = ns_subprocess::Subprocess(path_bin_daemon)
-    .with_var("FIM_DAEMON_CFG", Pop(ns_daemon::serialize(daemon)))
-    .with_var("FIM_DAEMON_LOG", Pop(ns_daemon::ns_log::serialize(logs)))
+    .with_var("FIM_SNAPSHOT", path_file_snapshot.string())
+    .with_var("FIM_DAEMON_MODE", daemon.get_mode().lower())
+    .with_var("FIM_DAEMON_SUPERVISOR", path_file_supervisor.string())
     .with_daemon()
     .spawn();
+  return_if(not portal->m_child or portal->m_child->get_pid().value_or(-1) < 0
+    , Error("E::Could not spawn portal daemon")
+  );
   return portal;
 }
 
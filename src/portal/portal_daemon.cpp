@@ -7,75 +7,117 @@
  */
 
 #include <cerrno>
-#include <chrono>
 #include <cstdlib>
 #include <expected>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
-#include <thread>
 #include <string>
 #include <csignal>
 #include <filesystem>
+#include <print>
+#include <set>
 #include <unistd.h>
 
 #include "../std/expected.hpp"
 #include "../lib/log.hpp"
 #include "../lib/env.hpp"
+#include "../lib/linux.hpp"
+#include "../lib/stats.hpp"
 #include "../lib/linux/fifo.hpp"
+#include "../lib/linux/socket.hpp"
+#include "../db/portal/environment.hpp"
 #include "../db/portal/message.hpp"
 #include "../db/portal/daemon.hpp"
+#include "../db/portal/snapshot.hpp"
+#include "../filesystems/supervisor.hpp"
 #include "../macro.hpp"
 #include "config.hpp"
 #include "child.hpp"
+#include "worker.hpp"
 
 extern char** environ;
 
 namespace fs = std::filesystem;
 namespace ns_message = ns_db::ns_portal::ns_message;
 namespace ns_daemon = ns_db::ns_portal::ns_daemon;
-
-// https://stackoverflow.com/questions/24931456/how-does-sig-atomic-t-actually-work
-// https://en.cppreference.com/w/cpp/utility/program/sig_atomic_t.html
-// https://man7.org/linux/man-pages/man7/signal-safety.7.html
-// https://www.cs.wm.edu/~smherwig/courses/csci415-common/signals/sig_atomic/index.html
-volatile std::sig_atomic_t G_CONTINUE = 1;
+namespace ns_snapshot = ns_db::ns_portal::ns_snapshot;
+namespace ns_environment = ns_db::ns_portal::ns_environment;
 
 /**
- * @brief Signal handler for daemon cleanup
+ * @brief Starts the daemon in the background and replaces this process with a program
  *
- * Sets the G_CONTINUE flag to 0 to signal the daemon's main loop to exit.
+ * Used as the entry point of the sandbox, in place of a shell that runs the daemon with nohup and
+ * then the program. The forked daemon is detached from the terminal and its standard streams,
+ * and keeps the pid of the program as parent. Only returns in the daemon process.
  *
- * @param sig Signal number (unused)
+ * @param argv The program to run and its arguments
  */
-void cleanup([[maybe_unused]] int sig)
+void init(char** argv)
 {
-  G_CONTINUE = 0;
+  if(pid_t pid = fork(); pid < 0)
+  {
+    logger("E::Could not fork portal daemon: {}", strerror(errno));
+  }
+  else if(pid == 0)
+  {
+    // Same as '&>/dev/null nohup daemon & disown'
+    signal(SIGHUP, SIG_IGN);
+    if(int fd_null = ::open("/dev/null", O_RDWR); fd_null >= 0)
+    {
+      dup2(fd_null, STDIN_FILENO);
+      dup2(fd_null, STDOUT_FILENO);
+      dup2(fd_null, STDERR_FILENO);
+      if(fd_null > STDERR_FILENO) { close(fd_null); }
+    }
+    return;
+  }
+  execvp(argv[0], argv);
+  // Save errno before printing can change it, same exit codes as a shell
+  int err = errno;
+  std::println(stderr, "{}: {}", argv[0], strerror(err));
+  _exit((err == ENOENT)? 127 : 126);
 }
 
 /**
  * @brief Entry point for the portal daemon
  *
+ * Without arguments it runs the daemon. With arguments, it runs them as a program and the daemon
+ * in the background, see init().
+ *
+ * @param argc Argument count
+ * @param argv Argument vector, the optional program to run and its arguments
  * @return int Exit code (0 for success, non-zero for failure)
  */
-int main()
+int main(int argc, char** argv)
 {
-  // Register cleanup signal handler
-  signal(SIGTERM, cleanup);
+  if(argc > 1)
+  {
+    init(argv + 1);
+  }
+
   // Ignore SIGPIPE - when parent dies and pipe readers close, we can still cleanup
   signal(SIGPIPE, SIG_IGN);
 
+  // Shutdown and child exits are read from a signalfd in the main loop, children restore the mask
+  sigset_t mask_signals, mask_original;
+  sigemptyset(&mask_signals);
+  sigaddset(&mask_signals, SIGTERM);
+  sigaddset(&mask_signals, SIGINT);
+  sigaddset(&mask_signals, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_signals, &mask_original);
+
   auto __expected_fn = [](auto&& e){ logger("E::{}", e.error()); return EXIT_FAILURE; };
   // Notify
   logger("D::Started host daemon");
 
-  // Retrieve daemon configuration from environment variables or command-line arguments
-  std::string daemon_cfg_str = Pop(ns_env::get_expected("FIM_DAEMON_CFG"));
-  std::string daemon_log_str = Pop(ns_env::get_expected("FIM_DAEMON_LOG"));
-
-  // Parse arguments
-  auto args_cfg = Pop(ns_daemon::deserialize(daemon_cfg_str));
-  auto args_log = Pop(ns_daemon::ns_log::deserialize(daemon_log_str));
+  // Retrieve the daemon configuration from the snapshot of the instance, FIM_DAEMON_CFG and
+  // FIM_DAEMON_LOG take precedence
+  std::string mode = ns_env::get_expected<"Q">("FIM_DAEMON_MODE").value_or("host");
+  auto args_cfg = Pop(ns_daemon::deserialize(Pop(ns_snapshot::read("FIM_DAEMON_CFG", "daemon_" + mode))));
+  auto args_log = Pop(ns_daemon::ns_log::deserialize(Pop(ns_snapshot::read("FIM_DAEMON_LOG", "log_" + mode))));
 
   // Configure logger file
   ns_log::set_sink_file(args_log.get_path_file_parent());
@@ -83,7 +125,7 @@ int main()
 
   // Create a fifo to receive commands from
   fs::path path_fifo_in = Pop(ns_linux::ns_fifo::create(args_cfg.get_path_fifo_listen()));
-  int fd_fifo = ::open(path_fifo_in.c_str(), O_RDONLY | O_NONBLOCK);
+  int fd_fifo = ::open(path_fifo_in.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
   return_if(fd_fifo < 0
     , EXIT_FAILURE
     , "E::Could not open file '{}': {}", path_fifo_in, strerror(errno)
@@ -91,71 +133,188 @@ int main()
   logger("D::Listening fifo {}", path_fifo_in);
 
   // Create dummy writter to keep fifo open
-  [[maybe_unused]] int fd_dummy = ::open(path_fifo_in.c_str(), O_WRONLY);
+  [[maybe_unused]] int fd_dummy = ::open(path_fifo_in.c_str(), O_WRONLY | O_CLOEXEC);
   return_if(fd_dummy < 0
     , EXIT_FAILURE
     , "E::Could not open dummy writer in '{}', {}", path_fifo_in, strerror(errno)
   );
 
+  // Create a socket for dispatchers that send their stdio, the fifo remains as a fallback
+  fs::path path_socket = args_cfg.get_path_socket_listen();
+  auto socket = ns_linux::ns_socket::listen(path_socket);
+  int fd_socket = socket.value_or(-1);
+  log_if(not socket, "W::Using only the fifo transport: {}", socket.error());
+  log_if(socket, "D::Listening socket {}", path_socket);
+
+  // Publish the environment of the daemon, dispatchers only send what differs from it
+  fs::path path_file_environment = args_cfg.get_path_file_environment();
+  ns_environment::write(path_file_environment, environ)
+    .discard("W::Dispatchers will send their whole environment");
+
   // Get reference pid to the main flatimage program
   pid_t pid_reference = args_cfg.get_pid_reference();
 
-  // ::read is non-blocking due to O_NONBLOCK, but make sure that any other
-  // operation that might hang do not leave the daemon running after the parent
-  // dies
-  [[maybe_unused]] auto thread_sig = std::jthread([pid_reference,pid=getpid()]
+  // Mounts of the reference process to clean if it exits without un-mounting them
+  fs::path path_file_supervisor = ns_env::get_expected<"Q">("FIM_DAEMON_SUPERVISOR").value_or("");
+  log_if(not path_file_supervisor.empty(), "D::Supervising the mounts in '{}'", path_file_supervisor);
+  bool is_reference_exit = false;
+
+  // Signals that stop the daemon or report the exit of a child
+  int fd_signal = ::signalfd(-1, &mask_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  return_if(fd_signal < 0, EXIT_FAILURE, "E::Could not create signalfd: {}", strerror(errno));
+
+  // Readable when the reference process exits. Without pidfd, the kernel can signal the death of
+  // the parent with SIGTERM if it is the direct parent, otherwise check it once a second
+  ns_linux::PidFd pidfd(pid_reference);
+  bool is_pdeathsig = pidfd.fd() < 0
+    and ::getppid() == pid_reference
+    and ::prctl(PR_SET_PDEATHSIG, SIGTERM) == 0
+    and ::getppid() == pid_reference;
+  int timeout_ms = (pidfd.fd() < 0 and not is_pdeathsig)? 1000 : -1;
+
+  // Optional pre-forked workers, and the maximum number of concurrent requests
+  auto f_env_size = [](char const* name)
+  {
+    return Catch(std::stoul(ns_env::get_expected<"Q">(name).value_or("0"))).value_or(0);
+  };
+  size_t const max_requests = f_env_size("FIM_PORTAL_MAX_REQUESTS");
+  ns_portal::ns_worker::Pool pool(f_env_size("FIM_PORTAL_WORKERS"), args_log, mask_original);
+  // Children forked for requests when no worker is idle
+  std::set<pid_t> children;
+  auto f_is_full = [&]{ return max_requests > 0 and children.size() + pool.busy() >= max_requests; };
+  // Sends a request to a worker, or to a new child if all are busy
+  auto f_dispatch = [&](std::string_view frame, int fd_conn, auto&& f_child)
   {
-    while(kill(pid_reference, 0) == 0)
+    if(pool.dispatch(frame, fd_conn))
+    {
+      ns_stats::add(ns_stats::Counter::PORTAL_WORKERS);
+      return;
+    }
+    if(pid_t pid = fork(); pid < 0)
+    {
+      logger("E::Could not fork child");
+    }
+    else if (pid == 0)
+    {
+      sigprocmask(SIG_SETMASK, &mask_original, nullptr);
+      f_child();
+      ns_log::flush();
+      _exit(0);
+    }
+    else
     {
-      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      ns_stats::add(ns_stats::Counter::PORTAL_FORKS);
+      children.insert(pid);
     }
-    kill(pid, SIGTERM);
-  });
+  };
 
-  // Recover messages
-  for(char buffer[16384];  G_CONTINUE;)
+  // Sleep until a message, a signal or the exit of the reference process
+  ns_message::Frames frames;
+  std::vector<pollfd> fds;
+  for(char buffer[SIZE_BUFFER_READ]; true;)
   {
-    ssize_t bytes_read = ::read(fd_fifo, &buffer, SIZE_BUFFER_READ);
-    // Check if the read was success full, should try again, or stop
-    // == 0 -> EOF
-    // <  0 -> error (possible retry, because of non-blocking operation)
-    // >  0 -> Possibly valid data to parse
-    if (bytes_read == 0)
+    // Spawn the requests already read, up to the limit of concurrent requests
+    for(bool is_frame = true; is_frame and not f_is_full();)
     {
-      break;
+      auto frame = frames.next();
+      break_if(not frame, "E::Could not read frame: {}", frame.error());
+      is_frame = frame->has_value();
+      continue_if(not is_frame);
+      std::string_view msg = frame->value();
+      logger("D::Recovered message: {}", msg);
+      // Validate and deserialize message
+      auto message = ns_message::deserialize(msg);
+      continue_if(not message, "E::Could not parse message: {}", message.error());
+      f_dispatch(Pop(ns_message::frame(msg)), -1, [&]
+      {
+        ns_portal::ns_child::spawn(args_log, message.value()).discard("C::Could not spawn grandchild");
+      });
     }
-    else if (bytes_read < 0)
+    // Stop reading new requests while at the limit, they wait in the fifo and socket backlog
+    bool is_full = f_is_full();
+    fds.assign({
+        { .fd = fd_fifo, .events = static_cast<short>(is_full? 0 : POLLIN), .revents = 0 }
+      , { .fd = fd_signal, .events = POLLIN, .revents = 0 }
+      , { .fd = pidfd.fd(), .events = POLLIN, .revents = 0 }
+      , { .fd = fd_socket, .events = static_cast<short>(is_full? 0 : POLLIN), .revents = 0 }
+    });
+    pool.poll_fds(fds);
+    int ready = ::poll(fds.data(), fds.size(), timeout_ms);
+    continue_if(ready < 0 and errno == EINTR);
+    break_if(ready < 0, "E::Could not poll portal daemon: {}", strerror(errno));
+    // Reference process exited, a negative fd is ignored by poll
+    is_reference_exit = (fds[2].revents & (POLLIN | POLLHUP)) or (ready == 0 and not pidfd.is_alive());
+    break_if(is_reference_exit, "D::Reference process {} exited", pid_reference);
+    // Workers that finished a request
+    pool.on_ready(fds);
+    // Shutdown request, or reap the children that served their requests
+    if(fds[1].revents & POLLIN)
     {
-      if (errno == EAGAIN or errno == EWOULDBLOCK)
+      bool is_shutdown = false;
+      for(signalfd_siginfo info; ::read(fd_signal, &info, sizeof(info)) == sizeof(info);)
       {
-        std::this_thread::sleep_for(std::chrono::milliseconds{100});
-        continue;
+        is_shutdown |= (info.ssi_signo != SIGCHLD);
       }
-      else
+      for(pid_t pid; (pid = ::waitpid(-1, nullptr, WNOHANG)) > 0;)
       {
-        break;
+        continue_if(children.erase(pid));
+        std::ignore = pool.on_exit(pid);
       }
+      break_if(is_shutdown, "D::Received shutdown signal");
     }
-    // Create a safe view over read data
-    std::string_view msg{buffer, static_cast<size_t>(bytes_read)};
-    logger("D::Recovered message: {}", msg);
-    // Validate and deserialize message
-    auto message = ns_message::deserialize(msg);
-    continue_if(not message, "E::Could not parse message: {}", message.error());
-    // Spawn child
-    if(pid_t pid = fork(); pid < 0)
-    {
-      logger("E::Could not fork child");
-    }
-    else if (pid == 0)
+    // Accept the pending connections, each one is served by a worker or a child
+    if(fds[3].revents & POLLIN)
     {
-      ns_portal::ns_child::spawn(args_log, message.value()).discard("C::Could not spawn grandchild");
-      _exit(0);
+      for(int fd_conn; not f_is_full() and (fd_conn = ::accept4(fd_socket, nullptr, nullptr, SOCK_CLOEXEC)) >= 0;)
+      {
+        // Only dispatchers of the same user run commands, whatever the permissions of the socket
+        if(auto uid = ns_linux::ns_socket::peer_uid(fd_conn); not uid or *uid != ::getuid())
+        {
+          logger("E::Rejecting connection of user {}", uid? std::to_string(*uid) : uid.error());
+          close(fd_conn);
+          continue;
+        }
+        f_dispatch(Pop(ns_message::frame("")), fd_conn, [&]
+        {
+          ns_portal::ns_child::serve(args_log, fd_conn).discard("C::Could not serve connection");
+        });
+        close(fd_conn);
+      }
     }
+    continue_if(not (fds[0].revents & (POLLIN | POLLHUP)));
+    ssize_t bytes_read = ::read(fd_fifo, &buffer, SIZE_BUFFER_READ);
+    // Check if the read was success full, should try again, or stop
+    // == 0 -> EOF
+    // <  0 -> error (possible retry, because of non-blocking operation)
+    // >  0 -> Possibly valid data to parse
+    break_if(bytes_read == 0);
+    continue_if(bytes_read < 0 and (errno == EAGAIN or errno == EWOULDBLOCK or errno == EINTR));
+    break_if(bytes_read < 0, "E::Could not read fifo: {}", strerror(errno));
+    // Reassemble frames, a read can hold part of a message or several of them
+    frames.push(std::string_view{buffer, static_cast<size_t>(bytes_read)});
   } // for
 
-  logger("D::Portal daemon shutdown, G_CONTINUE={}", G_CONTINUE);
+  logger("D::Portal daemon shutdown");
+
+  // The reference process removes the file after un-mounting its filesystems
+  if(is_reference_exit and not path_file_supervisor.empty() and fs::exists(path_file_supervisor))
+  {
+    logger("E::Reference process with pid '{}' exited without un-mounting its filesystems", pid_reference);
+    if(auto mounts = ns_filesystems::ns_supervisor::read(path_file_supervisor))
+    {
+      ns_filesystems::ns_supervisor::cleanup(*mounts);
+    }
+    std::error_code ec;
+    fs::remove(path_file_supervisor, ec);
+  }
 
+  if(fd_socket >= 0)
+  {
+    close(fd_socket);
+    unlink(path_socket.c_str());
+  }
+  unlink(path_file_environment.c_str());
+  close(fd_signal);
   close(fd_dummy);
   close(fd_fifo);
 
@@ -6,12 +6,21 @@
  * @copyright Copyright (c) 2025 Ruan Formigoni
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <expected>
 #include <fcntl.h>
 #include <filesystem>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <wordexp.h>
+#include <sys/file.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -26,16 +35,24 @@
 #include "../lib/linux.hpp"
 #include "../lib/linux/fifo.hpp"
 #include "../lib/linux/fd.hpp"
+#include "../lib/linux/socket.hpp"
+#include "../lib/stats.hpp"
+#include "../db/portal/environment.hpp"
 #include "../db/portal/message.hpp"
 #include "../db/portal/dispatcher.hpp"
+#include "../db/portal/snapshot.hpp"
 #include "config.hpp"
 
 namespace fs = std::filesystem;
 namespace ns_message = ns_db::ns_portal::ns_message;
 namespace ns_dispatcher = ns_db::ns_portal::ns_dispatcher;
+namespace ns_snapshot = ns_db::ns_portal::ns_snapshot;
+namespace ns_environment = ns_db::ns_portal::ns_environment;
 
 extern char** environ;
 std::optional<pid_t> opt_child = std::nullopt;
+// Processes running in the jobs of a session, zero for an idle job
+std::vector<std::atomic<pid_t>> vec_session_child;
 
 /**
  * @brief Forwards received signal to requested child process
@@ -48,6 +65,10 @@ void signal_handler(int sig)
   {
     kill(opt_child.value(), sig);
   }
+  for(auto const& pid_child : vec_session_child)
+  {
+    if(pid_t pid = pid_child.load(); pid > 0) { kill(pid, sig); }
+  }
 }
 
 /**
@@ -103,26 +124,58 @@ void register_signals()
   // Serialize to json string
   std::string data = Pop(ns_message::serialize(message));
   logger("D::{}", data);
-  // Write to fifo
-  ssize_t size_writen = ns_linux::open_write_with_timeout(path_fifo_daemon
-    , std::chrono::seconds(SECONDS_TIMEOUT)
-    , std::span(data.c_str(), data.length())
-  );
+  data = Pop(ns_message::frame(data));
+  // Open fifo
+  int fd = ns_linux::open_with_timeout(path_fifo_daemon, std::chrono::seconds(SECONDS_TIMEOUT), O_WRONLY);
+  return_if(fd < 0, Error("E::Could not open daemon fifo '{}': {}", path_fifo_daemon, strerror(errno)));
+  // Frames larger than PIPE_BUF are not written atomically, hold the fifo while writing so
+  // concurrent dispatchers do not interleave their frames
+  if(::flock(fd, LOCK_EX) < 0)
+  {
+    logger("W::Could not lock daemon fifo: {}", strerror(errno));
+  }
+  // Write to fifo, the daemon drains it while the frame is written
+  std::span<char const> pending(data.data(), data.size());
+  while(not pending.empty())
+  {
+    ssize_t size_written = ns_linux::write_with_timeout(fd, std::chrono::seconds(SECONDS_TIMEOUT), pending);
+    continue_if(size_written < 0 and errno == EINTR);
+    break_if(size_written <= 0);
+    pending = pending.subspan(size_written);
+  }
+  int err = errno;
+  ::close(fd);
   // Check for errors
-  return (static_cast<size_t>(size_writen) != data.length())?
-      Error("E::Could not write data to daemon({}): {}", size_writen, strerror(errno))
+  return (not pending.empty())?
+      Error("E::Could not write data to daemon({}/{}): {}", data.size() - pending.size(), data.size(), strerror(err))
     : Value<void>{};
 }
 
+/**
+ * @brief Counts a request whose process started
+ *
+ * @param time_request When the request was sent to the daemon
+ */
+void stats_started(std::chrono::steady_clock::time_point const& time_request)
+{
+  using namespace std::chrono;
+  uint64_t latency = duration_cast<microseconds>(steady_clock::now() - time_request).count();
+  ns_stats::add(ns_stats::Counter::PORTAL_REQUESTS);
+  ns_stats::add(ns_stats::Counter::PORTAL_LATENCY_US, latency);
+  ns_stats::max(ns_stats::Counter::PORTAL_LATENCY_MAX_US, latency);
+}
+
 /**
  * @brief Waits for the requested process to finish
  *
- * Forwards the child's stdin/stdout/stderr to itself
+ * Forwards the child's stdin/stdout/stderr to itself in a single event loop
  *
  * @param message The message containing the FIFO paths
+ * @param time_request When the message was sent to the daemon
  * @return Value<int> The process exit code or the respective error
  */
-[[nodiscard]] Value<int> process_wait(ns_message::Message const& message)
+[[nodiscard]] Value<int> process_wait(ns_message::Message const& message
+  , std::chrono::steady_clock::time_point const& time_request)
 {
   // Child pid received through a fifo
   pid_t pid_child;
@@ -133,24 +186,42 @@ void register_signals()
   return_if(bytes_read != sizeof(pid_child), Error("E::{}", strerror(errno)));
   // Check if PID is valid
   return_if(pid_child < 0, Error("E::Could not start PID, program not found?"));
+  stats_started(time_request);
   // Forward signal to pid
   opt_child = pid_child;
   logger("D::Child pid: {}", pid_child);
-  // Connect to stdin, stdout, and stderr with fifos and wait for them to exit
+  // Relay stdin, stdout and stderr through the fifos until the process exits, the fifos are
+  // opened in the same order as the process opens them
+  int fd_stdin = ns_linux::open_with_timeout(message.get_stdin(), std::chrono::seconds(SECONDS_TIMEOUT), O_WRONLY);
+  int fd_stdout = ns_linux::open_with_timeout(message.get_stdout(), std::chrono::seconds(SECONDS_TIMEOUT), O_RDONLY);
+  int fd_stderr = ns_linux::open_with_timeout(message.get_stderr(), std::chrono::seconds(SECONDS_TIMEOUT), O_RDONLY);
+  if(fd_stdin < 0 or fd_stdout < 0 or fd_stderr < 0)
+  {
+    logger("E::Could not open the stdio fifos of the process: {}", strerror(errno));
+    std::ranges::for_each(std::array{ fd_stdin, fd_stdout, fd_stderr }, [](int fd){ if(fd >= 0) { ::close(fd); } });
+  }
+  else
   {
-    std::jthread thread_stdin([pid_child, message]
+    for(int fd : { fd_stdin, fd_stdout, fd_stderr })
     {
-      ns_linux::ns_fd::redirect_fd_to_file(pid_child, STDIN_FILENO, message.get_stdin()).discard();
-    });
-    std::jthread thread_stdout([pid_child, message]
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    logger("D::Connected to stdin/stdout/stderr fifos");
+    std::array<ns_linux::ns_fd::Relay,3> const relays{{
+        { .fd_src = STDIN_FILENO, .fd_dst = fd_stdin, .is_input = true }
+      , { .fd_src = fd_stdout, .fd_dst = STDOUT_FILENO, .is_input = false }
+      , { .fd_src = fd_stderr, .fd_dst = STDERR_FILENO, .is_input = false }
+    }};
+    if(auto bytes = ns_linux::ns_fd::relay(pid_child, relays))
     {
-      ns_linux::ns_fd::redirect_file_to_fd(pid_child, message.get_stdout(), STDOUT_FILENO).discard();
-    });
-    std::jthread thread_stderr([pid_child, message]
+      ns_stats::add(ns_stats::Counter::PORTAL_BYTES_RELAYED, *bytes);
+    }
+    else
     {
-      ns_linux::ns_fd::redirect_file_to_fd(pid_child, message.get_stderr(), STDERR_FILENO).discard();
-    });
-    logger("D::Connected to stdin/stdout/stderr fifos");
+      logger("E::Could not relay the stdio of the process: {}", bytes.error());
+    }
+    ::close(fd_stdout);
+    ::close(fd_stderr);
   }
   // Open exit code fifo and retrieve the exit code of the requested process
   int code_exit{};
@@ -162,34 +233,242 @@ void register_signals()
   return code_exit;
 }
 
+/**
+ * @brief Reads an integer reported by the daemon through the socket
+ *
+ * @param fd_socket The connection to the daemon
+ * @return Value<int> The integer, or the respective error
+ */
+[[nodiscard]] Value<int> socket_read_int(int fd_socket)
+{
+  int value{};
+  std::vector<int> fds;
+  for(size_t offset = 0; offset < sizeof(value);)
+  {
+    auto buf = std::span(reinterpret_cast<char*>(&value) + offset, sizeof(value) - offset);
+    size_t size = Pop(ns_linux::ns_socket::recv(fd_socket, buf, fds));
+    return_if(size == 0, Error("E::Daemon closed the connection"));
+    offset += size;
+  }
+  std::ranges::for_each(fds, ::close);
+  return value;
+}
+
+/**
+ * @brief Requests a process through the daemon socket
+ *
+ * The given stdin, stdout and stderr are sent with the message, so the requested process uses them
+ * directly and nothing is relayed. The pid and the exit code of the process come back through the
+ * connection, which can carry another request afterwards.
+ *
+ * @param fd_socket The connection to the daemon
+ * @param message The message to send
+ * @param fds_stdio The stdin, stdout and stderr of the requested process
+ * @param f_started Called with the pid of the requested process once it started
+ * @return Value<int> The process exit code or the respective error
+ */
+[[nodiscard]] Value<int> process_request_socket(int fd_socket
+  , ns_message::Message const& message
+  , std::array<int,3> const& fds_stdio
+  , std::function<void(pid_t)> const& f_started)
+{
+  std::string data = Pop(ns_message::frame(Pop(ns_message::serialize(message))));
+  auto time_request = std::chrono::steady_clock::now();
+  Pop(ns_linux::ns_socket::send(fd_socket, data, fds_stdio));
+  // Child pid, negative if the process could not start
+  return_if(not ns_linux::poll_with_timeout(fd_socket, POLLIN, std::chrono::seconds(SECONDS_TIMEOUT))
+    , Error("E::Timeout waiting for pid from daemon")
+  );
+  pid_t pid_child = Pop(socket_read_int(fd_socket));
+  if(pid_child < 0)
+  {
+    // The exit code follows, consume it so the connection can be reused
+    std::ignore = socket_read_int(fd_socket);
+    return Error("E::Could not start PID, program not found?");
+  }
+  stats_started(time_request);
+  f_started(pid_child);
+  logger("D::Child pid: {}", pid_child);
+  // Exit code, sent once the process exits
+  return Pop(socket_read_int(fd_socket));
+}
+
+/**
+ * @brief Creates the builder of the messages sent to the daemon
+ *
+ * The builder sends only the difference to the environment of the daemon, computed once, or the
+ * whole environment if the daemon did not publish its environment.
+ *
+ * @param path_file_environment Path to the environment snapshot of the daemon
+ * @param path_dir_fifo Path to the directory of the dispatcher fifos
+ * @return std::function<ns_message::Message(std::vector<std::string> const&)> Builds the message
+ * of a command
+ */
+[[nodiscard]] std::function<ns_message::Message(std::vector<std::string> const&)> message_builder(
+    fs::path const& path_file_environment
+  , fs::path const& path_dir_fifo)
+{
+  ns_environment::Baseline baseline;
+  if(ns_environment::read(path_file_environment, baseline))
+  {
+    auto delta = ns_environment::delta(baseline, environ);
+    logger("D::Environment delta: {} set, {} unset", delta.set.size(), delta.unset.size());
+    return [=, id = baseline.id](std::vector<std::string> const& cmd)
+    {
+      return ns_message::Message(getpid(), cmd, path_dir_fifo, delta.set, delta.unset, id);
+    };
+  }
+  auto environment = std::ranges::subrange(environ, std::unreachable_sentinel)
+    | std::views::take_while([](char* p) { return p != nullptr; })
+    | std::ranges::to<std::vector<std::string>>();
+  return [=](std::vector<std::string> const& cmd)
+  {
+    return ns_message::Message(getpid(), cmd, path_dir_fifo, environment);
+  };
+}
+
 /**
  * @brief Sends a request to the daemon to create a new process
  *
+ * @param path_socket_daemon Path to the socket of the daemon
+ * @param path_fifo_daemon Path to the fifo of the daemon, used if the socket is not available
+ * @param path_file_environment Path to the environment snapshot of the daemon
+ * @param path_dir_fifo Path to the directory of the dispatcher fifos
  * @param cmd Command to request, with it's respective arguments
- * @param daemon_target "host" sends a command to the 'host' daemon and "guest" sends a command to the 'guest' daemon
- * @param path_dir_instance Path to the instance directory to use
  * @return Value<int> The process return code or the respective error
  */
-[[nodiscard]] Value<int> process_request(fs::path const& path_fifo_daemon
+[[nodiscard]] Value<int> process_request(fs::path const& path_socket_daemon
+    , fs::path const& path_fifo_daemon
+    , fs::path const& path_file_environment
     , fs::path const& path_dir_fifo
     , std::vector<std::string> const& cmd
   )
 {
-  using namespace std::chrono_literals;
-  // Get environment
-  auto environment = std::ranges::subrange(environ, std::unreachable_sentinel)
-    | std::views::take_while([](char* p) { return p != nullptr; })
-    | std::ranges::to<std::vector<std::string>>();
   // Build message with dispatcher PID
-  auto message = ns_message::Message(getpid(), cmd, path_dir_fifo, environment);
+  auto message = message_builder(path_file_environment, path_dir_fifo)(cmd);
+  // Prefer the socket transport, fall back to fifos if the daemon does not listen on a socket
+  if(auto fd_socket = ns_linux::ns_socket::connect(path_socket_daemon))
+  {
+    logger("D::Sending message through socket: {}", path_socket_daemon);
+    // A closed stdio descriptor cannot be sent, replace it with /dev/null
+    for(int fd = STDIN_FILENO; fd <= STDERR_FILENO; ++fd)
+    {
+      continue_if(::fcntl(fd, F_GETFD) >= 0);
+      int fd_null = ::open("/dev/null", O_RDWR);
+      if(fd_null >= 0 and fd_null != fd) { ::dup2(fd_null, fd); ::close(fd_null); }
+    }
+    auto code = process_request_socket(*fd_socket
+      , message
+      , { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO }
+      , [](pid_t pid){ opt_child = pid; }
+    );
+    ::close(*fd_socket);
+    return code;
+  }
   // Create fifos and build message
   Pop(fifo_create(message));
   // Create parent directories
   Pop(ns_fs::create_directories(message.get_exit().parent_path()));
   // Send message to daemon
+  auto time_request = std::chrono::steady_clock::now();
   Pop(send_message(message, path_fifo_daemon));
   // Wait for child process and retrieve exit code
-  return Pop(process_wait(message));
+  return Pop(process_wait(message, time_request));
+}
+
+/**
+ * @brief Splits a line of a session into the words of a command
+ *
+ * Words are split and expanded like the shell does, except command substitution.
+ *
+ * @param line The line to split
+ * @return Value<std::vector<std::string>> The command and its arguments, or the respective error
+ */
+[[nodiscard]] Value<std::vector<std::string>> session_split(std::string const& line)
+{
+  wordexp_t words{};
+  int err = ::wordexp(line.c_str(), &words, WRDE_NOCMD);
+  // The words are only allocated, and must be freed, on success or when out of memory
+  if(err == WRDE_NOSPACE) { ::wordfree(&words); }
+  return_if(err == WRDE_CMDSUB, Error("E::Command substitution is not allowed in '{}'", line));
+  return_if(err != 0, Error("E::Invalid command '{}'", line));
+  std::vector<std::string> cmd(words.we_wordv, words.we_wordv + words.we_wordc);
+  ::wordfree(&words);
+  return cmd;
+}
+
+/**
+ * @brief Runs the commands read from stdin through persistent connections to the daemon
+ *
+ * Each line of stdin is a command. Every job holds one connection to the daemon and runs the
+ * commands it takes from stdin one after the other through it, so the fifos, the relay threads
+ * and the startup of a dispatcher are paid once per session instead of once per command. The
+ * commands share the stdout and stderr of the session, their stdin is /dev/null.
+ *
+ * @param path_socket_daemon Path to the socket of the daemon
+ * @param f_message Builds the message of a command
+ * @param jobs Number of commands that run concurrently
+ * @return Value<int> Zero if every command succeeded, the exit code of a failed command otherwise
+ */
+[[nodiscard]] Value<int> process_session(fs::path const& path_socket_daemon
+  , std::function<ns_message::Message(std::vector<std::string> const&)> const& f_message
+  , size_t jobs)
+{
+  int fd_null = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return_if(fd_null < 0, Error("E::Could not open /dev/null: {}", strerror(errno)));
+  std::mutex mutex_stdin;
+  std::atomic<int> code_session = 0;
+  auto f_job = [&](std::atomic<pid_t>& pid_child) -> Value<void>
+  {
+    int fd_socket = -1;
+    for(std::string line; true;)
+    {
+      {
+        std::lock_guard lock(mutex_stdin);
+        break_if(not std::getline(std::cin, line));
+      }
+      auto cmd = session_split(line);
+      continue_if(not cmd, "E::{}", cmd.error());
+      continue_if(cmd->empty());
+      // Connect on the first command, or again after a failure left the connection unusable
+      if(fd_socket < 0)
+      {
+        fd_socket = Pop(ns_linux::ns_socket::connect(path_socket_daemon)
+          , "E::Sessions require the socket transport of the daemon"
+        );
+      }
+      auto code = process_request_socket(fd_socket
+        , f_message(*cmd)
+        , { fd_null, STDOUT_FILENO, STDERR_FILENO }
+        , [&](pid_t pid){ pid_child = pid; }
+      );
+      pid_child = 0;
+      if(not code)
+      {
+        logger("E::{}: {}", line, code.error());
+        code_session = 1;
+        ::close(fd_socket);
+        fd_socket = -1;
+        continue;
+      }
+      if(*code != 0) { code_session = *code; }
+    }
+    if(fd_socket >= 0) { ::close(fd_socket); }
+    return {};
+  };
+  vec_session_child = std::vector<std::atomic<pid_t>>(jobs);
+  {
+    std::vector<std::jthread> threads;
+    for(auto& pid_child : vec_session_child)
+    {
+      threads.emplace_back([&]
+      {
+        if(not f_job(pid_child)) { code_session = 1; }
+      });
+    }
+  }
+  ::close(fd_null);
+  return code_session.load();
 }
 
 /**
@@ -208,16 +487,28 @@ int main(int argc, char** argv)
   std::vector<std::string> args(argv+1, argv+argc);
   // No arguments for portal
   return_if(args.empty(), EXIT_FAILURE, "E::No arguments for dispatcher");
-  // De-serialize FIM_DISPATCHER_CFG
+  // De-serialize FIM_DISPATCHER_CFG, or the dispatcher of the snapshot of the instance
   ns_dispatcher::Dispatcher arg_cfg = Pop(
-    ns_dispatcher::deserialize(Pop(ns_env::get_expected("FIM_DISPATCHER_CFG")))
+    ns_dispatcher::deserialize(Pop(ns_snapshot::read("FIM_DISPATCHER_CFG", "dispatcher")))
   );
   // Set log file
   ns_log::set_sink_file(arg_cfg.get_path_file_log());
   // Register signals
   register_signals();
+  // Run the commands read from stdin in a session, '--session=N' runs N of them concurrently
+  if(std::string_view arg = args.front(); arg == "--session" or arg.starts_with("--session="))
+  {
+    arg.remove_prefix(std::min(arg.size(), std::string_view("--session=").size()));
+    size_t jobs = std::max<size_t>(1, Catch(std::stoul(std::string(arg))).value_or(1));
+    return Pop(process_session(arg_cfg.get_path_socket_daemon()
+      , message_builder(arg_cfg.get_path_file_environment_daemon(), arg_cfg.get_path_dir_fifo())
+      , jobs
+    ), "E::Failure to run portal session");
+  }
   // Request process from daemon
-  return Pop(process_request(arg_cfg.get_path_fifo_daemon()
+  return Pop(process_request(arg_cfg.get_path_socket_daemon()
+    , arg_cfg.get_path_fifo_daemon()
+    , arg_cfg.get_path_file_environment_daemon()
     , arg_cfg.get_path_dir_fifo()
     , args
   ) , "E::Failure to dispatch process request");
@@ -0,0 +1,379 @@
+/**
+ * @file worker.hpp
+ * @author Ruan Formigoni
+ * @brief Pool of pre-forked workers that spawn the requests of the portal daemon
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../std/expected.hpp"
+#include "../std/filesystem.hpp"
+#include "../lib/env.hpp"
+#include "../lib/log.hpp"
+#include "../lib/linux.hpp"
+#include "../lib/linux/socket.hpp"
+#include "../lib/subprocess.hpp"
+#include "../db/portal/message.hpp"
+#include "../db/portal/daemon.hpp"
+#include "../macro.hpp"
+#include "config.hpp"
+#include "child.hpp"
+
+/**
+ * @namespace ns_portal::ns_worker
+ * @brief Pre-forked workers of the portal daemon
+ *
+ * Without workers, the daemon forks a child for each request, which forks again to execute the
+ * program and waits for it. A worker is forked once when the daemon starts and serves requests
+ * one at a time, the program is started with a vfork clone, which does not copy the address space
+ * of the worker, and dies with the worker. The daemon sends each request to an idle worker through a socket pair:
+ * - A request read from the fifo is sent as its frame
+ * - A connection of the socket transport is sent as an empty frame with the connection attached
+ *
+ * The worker writes a single byte back once the program exits and it is idle again. The daemon
+ * forks a child as before when all workers are busy. Workers exit when the daemon closes its end
+ * of the pair, after the request they serve completes.
+ */
+namespace ns_portal::ns_worker
+{
+
+namespace ns_daemon = ns_db::ns_portal::ns_daemon;
+namespace ns_message = ns_db::ns_portal::ns_message;
+using ns_portal::ns_child::Channel;
+using ns_portal::ns_child::report;
+
+/**
+ * @brief Builds the environment of a request, the one of the worker with the message applied
+ *
+ * @param message The message of the request
+ * @return std::vector<std::string> The environment in the format 'KEY=VALUE'
+ */
+[[nodiscard]] inline std::vector<std::string> environment(ns_message::Message const& message)
+{
+  std::unordered_map<std::string_view,std::string_view> vars;
+  auto f_insert = [&](std::string_view entry)
+  {
+    auto pos = entry.find('=');
+    if(pos != std::string_view::npos) { vars[entry.substr(0, pos)] = entry; }
+  };
+  for(char** i = environ; *i != nullptr; ++i) { f_insert(*i); }
+  for(auto const& key : message.get_environment_unset()) { vars.erase(key); }
+  for(auto const& entry : message.get_environment()) { f_insert(entry); }
+  std::vector<std::string> env;
+  env.reserve(vars.size());
+  std::ranges::transform(vars, std::back_inserter(env), [](auto&& e){ return std::string(e.second); });
+  return env;
+}
+
+/**
+ * @brief Spawns the program of a request and waits for it
+ *
+ * @param message The message of the request
+ * @param channel Where the request came from
+ * @return Value<void> Success or error
+ */
+[[nodiscard]] inline Value<void> run(ns_message::Message const& message, Channel const& channel)
+{
+  auto f_fail = [&]
+  {
+    report(channel, -1, message.get_pid()).discard("C::Failed to write pid to fifo");
+    report(channel, 1, message.get_exit()).discard("C::Failed to write exit code to fifo");
+  };
+  auto const& vec_argv = message.get_command();
+  if(vec_argv.empty()) { f_fail(); return Error("E::Empty command"); }
+  auto path_bin_program = ns_env::search_path(vec_argv.front());
+  if(not path_bin_program) { f_fail(); return Error("E::Could not find program '{}'", vec_argv.front()); }
+  // Stdio of the dispatcher, or the fifos of the request
+  std::array<int,3> fds = channel.fds_stdio;
+  bool is_fifo = channel.fd_socket < 0;
+  if(is_fifo)
+  {
+    fds[0] = ns_linux::open_with_timeout(message.get_stdin(), std::chrono::seconds(SECONDS_TIMEOUT), O_RDONLY);
+    fds[1] = ns_linux::open_with_timeout(message.get_stdout(), std::chrono::seconds(SECONDS_TIMEOUT), O_WRONLY);
+    fds[2] = ns_linux::open_with_timeout(message.get_stderr(), std::chrono::seconds(SECONDS_TIMEOUT), O_WRONLY);
+  }
+  auto f_close = [&]{ if(is_fifo) { std::ranges::for_each(fds, [](int fd){ if(fd >= 0) { ::close(fd); } }); } };
+  if(std::ranges::any_of(fds, [](int fd){ return fd < 0; }))
+  {
+    f_close();
+    f_fail();
+    return Error("E::Failed to open the stdio of the request: {}", strerror(errno));
+  }
+  // Arguments and environment
+  std::vector<std::string> env = environment(message);
+  std::vector<char*> argv, envp;
+  std::ranges::transform(vec_argv, std::back_inserter(argv), [](auto&& e){ return const_cast<char*>(e.c_str()); });
+  std::ranges::transform(env, std::back_inserter(envp), [](auto&& e){ return const_cast<char*>(e.c_str()); });
+  argv.push_back(nullptr);
+  envp.push_back(nullptr);
+  // Redirect stdio, start with the default signal mask and die with the worker, like the
+  // children of the daemon
+  ns_subprocess::Shim shim
+  {
+    .program = path_bin_program->c_str(),
+    .argv = argv.data(),
+    .envp = envp.data(),
+    .fds_stdio = fds,
+    .fds_close = { -1, -1, -1, -1, -1, -1 },
+    .pid_die = getpid(),
+    .affinity = nullptr,
+    .mask = {},
+    .failure = nullptr,
+    .err = 0,
+  };
+  pid_t pid_child = ns_subprocess::clone_shim(shim, true);
+  f_close();
+  if(pid_child < 0 or shim.failure != nullptr)
+  {
+    if(pid_child > 0) { while(::waitpid(pid_child, nullptr, 0) < 0 and errno == EINTR) {} }
+    f_fail();
+    return Error("E::Could not spawn '{}': {}", *path_bin_program, strerror(shim.err));
+  }
+  report(channel, pid_child, message.get_pid()).discard("C::Failed to write pid to fifo");
+  // Wait for the program, a signal is reported like the shell does
+  int status = 0;
+  while(::waitpid(pid_child, &status, 0) < 0 and errno == EINTR) {}
+  int code = WIFEXITED(status)? WEXITSTATUS(status) : WIFSIGNALED(status)? 128 + WTERMSIG(status) : 1;
+  logger("D::Exit code: {}", code);
+  report(channel, code, message.get_exit()).discard("C::Failed to write exit code to fifo");
+  return {};
+}
+
+/**
+ * @brief Main loop of a worker, serves the requests sent by the daemon until it closes the pair
+ *
+ * @param logs Logging configuration with paths for log files
+ * @param fd_pair The end of the socket pair of the worker
+ */
+[[noreturn]] inline void work(ns_daemon::ns_log::Logs const& logs, int fd_pair)
+{
+  fs::path path_file_log = ns_fs::placeholders_replace(logs.get_path_file_child(), getpid());
+  std::error_code ec;
+  fs::create_directories(path_file_log.parent_path(), ec);
+  ns_log::set_sink_file(path_file_log);
+  ns_message::Frames frames;
+  std::vector<int> fds;
+  std::array<char, SIZE_BUFFER_READ> buffer;
+  while(true)
+  {
+    auto size = ns_linux::ns_socket::recv(fd_pair, buffer, fds);
+    // The daemon exited
+    if(not size or *size == 0) { ns_log::flush(); _exit(0); }
+    frames.push(std::string_view(buffer.data(), *size));
+    for(auto frame = frames.next(); frame and frame->has_value(); frame = frames.next())
+    {
+      if(frame->value().empty() and not fds.empty())
+      {
+        int fd_conn = fds.front();
+        fds.erase(fds.begin());
+        // A connection of the socket transport, a session sends several requests through it
+        for(Channel channel; true; channel = Channel{})
+        {
+          auto message = ns_portal::ns_child::receive(fd_conn, channel);
+          break_if(not message, "E::Could not receive request: {}", message.error());
+          break_if(not message->has_value());
+          run(message->value(), channel).discard("E::Could not run request");
+          std::ranges::for_each(channel.fds_stdio, ::close);
+        }
+        ::close(fd_conn);
+      }
+      else if(auto message = ns_message::deserialize(frame->value()))
+      {
+        run(*message, Channel{}).discard("E::Could not run request");
+      }
+      // Idle again
+      char const done = 1;
+      while(::write(fd_pair, &done, 1) < 0 and errno == EINTR) {}
+    }
+  }
+}
+
+/**
+ * @class Pool
+ * @brief The workers of the daemon and their state
+ */
+class Pool
+{
+  private:
+    struct Worker
+    {
+      pid_t pid;
+      int fd;
+      bool is_busy;
+    };
+    ns_daemon::ns_log::Logs m_logs;
+    sigset_t m_mask;
+    std::vector<Worker> m_workers;
+
+    [[nodiscard]] Value<Worker> fork_worker() const;
+
+  public:
+    Pool(size_t size, ns_daemon::ns_log::Logs const& logs, sigset_t const& mask);
+    ~Pool();
+    Pool(Pool const&) = delete;
+    Pool(Pool&&) = delete;
+    Pool& operator=(Pool const&) = delete;
+    Pool& operator=(Pool&&) = delete;
+    [[nodiscard]] size_t busy() const;
+    [[nodiscard]] bool dispatch(std::string_view frame, int fd_conn);
+    [[nodiscard]] bool on_exit(pid_t pid);
+    void on_ready(std::vector<pollfd> const& fds);
+    void poll_fds(std::vector<pollfd>& fds) const;
+};
+
+/**
+ * @brief Construct a new Pool object and fork its workers
+ *
+ * @param size The number of workers
+ * @param logs Logging configuration with paths for log files
+ * @param mask The signal mask of the workers
+ */
+inline Pool::Pool(size_t size, ns_daemon::ns_log::Logs const& logs, sigset_t const& mask)
+  : m_logs(logs)
+  , m_mask(mask)
+  , m_workers()
+{
+  for(size_t i = 0; i < size; ++i)
+  {
+    auto worker = fork_worker();
+    break_if(not worker, "E::Could not fork worker: {}", worker.error());
+    m_workers.push_back(*worker);
+  }
+  logger("D::Started {} portal workers", m_workers.size());
+}
+
+/**
+ * @brief Destroy the Pool object, the workers exit once their requests finish
+ */
+inline Pool::~Pool()
+{
+  std::ranges::for_each(m_workers, [](auto&& e){ ::close(e.fd); });
+}
+
+/**
+ * @brief Forks a worker connected to the daemon by a socket pair
+ *
+ * @return Value<Worker> The worker, or the respective error
+ */
+inline Value<Pool::Worker> Pool::fork_worker() const
+{
+  int fds[2];
+  return_if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0
+    , Error("E::Could not create socket pair: {}", strerror(errno))
+  );
+  pid_t pid = ::fork();
+  if(pid == 0)
+  {
+    ::close(fds[0]);
+    // Close the pairs of the other workers, their workers would not see the daemon exit
+    for(auto const& worker : m_workers) { ::close(worker.fd); }
+    sigprocmask(SIG_SETMASK, &m_mask, nullptr);
+    work(m_logs, fds[1]);
+  }
+  ::close(fds[1]);
+  if(pid < 0)
+  {
+    ::close(fds[0]);
+    return Error("E::Could not fork: {}", strerror(errno));
+  }
+  return Worker{ .pid = pid, .fd = fds[0], .is_busy = false };
+}
+
+/**
+ * @brief Gets the number of workers serving a request
+ *
+ * @return size_t The number of busy workers
+ */
+inline size_t Pool::busy() const
+{
+  return std::ranges::count_if(m_workers, [](auto&& e){ return e.is_busy; });
+}
+
+/**
+ * @brief Sends a request to an idle worker
+ *
+ * @param frame The frame of the request, or an empty frame for a connection
+ * @param fd_conn The connection of the socket transport, or -1
+ * @return bool True if a worker took the request, false if all workers are busy or failed
+ */
+inline bool Pool::dispatch(std::string_view frame, int fd_conn)
+{
+  auto it = std::ranges::find_if(m_workers, [](auto&& e){ return not e.is_busy; });
+  return_if(it == m_workers.end(), false);
+  std::vector<int> fds;
+  if(fd_conn >= 0) { fds.push_back(fd_conn); }
+  auto ret = ns_linux::ns_socket::send(it->fd, frame, fds);
+  return_if(not ret, false, "E::Could not send request to worker {}: {}", it->pid, ret.error());
+  it->is_busy = true;
+  return true;
+}
+
+/**
+ * @brief Replaces a worker that exited
+ *
+ * @param pid The pid of the process that exited
+ * @return bool True if the process was a worker
+ */
+inline bool Pool::on_exit(pid_t pid)
+{
+  auto it = std::ranges::find_if(m_workers, [&](auto&& e){ return e.pid == pid; });
+  return_if(it == m_workers.end(), false);
+  logger("W::Portal worker {} exited, replacing it", pid);
+  ::close(it->fd);
+  m_workers.erase(it);
+  if(auto worker = fork_worker())
+  {
+    m_workers.push_back(*worker);
+  }
+  return true;
+}
+
+/**
+ * @brief Marks the workers that reported completion as idle
+ *
+ * @param fds The polled descriptors, the ones of the workers are checked
+ */
+inline void Pool::on_ready(std::vector<pollfd> const& fds)
+{
+  for(auto const& pfd : fds)
+  {
+    continue_if(not (pfd.revents & POLLIN));
+    auto it = std::ranges::find_if(m_workers, [&](auto&& e){ return e.fd == pfd.fd; });
+    continue_if(it == m_workers.end());
+    char buf[64];
+    ssize_t n = ::recv(it->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if(n > 0) { it->is_busy = false; }
+  }
+}
+
+/**
+ * @brief Appends the descriptors of the workers to a poll set
+ *
+ * @param fds The poll set
+ */
+inline void Pool::poll_fds(std::vector<pollfd>& fds) const
+{
+  for(auto const& worker : m_workers)
+  {
+    fds.push_back(pollfd{ .fd = worker.fd, .events = POLLIN, .revents = 0 });
+  }
+}
+
+} // namespace ns_portal::ns_worker
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
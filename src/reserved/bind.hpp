@@ -64,11 +64,10 @@ inline Value<void> write(fs::path const& path_file_binary, std::string_view cons
  */
 inline Value<std::string> read(fs::path const& path_file_binary)
 {
-  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_BINDINGS_BEGIN;
-  uint64_t size = ns_reserved::FIM_RESERVED_OFFSET_BINDINGS_END - offset_begin;
-  auto buffer = std::make_unique<char[]>(size);
-  Pop(ns_reserved::read(path_file_binary, offset_begin, buffer.get(), size));
-  return buffer.get();
+  return ns_reserved::read_string(path_file_binary
+    , ns_reserved::FIM_RESERVED_OFFSET_BINDINGS_BEGIN
+    , ns_reserved::FIM_RESERVED_OFFSET_BINDINGS_END
+  );
 }
 
 } // namespace ns_reserved::ns_bind
@@ -9,7 +9,12 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <zlib.h>
 
 #include "../std/expected.hpp"
 #include "../macro.hpp"
@@ -20,10 +25,13 @@
  * @brief Application icon image storage in reserved space
  *
  * This namespace manages embedded icon image data stored in the binary's reserved space.
- * It stores icons in PNG or JPEG format along with the file extension
- * and size metadata. The embedded icon is used for desktop integration, appearing in
- * application launchers, taskbars, and .desktop files. Icons are processed through
- * ImageMagick for resizing as needed.
+ * It stores icons in PNG, JPEG or SVG format along with the file extension, the dimensions of
+ * the decoded image and size metadata. The embedded icon is used for desktop integration,
+ * appearing in application launchers, taskbars, and .desktop files.
+ *
+ * The section starts with a small header followed by the icon data, compressed with zlib when
+ * that makes it smaller, typically for SVG icons. Readers load the header and then only the bytes
+ * in use, instead of the whole section.
  */
 namespace ns_reserved::ns_icon
 {
@@ -33,80 +41,178 @@ namespace
 
 namespace fs = std::filesystem;
 
-}
+// Identifies the header, sections written by older versions start with the extension instead
+constexpr char const MAGIC[4] = {'F', 'I', 'C', '1'};
+
+// Layout of older versions: the extension, the data and its size at the end of the section
+constexpr uint64_t const LEGACY_OFFSET_DATA = 4;
+constexpr uint64_t const LEGACY_OFFSET_SIZE = (1<<20) - 8;
+
+} // namespace
 
 #pragma pack(push, 1)
 /**
- * @brief Stores icon data in reserved space
- *
- * Packed structure for embedding icon image data within the FlatImage binary.
+ * @brief Header of the icon section
  */
-struct Icon
+struct Header
 {
-  char m_ext[4];
-  char m_data[(1<<20) - 12];
-  uint64_t m_size;
-
-  /**
-   * @brief Default constructor, initializes to empty icon
-   */
-  Icon()
-    : m_size(0)
-  {
-    std::fill_n(m_ext, std::size(m_ext), 0);
-    std::fill_n(m_data, std::size(m_data), 0);
-  }
-
-  /**
-   * @brief Constructs an icon with the specified data
-   * @param ext File extension (3 characters + null terminator)
-   * @param data Icon image data
-   * @param size Size of the icon data in bytes
-   */
-  Icon(char* ext, char* data, uint64_t size)
-    : m_size(size)
-  {
-    // xxx + '\0'
-    std::copy(ext, ext+3, m_ext);
-    m_ext[3] = '\0';
-    std::copy(data, data+size, m_data);
-  } // Icon
+  char m_magic[4];            ///< Always MAGIC
+  char m_ext[4];              ///< File extension (3 characters + null terminator)
+  uint32_t m_width;           ///< Width of the decoded image, zero for SVG icons
+  uint32_t m_height;          ///< Height of the decoded image, zero for SVG icons
+  uint64_t m_size;            ///< Size of the icon data in bytes
+  uint64_t m_size_compressed; ///< Size of the stored data, equal to m_size if stored uncompressed
 };
 #pragma pack(pop)
 
 /**
- * @brief Writes the Icon struct to the target binary
+ * @brief An icon read from or to write to the reserved space
+ */
+struct Icon
+{
+  std::string m_ext;  ///< File extension, 'png', 'jpg' or 'svg', empty if there is no icon
+  uint32_t m_width;   ///< Width of the decoded image, zero for SVG icons
+  uint32_t m_height;  ///< Height of the decoded image, zero for SVG icons
+  std::string m_data; ///< Contents of the icon file
+};
+
+/**
+ * @brief Writes the icon to the target binary
  *
- * @param path_file_binary Target binary to write the struct to
- * @param icon Struct to write to the target file as binary data
+ * @param path_file_binary Target binary to write the icon to
+ * @param icon Icon to write to the target file
  * @return Value<void> Nothing on success, or the respective error message
  */
 inline Value<void> write(fs::path const& path_file_binary, Icon const& icon)
 {
+  return_if(icon.m_ext.size() > 3, Error("E::Invalid icon extension '{}'", icon.m_ext));
+  Header header{};
+  std::copy(std::begin(MAGIC), std::end(MAGIC), header.m_magic);
+  std::ranges::copy(icon.m_ext, header.m_ext);
+  header.m_width = icon.m_width;
+  header.m_height = icon.m_height;
+  header.m_size = icon.m_data.size();
+  // Compress the data, PNG and JPEG data usually do not shrink and are stored as is
+  uLongf size_compressed = ::compressBound(icon.m_data.size());
+  std::string data(sizeof(Header) + size_compressed, '\0');
+  int ret = ::compress2(reinterpret_cast<Bytef*>(data.data() + sizeof(Header))
+    , &size_compressed
+    , reinterpret_cast<Bytef const*>(icon.m_data.data())
+    , icon.m_data.size()
+    , Z_BEST_COMPRESSION
+  );
+  if(ret == Z_OK and size_compressed < icon.m_data.size())
+  {
+    header.m_size_compressed = size_compressed;
+    data.resize(sizeof(Header) + size_compressed);
+  }
+  else
+  {
+    header.m_size_compressed = icon.m_data.size();
+    data.resize(sizeof(Header));
+    data.append(icon.m_data);
+  }
+  std::memcpy(data.data(), &header, sizeof(Header));
+  logger("D::Icon of {} bytes stored in {} bytes", header.m_size, header.m_size_compressed);
   uint64_t space_available = ns_reserved::FIM_RESERVED_OFFSET_ICON_END - ns_reserved::FIM_RESERVED_OFFSET_ICON_BEGIN;
-  uint64_t space_required = sizeof(Icon);
+  uint64_t space_required = data.size();
   return_if(space_available < space_required, Error("E::Not enough space to fit icon data: {} vs {}", space_available, space_required));
   Pop(ns_reserved::write(path_file_binary
     , ns_reserved::FIM_RESERVED_OFFSET_ICON_BEGIN
     , ns_reserved::FIM_RESERVED_OFFSET_ICON_END
-    , reinterpret_cast<char const*>(&icon)
-    , sizeof(icon)
+    , data.data()
+    , data.size()
   ));
   return {};
 }
 
+namespace
+{
+
+/**
+ * @brief Reads the header of the icon and locates its data
+ *
+ * Sections written by older versions are converted to a header as stored uncompressed, without
+ * dimensions.
+ *
+ * @param path_file_binary Target binary to read the header from
+ * @return Value<std::pair<Header,uint64_t>> The header and the offset of the data in the binary,
+ * or the respective error message
+ */
+inline Value<std::pair<Header,uint64_t>> read_section(fs::path const& path_file_binary)
+{
+  Header header{};
+  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_ICON_BEGIN;
+  Pop(ns_reserved::read(path_file_binary, offset_begin, reinterpret_cast<char*>(&header), sizeof(Header)));
+  return_if(std::equal(std::begin(MAGIC), std::end(MAGIC), header.m_magic)
+    , std::make_pair(header, offset_begin + sizeof(Header))
+  );
+  // Layout of older versions
+  Header header_legacy{};
+  std::copy(std::begin(MAGIC), std::end(MAGIC), header_legacy.m_magic);
+  std::copy_n(header.m_magic, 3, header_legacy.m_ext);
+  if(header_legacy.m_ext[0] != '\0')
+  {
+    Pop(ns_reserved::read(path_file_binary
+      , offset_begin + LEGACY_OFFSET_SIZE
+      , reinterpret_cast<char*>(&header_legacy.m_size)
+      , sizeof(header_legacy.m_size)
+    ));
+    header_legacy.m_size_compressed = header_legacy.m_size;
+  }
+  return std::make_pair(header_legacy, offset_begin + LEGACY_OFFSET_DATA);
+}
+
+} // namespace
+
 /**
- * @brief Reads the Icon struct from the target binary
+ * @brief Reads the header of the icon from the target binary
  *
- * @param path_file_binary Target binary to write the struct from
- * @return On success it returns the read Icon struct, or the respective error message
+ * @param path_file_binary Target binary to read the header from
+ * @return Value<Header> The header, with an empty extension if there is no icon, or the
+ * respective error message
+ */
+inline Value<Header> read_header(fs::path const& path_file_binary)
+{
+  return Pop(read_section(path_file_binary)).first;
+}
+
+/**
+ * @brief Reads the icon from the target binary
+ *
+ * Only the bytes in use are read from the section.
+ *
+ * @param path_file_binary Target binary to read the icon from
+ * @return On success it returns the read icon, or the respective error message
  */
 inline Value<Icon> read(fs::path const& path_file_binary)
 {
-  Icon icon;
-  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_ICON_BEGIN;
-  uint64_t size = ns_reserved::FIM_RESERVED_OFFSET_ICON_END - offset_begin;
-  Pop(ns_reserved::read(path_file_binary, offset_begin, reinterpret_cast<char*>(&icon), size));
+  auto [header, offset_data] = Pop(read_section(path_file_binary));
+  Icon icon{ .m_ext = std::string(header.m_ext, ::strnlen(header.m_ext, sizeof(header.m_ext)))
+    , .m_width = header.m_width
+    , .m_height = header.m_height
+    , .m_data = {}
+  };
+  return_if(icon.m_ext.empty(), icon);
+  return_if(offset_data + header.m_size_compressed > ns_reserved::FIM_RESERVED_OFFSET_ICON_END
+    , Error("E::Invalid icon size '{}'", header.m_size_compressed)
+  );
+  std::string data(header.m_size_compressed, '\0');
+  Pop(ns_reserved::read(path_file_binary, offset_data, data.data(), data.size()));
+  if(header.m_size_compressed == header.m_size)
+  {
+    icon.m_data = std::move(data);
+    return icon;
+  }
+  // Decompress the stored data
+  icon.m_data.resize(header.m_size);
+  uLongf size = header.m_size;
+  int ret = ::uncompress(reinterpret_cast<Bytef*>(icon.m_data.data())
+    , &size
+    , reinterpret_cast<Bytef const*>(data.data())
+    , data.size()
+  );
+  return_if(ret != Z_OK or size != header.m_size, Error("E::Could not decompress icon data ({})", ret));
   return icon;
 }
 
@@ -10,6 +10,7 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <string>
 
 #include "../std/expected.hpp"
 #include "../macro.hpp"
@@ -38,29 +39,94 @@ namespace fs = std::filesystem;
 
 ENUM(OverlayType, BWRAP, OVERLAYFS, UNIONFS)
 
+namespace
+{
+
 /**
- * @brief Writes a overlay mask to the flatimage binary
- * 
- * @param path_file_binary Path to the flatimage binary
+ * @brief Encodes an overlay type in the low bits of the overlay byte
+ *
  * @param overlay Overlay type enumeration
- * @return Value<void> Nothing on success, or the respective error
+ * @return Value<uint8_t> The mask, or the respective error
  */
-inline Value<void> write(fs::path const& path_file_binary, OverlayType const& overlay)
+[[nodiscard]] inline Value<uint8_t> to_mask(OverlayType const& overlay)
 {
-  uint8_t mask{};
   switch(overlay)
   {
-    case OverlayType::BWRAP: mask = 1 << 1; break;
-    case OverlayType::OVERLAYFS: mask = 1 << 2; break;
-    case OverlayType::UNIONFS: mask = 1 << 3; break;
+    case OverlayType::BWRAP: return 1 << 1;
+    case OverlayType::OVERLAYFS: return 1 << 2;
+    case OverlayType::UNIONFS: return 1 << 3;
     case OverlayType::NONE:
     default: return Error("E::Invalid overlay option");
   }
+}
+
+/**
+ * @brief Decodes an overlay type from the low bits of the overlay byte
+ *
+ * @param mask The mask
+ * @return Value<OverlayType> The overlay type, or the respective error
+ */
+[[nodiscard]] inline Value<OverlayType> from_mask(uint8_t mask)
+{
+  switch(mask)
+  {
+    case 1 << 1: return OverlayType::BWRAP;
+    case 1 << 2: return OverlayType::OVERLAYFS;
+    case 1 << 3: return OverlayType::UNIONFS;
+    default: return std::unexpected("Invalid overlay option");
+  }
+}
+
+/**
+ * @brief Reads the overlay byte from the flatimage binary
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @return Value<uint8_t> The byte, or the respective error
+ */
+[[nodiscard]] inline Value<uint8_t> read_byte(fs::path const& path_file_binary)
+{
+  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_OVERLAY_BEGIN;
+  uint8_t byte;
+  ssize_t bytes = Pop(ns_reserved::read(path_file_binary, offset_begin, reinterpret_cast<char*>(&byte), sizeof(uint8_t)));
+  log_if(bytes != 1, "E::Possible error to read overlay byte, count is {}", bytes);
+  return byte;
+}
+
+/**
+ * @brief Writes the overlay byte to the flatimage binary
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @param byte The byte
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_byte(fs::path const& path_file_binary, uint8_t byte)
+{
   uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_OVERLAY_BEGIN;
   uint64_t offset_end = ns_reserved::FIM_RESERVED_OFFSET_OVERLAY_END;
   uint64_t size = offset_end - offset_begin;
   return_if(size != sizeof(uint8_t), Error("E::Incorrect number of bytes to write overlay mask: {} vs {}", size, sizeof(uint8_t)));
-  return ns_reserved::write(path_file_binary, offset_begin, offset_end, reinterpret_cast<char*>(&mask), sizeof(uint8_t));
+  return ns_reserved::write(path_file_binary, offset_begin, offset_end, reinterpret_cast<char*>(&byte), sizeof(uint8_t));
+}
+
+// The fallback is kept in the high bits of the byte, binaries that never set it read as unionfs
+constexpr uint8_t const FALLBACK_SHIFT = 4;
+
+} // namespace
+
+/**
+ * @brief Writes a overlay mask to the flatimage binary
+ *
+ * The configured fallback is kept.
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @param overlay Overlay type enumeration
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> write(fs::path const& path_file_binary, OverlayType const& overlay)
+{
+  uint8_t mask = Pop(to_mask(overlay));
+  uint8_t byte = read_byte(path_file_binary).value_or(0);
+  return write_byte(path_file_binary, (byte & 0xf0) | mask);
 }
 
 /**
@@ -71,17 +137,41 @@ inline Value<void> write(fs::path const& path_file_binary, OverlayType const& ov
  */
 inline Value<OverlayType> read(fs::path const& path_file_binary)
 {
-  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_OVERLAY_BEGIN;
-  uint8_t mask;
-  ssize_t bytes = Pop(ns_reserved::read(path_file_binary, offset_begin, reinterpret_cast<char*>(&mask), sizeof(uint8_t)));
-  log_if(bytes != 1, "E::Possible error to read overlay byte, count is {}", bytes);
-  switch(mask)
-  {
-    case 1 << 1: return OverlayType::BWRAP;
-    case 1 << 2: return OverlayType::OVERLAYFS;
-    case 1 << 3: return OverlayType::UNIONFS;
-    default: return std::unexpected("Invalid overlay option");
-  }
+  return from_mask(Pop(read_byte(path_file_binary)) & 0x0f);
+}
+
+/**
+ * @brief Writes the fuse overlay used when the kernel overlay of bwrap is unavailable
+ *
+ * The configured overlay type is kept.
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @param overlay OVERLAYFS or UNIONFS
+ * @return Value<void> Nothing on success, or the respective error
+ */
+inline Value<void> write_fallback(fs::path const& path_file_binary, OverlayType const& overlay)
+{
+  return_if(overlay != OverlayType::OVERLAYFS and overlay != OverlayType::UNIONFS
+    , Error("E::The fallback must be a fuse overlay, got '{}'", std::string{overlay})
+  );
+  uint8_t mask = Pop(to_mask(overlay));
+  uint8_t byte = read_byte(path_file_binary).value_or(0);
+  return write_byte(path_file_binary, static_cast<uint8_t>((byte & 0x0f) | (mask << FALLBACK_SHIFT)));
+}
+
+/**
+ * @brief Reads the fuse overlay used when the kernel overlay of bwrap is unavailable
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @return Value<OverlayType> OVERLAYFS or UNIONFS, UNIONFS if it was never set
+ */
+inline Value<OverlayType> read_fallback(fs::path const& path_file_binary)
+{
+  uint8_t mask = Pop(read_byte(path_file_binary)) >> FALLBACK_SHIFT;
+  return_if(mask == 0, OverlayType::UNIONFS);
+  OverlayType overlay = Pop(from_mask(mask));
+  return_if(overlay == OverlayType::BWRAP, Error("E::Invalid overlay fallback"));
+  return overlay;
 }
 
 } // namespace ns_reserved::ns_overlay
@@ -0,0 +1,74 @@
+/**
+ * @file perf.hpp
+ * @author Ruan Formigoni
+ * @brief Manages the performance tuning reserved space
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <string>
+#include <filesystem>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+#include "reserved.hpp"
+
+/**
+ * @namespace ns_reserved::ns_perf
+ * @brief DwarFS tuning options storage in reserved space
+ *
+ * This namespace manages the DwarFS mount options stored as a JSON string in the binary's
+ * reserved space. The options control the block cache size, worker threads, readahead and
+ * memory locking of the dwarfs processes, either for all layers or for a specific layer,
+ * so each image can carry the cache budget that fits its workload.
+ */
+namespace ns_reserved::ns_perf
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+}
+
+/**
+ * @brief Writes the perf json string to the target binary
+ *
+ * @param path_file_binary Target binary to write the json string
+ * @param json Json string to write to the target file as binary data
+ * @return Value<void> Nothing on success, or the respective error message
+ */
+inline Value<void> write(fs::path const& path_file_binary, std::string_view const& json)
+{
+  uint64_t space_available = ns_reserved::FIM_RESERVED_OFFSET_PERF_END - ns_reserved::FIM_RESERVED_OFFSET_PERF_BEGIN;
+  uint64_t space_required = json.size();
+  return_if(space_available <= space_required, Error("E::Not enough space to fit json data"));
+  Pop(ns_reserved::write(path_file_binary
+    , FIM_RESERVED_OFFSET_PERF_BEGIN
+    , FIM_RESERVED_OFFSET_PERF_END
+    , json.data()
+    , json.size()
+  ));
+  return {};
+}
+
+/**
+ * @brief Reads the perf json string from the target binary
+ *
+ * @param path_file_binary Target binary to read the json string
+ * @return On success it returns the read data, or the respective error message
+ */
+inline Value<std::string> read(fs::path const& path_file_binary)
+{
+  return ns_reserved::read_string(path_file_binary
+    , ns_reserved::FIM_RESERVED_OFFSET_PERF_BEGIN
+    , ns_reserved::FIM_RESERVED_OFFSET_PERF_END
+  );
+}
+
+} // namespace ns_reserved::ns_perf
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
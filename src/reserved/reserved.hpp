@@ -13,6 +13,18 @@
 #include <filesystem>
 #include <cstdint>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../common.hpp"
 #include "../macro.hpp"
@@ -80,13 +92,22 @@ struct Reserved
   // unshare
   constexpr static uint64_t const fim_reserved_offset_unshare_begin = fim_reserved_offset_remote_end;
   constexpr static uint64_t const fim_reserved_offset_unshare_end = fim_reserved_offset_unshare_begin + 2;
+  // perf
+  constexpr static uint64_t const fim_reserved_offset_perf_begin = fim_reserved_offset_unshare_end;
+  constexpr static uint64_t const fim_reserved_offset_perf_end = fim_reserved_offset_perf_begin + 4_kib;
+  // limit
+  constexpr static uint64_t const fim_reserved_offset_limit_begin = fim_reserved_offset_perf_end;
+  constexpr static uint64_t const fim_reserved_offset_limit_end = fim_reserved_offset_limit_begin + 4_kib;
+  // volatile
+  constexpr static uint64_t const fim_reserved_offset_volatile_begin = fim_reserved_offset_limit_end;
+  constexpr static uint64_t const fim_reserved_offset_volatile_end = fim_reserved_offset_volatile_begin + 1;
 
   /**
    * @brief Validates reserved space layout at compile-time
    */
   constexpr Reserved()
   {
-    static_assert(fim_reserved_offset_unshare_end < FIM_RESERVED_SIZE, "Insufficient reserved space");
+    static_assert(fim_reserved_offset_volatile_end < FIM_RESERVED_SIZE, "Insufficient reserved space");
   }
 };
 
@@ -126,18 +147,336 @@ uint64_t const FIM_RESERVED_OFFSET_REMOTE_END = FIM_RESERVED_OFFSET + reserved.f
 // Unshare
 uint64_t const FIM_RESERVED_OFFSET_UNSHARE_BEGIN = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_unshare_begin;
 uint64_t const FIM_RESERVED_OFFSET_UNSHARE_END = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_unshare_end;
+// Perf
+uint64_t const FIM_RESERVED_OFFSET_PERF_BEGIN = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_perf_begin;
+uint64_t const FIM_RESERVED_OFFSET_PERF_END = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_perf_end;
+// Limit
+uint64_t const FIM_RESERVED_OFFSET_LIMIT_BEGIN = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_limit_begin;
+uint64_t const FIM_RESERVED_OFFSET_LIMIT_END = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_limit_end;
+// Volatile
+uint64_t const FIM_RESERVED_OFFSET_VOLATILE_BEGIN = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_volatile_begin;
+uint64_t const FIM_RESERVED_OFFSET_VOLATILE_END = FIM_RESERVED_OFFSET + reserved.fim_reserved_offset_volatile_end;
 
 
 
+/**
+ * @class ReservedView
+ * @brief A read-only mapping of the reserved space of a binary
+ *
+ * The reserved space is mapped once per binary and process, every reader then takes views into
+ * the mapping instead of opening and seeking the binary again. Only the pages that are read are
+ * loaded from the file. The mapping is shared, so writes to the binary through write() are
+ * visible in it right away.
+ */
+class ReservedView
+{
+  private:
+    fs::path m_path_file_binary;
+    char const* m_ptr_map;
+    uint64_t m_size_map;
+    uint64_t m_offset_map;
+
+    ReservedView(fs::path const& path_file_binary, char const* ptr_map, uint64_t size_map, uint64_t offset_map);
+
+  public:
+    [[nodiscard]] static ReservedView const* get(fs::path const& path_file_binary);
+    [[nodiscard]] std::optional<std::span<char const>> span(uint64_t offset, uint64_t length) const;
+    ~ReservedView();
+    ReservedView(ReservedView const&) = delete;
+    ReservedView(ReservedView&&) = delete;
+    ReservedView& operator=(ReservedView const&) = delete;
+    ReservedView& operator=(ReservedView&&) = delete;
+};
+
+/**
+ * @brief Construct a new ReservedView object
+ *
+ * @param path_file_binary Path to the mapped binary
+ * @param ptr_map Start of the mapping
+ * @param size_map Size of the mapping
+ * @param offset_map Offset of the start of the mapping in the binary
+ */
+inline ReservedView::ReservedView(fs::path const& path_file_binary
+  , char const* ptr_map
+  , uint64_t size_map
+  , uint64_t offset_map)
+  : m_path_file_binary(path_file_binary)
+  , m_ptr_map(ptr_map)
+  , m_size_map(size_map)
+  , m_offset_map(offset_map)
+{
+}
+
+/**
+ * @brief Destroy the ReservedView object and un-map the reserved space
+ */
+inline ReservedView::~ReservedView()
+{
+  ::munmap(const_cast<char*>(m_ptr_map), m_size_map);
+}
+
+/**
+ * @brief Gets the view of the reserved space of a binary, mapping it on the first call
+ *
+ * @param path_file_binary Path to the binary
+ * @return ReservedView const* The view, or nullptr if the binary could not be mapped
+ */
+[[nodiscard]] inline ReservedView const* ReservedView::get(fs::path const& path_file_binary)
+{
+  static std::mutex mutex;
+  static std::map<fs::path, std::unique_ptr<ReservedView>> views;
+  std::lock_guard lock(mutex);
+  if(auto it = views.find(path_file_binary); it != views.end())
+  {
+    return it->second.get();
+  }
+  // A failed mapping is cached too, the readers fall back to the file
+  auto& view = views[path_file_binary];
+  int fd = ::open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC);
+  return_if(fd < 0, nullptr, "D::Could not open '{}' to map the reserved space", path_file_binary);
+  struct stat st{};
+  if(::fstat(fd, &st) < 0 or static_cast<uint64_t>(st.st_size) <= FIM_RESERVED_OFFSET)
+  {
+    ::close(fd);
+    return nullptr;
+  }
+  // The offset of a mapping must be page aligned, pages past the end of the file cannot be read
+  uint64_t size_page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  uint64_t offset_map = FIM_RESERVED_OFFSET - (FIM_RESERVED_OFFSET % size_page);
+  uint64_t size_map = std::min<uint64_t>(FIM_RESERVED_OFFSET + FIM_RESERVED_SIZE, st.st_size) - offset_map;
+  void* ptr_map = ::mmap(nullptr, size_map, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset_map));
+  ::close(fd);
+  return_if(ptr_map == MAP_FAILED, nullptr, "D::Could not map the reserved space of '{}': {}", path_file_binary, strerror(errno));
+  view.reset(new ReservedView(path_file_binary, static_cast<char const*>(ptr_map), size_map, offset_map));
+  return view.get();
+}
+
+/**
+ * @brief Gets a view of a range of the binary
+ *
+ * @param offset The starting offset in bytes in the binary
+ * @param length The number of bytes
+ * @return std::optional<std::span<char const>> The bytes, or nothing if the range is not mapped
+ */
+[[nodiscard]] inline std::optional<std::span<char const>> ReservedView::span(uint64_t offset, uint64_t length) const
+{
+  return_if(offset < m_offset_map or offset + length > m_offset_map + m_size_map, std::nullopt);
+  return std::span<char const>(m_ptr_map + (offset - m_offset_map), length);
+}
+
+/**
+ * @class Transaction
+ * @brief Collects updates to the reserved space and writes them to the binary at once
+ *
+ * While a transaction is open, write() calls for its binary are staged instead of written.
+ * On commit the binary is opened once, each section is compared with its current contents and
+ * only the range of bytes that changed is written, followed by a single fdatasync. A transaction
+ * destroyed without a commit discards its updates. Reads of a staged section return its staged
+ * contents, so read-modify-write updates of the same section compose within a transaction.
+ */
+class Transaction
+{
+  private:
+    struct Update
+    {
+      uint64_t offset_end;
+      std::string data;
+    };
+    fs::path m_path_file_binary;
+    std::map<uint64_t, Update> m_updates;
+    bool m_is_active;
+
+    [[nodiscard]] static Transaction*& active();
+    [[nodiscard]] Value<void> write_delta(int fd, uint64_t offset_begin, Update const& update);
+
+  public:
+    explicit Transaction(fs::path const& path_file_binary);
+    ~Transaction();
+    [[nodiscard]] static Transaction* get(fs::path const& path_file_binary);
+    [[nodiscard]] Value<void> stage(uint64_t offset_begin, uint64_t offset_end, char const* data, uint64_t length);
+    [[nodiscard]] bool peek(uint64_t offset, char* data, uint64_t length) const;
+    [[nodiscard]] Value<void> commit();
+    Transaction(Transaction const&) = delete;
+    Transaction(Transaction&&) = delete;
+    Transaction& operator=(Transaction const&) = delete;
+    Transaction& operator=(Transaction&&) = delete;
+};
+
+/**
+ * @brief The open transaction of the process
+ *
+ * @return Transaction*& Reference to the pointer of the open transaction, nullptr if none
+ */
+[[nodiscard]] inline Transaction*& Transaction::active()
+{
+  static Transaction* transaction = nullptr;
+  return transaction;
+}
+
+/**
+ * @brief Construct a new Transaction object and open it
+ *
+ * Transactions do not nest, while one is open a new one writes on commit only its own updates.
+ *
+ * @param path_file_binary Binary to update
+ */
+inline Transaction::Transaction(fs::path const& path_file_binary)
+  : m_path_file_binary(path_file_binary)
+  , m_updates()
+  , m_is_active(active() == nullptr)
+{
+  if(m_is_active) { active() = this; }
+}
+
+/**
+ * @brief Destroy the Transaction object, closes it and discards uncommitted updates
+ */
+inline Transaction::~Transaction()
+{
+  if(m_is_active) { active() = nullptr; }
+}
+
+/**
+ * @brief Gets the open transaction of a binary
+ *
+ * @param path_file_binary The binary
+ * @return Transaction* The open transaction, or nullptr if there is none for this binary
+ */
+[[nodiscard]] inline Transaction* Transaction::get(fs::path const& path_file_binary)
+{
+  Transaction* transaction = active();
+  return (transaction and transaction->m_path_file_binary == path_file_binary)? transaction : nullptr;
+}
+
+/**
+ * @brief Stages the contents of a section, a later update of the same section replaces it
+ *
+ * @param offset_begin The starting offset in bytes of the section
+ * @param offset_end The ending offset in bytes of the section
+ * @param data The data to write into the section
+ * @param length The length of the data, the rest of the section is cleared
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> Transaction::stage(uint64_t offset_begin
+  , uint64_t offset_end
+  , char const* data
+  , uint64_t length)
+{
+  return_if(length > offset_end - offset_begin, Error("E::Size of data exceeds available space"));
+  m_updates[offset_begin] = Update{offset_end, std::string(data, length)};
+  return {};
+}
+
+/**
+ * @brief Reads a range of a staged section
+ *
+ * @param offset The starting offset in bytes in the binary
+ * @param data Where to copy the bytes
+ * @param length The number of bytes
+ * @return bool True if the range is within a staged section and was copied, false otherwise
+ */
+[[nodiscard]] inline bool Transaction::peek(uint64_t offset, char* data, uint64_t length) const
+{
+  // The staged section that starts at or before the offset
+  auto it = m_updates.upper_bound(offset);
+  return_if(it == m_updates.begin(), false);
+  --it;
+  auto const& [offset_begin, update] = *it;
+  return_if(offset + length > update.offset_end, false);
+  for(uint64_t i = 0; i < length; ++i)
+  {
+    uint64_t index = offset - offset_begin + i;
+    data[i] = (index < update.data.size())? update.data[index] : '\0';
+  }
+  return true;
+}
+
+/**
+ * @brief Writes the bytes of a section that differ from its staged contents
+ *
+ * @param fd File descriptor of the binary, open for reading and writing
+ * @param offset_begin The starting offset in bytes of the section
+ * @param update The staged contents of the section
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> Transaction::write_delta(int fd, uint64_t offset_begin, Update const& update)
+{
+  uint64_t size = update.offset_end - offset_begin;
+  // Current contents, from the mapping or read from the file
+  std::vector<char> buffer;
+  std::span<char const> current;
+  if(auto view = ReservedView::get(m_path_file_binary); view and view->span(offset_begin, size))
+  {
+    current = *view->span(offset_begin, size);
+  }
+  else
+  {
+    buffer.resize(size);
+    ssize_t bytes = ::pread(fd, buffer.data(), size, static_cast<off_t>(offset_begin));
+    return_if(bytes != static_cast<ssize_t>(size), Error("E::Failed to read section at {}", offset_begin));
+    current = buffer;
+  }
+  // The staged contents are the data followed by zeros up to the end of the section
+  auto f_byte = [&](uint64_t i){ return i < update.data.size()? update.data[i] : '\0'; };
+  uint64_t first = 0;
+  while(first < size and current[first] == f_byte(first)) { ++first; }
+  return_if(first == size, {}, "D::Section at {} is unchanged", offset_begin);
+  uint64_t last = size;
+  while(current[last-1] == f_byte(last-1)) { --last; }
+  // Write the changed range
+  std::string delta(last - first, '\0');
+  if(first < update.data.size())
+  {
+    std::copy(update.data.begin() + first, update.data.begin() + std::min<uint64_t>(last, update.data.size()), delta.begin());
+  }
+  for(uint64_t written = 0; written < delta.size();)
+  {
+    ssize_t bytes = ::pwrite(fd, delta.data() + written, delta.size() - written, static_cast<off_t>(offset_begin + first + written));
+    continue_if(bytes < 0 and errno == EINTR);
+    return_if(bytes <= 0, Error("E::Failed to write section at {}: {}", offset_begin, strerror(errno)));
+    written += bytes;
+  }
+  logger("D::Wrote {} bytes to section at {}", delta.size(), offset_begin);
+  return {};
+}
+
+/**
+ * @brief Writes the staged updates to the binary and syncs it to disk
+ *
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> Transaction::commit()
+{
+  return_if(m_updates.empty(), {});
+  int fd = ::open(m_path_file_binary.c_str(), O_RDWR | O_CLOEXEC);
+  return_if(fd < 0, Error("E::Failed to open '{}': {}", m_path_file_binary, strerror(errno)));
+  for(auto const& [offset_begin, update] : m_updates)
+  {
+    if(auto ret = write_delta(fd, offset_begin, update); not ret)
+    {
+      ::close(fd);
+      return Error("E::Failed to update the reserved space: {}", ret.error());
+    }
+  }
+  m_updates.clear();
+  int ret = ::fdatasync(fd);
+  ::close(fd);
+  return_if(ret < 0, Error("E::Failed to sync '{}': {}", m_path_file_binary, strerror(errno)));
+  return {};
+}
+
 /**
  * @brief Writes data to a file in binary format
- * 
+ *
+ * Only the bytes that differ from the current contents of the section are written. While a
+ * Transaction for the binary is open the data is staged in it instead.
+ *
  * @param path_file_binary The binary file to modify
  * @param offset_begin The starting offset in bytes where to starting writing
  * @param offset_end The ending offset in bytes where to stop writing
  * @param data The data to write into the file
  * @param length The length of the data to write into the file
- * @return On success it returns void, otherwise it returns the number of bytes written
+ * @return Value<void> Nothing on success, or the respective error
  */
 [[nodiscard]] inline Value<void> write(fs::path const& path_file_binary
   , uint64_t offset_begin
@@ -145,24 +484,20 @@ uint64_t const FIM_RESERVED_OFFSET_UNSHARE_END = FIM_RESERVED_OFFSET + reserved.
   , const char* data
   , uint64_t length) noexcept
 {
-  uint64_t size = offset_end - offset_begin;
-  return_if(length > size, Error("E::Size of data exceeds available space"));
-  // Open output binary file
-  std::fstream file_binary(path_file_binary, std::ios::binary | std::ios::in | std::ios::out);
-  return_if(not file_binary.is_open(), Error("E::Failed to open input file"));
-  // Write blank data
-  std::vector<char> blank(size, 0);
-  return_if(not file_binary.seekp(offset_begin), Error("E::Failed to seek offset to blank"));
-  return_if(not file_binary.write(blank.data(), size), Error("E::Failed to write blank data"));
-  // Write data with length
-  return_if(not file_binary.seekp(offset_begin), Error("E::Failed to seek offset to write data"));
-  return_if(not file_binary.write(data, length), Error("E::Failed to write data"));
-  return {};
+  if(Transaction* transaction = Transaction::get(path_file_binary))
+  {
+    return transaction->stage(offset_begin, offset_end, data, length);
+  }
+  Transaction transaction(path_file_binary);
+  Pop(transaction.stage(offset_begin, offset_end, data, length));
+  return transaction.commit();
 }
 
 /**
  * @brief Reads data from a file in binary format
- * 
+ *
+ * While a Transaction for the binary is open, the sections staged in it are read from it.
+ *
  * @param path_file_binary The binary file to read
  * @param offset The starting offset in bytes where to starting writing
  * @param data The data to write into the file
@@ -174,6 +509,20 @@ uint64_t const FIM_RESERVED_OFFSET_UNSHARE_END = FIM_RESERVED_OFFSET + reserved.
   , char* data
   , uint64_t length) noexcept
 {
+  // Copy from the open transaction, which holds the contents the section will have
+  if(Transaction* transaction = Transaction::get(path_file_binary); transaction and transaction->peek(offset, data, length))
+  {
+    return static_cast<std::streamsize>(length);
+  }
+  // Copy from the mapped reserved space
+  if(auto view = ReservedView::get(path_file_binary))
+  {
+    if(auto span = view->span(offset, length))
+    {
+      std::ranges::copy(*span, data);
+      return static_cast<std::streamsize>(length);
+    }
+  }
   // Open binary file
   std::ifstream file_binary(path_file_binary, std::ios::binary | std::ios::in);
   return_if(not file_binary.is_open(), Error("E::Failed to open input file"));
@@ -185,6 +534,34 @@ uint64_t const FIM_RESERVED_OFFSET_UNSHARE_END = FIM_RESERVED_OFFSET + reserved.
   return file_binary.gcount();
 }
 
+/**
+ * @brief Reads a null terminated string from a file in binary format
+ *
+ * Reads straight from the mapped reserved space when available, only the bytes up to the null
+ * terminator are touched.
+ *
+ * @param path_file_binary The binary file to read
+ * @param offset_begin The starting offset in bytes of the string
+ * @param offset_end The ending offset in bytes of the space reserved for the string
+ * @return Value<std::string> The string, or the respective error
+ */
+[[nodiscard]] inline Value<std::string> read_string(fs::path const& path_file_binary
+  , uint64_t offset_begin
+  , uint64_t offset_end) noexcept
+{
+  uint64_t size = offset_end - offset_begin;
+  if(auto view = ReservedView::get(path_file_binary); view and not Transaction::get(path_file_binary))
+  {
+    if(auto span = view->span(offset_begin, size))
+    {
+      return std::string(span->data(), ::strnlen(span->data(), span->size()));
+    }
+  }
+  auto buffer = std::make_unique<char[]>(size);
+  Pop(ns_reserved::read(path_file_binary, offset_begin, buffer.get(), size));
+  return std::string(buffer.get(), ::strnlen(buffer.get(), size));
+}
+
 } // namespace ns_reserved
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,72 @@
+/**
+ * @file volatile.hpp
+ * @author Ruan Formigoni
+ * @brief Manages the volatile reserved space
+ *
+ * @copyright Copyright (c) 2025 Ruan Formigoni
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+#include "../std/expected.hpp"
+#include "../macro.hpp"
+#include "reserved.hpp"
+
+/**
+ * @namespace ns_reserved::ns_volatile
+ * @brief Volatile upper directory flag management in reserved space
+ *
+ * This namespace manages a single-byte flag in the binary's reserved space that controls
+ * whether the changes of a run are kept. When enabled, the upper and work directories of the
+ * overlay live in memory for the duration of the run, on top of the persistent upper directory
+ * which is only read, and are discarded on exit.
+ */
+namespace ns_reserved::ns_volatile
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+}
+
+/**
+ * @brief Writes the volatile flag to the flatimage binary
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @param is_volatile Whether the changes of a run should be discarded or not
+ * @return Value<void> Success or error
+ */
+inline Value<void> write(fs::path const& path_file_binary, uint8_t is_volatile)
+{
+  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_VOLATILE_BEGIN;
+  uint64_t offset_end = ns_reserved::FIM_RESERVED_OFFSET_VOLATILE_END;
+  uint64_t size = offset_end - offset_begin;
+  return_if(size != sizeof(uint8_t)
+    , Error("E::Incorrect number of bytes to write volatile flag: {} vs {}", size, sizeof(uint8_t))
+  );
+  return ns_reserved::write(path_file_binary, offset_begin, offset_end, reinterpret_cast<char*>(&is_volatile), sizeof(uint8_t));
+}
+
+/**
+ * @brief Read the volatile flag from the flatimage binary
+ *
+ * @param path_file_binary Path to the flatimage binary
+ * @return On success, if the volatile mode is enabled or not. Or the respective error.
+ */
+inline Value<uint8_t> read(fs::path const& path_file_binary)
+{
+  uint64_t offset_begin = ns_reserved::FIM_RESERVED_OFFSET_VOLATILE_BEGIN;
+  uint8_t is_volatile;
+  ssize_t bytes = Pop(ns_reserved::read(path_file_binary, offset_begin, reinterpret_cast<char*>(&is_volatile), sizeof(uint8_t)));
+  return_if(bytes != 1, Error("E::Error to read volatile byte, count is {}", bytes));
+  return is_volatile;
+}
+
+} // namespace ns_reserved::ns_volatile
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -7,9 +7,74 @@
  */
 
 #pragma once
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <expected>
 #include <print>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/**
+ * @namespace ns_enum
+ * @brief Lookup of enumeration entries by name
+ *
+ * The names of an enumeration are kept in a table sorted at compile time, a lookup is a binary
+ * search that compares the upper case of the input on the fly, it does not allocate.
+ */
+namespace ns_enum
+{
+
+/**
+ * @brief Compares the name of an entry with a string, ignoring the case of the string
+ *
+ * @param name Name of the entry, in upper case
+ * @param str The string to compare
+ * @return int Negative, zero or positive as the name sorts before, equal to or after the string
+ */
+constexpr int compare(std::string_view name, std::string_view str)
+{
+  for(size_t i = 0; i < name.size() and i < str.size(); ++i)
+  {
+    char const c = (str[i] >= 'a' and str[i] <= 'z')? static_cast<char>(str[i] - 'a' + 'A') : str[i];
+    if(name[i] != c) { return (name[i] < c)? -1 : 1; }
+  }
+  return (name.size() > str.size()) - (name.size() < str.size());
+}
+
+/**
+ * @brief Sorts a table of entries by name
+ *
+ * @tparam T The enumeration type
+ * @tparam N The number of entries
+ * @param table The entries and their names
+ * @return std::array<std::pair<std::string_view,T>,N> The table sorted by name
+ */
+template<typename T, size_t N>
+constexpr std::array<std::pair<std::string_view,T>,N> sorted(std::array<std::pair<std::string_view,T>,N> table)
+{
+  std::ranges::sort(table, {}, &std::pair<std::string_view,T>::first);
+  return table;
+}
+
+/**
+ * @brief Finds an entry by name in a sorted table
+ *
+ * @tparam T The enumeration type
+ * @tparam N The number of entries
+ * @param table The entries sorted by name
+ * @param str The name to look up, in any case
+ * @return T const* The entry, or nullptr if no name matches
+ */
+template<typename T, size_t N>
+constexpr T const* find(std::array<std::pair<std::string_view,T>,N> const& table, std::string_view str)
+{
+  auto it = std::ranges::partition_point(table, [&](auto const& entry){ return compare(entry.first, str) < 0; });
+  return (it != table.end() and compare(it->first, str) == 0)? &it->second : nullptr;
+}
+
+} // namespace ns_enum
 
 // Get size of __VA_ARGS__
 #define VA_SIZE(...) VA_SIZE_(__VA_ARGS__,VA_SIZE_RSEQ())
@@ -60,31 +125,31 @@
 #define ENUM_CASE_TO_STRING_IMPL(i,NAME,...) ENUM_CASE_TO_STRING_##i(NAME,__VA_ARGS__)
 #define ENUM_CASE_TO_STRING(i,NAME,...) ENUM_CASE_TO_STRING_IMPL(i,NAME,__VA_ARGS__)
 
-// Create a case statement for string to enum
-#define ENUM_FROM_STRING_EXPR(NAME,value) if ( str_enum == #value ) { return NAME(value); }
-#define ENUM_CASE_FROM_STRING_0(NAME,x)     ENUM_FROM_STRING_EXPR(NAME,x)
-#define ENUM_CASE_FROM_STRING_1(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_0(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_2(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_1(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_3(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_2(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_4(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_3(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_5(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_4(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_6(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_5(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_7(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_6(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_8(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_7(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_9(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_8(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_10(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_9(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_11(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_10(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_12(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_11(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_13(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_12(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_14(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_13(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_15(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_14(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_16(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_15(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_17(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_16(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_18(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_17(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_19(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_18(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_20(NAME,x,...) ENUM_FROM_STRING_EXPR(NAME,x) ENUM_CASE_FROM_STRING_19(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING_IMPL(i,NAME,...) ENUM_CASE_FROM_STRING_##i(NAME,__VA_ARGS__)
-#define ENUM_CASE_FROM_STRING(i,NAME,...) ENUM_CASE_FROM_STRING_IMPL(i,NAME,__VA_ARGS__)
+// Create an entry of the name table
+#define ENUM_TO_ENTRY_EXPR(NAME,value) entry_t{#value, enum_t::value},
+#define ENUM_TO_ENTRY_0(NAME,x)     ENUM_TO_ENTRY_EXPR(NAME,x)
+#define ENUM_TO_ENTRY_1(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_0(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_2(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_1(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_3(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_2(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_4(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_3(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_5(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_4(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_6(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_5(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_7(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_6(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_8(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_7(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_9(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_8(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_10(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_9(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_11(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_10(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_12(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_11(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_13(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_12(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_14(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_13(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_15(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_14(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_16(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_15(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_17(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_16(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_18(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_17(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_19(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_18(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_20(NAME,x,...) ENUM_TO_ENTRY_EXPR(NAME,x) ENUM_TO_ENTRY_19(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY_IMPL(i,NAME,...) ENUM_TO_ENTRY_##i(NAME,__VA_ARGS__)
+#define ENUM_TO_ENTRY(i,NAME,...) ENUM_TO_ENTRY_IMPL(i,NAME,__VA_ARGS__)
 
 // Create a static member entry
 #define ENUM_TO_MEMBER_EXPR(NAME,value) static enum_t const value;
@@ -145,6 +210,11 @@ struct NAME \
     enum class enum_t : int { __VA_ARGS__ }; \
   private: \
     enum_t m_current; \
+    using entry_t = std::pair<std::string_view, enum_t>; \
+    /* Names of the entries sorted at compile time for from_string */ \
+    static constexpr std::array<entry_t, VA_SIZE(__VA_ARGS__)> const m_table = ns_enum::sorted( \
+      std::array<entry_t, VA_SIZE(__VA_ARGS__)>{{ ENUM_TO_ENTRY(VA_SIZE(VA_DROP(__VA_ARGS__)), NAME, __VA_ARGS__) }} \
+    ); \
   public: \
     size_t const size = VA_SIZE(__VA_ARGS__); \
     ENUM_TO_MEMBER(VA_SIZE(VA_DROP(__VA_ARGS__)), NAME, __VA_ARGS__) \
@@ -154,7 +224,7 @@ struct NAME \
     NAME(enum_t entry) : m_current(entry) {}\
     /* from_string callable (declaration) */ \
     struct from_string_t {                                                       \
-      std::expected<NAME, std::string> operator()(std::string) const;            \
+      std::expected<NAME, std::string> operator()(std::string_view) const;       \
     };                                                                           \
     static inline constexpr from_string_t from_string{};                         \
     operator enum_t() const \
@@ -192,10 +262,11 @@ struct NAME \
 }; \
 ENUM_STATIC_INIT(VA_SIZE(VA_DROP(__VA_ARGS__)), NAME, __VA_ARGS__) \
 /* Define the callable after the class is complete */                          \
-inline std::expected<NAME, std::string> NAME::from_string_t::operator()(std::string str_enum) const { \
-  std::ranges::transform(str_enum, str_enum.begin(), [](unsigned char c){ return static_cast<char>(std::toupper(c)); }); \
-  ENUM_CASE_FROM_STRING(VA_SIZE(VA_DROP(__VA_ARGS__)), NAME, __VA_ARGS__)      \
-  return std::unexpected(std::string("Could not determine enum entry from '") + str_enum + "'"); \
+inline std::expected<NAME, std::string> NAME::from_string_t::operator()(std::string_view str_enum) const { \
+  if (NAME::enum_t const* entry = ns_enum::find(NAME::m_table, str_enum)) { return NAME(*entry); } \
+  std::string str_upper{str_enum}; \
+  std::ranges::transform(str_upper, str_upper.begin(), [](unsigned char c){ return static_cast<char>(std::toupper(c)); }); \
+  return std::unexpected(std::string("Could not determine enum entry from '") + str_upper + "'"); \
 }
 
 #define ENUM(NAME, ...) ENUM_IMPL(NAME, __VA_ARGS__, NONE)
@@ -178,7 +178,7 @@ constexpr auto __expected_fn = [](auto&& e) { return e; };
  * }
  *
  * // With additional context:
- * int val2 = Pop(get_value(), "Failed to get value for processing");
+ * int val2 = Pop(get_value(), "E::Failed to get value for processing");
  * @endcode
  */
 #define Pop(expr, ...)                                                  \
@@ -190,22 +190,8 @@ constexpr auto __expected_fn = [](auto&& e) { return e; };
     /* Log expected error at DEBUG level */                             \
     logger("D::{}", error);                                             \
     /* If a custom error was provided, log and propagate it instead */  \
-    __VA_OPT__(                                                         \
-      logger(__VA_ARGS__);                                              \
-      error = [&](auto &&fmt, auto &&...args)                           \
-      {                                                                 \
-        if constexpr (sizeof...(args) > 0)                              \
-        {                                                               \
-          return ns_log::vformat(std::string_view(fmt).substr(3),       \
-            ns_string::to_string(args)...);                             \
-        }                                                               \
-        else                                                            \
-        {                                                               \
-          return std::string_view(fmt).substr(3);                       \
-        }                                                               \
-      }(__VA_ARGS__);                                                   \
-    )                                                                   \
-    return __expected_fn(std::unexpected(error));                       \
+    __VA_OPT__(error = Error(__VA_ARGS__).error();)                     \
+    return __expected_fn(std::unexpected(std::move(error)));            \
   }                                                                     \
   std::move(__expected_ret).value();                                    \
 })
@@ -311,6 +297,56 @@ auto __except_impl(Fn&& f) -> Value<std::invoke_result_t<Fn>>
 #define Catch(expr, ...) (__except_impl([&]{ return (expr); })__VA_OPT__(.template forward(__VA_ARGS__)))
 
 
+/**
+ * @namespace ns_expected
+ * @brief Construction of the errors of the Error and Pop macros
+ *
+ * The message of an error is formatted once, then the same string is logged and stored in the
+ * error. The logger only writes a string it was given, so an error costs a single format and
+ * conversion of its arguments, and nothing at all on the success path.
+ */
+namespace ns_expected
+{
+
+/**
+ * @brief Log format that prints a formatted message at the level of an error format
+ *
+ * @tparam fmt Format string starting with log level indicator
+ * @return ns_string::static_string<6> The format with the same log level and a single argument
+ */
+template<ns_string::static_string fmt>
+constexpr ns_string::static_string<6> prefix()
+{
+  constexpr std::string_view sv{fmt.data};
+  return sv.starts_with("D")? ns_string::static_string("D::{}")
+    : sv.starts_with("I")? ns_string::static_string("I::{}")
+    : sv.starts_with("W")? ns_string::static_string("W::{}")
+    : sv.starts_with("E")? ns_string::static_string("E::{}")
+    : sv.starts_with("C")? ns_string::static_string("C::{}")
+    : ns_string::static_string("Q::{}");
+}
+
+/**
+ * @brief Formats, logs and wraps an error message
+ *
+ * @tparam fmt Format string starting with log level prefix
+ * @tparam Args Types of the format arguments
+ * @param loc Source location for logging
+ * @param args Arguments for the format string
+ * @return std::unexpected<std::string> The formatted message without the log level prefix
+ *
+ * @note Used internally by the Error() macro
+ */
+template<ns_string::static_string fmt, typename... Args>
+[[nodiscard]] std::unexpected<std::string> error(ns_log::Location const& loc, Args&&... args)
+{
+  std::string message = std::format(std::string_view(fmt).substr(3), ns_string::to_string(args)...);
+  logger_loc(loc, prefix<fmt>(), message);
+  return std::unexpected(std::move(message));
+}
+
+} // namespace ns_expected
+
 /**
  * @brief Create an unexpected error with logging
  *
@@ -332,23 +368,4 @@ auto __except_impl(Fn&& f) -> Value<std::invoke_result_t<Fn>>
  * }
  * @endcode
  */
-#define Error(fmt,...)                                 \
-({                                                     \
-  logger(fmt __VA_OPT__(,) __VA_ARGS__);               \
-  [&](auto&&... __fmt_args)                            \
-  {                                                    \
-    if constexpr (sizeof...(__fmt_args) > 0)           \
-    {                                                  \
-      return std::unexpected(                          \
-          std::format(std::string_view(fmt).substr(3)  \
-        , ns_string::to_string(__fmt_args)...)         \
-      );                                               \
-    }                                                  \
-    else                                               \
-    {                                                  \
-      return std::unexpected(                          \
-        std::format(std::string_view(fmt).substr(3))   \
-      );                                               \
-    }                                                  \
-  }(__VA_ARGS__);                                      \
-})
+#define Error(fmt,...) ::ns_expected::error<fmt>(::ns_log::Location{} __VA_OPT__(,) __VA_ARGS__)
@@ -15,6 +15,8 @@
 #include <string>
 #include <filesystem>
 #include <linux/limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "expected.hpp"
 #include "string.hpp"
@@ -86,6 +88,44 @@ using perm_options = fs::perm_options;
     return p;
 }
 
+/**
+ * @brief Creates a directory that only the current user can access
+ *
+ * Missing parent directories are created with the same mode. An existing directory is only
+ * accepted if it is not a symlink, is owned by the effective user and grants no access to group
+ * or others.
+ *
+ * @param p Path to the directory
+ * @return Value<fs::path> The path of the directory or the respective error
+ */
+[[nodiscard]] inline Value<fs::path> create_private_directory(fs::path const& p)
+{
+    // Missing parents are created private as well, existing ones are kept as they are
+    std::error_code ec;
+    if(p.has_parent_path() and not fs::exists(p.parent_path(), ec))
+    {
+      if(auto ret = create_private_directory(p.parent_path()); not ret) { return std::unexpected(ret.error()); }
+    }
+    if(::mkdir(p.c_str(), 0700) == 0)
+    {
+      return p;
+    }
+    if(errno != EEXIST)
+    {
+      return std::unexpected(std::format("Could not create directory {}: {}", p.string(), strerror(errno)));
+    }
+    struct stat st{};
+    if(::lstat(p.c_str(), &st) < 0 or not S_ISDIR(st.st_mode))
+    {
+      return std::unexpected(std::format("{} is not a directory", p.string()));
+    }
+    if(st.st_uid != ::geteuid() or (st.st_mode & 077) != 0)
+    {
+      return std::unexpected(std::format("Directory {} is not private to uid {}", p.string(), ::geteuid()));
+    }
+    return p;
+}
+
 /**
  * @brief Replace placeholders in a path by traversing components
  *
@@ -0,0 +1,14 @@
+#!/bin/python3
+
+from cli.test_base import TestBase
+
+class BenchTestBase(TestBase):
+  """
+  Base class for bench tests providing shared utilities
+  """
+
+  def setUp(self):
+    super().setUp()
+
+  def tearDown(self):
+    super().tearDown()
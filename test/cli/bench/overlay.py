@@ -0,0 +1,42 @@
+#!/bin/python3
+
+from .common import BenchTestBase
+from cli.test_runner import run_cmd
+
+class TestFimBenchOverlay(BenchTestBase):
+  """Test suite for fim-bench overlay command"""
+
+  def test_bench_overlay(self):
+    """Test that every backend reports every test"""
+    out,_,code = run_cmd(self.file_image, "fim-bench", "overlay")
+    self.assertEqual(code, 0)
+    lines = out.splitlines()
+    self.assertTrue(lines[0].startswith("backend"))
+    for backend in ["OVERLAYFS", "UNIONFS"]:
+      for test in ["stat", "readdir", "read", "create", "copy-up"]:
+        self.assertTrue(any(line.split()[:2] == [backend, test] for line in lines), f"{backend} {test}")
+    self.assertRegex(lines[-1], "^Fastest overlay: (OVERLAYFS|UNIONFS|BWRAP)$")
+    # The scratch directories are removed and the data directory is untouched
+    self.assertFalse((self.dir_image / "tmp" / "bench").exists())
+    self.assertFalse((self.dir_image / "root" / "fim-bench").exists())
+
+  def test_bench_overlay_set(self):
+    """Test that the fastest backend is set as the default"""
+    out,_,code = run_cmd(self.file_image, "fim-bench", "overlay", "set")
+    self.assertEqual(code, 0)
+    fastest = out.splitlines()[-1].removeprefix("Fastest overlay: ")
+    out,_,code = run_cmd(self.file_image, "fim-overlay", "show")
+    self.assertEqual(code, 0)
+    self.assertEqual(out, fastest)
+
+  def test_bench_cli(self):
+    """Test CLI argument validation for bench command"""
+    _,err,code = run_cmd(self.file_image, "fim-bench")
+    self.assertIn("Missing op for 'fim-bench' (<overlay>)", err)
+    self.assertEqual(code, 125)
+    _,err,code = run_cmd(self.file_image, "fim-bench", "overlay", "apply")
+    self.assertIn("Invalid argument for 'overlay': apply", err)
+    self.assertEqual(code, 125)
+    _,err,code = run_cmd(self.file_image, "fim-bench", "overlay", "set", "extra")
+    self.assertIn("Trailing arguments for fim-bench", err)
+    self.assertEqual(code, 125)
@@ -0,0 +1,69 @@
+#!/bin/python3
+
+import json
+from .common import ConfigTestBase
+from cli.test_runner import run_cmd
+
+class TestFimConfigApply(ConfigTestBase):
+  """Test suite for fim-config apply command"""
+
+  def test_apply(self):
+    """Test that every key of the configuration is applied"""
+    file_config = self.write_config({
+      "permissions": ["home", "network"],
+      "environment": ["HELLO=world", "FOO=bar"],
+      "bind": { "0": { "src": "/tmp", "dst": "/host/tmp", "type": "ro" } },
+      "boot": { "program": "echo", "args": ["booted"] },
+      "remote": "https://example.com/recipes",
+      "unshare": ["ipc"],
+      "notify": "off",
+    })
+    _,err,code = run_cmd(self.file_image, "fim-config", "apply", file_config)
+    self.assertEqual(code, 0, err)
+    out,_,_ = run_cmd(self.file_image, "fim-perms", "list")
+    self.assertEqual(out.splitlines(), ["home", "network"])
+    out,_,_ = run_cmd(self.file_image, "fim-env", "list")
+    self.assertEqual(sorted(out.splitlines()), ["FOO=bar", "HELLO=world"])
+    out,_,_ = run_cmd(self.file_image, "fim-bind", "list")
+    self.assertEqual(json.loads(out)["0"]["dst"], "/host/tmp")
+    out,_,_ = run_cmd(self.file_image, "fim-boot", "show")
+    self.assertEqual(json.loads(out)["program"], "echo")
+    out,_,_ = run_cmd(self.file_image, "fim-remote", "show")
+    self.assertEqual(out.strip(), "https://example.com/recipes")
+    out,_,_ = run_cmd(self.file_image, "fim-unshare", "list")
+    self.assertEqual(out.splitlines(), ["ipc"])
+
+  def test_apply_replaces(self):
+    """Test that the given keys replace their configuration and the others are kept"""
+    _,_,code = run_cmd(self.file_image, "fim-env", "add", "OLD=value")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-perms", "set", "audio")
+    self.assertEqual(code, 0)
+    _,err,code = run_cmd(self.file_image, "fim-config", "apply", self.write_config({ "environment": ["NEW=value"] }))
+    self.assertEqual(code, 0, err)
+    out,_,_ = run_cmd(self.file_image, "fim-env", "list")
+    self.assertEqual(out.splitlines(), ["NEW=value"])
+    out,_,_ = run_cmd(self.file_image, "fim-perms", "list")
+    self.assertEqual(out.splitlines(), ["audio"])
+
+  def test_apply_invalid_is_atomic(self):
+    """Test that an invalid entry leaves the whole configuration unchanged"""
+    for config in [
+      { "environment": ["NEW=value"], "permissions": ["invalid"] },
+      { "environment": ["NEW=value"], "unknown": [] },
+      { "environment": ["NEW=value"], "notify": "maybe" },
+    ]:
+      with self.subTest(config=config):
+        _,_,code = run_cmd(self.file_image, "fim-config", "apply", self.write_config(config))
+        self.assertNotEqual(code, 0)
+        out,_,_ = run_cmd(self.file_image, "fim-env", "list")
+        self.assertEqual(out.strip(), "")
+
+  def test_apply_cli(self):
+    """Test that invalid arguments are rejected"""
+    _,_,code = run_cmd(self.file_image, "fim-config", "apply")
+    self.assertNotEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-config", "apply", str(self.dir_data / "missing.json"))
+    self.assertNotEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-config", "apply", self.write_config({}), "trailing")
+    self.assertNotEqual(code, 0)
@@ -0,0 +1,23 @@
+#!/bin/python3
+
+import json
+from cli.test_base import TestBase
+
+class ConfigTestBase(TestBase):
+  """
+  Base class for config tests providing shared utilities
+  """
+
+  def setUp(self):
+    super().setUp()
+    self.file_config = self.dir_data / "config.json"
+
+  def tearDown(self):
+    if self.file_config.exists():
+      self.file_config.unlink()
+    super().tearDown()
+
+  def write_config(self, config):
+    """Writes a configuration file and returns its path as a string"""
+    self.file_config.write_text(json.dumps(config))
+    return str(self.file_config)
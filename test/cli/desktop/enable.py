@@ -274,3 +274,30 @@ class TestFimDesktopEnable(DesktopTestBase):
     self.assertEqual(out, "")
     self.assertIn("Application name cannot contain the '/' character", err)
     self.assertEqual(code, 125)
+
+  def test_stamp(self):
+    """Test that launches skip an integration that is up to date"""
+    name = "MyApp"
+    path_dir_xdg = self.setup_xdg_data_home()
+    self.make_json_setup(r'''"ENTRY","MIMETYPE","ICON"''', name)
+    _, err, code = run_cmd(self.file_image, "fim-desktop", "setup", str(self.file_desktop))
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    # The first launch integrates and writes the stamp
+    out, err, code = run_cmd(self.file_image, "fim-exec", "echo")
+    self.assertEqual(code, 0)
+    path_file_stamp = path_dir_xdg / "flatimage" / "desktop" / f"{name}.stamp"
+    self.assertTrue(path_file_stamp.exists())
+    self.check_entry(self.file_image, name, path_dir_xdg, self.assertTrue)
+    # Later launches do not recreate removed files while the stamp matches
+    path_file_entry = path_dir_xdg / "applications" / f"flatimage-{name}.desktop"
+    path_file_entry.unlink()
+    out, err, code = run_cmd(self.file_image, "fim-exec", "echo")
+    self.assertEqual(code, 0)
+    self.assertFalse(path_file_entry.exists())
+    # Changing the configuration of the binary integrates again
+    out, err, code = run_cmd(self.file_image, "fim-desktop", "enable", "entry,icon")
+    self.assertEqual(code, 0)
+    out, err, code = run_cmd(self.file_image, "fim-exec", "echo")
+    self.assertEqual(code, 0)
+    self.check_entry(self.file_image, name, path_dir_xdg, self.assertTrue)
@@ -0,0 +1,32 @@
+#!/bin/python3
+
+import os
+from .common import ExecTestBase
+from cli.test_runner import run_cmd
+
+class TestFimExecTrace(ExecTestBase):
+  """
+  Tests for recording the files read from the layers and prefetching them.
+  """
+
+  def tearDown(self):
+    super().tearDown()
+    os.environ.pop("FIM_TRACE_ACCESS", None)
+
+  def test_trace_record_prefetch(self):
+    dir_trace = self.dir_image / "trace"
+    # Record the files read by the command
+    os.environ["FIM_TRACE_ACCESS"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/etc/os-release")
+    del os.environ["FIM_TRACE_ACCESS"]
+    self.assertEqual(code, 0)
+    hints = list(dir_trace.glob("*.hint"))
+    self.assertGreater(len(hints), 0)
+    content = "".join(hint.read_text() for hint in hints)
+    self.assertIn("os-release", content)
+    # The next run reads the recorded files ahead of the command
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "echo", "test")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertEqual(code, 0)
+    self.assertIn("Prefetched", out + err)
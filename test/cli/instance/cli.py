@@ -12,7 +12,7 @@ class TestFimInstanceCli(InstanceTestBase):
     # Missing arguments for instance
     out,err,code = run_cmd(self.file_image, "fim-instance")
     self.assertEqual(out, "")
-    self.assertIn("Missing op for 'fim-instance' (<exec|list>)", err)
+    self.assertIn("Missing op for 'fim-instance' (<exec|list|serve>)", err)
     self.assertEqual(code, 125)
     # Missing arguments for exec
     out,err,code = run_cmd(self.file_image, "fim-instance", "exec")
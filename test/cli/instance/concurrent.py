@@ -0,0 +1,59 @@
+#!/bin/python3
+
+import os
+import time
+from .common import InstanceTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimInstanceConcurrent(InstanceTestBase):
+  """Test suite for concurrent instances with their own upper directories"""
+
+  def setUp(self):
+    super().setUp()
+    self.file_root = self.dir_image / "root" / "concurrent.txt"
+
+  def tearDown(self):
+    os.environ.pop("FIM_CONCURRENT", None)
+    super().tearDown()
+
+  def test_concurrent_start(self):
+    """Test that an instance starts while another one is running"""
+    os.environ["FIM_CONCURRENT"] = "1"
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "5")
+    time.sleep(1)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "echo", "hello")
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+    # It did not wait for the first instance
+    self.assertIsNone(proc.poll())
+    proc.wait()
+
+  def test_concurrent_discard(self):
+    """Test that the changes of a concurrent instance are discarded on exit"""
+    os.environ["FIM_CONCURRENT"] = "1"
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /concurrent.txt")
+    self.assertEqual(code, 0)
+    self.assertFalse(self.file_root.exists())
+    self.assertEqual(list((self.dir_image / "instances").iterdir()), [])
+
+  def test_concurrent_read_upper(self):
+    """Test that a concurrent instance reads the persistent upper directory"""
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /concurrent.txt")
+    self.assertEqual(code, 0)
+    os.environ["FIM_CONCURRENT"] = "1"
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/concurrent.txt")
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+
+  def test_concurrent_merge(self):
+    """Test that the changes are merged once no concurrent instance is running"""
+    os.environ["FIM_CONCURRENT"] = "merge"
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "4")
+    time.sleep(1)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /concurrent.txt")
+    self.assertEqual(code, 0)
+    # Kept until the other instance exits
+    self.assertFalse(self.file_root.exists())
+    proc.wait()
+    self.assertTrue(self.file_root.exists())
+    self.assertEqual(self.file_root.read_text().strip(), "hello")
@@ -0,0 +1,36 @@
+#!/bin/python3
+
+import os
+import time
+from .common import InstanceTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimInstanceServe(InstanceTestBase):
+  """Test suite for fim-instance serve command"""
+
+  def test_instances_serve(self):
+    """Test forwarding invocations to a served instance"""
+    os.environ["FIM_OVERLAY"] = "unionfs"
+    # Invalid timeout
+    out,err,code = run_cmd(self.file_image, "fim-instance", "serve", "foo")
+    self.assertEqual(out, "")
+    self.assertIn("Timeout argument must be a digit", err)
+    self.assertEqual(code, 125)
+    # Serve with a short timeout
+    proc = spawn_cmd(self.file_image, "fim-instance", "serve", "3")
+    time.sleep(1)
+    # A second server is refused
+    out,err,code = run_cmd(self.file_image, "fim-instance", "serve")
+    self.assertIn("An instance already serves this binary", err)
+    self.assertEqual(code, 125)
+    # Commands run in the served instance, with output and exit code forwarded
+    out,err,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello; exit 3")
+    self.assertEqual(out, "hello")
+    self.assertEqual(code, 3)
+    out,err,code = run_cmd(self.file_image, "fim-instance", "list")
+    self.assertEqual(out.count('\n'), 0)
+    # The served instance exits once idle for the timeout
+    proc.wait(timeout=10)
+    out,err,code = run_cmd(self.file_image, "fim-instance", "list")
+    self.assertEqual(out, "")
+    del os.environ["FIM_OVERLAY"]
@@ -0,0 +1,42 @@
+#!/bin/python3
+
+import os
+import time
+from .common import InstanceTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimInstanceShare(InstanceTestBase):
+  """Test suite for layer mounts shared between instances"""
+
+  def tearDown(self):
+    super().tearDown()
+    os.environ.pop("FIM_SHARE_LAYERS", None)
+
+  def test_share_reuse(self):
+    """Test that a second instance reuses the layer mounts of the first"""
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "3")
+    time.sleep(1)
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertEqual(code, 0)
+    self.assertIn("is reused", out + err)
+    self.assertNotIn("is new", out + err)
+    proc.wait()
+    # The last instance un-mounts the shared layers
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertEqual(code, 0)
+    self.assertIn("is new", out + err)
+    self.assertNotIn("is reused", out + err)
+
+  def test_share_disabled(self):
+    """Test that FIM_SHARE_LAYERS=0 mounts the layers for the instance"""
+    os.environ["FIM_SHARE_LAYERS"] = "0"
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "echo", "hello")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+    self.assertNotIn("Shared mount", out + err)
@@ -0,0 +1,61 @@
+#!/bin/python3
+
+import os
+import signal
+import time
+from pathlib import Path
+from .common import InstanceTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimInstanceSupervisor(InstanceTestBase):
+  """Test suite for the cleanup of the mounts by the host portal daemon"""
+
+  def setUp(self):
+    super().setUp()
+    os.environ["FIM_SUPERVISOR"] = "1"
+    os.environ["FIM_OVERLAY"] = "unionfs"
+
+  def tearDown(self):
+    del os.environ["FIM_SUPERVISOR"]
+    del os.environ["FIM_OVERLAY"]
+    super().tearDown()
+
+  def get_janitors(self, pid):
+    """Lists the janitor processes that wait for a pid"""
+    janitors = []
+    for dir_proc in Path("/proc").iterdir():
+      try:
+        args = (dir_proc / "cmdline").read_bytes().split(b"\0")
+      except OSError:
+        continue
+      if args[0].endswith(b"fim_janitor") and len(args) > 1 and args[1] == str(pid).encode():
+        janitors.append(dir_proc.name)
+    return janitors
+
+  def test_supervisor_run(self):
+    """Test that a program runs without a janitor"""
+    out,_,code = run_cmd(self.file_image, "fim-exec", "echo", "hello")
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+
+  def test_supervisor_crash(self):
+    """Test that the mounts of a crashed instance are cleaned by the portal daemon"""
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo $FIM_DIR_APP")
+    self.assertEqual(code, 0)
+    dir_app = Path(out.splitlines()[-1].strip())
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "10")
+    time.sleep(2)
+    out,_,code = run_cmd(self.file_image, "fim-instance", "list")
+    self.assertEqual(code, 0)
+    pid = int(out.splitlines()[0].split(":")[1])
+    dir_instance = dir_app / "instance" / str(pid)
+    # The mounts are handed to the daemon, no janitor waits for the instance
+    self.assertTrue((dir_instance / "supervisor").exists())
+    self.assertEqual(self.get_janitors(pid), [])
+    self.assertIn(str(dir_instance), Path("/proc/mounts").read_text())
+    # Crash the instance
+    os.kill(pid, signal.SIGKILL)
+    proc.wait()
+    time.sleep(2)
+    self.assertNotIn(str(dir_instance), Path("/proc/mounts").read_text())
+    self.assertFalse((dir_instance / "supervisor").exists())
@@ -1,6 +1,7 @@
 #!/bin/python3
 
 import os
+import time
 import shutil
 import subprocess
 from .common import LayerTestBase
@@ -51,6 +52,41 @@ class TestFimLayerCommit(LayerTestBase):
       shutil.rmtree(self.dir_image, ignore_errors=True)
       count_layers += 1
 
+  def test_commit_progress(self):
+    """Test the summary of the compression and of the commit phases"""
+    self.create_script("progress")
+    out,err,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    self.assertRegex(out, r"Compressed [0-9]+ entries \([0-9]+/s\) from .* to [0-9.]+ [KMG]?i?B \(ratio [0-9.a-z]+\)")
+    self.assertRegex(out, r"Commit phases: scan [0-9.]+s, compress [0-9.]+s, append [0-9.]+s, cleanup [0-9.]+s")
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    self.script_exec("progress", "", 0)
+
+  def test_commit_profile(self):
+    """Test committing with the profile of the binary and with a profile of the commit"""
+    out,err,code = run_cmd(self.file_image, "fim-perf", "profile", "small")
+    self.assertIn("Set the layer profile to 'small'", out)
+    self.assertEqual(code, 0)
+    # The profile of the binary
+    self.create_script("small layer")
+    out,err,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertIn("--max-lookback-blocks", out)
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    self.script_exec("small layer", "", 0)
+    # The profile of the commit overrides the one of the binary, raw options override the profile
+    self.create_script("random access layer")
+    out,err,code = run_cmd(self.file_image, "fim-layer", "commit", "binary", "random-access", "--block-size-bits", "19")
+    self.assertIn("Options of mkdwarfs", out)
+    self.assertNotIn("--max-lookback-blocks", out)
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    self.script_exec("random access layer", "", 0)
+    # Invalid profile
+    out,err,code = run_cmd(self.file_image, "fim-layer", "commit", "binary", "tiny")
+    self.assertIn("Invalid profile 'tiny'", err)
+    self.assertEqual(code, 125)
+
   def test_commit_to_file(self):
     """Test committing changes to a separate layer file"""
     # Create script in overlay
@@ -77,6 +113,29 @@ class TestFimLayerCommit(LayerTestBase):
     if layer_file.exists():
       os.unlink(layer_file)
 
+  def test_commit_stream(self):
+    """Test streaming a layer to stdout and adding it back from stdin"""
+    self.create_script("streamed layer")
+    # Stream through a pipe, the layer never touches the disk before it is added
+    commit = subprocess.Popen([self.file_image, "fim-layer", "commit", "stream", "-"]
+      , stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    data, err = commit.communicate()
+    self.assertEqual(commit.returncode, 0)
+    self.assertIn("Layer streamed to '-'", err.decode())
+    self.assertTrue(data.startswith(b"DWARFS"))
+    shutil.rmtree(self.dir_image / "root", ignore_errors=False)
+    self.script_exec(None, None, 127)
+    add = subprocess.run([self.file_image, "fim-layer", "add", "-"], input=data, capture_output=True)
+    self.assertEqual(add.returncode, 0)
+    self.assertIn(f"Included novel layer of {len(data)} bytes from stream", add.stdout.decode())
+    self.script_exec("streamed layer", None, 0)
+    # An empty stream leaves the binary as it was
+    size = os.path.getsize(self.file_image)
+    add = subprocess.run([self.file_image, "fim-layer", "add", "-"], input=b"", capture_output=True)
+    self.assertIn("The layer stream is empty", add.stderr.decode())
+    self.assertNotEqual(add.returncode, 0)
+    self.assertEqual(os.path.getsize(self.file_image), size)
+
   def test_commit_to_layer_directory(self):
     """Test committing changes to the managed layers directory"""
     # Create script in overlay
@@ -156,8 +215,13 @@ class TestFimLayerCommit(LayerTestBase):
       # 3. But the directory CANNOT be removed (parent is root-owned)
       subprocess.run(["sudo", "chown", "root:root", str(empty_parent)], check=True)
 
+      # Make the data directory read-only so the upper directory cannot be swapped,
+      # which makes the commit erase the files one by one
+      os.chmod(self.dir_image, 0o555)
+
       # Commit to binary - this should trigger warnings but still succeed
       out, err, code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+      os.chmod(self.dir_image, 0o755)
 
       # Check that commit succeeded despite erasure warnings
       self.assertEqual(code, 0)
@@ -167,10 +231,39 @@ class TestFimLayerCommit(LayerTestBase):
       self.assertIn("Finished erasing files", out)
 
       # Verify permissive warning messages appear
+      self.assertRegex(err, "Could not swap.*erasing file by file")
       self.assertRegex(err, "Could not remove file.*locked_file.txt")
       self.assertRegex(err, "Could not remove directory.*empty_dir")
 
     finally:
       os.environ["FIM_DEBUG"] = "0"
+      os.chmod(self.dir_image, 0o755)
       # Clean up: restore ownership so tearDown can clean up properly
-      subprocess.run(["sudo", "chown", "-R", f"{os.getuid()}:{os.getgid()}", str(self.dir_image / "root")], check=False)
\ No newline at end of file
+      subprocess.run(["sudo", "chown", "-R", f"{os.getuid()}:{os.getgid()}", str(self.dir_image / "root")], check=False)
+
+  def test_commit_swap_upper(self):
+    """Test the upper directory is swapped for an empty one and removed in the background"""
+    self.create_script("swap test")
+    # Create a tree with several files to remove
+    for i in range(32):
+      dir_tree = self.dir_image / "root" / "tree" / str(i)
+      dir_tree.mkdir(parents=True, exist_ok=False)
+      for j in range(8):
+        (dir_tree / f"file_{j}").write_text("data")
+    os.chmod(self.dir_image / "root", 0o750)
+    out, _, code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    self.assertIn("Filesystem appended to binary", out)
+    # The upper directory is empty and keeps its permissions
+    dir_root = self.dir_image / "root"
+    self.assertTrue(dir_root.is_dir())
+    self.assertEqual(list(dir_root.iterdir()), [])
+    self.assertEqual(dir_root.stat().st_mode & 0o777, 0o750)
+    # The old tree is removed by a background process
+    for _ in range(50):
+      if not list(self.dir_image.glob("root.commit.*")):
+        break
+      time.sleep(0.1)
+    self.assertEqual(list(self.dir_image.glob("root.commit.*")), [])
+    # The committed files are in the binary
+    self.script_exec("swap test", "", 0)
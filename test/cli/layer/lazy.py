@@ -0,0 +1,87 @@
+#!/bin/python3
+
+import os
+import shutil
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerLazy(LayerTestBase):
+  """Test suite for fim-layer lazy command"""
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls.file_layer_external = cls.dir_data / "lazy.layer"
+
+  def setUp(self):
+    super().setUp()
+    dir_root = self.dir_data / "lazy_root"
+    shutil.rmtree(dir_root, ignore_errors=True)
+    (dir_root / "opt" / "lazy").mkdir(parents=True)
+    (dir_root / "opt" / "lazy" / "marker").write_text("lazy layer\n")
+    _,err,code = run_cmd(self.file_image, "fim-layer", "create", str(dir_root), str(self.file_layer_external))
+    self.assertEqual(code, 0, err)
+    shutil.rmtree(dir_root, ignore_errors=True)
+    os.environ["FIM_LAYERS"] = str(self.file_layer_external)
+
+  def tearDown(self):
+    super().tearDown()
+    for var in ["FIM_LAYERS", "FIM_TRACE_ACCESS", "FIM_DEBUG"]:
+      os.environ.pop(var, None)
+    if self.file_layer_external.exists():
+      os.unlink(self.file_layer_external)
+
+  def record(self, *args):
+    """Runs a command while recording the files it reads"""
+    os.environ["FIM_TRACE_ACCESS"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", *args)
+    del os.environ["FIM_TRACE_ACCESS"]
+    return out,err,code
+
+  def test_lazy_without_recording_is_mounted(self):
+    """Test that a lazy layer is mounted until a recording tells it is not read"""
+    _,err,code = run_cmd(self.file_image, "fim-layer", "lazy", "on", str(self.file_layer_external))
+    self.assertEqual(code, 0, err)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/lazy/marker")
+    self.assertEqual(code, 0)
+    self.assertIn("lazy layer", out)
+
+  def test_lazy_unread_is_not_mounted(self):
+    """Test that a lazy layer the last recording did not read is left out"""
+    _,err,code = run_cmd(self.file_image, "fim-layer", "lazy", "on", str(self.file_layer_external))
+    self.assertEqual(code, 0, err)
+    _,_,code = self.record("true")
+    self.assertEqual(code, 0)
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/lazy/marker")
+    self.assertNotEqual(code, 0)
+    self.assertIn("not mounted", out + err)
+    # Recording a run that reads the layer mounts it again
+    del os.environ["FIM_DEBUG"]
+    out,_,code = self.record("cat", "/opt/lazy/marker")
+    self.assertEqual(code, 0)
+    self.assertIn("lazy layer", out)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/lazy/marker")
+    self.assertEqual(code, 0)
+    self.assertIn("lazy layer", out)
+
+  def test_lazy_off(self):
+    """Test that a layer marked back as eager is mounted on every boot"""
+    _,err,code = run_cmd(self.file_image, "fim-layer", "lazy", "on", str(self.file_layer_external))
+    self.assertEqual(code, 0, err)
+    _,_,code = self.record("true")
+    self.assertEqual(code, 0)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "lazy", "off", str(self.file_layer_external))
+    self.assertEqual(code, 0, err)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/lazy/marker")
+    self.assertEqual(code, 0)
+    self.assertIn("lazy layer", out)
+
+  def test_lazy_invalid(self):
+    """Test that invalid arguments are rejected"""
+    _,_,code = run_cmd(self.file_image, "fim-layer", "lazy", "maybe", str(self.file_layer_external))
+    self.assertNotEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-layer", "lazy", "on", str(self.dir_data / "missing.layer"))
+    self.assertNotEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-layer", "lazy", "on")
+    self.assertNotEqual(code, 0)
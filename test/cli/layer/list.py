@@ -143,6 +143,84 @@ class TestFimLayerList(LayerTestBase):
     # Path should match the external layer file
     self.assertIn(self.file_layer_external.name, parts[3])
 
+  def test_list_layer_index(self):
+    """Test that the embedded layers are indexed and the index is refreshed on changes"""
+    file_index = self.dir_image / "layers.json"
+    # First boot scans the binary and writes the index
+    out_before, _, code = run_cmd(self.file_image, "fim-layer", "list")
+    self.assertEqual(code, 0)
+    self.assertTrue(file_index.exists())
+    # Next boot loads the layers from the index
+    os.environ["FIM_DEBUG"] = "1"
+    out, err, code = run_cmd(self.file_image, "fim-exec", "true")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertEqual(code, 0)
+    self.assertIn("Loaded {} layers from index".format(len(out_before.strip().split('\n'))), out + err)
+    # Changing the binary invalidates the index
+    self.create_script("test layer index")
+    out, err, code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    out_after, _, code = run_cmd(self.file_image, "fim-layer", "list")
+    self.assertEqual(code, 0)
+    self.assertEqual(len(out_after.strip().split('\n')), len(out_before.strip().split('\n')) + 1)
+
+  def test_list_external_layer_cache(self):
+    """Test that external layer files are validated once and re-validated on changes"""
+    dir_layers = self.dir_image / "external"
+    dir_layers.mkdir(parents=True, exist_ok=True)
+    self.create_script("cached external layer")
+    _, _, code = run_cmd(self.file_image, "fim-layer", "create", str(self.dir_image / "root"), str(dir_layers / "a.layer"))
+    self.assertEqual(code, 0)
+    (dir_layers / "b.layer").write_text("not a dwarfs filesystem")
+    os.environ["FIM_LAYERS"] = str(dir_layers)
+    try:
+      # First boot checks both files
+      os.environ["FIM_DEBUG"] = "1"
+      out, err, code = run_cmd(self.file_image, "fim-layer", "list")
+      self.assertEqual(code, 0)
+      self.assertIn("Layer files cached: 0, to check: 2", out + err)
+      self.assertIn("Skipping invalid dwarfs filesystem", out + err)
+      # Second boot uses the cached results
+      out, err, code = run_cmd(self.file_image, "fim-layer", "list")
+      self.assertEqual(code, 0)
+      self.assertIn("Layer files cached: 2, to check: 0", out + err)
+      self.assertIn("Skipping invalid dwarfs filesystem", out + err)
+      # Modifying a file makes it checked again
+      (dir_layers / "b.layer").write_text("still not a dwarfs filesystem")
+      out, err, code = run_cmd(self.file_image, "fim-layer", "list")
+      self.assertEqual(code, 0)
+      self.assertIn("Layer files cached: 1, to check: 1", out + err)
+      os.environ["FIM_DEBUG"] = "0"
+      # Only the valid layer is listed
+      out, _, code = run_cmd(self.file_image, "fim-layer", "list")
+      self.assertEqual(code, 0)
+      self.assertIn("a.layer", out)
+      self.assertNotIn("b.layer", out)
+    finally:
+      os.environ["FIM_DEBUG"] = "0"
+      del os.environ["FIM_LAYERS"]
+
+  def test_list_duplicate_layer(self):
+    """Test that a layer given twice is listed twice and mounted once"""
+    self.create_script("duplicate layer")
+    _, _, code = run_cmd(self.file_image, "fim-layer", "create", str(self.dir_image / "root"), str(self.file_layer_external))
+    self.assertEqual(code, 0)
+    os.environ["FIM_LAYERS"] = "{0}:{0}".format(self.file_layer_external)
+    try:
+      out, _, code = run_cmd(self.file_image, "fim-layer", "list")
+      self.assertEqual(code, 0)
+      self.assertEqual(out.count(self.file_layer_external.name), 2)
+      count_layers = len(out.strip().split('\n'))
+      # The lower copy is skipped, the topmost one is mounted
+      os.environ["FIM_DEBUG"] = "1"
+      out, err, code = run_cmd(self.file_image, "fim-exec", "hello-world.sh")
+      self.assertEqual(code, 0)
+      self.assertIn("duplicate layer", out)
+      self.assertIn("Layer {} is a copy of layer {}, mounted once".format(count_layers - 2, count_layers - 1), out + err)
+    finally:
+      os.environ["FIM_DEBUG"] = "0"
+      del os.environ["FIM_LAYERS"]
+
   def test_list_format_validation(self):
     """Test that list output format is correct"""
     out, err, code = run_cmd(self.file_image, "fim-layer", "list")
@@ -0,0 +1,95 @@
+#!/bin/python3
+
+import os
+import shutil
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerRebase(LayerTestBase):
+  """Test suite for fim-layer rebase command"""
+
+  def commit(self, content):
+    """Commits a layer with a novel script that echoes 'content'"""
+    self.create_script(content)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertIn("Filesystem appended to binary", out)
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+
+  def list_layers(self):
+    """Lists the layers of the image as (offset, size) pairs"""
+    out,_,code = run_cmd(self.file_image, "fim-layer", "list")
+    self.assertEqual(code, 0)
+    return [tuple(map(int, line.split(':')[1:3])) for line in out.strip().splitlines()]
+
+  def test_rebase(self):
+    """Test rebasing keeps the layer count and the visible files"""
+    for i in ["first layer", "second layer", "third layer"]:
+      self.commit(i)
+    self.assertEqual(len(self.list_layers()), 4)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "rebase", "1", "3")
+    self.assertIn("Rebased layers 1 to 3", out)
+    self.assertEqual(code, 0)
+    self.assertEqual(len(self.list_layers()), 4)
+    # The top-most file is the visible one
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertIn("third layer", out)
+    self.assertEqual(code, 0)
+
+  def test_rebase_drops_shadowed(self):
+    """Test a large file replaced in an upper layer is dropped from the lower layer"""
+    # Commit a large incompressible file
+    dir_root = self.dir_image / "root"
+    self.create_script("first layer")
+    (dir_root / "usr" / "bin" / "blob").write_bytes(os.urandom(4 * 1024 * 1024))
+    _,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    # Replace it with a small file
+    self.create_script("second layer")
+    (dir_root / "usr" / "bin" / "blob").write_text("small")
+    _,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    size_before = self.file_image.stat().st_size
+    out,_,code = run_cmd(self.file_image, "fim-layer", "rebase", "1", "2")
+    self.assertEqual(code, 0)
+    self.assertLess(self.file_image.stat().st_size, size_before - 1024 * 1024)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/usr/bin/blob")
+    self.assertEqual(out, "small")
+    self.assertEqual(code, 0)
+
+  def test_rebase_whiteout(self):
+    """Test a file deleted in an upper layer stays deleted after rebasing"""
+    self.commit("first layer")
+    _,_,code = run_cmd(self.file_image, "fim-root", "rm", "/usr/bin/hello-world.sh")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "rebase", "1", "2")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertEqual(code, 127)
+
+  def test_rebase_cli(self):
+    """Test CLI argument validation for rebase command"""
+    # Single argument
+    out,err,code = run_cmd(self.file_image, "fim-layer", "rebase", "1")
+    self.assertEqual(out, "")
+    self.assertIn("rebase requires two arguments (<begin> <end>)", err)
+    self.assertEqual(code, 125)
+    # No range
+    out,err,code = run_cmd(self.file_image, "fim-layer", "rebase")
+    self.assertEqual(out, "")
+    self.assertIn("rebase requires two arguments (<begin> <end>)", err)
+    self.assertEqual(code, 125)
+    # Not a number
+    out,err,code = run_cmd(self.file_image, "fim-layer", "rebase", "a", "b")
+    self.assertEqual(out, "")
+    self.assertIn("Index arguments for 'rebase' must be numbers", err)
+    self.assertEqual(code, 125)
+    # Out of bounds
+    _,err,code = run_cmd(self.file_image, "fim-layer", "rebase", "0", "10")
+    self.assertIn("Layer index '10' is out of bounds", err)
+    self.assertEqual(code, 125)
@@ -0,0 +1,119 @@
+#!/bin/python3
+
+import os
+import re
+import shutil
+import threading
+from functools import partial
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+from pathlib import Path
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class RangeHandler(SimpleHTTPRequestHandler):
+  """Serves files with support for single byte ranges"""
+
+  def log_message(self, *args):
+    pass
+
+  def send_head(self):
+    match = re.fullmatch(r"bytes=(\d+)-(\d+)", self.headers.get("Range", ""))
+    if not match:
+      return super().send_head()
+    path = Path(self.translate_path(self.path))
+    if not path.is_file():
+      self.send_error(404)
+      return None
+    size = path.stat().st_size
+    start, end = int(match.group(1)), min(int(match.group(2)), size - 1)
+    file = open(path, "rb")
+    file.seek(start)
+    self.send_response(206)
+    self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+    self.send_header("Content-Length", str(end - start + 1))
+    self.end_headers()
+    self.wfile.write(file.read(end - start + 1))
+    file.close()
+    return None
+
+class TestFimLayerRemote(LayerTestBase):
+  """Test suite for layers given by URL in FIM_LAYERS"""
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls.dir_serve = cls.dir_data / "remote_serve"
+    cls.dir_cache = Path(os.environ.get("XDG_CACHE_HOME", Path.home() / ".cache")) / "flatimage" / "remote"
+
+  def setUp(self):
+    super().setUp()
+    shutil.rmtree(self.dir_serve, ignore_errors=True)
+    shutil.rmtree(self.dir_cache, ignore_errors=True)
+    self.dir_serve.mkdir(parents=True)
+    dir_root = self.dir_data / "remote_root"
+    shutil.rmtree(dir_root, ignore_errors=True)
+    (dir_root / "opt" / "remote").mkdir(parents=True)
+    (dir_root / "opt" / "remote" / "marker").write_text("remote layer\n")
+    _,err,code = run_cmd(self.file_image, "fim-layer", "create", str(dir_root), str(self.dir_serve / "remote.layer"))
+    self.assertEqual(code, 0, err)
+    shutil.rmtree(dir_root, ignore_errors=True)
+    self.server = ThreadingHTTPServer(("127.0.0.1", 0), partial(RangeHandler, directory=str(self.dir_serve)))
+    self.thread = threading.Thread(target=self.server.serve_forever, daemon=True)
+    self.thread.start()
+    self.url = f"http://127.0.0.1:{self.server.server_address[1]}/remote.layer"
+
+  def tearDown(self):
+    self.server.shutdown()
+    self.server.server_close()
+    super().tearDown()
+    os.environ.pop("FIM_LAYERS", None)
+    shutil.rmtree(self.dir_serve, ignore_errors=True)
+    shutil.rmtree(self.dir_cache, ignore_errors=True)
+
+  def test_remote_layer(self):
+    """Test that a remote layer is downloaded once and mounted from the cache"""
+    os.environ["FIM_LAYERS"] = self.url
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    self.assertEqual(code, 0, err)
+    self.assertIn("remote layer", out)
+    self.assertEqual(len(list(self.dir_cache.glob("*.layer"))), 1)
+    self.assertEqual(list(self.dir_cache.glob("*.part")), [])
+    # The cache is private to the user
+    self.assertEqual(self.dir_cache.stat().st_mode & 0o777, 0o700)
+    # The next boot does not contact the server
+    self.server.shutdown()
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    self.assertEqual(code, 0, err)
+    self.assertIn("remote layer", out)
+
+  def test_remote_layer_with_paths(self):
+    """Test that the scheme of a URL is not split from the rest of it"""
+    dir_layers = self.dir_data / "remote_layers"
+    dir_layers.mkdir(parents=True, exist_ok=True)
+    os.environ["FIM_LAYERS"] = f"{dir_layers}:{self.url}"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    shutil.rmtree(dir_layers, ignore_errors=True)
+    self.assertEqual(code, 0, err)
+    self.assertIn("remote layer", out)
+
+  def test_remote_layer_unreachable(self):
+    """Test that an unreachable remote layer is skipped"""
+    os.environ["FIM_LAYERS"] = self.url.replace("remote.layer", "missing.layer")
+    _,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    self.assertNotEqual(code, 0)
+    self.assertEqual(list(self.dir_cache.glob("*.layer")), [])
+
+  def test_remote_layer_tampered(self):
+    """Test that a cached layer that does not match its record is downloaded again"""
+    os.environ["FIM_LAYERS"] = self.url
+    _,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    self.assertEqual(code, 0, err)
+    file_layer = next(self.dir_cache.glob("*.layer"))
+    # Same size, different contents
+    data = bytearray(file_layer.read_bytes())
+    data[-1] ^= 0xff
+    file_layer.write_bytes(bytes(data))
+    out,err,code = run_cmd(self.file_image, "fim-exec", "cat", "/opt/remote/marker")
+    self.assertEqual(code, 0, err)
+    self.assertIn("remote layer", out)
+    self.assertEqual(file_layer.read_bytes(), (self.dir_serve / "remote.layer").read_bytes())
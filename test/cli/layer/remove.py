@@ -0,0 +1,106 @@
+#!/bin/python3
+
+import os
+import shutil
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerRemove(LayerTestBase):
+  """Test suite for fim-layer remove and compact commands"""
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls.file_layer = cls.dir_data / "remove.layer"
+
+  def tearDown(self):
+    super().tearDown()
+    if self.file_layer.exists():
+      os.unlink(self.file_layer)
+
+  def commit(self, content):
+    """Commits a layer with a novel script that echoes 'content'"""
+    self.create_script(content)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertIn("Filesystem appended to binary", out)
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+
+  def count_layers(self):
+    """Counts the number of layers in the image"""
+    out,_,code = run_cmd(self.file_image, "fim-layer", "list")
+    self.assertEqual(code, 0)
+    return len(out.strip().splitlines())
+
+  def hello(self):
+    """Runs the script of the top-most layer that has it"""
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertEqual(code, 0)
+    return out
+
+  def test_remove_top(self):
+    """Test removing the top-most layer truncates the binary"""
+    self.commit("first layer")
+    size = os.path.getsize(self.file_image)
+    self.commit("second layer")
+    out,_,code = run_cmd(self.file_image, "fim-layer", "remove", "2")
+    self.assertEqual(code, 0)
+    self.assertIn("Removed layer 2", out)
+    self.assertEqual(os.path.getsize(self.file_image), size)
+    self.assertEqual(self.count_layers(), 2)
+    self.assertIn("first layer", self.hello())
+
+  def test_remove_middle(self):
+    """Test removing a layer keeps the layers above it"""
+    for i in ["first layer", "second layer", "third layer"]:
+      self.commit(i)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "remove", "3")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-layer", "remove", "1")
+    self.assertEqual(code, 0)
+    self.assertEqual(self.count_layers(), 2)
+    self.assertIn("second layer", self.hello())
+
+  def test_remove_cli(self):
+    """Test CLI argument validation for remove command"""
+    _,err,code = run_cmd(self.file_image, "fim-layer", "remove")
+    self.assertIn("remove requires exactly one argument (<index>)", err)
+    self.assertEqual(code, 125)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "remove", "a")
+    self.assertIn("Index argument for 'remove' must be a number", err)
+    self.assertEqual(code, 125)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "remove", "0")
+    self.assertIn("The base layer cannot be removed", err)
+    self.assertEqual(code, 125)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "remove", "10")
+    self.assertIn("Layer '10' is not embedded in the binary", err)
+    self.assertEqual(code, 125)
+
+  def test_compact_copies(self):
+    """Test compact drops a layer identical to a layer above it"""
+    self.create_script("copied layer")
+    _,_,code = run_cmd(self.file_image, "fim-layer", "create", str(self.dir_image / "root"), str(self.file_layer))
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    for _ in range(2):
+      _,_,code = run_cmd(self.file_image, "fim-layer", "add", str(self.file_layer))
+      self.assertEqual(code, 0)
+    self.commit("top layer")
+    self.assertEqual(self.count_layers(), 4)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "compact")
+    self.assertEqual(code, 0)
+    self.assertIn("Dropping layer 1, a copy of layer 2", out)
+    self.assertEqual(self.count_layers(), 3)
+    self.assertIn("top layer", self.hello())
+
+  def test_compact_trailing(self):
+    """Test compact drops the data after the last layer"""
+    size = os.path.getsize(self.file_image)
+    with open(self.file_image, "ab") as f:
+      f.write(b"\0" * 4096)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "compact")
+    self.assertEqual(code, 0)
+    self.assertIn("after the last layer", out)
+    self.assertEqual(os.path.getsize(self.file_image), size)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "true")
+    self.assertEqual(code, 0)
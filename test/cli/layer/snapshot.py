@@ -0,0 +1,62 @@
+#!/bin/python3
+
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerSnapshot(LayerTestBase):
+  """Test suite for fim-layer snapshot command"""
+
+  def test_snapshot_restore(self):
+    """Test that a restore brings back the changes of the snapshot"""
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo before > /snapshot.txt")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create", "checkpoint")
+    self.assertEqual(code, 0)
+    self.assertIn("Created snapshot 'checkpoint'", out + err)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo after > /snapshot.txt; touch /novel.txt")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "restore", "checkpoint")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/snapshot.txt")
+    self.assertEqual(code, 0)
+    self.assertEqual(out.strip(), "before")
+    self.assertFalse((self.dir_image / "root" / "novel.txt").exists())
+    # The snapshot is kept after the restore
+    out,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "list")
+    self.assertEqual(code, 0)
+    self.assertEqual(out.splitlines(), ["checkpoint"])
+
+  def test_snapshot_default_name(self):
+    """Test that snapshots without a name are named after the current time"""
+    _,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "list")
+    self.assertEqual(code, 0)
+    self.assertRegex(out.strip(), r"^\d{8}-\d{6}$")
+
+  def test_snapshot_delete(self):
+    """Test that a deleted snapshot is no longer listed"""
+    _,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create", "temporary")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "delete", "temporary")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "list")
+    self.assertEqual(code, 0)
+    self.assertEqual(out.strip(), "")
+
+  def test_snapshot_errors(self):
+    """Test that invalid names and missing snapshots are rejected"""
+    _,_,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create", "checkpoint")
+    self.assertEqual(code, 0)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create", "checkpoint")
+    self.assertNotEqual(code, 0)
+    self.assertIn("already exists", err)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "snapshot", "restore", "missing")
+    self.assertNotEqual(code, 0)
+    self.assertIn("does not exist", err)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "snapshot", "create", "../escape")
+    self.assertNotEqual(code, 0)
+    self.assertIn("Invalid snapshot name", err)
+    _,err,code = run_cmd(self.file_image, "fim-layer", "snapshot", "restore")
+    self.assertEqual(code, 125)
+    self.assertIn("Missing name", err)
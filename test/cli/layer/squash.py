@@ -0,0 +1,100 @@
+#!/bin/python3
+
+import os
+import shutil
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerSquash(LayerTestBase):
+  """Test suite for fim-layer squash command"""
+
+  def commit(self, content):
+    """Commits a layer with a novel script that echoes 'content'"""
+    self.create_script(content)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertIn("Filesystem appended to binary", out)
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+
+  def count_layers(self):
+    """Counts the number of layers in the image"""
+    out,_,code = run_cmd(self.file_image, "fim-layer", "list")
+    self.assertEqual(code, 0)
+    return len(out.strip().splitlines())
+
+  def test_squash(self):
+    """Test squashing committed layers into a single layer"""
+    for i in ["first layer", "second layer", "third layer"]:
+      self.commit(i)
+    self.assertEqual(self.count_layers(), 4)
+    # Squash all committed layers
+    out,_,code = run_cmd(self.file_image, "fim-layer", "squash")
+    self.assertIn("Squashed layers 1 to 3 into layer 1", out)
+    self.assertEqual(code, 0)
+    self.assertEqual(self.count_layers(), 2)
+    # The top-most file is the visible one
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertIn("third layer", out)
+    self.assertEqual(code, 0)
+
+  def test_squash_range(self):
+    """Test squashing a range keeps the layers above it"""
+    for i in ["first layer", "second layer", "third layer"]:
+      self.commit(i)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "squash", "1", "2")
+    self.assertIn("Squashed layers 1 to 2 into layer 1", out)
+    self.assertEqual(code, 0)
+    self.assertEqual(self.count_layers(), 3)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertIn("third layer", out)
+    self.assertEqual(code, 0)
+
+  def test_squash_whiteout(self):
+    """Test a file deleted in an upper layer stays deleted after squashing"""
+    self.commit("first layer")
+    _,_,code = run_cmd(self.file_image, "fim-root", "rm", "/usr/bin/hello-world.sh")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    out,_,code = run_cmd(self.file_image, "fim-layer", "squash")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertEqual(code, 127)
+
+  def test_squash_recreated(self):
+    """Test a file deleted and then created again stays visible after squashing the range"""
+    self.commit("first layer")
+    _,_,code = run_cmd(self.file_image, "fim-root", "rm", "/usr/bin/hello-world.sh")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+    shutil.rmtree(self.dir_image, ignore_errors=True)
+    self.commit("third layer")
+    # The whiteout of layer 2 is kept, as the range does not start at layer 0
+    out,_,code = run_cmd(self.file_image, "fim-layer", "squash", "2", "3")
+    self.assertIn("Squashed layers 2 to 3 into layer 2", out)
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "hello-world.sh")
+    self.assertIn("third layer", out)
+    self.assertEqual(code, 0)
+    # The binary is replaced by its rewritten copy
+    dir_binary = os.path.dirname(os.path.abspath(self.file_image))
+    self.assertEqual([e for e in os.listdir(dir_binary) if e.endswith(".rewrite")], [])
+
+  def test_squash_cli(self):
+    """Test CLI argument validation for squash command"""
+    # Single argument
+    out,err,code = run_cmd(self.file_image, "fim-layer", "squash", "1")
+    self.assertEqual(out, "")
+    self.assertIn("squash requires zero or two arguments (<begin> <end>)", err)
+    self.assertEqual(code, 125)
+    # Not a number
+    out,err,code = run_cmd(self.file_image, "fim-layer", "squash", "a", "b")
+    self.assertEqual(out, "")
+    self.assertIn("Index arguments for 'squash' must be numbers", err)
+    self.assertEqual(code, 125)
+    # Out of bounds
+    _,err,code = run_cmd(self.file_image, "fim-layer", "squash", "0", "10")
+    self.assertIn("Layer index '10' is out of bounds", err)
+    self.assertEqual(code, 125)
@@ -0,0 +1,86 @@
+#!/bin/python3
+
+import os
+from .common import LayerTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLayerVerify(LayerTestBase):
+  """Test suite for fim-layer verify command"""
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls.file_layer_external = cls.dir_data / "verify.layer"
+
+  def tearDown(self):
+    super().tearDown()
+    if "FIM_LAYERS" in os.environ:
+      del os.environ["FIM_LAYERS"]
+    if self.file_layer_external.exists():
+      os.unlink(self.file_layer_external)
+
+  def create_external_layer(self):
+    """Creates an external layer and loads it through FIM_LAYERS"""
+    self.create_script("verify layer")
+    _, _, code = run_cmd(self.file_image, "fim-layer", "create", str(self.dir_image / "root"), str(self.file_layer_external))
+    self.assertEqual(code, 0)
+    os.environ["FIM_LAYERS"] = str(self.file_layer_external)
+
+  def overwrite(self, position, data):
+    """Overwrites bytes of the external layer without changing its modification time"""
+    st = os.stat(self.file_layer_external)
+    with open(self.file_layer_external, "r+b") as f:
+      f.seek(position)
+      f.write(data)
+    os.utime(self.file_layer_external, ns=(st.st_atime_ns, st.st_mtime_ns))
+
+  def test_verify_quick(self):
+    """Test that the quick mode checks the section headers of every layer"""
+    out, _, code = run_cmd(self.file_image, "fim-layer", "verify", "quick")
+    self.assertEqual(code, 0)
+    self.assertIn("Layer 0 is intact", out)
+    self.assertNotIn("hash", out)
+    self.assertIn("Verified", out)
+
+  def test_verify_records_and_matches_hashes(self):
+    """Test that the first full run records the hashes and the next one compares them"""
+    out, _, code = run_cmd(self.file_image, "fim-layer", "verify")
+    self.assertEqual(code, 0)
+    self.assertIn("(recorded)", out)
+    out, _, code = run_cmd(self.file_image, "fim-layer", "verify")
+    self.assertEqual(code, 0)
+    self.assertIn("(matches)", out)
+    self.assertNotIn("(recorded)", out)
+
+  def test_verify_detects_changed_data(self):
+    """Test that data changed in place is reported as corrupted"""
+    self.create_external_layer()
+    _, _, code = run_cmd(self.file_image, "fim-layer", "verify")
+    self.assertEqual(code, 0)
+    # Flip a byte in the middle of the layer, the headers stay intact
+    size = os.path.getsize(self.file_layer_external)
+    with open(self.file_layer_external, "rb") as f:
+      f.seek(size // 2)
+      byte = f.read(1)
+    self.overwrite(size // 2, bytes([byte[0] ^ 0xff]))
+    _, _, code = run_cmd(self.file_image, "fim-layer", "verify", "quick")
+    self.assertEqual(code, 0)
+    _, err, code = run_cmd(self.file_image, "fim-layer", "verify")
+    self.assertNotEqual(code, 0)
+    self.assertIn("differs from the stored hash", err)
+    self.assertIn("1 of", err)
+
+  def test_verify_detects_broken_headers(self):
+    """Test that a broken section header is reported by the quick mode"""
+    self.create_external_layer()
+    # The number of the first section is at byte 48 of its header
+    self.overwrite(48, b"\xff\xff\xff\xff")
+    _, err, code = run_cmd(self.file_image, "fim-layer", "verify", "quick")
+    self.assertNotEqual(code, 0)
+    self.assertIn("is corrupted", err)
+
+  def test_verify_invalid_mode(self):
+    """Test that an unknown mode is rejected"""
+    _, err, code = run_cmd(self.file_image, "fim-layer", "verify", "slow")
+    self.assertNotEqual(code, 0)
+    self.assertIn("Invalid mode", err)
@@ -0,0 +1,17 @@
+#!/bin/python3
+"""
+Base test class for limit tests.
+"""
+
+from cli.test_base import TestBase
+
+class LimitTestBase(TestBase):
+  """
+  Base class for limit tests. Provides common setup/teardown and utilities for testing fim-limit.
+  """
+
+  def setUp(self):
+    super().setUp()
+
+  def tearDown(self):
+    super().tearDown()
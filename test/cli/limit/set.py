@@ -0,0 +1,72 @@
+#!/bin/python3
+"""
+Test suite for fim-limit command.
+"""
+
+from .common import LimitTestBase
+from cli.test_runner import run_cmd
+
+class TestFimLimitSet(LimitTestBase):
+  """
+  Tests for fim-limit - configuring the cgroup limits of the sandbox.
+  """
+
+  def test_limit_set(self):
+    """Test setting, listing and deleting limits."""
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "cpu.max", "50000 100000")
+    self.assertIn("Set 'cpu.max' to '50000 100000'", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "memory.max", "2G")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "accounting", "on")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "list")
+    self.assertEqual(out.splitlines(), ["cpu.max=50000 100000", "memory.max=2G", "accounting=on"])
+    self.assertEqual(code, 0)
+    # The sandbox still runs when the host does not delegate the controllers
+    out,err,code = run_cmd(self.file_image, "fim-exec", "echo", "hello")
+    self.assertIn("hello", out)
+    self.assertEqual(code, 0)
+    # Delete and clear
+    out,err,code = run_cmd(self.file_image, "fim-limit", "del", "cpu.max")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "list")
+    self.assertEqual(out.splitlines(), ["memory.max=2G", "accounting=on"])
+    out,err,code = run_cmd(self.file_image, "fim-limit", "clear")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "list")
+    self.assertEqual(out, "")
+
+  def test_limit_invalid(self):
+    """Test invalid options and values."""
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "cpu.foo", "1")
+    self.assertIn("Invalid limit option", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "cpu.weight", "0")
+    self.assertIn("Invalid value '0' for option 'cpu.weight'", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "memory.high", "lots")
+    self.assertIn("Invalid value 'lots' for option 'memory.high'", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "list", "foo")
+    self.assertIn("Trailing arguments for fim-limit", err)
+    self.assertEqual(code, 125)
+
+  def test_limit_affinity(self):
+    """Test the placement of the program and of the fuse filesystems."""
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "affinity", "0")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "affinity.fuse", "0")
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "list")
+    self.assertEqual(out.splitlines(), ["affinity=0", "affinity.fuse=0"])
+    # The program runs on the configured cpu
+    out,err,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "grep Cpus_allowed_list /proc/self/status")
+    self.assertEqual(out, "Cpus_allowed_list:\t0")
+    self.assertEqual(code, 0)
+    # Invalid placement
+    out,err,code = run_cmd(self.file_image, "fim-limit", "set", "affinity", "a-b")
+    self.assertIn("Invalid value 'a-b' for option 'affinity'", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-limit", "clear")
+    self.assertEqual(code, 0)
@@ -0,0 +1,50 @@
+#!/bin/python3
+
+from .common import OverlayTestBase
+from cli.test_runner import run_cmd
+
+class TestFimOverlayFallback(OverlayTestBase):
+  """Test suite for fim-overlay fallback command"""
+
+  def test_fallback_keeps_overlay(self):
+    """Test that the fallback and the overlay type are set independently"""
+    def check_overlay(name):
+      out,err,code = run_cmd(self.file_image, "fim-overlay", "show")
+      self.assertEqual(out, name)
+      self.assertEqual(err, "")
+      self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "set", "overlayfs")
+    self.assertEqual(code, 0)
+    for fallback in ["overlayfs", "unionfs"]:
+      out,err,code = run_cmd(self.file_image, "fim-overlay", "fallback", fallback)
+      self.assertEqual(out, "")
+      self.assertEqual(err, "")
+      self.assertEqual(code, 0)
+      check_overlay("OVERLAYFS")
+    # Setting the overlay type keeps the fallback
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "set", "bwrap")
+    self.assertEqual(code, 0)
+    check_overlay("BWRAP")
+
+  def test_fallback_cli(self):
+    """Test CLI argument validation for fallback command"""
+    # Missing arguments
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "fallback")
+    self.assertEqual(out, "")
+    self.assertIn("Missing argument for 'fallback'", err)
+    self.assertEqual(code, 125)
+    # Invalid arguments
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "fallback", "foo")
+    self.assertEqual(out, "")
+    self.assertIn("Invalid overlay type", err)
+    self.assertEqual(code, 125)
+    # The kernel overlay cannot be its own fallback
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "fallback", "bwrap")
+    self.assertEqual(out, "")
+    self.assertIn("The fallback must be a fuse overlay", err)
+    self.assertEqual(code, 125)
+    # Trailing arguments
+    out,err,code = run_cmd(self.file_image, "fim-overlay", "fallback", "unionfs", "foo")
+    self.assertEqual(out, "")
+    self.assertIn("Trailing arguments for fim-overlay: ['foo',]", err)
+    self.assertEqual(code, 125)
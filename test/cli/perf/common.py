@@ -0,0 +1,17 @@
+#!/bin/python3
+"""
+Base test class for perf tests.
+"""
+
+from cli.test_base import TestBase
+
+class PerfTestBase(TestBase):
+  """
+  Base class for perf tests. Provides common setup/teardown and utilities for testing fim-perf.
+  """
+
+  def setUp(self):
+    super().setUp()
+
+  def tearDown(self):
+    super().tearDown()
@@ -0,0 +1,150 @@
+#!/bin/python3
+"""
+Test suite for fim-perf command.
+"""
+
+import os
+from .common import PerfTestBase
+from cli.test_runner import run_cmd
+
+class TestFimPerfSet(PerfTestBase):
+  """
+  Tests for fim-perf - configuring dwarfs tuning options.
+  """
+
+  def test_perf_set(self):
+    """Test setting global and per-layer options."""
+    # Global option
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "cachesize", "1g")
+    self.assertIn("Set 'cachesize' to '1g' for all layers", out)
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    # Layer option
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "workers", "4", "0")
+    self.assertIn("Set 'workers' to '4' for layer '0'", out)
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    # List
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out.splitlines(), ["global:cachesize=1g", "0:workers=4"])
+    self.assertEqual(code, 0)
+    # The options are passed to dwarfs
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true")
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertIn("cachesize=1g,workers=4", out + err)
+    self.assertEqual(code, 0)
+
+  def test_perf_env(self):
+    """Test environment variables override the configured options."""
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "cachesize", "1g")
+    self.assertEqual(code, 0)
+    os.environ["FIM_DEBUG"] = "1"
+    env = os.environ.copy()
+    env["FIM_DWARFS_CACHESIZE"] = "256m"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true", env=env)
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertIn("cachesize=256m", out + err)
+    self.assertEqual(code, 0)
+
+  def test_perf_del_clear(self):
+    """Test deleting and clearing options."""
+    run_cmd(self.file_image, "fim-perf", "set", "cachesize", "1g")
+    run_cmd(self.file_image, "fim-perf", "set", "readahead", "32m")
+    out,err,code = run_cmd(self.file_image, "fim-perf", "del", "cachesize")
+    self.assertIn("Erase option 'cachesize'", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "global:readahead=32m")
+    out,err,code = run_cmd(self.file_image, "fim-perf", "clear")
+    self.assertIn("Cleared perf options", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "")
+
+  def test_perf_profile(self):
+    """Test setting, listing and clearing the layer profile."""
+    out,err,code = run_cmd(self.file_image, "fim-perf", "profile", "random-access", "--block-size-bits", "19")
+    self.assertIn("Set the layer profile to 'random-access'", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "profile:random-access --block-size-bits 19")
+    out,err,code = run_cmd(self.file_image, "fim-perf", "profile", "none")
+    self.assertIn("Cleared the layer profile", out)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "")
+    out,err,code = run_cmd(self.file_image, "fim-perf", "profile", "tiny")
+    self.assertIn("Invalid profile 'tiny'", err)
+    self.assertEqual(code, 125)
+
+  def test_perf_cli(self):
+    """Test CLI argument validation."""
+    out,err,code = run_cmd(self.file_image, "fim-perf")
+    self.assertIn("Missing op for 'fim-perf' (<set|del|list|clear|profile>)", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "invalid", "1")
+    self.assertIn("Invalid perf option", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "cachesize")
+    self.assertIn("Incorrect number of arguments for 'set' (<option> <value> [layer])", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "cachesize", "1g", "x")
+    self.assertIn("Layer index argument for 'fim-perf' is not a number", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "set", "cachesize", "1g,allow_other")
+    self.assertIn("Invalid value '1g,allow_other' for option 'cachesize'", err)
+    self.assertEqual(code, 125)
+
+  def test_perf_budget(self):
+    """Test splitting a cache budget across the layers."""
+    out,err,code = run_cmd(self.file_image, "fim-perf", "budget", "64m")
+    self.assertIn("Set the cache budget to '64m'", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "budget:64m")
+    # The only layer gets the whole budget
+    os.environ["FIM_DEBUG"] = "1"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true")
+    self.assertIn("cachesize={}".format(64 << 20), out + err)
+    self.assertEqual(code, 0)
+    # The environment overrides the budget
+    env = os.environ.copy()
+    env["FIM_DWARFS_BUDGET"] = "32m"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "true", env=env)
+    os.environ["FIM_DEBUG"] = "0"
+    self.assertIn("cachesize={}".format(32 << 20), out + err)
+    # Invalid sizes
+    out,err,code = run_cmd(self.file_image, "fim-perf", "budget", "lots")
+    self.assertIn("Invalid size 'lots'", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "budget", "none")
+    self.assertIn("Cleared the cache budget", out)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "")
+
+  def test_perf_shm(self):
+    """Test mounting a private tmpfs to /dev/shm."""
+    out,err,code = run_cmd(self.file_image, "fim-perf", "shm", "64m")
+    self.assertIn("Set the shm mount to '64m'", out)
+    self.assertEqual(code, 0)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "shm:64m")
+    # Only with the shm permission
+    run_cmd(self.file_image, "fim-perms", "add", "shm")
+    out,err,code = run_cmd(self.file_image, "fim-exec", "df", "-k", "--output=size", "/dev/shm")
+    self.assertEqual(code, 0, err)
+    self.assertIn("65536", out)
+    # The environment overrides the configured mount
+    env = os.environ.copy()
+    env["FIM_SHM"] = "32m"
+    out,err,code = run_cmd(self.file_image, "fim-exec", "df", "-k", "--output=size", "/dev/shm", env=env)
+    self.assertIn("32768", out)
+    run_cmd(self.file_image, "fim-perms", "del", "shm")
+    # Invalid values
+    out,err,code = run_cmd(self.file_image, "fim-perf", "shm", "lots")
+    self.assertIn("Invalid shm 'lots'", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "shm", "none")
+    self.assertIn("Cleared the shm mount", out)
+    out,err,code = run_cmd(self.file_image, "fim-perf", "list")
+    self.assertEqual(out, "")
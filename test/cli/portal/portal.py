@@ -1,5 +1,7 @@
 #!/bin/python3
 
+import json
+import os
 import subprocess
 from .common import PortalTestBase
 from cli.test_runner import run_cmd
@@ -57,3 +59,100 @@ class TestFimPortal(PortalTestBase):
     # Error message should indicate the program was not found
     self.assertIn("program not found", err)
     self.assertEqual(code, 1)
+
+  def test_portal_large_environment(self):
+    """Test portal requests larger than a single read of the daemon"""
+    env = dict(os.environ, FIM_TEST_LARGE="x" * 65536)
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "fim_portal", "sh", "-c", 'printf "%s" "$FIM_TEST_LARGE" | wc -c'],
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True,
+      env=env
+    )
+    self.assertEqual(result.stdout.strip(), "65536")
+    self.assertEqual(result.returncode, 0)
+
+  def test_portal_concurrent_requests(self):
+    """Test concurrent portal requests with large messages do not interleave"""
+    env = dict(os.environ, FIM_TEST_LARGE="x" * 32768)
+    script = 'for i in 0 1 2 3 4 5 6 7; do fim_portal echo "$i" > "/tmp/fim-portal-$i" & done; wait; cat /tmp/fim-portal-*'
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "sh", "-c", script],
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True,
+      env=env
+    )
+    self.assertEqual(result.stdout.split(), [str(i) for i in range(8)])
+    self.assertEqual(result.returncode, 0)
+
+  def test_portal_environment_delta(self):
+    """Test the environment of the caller reaches the portal process"""
+    script = 'export FIM_TEST_CHANGED=guest; unset FIM_TEST_REMOVED; fim_portal sh -c \'echo "$FIM_TEST_CHANGED:${FIM_TEST_REMOVED-unset}"\''
+    env = dict(os.environ, FIM_TEST_CHANGED="host", FIM_TEST_REMOVED="1")
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "sh", "-c", script],
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True,
+      env=env
+    )
+    self.assertEqual(result.stdout.strip(), "guest:unset")
+    self.assertEqual(result.returncode, 0)
+
+  def test_portal_workers(self):
+    """Test portal requests served by the pre-forked workers"""
+    env = dict(os.environ, FIM_PORTAL_WORKERS="2", FIM_PORTAL_MAX_REQUESTS="4")
+    script = 'for i in 0 1 2 3 4 5 6 7; do fim_portal sh -c "echo $i; exit $i" > "/tmp/fim-worker-$i"; echo "$?" >> "/tmp/fim-worker-$i" & done; wait; cat /tmp/fim-worker-*'
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "sh", "-c", script],
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True,
+      env=env
+    )
+    self.assertEqual(result.stdout.split(), [str(i) for i in range(8) for _ in range(2)])
+    self.assertEqual(result.returncode, 0)
+
+  def test_portal_session(self):
+    """Test several portal requests through a single session"""
+    commands = "echo one\nsh -c 'echo \"two three\"'\n\nsh -c 'exit 3'\necho four\n"
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "fim_portal", "--session"],
+      input=commands,
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True
+    )
+    self.assertEqual(result.stdout.splitlines(), ["one", "two three", "four"])
+    self.assertEqual(result.returncode, 3)
+    # Concurrent jobs run every command
+    commands = "".join(f"echo {i}\n" for i in range(16))
+    result = subprocess.run(
+      [self.file_image, "fim-exec", "fim_portal", "--session=4"],
+      input=commands,
+      stdout=subprocess.PIPE,
+      stderr=subprocess.PIPE,
+      text=True
+    )
+    self.assertEqual(sorted(result.stdout.split(), key=int), [str(i) for i in range(16)])
+    self.assertEqual(result.returncode, 0)
+
+  def test_portal_snapshot(self):
+    """Test the portal processes read their configuration from the snapshot of the instance"""
+    script = 'echo "${FIM_DAEMON_CFG-unset}:${FIM_DISPATCHER_CFG-unset}"; cat "$FIM_SNAPSHOT"'
+    out,err,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", script)
+    self.assertEqual(code, 0, err)
+    variables, _, snapshot = out.partition("\n")
+    self.assertEqual(variables, "unset:unset")
+    self.assertEqual(sorted(json.loads(snapshot).keys())
+      , ["daemon_guest", "daemon_host", "dispatcher", "log_guest", "log_host"]
+    )
+    # The dispatcher of the sandbox reaches the host daemon through it
+    out,err,code = run_cmd(self.file_image, "fim-exec", "fim_portal", "echo", "host")
+    self.assertEqual(out, "host")
+    self.assertEqual(code, 0)
+    # A variable takes precedence over the snapshot
+    out,err,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", 'FIM_DISPATCHER_CFG=invalid fim_portal echo host')
+    self.assertNotEqual(code, 0)
@@ -85,3 +85,18 @@ class TestFimRecipeFetch(RecipeTestBase):
     # The new content should have real data from the remote
     self.assertIn("packages", new_content)  # Should have packages array
     self.assertIsInstance(new_content["packages"], list)  # Should be a list
+
+  def test_fetch_revalidates_cached_recipe(self):
+    """Test that fetching an unchanged recipe again keeps the cached copy"""
+    out, err, code = run_cmd(self.file_image, "fim-recipe", "fetch", "xorg")
+    self.assertIn("Successfully downloaded recipe 'xorg'", out)
+    self.assertEqual(code, 0)
+    cache_path = self.get_recipe_cache_path(self.get_distribution(), "xorg")
+    with open(cache_path, 'r') as f:
+      content = json.load(f)
+    # The second fetch sends the validators of the first one
+    out, err, code = run_cmd(self.file_image, "fim-recipe", "fetch", "xorg")
+    self.assertIn("Recipe 'xorg' is up to date", out)
+    self.assertEqual(code, 0)
+    with open(cache_path, 'r') as f:
+      self.assertEqual(json.load(f), content)
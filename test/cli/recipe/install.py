@@ -122,6 +122,21 @@ class TestFimRecipeInstall(RecipeTestBase):
     self.assertIn("Cyclic dependency for recipe 'foo'", err)
     self.assertEqual(code, 125)
 
+  def test_install_shared_dependency_is_not_a_cycle(self):
+    """Test install accepts recipes that share a dependency"""
+    # Create diamond: foo > bar > qux, foo > baz > qux
+    self.create_mock_recipe(self.get_distribution(), "foo", {"description": "foo", "dependencies": ["bar", "baz"], "packages": ["foo"]})
+    self.create_mock_recipe(self.get_distribution(), "bar", {"description": "bar", "dependencies": ["qux"], "packages": ["bar"]})
+    self.create_mock_recipe(self.get_distribution(), "baz", {"description": "baz", "dependencies": ["qux"], "packages": ["baz"]})
+    self.create_mock_recipe(self.get_distribution(), "qux", {"description": "qux", "packages": ["qux"]})
+    out, err, code = run_cmd(self.file_image, "fim-recipe", "install", "foo")
+    for recipe in ["foo", "bar", "baz", "qux"]:
+      self.assertRegex(out, f"Using existing recipe from.*{recipe}.json")
+    self.assertNotIn("Cyclic dependency", err)
+    # Each recipe is resolved once, after its dependencies
+    self.assertIn("Resolved 4 recipes: qux,bar,baz,foo", out)
+    self.assertIn("From cache: qux,bar,baz,foo", out)
+
   def test_recipe_only_dependencies_no_packages(self):
     """Test recipe with only dependencies but no packages"""
     # Create dependencies
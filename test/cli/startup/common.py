@@ -0,0 +1,116 @@
+#!/bin/python3
+
+import json
+import os
+import statistics
+import time
+from pathlib import Path
+from cli.test_base import TestBase
+from cli.test_runner import run_cmd
+
+class StartupTestBase(TestBase):
+  """
+  Base class for startup time tests providing shared utilities
+
+  Each case runs several times and its median is compared with the baseline stored in
+  'baseline.json' next to this file. A case fails when its median exceeds the baseline by more
+  than FIM_TEST_STARTUP_THRESHOLD percent, default 30, and by more than FIM_TEST_STARTUP_SLACK
+  milliseconds, default 20, which absorbs the noise of short cases. The phases traced by
+  FIM_TRACE are compared the same way, so a regression points to the phase that caused it.
+
+  Baselines depend on the machine, record them in the test image with
+  FIM_TEST_STARTUP_RECORD=1. Cases without a baseline are measured and skipped.
+  """
+
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+    cls.file_baseline = Path(__file__).resolve().parent / "baseline.json"
+    cls.runs = int(os.environ.get("FIM_TEST_STARTUP_RUNS", "5"))
+    cls.threshold = float(os.environ.get("FIM_TEST_STARTUP_THRESHOLD", "30")) / 100
+    cls.slack = float(os.environ.get("FIM_TEST_STARTUP_SLACK", "20"))
+    cls.is_record = os.environ.get("FIM_TEST_STARTUP_RECORD", "0") == "1"
+
+  def setUp(self):
+    super().setUp()
+    self.file_trace = self.dir_data / "startup.trace.json"
+
+  def tearDown(self):
+    if self.file_trace.exists():
+      os.unlink(self.file_trace)
+    super().tearDown()
+
+  def read_trace(self):
+    """
+    Sums the duration of each phase in the trace file, in milliseconds
+
+    The trace is a json array of complete events that is never closed, and each event ends
+    with a comma.
+    """
+    if not self.file_trace.exists():
+      return {}
+    text = self.file_trace.read_text().strip().rstrip(",")
+    if not text.endswith("]"):
+      text += "]"
+    phases = {}
+    for event in json.loads(text):
+      phases[event["name"]] = phases.get(event["name"], 0) + event["dur"] / 1000
+    return phases
+
+  def measure(self, *args, env=None, f_before=None):
+    """
+    Runs a command of the image several times
+
+    Args:
+      *args: Arguments of the image
+      env: Environment of the command, defaults to the current one
+      f_before: Called before each run, not measured
+
+    Returns:
+      Tuple of the median wall time and a dict of the median time of each traced phase,
+      both in milliseconds
+    """
+    env = dict(env or os.environ)
+    samples = []
+    samples_phases = {}
+    for _ in range(self.runs):
+      if f_before:
+        f_before()
+      if self.file_trace.exists():
+        os.unlink(self.file_trace)
+      env["FIM_TRACE"] = str(self.file_trace)
+      start = time.monotonic()
+      _,err,code = run_cmd(self.file_image, *args, env=env)
+      samples.append((time.monotonic() - start) * 1000)
+      self.assertEqual(code, 0, err)
+      for name, duration in self.read_trace().items():
+        samples_phases.setdefault(name, []).append(duration)
+    phases = { name: statistics.median(values) for name, values in samples_phases.items() }
+    return statistics.median(samples), phases
+
+  def check(self, case, wall, phases):
+    """
+    Compares a measurement with its baseline, or records it
+
+    Args:
+      case: Name of the case in the baseline file
+      wall: Median wall time in milliseconds
+      phases: Median time of each traced phase in milliseconds
+    """
+    print(f"\nstartup.{case}: {wall:.1f} ms "
+      + " ".join(f"{name}={duration:.1f}" for name, duration in sorted(phases.items())))
+    baselines = json.loads(self.file_baseline.read_text()) if self.file_baseline.exists() else {}
+    if self.is_record:
+      baselines[case] = { "wall": round(wall, 1), "phases": { k: round(v, 1) for k,v in phases.items() } }
+      self.file_baseline.write_text(json.dumps(baselines, indent=2, sort_keys=True) + "\n")
+      return
+    if case not in baselines:
+      self.skipTest(f"No baseline for '{case}', record it with FIM_TEST_STARTUP_RECORD=1")
+    baseline = baselines[case]
+    def limit(value):
+      return max(value * (1 + self.threshold), value + self.slack)
+    regressions = [ f"wall {wall:.1f} ms > {limit(baseline['wall']):.1f} ms" ] if wall > limit(baseline["wall"]) else []
+    for name, duration in baseline.get("phases", {}).items():
+      if name in phases and phases[name] > limit(duration):
+        regressions.append(f"{name} {phases[name]:.1f} ms > {limit(duration):.1f} ms")
+    self.assertEqual(regressions, [], f"Startup regression in '{case}'")
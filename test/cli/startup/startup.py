@@ -0,0 +1,75 @@
+#!/bin/python3
+
+import os
+import shutil
+import time
+from pathlib import Path
+from .common import StartupTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimStartup(StartupTestBase):
+  """
+  Startup time of the image compared with the stored baselines
+  """
+
+  def _create_layers(self, count):
+    """
+    Creates layer files in a directory to load with FIM_LAYERS
+
+    Args:
+      count: Number of layers
+
+    Returns:
+      Path to the directory of layers
+    """
+    dir_layers = self.dir_data / "startup_layers"
+    shutil.rmtree(dir_layers, ignore_errors=True)
+    dir_layers.mkdir(parents=True)
+    for i in range(count):
+      dir_root = self.dir_data / "startup_root" / str(i)
+      (dir_root / "opt" / f"layer{i}").mkdir(parents=True, exist_ok=True)
+      (dir_root / "opt" / f"layer{i}" / "marker").write_text(f"{i}\n")
+      _,err,code = run_cmd(self.file_image, "fim-layer", "create", str(dir_root), str(dir_layers / f"{i:03}.layer"))
+      self.assertEqual(code, 0, err)
+    shutil.rmtree(self.dir_data / "startup_root", ignore_errors=True)
+    return dir_layers
+
+  def test_startup_cold(self):
+    # Without the extracted tools and the data directory of the image
+    def f_before():
+      shutil.rmtree(Path("/tmp/fim/app"), ignore_errors=True)
+      shutil.rmtree(self.dir_image, ignore_errors=True)
+    wall, phases = self.measure("fim-exec", "true", f_before=f_before)
+    self.check("cold", wall, phases)
+
+  def test_startup_warm(self):
+    _,err,code = run_cmd(self.file_image, "fim-exec", "true")
+    self.assertEqual(code, 0, err)
+    wall, phases = self.measure("fim-exec", "true")
+    self.check("warm", wall, phases)
+
+  def test_startup_instance_exec(self):
+    # Round trip of a command in a running instance
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "60")
+    try:
+      for _ in range(50):
+        out,_,_ = run_cmd(self.file_image, "fim-instance", "list")
+        if out:
+          break
+        time.sleep(0.1)
+      wall, phases = self.measure("fim-instance", "exec", "0", "true")
+    finally:
+      proc.kill()
+      proc.wait()
+      time.sleep(1)
+    self.check("instance_exec", wall, phases)
+
+  def test_startup_layers(self):
+    for count in [1, 5, 20]:
+      with self.subTest(layers=count):
+        env = os.environ.copy()
+        env["FIM_LAYERS"] = str(self._create_layers(count))
+        _,err,code = run_cmd(self.file_image, "fim-exec", "true", env=env)
+        self.assertEqual(code, 0, err)
+        wall, phases = self.measure("fim-exec", "true", env=env)
+        self.check(f"layers_{count}", wall, phases)
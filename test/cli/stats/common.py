@@ -0,0 +1,18 @@
+#!/bin/python3
+
+import time
+from cli.test_base import TestBase
+
+class StatsTestBase(TestBase):
+  """
+  Base class for stats tests providing shared utilities
+  """
+  @classmethod
+  def setUpClass(cls):
+    super().setUpClass()
+
+  def setUp(self):
+    super().setUp()
+
+  def tearDown(self):
+    super().tearDown()
\ No newline at end of file
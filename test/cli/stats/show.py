@@ -0,0 +1,73 @@
+#!/bin/python3
+
+import os
+import json
+import re
+import time
+from .common import StatsTestBase
+from cli.test_runner import run_cmd, spawn_cmd
+
+class TestFimStats(StatsTestBase):
+  """Test suite for fim-stats command"""
+
+  def test_stats_arguments(self):
+    """Test invalid arguments and the absence of instances"""
+    out,err,code = run_cmd(self.file_image, "fim-stats")
+    self.assertEqual(out, "")
+    self.assertIn("Missing op for 'fim-stats' (<show|json>)", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-stats", "show", "foo")
+    self.assertEqual(out, "")
+    self.assertIn("Id argument must be a digit", err)
+    self.assertEqual(code, 125)
+    out,err,code = run_cmd(self.file_image, "fim-stats", "show")
+    self.assertEqual(out, "")
+    self.assertIn("No instances are running", err)
+    self.assertEqual(code, 125)
+
+  def test_stats_instance(self):
+    """Test the counters of a running instance"""
+    os.environ["FIM_OVERLAY"] = "unionfs"
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "5")
+    time.sleep(1)
+    # Counters as lines
+    out,err,code = run_cmd(self.file_image, "fim-stats", "show", "0")
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    self.assertRegex(out, r"(?m)^0:\d+$")
+    counters = dict(re.compile(r"""(?m)^(\w+)=(\d+)$""").findall(out))
+    self.assertGreater(int(counters["layers_mounted"]), 0)
+    self.assertGreater(int(counters["mount_us"]), 0)
+    self.assertEqual(int(counters["fuse_exits"]), 0)
+    # Counters as json, keyed by the pid of the instance
+    out,err,code = run_cmd(self.file_image, "fim-stats", "json")
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    stats = json.loads(out)
+    self.assertEqual(len(stats), 1)
+    self.assertEqual(next(iter(stats.values()))["layers_mounted"], int(counters["layers_mounted"]))
+    # Out of bounds
+    out,err,code = run_cmd(self.file_image, "fim-stats", "show", "1")
+    self.assertIn("Instance index out of bounds", err)
+    self.assertEqual(code, 125)
+    proc.kill()
+    time.sleep(1)
+    del os.environ["FIM_OVERLAY"]
+
+  def test_stats_perfmon(self):
+    """Test the performance monitor summary of the layers"""
+    os.environ["FIM_OVERLAY"] = "unionfs"
+    os.environ["FIM_DWARFS_PERFMON"] = "fuse+block_cache"
+    proc = spawn_cmd(self.file_image, "fim-exec", "sleep", "5")
+    time.sleep(1)
+    out,err,code = run_cmd(self.file_image, "fim-stats", "show", "0")
+    self.assertEqual(code, 0)
+    self.assertRegex(out, r"(?m)^perfmon\.0:$")
+    out,err,code = run_cmd(self.file_image, "fim-stats", "json", "0")
+    self.assertEqual(code, 0)
+    stats = json.loads(out)
+    self.assertIn("0", next(iter(stats.values()))["perfmon"])
+    proc.kill()
+    time.sleep(1)
+    del os.environ["FIM_DWARFS_PERFMON"]
+    del os.environ["FIM_OVERLAY"]
@@ -0,0 +1,154 @@
+#!/bin/python3
+"""
+Test suite for fim-update.
+"""
+
+import json
+import os
+import re
+import shutil
+from .common import UpdateTestBase
+from cli.test_runner import run_cmd
+
+class TestFimUpdate(UpdateTestBase):
+  """
+  Tests for fim-update - publishing an image and updating another copy from it.
+  """
+
+  def commit(self, file_image, content):
+    """Commits a layer with a script that echoes 'content' to an image"""
+    dir_root = file_image.parent / ".{}.data".format(file_image.name) / "root"
+    shutil.rmtree(dir_root, ignore_errors=True)
+    file_script = dir_root / "usr" / "bin" / "update-test.sh"
+    file_script.parent.mkdir(parents=True, exist_ok=False)
+    file_script.write_text('echo "{}"\n'.format(content))
+    os.chmod(file_script, 0o755)
+    _, _, code = run_cmd(str(file_image), "fim-layer", "commit", "binary")
+    self.assertEqual(code, 0)
+
+  def test_update_url(self):
+    """Test setting, showing and clearing the update URL without touching the recipes URL"""
+    _, _, code = run_cmd(self.file_image, "fim-remote", "set", "https://example.com/recipes")
+    self.assertEqual(code, 0)
+    out, _, code = run_cmd(self.file_image, "fim-update", "set", "https://example.com/app", self.key)
+    self.assertIn("Set update URL to 'https://example.com/app'", out)
+    self.assertEqual(code, 0)
+    out, _, code = run_cmd(self.file_image, "fim-update", "show")
+    self.assertEqual(out, "https://example.com/app\n{}".format(self.key))
+    self.assertEqual(code, 0)
+    out, _, code = run_cmd(self.file_image, "fim-remote", "show")
+    self.assertEqual(out, "https://example.com/recipes")
+    _, _, code = run_cmd(self.file_image, "fim-update", "clear")
+    self.assertEqual(code, 0)
+    _, err, code = run_cmd(self.file_image, "fim-update", "show")
+    self.assertIn("No update URL configured", err)
+    self.assertNotEqual(code, 0)
+    out, _, code = run_cmd(self.file_image, "fim-remote", "show")
+    self.assertEqual(out, "https://example.com/recipes")
+
+  def test_update_url_rejects_insecure(self):
+    """Test that the update URL must use https and the key must be a public key"""
+    _, err, code = run_cmd(self.file_image, "fim-update", "set", "http://example.com/app", self.key)
+    self.assertIn("The update URL must use https", err)
+    self.assertNotEqual(code, 0)
+    _, err, code = run_cmd(self.file_image, "fim-update", "set", "https://example.com/app", "1234")
+    self.assertIn("Invalid update key", err)
+    self.assertNotEqual(code, 0)
+    _, err, code = run_cmd(self.file_image, "fim-update", "show")
+    self.assertIn("No update URL configured", err)
+    self.assertNotEqual(code, 0)
+
+  def test_update_downloads_changed_regions(self):
+    """Test that an update only downloads the new layer and yields the published image"""
+    # The published image carries its update URL, so updated images keep it
+    _, _, code = run_cmd(str(self.file_image_new), "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    self.commit(self.file_image_new, "new layer")
+    out, _, code = run_cmd(str(self.file_image_new), "fim-update", "publish", str(self.dir_publish), str(self.file_key))
+    self.assertIn("Published", out)
+    self.assertEqual(code, 0)
+    self.assertTrue((self.dir_publish / "manifest.json").exists())
+    self.assertTrue((self.dir_publish / "manifest.json.sig").exists())
+    # The old image downloads the new layer only
+    _, _, code = run_cmd(self.file_image, "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    out, _, code = run_cmd(self.file_image, "fim-update", "apply")
+    self.assertEqual(code, 0)
+    match = re.search(r"Downloading (\d+) of (\d+) regions", out)
+    self.assertIsNotNone(match)
+    self.assertGreaterEqual(int(match.group(1)), 1)
+    self.assertLess(int(match.group(1)), int(match.group(2)))
+    self.assertIn("Updated", out)
+    with open(self.file_image, "rb") as f_old, open(self.file_image_new, "rb") as f_new:
+      self.assertEqual(f_old.read(), f_new.read())
+    out, _, code = run_cmd(self.file_image, "fim-exec", "update-test.sh")
+    self.assertEqual(out, "new layer")
+    self.assertEqual(code, 0)
+    # Nothing left to download
+    out, _, code = run_cmd(self.file_image, "fim-update", "apply")
+    self.assertIn("The image is up to date", out)
+    self.assertEqual(code, 0)
+
+  def test_update_rejects_corrupted_objects(self):
+    """Test that a corrupted object fails the update and keeps the current image"""
+    _, _, code = run_cmd(str(self.file_image_new), "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    self.commit(self.file_image_new, "corrupted layer")
+    _, _, code = run_cmd(str(self.file_image_new), "fim-update", "publish", str(self.dir_publish), str(self.file_key))
+    self.assertEqual(code, 0)
+    # Corrupt the object of the new layer, which the old image does not have
+    manifest = json.loads((self.dir_publish / "manifest.json").read_text())
+    file_object = self.dir_publish / "objects" / manifest["layers"][-1].split(":")[0]
+    data = bytearray(file_object.read_bytes())
+    data[len(data) // 2] ^= 0xff
+    file_object.write_bytes(bytes(data))
+    _, _, code = run_cmd(self.file_image, "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    with open(self.file_image, "rb") as f:
+      data_before = f.read()
+    _, err, code = run_cmd(self.file_image, "fim-update", "apply")
+    self.assertNotEqual(code, 0)
+    self.assertIn("does not match its hash", err)
+    with open(self.file_image, "rb") as f:
+      self.assertEqual(f.read(), data_before)
+
+  def test_update_rejects_unsigned_manifest(self):
+    """Test that a manifest not signed by the update key of the image is refused"""
+    _, _, code = run_cmd(str(self.file_image_new), "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    self.commit(self.file_image_new, "unsigned layer")
+    _, _, code = run_cmd(str(self.file_image_new), "fim-update", "publish", str(self.dir_publish), str(self.file_key))
+    self.assertEqual(code, 0)
+    _, _, code = run_cmd(self.file_image, "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    with open(self.file_image, "rb") as f:
+      data_before = f.read()
+    # A manifest changed after it was signed
+    file_manifest = self.dir_publish / "manifest.json"
+    manifest = json.loads(file_manifest.read_text())
+    manifest["layers"] = manifest["layers"][:-1]
+    file_manifest.write_text(json.dumps(manifest))
+    _, err, code = run_cmd(self.file_image, "fim-update", "apply")
+    self.assertNotEqual(code, 0)
+    self.assertIn("The manifest is not signed by the update key of the image", err)
+    # A manifest without signature
+    (self.dir_publish / "manifest.json.sig").unlink()
+    _, err, code = run_cmd(self.file_image, "fim-update", "apply")
+    self.assertNotEqual(code, 0)
+    with open(self.file_image, "rb") as f:
+      self.assertEqual(f.read(), data_before)
+
+  def test_publish_rejects_other_key(self):
+    """Test that publishing with a key other than the update key of the image fails"""
+    file_key_other = self.dir_data / "other.key"
+    file_key_other.unlink(missing_ok=True)
+    _, _, code = run_cmd(self.file_image, "fim-update", "keygen", str(file_key_other))
+    self.assertEqual(code, 0)
+    self.assertEqual(file_key_other.stat().st_mode & 0o777, 0o600)
+    _, _, code = run_cmd(self.file_image, "fim-update", "set", self.url, self.key)
+    self.assertEqual(code, 0)
+    _, err, code = run_cmd(self.file_image, "fim-update", "publish", str(self.dir_publish), str(file_key_other))
+    self.assertNotEqual(code, 0)
+    self.assertIn("does not match the update key of the image", err)
+    self.assertFalse((self.dir_publish / "manifest.json").exists())
+    file_key_other.unlink()
@@ -0,0 +1,59 @@
+#!/bin/python3
+"""
+Base test class for update tests.
+"""
+
+import functools
+import shutil
+import ssl
+import subprocess
+import tempfile
+import threading
+from http.server import ThreadingHTTPServer, SimpleHTTPRequestHandler
+from pathlib import Path
+from cli.test_base import TestBase
+from cli.test_runner import run_cmd
+
+class UpdateTestBase(TestBase):
+  """
+  Base class for update tests. Serves a publish directory over https for fim-update apply, with
+  a self-signed certificate generated for localhost, and creates a signing key.
+  """
+
+  def setUp(self):
+    super().setUp()
+    self.file_image_new = Path(self.file_image).parent / "temp.flatimage"
+    shutil.copy(self.file_image, self.file_image_new)
+    self.dir_publish = self.dir_data / "publish"
+    shutil.rmtree(self.dir_publish, ignore_errors=True)
+    handler = functools.partial(SimpleHTTPRequestHandler, directory=str(self.dir_publish))
+    self.server = ThreadingHTTPServer(("127.0.0.1", 0), handler)
+    # Self-signed certificate of the server, valid for a day
+    self.dir_tls = Path(tempfile.mkdtemp())
+    file_cert = self.dir_tls / "cert.pem"
+    file_key_tls = self.dir_tls / "key.pem"
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes"
+      , "-keyout", str(file_key_tls), "-out", str(file_cert), "-days", "1", "-subj", "/CN=localhost"
+      , "-addext", "subjectAltName=DNS:localhost,IP:127.0.0.1"]
+      , stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True
+    )
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(file_cert, file_key_tls)
+    self.server.socket = context.wrap_socket(self.server.socket, server_side=True)
+    self.thread = threading.Thread(target=self.server.serve_forever, daemon=True)
+    self.thread.start()
+    self.url = "https://127.0.0.1:{}".format(self.server.server_address[1])
+    # Signing key of the publisher
+    self.file_key = self.dir_data / "update.key"
+    self.file_key.unlink(missing_ok=True)
+    out, _, code = run_cmd(self.file_image, "fim-update", "keygen", str(self.file_key))
+    self.assertEqual(code, 0)
+    self.key = out
+
+  def tearDown(self):
+    self.server.shutdown()
+    self.server.server_close()
+    shutil.rmtree(self.dir_publish, ignore_errors=True)
+    self.file_key.unlink(missing_ok=True)
+    shutil.rmtree(self.dir_tls, ignore_errors=True)
+    super().tearDown()
@@ -0,0 +1,14 @@
+#!/bin/python3
+
+from cli.test_base import TestBase
+
+class VolatileTestBase(TestBase):
+  """
+  Base class for volatile tests providing shared utilities
+  """
+
+  def setUp(self):
+    super().setUp()
+
+  def tearDown(self):
+    super().tearDown()
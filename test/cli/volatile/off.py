@@ -0,0 +1,17 @@
+#!/bin/python3
+
+from .common import VolatileTestBase
+from cli.test_runner import run_cmd
+
+class TestFimVolatileOff(VolatileTestBase):
+  """Test suite for fim-volatile off command"""
+
+  def test_volatile_off_after_on(self):
+    """Test that the changes persist after the volatile mode is disabled"""
+    _,_,code = run_cmd(self.file_image, "fim-volatile", "on")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-volatile", "off")
+    self.assertEqual(code, 0)
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /volatile.txt")
+    self.assertEqual(code, 0)
+    self.assertTrue((self.dir_image / "root" / "volatile.txt").exists())
@@ -0,0 +1,63 @@
+#!/bin/python3
+
+import os
+import subprocess
+import time
+from .common import VolatileTestBase
+from cli.test_runner import run_cmd
+
+class TestFimVolatileOn(VolatileTestBase):
+  """Test suite for fim-volatile on command"""
+
+  def tearDown(self):
+    os.environ.pop("FIM_VOLATILE", None)
+    super().tearDown()
+
+  def test_volatile_enabled(self):
+    """Test that the changes of a volatile run are discarded"""
+    out,err,code = run_cmd(self.file_image, "fim-volatile", "on")
+    self.assertEqual(out, "")
+    self.assertEqual(err, "")
+    self.assertEqual(code, 0)
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /volatile.txt; cat /volatile.txt")
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+    self.assertFalse((self.dir_image / "root" / "volatile.txt").exists())
+    _,_,code = run_cmd(self.file_image, "fim-exec", "cat", "/volatile.txt")
+    self.assertNotEqual(code, 0)
+
+  def test_volatile_env(self):
+    """Test that FIM_VOLATILE=1 reads the persistent changes without writing to them"""
+    _,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "echo hello > /persistent.txt")
+    self.assertEqual(code, 0)
+    os.environ["FIM_VOLATILE"] = "1"
+    out,_,code = run_cmd(self.file_image, "fim-exec", "sh", "-c", "cat /persistent.txt; rm /persistent.txt")
+    self.assertEqual(code, 0)
+    self.assertIn("hello", out)
+    self.assertTrue((self.dir_image / "root" / "persistent.txt").exists())
+    # Nothing is left in memory
+    self.assertFalse(any(p.name.startswith("fim-") for p in os.scandir("/dev/shm")))
+
+  def test_volatile_private(self):
+    """Test that the volatile directory of a run is private to its owner"""
+    os.environ["FIM_VOLATILE"] = "1"
+    dirs_before = {p.name for p in os.scandir("/dev/shm")}
+    proc = subprocess.Popen([self.file_image, "fim-exec", "sleep", "5"])
+    try:
+      dirs = []
+      for _ in range(100):
+        dirs = [p for p in os.scandir("/dev/shm") if p.name.startswith("fim-") and p.name not in dirs_before]
+        if dirs: break
+        time.sleep(0.1)
+      self.assertEqual(len(dirs), 1)
+      st = os.lstat(dirs[0].path)
+      self.assertEqual(st.st_mode & 0o777, 0o700)
+      self.assertEqual(st.st_uid, os.geteuid())
+    finally:
+      self.assertEqual(proc.wait(), 0)
+
+  def test_volatile_invalid(self):
+    """Test that an invalid switch is rejected"""
+    _,err,code = run_cmd(self.file_image, "fim-volatile", "maybe")
+    self.assertEqual(code, 125)
+    self.assertIn("Invalid volatile switch", err)
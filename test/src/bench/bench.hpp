@@ -0,0 +1,118 @@
+/**
+ * @file bench.hpp
+ * @brief Samples, statistics and json output shared by the benchmarks
+ *
+ * Every benchmark collects its measurements as Result entries, prints them as a table and writes
+ * them as json in the same layout, so runs of any benchmark can be compared with the same tools.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <print>
+#include <string>
+#include <vector>
+
+#include "../../../src/std/expected.hpp"
+#include "../../../src/macro.hpp"
+
+namespace ns_bench
+{
+
+namespace fs = std::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Samples of a metric
+ */
+struct Result
+{
+  std::string metric;          ///< Name of the metric, e.g., 'socket.request_pid'
+  std::string unit;            ///< Unit of the samples
+  std::vector<double> samples; ///< Measured values
+  double rate = 0;             ///< Completed operations per second, zero if not applicable
+
+  /**
+   * @brief Gets a percentile of the samples, with the nearest rank method
+   *
+   * @param p The percentile, from 0 to 1
+   * @return double The value of the percentile, zero without samples
+   */
+  [[nodiscard]] double percentile(double p) const
+  {
+    if(samples.empty()) { return 0; }
+    std::vector<double> sorted = samples;
+    std::ranges::sort(sorted);
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+  }
+
+  [[nodiscard]] double mean() const
+  {
+    return samples.empty()? 0 : std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+  }
+};
+
+[[nodiscard]] inline double elapsed_us(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Writes the results as json
+ *
+ * @param path_file_output Where to write the results
+ * @param benchmark Name of the benchmark
+ * @param results The results to write
+ * @return Value<void> Nothing on success, or the respective error
+ */
+[[nodiscard]] inline Value<void> write_json(fs::path const& path_file_output
+  , std::string_view benchmark
+  , std::vector<Result> const& results)
+{
+  std::error_code ec;
+  fs::create_directories(path_file_output.parent_path(), ec);
+  std::ofstream file(path_file_output, std::ios::trunc);
+  return_if(not file.is_open(), Error("E::Could not open '{}'", path_file_output));
+  auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+  file << std::format("{{\n  \"benchmark\": \"{}\",\n  \"timestamp\": {},\n  \"results\": [\n", benchmark, timestamp);
+  for(size_t i = 0; i < results.size(); ++i)
+  {
+    auto const& r = results[i];
+    file << std::format("    {{ \"metric\": \"{}\", \"unit\": \"{}\", \"samples\": {}, \"p50\": {:.2f}"
+        ", \"p99\": {:.2f}, \"mean\": {:.2f}, \"rate\": {:.2f} }}{}\n"
+      , r.metric, r.unit, r.samples.size(), r.percentile(0.5), r.percentile(0.99), r.mean(), r.rate
+      , (i + 1 < results.size())? "," : ""
+    );
+  }
+  file << "  ]\n}\n";
+  return {};
+}
+
+/**
+ * @brief Prints the results as a table
+ *
+ * @param results The results to print
+ */
+inline void print(std::vector<Result> const& results)
+{
+  std::println("{:<32} {:>8} {:>12} {:>12} {:>12} {:>10}", "metric", "samples", "p50", "p99", "rate/s", "unit");
+  for(auto const& r : results)
+  {
+    std::println("{:<32} {:>8} {:>12.2f} {:>12.2f} {:>12.2f} {:>10}"
+      , r.metric, r.samples.size(), r.percentile(0.5), r.percentile(0.99), r.rate, r.unit
+    );
+  }
+}
+
+} // namespace ns_bench
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
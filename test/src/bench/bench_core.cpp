@@ -0,0 +1,340 @@
+/**
+ * @file bench_core.cpp
+ * @brief Microbenchmarks of the core libraries
+ *
+ * Measures the operations that run on every launch or every request:
+ * - Parse and dump of a json database with ns_db
+ * - Serialize and deserialize of a portal message with ns_message
+ * - Throughput of the log writer to a sink file
+ * - Throughput of a pipe to pipe relay with ns_linux::ns_fd
+ * - Read and write of a section of the reserved space with ns_reserved
+ * - Scan of a synthetic image with concatenated layers by Layers::push_binary
+ * - Latency from spawn to exit of 'true' with ns_subprocess
+ *
+ * Results are printed as a table and written as json to the path given as the first argument,
+ * in the layout of the other benchmarks, so runs can be compared.
+ *
+ * Usage: bench_core [output.json]
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../../../src/db/db.hpp"
+#include "../../../src/db/portal/message.hpp"
+#include "../../../src/filesystems/layers.hpp"
+#include "../../../src/lib/env.hpp"
+#include "../../../src/lib/linux/fd.hpp"
+#include "../../../src/lib/log.hpp"
+#include "../../../src/lib/subprocess.hpp"
+#include "../../../src/reserved/reserved.hpp"
+#include "bench.hpp"
+
+namespace fs = std::filesystem;
+namespace ns_message = ns_db::ns_portal::ns_message;
+
+using ns_bench::Clock;
+using ns_bench::Result;
+using ns_bench::elapsed_us;
+
+namespace
+{
+
+// Iterations of each latency measurement
+constexpr size_t const ITERATIONS = 1000;
+// Iterations of the measurements that spawn processes or scan images
+constexpr size_t const ITERATIONS_SLOW = 100;
+// Entries of the json database
+constexpr size_t const SIZE_DB = 256;
+// Messages written in each log sample, and number of samples
+constexpr size_t const SIZE_LOG = 100'000;
+constexpr size_t const ITERATIONS_LOG = 5;
+// Bytes relayed in each relay sample, and number of samples
+constexpr size_t const SIZE_RELAY = 256 << 20;
+constexpr size_t const ITERATIONS_RELAY = 3;
+// Size of the section of the reserved space
+constexpr size_t const SIZE_RESERVED = 4096;
+// Layers of the synthetic image, and size of each
+constexpr size_t const LAYERS = 64;
+constexpr size_t const SIZE_LAYER = 64 << 10;
+
+/**
+ * @brief Measures the parse and dump of a json database
+ *
+ * @return std::array<Result,2> The parse and dump latencies
+ */
+[[nodiscard]] std::array<Result,2> bench_db()
+{
+  std::array<Result,2> results{
+      Result{ .metric = "db.parse", .unit = "us" }
+    , Result{ .metric = "db.dump", .unit = "us" }
+  };
+  ns_db::Db db;
+  for(size_t i = 0; i < SIZE_DB; ++i)
+  {
+    db(std::format("key_{}", i)) = std::vector<std::string>{"/usr/bin", "/usr/lib", std::format("value_{}", i)};
+  }
+  std::string data = db.dump().value_or(std::string{});
+  for(size_t i = 0; i < ITERATIONS; ++i)
+  {
+    auto start = Clock::now();
+    auto parsed = ns_db::from_string(data);
+    results[0].samples.push_back(elapsed_us(start));
+    continue_if(not parsed);
+    start = Clock::now();
+    std::ignore = parsed->dump();
+    results[1].samples.push_back(elapsed_us(start));
+  }
+  return results;
+}
+
+/**
+ * @brief Measures the serialize and deserialize of a portal message
+ *
+ * The message carries an environment the size of a typical desktop session.
+ *
+ * @return std::array<Result,2> The serialize and deserialize latencies
+ */
+[[nodiscard]] std::array<Result,2> bench_message()
+{
+  std::array<Result,2> results{
+      Result{ .metric = "message.serialize", .unit = "us" }
+    , Result{ .metric = "message.deserialize", .unit = "us" }
+  };
+  std::vector<std::string> environment;
+  for(size_t i = 0; i < 64; ++i) { environment.push_back(std::format("VARIABLE_{}=/usr/share/value/{}", i, i)); }
+  ns_message::Message message(getpid(), {"sh", "-c", "true"}, fs::temp_directory_path() / "fifo", environment);
+  for(size_t i = 0; i < ITERATIONS; ++i)
+  {
+    auto start = Clock::now();
+    auto serialized = ns_message::serialize(message);
+    results[0].samples.push_back(elapsed_us(start));
+    continue_if(not serialized);
+    start = Clock::now();
+    std::ignore = ns_message::deserialize(*serialized);
+    results[1].samples.push_back(elapsed_us(start));
+  }
+  return results;
+}
+
+/**
+ * @brief Measures the throughput of the log writer to a sink file
+ *
+ * @param path_dir_tmp Scratch directory
+ * @return Result The messages written per second of each sample
+ */
+[[nodiscard]] Result bench_log(fs::path const& path_dir_tmp)
+{
+  Result result{ .metric = "log.sink", .unit = "msg/s" };
+  // Keep the console quiet, the sink receives every level
+  ns_log::set_level(ns_log::Level::CRITICAL);
+  ns_log::set_sink_file(path_dir_tmp / "bench.log");
+  for(size_t i = 0; i < ITERATIONS_LOG; ++i)
+  {
+    auto start = Clock::now();
+    for(size_t j = 0; j < SIZE_LOG; ++j)
+    {
+      logger("I::Message {} of sample {} from '{}'", j, i, path_dir_tmp);
+    }
+    ns_log::flush();
+    result.samples.push_back(SIZE_LOG / (elapsed_us(start) / 1e6));
+  }
+  ns_log::set_sink_file("/dev/null");
+  return result;
+}
+
+/**
+ * @brief Measures the throughput of a relay between two pipes
+ *
+ * A thread writes into the first pipe and another drains the second, the relay in between is
+ * the one the subprocess library uses for the stdio of its children.
+ *
+ * @return Result The throughput of each sample
+ */
+[[nodiscard]] Result bench_relay()
+{
+  Result result{ .metric = "fd.relay_throughput", .unit = "MiB/s" };
+  for(size_t i = 0; i < ITERATIONS_RELAY; ++i)
+  {
+    int fds_src[2], fds_dst[2];
+    continue_if(::pipe2(fds_src, O_CLOEXEC) < 0);
+    if(::pipe2(fds_dst, O_CLOEXEC) < 0)
+    {
+      ::close(fds_src[0]);
+      ::close(fds_src[1]);
+      continue;
+    }
+    size_t size = 0;
+    auto start = Clock::now();
+    std::thread writer([&]
+    {
+      std::vector<char> buffer(1 << 20);
+      for(size_t written = 0; written < SIZE_RELAY;)
+      {
+        ssize_t n = ::write(fds_src[1], buffer.data(), std::min(buffer.size(), SIZE_RELAY - written));
+        continue_if(n < 0 and errno == EINTR);
+        break_if(n < 0);
+        written += n;
+      }
+      ::close(fds_src[1]);
+    });
+    std::thread reader([&]
+    {
+      std::vector<char> buffer(1 << 20);
+      for(ssize_t n; (n = ::read(fds_dst[0], buffer.data(), buffer.size())) != 0;)
+      {
+        continue_if(n < 0 and errno == EINTR);
+        break_if(n < 0);
+        size += n;
+      }
+    });
+    auto relayed = ns_linux::ns_fd::redirect_fd_to_fd(getpid(), fds_src[0], fds_dst[1]);
+    ::close(fds_dst[1]);
+    writer.join();
+    reader.join();
+    ::close(fds_src[0]);
+    ::close(fds_dst[0]);
+    continue_if(not relayed or size != SIZE_RELAY);
+    result.samples.push_back((size / double(1 << 20)) / (elapsed_us(start) / 1e6));
+  }
+  return result;
+}
+
+/**
+ * @brief Measures the read and write of a section of the reserved space
+ *
+ * Writes alternate between two payloads, so every write changes the section.
+ *
+ * @param path_dir_tmp Scratch directory
+ * @return std::array<Result,2> The write and read latencies
+ */
+[[nodiscard]] std::array<Result,2> bench_reserved(fs::path const& path_dir_tmp)
+{
+  std::array<Result,2> results{
+      Result{ .metric = "reserved.write", .unit = "us" }
+    , Result{ .metric = "reserved.read", .unit = "us" }
+  };
+  fs::path path_file_binary = path_dir_tmp / "reserved.bin";
+  std::ofstream(path_file_binary, std::ios::binary) << std::string(SIZE_RESERVED * 4, '\0');
+  std::array<std::string,2> payloads{ std::string(SIZE_RESERVED, 'a'), std::string(SIZE_RESERVED, 'b') };
+  std::string buffer(SIZE_RESERVED, '\0');
+  for(size_t i = 0; i < ITERATIONS; ++i)
+  {
+    std::string const& payload = payloads[i % payloads.size()];
+    auto start = Clock::now();
+    auto written = ns_reserved::write(path_file_binary, SIZE_RESERVED, SIZE_RESERVED * 2, payload.data(), payload.size());
+    results[0].samples.push_back(elapsed_us(start));
+    continue_if(not written);
+    start = Clock::now();
+    std::ignore = ns_reserved::read(path_file_binary, SIZE_RESERVED, buffer.data(), buffer.size());
+    results[1].samples.push_back(elapsed_us(start));
+  }
+  return results;
+}
+
+/**
+ * @brief Measures the scan of the layers of a synthetic image
+ *
+ * The image is a header followed by layers in the format of an image, each one an 8 byte size
+ * and a payload that starts with the dwarfs magic. The scan runs without and with a layer index.
+ *
+ * @param path_dir_tmp Scratch directory
+ * @return std::array<Result,2> The latencies of the scan and of the indexed load
+ */
+[[nodiscard]] std::array<Result,2> bench_layers(fs::path const& path_dir_tmp)
+{
+  std::array<Result,2> results{
+      Result{ .metric = "layers.push_binary_scan", .unit = "us" }
+    , Result{ .metric = "layers.push_binary_index", .unit = "us" }
+  };
+  fs::path path_file_binary = path_dir_tmp / "image.bin";
+  fs::path path_file_index = path_dir_tmp / "layers.json";
+  uint64_t const offset = 4096;
+  {
+    std::ofstream file(path_file_binary, std::ios::binary);
+    file << std::string(offset, '\0');
+    std::string layer = "DWARFS" + std::string(SIZE_LAYER - 6, '\0');
+    for(size_t i = 0; i < LAYERS; ++i)
+    {
+      uint64_t size = layer.size();
+      file.write(reinterpret_cast<char const*>(&size), sizeof(size));
+      file << layer;
+    }
+  }
+  for(size_t i = 0; i < ITERATIONS_SLOW; ++i)
+  {
+    ns_filesystems::ns_layers::Layers layers;
+    auto start = Clock::now();
+    layers.push_binary(path_file_binary, offset);
+    results[0].samples.push_back(elapsed_us(start));
+  }
+  // The first load writes the index
+  ns_filesystems::ns_layers::Layers().push_binary(path_file_binary, offset, path_file_index);
+  for(size_t i = 0; i < ITERATIONS_SLOW; ++i)
+  {
+    ns_filesystems::ns_layers::Layers layers;
+    auto start = Clock::now();
+    layers.push_binary(path_file_binary, offset, path_file_index);
+    results[1].samples.push_back(elapsed_us(start));
+  }
+  return results;
+}
+
+/**
+ * @brief Measures the latency from spawn to exit of a subprocess
+ *
+ * @return Value<Result> The latencies, or the respective error
+ */
+[[nodiscard]] Value<Result> bench_subprocess()
+{
+  Result result{ .metric = "subprocess.spawn_exit", .unit = "us" };
+  fs::path path_bin_true = Pop(ns_env::search_path("true"));
+  for(size_t i = 0; i < ITERATIONS_SLOW; ++i)
+  {
+    auto start = Clock::now();
+    auto code = ns_subprocess::Subprocess(path_bin_true)
+      .with_stdio(ns_subprocess::Stream::Null)
+      .spawn()
+      ->wait();
+    continue_if(not code or *code != 0);
+    result.samples.push_back(elapsed_us(start));
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  auto __expected_fn = [](auto&& e){ std::println(stderr, "{}", e.error()); return EXIT_FAILURE; };
+  fs::path path_file_output = (argc > 1)? fs::path(argv[1]) : fs::path("bench_core.json");
+  fs::path path_dir_tmp = fs::temp_directory_path() / std::format("fim-bench-core-{}", getpid());
+  Try(fs::create_directories(path_dir_tmp));
+  std::vector<Result> results;
+  std::ranges::copy(bench_db(), std::back_inserter(results));
+  std::ranges::copy(bench_message(), std::back_inserter(results));
+  results.push_back(bench_log(path_dir_tmp));
+  results.push_back(bench_relay());
+  std::ranges::copy(bench_reserved(path_dir_tmp), std::back_inserter(results));
+  std::ranges::copy(bench_layers(path_dir_tmp), std::back_inserter(results));
+  results.push_back(Pop(bench_subprocess()));
+  std::error_code ec;
+  fs::remove_all(path_dir_tmp, ec);
+  // Report
+  ns_bench::print(results);
+  Pop(ns_bench::write_json(path_file_output, "core", results));
+  std::println("Results written to {}", path_file_output.string());
+  return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
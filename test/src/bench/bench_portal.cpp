@@ -0,0 +1,320 @@
+/**
+ * @file bench_portal.cpp
+ * @brief Latency and throughput benchmark of the portal daemon and dispatcher
+ *
+ * Starts a fim_portal_daemon in a temporary directory and measures:
+ * - Request to pid and request to exit latency of the socket transport, without a dispatcher
+ * - Request to exit latency of a fim_portal dispatcher that runs 'true'
+ * - Stdout throughput of a fim_portal dispatcher that runs 'head -c' on /dev/zero
+ * - Latency and request rate of 1 to 64 concurrent dispatchers
+ *
+ * The dispatcher measurements run for the socket transport, and again for the fifo transport
+ * after the socket of the daemon is removed. Results are printed as a table and written as json
+ * to the path given as the first argument, so runs can be compared.
+ *
+ * Usage: bench_portal [output.json]
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <print>
+#include <spawn.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../../src/db/portal/daemon.hpp"
+#include "../../../src/db/portal/dispatcher.hpp"
+#include "../../../src/db/portal/message.hpp"
+#include "../../../src/lib/linux/socket.hpp"
+#include "bench.hpp"
+
+#if not defined(BENCH_PATH_BIN_DAEMON) or not defined(BENCH_PATH_BIN_DISPATCHER)
+#error "BENCH_PATH_BIN_DAEMON and BENCH_PATH_BIN_DISPATCHER must be defined"
+#endif
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+namespace ns_daemon = ns_db::ns_portal::ns_daemon;
+namespace ns_dispatcher = ns_db::ns_portal::ns_dispatcher;
+namespace ns_message = ns_db::ns_portal::ns_message;
+
+using ns_bench::Clock;
+using ns_bench::Result;
+using ns_bench::elapsed_us;
+
+namespace
+{
+
+// Iterations of each latency measurement
+constexpr size_t const ITERATIONS_LATENCY = 300;
+// Bytes written to stdout in each throughput sample, and number of samples
+constexpr size_t const SIZE_THROUGHPUT = 256 << 20;
+constexpr size_t const ITERATIONS_THROUGHPUT = 3;
+// Requests of each concurrency level
+constexpr size_t const REQUESTS_CONCURRENT = 256;
+
+/**
+ * @brief Spawns a program with extra environment variables and the given stdout
+ *
+ * @param argv The program and its arguments
+ * @param env Variables in the format 'KEY=VALUE' added to the environment of the benchmark
+ * @param fd_stdout The stdout of the program, stdin and stderr are /dev/null
+ * @return pid_t The pid of the program, or -1 on failure
+ */
+[[nodiscard]] pid_t spawn(std::vector<std::string> const& argv
+  , std::vector<std::string> const& env
+  , int fd_stdout)
+{
+  std::vector<char*> vec_argv, vec_envp;
+  std::ranges::transform(argv, std::back_inserter(vec_argv), [](auto&& e){ return const_cast<char*>(e.c_str()); });
+  for(char** i = environ; *i != nullptr; ++i) { vec_envp.push_back(*i); }
+  std::ranges::transform(env, std::back_inserter(vec_envp), [](auto&& e){ return const_cast<char*>(e.c_str()); });
+  vec_argv.push_back(nullptr);
+  vec_envp.push_back(nullptr);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fd_stdout, STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  pid_t pid = -1;
+  int err = ::posix_spawn(&pid, vec_argv.front(), &actions, nullptr, vec_argv.data(), vec_envp.data());
+  posix_spawn_file_actions_destroy(&actions);
+  return (err == 0)? pid : -1;
+}
+
+[[nodiscard]] int wait(pid_t pid)
+{
+  int status = 0;
+  while(::waitpid(pid, &status, 0) < 0 and errno == EINTR) {}
+  return WIFEXITED(status)? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * @brief Reads an integer reported by the daemon through a connection
+ *
+ * @param fd_socket The connection to the daemon
+ * @return Value<int> The integer, or the respective error
+ */
+[[nodiscard]] Value<int> read_int(int fd_socket)
+{
+  int value{};
+  std::vector<int> fds;
+  for(size_t offset = 0; offset < sizeof(value);)
+  {
+    auto buf = std::span(reinterpret_cast<char*>(&value) + offset, sizeof(value) - offset);
+    size_t size = Pop(ns_linux::ns_socket::recv(fd_socket, buf, fds));
+    return_if(size == 0, Error("E::Daemon closed the connection"));
+    offset += size;
+  }
+  return value;
+}
+
+/**
+ * @brief Measures the request to pid and request to exit latency of the socket transport
+ *
+ * Talks to the daemon like the dispatcher does, so the startup of a dispatcher is not included.
+ *
+ * @param path_socket Socket of the daemon
+ * @param path_dir_fifo Directory of the dispatcher fifos, unused by the socket transport
+ * @return Value<std::array<Result,2>> The pid and exit latencies, or the respective error
+ */
+[[nodiscard]] Value<std::array<Result,2>> bench_socket(fs::path const& path_socket, fs::path const& path_dir_fifo)
+{
+  std::array<Result,2> results{
+      Result{ .metric = "socket.request_pid", .unit = "us" }
+    , Result{ .metric = "socket.request_exit", .unit = "us" }
+  };
+  std::string data = Pop(ns_message::frame(Pop(ns_message::serialize(
+    ns_message::Message(getpid(), {"true"}, path_dir_fifo, {})
+  ))));
+  int fd_null = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+  return_if(fd_null < 0, Error("E::Could not open /dev/null"));
+  std::array<int,3> const fds{ fd_null, fd_null, fd_null };
+  for(size_t i = 0; i < ITERATIONS_LATENCY; ++i)
+  {
+    auto start = Clock::now();
+    int fd_socket = Pop(ns_linux::ns_socket::connect(path_socket));
+    Pop(ns_linux::ns_socket::send(fd_socket, data, fds));
+    pid_t pid = Pop(read_int(fd_socket));
+    results[0].samples.push_back(elapsed_us(start));
+    int code = Pop(read_int(fd_socket));
+    results[1].samples.push_back(elapsed_us(start));
+    ::close(fd_socket);
+    return_if(pid < 0 or code != 0, Error("E::Request failed with pid {} and code {}", pid, code));
+  }
+  ::close(fd_null);
+  return results;
+}
+
+/**
+ * @brief Measures the request to exit latency of a dispatcher
+ *
+ * @param transport Name of the transport, prefix of the metric
+ * @param env The configuration of the dispatcher
+ * @return Result The latencies
+ */
+[[nodiscard]] Result bench_dispatcher(std::string const& transport, std::vector<std::string> const& env)
+{
+  Result result{ .metric = transport + ".dispatcher_exit", .unit = "us" };
+  int fd_null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  for(size_t i = 0; i < ITERATIONS_LATENCY; ++i)
+  {
+    auto start = Clock::now();
+    pid_t pid = spawn({BENCH_PATH_BIN_DISPATCHER, "true"}, env, fd_null);
+    continue_if(pid < 0 or wait(pid) != 0);
+    result.samples.push_back(elapsed_us(start));
+  }
+  ::close(fd_null);
+  return result;
+}
+
+/**
+ * @brief Measures the throughput of the stdout of a requested process
+ *
+ * @param transport Name of the transport, prefix of the metric
+ * @param env The configuration of the dispatcher
+ * @return Result The throughput of each sample
+ */
+[[nodiscard]] Result bench_throughput(std::string const& transport, std::vector<std::string> const& env)
+{
+  Result result{ .metric = transport + ".stdout_throughput", .unit = "MiB/s" };
+  std::vector<char> buffer(1 << 20);
+  for(size_t i = 0; i < ITERATIONS_THROUGHPUT; ++i)
+  {
+    int fds[2];
+    continue_if(::pipe2(fds, O_CLOEXEC) < 0);
+    auto start = Clock::now();
+    pid_t pid = spawn({BENCH_PATH_BIN_DISPATCHER, "head", "-c", std::to_string(SIZE_THROUGHPUT), "/dev/zero"}
+      , env
+      , fds[1]
+    );
+    ::close(fds[1]);
+    size_t size = 0;
+    for(ssize_t n; (n = ::read(fds[0], buffer.data(), buffer.size())) != 0;)
+    {
+      continue_if(n < 0 and errno == EINTR);
+      break_if(n < 0);
+      size += n;
+    }
+    ::close(fds[0]);
+    continue_if(pid < 0 or wait(pid) != 0 or size != SIZE_THROUGHPUT);
+    result.samples.push_back((size / double(1 << 20)) / (elapsed_us(start) / 1e6));
+  }
+  return result;
+}
+
+/**
+ * @brief Measures the latency of concurrent dispatchers
+ *
+ * Keeps the given number of dispatchers running until all requests complete.
+ *
+ * @param transport Name of the transport, prefix of the metric
+ * @param env The configuration of the dispatcher
+ * @param concurrency Number of dispatchers that run at once
+ * @return Result The latency of each request, and the rate of completed requests
+ */
+[[nodiscard]] Result bench_concurrent(std::string const& transport
+  , std::vector<std::string> const& env
+  , size_t concurrency)
+{
+  Result result{ .metric = std::format("{}.concurrent_{}", transport, concurrency), .unit = "us" };
+  int fd_null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  std::vector<std::pair<pid_t,Clock::time_point>> running;
+  auto start = Clock::now();
+  for(size_t started = 0; started < REQUESTS_CONCURRENT or not running.empty();)
+  {
+    // Keep the number of running dispatchers
+    for(; started < REQUESTS_CONCURRENT and running.size() < concurrency; ++started)
+    {
+      pid_t pid = spawn({BENCH_PATH_BIN_DISPATCHER, "true"}, env, fd_null);
+      if(pid > 0) { running.emplace_back(pid, Clock::now()); }
+    }
+    int status = 0;
+    pid_t pid = ::waitpid(-1, &status, 0);
+    continue_if(pid < 0 and errno == EINTR);
+    break_if(pid < 0);
+    auto it = std::ranges::find_if(running, [&](auto&& e){ return e.first == pid; });
+    continue_if(it == running.end());
+    if(WIFEXITED(status) and WEXITSTATUS(status) == 0) { result.samples.push_back(elapsed_us(it->second)); }
+    running.erase(it);
+  }
+  result.rate = result.samples.size() / (elapsed_us(start) / 1e6);
+  ::close(fd_null);
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  auto __expected_fn = [](auto&& e){ std::println(stderr, "{}", e.error()); return EXIT_FAILURE; };
+  fs::path path_file_output = (argc > 1)? fs::path(argv[1]) : fs::path("bench_portal.json");
+  // Instance layout expected by the daemon and dispatcher configurations
+  fs::path path_dir_app = fs::temp_directory_path() / std::format("fim-bench-portal-{}", getpid());
+  fs::path path_dir_portal = path_dir_app / "instance" / std::to_string(getpid()) / "portal";
+  ns_daemon::Daemon daemon(ns_daemon::Mode::HOST, BENCH_PATH_BIN_DAEMON, path_dir_portal);
+  ns_daemon::ns_log::Logs logs(path_dir_app / "logs" / "daemon");
+  ns_dispatcher::Dispatcher dispatcher(getpid()
+    , ns_daemon::Mode::HOST
+    , path_dir_app
+    , ns_dispatcher::Logs(path_dir_app / "logs" / "dispatcher")
+  );
+  std::vector<std::string> env_daemon{
+      "FIM_DAEMON_CFG=" + Pop(ns_daemon::serialize(daemon))
+    , "FIM_DAEMON_LOG=" + Pop(ns_daemon::ns_log::serialize(logs))
+  };
+  std::vector<std::string> env_dispatcher{ "FIM_DISPATCHER_CFG=" + Pop(ns_dispatcher::serialize(dispatcher)) };
+  // Start the daemon and wait for its socket
+  int fd_null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+  pid_t pid_daemon = spawn({BENCH_PATH_BIN_DAEMON}, env_daemon, fd_null);
+  return_if(pid_daemon < 0, EXIT_FAILURE, "E::Could not start '{}'", BENCH_PATH_BIN_DAEMON);
+  fs::path path_socket = daemon.get_path_socket_listen();
+  for(auto start = Clock::now(); not fs::exists(path_socket) and Clock::now() - start < std::chrono::seconds(5);)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  std::vector<Result> results;
+  if(fs::exists(path_socket))
+  {
+    auto socket = bench_socket(path_socket, dispatcher.get_path_dir_fifo());
+    if(socket) { std::ranges::copy(*socket, std::back_inserter(results)); }
+    else { std::println(stderr, "{}", socket.error()); }
+    results.push_back(bench_dispatcher("socket", env_dispatcher));
+    results.push_back(bench_throughput("socket", env_dispatcher));
+    for(size_t concurrency = 1; concurrency <= 64; concurrency *= 2)
+    {
+      results.push_back(bench_concurrent("socket", env_dispatcher, concurrency));
+    }
+    // Dispatchers fall back to the fifo transport without the socket
+    fs::remove(path_socket);
+  }
+  results.push_back(bench_dispatcher("fifo", env_dispatcher));
+  results.push_back(bench_throughput("fifo", env_dispatcher));
+  for(size_t concurrency = 1; concurrency <= 64; concurrency *= 2)
+  {
+    results.push_back(bench_concurrent("fifo", env_dispatcher, concurrency));
+  }
+  // Stop the daemon
+  ::kill(pid_daemon, SIGTERM);
+  std::ignore = wait(pid_daemon);
+  ::close(fd_null);
+  std::error_code ec;
+  fs::remove_all(path_dir_app, ec);
+  // Report
+  ns_bench::print(results);
+  Pop(ns_bench::write_json(path_file_output, "portal", results));
+  std::println("Results written to {}", path_file_output.string());
+  return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
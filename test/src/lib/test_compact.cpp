@@ -0,0 +1,120 @@
+/**
+ * @file test_compact.cpp
+ * @brief Unit tests for compact.hpp binary encoding of the configuration sections
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "../../../src/db/compact.hpp"
+
+using ns_db::ns_compact::Kind;
+using ns_db::ns_compact::Reader;
+using ns_db::ns_compact::Writer;
+
+TEST_CASE("ns_compact::Writer and Reader round trip integers and strings")
+{
+  auto data = Writer(Kind::BOOT)
+    .integer(0)
+    .integer(127)
+    .integer(128)
+    .integer(UINT64_MAX - 1)
+    .string("")
+    .string("hello world")
+    .string(std::string(300, 'x'))
+    .finish();
+  REQUIRE(data);
+  CHECK(ns_db::ns_compact::is_compact(*data));
+  // The encoding is a null terminated string
+  CHECK_FALSE(data->contains('\0'));
+  auto reader = Reader::open(*data, Kind::BOOT);
+  REQUIRE(reader);
+  CHECK_EQ(reader->integer().value(), 0u);
+  CHECK_EQ(reader->integer().value(), 127u);
+  CHECK_EQ(reader->integer().value(), 128u);
+  CHECK_EQ(reader->integer().value(), UINT64_MAX - 1);
+  CHECK_EQ(reader->string().value(), "");
+  CHECK_EQ(reader->string().value(), "hello world");
+  CHECK_EQ(reader->string().value(), std::string(300, 'x'));
+  // Nothing is left
+  CHECK_FALSE(reader->integer());
+}
+
+TEST_CASE("ns_compact::Writer rejects values it cannot encode")
+{
+  CHECK_FALSE(Writer(Kind::BOOT).string(std::string_view("a\0b", 3)).finish());
+  CHECK_FALSE(Writer(Kind::BOOT).integer(UINT64_MAX).finish());
+}
+
+TEST_CASE("ns_compact::Reader::open checks the header")
+{
+  std::string data = Writer(Kind::REMOTE).string("url").finish().value();
+  CHECK(Reader::open(data, Kind::REMOTE));
+  // Another kind
+  auto reader = Reader::open(data, Kind::BOOT);
+  REQUIRE_FALSE(reader);
+  CHECK(reader.error().contains("does not match"));
+  // Json sections written by older versions
+  CHECK_FALSE(ns_db::ns_compact::is_compact(R"({"url":"x"})"));
+  CHECK_FALSE(Reader::open(R"({"url":"x"})", Kind::REMOTE));
+  // Another version
+  std::string data_version = data;
+  data_version[ns_db::ns_compact::magic.size()] = static_cast<char>(ns_db::ns_compact::version + 2);
+  reader = Reader::open(data_version, Kind::REMOTE);
+  REQUIRE_FALSE(reader);
+  CHECK(reader.error().contains("Unsupported section version"));
+}
+
+TEST_CASE("ns_compact::Reader fails on every truncation of a section")
+{
+  std::string data = Writer(Kind::ENVIRONMENT)
+    .integer(300)
+    .string("key=value")
+    .integer(UINT64_MAX - 1)
+    .finish()
+    .value();
+  for(size_t size = 0; size < data.size(); ++size)
+  {
+    CAPTURE(size);
+    std::string_view prefix = std::string_view(data).substr(0, size);
+    auto reader = Reader::open(prefix, Kind::ENVIRONMENT);
+    if(not reader) { continue; }
+    bool is_complete = reader->integer() and reader->string() and reader->integer();
+    CHECK_FALSE(is_complete);
+  }
+}
+
+TEST_CASE("ns_compact::Reader rejects malformed integers and strings")
+{
+  // The reader views the data, which must outlive it
+  std::string const header = Writer(Kind::DESKTOP).finish().value();
+  // A null byte is never written
+  std::string data = header + std::string(1, '\0');
+  auto reader = Reader::open(data, Kind::DESKTOP);
+  REQUIRE(reader);
+  auto integer = reader->integer();
+  REQUIRE_FALSE(integer);
+  CHECK(integer.error().contains("Invalid integer"));
+  // More than 64 bits
+  data = header + std::string(10, '\xff') + "\x01";
+  reader = Reader::open(data, Kind::DESKTOP);
+  REQUIRE(reader);
+  integer = reader->integer();
+  REQUIRE_FALSE(integer);
+  CHECK(integer.error().contains("too large"));
+  data = header + std::string(9, '\xff') + "\x02";
+  reader = Reader::open(data, Kind::DESKTOP);
+  REQUIRE(reader);
+  CHECK_FALSE(reader->integer());
+  // A length past the end of the data
+  data = header + "\x0b" "abc";
+  reader = Reader::open(data, Kind::DESKTOP);
+  REQUIRE(reader);
+  auto string = reader->string();
+  REQUIRE_FALSE(string);
+  CHECK(string.error().contains("Truncated string"));
+}
@@ -0,0 +1,77 @@
+/**
+ * @file test_ed25519.cpp
+ * @brief Unit tests for ed25519.hpp Ed25519 signatures
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <ranges>
+#include <string>
+
+#include "../../../src/lib/ed25519.hpp"
+
+TEST_CASE("ns_ed25519 matches the RFC 8032 examples")
+{
+  auto seed_empty = ns_ed25519::from_hex<32>("9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60");
+  REQUIRE(seed_empty);
+  CHECK_EQ(ns_ed25519::to_hex(ns_ed25519::public_key(*seed_empty).value())
+    , "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a"
+  );
+  CHECK_EQ(ns_ed25519::to_hex(ns_ed25519::sign("", *seed_empty).value())
+    , "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e065224901555fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b"
+  );
+  auto seed_r = ns_ed25519::from_hex<32>("4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb");
+  REQUIRE(seed_r);
+  CHECK_EQ(ns_ed25519::to_hex(ns_ed25519::public_key(*seed_r).value())
+    , "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c"
+  );
+  CHECK_EQ(ns_ed25519::to_hex(ns_ed25519::sign("r", *seed_r).value())
+    , "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00"
+  );
+}
+
+TEST_CASE("ns_ed25519::verify accepts only the signed message and key")
+{
+  auto seed = ns_ed25519::generate();
+  REQUIRE(seed);
+  auto key = ns_ed25519::public_key(*seed);
+  REQUIRE(key);
+  std::string message(300, 'm');
+  auto signature = ns_ed25519::sign(message, *seed);
+  REQUIRE(signature);
+  CHECK(ns_ed25519::verify(message, *signature, *key));
+  // Another message
+  CHECK_FALSE(ns_ed25519::verify(message + "m", *signature, *key));
+  // Another key
+  auto seed_other = ns_ed25519::generate();
+  REQUIRE(seed_other);
+  CHECK_FALSE(ns_ed25519::verify(message, *signature, ns_ed25519::public_key(*seed_other).value()));
+  // A changed signature
+  for(size_t i : {0, 31, 32, 63})
+  {
+    auto signature_changed = *signature;
+    signature_changed[i] ^= 0x10;
+    CHECK_FALSE(ns_ed25519::verify(message, signature_changed, *key));
+  }
+  // The same scalar plus the order of the group, which is not its canonical encoding
+  auto order = ns_ed25519::from_hex<32>("edd3f55c1a631258d69cf7a2def9de1400000000000000000000000000000010");
+  REQUIRE(order);
+  auto signature_malleable = *signature;
+  for(unsigned carry = 0; size_t i : std::views::iota(size_t{0}, size_t{32}))
+  {
+    carry += signature_malleable[32 + i] + (*order)[i];
+    signature_malleable[32 + i] = carry & 0xff;
+    carry >>= 8;
+  }
+  CHECK_FALSE(ns_ed25519::verify(message, signature_malleable, *key));
+}
+
+TEST_CASE("ns_ed25519::from_hex rejects malformed input")
+{
+  CHECK(ns_ed25519::from_hex<2>(" abCD\n"));
+  CHECK_FALSE(ns_ed25519::from_hex<2>("abc"));
+  CHECK_FALSE(ns_ed25519::from_hex<2>("abcde"));
+  CHECK_FALSE(ns_ed25519::from_hex<2>("abcg"));
+  CHECK_FALSE(ns_ed25519::from_hex<2>(""));
+}
@@ -174,3 +174,37 @@ TEST_CASE("ns_elf::copy_binary handles large sections")
   fs::remove(input_file);
   fs::remove(output_file);
 }
+
+TEST_CASE("ns_elf::skip_elf_header reads consecutive ELFs from one descriptor")
+{
+  fs::path elf_binary = "/bin/sh";
+  if (not fs::exists(elf_binary) or not ns_elf::skip_elf_header(elf_binary).has_value())
+  {
+    MESSAGE("System ELF binary /bin/sh not found, skipping test");
+    return;
+  }
+  // Two copies of the same ELF back to back, like the main and boot binaries of an image
+  uint64_t size = ns_elf::skip_elf_header(elf_binary).value();
+  fs::path path_file_image = fs::temp_directory_path() / "test_elf_image.bin";
+  REQUIRE(ns_elf::copy_binary(elf_binary, path_file_image, {0, size}).has_value());
+  {
+    std::ofstream out(path_file_image, std::ios::binary | std::ios::app);
+    std::ifstream in(elf_binary, std::ios::binary);
+    out << in.rdbuf();
+  }
+  int fd = ::open(path_file_image.c_str(), O_RDONLY | O_CLOEXEC);
+  REQUIRE(fd >= 0);
+  CHECK(ns_elf::skip_elf_header(fd).value() == size);
+  CHECK(ns_elf::skip_elf_header(fd, size).value() == size);
+  CHECK_FALSE(ns_elf::skip_elf_header(fd, 1).has_value());
+  // The descriptor is read at explicit offsets, copies do not move it
+  fs::path path_file_output = fs::temp_directory_path() / "test_elf_image_copy.bin";
+  REQUIRE(ns_elf::copy_binary(fd, path_file_output, {size, size * 2}).has_value());
+  CHECK(fs::file_size(path_file_output) == size);
+  CHECK(::lseek(fd, 0, SEEK_CUR) == 0);
+  ::close(fd);
+
+  // Cleanup
+  fs::remove(path_file_image);
+  fs::remove(path_file_output);
+}
@@ -118,6 +118,40 @@ TEST_CASE("ns_env::expand returns string unchanged if no expansion needed")
   CHECK(result.value() == "literal_string");
 }
 
+TEST_CASE("ns_env::is_literal detects strings expand leaves unchanged")
+{
+  CHECK(ns_env::is_literal("/usr/share/icons"));
+  CHECK(ns_env::is_literal("KEY=value with spaces"));
+  CHECK(ns_env::is_literal(""));
+  CHECK_FALSE(ns_env::is_literal("$HOME/data"));
+  CHECK_FALSE(ns_env::is_literal("KEY=${HOME}"));
+  CHECK_FALSE(ns_env::is_literal("~/data"));
+  CHECK_FALSE(ns_env::is_literal("$(echo x)"));
+  CHECK_FALSE(ns_env::is_literal("/data/*"));
+  // Literal strings expand to themselves
+  for(auto str : {"/usr/share/icons", "/a/b~c", "KEY=a=b"})
+  {
+    CHECK(ns_env::is_literal(str));
+    CHECK(ns_env::expand(str).value() == str);
+  }
+}
+
+TEST_CASE("ns_env::expand evaluates shell expansions on every call")
+{
+  setenv("TEST_EXPAND_SHELL", "first", 1);
+  auto first = ns_env::expand("$(printf %s \"$TEST_EXPAND_SHELL\")");
+  setenv("TEST_EXPAND_SHELL", "second", 1);
+  auto second = ns_env::expand("$(printf %s \"$TEST_EXPAND_SHELL\")");
+
+  REQUIRE(first.has_value());
+  REQUIRE(second.has_value());
+  CHECK(first.value() == "first");
+  CHECK(second.value() == "second");
+
+  // Cleanup
+  unsetenv("TEST_EXPAND_SHELL");
+}
+
 TEST_CASE("ns_env::xdg_data_home returns XDG_DATA_HOME if set")
 {
   setenv("XDG_DATA_HOME", "/custom/data/home", 1);
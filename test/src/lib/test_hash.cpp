@@ -0,0 +1,35 @@
+/**
+ * @file test_hash.cpp
+ * @brief Unit tests for hash.hpp XXH64 implementation
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <string>
+#include <string_view>
+
+#include "../../../src/lib/hash.hpp"
+
+TEST_CASE("ns_hash::xxh64 matches the reference implementation")
+{
+  CHECK_EQ(ns_hash::xxh64(""), 0xEF46DB3751D8E999ULL);
+  CHECK_EQ(ns_hash::xxh64("a"), 0xD24EC4F1A98C6E5BULL);
+  CHECK_EQ(ns_hash::xxh64("abc"), 0x44BC2CF5AD770999ULL);
+}
+
+TEST_CASE("ns_hash::Xxh64 gives the same hash for any split of the input")
+{
+  std::string data(1000, '\0');
+  for(size_t i = 0; i < data.size(); ++i) { data[i] = static_cast<char>(i * 7); }
+  uint64_t expected = ns_hash::xxh64(data);
+  for(size_t size_chunk : {1, 3, 13, 32, 33, 999})
+  {
+    ns_hash::Xxh64 hash;
+    for(std::string_view view = data; not view.empty(); view.remove_prefix(std::min(size_chunk, view.size())))
+    {
+      hash.update(view.substr(0, size_chunk));
+    }
+    CHECK_EQ(hash.digest(), expected);
+  }
+}
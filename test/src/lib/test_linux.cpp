@@ -5,14 +5,23 @@
 
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
+#include <ext/stdio_filebuf.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "../../../src/lib/linux.hpp"
+#include "../../../src/lib/linux/fd.hpp"
 
 namespace fs = std::filesystem;
 
@@ -154,3 +163,170 @@ TEST_CASE("ns_linux::read_with_timeout handles empty files")
   // Cleanup
   fs::remove(test_file);
 }
+
+TEST_CASE("ns_linux::ns_fd::redirect_fd_to_fd relays pipes without throttling")
+{
+  constexpr size_t size_total = 256 * 1024 * 1024;
+  int pipe_src[2], pipe_dst[2];
+  REQUIRE_EQ(pipe(pipe_src), 0);
+  REQUIRE_EQ(pipe(pipe_dst), 0);
+  // Writer process, the relay stops once it exits and its output is drained
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    close(pipe_src[0]);
+    std::vector<char> chunk(1 << 16, 'x');
+    for(size_t written = 0; written < size_total;)
+    {
+      ssize_t n = write(pipe_src[1], chunk.data(), std::min(chunk.size(), size_total - written));
+      if(n <= 0) { _exit(1); }
+      written += n;
+    }
+    _exit(0);
+  }
+  close(pipe_src[1]);
+  // Count the relayed bytes
+  size_t size_read = 0;
+  std::jthread reader([&]
+  {
+    std::vector<char> buf(1 << 16);
+    for(ssize_t n; (n = read(pipe_dst[0], buf.data(), buf.size())) > 0;) { size_read += n; }
+  });
+  auto start = std::chrono::steady_clock::now();
+  auto result = ns_linux::ns_fd::redirect_fd_to_fd(pid, pipe_src[0], pipe_dst[1]);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  close(pipe_dst[1]);
+  reader.join();
+  waitpid(pid, nullptr, 0);
+  close(pipe_src[0]);
+  close(pipe_dst[0]);
+  CHECK(result.has_value());
+  CHECK_EQ(size_read, size_total);
+  // A throttled relay of 16 KiB per 50 ms takes over ten minutes
+  CHECK_LT(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), 10);
+}
+
+TEST_CASE("ns_linux::ns_fd::relay forwards input and output of a process in one loop")
+{
+  constexpr size_t size_total = 8 * 1024 * 1024;
+  int pipe_feed[2], pipe_in[2], pipe_out[2], pipe_res[2];
+  REQUIRE_EQ(pipe(pipe_feed), 0);
+  REQUIRE_EQ(pipe(pipe_in), 0);
+  REQUIRE_EQ(pipe(pipe_out), 0);
+  REQUIRE_EQ(pipe(pipe_res), 0);
+  // Copies its input to its output, like cat, both pipes fill up unless the relay moves both ways
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    close(pipe_in[1]);
+    close(pipe_out[0]);
+    std::vector<char> buf(1 << 16);
+    for(ssize_t n; (n = read(pipe_in[0], buf.data(), buf.size())) > 0;)
+    {
+      for(ssize_t offset = 0; offset < n;)
+      {
+        ssize_t written = write(pipe_out[1], buf.data() + offset, n - offset);
+        if(written <= 0) { _exit(1); }
+        offset += written;
+      }
+    }
+    _exit(0);
+  }
+  close(pipe_in[0]);
+  close(pipe_out[1]);
+  fcntl(pipe_in[1], F_SETFL, fcntl(pipe_in[1], F_GETFL) | O_NONBLOCK);
+  fcntl(pipe_out[0], F_SETFL, fcntl(pipe_out[0], F_GETFL) | O_NONBLOCK);
+  std::jthread writer([&]
+  {
+    std::vector<char> chunk(1 << 16, 'x');
+    for(size_t written = 0; written < size_total;)
+    {
+      ssize_t n = write(pipe_feed[1], chunk.data(), std::min(chunk.size(), size_total - written));
+      if(n <= 0) { break; }
+      written += n;
+    }
+    close(pipe_feed[1]);
+  });
+  size_t size_read = 0;
+  std::jthread reader([&]
+  {
+    std::vector<char> buf(1 << 16);
+    for(ssize_t n; (n = read(pipe_res[0], buf.data(), buf.size())) > 0;) { size_read += n; }
+  });
+  std::array<ns_linux::ns_fd::Relay,2> const relays{{
+      { .fd_src = pipe_feed[0], .fd_dst = pipe_in[1], .is_input = true }
+    , { .fd_src = pipe_out[0], .fd_dst = pipe_res[1], .is_input = false }
+  }};
+  // The relay closes the input of the process at the end of the feed, then the process exits
+  auto result = ns_linux::ns_fd::relay(pid, relays);
+  close(pipe_res[1]);
+  writer.join();
+  reader.join();
+  int status = 0;
+  waitpid(pid, &status, 0);
+  close(pipe_feed[0]);
+  close(pipe_out[0]);
+  close(pipe_res[0]);
+  REQUIRE(result.has_value());
+  CHECK_EQ(size_read, size_total);
+  // Both directions are counted
+  CHECK_EQ(*result, 2 * size_total);
+  CHECK(WIFEXITED(status));
+  CHECK_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST_CASE("ns_linux::ns_fd::LineSplitter joins lines split across reads")
+{
+  ns_linux::ns_fd::LineSplitter splitter(8);
+  std::vector<std::string> lines;
+  auto f_line = [&](std::string_view line) { lines.emplace_back(line); };
+  auto f_feed = [&](std::string_view data)
+  {
+    std::span<char> buf = splitter.free();
+    REQUIRE_LE(data.size(), buf.size());
+    std::ranges::copy(data, buf.begin());
+    splitter.commit(data.size(), f_line);
+  };
+  // A line that spans two reads, and a carriage return that ends a line
+  f_feed("ab");
+  f_feed("c\nd\re");
+  // A line without a terminator that fills the buffer is handed over as is
+  f_feed("fghijkl");
+  f_feed("m");
+  splitter.flush(f_line);
+  CHECK_EQ(lines, std::vector<std::string>{"abc", "d", "efghijkl", "m"});
+}
+
+TEST_CASE("ns_linux::ns_fd::redirect_stream_to_fd polls streams backed by a file descriptor")
+{
+  int pipe_src[2], pipe_dst[2];
+  REQUIRE_EQ(pipe(pipe_src), 0);
+  REQUIRE_EQ(pipe(pipe_dst), 0);
+  // Stays alive until its input ends
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    close(pipe_dst[1]);
+    std::string data(64, '\0');
+    ssize_t n = read(pipe_dst[0], data.data(), data.size());
+    char c;
+    _exit((n == 5 and data.starts_with("hello") and read(pipe_dst[0], &c, 1) == 0)? 0 : 1);
+  }
+  close(pipe_dst[0]);
+  REQUIRE_EQ(write(pipe_src[1], "hello", 5), 5);
+  close(pipe_src[1]);
+  __gnu_cxx::stdio_filebuf<char> buf(pipe_src[0], std::ios::in);
+  std::istream stream(&buf);
+  REQUIRE_EQ(ns_linux::ns_fd::stream_fd(stream), pipe_src[0]);
+  // The end of the source ends the redirection
+  auto result = ns_linux::ns_fd::redirect_stream_to_fd(pid, stream, pipe_dst[1]);
+  close(pipe_dst[1]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  CHECK(result.has_value());
+  CHECK(WIFEXITED(status));
+  CHECK_EQ(WEXITSTATUS(status), 0);
+}
@@ -6,6 +6,7 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <string>
@@ -90,8 +91,8 @@ TEST_CASE("Logger writes to file when configured")
   // Write a log message using the logger macro
   logger("I::Test log message");
 
-  // Give it a moment to flush
-  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  // Messages below the warning level are buffered
+  ns_log::flush();
 
   // Check file exists and has content
   REQUIRE(fs::exists(log_file));
@@ -137,7 +138,7 @@ TEST_CASE("Logger supports format arguments")
   std::string text = "test";
   logger("I::Value is {} and text is {}", value, text);
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ns_log::flush();
 
   // Verify file exists
   REQUIRE(fs::exists(log_file));
@@ -172,4 +173,45 @@ TEST_CASE("Logger quiet mode discards messages")
   {
     fs::remove(log_file);
   }
-}
\ No newline at end of file
+}
+TEST_CASE("Logger buffers messages below the warning level until flushed")
+{
+  fs::path log_file = fs::temp_directory_path() / "test_logger_buffer.log";
+  ns_log::set_sink_file(log_file);
+  auto f_content = [&]
+  {
+    std::ifstream file(log_file);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  };
+  // Stays in the buffer, the sink was just opened
+  logger("D::Buffered message");
+  CHECK_EQ(f_content().find("Buffered message"), std::string::npos);
+  // Errors are written immediately, along with the buffered messages
+  logger("E::Error message");
+  CHECK_NE(f_content().find("Buffered message"), std::string::npos);
+  CHECK_NE(f_content().find("Error message"), std::string::npos);
+  fs::remove(log_file);
+  ns_log::set_sink_file("/dev/null");
+}
+
+TEST_CASE("Logger rotates the sink file once it reaches the maximum size")
+{
+  fs::path log_file = fs::temp_directory_path() / "test_logger_rotate.log";
+  fs::path log_file_backup = fs::path(log_file).concat(".1");
+  fs::remove(log_file_backup);
+  // The limit is read when the sink is opened
+  REQUIRE_EQ(::setenv("FIM_LOG_MAX_SIZE", "1024", 1), 0);
+  ns_log::set_sink_file(log_file);
+  for(int i = 0; i < 100; ++i)
+  {
+    logger("E::Message number {} to fill the sink file", i);
+  }
+  ns_log::flush();
+  REQUIRE(fs::exists(log_file_backup));
+  CHECK_GE(fs::file_size(log_file_backup), 1024);
+  CHECK_LT(fs::file_size(log_file), 1024);
+  ::unsetenv("FIM_LOG_MAX_SIZE");
+  ns_log::set_sink_file("/dev/null");
+  fs::remove(log_file);
+  fs::remove(log_file_backup);
+}
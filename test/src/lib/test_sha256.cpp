@@ -0,0 +1,58 @@
+/**
+ * @file test_sha256.cpp
+ * @brief Unit tests for sha256.hpp SHA-256 implementation
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+#include "../../../src/lib/sha256.hpp"
+
+TEST_CASE("ns_sha256::sha256 matches the FIPS 180-4 examples")
+{
+  CHECK_EQ(ns_sha256::sha256(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  CHECK_EQ(ns_sha256::sha256("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  CHECK_EQ(ns_sha256::sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")
+    , "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+  );
+  CHECK_EQ(ns_sha256::sha256(std::string(1000000, 'a'))
+    , "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+  );
+}
+
+TEST_CASE("ns_sha256::Sha256 gives the same hash for any split of the input")
+{
+  std::string data(1000, '\0');
+  for(size_t i = 0; i < data.size(); ++i) { data[i] = static_cast<char>(i * 7); }
+  std::string expected = ns_sha256::sha256(data);
+  for(size_t size_chunk : {1, 3, 55, 56, 64, 65, 999})
+  {
+    ns_sha256::Sha256 hash;
+    for(std::string_view view = data; not view.empty(); view.remove_prefix(std::min(size_chunk, view.size())))
+    {
+      hash.update(view.substr(0, size_chunk));
+    }
+    CHECK_EQ(hash.hex(), expected);
+  }
+}
+
+TEST_CASE("ns_sha256::sha256 hashes a region of a file")
+{
+  FILE* file = std::tmpfile();
+  REQUIRE(file != nullptr);
+  std::string data = "prefix:abc:suffix";
+  REQUIRE(::write(::fileno(file), data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+
+  auto hash = ns_sha256::sha256(::fileno(file), 7, 3);
+  REQUIRE(hash.has_value());
+  CHECK_EQ(*hash, ns_sha256::sha256("abc"));
+  // A region past the end of the file is an error
+  CHECK_FALSE(ns_sha256::sha256(::fileno(file), 7, 100).has_value());
+
+  std::fclose(file);
+}
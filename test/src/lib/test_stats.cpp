@@ -0,0 +1,55 @@
+/**
+ * @file test_stats.cpp
+ * @brief Unit tests for stats.hpp runtime counters
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../../src/lib/stats.hpp"
+
+namespace fs = std::filesystem;
+
+TEST_CASE("ns_stats::read returns zeros without a stats file")
+{
+  fs::path path_dir = fs::temp_directory_path() / ("fim_test_stats_empty_" + std::to_string(getpid()));
+  fs::create_directories(path_dir);
+  auto counters = ns_stats::read(path_dir);
+  REQUIRE(counters.has_value());
+  for(uint64_t value : *counters) { CHECK_EQ(value, 0); }
+  fs::remove_all(path_dir);
+}
+
+TEST_CASE("ns_stats counters are shared with forked processes")
+{
+  using ns_stats::Counter;
+  fs::path path_dir = fs::temp_directory_path() / ("fim_test_stats_" + std::to_string(getpid()));
+  fs::create_directories(path_dir);
+  // The counters are mapped on the first update
+  REQUIRE_EQ(::setenv("FIM_DIR_INSTANCE", path_dir.c_str(), 1), 0);
+  ns_stats::add(Counter::PORTAL_REQUESTS);
+  ns_stats::max(Counter::PORTAL_LATENCY_MAX_US, 20);
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if(pid == 0)
+  {
+    ns_stats::add(Counter::PORTAL_REQUESTS, 2);
+    ns_stats::max(Counter::PORTAL_LATENCY_MAX_US, 10);
+    ns_stats::max(Counter::PORTAL_LATENCY_MAX_US, 30);
+    _exit(0);
+  }
+  int status{};
+  REQUIRE_EQ(::waitpid(pid, &status, 0), pid);
+  auto counters = ns_stats::read(path_dir);
+  REQUIRE(counters.has_value());
+  CHECK_EQ(counters->at(static_cast<size_t>(Counter::PORTAL_REQUESTS)), 3);
+  CHECK_EQ(counters->at(static_cast<size_t>(Counter::PORTAL_LATENCY_MAX_US)), 30);
+  CHECK_EQ(counters->at(static_cast<size_t>(Counter::SPAWNS)), 0);
+  fs::remove_all(path_dir);
+}
@@ -9,6 +9,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <csignal>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -366,3 +368,90 @@ TEST_CASE("Subprocess handles exit codes correctly")
   REQUIRE(exit_code);
   CHECK_EQ(*exit_code, 42);
 }
+
+TEST_CASE("Subprocess::spawn without a child callback captures pipes like the fork path")
+{
+  // Without a callback the child is created with clone(CLONE_VM | CLONE_VFORK)
+  std::ostringstream out_vfork;
+  auto code_vfork = Subprocess("/bin/sh")
+    .with_args("-c", "echo hello; echo world 1>&2")
+    .with_stdio(Stream::Pipe)
+    .with_streams(std::cin, out_vfork, out_vfork)
+    .spawn()
+    ->wait();
+  // The callback forces a fork
+  std::ostringstream out_fork;
+  auto code_fork = Subprocess("/bin/sh")
+    .with_args("-c", "echo hello; echo world 1>&2")
+    .with_stdio(Stream::Pipe)
+    .with_streams(std::cin, out_fork, out_fork)
+    .with_callback_child([](ArgsCallbackChild){})
+    .spawn()
+    ->wait();
+  REQUIRE(code_vfork);
+  REQUIRE(code_fork);
+  CHECK_EQ(*code_vfork, 0);
+  CHECK_EQ(*code_fork, 0);
+  CHECK_NE(out_vfork.str().find("hello"), std::string::npos);
+  CHECK_NE(out_vfork.str().find("world"), std::string::npos);
+  CHECK_EQ(out_vfork.str().size(), out_fork.str().size());
+}
+
+TEST_CASE("Subprocess::spawn without a child callback reports failures of the child")
+{
+  // The program does not exist
+  auto code_missing = Subprocess("/definitely/not/a/program").with_stdio(Stream::Null).spawn()->wait();
+  REQUIRE(code_missing);
+  CHECK_EQ(*code_missing, 1);
+  // The pid to die with is not running
+  pid_t pid_dead = fork();
+  REQUIRE(pid_dead >= 0);
+  if(pid_dead == 0) { _exit(0); }
+  waitpid(pid_dead, nullptr, 0);
+  auto code_dead = Subprocess("/bin/true").with_die_on_pid(pid_dead).spawn()->wait();
+  REQUIRE(code_dead);
+  CHECK_EQ(*code_dead, 1);
+}
+
+TEST_CASE("ns_subprocess::WaitSet reports exits of many children without reaping them")
+{
+  using namespace std::chrono_literals;
+  auto child_fast = Subprocess("/bin/sh").with_args("-c", "exit 3").spawn();
+  auto child_slow = Subprocess("/bin/sleep").with_args("10").spawn();
+  WaitSet wait_set;
+  wait_set.add(*child_fast);
+  wait_set.add(*child_slow);
+  // The fast child is reported, the slow one stays in the set
+  std::vector<Exit> exits;
+  for(int i = 0; i < 50 and exits.empty(); ++i)
+  {
+    exits = wait_set.wait(100ms).value_or(std::vector<Exit>{});
+  }
+  REQUIRE_EQ(exits.size(), 1);
+  CHECK_EQ(exits[0].pid, child_fast->get_pid().value_or(-1));
+  CHECK_EQ(exits[0].code, 3);
+  CHECK_FALSE(wait_set.empty());
+  // Signals are reported as such
+  child_slow->kill(SIGKILL);
+  exits = wait_set.wait(5s).value_or(std::vector<Exit>{});
+  REQUIRE_EQ(exits.size(), 1);
+  CHECK_EQ(exits[0].signal, SIGKILL);
+  CHECK(wait_set.empty());
+  // The children were not reaped, their handles still collect the exit
+  auto code_fast = child_fast->wait();
+  REQUIRE(code_fast);
+  CHECK_EQ(*code_fast, 3);
+  CHECK_FALSE(child_slow->wait());
+}
+
+TEST_CASE("ns_subprocess::Child::wait returns nothing while the child runs past the timeout")
+{
+  using namespace std::chrono_literals;
+  auto child = Subprocess("/bin/sleep").with_args("10").spawn();
+  auto code_running = child->wait(50ms);
+  REQUIRE(code_running);
+  CHECK_FALSE(code_running->has_value());
+  child->kill(SIGTERM);
+  CHECK_FALSE(child->wait(5s));
+  CHECK_FALSE(child->get_pid());
+}
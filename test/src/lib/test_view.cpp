@@ -0,0 +1,120 @@
+/**
+ * @file test_view.cpp
+ * @brief Unit tests for view.hpp read-only json view
+ */
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../../../src/db/view.hpp"
+
+using ns_db::View;
+
+TEST_CASE("ns_db::View looks up strings, arrays and nested objects")
+{
+  std::string_view json = R"( {
+    "command": ["sh", "-c", "echo ]}"],
+    "number": 42,
+    "nested": { "key": "value", "empty": {} },
+    "path": "/tmp/fifo"
+  } )";
+  View view(json);
+  std::vector<std::string> const command{"sh", "-c", "echo ]}"};
+  CHECK_EQ(view("command").value<std::vector<std::string>>().value(), command);
+  CHECK_EQ(view("nested")("key").value<std::string>().value(), "value");
+  CHECK_EQ(view("path").value<std::string>().value(), "/tmp/fifo");
+  CHECK_EQ(view("number").json().value(), "42");
+  CHECK_EQ(view("nested")("empty").json().value(), "{}");
+  CHECK_EQ(view("command").json().value(), R"(["sh", "-c", "echo ]}"])");
+}
+
+TEST_CASE("ns_db::View reports missing keys and mismatched types")
+{
+  View view(R"({"a": "b", "n": 1, "o": {}})");
+  auto missing = view("c").value<std::string>();
+  REQUIRE_FALSE(missing);
+  CHECK(missing.error().contains("Key 'c' not found"));
+  // Errors propagate through nested lookups
+  CHECK_FALSE(view("c")("d").value<std::string>());
+  CHECK_FALSE(view("a")("b").value<std::string>());
+  CHECK_FALSE(view("n").value<std::string>());
+  CHECK_FALSE(view("o").value<std::vector<std::string>>());
+  CHECK_FALSE(View(R"(["a"])")("a").value<std::string>());
+}
+
+TEST_CASE("ns_db::View decodes escapes")
+{
+  View view(R"({
+    "simple": "a\"b\\c\/d",
+    "control": "\b\f\n\r\t",
+    "unicode": "\u00e9\u20AC",
+    "pair": "\ud83d\ude00",
+    "k\u0065y": "escaped key",
+    "array": ["\"", "A"]
+  })");
+  CHECK_EQ(view("simple").value<std::string>().value(), "a\"b\\c/d");
+  CHECK_EQ(view("control").value<std::string>().value(), "\b\f\n\r\t");
+  CHECK_EQ(view("unicode").value<std::string>().value(), "\xc3\xa9\xe2\x82\xac");
+  CHECK_EQ(view("pair").value<std::string>().value(), "\xf0\x9f\x98\x80");
+  CHECK_EQ(view("key").value<std::string>().value(), "escaped key");
+  std::vector<std::string> const array{"\"", "A"};
+  CHECK_EQ(view("array").value<std::vector<std::string>>().value(), array);
+}
+
+TEST_CASE("ns_db::View rejects malformed escapes")
+{
+  View view(R"({
+    "invalid": "\x",
+    "hex": "\u12g4",
+    "short": "\u12",
+    "surrogate": "\ud83dA",
+    "low": "\ude00"
+  })");
+  auto invalid = view("invalid").value<std::string>();
+  REQUIRE_FALSE(invalid);
+  CHECK(invalid.error().contains("Invalid json escape"));
+  CHECK_FALSE(view("hex").value<std::string>());
+  CHECK_FALSE(view("short").value<std::string>());
+  auto surrogate = view("surrogate").value<std::string>();
+  REQUIRE_FALSE(surrogate);
+  CHECK(surrogate.error().contains("surrogate"));
+  CHECK_FALSE(view("low").value<std::string>());
+}
+
+TEST_CASE("ns_db::View rejects incomplete documents")
+{
+  // Unclosed objects, arrays and strings
+  for(std::string_view json : {R"({"a": "b")", R"({"a": ["b")", R"({"a": "b)", R"({"a)", "{", ""})
+  {
+    CAPTURE(json);
+    auto value = View(json)("a").value<std::string>();
+    CHECK_FALSE(value);
+    CHECK_FALSE(View(json).json());
+  }
+  // Truncations of a valid document
+  std::string_view json = R"({"a": {"b": ["c", "d"]}, "e": "f"})";
+  for(size_t size = 0; size < json.size(); ++size)
+  {
+    CAPTURE(size);
+    CHECK_FALSE(View(json.substr(0, size))("e").value<std::string>());
+  }
+  CHECK_EQ(View(json)("e").value<std::string>().value(), "f");
+}
+
+TEST_CASE("ns_db::View rejects trailing characters")
+{
+  // Whitespace is allowed
+  CHECK_EQ(View(" {\"a\": \"b\"} \n\t").json().value(), R"({"a": "b"})");
+  for(std::string_view json : {R"({"a": "b"} x)", R"({"a": "b"}})", R"({"a": "b"}{"a": "c"})", R"({"a": "b"},)"})
+  {
+    CAPTURE(json);
+    auto value = View(json)("a").value<std::string>();
+    REQUIRE_FALSE(value);
+    CHECK(value.error().contains("Trailing characters"));
+    CHECK_FALSE(View(json).json());
+  }
+}
@@ -7,6 +7,7 @@
 #include <doctest/doctest.h>
 
 #include <string>
+#include <string_view>
 
 #include "../../../src/std/enum.hpp"
 
@@ -87,6 +88,24 @@ TEST_CASE("ENUM from_string returns error for invalid strings")
   CHECK_FALSE(result.has_value());
 }
 
+TEST_CASE("ENUM from_string rejects prefixes and extensions of names")
+{
+  CHECK_FALSE(Status::from_string("RUN").has_value());
+  CHECK_FALSE(Status::from_string("RUNNINGX").has_value());
+  CHECK_FALSE(Status::from_string("").has_value());
+  CHECK(Status::from_string("x").error() == "Could not determine enum entry from 'X'");
+}
+
+TEST_CASE("ENUM from_string finds every entry from a string_view")
+{
+  std::string_view names = "pending,running,completed,failed,none";
+  CHECK(Status::from_string(names.substr(0, 7)).value() == Status::enum_t::PENDING);
+  CHECK(Status::from_string(names.substr(8, 7)).value() == Status::enum_t::RUNNING);
+  CHECK(Status::from_string(names.substr(16, 9)).value() == Status::enum_t::COMPLETED);
+  CHECK(Status::from_string(names.substr(26, 6)).value() == Status::enum_t::FAILED);
+  CHECK(Status::from_string(names.substr(33, 4)).value() == Status::enum_t::NONE);
+}
+
 TEST_CASE("ENUM supports comparison operators")
 {
   Color red = Color::RED;
@@ -643,6 +643,40 @@ TEST_CASE("Error macro with format arguments")
   CHECK(LogCapture::extract_log_message(logs[0]) == "E::Error code: 404");
 }
 
+TEST_CASE("Error macro logs the same message it stores")
+{
+  LogCapture capture;
+
+  auto test_func = [](std::string const& name) -> Value<int>
+  {
+    return Error("W::Invalid name '{}'", name);
+  };
+
+  // Braces in the arguments are not interpreted again by the logger
+  auto result = test_func("{}");
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error() == "Invalid name '{}'");
+
+  auto logs = capture.read_logs();
+  REQUIRE(logs.size() == 1);
+  CHECK(LogCapture::extract_log_message(logs[0]) == "W::Invalid name '{}'");
+}
+
+TEST_CASE("Error macro with quiet level is not logged")
+{
+  LogCapture capture;
+
+  auto test_func = []() -> Value<int>
+  {
+    return Error("Q::Quiet error {}", 1);
+  };
+
+  auto result = test_func();
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error() == "Quiet error 1");
+  CHECK(capture.read_logs().empty());
+}
+
 // ============================================================================
 // discard/forward MACRO TESTS
 // ============================================================================
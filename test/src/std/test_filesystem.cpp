@@ -112,6 +112,37 @@ TEST_CASE("ns_fs::create_directories returns existing directory")
   fs::remove(temp_path);
 }
 
+TEST_CASE("ns_fs::create_private_directory creates a directory only the user can access")
+{
+  fs::path temp_path = fs::temp_directory_path() / "test_private" / "cache";
+  fs::remove_all(temp_path.parent_path());
+
+  auto result = ns_fs::create_private_directory(temp_path);
+
+  REQUIRE(result.has_value());
+  CHECK((fs::status(temp_path).permissions() & fs::perms::all) == fs::perms::owner_all);
+  // An existing private directory is accepted
+  CHECK(ns_fs::create_private_directory(temp_path).has_value());
+
+  // Cleanup
+  fs::remove_all(temp_path.parent_path());
+}
+
+TEST_CASE("ns_fs::create_private_directory rejects shared directories and symlinks")
+{
+  fs::path temp_path = fs::temp_directory_path() / "test_private_shared";
+  fs::remove_all(temp_path);
+  fs::create_directories(temp_path / "target");
+  fs::permissions(temp_path, fs::perms::all);
+  fs::create_directory_symlink(temp_path / "target", temp_path / "link");
+
+  CHECK_FALSE(ns_fs::create_private_directory(temp_path).has_value());
+  CHECK_FALSE(ns_fs::create_private_directory(temp_path / "link").has_value());
+
+  // Cleanup
+  fs::remove_all(temp_path);
+}
+
 TEST_CASE("ns_fs::placeholders_replace substitutes path components")
 {
   fs::path template_path = "/home/{}/documents/{}";
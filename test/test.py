@@ -22,6 +22,9 @@ from cli.boot.cli import TestFimBootCLI
 from cli.casefold.on import TestFimCasefoldOn
 from cli.casefold.off import TestFimCasefoldOff
 
+# Config tests
+from cli.config.apply import TestFimConfigApply
+
 # Desktop tests
 from cli.desktop.setup import TestFimDesktopSetup
 from cli.desktop.enable import TestFimDesktopEnable
@@ -39,21 +42,40 @@ from cli.environment.identity import TestFimEnvIdentity
 
 # Exec tests
 from cli.execute.execute import TestFimExec
+from cli.execute.trace import TestFimExecTrace
 
 # # Instance tests
 from cli.instance.cli import TestFimInstanceCli
 from cli.instance.exec import TestFimInstanceExec
 from cli.instance.list import TestFimInstanceList
+from cli.instance.serve import TestFimInstanceServe
+from cli.instance.share import TestFimInstanceShare
+from cli.instance.concurrent import TestFimInstanceConcurrent
+from cli.instance.supervisor import TestFimInstanceSupervisor
 
 # Layer tests
 from cli.layer.commit import TestFimLayerCommit
 from cli.layer.create import TestFimLayerCreate
 from cli.layer.list import TestFimLayerList
+from cli.layer.squash import TestFimLayerSquash
+from cli.layer.rebase import TestFimLayerRebase
+from cli.layer.verify import TestFimLayerVerify
+from cli.layer.snapshot import TestFimLayerSnapshot
+from cli.layer.lazy import TestFimLayerLazy
+from cli.layer.remove import TestFimLayerRemove
+from cli.layer.remote import TestFimLayerRemote
+
+# Limit tests
+from cli.limit.set import TestFimLimitSet
 
 # Overlay tests
 from cli.overlay.set import TestFimOverlaySet
 from cli.overlay.show import TestFimOverlayShow
 
+# Perf tests
+from cli.perf.set import TestFimPerfSet
+from cli.bench.overlay import TestFimBenchOverlay
+
 # Permissions tests
 from cli.permissions.add import TestFimPermsAdd
 from cli.permissions.delete import TestFimPermsDel
@@ -80,6 +102,12 @@ from cli.remote.workflow import TestFimRemoteWorkflow
 # Root tests
 from cli.root.root import TestFimRoot
 
+# Startup tests
+from cli.startup.startup import TestFimStartup
+
+# Stats tests
+from cli.stats.show import TestFimStats
+
 # Unshare tests
 from cli.unshare.add import TestFimUnshareAdd
 from cli.unshare.set import TestFimUnshareSet
@@ -87,11 +115,18 @@ from cli.unshare.delete import TestFimUnshareDel
 from cli.unshare.clear import TestFimUnshareClear
 from cli.unshare.list import TestFimUnshareList
 
+# Update tests
+from cli.update.apply import TestFimUpdate
+
 # Version tests
 from cli.version.deps import TestFimVersionDeps
 from cli.version.full import TestFimVersionFull
 from cli.version.short import TestFimVersionShort
 
+# Volatile tests
+from cli.volatile.on import TestFimVolatileOn
+from cli.volatile.off import TestFimVolatileOff
+
 # Misc tests
 from misc.fim_dir_data import TestFimDirData
 from misc.fim_layers import TestFimLayers
@@ -110,6 +145,8 @@ def suite():
   # Casefold tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimCasefoldOn))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimCasefoldOff))
+  # Config tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimConfigApply))
   # Desktop tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimDesktopSetup))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimDesktopEnable))
@@ -125,17 +162,34 @@ def suite():
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimEnvIdentity))
   # Exec tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimExec))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimExecTrace))
   # Instance tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceCli))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceExec))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceList))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceServe))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceShare))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceConcurrent))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimInstanceSupervisor))
   # Layer tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerCommit))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerCreate))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerList))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerSquash))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerRebase))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerVerify))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerSnapshot))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerLazy))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerRemove))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayerRemote))
+  # Limit tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLimitSet))
   # Overlay tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimOverlaySet))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimOverlayShow))
+  # Perf tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimPerfSet))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimBenchOverlay))
   # Permissions tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimPermsAdd))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimPermsDel))
@@ -157,16 +211,25 @@ def suite():
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimRemoteWorkflow))
   # Root tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimRoot))
+  # Startup tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimStartup))
+  # Stats tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimStats))
   # Unshare tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUnshareAdd))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUnshareSet))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUnshareDel))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUnshareClear))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUnshareList))
+  # Update tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimUpdate))
   # Version tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimVersionDeps))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimVersionFull))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimVersionShort))
+  # Volatile tests
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimVolatileOn))
+  suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimVolatileOff))
   # Misc tests
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimDirData))
   suite.addTest(unittest.TestLoader().loadTestsFromTestCase(TestFimLayers))